@@ -0,0 +1,544 @@
+/*!
+ * @file source/client/main.c
+ *
+ * @brief This file contains the entry point for the client program.
+ *
+ *          The client sends a stream of balance requests, keeping up to
+ *              a window of them in flight, and reports the rate and the
+ *              mean round trip time. Requests go over TCP, or over the
+ *              server's shared-memory segment when one is named. The
+ *              benchmark mode runs the same load over both, one after
+ *              the other.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "../common/msg.h"
+#include "../common/shm.h"
+
+/*!
+ * @brief The default server address and port.
+ */
+#define CLIENT_DEFAULT_HOST "127.0.0.1"
+#define CLIENT_DEFAULT_PORT 8000
+
+/*!
+ * @brief The default number of requests sent.
+ */
+#define CLIENT_DEFAULT_COUNT 100000
+
+/*!
+ * @brief The default and the largest number of requests in flight.
+ */
+#define CLIENT_DEFAULT_WINDOW 32
+#define CLIENT_MAX_WINDOW 4096
+
+/*!
+ * @brief This datatype defines a transport, as the functions sending a
+ *          request frame and receiving a response frame, in order.
+ *
+ * @param send_func Sends a request frame. Returns 0 on success.
+ * @param recv_func Waits for the next response frame. Returns 0 on
+ *          success.
+ * @param p_ctx The transport's connection.
+ */
+typedef struct _client_transport
+{
+    int    (* send_func) (void * p_ctx, const unsigned char * p_request);
+    int    (* recv_func) (void * p_ctx, unsigned char * p_response);
+    void * p_ctx;
+} client_transport_t;
+
+/*!
+ * @brief This datatype defines the result of a run.
+ *
+ * @param num_reqs The number of requests answered.
+ * @param seconds The time the run took.
+ * @param total_ns The sum of the requests' round trip times.
+ */
+typedef struct _client_result
+{
+    size_t num_reqs;
+    double seconds;
+    double total_ns;
+} client_result_t;
+
+/*!
+ * @brief This is a static function that reads the monotonic clock.
+ *
+ * @return The time in nanoseconds.
+ */
+static uint64_t
+client_now (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000u) + (uint64_t) now.tv_nsec;
+}
+
+/*!
+ * @brief This is a static function that connects to the server over TCP.
+ *
+ * @param[in] p_host The server's IPv4 address.
+ * @param[in] port The server's port.
+ *
+ * @return The socket. -1 on error.
+ */
+static int
+client_tcp_connect (const char * p_host, const uint16_t port)
+{
+    int fd = -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (1 != inet_pton(AF_INET, p_host, &(addr.sin_addr)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+    {
+        goto EXIT;
+    }
+    int one = 1;
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (-1 == connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        close(fd);
+        fd = -1;
+    }
+    
+    EXIT:
+        return fd;
+}
+
+/*!
+ * @brief This is a static function that sends a request frame over TCP.
+ *
+ * @param[in] p_ctx Pointer to the socket.
+ * @param[in] p_request The request frame.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+client_tcp_send (void * p_ctx, const unsigned char * p_request)
+{
+    int status = -1;
+    int fd = *(int *) p_ctx;
+    size_t sent = 0;
+    while (sent < MSG_REQ_SIZE)
+    {
+        ssize_t ret = send(fd, p_request + sent, MSG_REQ_SIZE - sent, MSG_NOSIGNAL);
+        if (ret <= 0)
+        {
+            if ((-1 == ret) &&
+                (EINTR == errno))
+            {
+                continue;
+            }
+            goto EXIT;
+        }
+        sent += (size_t) ret;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that receives a response frame over
+ *          TCP.
+ *
+ * @param[in] p_ctx Pointer to the socket.
+ * @param[out] p_response The response frame.
+ *
+ * @return 0 on success, -1 on error or if the server closed the
+ *          connection.
+ */
+static int
+client_tcp_recv (void * p_ctx, unsigned char * p_response)
+{
+    int status = -1;
+    int fd = *(int *) p_ctx;
+    size_t received = 0;
+    while (received < MSG_RESP_SIZE)
+    {
+        ssize_t ret = recv(fd, p_response + received, MSG_RESP_SIZE - received, 0);
+        if (ret <= 0)
+        {
+            if ((-1 == ret) &&
+                (EINTR == errno))
+            {
+                continue;
+            }
+            goto EXIT;
+        }
+        received += (size_t) ret;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that sends a request frame over the
+ *          shared-memory segment.
+ *
+ * @param[in] p_ctx The client's view of the segment.
+ * @param[in] p_request The request frame.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+client_shm_send (void * p_ctx, const unsigned char * p_request)
+{
+    return shm_send(p_ctx, p_request);
+}
+
+/*!
+ * @brief This is a static function that waits for a response frame over
+ *          the shared-memory segment.
+ *
+ * @param[in] p_ctx The client's view of the segment.
+ * @param[out] p_response The response frame.
+ *
+ * @return 0 on success, -1 on error or if the server is gone.
+ */
+static int
+client_shm_recv (void * p_ctx, unsigned char * p_response)
+{
+    return shm_recv(p_ctx, p_response, true);
+}
+
+/*!
+ * @brief This is a static function that sends count balance requests,
+ *          keeping up to window of them in flight, and checks each
+ *          response echoes its request's session id.
+ *
+ * @param[in] p_transport The transport.
+ * @param[in] count The number of requests.
+ * @param[in] window The most requests in flight.
+ * @param[out] p_result The result.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+client_run (const client_transport_t * p_transport, const size_t count, const size_t window,
+            client_result_t * p_result)
+{
+    int status = -1;
+    uint64_t * p_sent_at = calloc(window, sizeof(uint64_t));
+    if (NULL == p_sent_at)
+    {
+        goto EXIT;
+    }
+    
+    msg_request_t request;
+    msg_response_t response;
+    size_t num_sent = 0;
+    size_t num_recv = 0;
+    double total_ns = 0;
+    uint64_t start = client_now();
+    while (num_recv < count)
+    {
+        // Fill the window, then wait for the oldest response.
+        while ((num_sent < count) &&
+               ((num_sent - num_recv) < window))
+        {
+            uint32_t sid = (uint32_t) num_sent + 1;
+            (void) msg_request_encode(&request, MSG_OP_ACCOUNT_BALANCE, sid, NULL, NULL, 0);
+            p_sent_at[num_sent % window] = client_now();
+            if (-1 == p_transport->send_func(p_transport->p_ctx, (unsigned char *) &request))
+            {
+                goto EXIT;
+            }
+            num_sent++;
+        }
+        if (-1 == p_transport->recv_func(p_transport->p_ctx, (unsigned char *) &response))
+        {
+            goto EXIT;
+        }
+        total_ns += (double) (client_now() - p_sent_at[num_recv % window]);
+        if ((uint32_t) num_recv + 1 != msg_response_sid(&response))
+        {
+            fprintf(stderr, "response %zu has session id %u\n", num_recv,
+                    msg_response_sid(&response));
+            errno = EPROTO;
+            goto EXIT;
+        }
+        num_recv++;
+    }
+    
+    p_result->num_reqs = num_recv;
+    p_result->seconds = (double) (client_now() - start) / 1e9;
+    p_result->total_ns = total_ns;
+    status = 0;
+    
+    EXIT:
+        free(p_sent_at);
+        p_sent_at = NULL;
+        return status;
+}
+
+/*!
+ * @brief This is a static function that prints a run's result.
+ *
+ * @param[in] p_label The transport's name.
+ * @param[in] p_result The result.
+ *
+ * @return No return value expected.
+ */
+static void
+client_report (const char * p_label, const client_result_t * p_result)
+{
+    printf("%-6s %zu requests in %.3f s: %.0f req/s, mean round trip %.1f us\n", p_label,
+           p_result->num_reqs, p_result->seconds,
+           (double) p_result->num_reqs / p_result->seconds,
+           (p_result->total_ns / (double) p_result->num_reqs) / 1e3);
+}
+
+/*!
+ * @brief This is a static function that runs the load over TCP.
+ *
+ * @param[in] p_host The server's IPv4 address.
+ * @param[in] port The server's port.
+ * @param[in] count The number of requests.
+ * @param[in] window The most requests in flight.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+client_bench_tcp (const char * p_host, const uint16_t port, const size_t count,
+                  const size_t window)
+{
+    int status = -1;
+    int fd = client_tcp_connect(p_host, port);
+    if (-1 == fd)
+    {
+        perror("connect");
+        goto EXIT;
+    }
+    
+    client_transport_t transport = {client_tcp_send, client_tcp_recv, &fd};
+    client_result_t result;
+    if (-1 == client_run(&transport, count, window, &result))
+    {
+        perror("tcp");
+        goto EXIT;
+    }
+    client_report("tcp", &result);
+    status = 0;
+    
+    EXIT:
+        if (-1 != fd)
+        {
+            close(fd);
+        }
+        return status;
+}
+
+/*!
+ * @brief This is a static function that runs the load over the
+ *          shared-memory segment. The window is capped at the channel
+ *          depth.
+ *
+ * @param[in] p_name The segment's name.
+ * @param[in] count The number of requests.
+ * @param[in] window The most requests in flight.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+client_bench_shm (const char * p_name, const size_t count, const size_t window)
+{
+    int status = -1;
+    shm_t * p_shm = shm_attach(p_name);
+    if (NULL == p_shm)
+    {
+        perror("shm_attach");
+        goto EXIT;
+    }
+    
+    client_transport_t transport = {client_shm_send, client_shm_recv, p_shm};
+    client_result_t result;
+    size_t depth = shm_depth(p_shm);
+    if (-1 == client_run(&transport, count, (window < depth) ? window : depth, &result))
+    {
+        perror("shm");
+        goto EXIT;
+    }
+    client_report("shm", &result);
+    status = 0;
+    
+    EXIT:
+        shm_detach(p_shm);
+        p_shm = NULL;
+        return status;
+}
+
+/*!
+ * @brief This is a static function that prints the program's usage.
+ *
+ * @param[in] p_prog The program name.
+ *
+ * @return No return value expected.
+ */
+static void
+usage (const char * p_prog)
+{
+    fprintf(stderr,
+            "usage: %s [-H host] [-p port] [-s shm_name] [-n count] [-w window] [-b]\n"
+            "  -H host       server IPv4 address (default %s)\n"
+            "  -p port       server TCP port (default %d)\n"
+            "  -s shm_name   use the server's shared-memory segment instead of TCP\n"
+            "  -n count      number of requests to send (default %d)\n"
+            "  -w window     most requests in flight (default %d)\n"
+            "  -b            run over TCP, then over the segment, and compare\n",
+            p_prog, CLIENT_DEFAULT_HOST, CLIENT_DEFAULT_PORT, CLIENT_DEFAULT_COUNT,
+            CLIENT_DEFAULT_WINDOW);
+}
+
+/*!
+ * @brief This is a static function that parses a numeric command line
+ *          argument.
+ *
+ * @param[in] p_arg The argument.
+ * @param[in] min The smallest value accepted.
+ * @param[in] max The largest value accepted.
+ * @param[out] p_value The parsed value.
+ *
+ * @return 0 on success, -1 if the argument is not a number in range.
+ */
+static int
+parse_num (const char * p_arg, const unsigned long min, const unsigned long max,
+           unsigned long * p_value)
+{
+    int status = -1;
+    char * p_end = NULL;
+    errno = 0;
+    unsigned long value = strtoul(p_arg, &p_end, 10);
+    if ((0 != errno) ||
+        (p_end == p_arg) ||
+        ('\0' != *p_end) ||
+        (value < min) ||
+        (value > max))
+    {
+        goto EXIT;
+    }
+    
+    *p_value = value;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is the entry point for the client program. It handles
+ *          parsing of command line arguments and runs the load over the
+ *          chosen transports.
+ *
+ * @return 0 on success, 1 on error.
+ */
+int
+main (int argc, char ** argv)
+{
+    int status = 1;
+    const char * p_host = CLIENT_DEFAULT_HOST;
+    const char * p_shm_name = NULL;
+    uint16_t port = CLIENT_DEFAULT_PORT;
+    size_t count = CLIENT_DEFAULT_COUNT;
+    size_t window = CLIENT_DEFAULT_WINDOW;
+    bool b_bench = false;
+    
+    int opt = 0;
+    unsigned long value = 0;
+    while (-1 != (opt = getopt(argc, argv, "H:p:s:n:w:bh")))
+    {
+        switch (opt)
+        {
+            case 'H':
+                p_host = optarg;
+                break;
+            case 'p':
+                if (-1 == parse_num(optarg, 1, UINT16_MAX, &value))
+                {
+                    fprintf(stderr, "invalid port: %s\n", optarg);
+                    goto EXIT;
+                }
+                port = (uint16_t) value;
+                break;
+            case 's':
+                p_shm_name = optarg;
+                break;
+            case 'n':
+                if (-1 == parse_num(optarg, 1, UINT32_MAX, &value))
+                {
+                    fprintf(stderr, "invalid request count: %s\n", optarg);
+                    goto EXIT;
+                }
+                count = value;
+                break;
+            case 'w':
+                if (-1 == parse_num(optarg, 1, CLIENT_MAX_WINDOW, &value))
+                {
+                    fprintf(stderr, "invalid window: %s\n", optarg);
+                    goto EXIT;
+                }
+                window = value;
+                break;
+            case 'b':
+                b_bench = true;
+                break;
+            case 'h':
+                usage(argv[0]);
+                status = 0;
+                goto EXIT;
+            default:
+                usage(argv[0]);
+                goto EXIT;
+        }
+    }
+    if ((true == b_bench) &&
+        (NULL == p_shm_name))
+    {
+        fprintf(stderr, "benchmark needs a shared-memory name\n");
+        goto EXIT;
+    }
+    
+    if (((NULL == p_shm_name) || (true == b_bench)) &&
+        (-1 == client_bench_tcp(p_host, port, count, window)))
+    {
+        goto EXIT;
+    }
+    if ((NULL != p_shm_name) &&
+        (-1 == client_bench_shm(p_shm_name, count, window)))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
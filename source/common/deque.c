@@ -0,0 +1,260 @@
+/*!
+ * @file deque.c
+ *
+ * @brief This file contains a fixed-capacity work-stealing deque
+ *          (Chase-Lev).
+ *
+ *          The memory orderings follow the C11 formulation of the
+ *              Chase-Lev deque by Le, Pop, Cohen and Zappa Nardelli.
+ *              The owner moves bottom and only needs to synchronize
+ *              with thieves when a single entry remains, in which case
+ *              owner and thieves race with a compare-and-swap on top.
+ */
+
+#include <string.h>
+
+#include "deque.h"
+
+/*!
+ * @brief This function instantiates a new empty deque.
+ *
+ * @param[in] capacity The maximum number of entries in the deque.
+ *              This must be a non-zero power of two, or error will
+ *              be returned.
+ *
+ * @return Pointer to new deque context. NULL on error.
+ */
+deque_t *
+deque_create (const size_t capacity)
+{
+    int status = -1;
+    deque_t * p_deque = NULL;
+    if ((0 == capacity) ||
+        (0 != (capacity & (capacity - 1))))
+    {
+        goto EXIT;
+    }
+    
+    // The context is cache line aligned so the cursors do not share a line.
+    p_deque = aligned_alloc(DEQUE_CACHE_LINE, sizeof(deque_t));
+    if (NULL == p_deque)
+    {
+        goto EXIT;
+    }
+    memset(p_deque, 0, sizeof(deque_t));
+    p_deque->mask = (long) capacity - 1;
+    atomic_init(&(p_deque->top), 0);
+    atomic_init(&(p_deque->bottom), 0);
+    
+    p_deque->pp_slots = calloc(capacity, sizeof(_Atomic(void *)));
+    if (NULL == p_deque->pp_slots)
+    {
+        goto EXIT;
+    }
+    for (size_t idx = 0; idx < capacity; ++idx)
+    {
+        atomic_init(p_deque->pp_slots + idx, NULL);
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_deque))
+        {
+            deque_destroy(p_deque);
+            p_deque = NULL;
+        }
+        return p_deque;
+}
+
+/*!
+ * @brief This function destroys a deque context.
+ *
+ *          This will not deallocate any data referenced by the deque.
+ *              No other thread may be using the deque when it is
+ *              destroyed.
+ *
+ * @param[in/out] p_deque The deque context.
+ *
+ * @return No return value expected.
+ */
+void
+deque_destroy (deque_t * p_deque)
+{
+    if (NULL == p_deque)
+    {
+        goto EXIT;
+    }
+    
+    free(p_deque->pp_slots);
+    p_deque->pp_slots = NULL;
+    free(p_deque);
+    p_deque = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function pushes data onto the bottom of the deque.
+ *
+ *          Only the owner thread may call this function.
+ *
+ * @param[in/out] p_deque The deque context.
+ * @param[in/out] p_data The data to push.
+ *
+ * @return 0 on success, -1 on error or if the deque is full.
+ */
+int
+deque_push (deque_t * p_deque, void * p_data)
+{
+    int status = -1;
+    if ((NULL == p_deque) ||
+        (NULL == p_data))
+    {
+        goto EXIT;
+    }
+    
+    long bottom = atomic_load_explicit(&(p_deque->bottom), memory_order_relaxed);
+    long top = atomic_load_explicit(&(p_deque->top), memory_order_acquire);
+    if ((bottom - top) > p_deque->mask)
+    {
+        goto EXIT;
+    }
+    
+    // Store the entry, then publish it by moving bottom.
+    atomic_store_explicit(p_deque->pp_slots + (bottom & p_deque->mask), p_data,
+                          memory_order_relaxed);
+    atomic_store_explicit(&(p_deque->bottom), bottom + 1, memory_order_release);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function pops the most recently pushed entry from the
+ *          bottom of the deque.
+ *
+ *          Only the owner thread may call this function.
+ *
+ * @param[in/out] p_deque The deque context.
+ *
+ * @return Pointer to the popped data. NULL on error or empty deque.
+ */
+void *
+deque_pop (deque_t * p_deque)
+{
+    void * p_result = NULL;
+    if (NULL == p_deque)
+    {
+        goto EXIT;
+    }
+    
+    // Reserve the bottom entry before looking at top.
+    long bottom = atomic_load_explicit(&(p_deque->bottom), memory_order_relaxed) - 1;
+    atomic_store_explicit(&(p_deque->bottom), bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&(p_deque->top), memory_order_relaxed);
+    
+    if (top > bottom)
+    {
+        // The deque was empty, restore bottom.
+        atomic_store_explicit(&(p_deque->bottom), bottom + 1, memory_order_relaxed);
+        goto EXIT;
+    }
+    
+    p_result = atomic_load_explicit(p_deque->pp_slots + (bottom & p_deque->mask),
+                                    memory_order_relaxed);
+    
+    if (top == bottom)
+    {
+        // This is the last entry, so race the thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&(p_deque->top), &top, top + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+        {
+            p_result = NULL;
+        }
+        atomic_store_explicit(&(p_deque->bottom), bottom + 1, memory_order_relaxed);
+    }
+    
+    EXIT:
+        return p_result;
+}
+
+/*!
+ * @brief This function steals the oldest entry from the top of the deque.
+ *
+ *          Any thread may call this function.
+ *
+ * @param[in/out] p_deque The deque context.
+ *
+ * @return Pointer to the stolen data. NULL on error, empty deque, or if
+ *          another thread won the race for the entry.
+ */
+void *
+deque_steal (deque_t * p_deque)
+{
+    void * p_result = NULL;
+    if (NULL == p_deque)
+    {
+        goto EXIT;
+    }
+    
+    long top = atomic_load_explicit(&(p_deque->top), memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&(p_deque->bottom), memory_order_acquire);
+    
+    if (top >= bottom)
+    {
+        goto EXIT;
+    }
+    
+    // Read the entry, then claim it by moving top.
+    p_result = atomic_load_explicit(p_deque->pp_slots + (top & p_deque->mask),
+                                    memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&(p_deque->top), &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+    {
+        p_result = NULL;
+    }
+    
+    EXIT:
+        return p_result;
+}
+
+/*!
+ * @brief This function returns the number of entries in the deque.
+ *
+ *          While other threads are operating on the deque this is
+ *              only an estimate.
+ *
+ * @param[in] p_deque The deque context.
+ *
+ * @return The number of entries. 0 on error.
+ */
+size_t
+deque_size (deque_t * p_deque)
+{
+    size_t size = 0;
+    if (NULL == p_deque)
+    {
+        goto EXIT;
+    }
+    
+    long top = atomic_load_explicit(&(p_deque->top), memory_order_acquire);
+    long bottom = atomic_load_explicit(&(p_deque->bottom), memory_order_acquire);
+    if (bottom > top)
+    {
+        size = (size_t) (bottom - top);
+    }
+    
+    EXIT:
+        return size;
+}
+
+/***   end of file   ***/
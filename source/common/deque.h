@@ -0,0 +1,135 @@
+/*!
+ * @file deque.h
+ *
+ * @brief This file contains a fixed-capacity work-stealing deque
+ *          (Chase-Lev).
+ *
+ *          The deque has a single owner thread which pushes and pops
+ *              entries at the bottom in LIFO order. Any other thread
+ *              may steal entries from the top in FIFO order. Neither
+ *              end takes a lock; owner and thieves only contend when
+ *              racing for the last entry.
+ *
+ *          Like queue_t, the deque holds references to data and is
+ *              not responsible for allocation or deallocation of
+ *              the referenced data.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - deque_create
+ *              - deque_destroy
+ *              - deque_push
+ *              - deque_pop
+ *              - deque_steal
+ *              - deque_size
+ */
+
+#ifndef COMMON_DEQUE_H
+#define COMMON_DEQUE_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/*!
+ * @brief The assumed cache line size. The owner and thief cursors are
+ *          placed on separate cache lines to avoid false sharing.
+ */
+#define DEQUE_CACHE_LINE 64
+
+/*!
+ * @brief This datatype defines a deque context.
+ *
+ * @param pp_slots The circular array of entries.
+ * @param mask The capacity minus one, used to wrap cursors.
+ * @param top The thief cursor. Entries are stolen from here.
+ * @param bottom The owner cursor. Entries are pushed and popped here.
+ */
+typedef struct _deque
+{
+    _Atomic(void *) * pp_slots;
+    long              mask;
+    _Alignas(DEQUE_CACHE_LINE) _Atomic long top;
+    _Alignas(DEQUE_CACHE_LINE) _Atomic long bottom;
+} deque_t;
+
+/*!
+ * @brief This function instantiates a new empty deque.
+ *
+ * @param[in] capacity The maximum number of entries in the deque.
+ *              This must be a non-zero power of two, or error will
+ *              be returned.
+ *
+ * @return Pointer to new deque context. NULL on error.
+ */
+deque_t *
+deque_create (const size_t capacity);
+
+/*!
+ * @brief This function destroys a deque context.
+ *
+ *          This will not deallocate any data referenced by the deque.
+ *              No other thread may be using the deque when it is
+ *              destroyed.
+ *
+ * @param[in/out] p_deque The deque context.
+ *
+ * @return No return value expected.
+ */
+void
+deque_destroy (deque_t * p_deque);
+
+/*!
+ * @brief This function pushes data onto the bottom of the deque.
+ *
+ *          Only the owner thread may call this function.
+ *
+ * @param[in/out] p_deque The deque context.
+ * @param[in/out] p_data The data to push.
+ *
+ * @return 0 on success, -1 on error or if the deque is full.
+ */
+int
+deque_push (deque_t * p_deque, void * p_data);
+
+/*!
+ * @brief This function pops the most recently pushed entry from the
+ *          bottom of the deque.
+ *
+ *          Only the owner thread may call this function.
+ *
+ * @param[in/out] p_deque The deque context.
+ *
+ * @return Pointer to the popped data. NULL on error or empty deque.
+ */
+void *
+deque_pop (deque_t * p_deque);
+
+/*!
+ * @brief This function steals the oldest entry from the top of the deque.
+ *
+ *          Any thread may call this function.
+ *
+ * @param[in/out] p_deque The deque context.
+ *
+ * @return Pointer to the stolen data. NULL on error, empty deque, or if
+ *          another thread won the race for the entry.
+ */
+void *
+deque_steal (deque_t * p_deque);
+
+/*!
+ * @brief This function returns the number of entries in the deque.
+ *
+ *          While other threads are operating on the deque this is
+ *              only an estimate.
+ *
+ * @param[in] p_deque The deque context.
+ *
+ * @return The number of entries. 0 on error.
+ */
+size_t
+deque_size (deque_t * p_deque);
+
+#endif // COMMON_DEQUE_H
+
+/***   end of file   ***/
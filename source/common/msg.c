@@ -0,0 +1,400 @@
+/*!
+ * @file msg.c
+ *
+ * @brief This file contains the codec for the fixed-layout request and
+ *          response frames described in docs/msg_protocol.md.
+ *
+ *          Validation and dispatch share one table indexed by opcode.
+ *              Each entry holds the operation's index in a dispatcher's
+ *              handlers, 0 for unknown opcodes, and the fields the
+ *              operation uses, so checking and routing a request costs
+ *              a single lookup and no branch per operation.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include <endian.h>
+
+#include "msg.h"
+
+/*!
+ * @brief The fields an operation uses, as checked by validation.
+ */
+#define MSG_FIELD_USERNAME 0x01
+#define MSG_FIELD_PASSWORD 0x02
+#define MSG_FIELD_AMOUNT   0x04
+
+/*!
+ * @brief This datatype defines an operation's entry in the opcode table.
+ *
+ * @param index The operation's index in a dispatcher's handlers. 0 if
+ *          the opcode is unknown.
+ * @param fields The fields the operation uses.
+ */
+typedef struct _msg_op_info
+{
+    uint8_t index;
+    uint8_t fields;
+} msg_op_info_t;
+
+/*!
+ * @brief The opcode table.
+ */
+static const msg_op_info_t g_ops[UINT8_MAX + 1] =
+{
+    [MSG_OP_USER_REGISTER]    = {1, MSG_FIELD_USERNAME | MSG_FIELD_PASSWORD},
+    [MSG_OP_USER_DELETE]      = {2, 0},
+    [MSG_OP_USER_LOGIN]       = {3, MSG_FIELD_USERNAME | MSG_FIELD_PASSWORD},
+    [MSG_OP_ACCOUNT_BALANCE]  = {4, 0},
+    [MSG_OP_ACCOUNT_DEPOSIT]  = {5, MSG_FIELD_AMOUNT},
+    [MSG_OP_ACCOUNT_WITHDRAW] = {6, MSG_FIELD_AMOUNT},
+    [MSG_OP_ACCOUNT_TRANSFER] = {7, MSG_FIELD_USERNAME | MSG_FIELD_AMOUNT},
+};
+
+/*!
+ * @brief This is a static function that checks a string field is
+ *          non-empty and NUL-terminated within the field.
+ *
+ * @param[in] p_str The field.
+ *
+ * @return true if the field holds a valid string, false otherwise.
+ */
+static bool
+msg_str_valid (const char * p_str)
+{
+    return ('\0' != p_str[0]) &&
+           (NULL != memchr(p_str, '\0', MSG_STR_SIZE));
+}
+
+/*!
+ * @brief This is a static function that copies a string into a field.
+ *
+ * @param[out] p_field The field, zeroed.
+ * @param[in] p_str The string. NULL leaves the field empty.
+ *
+ * @return 0 on success, -1 if the string does not fit the field.
+ */
+static int
+msg_str_encode (char * p_field, const char * p_str)
+{
+    int status = -1;
+    if (NULL != p_str)
+    {
+        size_t len = strnlen(p_str, MSG_STR_SIZE);
+        if (MSG_STR_SIZE == len)
+        {
+            goto EXIT;
+        }
+        memcpy(p_field, p_str, len);
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function encodes a request frame.
+ *
+ * @param[out] p_request The request frame.
+ * @param[in] opcode The operation.
+ * @param[in] sid The session id.
+ * @param[in] p_username The username. NULL leaves the field empty.
+ * @param[in] p_password The password. NULL leaves the field empty.
+ * @param[in] amount The amount.
+ *
+ * @return 0 on success, -1 on error or if a string does not fit its
+ *          field.
+ */
+int
+msg_request_encode (msg_request_t * p_request, const uint8_t opcode, const uint32_t sid,
+                    const char * p_username, const char * p_password, const uint64_t amount)
+{
+    int status = -1;
+    if (NULL == p_request)
+    {
+        goto EXIT;
+    }
+    
+    memset(p_request, 0, sizeof(msg_request_t));
+    if ((-1 == msg_str_encode(p_request->username, p_username)) ||
+        (-1 == msg_str_encode(p_request->password, p_password)))
+    {
+        goto EXIT;
+    }
+    p_request->opcode = opcode;
+    p_request->sid = htobe32(sid);
+    p_request->amount = htobe64(amount);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function validates a request frame in place. The opcode
+ *          must be known, and the fields its operation uses must be
+ *          well formed: strings non-empty and NUL-terminated within
+ *          their field, and amounts non-zero. Fields the operation does
+ *          not use are not looked at.
+ *
+ * @param[in] p_request The request frame.
+ *
+ * @return 0 if the frame is valid, -1 otherwise.
+ */
+int
+msg_request_validate (const msg_request_t * p_request)
+{
+    int status = -1;
+    if (NULL == p_request)
+    {
+        goto EXIT;
+    }
+    
+    msg_op_info_t info = g_ops[p_request->opcode];
+    if ((0 == info.index) ||
+        ((0 != (info.fields & MSG_FIELD_USERNAME)) &&
+         (false == msg_str_valid(p_request->username))) ||
+        ((0 != (info.fields & MSG_FIELD_PASSWORD)) &&
+         (false == msg_str_valid(p_request->password))) ||
+        ((0 != (info.fields & MSG_FIELD_AMOUNT)) &&
+         (0 == p_request->amount)))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function returns a request's session id in host byte
+ *          order.
+ *
+ * @param[in] p_request The request frame.
+ *
+ * @return The session id. 0 on error.
+ */
+uint32_t
+msg_request_sid (const msg_request_t * p_request)
+{
+    uint32_t sid = 0;
+    if (NULL == p_request)
+    {
+        goto EXIT;
+    }
+    
+    sid = be32toh(p_request->sid);
+    
+    EXIT:
+        return sid;
+}
+
+/*!
+ * @brief This function returns a request's amount in host byte order.
+ *
+ * @param[in] p_request The request frame.
+ *
+ * @return The amount. 0 on error.
+ */
+uint64_t
+msg_request_amount (const msg_request_t * p_request)
+{
+    uint64_t amount = 0;
+    if (NULL == p_request)
+    {
+        goto EXIT;
+    }
+    
+    amount = be64toh(p_request->amount);
+    
+    EXIT:
+        return amount;
+}
+
+/*!
+ * @brief This function encodes a response frame.
+ *
+ * @param[out] p_response The response frame.
+ * @param[in] code The response code.
+ * @param[in] sid The session id.
+ * @param[in] amount The amount.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+msg_response_encode (msg_response_t * p_response, const uint8_t code, const uint32_t sid,
+                     const uint64_t amount)
+{
+    int status = -1;
+    if (NULL == p_response)
+    {
+        goto EXIT;
+    }
+    
+    p_response->code = code;
+    p_response->sid = htobe32(sid);
+    p_response->amount = htobe64(amount);
+    memset(p_response->padding, 0, sizeof(p_response->padding));
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function returns a response's session id in host byte
+ *          order.
+ *
+ * @param[in] p_response The response frame.
+ *
+ * @return The session id. 0 on error.
+ */
+uint32_t
+msg_response_sid (const msg_response_t * p_response)
+{
+    uint32_t sid = 0;
+    if (NULL == p_response)
+    {
+        goto EXIT;
+    }
+    
+    sid = be32toh(p_response->sid);
+    
+    EXIT:
+        return sid;
+}
+
+/*!
+ * @brief This function returns a response's amount in host byte order.
+ *
+ * @param[in] p_response The response frame.
+ *
+ * @return The amount. 0 on error.
+ */
+uint64_t
+msg_response_amount (const msg_response_t * p_response)
+{
+    uint64_t amount = 0;
+    if (NULL == p_response)
+    {
+        goto EXIT;
+    }
+    
+    amount = be64toh(p_response->amount);
+    
+    EXIT:
+        return amount;
+}
+
+/*!
+ * @brief This function initializes a dispatcher with no handlers.
+ *
+ * @param[out] p_dispatch The dispatcher.
+ * @param[in] p_ctx The context passed to the handlers.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+msg_dispatch_init (msg_dispatch_t * p_dispatch, void * p_ctx)
+{
+    int status = -1;
+    if (NULL == p_dispatch)
+    {
+        goto EXIT;
+    }
+    
+    for (size_t idx = 0; idx <= MSG_NUM_OPS; ++idx)
+    {
+        p_dispatch->handlers[idx] = NULL;
+    }
+    p_dispatch->p_ctx = p_ctx;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function registers the handler for an operation.
+ *
+ * @param[in/out] p_dispatch The dispatcher.
+ * @param[in] opcode The operation.
+ * @param[in] handle_func The handler. NULL removes the handler.
+ *
+ * @return 0 on success, -1 on error or if the opcode is unknown.
+ */
+int
+msg_dispatch_set (msg_dispatch_t * p_dispatch, const uint8_t opcode, msg_handle_f handle_func)
+{
+    int status = -1;
+    if ((NULL == p_dispatch) ||
+        (0 == g_ops[opcode].index))
+    {
+        goto EXIT;
+    }
+    
+    p_dispatch->handlers[g_ops[opcode].index] = handle_func;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function validates a request frame and calls the handler
+ *          for its operation, which fills in the response frame.
+ *
+ *          An invalid request, or one whose operation has no handler,
+ *              is answered with MSG_CODE_FAILURE and the request's
+ *              session id.
+ *
+ * @param[in] p_dispatch The dispatcher.
+ * @param[in] p_request The request frame, MSG_REQ_SIZE bytes.
+ * @param[out] p_response The response frame, MSG_RESP_SIZE bytes.
+ *
+ * @return 0 if a handler was called, -1 otherwise.
+ */
+int
+msg_dispatch (const msg_dispatch_t * p_dispatch, const unsigned char * p_request,
+              unsigned char * p_response)
+{
+    int status = -1;
+    if ((NULL == p_dispatch) ||
+        (NULL == p_request) ||
+        (NULL == p_response))
+    {
+        goto EXIT;
+    }
+    
+    // The frames are read and written where they lie. The session id is
+    // echoed without converting it twice.
+    const msg_request_t * p_req = (const msg_request_t *) p_request;
+    msg_response_t * p_resp = (msg_response_t *) p_response;
+    p_resp->code = MSG_CODE_FAILURE;
+    p_resp->sid = p_req->sid;
+    p_resp->amount = 0;
+    memset(p_resp->padding, 0, sizeof(p_resp->padding));
+    
+    msg_handle_f handle_func = p_dispatch->handlers[g_ops[p_req->opcode].index];
+    if ((NULL == handle_func) ||
+        (-1 == msg_request_validate(p_req)))
+    {
+        goto EXIT;
+    }
+    handle_func(p_req, p_resp, p_dispatch->p_ctx);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,319 @@
+/*!
+ * @file msg.h
+ *
+ * @brief This file contains the codec for the fixed-layout request and
+ *          response frames described in docs/msg_protocol.md.
+ *
+ *          The frame structs are packed to the exact wire layout, so a
+ *              frame is read and written in place by overlaying its
+ *              struct on the buffer it sits in. Nothing is copied or
+ *              allocated, and no alignment is needed. The frame sizes
+ *              are whole cache lines, so frames packed back to back in
+ *              a cache line aligned buffer each start on a line of
+ *              their own.
+ *
+ *          The session id and amount are carried in network byte
+ *              order. The accessors convert them, so the fields are
+ *              never read directly.
+ *
+ *          A dispatcher validates a request frame and calls the
+ *              handler registered for its operation, looked up from a
+ *              table indexed by opcode.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - msg_request_encode
+ *              - msg_request_validate
+ *              - msg_request_sid
+ *              - msg_request_amount
+ *              - msg_response_encode
+ *              - msg_response_sid
+ *              - msg_response_amount
+ *              - msg_dispatch_init
+ *              - msg_dispatch_set
+ *              - msg_dispatch
+ */
+
+#ifndef COMMON_MSG_H
+#define COMMON_MSG_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*!
+ * @brief The size of a request frame, in bytes.
+ */
+#define MSG_REQ_SIZE 256
+
+/*!
+ * @brief The size of a response frame, in bytes.
+ */
+#define MSG_RESP_SIZE 128
+
+/*!
+ * @brief The assumed cache line size. Frame sizes are multiples of it.
+ */
+#define MSG_CACHE_LINE 64
+
+/*!
+ * @brief The size of the username and password fields. A string must be
+ *          NUL-terminated within its field.
+ */
+#define MSG_STR_SIZE 32
+
+/*!
+ * @brief The number of operations.
+ */
+#define MSG_NUM_OPS 7
+
+/*!
+ * @brief This enumeration defines the request opcodes.
+ */
+typedef enum _msg_op
+{
+    MSG_OP_USER_REGISTER    = 0x01,
+    MSG_OP_USER_DELETE      = 0x02,
+    MSG_OP_USER_LOGIN       = 0x03,
+    MSG_OP_ACCOUNT_BALANCE  = 0x10,
+    MSG_OP_ACCOUNT_DEPOSIT  = 0x11,
+    MSG_OP_ACCOUNT_WITHDRAW = 0x12,
+    MSG_OP_ACCOUNT_TRANSFER = 0x13,
+} msg_op_t;
+
+/*!
+ * @brief This enumeration defines the response codes. Codes 0xF1 to
+ *          0xF3 mean different failures for different operations.
+ */
+typedef enum _msg_code
+{
+    MSG_CODE_SUCCESS           = 0xA0,
+    MSG_CODE_INVALID_SID       = 0xF0,
+    MSG_CODE_USER_EXISTS       = 0xF1,
+    MSG_CODE_USER_NOT_FOUND    = 0xF1,
+    MSG_CODE_DEPOSIT_OVERFLOW  = 0xF1,
+    MSG_CODE_INSUFF_FUNDS      = 0xF1,
+    MSG_CODE_PASS_INVALID      = 0xF2,
+    MSG_CODE_INVALID_USER      = 0xF2,
+    MSG_CODE_DB_FULL           = 0xF3,
+    MSG_CODE_TRANSFER_OVERFLOW = 0xF3,
+    MSG_CODE_FAILURE           = 0xFF,
+} msg_code_t;
+
+/*!
+ * @brief The size of the fields of a request frame, before its padding.
+ */
+#define MSG_REQ_FIELDS_SIZE (1 + 4 + (2 * MSG_STR_SIZE) + 8)
+
+/*!
+ * @brief The size of the fields of a response frame, before its padding.
+ */
+#define MSG_RESP_FIELDS_SIZE (1 + 4 + 8)
+
+/*!
+ * @brief This datatype defines a request frame, laid out as on the wire.
+ *
+ * @param opcode The operation, one of msg_op_t.
+ * @param sid The session id, in network byte order.
+ * @param username The username, NUL-terminated.
+ * @param password The password, NUL-terminated.
+ * @param amount The amount, in network byte order.
+ * @param padding Unused bytes up to the frame size.
+ */
+typedef struct __attribute__((packed)) _msg_request
+{
+    uint8_t  opcode;
+    uint32_t sid;
+    char     username[MSG_STR_SIZE];
+    char     password[MSG_STR_SIZE];
+    uint64_t amount;
+    uint8_t  padding[MSG_REQ_SIZE - MSG_REQ_FIELDS_SIZE];
+} msg_request_t;
+
+/*!
+ * @brief This datatype defines a response frame, laid out as on the
+ *          wire.
+ *
+ * @param code The response code, one of msg_code_t.
+ * @param sid The session id, in network byte order.
+ * @param amount The amount, in network byte order.
+ * @param padding Unused bytes up to the frame size.
+ */
+typedef struct __attribute__((packed)) _msg_response
+{
+    uint8_t  code;
+    uint32_t sid;
+    uint64_t amount;
+    uint8_t  padding[MSG_RESP_SIZE - MSG_RESP_FIELDS_SIZE];
+} msg_response_t;
+
+_Static_assert(sizeof(msg_request_t) == MSG_REQ_SIZE, "request frame size");
+_Static_assert(sizeof(msg_response_t) == MSG_RESP_SIZE, "response frame size");
+_Static_assert(0 == (MSG_REQ_SIZE % MSG_CACHE_LINE), "request frame spans whole cache lines");
+_Static_assert(0 == (MSG_RESP_SIZE % MSG_CACHE_LINE), "response frame spans whole cache lines");
+_Static_assert(1 == offsetof(msg_request_t, sid), "request sid offset");
+_Static_assert(5 == offsetof(msg_request_t, username), "request username offset");
+_Static_assert(37 == offsetof(msg_request_t, password), "request password offset");
+_Static_assert(69 == offsetof(msg_request_t, amount), "request amount offset");
+_Static_assert(1 == offsetof(msg_response_t, sid), "response sid offset");
+_Static_assert(5 == offsetof(msg_response_t, amount), "response amount offset");
+_Static_assert(1 == _Alignof(msg_request_t), "request frame overlays any buffer");
+
+/*!
+ * @brief This datatype defines an operation handler. The response is
+ *          set to a failure echoing the request's session id before the
+ *          handler is called.
+ *
+ * @param[in] p_request The request frame, validated.
+ * @param[out] p_response The response frame.
+ * @param[in] p_ctx The dispatcher's context.
+ *
+ * @return No return value expected.
+ */
+typedef void (* msg_handle_f) (const msg_request_t * p_request, msg_response_t * p_response,
+                               void * p_ctx);
+
+/*!
+ * @brief This datatype defines a dispatcher.
+ *
+ * @param handlers The handlers, by operation index. The first entry is
+ *          for unknown opcodes and is always NULL.
+ * @param p_ctx The context passed to the handlers.
+ */
+typedef struct _msg_dispatch
+{
+    msg_handle_f handlers[MSG_NUM_OPS + 1];
+    void *       p_ctx;
+} msg_dispatch_t;
+
+/*!
+ * @brief This function encodes a request frame.
+ *
+ * @param[out] p_request The request frame.
+ * @param[in] opcode The operation.
+ * @param[in] sid The session id.
+ * @param[in] p_username The username. NULL leaves the field empty.
+ * @param[in] p_password The password. NULL leaves the field empty.
+ * @param[in] amount The amount.
+ *
+ * @return 0 on success, -1 on error or if a string does not fit its
+ *          field.
+ */
+int
+msg_request_encode (msg_request_t * p_request, const uint8_t opcode, const uint32_t sid,
+                    const char * p_username, const char * p_password, const uint64_t amount);
+
+/*!
+ * @brief This function validates a request frame in place. The opcode
+ *          must be known, and the fields its operation uses must be
+ *          well formed: strings non-empty and NUL-terminated within
+ *          their field, and amounts non-zero. Fields the operation does
+ *          not use are not looked at.
+ *
+ * @param[in] p_request The request frame.
+ *
+ * @return 0 if the frame is valid, -1 otherwise.
+ */
+int
+msg_request_validate (const msg_request_t * p_request);
+
+/*!
+ * @brief This function returns a request's session id in host byte
+ *          order.
+ *
+ * @param[in] p_request The request frame.
+ *
+ * @return The session id. 0 on error.
+ */
+uint32_t
+msg_request_sid (const msg_request_t * p_request);
+
+/*!
+ * @brief This function returns a request's amount in host byte order.
+ *
+ * @param[in] p_request The request frame.
+ *
+ * @return The amount. 0 on error.
+ */
+uint64_t
+msg_request_amount (const msg_request_t * p_request);
+
+/*!
+ * @brief This function encodes a response frame.
+ *
+ * @param[out] p_response The response frame.
+ * @param[in] code The response code.
+ * @param[in] sid The session id.
+ * @param[in] amount The amount.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+msg_response_encode (msg_response_t * p_response, const uint8_t code, const uint32_t sid,
+                     const uint64_t amount);
+
+/*!
+ * @brief This function returns a response's session id in host byte
+ *          order.
+ *
+ * @param[in] p_response The response frame.
+ *
+ * @return The session id. 0 on error.
+ */
+uint32_t
+msg_response_sid (const msg_response_t * p_response);
+
+/*!
+ * @brief This function returns a response's amount in host byte order.
+ *
+ * @param[in] p_response The response frame.
+ *
+ * @return The amount. 0 on error.
+ */
+uint64_t
+msg_response_amount (const msg_response_t * p_response);
+
+/*!
+ * @brief This function initializes a dispatcher with no handlers.
+ *
+ * @param[out] p_dispatch The dispatcher.
+ * @param[in] p_ctx The context passed to the handlers.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+msg_dispatch_init (msg_dispatch_t * p_dispatch, void * p_ctx);
+
+/*!
+ * @brief This function registers the handler for an operation.
+ *
+ * @param[in/out] p_dispatch The dispatcher.
+ * @param[in] opcode The operation.
+ * @param[in] handle_func The handler. NULL removes the handler.
+ *
+ * @return 0 on success, -1 on error or if the opcode is unknown.
+ */
+int
+msg_dispatch_set (msg_dispatch_t * p_dispatch, const uint8_t opcode, msg_handle_f handle_func);
+
+/*!
+ * @brief This function validates a request frame and calls the handler
+ *          for its operation, which fills in the response frame.
+ *
+ *          An invalid request, or one whose operation has no handler,
+ *              is answered with MSG_CODE_FAILURE and the request's
+ *              session id.
+ *
+ * @param[in] p_dispatch The dispatcher.
+ * @param[in] p_request The request frame, MSG_REQ_SIZE bytes.
+ * @param[out] p_response The response frame, MSG_RESP_SIZE bytes.
+ *
+ * @return 0 if a handler was called, -1 otherwise.
+ */
+int
+msg_dispatch (const msg_dispatch_t * p_dispatch, const unsigned char * p_request,
+              unsigned char * p_response);
+
+#endif // COMMON_MSG_H
+
+/***   end of file   ***/
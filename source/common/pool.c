@@ -0,0 +1,534 @@
+/*!
+ * @file pool.c
+ *
+ * @brief This file contains a fixed-size object pool allocator.
+ *
+ *          Objects are carved out of slabs and kept on free lists
+ *              for reuse. Each thread has a private cache in front of
+ *              the shared free list, so the common path takes no lock.
+ *
+ *          A thread's cache is created the first time it touches the
+ *              pool and is stored under a thread-specific key. When the
+ *              thread exits its cached objects and counters are handed
+ *              back to the pool.
+ */
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pool.h"
+
+/*!
+ * @brief This macro rounds a size up to the given power of two alignment.
+ */
+#define POOL_ALIGN_UP(size, align) (((size) + ((align) - 1)) & ~((align) - 1))
+
+/*!
+ * @brief This is a static function that hands a thread's cache back to
+ *          its pool. It is registered as the destructor for the pool's
+ *          thread-specific key and runs when the owning thread exits.
+ *
+ * @param[in/out] vp_cache A void pointer to the cache. This is a void
+ *                  pointer to be in compliance with the
+ *                  pthread_key_create function's specs.
+ *
+ * @return No return value expected.
+ */
+static void
+pool_cache_release (void * vp_cache)
+{
+    if (NULL == vp_cache)
+    {
+        goto EXIT;
+    }
+    
+    pool_cache_t * p_cache = (pool_cache_t *) vp_cache;
+    pool_t * p_pool = p_cache->p_pool;
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_pool->mutex));
+    
+    // Return every cached object to the shared free list.
+    while (NULL != p_cache->p_free)
+    {
+        pool_obj_t * p_obj = p_cache->p_free;
+        p_cache->p_free = p_obj->p_next;
+        p_obj->p_next = p_pool->p_free;
+        p_pool->p_free = p_obj;
+        p_pool->free_count++;
+    }
+    
+    // Keep the cache's counters in the pool totals.
+    p_pool->hits += atomic_load(&(p_cache->hits));
+    p_pool->misses += atomic_load(&(p_cache->misses));
+    p_pool->refills += atomic_load(&(p_cache->refills));
+    
+    // Unregister the cache.
+    if (NULL != p_cache->p_prev)
+    {
+        p_cache->p_prev->p_next = p_cache->p_next;
+    }
+    else
+    {
+        p_pool->p_caches = p_cache->p_next;
+    }
+    if (NULL != p_cache->p_next)
+    {
+        p_cache->p_next->p_prev = p_cache->p_prev;
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_pool->mutex));
+    
+    free(p_cache);
+    p_cache = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This is a static function that returns the calling thread's
+ *          cache for a pool, creating and registering it on first use.
+ *
+ * @param[in/out] p_pool The pool context.
+ *
+ * @return Pointer to the thread's cache. NULL on error.
+ */
+static pool_cache_t *
+pool_cache_get (pool_t * p_pool)
+{
+    pool_cache_t * p_cache = pthread_getspecific(p_pool->key);
+    if (NULL != p_cache)
+    {
+        goto EXIT;
+    }
+    
+    // This only happens once per thread per pool.
+    p_cache = calloc(1, sizeof(pool_cache_t));
+    if (NULL == p_cache)
+    {
+        goto EXIT;
+    }
+    p_cache->p_pool = p_pool;
+    p_cache->p_free = NULL;
+    p_cache->count = 0;
+    atomic_init(&(p_cache->hits), 0);
+    atomic_init(&(p_cache->misses), 0);
+    atomic_init(&(p_cache->refills), 0);
+    p_cache->p_prev = NULL;
+    
+    if (0 != pthread_setspecific(p_pool->key, p_cache))
+    {
+        free(p_cache);
+        p_cache = NULL;
+        goto EXIT;
+    }
+    
+    // Register the cache so the pool can reclaim it on destruction.
+    pthread_mutex_lock(&(p_pool->mutex));
+    p_cache->p_next = p_pool->p_caches;
+    if (NULL != p_pool->p_caches)
+    {
+        p_pool->p_caches->p_prev = p_cache;
+    }
+    p_pool->p_caches = p_cache;
+    pthread_mutex_unlock(&(p_pool->mutex));
+    
+    EXIT:
+        return p_cache;
+}
+
+/*!
+ * @brief This is a static function that allocates a new slab and places
+ *          its objects on the shared free list.
+ *
+ *          The pool's mutex must be held by the caller.
+ *
+ * @param[in/out] p_pool The pool context.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+pool_grow (pool_t * p_pool)
+{
+    int status = -1;
+    size_t header = POOL_ALIGN_UP(sizeof(pool_slab_t), alignof(max_align_t));
+    
+    pool_slab_t * p_slab = malloc(header + (p_pool->slab_objs * p_pool->obj_size));
+    if (NULL == p_slab)
+    {
+        goto EXIT;
+    }
+    p_slab->p_next = p_pool->p_slabs;
+    p_pool->p_slabs = p_slab;
+    p_pool->num_slabs++;
+    
+    // Thread each object in the slab onto the shared free list.
+    char * p_base = (char *) p_slab + header;
+    for (size_t idx = 0; idx < p_pool->slab_objs; ++idx)
+    {
+        pool_obj_t * p_obj = (pool_obj_t *) (p_base + (idx * p_pool->obj_size));
+        p_obj->p_next = p_pool->p_free;
+        p_pool->p_free = p_obj;
+    }
+    p_pool->free_count += p_pool->slab_objs;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that takes a single object directly
+ *          from the shared free list. It is used when the calling thread
+ *          has no cache.
+ *
+ * @param[in/out] p_pool The pool context.
+ *
+ * @return Pointer to the object. NULL on error.
+ */
+static void *
+pool_alloc_shared (pool_t * p_pool)
+{
+    pool_obj_t * p_obj = NULL;
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_pool->mutex));
+    
+    if (NULL == p_pool->p_free)
+    {
+        if (-1 == pool_grow(p_pool))
+        {
+            pthread_mutex_unlock(&(p_pool->mutex));
+            goto EXIT;
+        }
+        p_pool->misses++;
+    }
+    else
+    {
+        p_pool->hits++;
+    }
+    
+    p_obj = p_pool->p_free;
+    p_pool->p_free = p_obj->p_next;
+    p_pool->free_count--;
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_pool->mutex));
+    
+    EXIT:
+        return p_obj;
+}
+
+/*!
+ * @brief This function instantiates a new empty pool.
+ *
+ * @param[in] obj_size The size of each object. This must be non-zero,
+ *              or error will be returned.
+ * @param[in] slab_objs The number of objects per slab. Zero selects
+ *              POOL_DEFAULT_SLAB_OBJS.
+ *
+ * @return Pointer to new pool context. NULL on error.
+ */
+pool_t *
+pool_create (const size_t obj_size, const size_t slab_objs)
+{
+    pool_t * p_pool = NULL;
+    if (0 == obj_size)
+    {
+        goto EXIT;
+    }
+    
+    p_pool = calloc(1, sizeof(pool_t));
+    if (NULL == p_pool)
+    {
+        goto EXIT;
+    }
+    
+    // Objects must hold a free list link and keep natural alignment.
+    size_t size = obj_size;
+    if (size < sizeof(pool_obj_t))
+    {
+        size = sizeof(pool_obj_t);
+    }
+    p_pool->obj_size = POOL_ALIGN_UP(size, alignof(max_align_t));
+    p_pool->slab_objs = (0 == slab_objs) ? POOL_DEFAULT_SLAB_OBJS : slab_objs;
+    p_pool->cache_max = POOL_DEFAULT_CACHE_MAX;
+    p_pool->p_free = NULL;
+    p_pool->free_count = 0;
+    p_pool->p_slabs = NULL;
+    p_pool->num_slabs = 0;
+    p_pool->p_caches = NULL;
+    p_pool->hits = 0;
+    p_pool->misses = 0;
+    p_pool->refills = 0;
+    
+    if (0 != pthread_mutex_init(&(p_pool->mutex), NULL))
+    {
+        free(p_pool);
+        p_pool = NULL;
+        goto EXIT;
+    }
+    
+    if (0 != pthread_key_create(&(p_pool->key), pool_cache_release))
+    {
+        pthread_mutex_destroy(&(p_pool->mutex));
+        free(p_pool);
+        p_pool = NULL;
+        goto EXIT;
+    }
+    
+    EXIT:
+        return p_pool;
+}
+
+/*!
+ * @brief This function destroys a pool context.
+ *
+ *          All slabs are returned to the system allocator, which
+ *              invalidates any objects still held by clients.
+ *              No other thread may be using the pool when it is
+ *              destroyed.
+ *
+ * @param[in/out] p_pool The pool context.
+ *
+ * @return No return value expected.
+ */
+void
+pool_destroy (pool_t * p_pool)
+{
+    if (NULL == p_pool)
+    {
+        goto EXIT;
+    }
+    
+    // Deleting the key guarantees cache destructors will no longer run.
+    pthread_key_delete(p_pool->key);
+    
+    // Free the caches of threads that are still alive.
+    pool_cache_t * p_cache = p_pool->p_caches;
+    while (NULL != p_cache)
+    {
+        pool_cache_t * p_next = p_cache->p_next;
+        free(p_cache);
+        p_cache = p_next;
+    }
+    p_pool->p_caches = NULL;
+    
+    // Free each slab. Cached and shared objects live inside the slabs.
+    pool_slab_t * p_slab = p_pool->p_slabs;
+    while (NULL != p_slab)
+    {
+        pool_slab_t * p_next = p_slab->p_next;
+        free(p_slab);
+        p_slab = p_next;
+    }
+    p_pool->p_slabs = NULL;
+    
+    pthread_mutex_destroy(&(p_pool->mutex));
+    free(p_pool);
+    p_pool = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function allocates an object from the pool.
+ *
+ *          The contents of the returned object are unspecified.
+ *
+ * @param[in/out] p_pool The pool context.
+ *
+ * @return Pointer to the object. NULL on error.
+ */
+void *
+pool_alloc (pool_t * p_pool)
+{
+    pool_obj_t * p_obj = NULL;
+    if (NULL == p_pool)
+    {
+        goto EXIT;
+    }
+    
+    pool_cache_t * p_cache = pool_cache_get(p_pool);
+    if (NULL == p_cache)
+    {
+        // Without a cache, fall back to the shared free list.
+        p_obj = pool_alloc_shared(p_pool);
+        goto EXIT;
+    }
+    
+    if (NULL == p_cache->p_free)
+    {
+        // Refill half a cache worth of objects from the shared free list.
+        bool b_miss = false;
+        
+        // Enter critical section.
+        pthread_mutex_lock(&(p_pool->mutex));
+        
+        if (NULL == p_pool->p_free)
+        {
+            if (-1 == pool_grow(p_pool))
+            {
+                pthread_mutex_unlock(&(p_pool->mutex));
+                goto EXIT;
+            }
+            b_miss = true;
+        }
+        
+        size_t batch = p_pool->cache_max / 2;
+        while ((0 != batch--) &&
+               (NULL != p_pool->p_free))
+        {
+            pool_obj_t * p_move = p_pool->p_free;
+            p_pool->p_free = p_move->p_next;
+            p_pool->free_count--;
+            p_move->p_next = p_cache->p_free;
+            p_cache->p_free = p_move;
+            p_cache->count++;
+        }
+        
+        // Exit critical section.
+        pthread_mutex_unlock(&(p_pool->mutex));
+        
+        atomic_fetch_add_explicit(&(p_cache->refills), 1, memory_order_relaxed);
+        if (true == b_miss)
+        {
+            atomic_fetch_add_explicit(&(p_cache->misses), 1, memory_order_relaxed);
+        }
+        else
+        {
+            atomic_fetch_add_explicit(&(p_cache->hits), 1, memory_order_relaxed);
+        }
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&(p_cache->hits), 1, memory_order_relaxed);
+    }
+    
+    // Pop from the thread's cache.
+    p_obj = p_cache->p_free;
+    p_cache->p_free = p_obj->p_next;
+    p_cache->count--;
+    
+    EXIT:
+        return p_obj;
+}
+
+/*!
+ * @brief This function returns an object to the pool.
+ *
+ *          The object may be freed by a different thread than the one
+ *              that allocated it.
+ *
+ * @param[in/out] p_pool The pool context.
+ * @param[in/out] p_obj The object to free. NULL is ignored.
+ *
+ * @return No return value expected.
+ */
+void
+pool_free (pool_t * p_pool, void * p_obj)
+{
+    if ((NULL == p_pool) ||
+        (NULL == p_obj))
+    {
+        goto EXIT;
+    }
+    
+    pool_obj_t * p_free = (pool_obj_t *) p_obj;
+    pool_cache_t * p_cache = pool_cache_get(p_pool);
+    if (NULL == p_cache)
+    {
+        // Without a cache, return the object to the shared free list.
+        pthread_mutex_lock(&(p_pool->mutex));
+        p_free->p_next = p_pool->p_free;
+        p_pool->p_free = p_free;
+        p_pool->free_count++;
+        pthread_mutex_unlock(&(p_pool->mutex));
+        goto EXIT;
+    }
+    
+    // Push onto the thread's cache.
+    p_free->p_next = p_cache->p_free;
+    p_cache->p_free = p_free;
+    p_cache->count++;
+    
+    // If the cache is over its limit, return half of it to the shared list.
+    if (p_cache->count > p_pool->cache_max)
+    {
+        size_t batch = p_pool->cache_max / 2;
+        
+        // Enter critical section.
+        pthread_mutex_lock(&(p_pool->mutex));
+        
+        while (0 != batch--)
+        {
+            pool_obj_t * p_move = p_cache->p_free;
+            p_cache->p_free = p_move->p_next;
+            p_cache->count--;
+            p_move->p_next = p_pool->p_free;
+            p_pool->p_free = p_move;
+            p_pool->free_count++;
+        }
+        
+        // Exit critical section.
+        pthread_mutex_unlock(&(p_pool->mutex));
+    }
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function takes a snapshot of a pool's counters.
+ *
+ *          Counters of live threads are read without stopping them,
+ *              so the snapshot is approximate while the pool is in use.
+ *
+ * @param[in/out] p_pool The pool context.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+pool_stats (pool_t * p_pool, pool_stats_t * p_stats)
+{
+    int status = -1;
+    if ((NULL == p_pool) ||
+        (NULL == p_stats))
+    {
+        goto EXIT;
+    }
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_pool->mutex));
+    
+    p_stats->hits = p_pool->hits;
+    p_stats->misses = p_pool->misses;
+    p_stats->refills = p_pool->refills;
+    p_stats->slabs = p_pool->num_slabs;
+    
+    // Merge the counters of each live cache.
+    for (pool_cache_t * p_cache = p_pool->p_caches;
+         NULL != p_cache;
+         p_cache = p_cache->p_next)
+    {
+        p_stats->hits += atomic_load_explicit(&(p_cache->hits), memory_order_relaxed);
+        p_stats->misses += atomic_load_explicit(&(p_cache->misses), memory_order_relaxed);
+        p_stats->refills += atomic_load_explicit(&(p_cache->refills), memory_order_relaxed);
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_pool->mutex));
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,222 @@
+/*!
+ * @file pool.h
+ *
+ * @brief This file contains a fixed-size object pool allocator.
+ *
+ *          The pool hands out objects of a single size chosen at
+ *              creation time. Objects are carved out of large slabs
+ *              obtained from the system allocator, and freed objects
+ *              are kept for reuse instead of being returned to it.
+ *
+ *          Each thread that uses a pool gets its own small cache of
+ *              free objects, so most allocations and frees take no
+ *              lock. When a thread's cache runs dry it refills a batch
+ *              from the shared free list, and when it grows too large
+ *              it returns a batch. Only when the shared free list is
+ *              empty is a new slab allocated.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - pool_create
+ *              - pool_destroy
+ *              - pool_alloc
+ *              - pool_free
+ *              - pool_stats
+ */
+
+#ifndef COMMON_POOL_H
+#define COMMON_POOL_H
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*!
+ * @brief The default number of objects carved out of each slab.
+ */
+#define POOL_DEFAULT_SLAB_OBJS 256
+
+/*!
+ * @brief The default maximum number of free objects held in a
+ *          single thread's cache before a batch is returned to the
+ *          shared free list.
+ */
+#define POOL_DEFAULT_CACHE_MAX 64
+
+/*!
+ * @brief This datatype defines a free object. The first bytes of a
+ *          free object are reused as the free list link.
+ *
+ * @param p_next Pointer to the next free object.
+ */
+typedef struct _pool_obj pool_obj_t;
+struct _pool_obj
+{
+    pool_obj_t * p_next;
+};
+
+/*!
+ * @brief This datatype defines a slab header. Objects follow the header
+ *          in the same allocation.
+ *
+ * @param p_next Pointer to the next slab owned by the pool.
+ */
+typedef struct _pool_slab pool_slab_t;
+struct _pool_slab
+{
+    pool_slab_t * p_next;
+};
+
+typedef struct _pool pool_t;
+
+/*!
+ * @brief This datatype defines a per-thread object cache.
+ *
+ *          The counters are only written by the owning thread, but are
+ *              atomic so pool_stats may read them at any time.
+ *
+ * @param p_pool The parent pool.
+ * @param p_free The cache's free list.
+ * @param count The number of objects on the cache's free list.
+ * @param hits Allocations served without the system allocator.
+ * @param misses Allocations that required a new slab.
+ * @param refills Batches taken from the shared free list.
+ * @param p_prev The previous cache registered with the pool.
+ * @param p_next The next cache registered with the pool.
+ */
+typedef struct _pool_cache pool_cache_t;
+struct _pool_cache
+{
+    pool_t *       p_pool;
+    pool_obj_t *   p_free;
+    size_t         count;
+    _Atomic size_t hits;
+    _Atomic size_t misses;
+    _Atomic size_t refills;
+    pool_cache_t * p_prev;
+    pool_cache_t * p_next;
+};
+
+/*!
+ * @brief This datatype defines a pool context.
+ *
+ * @param obj_size The size of each object, rounded up for alignment.
+ * @param slab_objs The number of objects per slab.
+ * @param cache_max The maximum number of objects in a thread's cache.
+ * @param key The thread-specific key for the per-thread caches.
+ * @param mutex The mutex protecting the shared state below.
+ * @param p_free The shared free list.
+ * @param free_count The number of objects on the shared free list.
+ * @param p_slabs The list of slabs owned by the pool.
+ * @param num_slabs The number of slabs owned by the pool.
+ * @param p_caches The list of live per-thread caches.
+ * @param hits Hits accumulated from caches of exited threads.
+ * @param misses Misses accumulated from caches of exited threads.
+ * @param refills Refills accumulated from caches of exited threads.
+ */
+struct _pool
+{
+    size_t          obj_size;
+    size_t          slab_objs;
+    size_t          cache_max;
+    pthread_key_t   key;
+    pthread_mutex_t mutex;
+    pool_obj_t *    p_free;
+    size_t          free_count;
+    pool_slab_t *   p_slabs;
+    size_t          num_slabs;
+    pool_cache_t *  p_caches;
+    size_t          hits;
+    size_t          misses;
+    size_t          refills;
+};
+
+/*!
+ * @brief This datatype defines a snapshot of a pool's counters.
+ *
+ * @param hits Allocations served from cached or shared free objects.
+ * @param misses Allocations that required a new slab from the
+ *          system allocator.
+ * @param refills Batches moved from the shared free list into a
+ *          thread's cache.
+ * @param slabs The number of slabs currently owned by the pool.
+ */
+typedef struct _pool_stats
+{
+    size_t hits;
+    size_t misses;
+    size_t refills;
+    size_t slabs;
+} pool_stats_t;
+
+/*!
+ * @brief This function instantiates a new empty pool.
+ *
+ * @param[in] obj_size The size of each object. This must be non-zero,
+ *              or error will be returned.
+ * @param[in] slab_objs The number of objects per slab. Zero selects
+ *              POOL_DEFAULT_SLAB_OBJS.
+ *
+ * @return Pointer to new pool context. NULL on error.
+ */
+pool_t *
+pool_create (const size_t obj_size, const size_t slab_objs);
+
+/*!
+ * @brief This function destroys a pool context.
+ *
+ *          All slabs are returned to the system allocator, which
+ *              invalidates any objects still held by clients.
+ *              No other thread may be using the pool when it is
+ *              destroyed.
+ *
+ * @param[in/out] p_pool The pool context.
+ *
+ * @return No return value expected.
+ */
+void
+pool_destroy (pool_t * p_pool);
+
+/*!
+ * @brief This function allocates an object from the pool.
+ *
+ *          The contents of the returned object are unspecified.
+ *
+ * @param[in/out] p_pool The pool context.
+ *
+ * @return Pointer to the object. NULL on error.
+ */
+void *
+pool_alloc (pool_t * p_pool);
+
+/*!
+ * @brief This function returns an object to the pool.
+ *
+ *          The object may be freed by a different thread than the one
+ *              that allocated it.
+ *
+ * @param[in/out] p_pool The pool context.
+ * @param[in/out] p_obj The object to free. NULL is ignored.
+ *
+ * @return No return value expected.
+ */
+void
+pool_free (pool_t * p_pool, void * p_obj);
+
+/*!
+ * @brief This function takes a snapshot of a pool's counters.
+ *
+ *          Counters of live threads are read without stopping them,
+ *              so the snapshot is approximate while the pool is in use.
+ *
+ * @param[in/out] p_pool The pool context.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+pool_stats (pool_t * p_pool, pool_stats_t * p_stats);
+
+#endif // COMMON_POOL_H
+
+/***   end of file   ***/
@@ -8,16 +8,77 @@
  *              but will not be responsible for allocation or
  *              deallocation of referenced data.
  *
+ *          Nodes are taken from an object pool shared by all queues,
+ *              so steady-state enqueue and dequeue do not touch the
+ *              system allocator.
+ *
  *          Function supported are as follows:
  *
  *              - queue_create
  *              - queue_destroy
  *              - queue_enq
  *              - queue_deq
+ *              - queue_enq_batch
+ *              - queue_deq_batch
+ *              - queue_splice
  */
 
+#include <pthread.h>
+
 #include "queue.h"
 
+/*!
+ * @brief The node pool shared by all queues. It is created by the first
+ *          queue_create and destroyed by the last queue_destroy.
+ */
+static pool_t * gp_node_pool = NULL;
+static size_t g_node_pool_refs = 0;
+static pthread_mutex_t g_node_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * @brief This is a static function that takes a reference on the shared
+ *          node pool, creating it if needed.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+queue_pool_ref (void)
+{
+    int status = -1;
+    
+    pthread_mutex_lock(&g_node_pool_mutex);
+    if (NULL == gp_node_pool)
+    {
+        gp_node_pool = pool_create(sizeof(queue_node_t), 0);
+    }
+    if (NULL != gp_node_pool)
+    {
+        g_node_pool_refs++;
+        status = 0;
+    }
+    pthread_mutex_unlock(&g_node_pool_mutex);
+    
+    return status;
+}
+
+/*!
+ * @brief This is a static function that drops a reference on the shared
+ *          node pool, destroying it with the last reference.
+ *
+ * @return No return value expected.
+ */
+static void
+queue_pool_unref (void)
+{
+    pthread_mutex_lock(&g_node_pool_mutex);
+    if (0 == --g_node_pool_refs)
+    {
+        pool_destroy(gp_node_pool);
+        gp_node_pool = NULL;
+    }
+    pthread_mutex_unlock(&g_node_pool_mutex);
+}
+
 /*!
  * @brief This function instantiates a new empty queue.
  *
@@ -35,6 +96,14 @@ queue_create (void)
     p_queue->p_tail = NULL;
     p_queue->size = 0;
     
+    // Every queue holds a reference on the shared node pool.
+    if (-1 == queue_pool_ref())
+    {
+        free(p_queue);
+        p_queue = NULL;
+        goto EXIT;
+    }
+    
     EXIT:
         return p_queue;
 }
@@ -54,29 +123,27 @@ queue_create (void)
 void
 queue_destroy (queue_t * p_queue)
 {
-    if ((NULL == p_queue) ||
-        (NULL == p_queue->p_head))
+    if (NULL == p_queue)
     {
         goto EXIT;
     }
     
-    // Free each node in the queue.
+    // Return each node in the queue to the node pool.
     queue_node_t * p_curr = p_queue->p_head;
     queue_node_t * p_next = NULL;
     
     while (NULL != p_curr)
     {
         p_next = p_curr->p_next;
-        free(p_curr);
+        pool_free(gp_node_pool, p_curr);
         p_curr = p_next;
     }
     
+    free(p_queue);
+    p_queue = NULL;
+    queue_pool_unref();
+    
     EXIT:
-        if (NULL != p_queue)
-        {
-            free(p_queue);
-            p_queue = NULL;
-        }
         return;
 }
 
@@ -99,7 +166,7 @@ queue_enq (queue_t * p_queue, void * p_data)
     }
     
     // Create a new node.
-    queue_node_t * p_new = calloc(1, sizeof(queue_node_t));
+    queue_node_t * p_new = pool_alloc(gp_node_pool);
     if (NULL == p_new)
     {
         goto EXIT;
@@ -145,7 +212,7 @@ queue_deq (queue_t * p_queue)
     
     queue_node_t * p_next = p_queue->p_head->p_next;
     p_result = p_queue->p_head->p_data;
-    free(p_queue->p_head);
+    pool_free(gp_node_pool, p_queue->p_head);
     p_queue->p_head = p_next;
     
     if (NULL == p_queue->p_head)
@@ -158,4 +225,169 @@ queue_deq (queue_t * p_queue)
         return p_result;
 }
 
+/*!
+ * @brief This function enqueues an array of data into the queue.
+ *
+ *          The nodes are linked into a chain first and the chain is
+ *              then spliced onto the tail of the queue in one step.
+ *              Either every entry is enqueued or none are.
+ *
+ * @param[in/out] p_queue The queue context.
+ * @param[in] pp_data The array of data to enqueue, in order. No entry
+ *              may be NULL.
+ * @param[in] count The number of entries in the array. Must be non-zero.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+queue_enq_batch (queue_t * p_queue, void * const * pp_data, const size_t count)
+{
+    int status = -1;
+    queue_node_t * p_first = NULL;
+    queue_node_t * p_last = NULL;
+    if ((NULL == p_queue) ||
+        (NULL == pp_data) ||
+        (0 == count))
+    {
+        goto EXIT;
+    }
+    
+    // Build the chain of new nodes.
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        if (NULL == pp_data[idx])
+        {
+            goto EXIT;
+        }
+        
+        queue_node_t * p_new = pool_alloc(gp_node_pool);
+        if (NULL == p_new)
+        {
+            goto EXIT;
+        }
+        p_new->p_data = pp_data[idx];
+        p_new->p_next = NULL;
+        
+        if (NULL == p_first)
+        {
+            p_first = p_new;
+        }
+        else
+        {
+            p_last->p_next = p_new;
+        }
+        p_last = p_new;
+    }
+    
+    // Splice the chain onto the tail of the queue.
+    if (NULL == p_queue->p_head)
+    {
+        p_queue->p_head = p_first;
+    }
+    else
+    {
+        p_queue->p_tail->p_next = p_first;
+    }
+    p_queue->p_tail = p_last;
+    p_queue->size += count;
+    
+    status = 0;
+    
+    EXIT:
+        // On error, return any partially built chain to the node pool.
+        if (-1 == status)
+        {
+            while (NULL != p_first)
+            {
+                queue_node_t * p_next = p_first->p_next;
+                pool_free(gp_node_pool, p_first);
+                p_first = p_next;
+            }
+        }
+        return status;
+}
+
+/*!
+ * @brief This function dequeues up to max_count nodes from the front
+ *          of the queue.
+ *
+ * @param[in/out] p_queue The queue context.
+ * @param[out] pp_data The array to receive the dequeued data, in order.
+ * @param[in] max_count The maximum number of entries to dequeue.
+ *
+ * @return The number of entries dequeued. 0 on error or empty queue.
+ */
+size_t
+queue_deq_batch (queue_t * p_queue, void ** pp_data, const size_t max_count)
+{
+    size_t count = 0;
+    if ((NULL == p_queue) ||
+        (NULL == pp_data))
+    {
+        goto EXIT;
+    }
+    
+    while ((count < max_count) &&
+           (NULL != p_queue->p_head))
+    {
+        queue_node_t * p_next = p_queue->p_head->p_next;
+        pp_data[count++] = p_queue->p_head->p_data;
+        pool_free(gp_node_pool, p_queue->p_head);
+        p_queue->p_head = p_next;
+    }
+    
+    if (NULL == p_queue->p_head)
+    {
+        p_queue->p_tail = NULL;
+    }
+    p_queue->size -= count;
+    
+    EXIT:
+        return count;
+}
+
+/*!
+ * @brief This function moves every node of one queue onto the tail of
+ *          another in constant time. The source queue is left empty.
+ *
+ * @param[in/out] p_dst The queue to append to.
+ * @param[in/out] p_src The queue to take nodes from.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+queue_splice (queue_t * p_dst, queue_t * p_src)
+{
+    int status = -1;
+    if ((NULL == p_dst) ||
+        (NULL == p_src) ||
+        (p_dst == p_src))
+    {
+        goto EXIT;
+    }
+    
+    if (NULL != p_src->p_head)
+    {
+        if (NULL == p_dst->p_head)
+        {
+            p_dst->p_head = p_src->p_head;
+        }
+        else
+        {
+            p_dst->p_tail->p_next = p_src->p_head;
+        }
+        p_dst->p_tail = p_src->p_tail;
+        p_dst->size += p_src->size;
+        
+        p_src->p_head = NULL;
+        p_src->p_tail = NULL;
+        p_src->size = 0;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
 /***   end of file   ***/
\ No newline at end of file
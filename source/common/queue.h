@@ -8,12 +8,19 @@
  *              but will not be responsible for allocation or
  *              deallocation of referenced data.
  *
+ *          Nodes are taken from an object pool shared by all queues,
+ *              so steady-state enqueue and dequeue do not touch the
+ *              system allocator.
+ *
  *          Function supported are as follows:
  *
  *              - queue_create
  *              - queue_destroy
  *              - queue_enq
  *              - queue_deq
+ *              - queue_enq_batch
+ *              - queue_deq_batch
+ *              - queue_splice
  */
 
 #ifndef COMMON_QUEUE_H
@@ -21,6 +28,8 @@
 
 #include <stdlib.h>
 
+#include "pool.h"
+
 /*!
  * @brief This datatype defines a node for the linked list.
  *
@@ -93,6 +102,48 @@ queue_enq (queue_t * p_queue, void * p_data);
 void *
 queue_deq (queue_t * p_queue);
 
+/*!
+ * @brief This function enqueues an array of data into the queue.
+ *
+ *          The nodes are linked into a chain first and the chain is
+ *              then spliced onto the tail of the queue in one step.
+ *              Either every entry is enqueued or none are.
+ *
+ * @param[in/out] p_queue The queue context.
+ * @param[in] pp_data The array of data to enqueue, in order. No entry
+ *              may be NULL.
+ * @param[in] count The number of entries in the array. Must be non-zero.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+queue_enq_batch (queue_t * p_queue, void * const * pp_data, const size_t count);
+
+/*!
+ * @brief This function dequeues up to max_count nodes from the front
+ *          of the queue.
+ *
+ * @param[in/out] p_queue The queue context.
+ * @param[out] pp_data The array to receive the dequeued data, in order.
+ * @param[in] max_count The maximum number of entries to dequeue.
+ *
+ * @return The number of entries dequeued. 0 on error or empty queue.
+ */
+size_t
+queue_deq_batch (queue_t * p_queue, void ** pp_data, const size_t max_count);
+
+/*!
+ * @brief This function moves every node of one queue onto the tail of
+ *          another in constant time. The source queue is left empty.
+ *
+ * @param[in/out] p_dst The queue to append to.
+ * @param[in/out] p_src The queue to take nodes from.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+queue_splice (queue_t * p_dst, queue_t * p_src);
+
 #endif // COMMON_QUEUE_H
 
 /***   end of file   ***/
\ No newline at end of file
@@ -0,0 +1,265 @@
+/*!
+ * @file ring.c
+ *
+ * @brief This file contains a bounded lock-free multi-producer
+ *          multi-consumer ring queue.
+ *
+ *          The ring has a fixed power-of-two capacity chosen at
+ *              creation time. All memory is allocated up front, so
+ *              enqueue and dequeue never touch the system allocator
+ *              and never take a lock.
+ *
+ *          Each slot carries a sequence number. A slot at position
+ *              pos is free for a producer when its sequence equals
+ *              pos, and holds data for a consumer when its sequence
+ *              equals pos + 1. Producers and consumers claim
+ *              positions by compare-and-swap on their cursor.
+ */
+
+#include <string.h>
+
+#include "ring.h"
+
+/*!
+ * @brief This function instantiates a new empty ring.
+ *
+ * @param[in] capacity The maximum number of entries in the ring.
+ *              This must be a non-zero power of two, or error will
+ *              be returned.
+ *
+ * @return Pointer to new ring context. NULL on error.
+ */
+ring_t *
+ring_create (const size_t capacity)
+{
+    int status = -1;
+    ring_t * p_ring = NULL;
+    if ((0 == capacity) ||
+        (0 != (capacity & (capacity - 1))))
+    {
+        goto EXIT;
+    }
+    
+    // The context is cache line aligned so the cursors do not share a line.
+    p_ring = aligned_alloc(RING_CACHE_LINE, sizeof(ring_t));
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    memset(p_ring, 0, sizeof(ring_t));
+    p_ring->mask = capacity - 1;
+    atomic_init(&(p_ring->enq_pos), 0);
+    atomic_init(&(p_ring->deq_pos), 0);
+    
+    p_ring->p_cells = calloc(capacity, sizeof(ring_cell_t));
+    if (NULL == p_ring->p_cells)
+    {
+        goto EXIT;
+    }
+    
+    // Each slot starts out free for the producer at its own position.
+    for (size_t idx = 0; idx < capacity; ++idx)
+    {
+        atomic_init(&(p_ring->p_cells[idx].seq), idx);
+        p_ring->p_cells[idx].p_data = NULL;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_ring))
+        {
+            ring_destroy(p_ring);
+            p_ring = NULL;
+        }
+        return p_ring;
+}
+
+/*!
+ * @brief This function destroys a ring context.
+ *
+ *          This will not deallocate any data referenced by the ring.
+ *              No other thread may be using the ring when it is
+ *              destroyed.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return No return value expected.
+ */
+void
+ring_destroy (ring_t * p_ring)
+{
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    
+    free(p_ring->p_cells);
+    p_ring->p_cells = NULL;
+    free(p_ring);
+    p_ring = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function attempts to enqueue data into the ring.
+ *
+ *          This function never blocks.
+ *
+ * @param[in/out] p_ring The ring context.
+ * @param[in/out] p_data The data to enqueue.
+ *
+ * @return 0 on success, -1 on error or if the ring is full.
+ */
+int
+ring_try_enq (ring_t * p_ring, void * p_data)
+{
+    int status = -1;
+    if ((NULL == p_ring) ||
+        (NULL == p_data))
+    {
+        goto EXIT;
+    }
+    
+    ring_cell_t * p_cell = NULL;
+    size_t pos = atomic_load_explicit(&(p_ring->enq_pos), memory_order_relaxed);
+    
+    for (;;)
+    {
+        p_cell = p_ring->p_cells + (pos & p_ring->mask);
+        size_t seq = atomic_load_explicit(&(p_cell->seq), memory_order_acquire);
+        long diff = (long) (seq - pos);
+        
+        if (0 == diff)
+        {
+            // The slot is free, try to claim this position.
+            if (atomic_compare_exchange_weak_explicit(&(p_ring->enq_pos),
+                                                      &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The slot still holds data from the previous lap: ring is full.
+            goto EXIT;
+        }
+        else
+        {
+            // Another producer claimed this position, reload the cursor.
+            pos = atomic_load_explicit(&(p_ring->enq_pos), memory_order_relaxed);
+        }
+    }
+    
+    // Publish the data to consumers.
+    p_cell->p_data = p_data;
+    atomic_store_explicit(&(p_cell->seq), pos + 1, memory_order_release);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function attempts to dequeue the oldest entry in the ring.
+ *
+ *          This function never blocks.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return Pointer to the dequeued data. NULL on error or empty ring.
+ */
+void *
+ring_try_deq (ring_t * p_ring)
+{
+    void * p_result = NULL;
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    
+    ring_cell_t * p_cell = NULL;
+    size_t pos = atomic_load_explicit(&(p_ring->deq_pos), memory_order_relaxed);
+    
+    for (;;)
+    {
+        p_cell = p_ring->p_cells + (pos & p_ring->mask);
+        size_t seq = atomic_load_explicit(&(p_cell->seq), memory_order_acquire);
+        long diff = (long) (seq - (pos + 1));
+        
+        if (0 == diff)
+        {
+            // The slot holds data, try to claim this position.
+            if (atomic_compare_exchange_weak_explicit(&(p_ring->deq_pos),
+                                                      &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // No producer has filled this slot yet: ring is empty.
+            goto EXIT;
+        }
+        else
+        {
+            // Another consumer claimed this position, reload the cursor.
+            pos = atomic_load_explicit(&(p_ring->deq_pos), memory_order_relaxed);
+        }
+    }
+    
+    // Take the data and hand the slot to the producer one lap ahead.
+    p_result = p_cell->p_data;
+    p_cell->p_data = NULL;
+    atomic_store_explicit(&(p_cell->seq), pos + p_ring->mask + 1,
+                          memory_order_release);
+    
+    EXIT:
+        return p_result;
+}
+
+/*!
+ * @brief This function returns the number of entries in the ring.
+ *
+ *          While other threads are operating on the ring this is
+ *              only an estimate.
+ *
+ * @param[in] p_ring The ring context.
+ *
+ * @return The number of entries. 0 on error.
+ */
+size_t
+ring_size (ring_t * p_ring)
+{
+    size_t size = 0;
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    
+    size_t deq = atomic_load_explicit(&(p_ring->deq_pos), memory_order_acquire);
+    size_t enq = atomic_load_explicit(&(p_ring->enq_pos), memory_order_acquire);
+    
+    // The cursors are read separately, so clamp any transient skew.
+    if (enq > deq)
+    {
+        size = enq - deq;
+    }
+    if (size > (p_ring->mask + 1))
+    {
+        size = p_ring->mask + 1;
+    }
+    
+    EXIT:
+        return size;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,136 @@
+/*!
+ * @file ring.h
+ *
+ * @brief This file contains a bounded lock-free multi-producer
+ *          multi-consumer ring queue.
+ *
+ *          The ring has a fixed power-of-two capacity chosen at
+ *              creation time. All memory is allocated up front, so
+ *              enqueue and dequeue never touch the system allocator
+ *              and never take a lock.
+ *
+ *          Each slot carries a sequence number that tells producers
+ *              and consumers whether the slot is ready for them,
+ *              so any number of threads may enqueue and dequeue
+ *              concurrently.
+ *
+ *          Like queue_t, the ring holds references to data and is
+ *              not responsible for allocation or deallocation of
+ *              the referenced data.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - ring_create
+ *              - ring_destroy
+ *              - ring_try_enq
+ *              - ring_try_deq
+ *              - ring_size
+ */
+
+#ifndef COMMON_RING_H
+#define COMMON_RING_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/*!
+ * @brief The assumed cache line size. Producer and consumer cursors
+ *          are placed on separate cache lines to avoid false sharing.
+ */
+#define RING_CACHE_LINE 64
+
+/*!
+ * @brief This datatype defines a single slot in the ring.
+ *
+ * @param seq The slot's sequence number.
+ * @param p_data Pointer to the referenced data.
+ */
+typedef struct _ring_cell
+{
+    _Atomic size_t seq;
+    void *         p_data;
+} ring_cell_t;
+
+/*!
+ * @brief This datatype defines a ring context.
+ *
+ * @param p_cells The array of slots.
+ * @param mask The capacity minus one, used to wrap cursors.
+ * @param enq_pos The producer cursor.
+ * @param deq_pos The consumer cursor.
+ */
+typedef struct _ring
+{
+    ring_cell_t *  p_cells;
+    size_t         mask;
+    _Alignas(RING_CACHE_LINE) _Atomic size_t enq_pos;
+    _Alignas(RING_CACHE_LINE) _Atomic size_t deq_pos;
+} ring_t;
+
+/*!
+ * @brief This function instantiates a new empty ring.
+ *
+ * @param[in] capacity The maximum number of entries in the ring.
+ *              This must be a non-zero power of two, or error will
+ *              be returned.
+ *
+ * @return Pointer to new ring context. NULL on error.
+ */
+ring_t *
+ring_create (const size_t capacity);
+
+/*!
+ * @brief This function destroys a ring context.
+ *
+ *          This will not deallocate any data referenced by the ring.
+ *              No other thread may be using the ring when it is
+ *              destroyed.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return No return value expected.
+ */
+void
+ring_destroy (ring_t * p_ring);
+
+/*!
+ * @brief This function attempts to enqueue data into the ring.
+ *
+ *          This function never blocks.
+ *
+ * @param[in/out] p_ring The ring context.
+ * @param[in/out] p_data The data to enqueue.
+ *
+ * @return 0 on success, -1 on error or if the ring is full.
+ */
+int
+ring_try_enq (ring_t * p_ring, void * p_data);
+
+/*!
+ * @brief This function attempts to dequeue the oldest entry in the ring.
+ *
+ *          This function never blocks.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return Pointer to the dequeued data. NULL on error or empty ring.
+ */
+void *
+ring_try_deq (ring_t * p_ring);
+
+/*!
+ * @brief This function returns the number of entries in the ring.
+ *
+ *          While other threads are operating on the ring this is
+ *              only an estimate.
+ *
+ * @param[in] p_ring The ring context.
+ *
+ * @return The number of entries. 0 on error.
+ */
+size_t
+ring_size (ring_t * p_ring);
+
+#endif // COMMON_RING_H
+
+/***   end of file   ***/
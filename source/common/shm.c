@@ -0,0 +1,750 @@
+/*!
+ * @file shm.c
+ *
+ * @brief This file contains a shared-memory transport for clients on the
+ *          same host as the server.
+ *
+ *          Sleeping on a doorbell follows one pattern on both sides. The
+ *              sleeper says it is waiting, reads the doorbell, checks
+ *              once more for work, and only then waits on the doorbell
+ *              for the value it read. The other side publishes its work
+ *              before checking whether anyone is waiting, and rings the
+ *              doorbell by bumping it before the wake-up, so either the
+ *              sleeper sees the work or the wait sees a changed
+ *              doorbell and returns at once.
+ *
+ *          Before going to sleep, a side polls a few times, yielding the
+ *              processor in between, so a steady stream of requests
+ *              costs no system calls at all.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm.h"
+
+/*!
+ * @brief The number of times a side polls before sleeping.
+ */
+#define SHM_SPIN_POLLS 64
+
+/*!
+ * @brief This is a static function that waits on a doorbell while it
+ *          holds the given value. Wake-ups may be spurious.
+ *
+ * @param[in] p_bell The doorbell.
+ * @param[in] value The value read before checking for work.
+ *
+ * @return No return value expected.
+ */
+static void
+shm_bell_wait (_Atomic uint32_t * p_bell, const uint32_t value)
+{
+    // The doorbell is shared between processes, so the futex is not
+    // private.
+    (void) syscall(SYS_futex, (uint32_t *) p_bell, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+/*!
+ * @brief This is a static function that rings a doorbell if its owner
+ *          said it is waiting. The caller's work must be published.
+ *
+ * @param[in/out] p_bell The doorbell.
+ * @param[in] p_waiting The owner's waiting flag.
+ *
+ * @return No return value expected.
+ */
+static void
+shm_bell_ring (_Atomic uint32_t * p_bell, _Atomic uint32_t * p_waiting)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 != atomic_load_explicit(p_waiting, memory_order_relaxed))
+    {
+        atomic_fetch_add(p_bell, 1);
+        (void) syscall(SYS_futex, (uint32_t *) p_bell, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*!
+ * @brief This is a static function that computes the size of a segment.
+ *
+ * @param[in] num_channels The number of channels.
+ * @param[in] depth The number of slots per channel.
+ *
+ * @return The size in bytes.
+ */
+static size_t
+shm_size (const size_t num_channels, const size_t depth)
+{
+    return sizeof(shm_header_t) +
+           (num_channels * sizeof(shm_channel_t)) +
+           (num_channels * depth * sizeof(shm_slot_t));
+}
+
+/*!
+ * @brief This is a static function that maps a segment and fills in a
+ *          view of it.
+ *
+ * @param[in/out] p_shm The view, with its size set.
+ * @param[in] fd The segment's descriptor.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+shm_map (shm_t * p_shm, const int fd)
+{
+    int status = -1;
+    void * p_map = mmap(NULL, p_shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == p_map)
+    {
+        goto EXIT;
+    }
+    p_shm->p_header = p_map;
+    p_shm->p_channels = (shm_channel_t *) (p_shm->p_header + 1);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that returns a slot of a channel.
+ *
+ * @param[in] p_shm The view of the segment.
+ * @param[in] channel The channel's index.
+ * @param[in] seq The sequence number of a request in the channel.
+ *
+ * @return Pointer to the slot.
+ */
+static shm_slot_t *
+shm_slot (shm_t * p_shm, const size_t channel, const uint64_t seq)
+{
+    return p_shm->p_slots + (channel * p_shm->depth) + (seq & (p_shm->depth - 1));
+}
+
+/*!
+ * @brief This is a static function that checks a request the client
+ *          published may be taken: its slot's previous request must have
+ *          been answered, as a client never reuses a slot before reading
+ *          the response it held.
+ *
+ * @param[in] p_shm The server's view of the segment.
+ * @param[in] channel The channel's index.
+ * @param[in] seq The request's sequence number.
+ *
+ * @return true if it may be taken, false if the client broke the ring's
+ *          rules.
+ */
+static bool
+shm_slot_free (shm_t * p_shm, const size_t channel, const uint64_t seq)
+{
+    uint64_t done = atomic_load_explicit(&(shm_slot(p_shm, channel, seq)->done),
+                                         memory_order_acquire);
+    if (seq < p_shm->depth)
+    {
+        return (0 == done);
+    }
+    return ((seq - p_shm->depth + 1) == done);
+}
+
+/*!
+ * @brief This is a static function that marks a channel broken and wakes
+ *          its client to find out.
+ *
+ * @param[in/out] p_channel The channel.
+ *
+ * @return No return value expected.
+ */
+static void
+shm_break (shm_channel_t * p_channel)
+{
+    atomic_store(&(p_channel->b_broken), 1);
+    shm_bell_ring(&(p_channel->bell), &(p_channel->b_waiting));
+}
+
+/*!
+ * @brief This is a static function that checks whether any channel has
+ *          a request the server has not taken.
+ *
+ * @param[in] p_shm The server's view of the segment.
+ *
+ * @return true if a request is waiting, false otherwise.
+ */
+static bool
+shm_pending (shm_t * p_shm)
+{
+    for (size_t idx = 0; idx < p_shm->num_channels; ++idx)
+    {
+        shm_channel_t * p_channel = p_shm->p_channels + idx;
+        if ((0 == atomic_load_explicit(&(p_channel->b_broken), memory_order_relaxed)) &&
+            (atomic_load_explicit(&(p_channel->req_tail), memory_order_acquire) !=
+             atomic_load_explicit(&(p_channel->req_head), memory_order_relaxed)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief This function creates a segment, replacing any stale one of the
+ *          same name, with every channel free.
+ *
+ * @param[in] p_name The segment's name, starting with a slash.
+ * @param[in] num_channels The number of channels, at most
+ *              SHM_MAX_CHANNELS.
+ * @param[in] depth The number of slots per channel. Must be a power of
+ *              two no larger than SHM_MAX_DEPTH.
+ *
+ * @return Pointer to the server's view of the segment. NULL on error.
+ */
+shm_t *
+shm_create (const char * p_name, const size_t num_channels, const size_t depth)
+{
+    int status = -1;
+    int fd = -1;
+    shm_t * p_shm = NULL;
+    if ((NULL == p_name) ||
+        ('/' != p_name[0]) ||
+        (strlen(p_name) >= SHM_NAME_MAX) ||
+        (0 == num_channels) ||
+        (num_channels > SHM_MAX_CHANNELS) ||
+        (0 == depth) ||
+        (depth > SHM_MAX_DEPTH) ||
+        (0 != (depth & (depth - 1))))
+    {
+        goto EXIT;
+    }
+    
+    p_shm = calloc(1, sizeof(shm_t));
+    if (NULL == p_shm)
+    {
+        goto EXIT;
+    }
+    strcpy(p_shm->name, p_name);
+    p_shm->size = shm_size(num_channels, depth);
+    p_shm->depth = depth;
+    p_shm->num_channels = num_channels;
+    
+    // A segment left by a server that did not exit cleanly is replaced.
+    // A fresh segment is zeroed, so every channel starts out free.
+    (void) shm_unlink(p_name);
+    fd = shm_open(p_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (-1 == fd)
+    {
+        goto EXIT;
+    }
+    p_shm->b_server = true;
+    if ((-1 == ftruncate(fd, p_shm->size)) ||
+        (-1 == shm_map(p_shm, fd)))
+    {
+        goto EXIT;
+    }
+    p_shm->p_slots = (shm_slot_t *) (p_shm->p_channels + num_channels);
+    p_shm->p_header->num_channels = num_channels;
+    p_shm->p_header->depth = depth;
+    p_shm->p_header->size = p_shm->size;
+    atomic_store_explicit(&(p_shm->p_header->magic), SHM_MAGIC, memory_order_release);
+    
+    status = 0;
+    
+    EXIT:
+        if (-1 != fd)
+        {
+            close(fd);
+        }
+        if ((-1 == status) &&
+            (NULL != p_shm))
+        {
+            shm_destroy(p_shm);
+            p_shm = NULL;
+        }
+        return p_shm;
+}
+
+/*!
+ * @brief This function unmaps and unlinks a segment created by
+ *          shm_create. Attached clients keep their mapping.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ *
+ * @return No return value expected.
+ */
+void
+shm_destroy (shm_t * p_shm)
+{
+    if (NULL == p_shm)
+    {
+        goto EXIT;
+    }
+    
+    // Clients waiting on a response are woken to find the segment gone.
+    if ((true == p_shm->b_server) &&
+        (NULL != p_shm->p_header))
+    {
+        atomic_store(&(p_shm->p_header->magic), 0);
+        for (size_t idx = 0; idx < p_shm->num_channels; ++idx)
+        {
+            shm_channel_t * p_channel = p_shm->p_channels + idx;
+            shm_bell_ring(&(p_channel->bell), &(p_channel->b_waiting));
+        }
+    }
+    if (NULL != p_shm->p_header)
+    {
+        munmap(p_shm->p_header, p_shm->size);
+    }
+    if (true == p_shm->b_server)
+    {
+        (void) shm_unlink(p_shm->name);
+    }
+    free(p_shm);
+    p_shm = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function takes waiting requests from the channels, going
+ *          round them so no channel starves the others. The server has
+ *          one poller.
+ *
+ *          A channel whose client published more than depth requests
+ *              ahead of what was taken, or reused a slot whose response
+ *              was not sent, is marked broken and its client woken, and
+ *              nothing more is taken from it.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ * @param[out] p_reqs The requests taken.
+ * @param[in] max_reqs The most requests to take.
+ *
+ * @return The number of requests taken. 0 on error.
+ */
+size_t
+shm_poll (shm_t * p_shm, shm_req_t * p_reqs, const size_t max_reqs)
+{
+    size_t num_reqs = 0;
+    if ((NULL == p_shm) ||
+        (NULL == p_reqs) ||
+        (false == p_shm->b_server))
+    {
+        goto EXIT;
+    }
+    
+    size_t start = p_shm->next;
+    for (size_t count = 0; (count < p_shm->num_channels) && (num_reqs < max_reqs); ++count)
+    {
+        size_t channel = (start + count) % p_shm->num_channels;
+        shm_channel_t * p_channel = p_shm->p_channels + channel;
+        if (0 != atomic_load_explicit(&(p_channel->b_broken), memory_order_relaxed))
+        {
+            continue;
+        }
+        uint64_t head = atomic_load_explicit(&(p_channel->req_head), memory_order_relaxed);
+        uint64_t tail = atomic_load_explicit(&(p_channel->req_tail), memory_order_acquire);
+        if ((tail - head) > p_shm->depth)
+        {
+            shm_break(p_channel);
+            continue;
+        }
+        while ((head != tail) &&
+               (num_reqs < max_reqs))
+        {
+            if (false == shm_slot_free(p_shm, channel, head))
+            {
+                shm_break(p_channel);
+                break;
+            }
+            shm_slot_t * p_slot = shm_slot(p_shm, channel, head);
+            p_reqs[num_reqs].channel = channel;
+            p_reqs[num_reqs].seq = head;
+            p_reqs[num_reqs].p_request = p_slot->request;
+            p_reqs[num_reqs].p_response = p_slot->response;
+            num_reqs++;
+            head++;
+        }
+        atomic_store_explicit(&(p_channel->req_head), head, memory_order_relaxed);
+    }
+    p_shm->next = (start + 1) % p_shm->num_channels;
+    
+    EXIT:
+        return num_reqs;
+}
+
+/*!
+ * @brief This function publishes the response to a request once its
+ *          response frame is filled, and wakes the client if it is
+ *          waiting. Any thread may respond, in any order.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ * @param[in] p_req The request.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+shm_respond (shm_t * p_shm, const shm_req_t * p_req)
+{
+    int status = -1;
+    if ((NULL == p_shm) ||
+        (NULL == p_req) ||
+        (p_req->channel >= p_shm->num_channels))
+    {
+        goto EXIT;
+    }
+    
+    shm_channel_t * p_channel = p_shm->p_channels + p_req->channel;
+    shm_slot_t * p_slot = shm_slot(p_shm, p_req->channel, p_req->seq);
+    atomic_store_explicit(&(p_slot->done), p_req->seq + 1, memory_order_release);
+    shm_bell_ring(&(p_channel->bell), &(p_channel->b_waiting));
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function puts the poller to sleep until a client sends a
+ *          request or shm_wake is called. It returns at once if a
+ *          request is already waiting.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+shm_wait (shm_t * p_shm)
+{
+    int status = -1;
+    if ((NULL == p_shm) ||
+        (false == p_shm->b_server))
+    {
+        goto EXIT;
+    }
+    
+    for (size_t spin = 0; spin < SHM_SPIN_POLLS; ++spin)
+    {
+        if (true == shm_pending(p_shm))
+        {
+            status = 0;
+            goto EXIT;
+        }
+        sched_yield();
+    }
+    
+    // A wake-up that came before the doorbell was read would not stop the
+    // wait, so it is also left in the view.
+    shm_header_t * p_header = p_shm->p_header;
+    atomic_store(&(p_header->b_waiting), 1);
+    uint32_t bell = atomic_load(&(p_header->bell));
+    if ((false == atomic_exchange(&(p_shm->b_woken), false)) &&
+        (false == shm_pending(p_shm)))
+    {
+        shm_bell_wait(&(p_header->bell), bell);
+    }
+    atomic_store_explicit(&(p_header->b_waiting), 0, memory_order_relaxed);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function wakes the poller from shm_wait, or makes its next
+ *          call return at once.
+ *
+ *          It is async-signal-safe, so it may be called from a signal
+ *              handler.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ *
+ * @return No return value expected.
+ */
+void
+shm_wake (shm_t * p_shm)
+{
+    if (NULL == p_shm)
+    {
+        goto EXIT;
+    }
+    
+    atomic_store(&(p_shm->b_woken), true);
+    atomic_fetch_add(&(p_shm->p_header->bell), 1);
+    (void) syscall(SYS_futex, (uint32_t *) &(p_shm->p_header->bell), FUTEX_WAKE, INT_MAX,
+                   NULL, NULL, 0);
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function attaches to a segment and claims a free channel.
+ *
+ * @param[in] p_name The segment's name.
+ *
+ * @return Pointer to the client's view of the segment. NULL on error or
+ *          if every channel is claimed.
+ */
+shm_t *
+shm_attach (const char * p_name)
+{
+    int status = -1;
+    int fd = -1;
+    shm_t * p_shm = NULL;
+    if ((NULL == p_name) ||
+        (strlen(p_name) >= SHM_NAME_MAX))
+    {
+        goto EXIT;
+    }
+    
+    p_shm = calloc(1, sizeof(shm_t));
+    if (NULL == p_shm)
+    {
+        goto EXIT;
+    }
+    strcpy(p_shm->name, p_name);
+    fd = shm_open(p_name, O_RDWR | O_CLOEXEC, 0);
+    struct stat st;
+    if ((-1 == fd) ||
+        (-1 == fstat(fd, &st)) ||
+        ((size_t) st.st_size < sizeof(shm_header_t)))
+    {
+        goto EXIT;
+    }
+    p_shm->size = st.st_size;
+    if (-1 == shm_map(p_shm, fd))
+    {
+        goto EXIT;
+    }
+    
+    // Trust nothing in the header until the whole layout checks out.
+    shm_header_t * p_header = p_shm->p_header;
+    if ((SHM_MAGIC != atomic_load_explicit(&(p_header->magic), memory_order_acquire)) ||
+        (0 == p_header->num_channels) ||
+        (p_header->num_channels > SHM_MAX_CHANNELS) ||
+        (0 == p_header->depth) ||
+        (p_header->depth > SHM_MAX_DEPTH) ||
+        (0 != (p_header->depth & (p_header->depth - 1))) ||
+        (p_header->size != p_shm->size) ||
+        (shm_size(p_header->num_channels, p_header->depth) != p_shm->size))
+    {
+        goto EXIT;
+    }
+    p_shm->depth = p_header->depth;
+    p_shm->num_channels = p_header->num_channels;
+    p_shm->p_slots = (shm_slot_t *) (p_shm->p_channels + p_shm->num_channels);
+    
+    uint32_t pid = (uint32_t) getpid();
+    for (size_t idx = 0; idx < p_shm->num_channels; ++idx)
+    {
+        uint32_t free_owner = 0;
+        if ((0 == atomic_load(&(p_shm->p_channels[idx].b_broken))) &&
+            (atomic_compare_exchange_strong(&(p_shm->p_channels[idx].owner), &free_owner, pid)))
+        {
+            p_shm->channel = idx;
+            status = 0;
+            break;
+        }
+    }
+    
+    EXIT:
+        if (-1 != fd)
+        {
+            close(fd);
+        }
+        if ((-1 == status) &&
+            (NULL != p_shm))
+        {
+            shm_destroy(p_shm);
+            p_shm = NULL;
+        }
+        return p_shm;
+}
+
+/*!
+ * @brief This function waits for the responses to every request in
+ *          flight, frees the channel and detaches from the segment.
+ *
+ * @param[in/out] p_shm The client's view of the segment.
+ *
+ * @return No return value expected.
+ */
+void
+shm_detach (shm_t * p_shm)
+{
+    if ((NULL == p_shm) ||
+        (true == p_shm->b_server))
+    {
+        goto EXIT;
+    }
+    
+    // The next owner must find no responses left over. A broken channel
+    // is never handed out again.
+    shm_channel_t * p_channel = p_shm->p_channels + p_shm->channel;
+    unsigned char response[MSG_RESP_SIZE];
+    while (0 == shm_recv(p_shm, response, true))
+    {
+    }
+    if (0 == atomic_load(&(p_channel->b_broken)))
+    {
+        atomic_store_explicit(&(p_channel->owner), 0, memory_order_release);
+    }
+    shm_destroy(p_shm);
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function sends a request frame, waking the server if it
+ *          is waiting.
+ *
+ * @param[in/out] p_shm The client's view of the segment.
+ * @param[in] p_request The request frame, MSG_REQ_SIZE bytes.
+ *
+ * @return 0 on success, -1 on error or if depth requests are already
+ *          in flight. errno is set to EPIPE if the server marked the
+ *          channel broken.
+ */
+int
+shm_send (shm_t * p_shm, const unsigned char * p_request)
+{
+    int status = -1;
+    if ((NULL == p_shm) ||
+        (NULL == p_request) ||
+        (true == p_shm->b_server))
+    {
+        goto EXIT;
+    }
+    
+    // A slot is free once the response it held has been read.
+    shm_channel_t * p_channel = p_shm->p_channels + p_shm->channel;
+    if (0 != atomic_load_explicit(&(p_channel->b_broken), memory_order_relaxed))
+    {
+        errno = EPIPE;
+        goto EXIT;
+    }
+    uint64_t tail = atomic_load_explicit(&(p_channel->req_tail), memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&(p_channel->resp_head), memory_order_relaxed);
+    if ((tail - head) >= p_shm->depth)
+    {
+        goto EXIT;
+    }
+    memcpy(shm_slot(p_shm, p_shm->channel, tail)->request, p_request, MSG_REQ_SIZE);
+    atomic_store_explicit(&(p_channel->req_tail), tail + 1, memory_order_release);
+    shm_bell_ring(&(p_shm->p_header->bell), &(p_shm->p_header->b_waiting));
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function reads the response to the oldest request in
+ *          flight.
+ *
+ * @param[in/out] p_shm The client's view of the segment.
+ * @param[out] p_response The response frame, MSG_RESP_SIZE bytes.
+ * @param[in] b_block Whether to wait for the response if it is not
+ *              ready.
+ *
+ * @return 0 on success, -1 on error, if no request is in flight, or if
+ *          the response is not ready and b_block is false. errno is set
+ *          to EPIPE if the server marked the channel broken.
+ */
+int
+shm_recv (shm_t * p_shm, unsigned char * p_response, const bool b_block)
+{
+    int status = -1;
+    if ((NULL == p_shm) ||
+        (NULL == p_response) ||
+        (true == p_shm->b_server))
+    {
+        goto EXIT;
+    }
+    
+    shm_channel_t * p_channel = p_shm->p_channels + p_shm->channel;
+    uint64_t head = atomic_load_explicit(&(p_channel->resp_head), memory_order_relaxed);
+    if (head == atomic_load_explicit(&(p_channel->req_tail), memory_order_relaxed))
+    {
+        goto EXIT;
+    }
+    
+    // Poll for a while, then sleep on the doorbell, giving up if the
+    // server went away or stopped serving the channel.
+    shm_slot_t * p_slot = shm_slot(p_shm, p_shm->channel, head);
+    size_t spin = 0;
+    while ((head + 1) != atomic_load_explicit(&(p_slot->done), memory_order_acquire))
+    {
+        if (0 != atomic_load(&(p_channel->b_broken)))
+        {
+            errno = EPIPE;
+            goto EXIT;
+        }
+        if ((false == b_block) ||
+            (SHM_MAGIC != atomic_load(&(p_shm->p_header->magic))))
+        {
+            goto EXIT;
+        }
+        if (spin < SHM_SPIN_POLLS)
+        {
+            spin++;
+            sched_yield();
+            continue;
+        }
+        atomic_store(&(p_channel->b_waiting), 1);
+        uint32_t bell = atomic_load(&(p_channel->bell));
+        if (((head + 1) != atomic_load(&(p_slot->done))) &&
+            (SHM_MAGIC == atomic_load(&(p_shm->p_header->magic))) &&
+            (0 == atomic_load(&(p_channel->b_broken))))
+        {
+            shm_bell_wait(&(p_channel->bell), bell);
+        }
+        atomic_store_explicit(&(p_channel->b_waiting), 0, memory_order_relaxed);
+    }
+    memcpy(p_response, p_slot->response, MSG_RESP_SIZE);
+    atomic_store_explicit(&(p_channel->resp_head), head + 1, memory_order_relaxed);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function returns the number of requests a client may have
+ *          in flight.
+ *
+ * @param[in] p_shm The view of the segment.
+ *
+ * @return The channel depth. 0 on error.
+ */
+size_t
+shm_depth (shm_t * p_shm)
+{
+    size_t depth = 0;
+    if (NULL == p_shm)
+    {
+        goto EXIT;
+    }
+    
+    depth = p_shm->depth;
+    
+    EXIT:
+        return depth;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,332 @@
+/*!
+ * @file shm.h
+ *
+ * @brief This file contains a shared-memory transport for clients on the
+ *          same host as the server.
+ *
+ *          The server creates a named POSIX shared-memory segment holding
+ *              a fixed number of channels. A client attaches to the
+ *              segment and claims a free channel, which is then its
+ *              own until it detaches.
+ *
+ *          A channel is a ring of depth slots, each with room for one
+ *              request frame and its response frame, laid out as in
+ *              msg.h. The client is the only producer of requests and
+ *              the server's poller the only consumer, so requests move
+ *              through a single-producer single-consumer ring. A
+ *              response is written into its request's slot by
+ *              whichever thread handled it and published through the
+ *              slot's own sequence word, so responses may be finished
+ *              in any order and are still read in request order. A
+ *              client has at most depth requests in flight.
+ *
+ *          Neither side makes a system call while the other is busy.
+ *              A side about to sleep says so in the segment, and the
+ *              other side only rings its doorbell, a futex word in the
+ *              segment, when it sees that.
+ *
+ *          A client that dies without detaching keeps its channel until
+ *              the segment is recreated. So does a client that breaks
+ *              the ring's rules, sending more than depth requests ahead
+ *              of their responses: the server marks its channel broken,
+ *              takes nothing more from it, and the client's calls fail.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - shm_create
+ *              - shm_destroy
+ *              - shm_poll
+ *              - shm_respond
+ *              - shm_wait
+ *              - shm_wake
+ *              - shm_attach
+ *              - shm_detach
+ *              - shm_send
+ *              - shm_recv
+ *              - shm_depth
+ */
+
+#ifndef COMMON_SHM_H
+#define COMMON_SHM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "msg.h"
+
+/*!
+ * @brief The assumed cache line size. Fields written by the client and
+ *          by the server sit on separate lines.
+ */
+#define SHM_CACHE_LINE 64
+
+/*!
+ * @brief The value identifying a segment laid out by this version of
+ *          the transport.
+ */
+#define SHM_MAGIC 0x42534D31
+
+/*!
+ * @brief The longest segment name, including its terminator.
+ */
+#define SHM_NAME_MAX 64
+
+/*!
+ * @brief The largest number of channels and the deepest channel a
+ *          segment may have.
+ */
+#define SHM_MAX_CHANNELS 1024
+#define SHM_MAX_DEPTH 4096
+
+/*!
+ * @brief This datatype defines a slot of a channel.
+ *
+ * @param request The request frame.
+ * @param response The response frame.
+ * @param done One more than the sequence number of the request whose
+ *          response the slot holds.
+ */
+typedef struct _shm_slot
+{
+    unsigned char    request[MSG_REQ_SIZE];
+    unsigned char    response[MSG_RESP_SIZE];
+    _Alignas(SHM_CACHE_LINE) _Atomic uint64_t done;
+} shm_slot_t;
+
+/*!
+ * @brief This datatype defines a channel's shared state.
+ *
+ * @param owner The process id of the attached client. 0 if free.
+ * @param bell The client's doorbell.
+ * @param b_waiting Whether the client is asleep on its doorbell.
+ * @param req_tail The number of requests the client has sent.
+ * @param resp_head The number of responses the client has read.
+ * @param req_head The number of requests the server has taken.
+ * @param b_broken Whether the server found the client breaking the
+ *          ring's rules and stopped serving the channel.
+ */
+typedef struct _shm_channel
+{
+    _Alignas(SHM_CACHE_LINE) _Atomic uint32_t owner;
+    _Atomic uint32_t bell;
+    _Atomic uint32_t b_waiting;
+    _Alignas(SHM_CACHE_LINE) _Atomic uint64_t req_tail;
+    _Atomic uint64_t resp_head;
+    _Alignas(SHM_CACHE_LINE) _Atomic uint64_t req_head;
+    _Atomic uint32_t b_broken;
+} shm_channel_t;
+
+/*!
+ * @brief This datatype defines a segment's header. The channels follow
+ *          it, then every channel's slots.
+ *
+ * @param magic SHM_MAGIC once the segment is ready.
+ * @param num_channels The number of channels.
+ * @param depth The number of slots per channel.
+ * @param size The size of the segment.
+ * @param bell The server's doorbell.
+ * @param b_waiting Whether the server is asleep on its doorbell.
+ */
+typedef struct _shm_header
+{
+    _Atomic uint32_t magic;
+    uint32_t         num_channels;
+    uint32_t         depth;
+    uint64_t         size;
+    _Alignas(SHM_CACHE_LINE) _Atomic uint32_t bell;
+    _Atomic uint32_t b_waiting;
+} shm_header_t;
+
+/*!
+ * @brief This datatype defines a process's view of a segment.
+ *
+ * @param p_header The mapped segment.
+ * @param p_channels The channels.
+ * @param p_slots The slots, channel by channel.
+ * @param size The size of the mapping.
+ * @param depth The number of slots per channel.
+ * @param num_channels The number of channels.
+ * @param b_server Whether this is the server's view, which unlinks the
+ *          segment when destroyed.
+ * @param name The segment's name.
+ * @param channel The channel a client claimed.
+ * @param next The channel the server polls first next time.
+ * @param b_woken Whether shm_wake was called since the poller last
+ *          returned from shm_wait.
+ */
+typedef struct _shm
+{
+    shm_header_t *  p_header;
+    shm_channel_t * p_channels;
+    shm_slot_t *    p_slots;
+    size_t          size;
+    size_t          depth;
+    size_t          num_channels;
+    bool            b_server;
+    char            name[SHM_NAME_MAX];
+    size_t          channel;
+    size_t          next;
+    _Atomic bool    b_woken;
+} shm_t;
+
+/*!
+ * @brief This datatype defines a request the server took from a channel.
+ *
+ * @param channel The channel's index.
+ * @param seq The request's sequence number in its channel.
+ * @param p_request The request frame, in the segment.
+ * @param p_response The response frame to fill, in the segment.
+ */
+typedef struct _shm_req
+{
+    size_t                channel;
+    uint64_t              seq;
+    const unsigned char * p_request;
+    unsigned char *       p_response;
+} shm_req_t;
+
+/*!
+ * @brief This function creates a segment, replacing any stale one of the
+ *          same name, with every channel free.
+ *
+ * @param[in] p_name The segment's name, starting with a slash.
+ * @param[in] num_channels The number of channels, at most
+ *              SHM_MAX_CHANNELS.
+ * @param[in] depth The number of slots per channel. Must be a power of
+ *              two no larger than SHM_MAX_DEPTH.
+ *
+ * @return Pointer to the server's view of the segment. NULL on error.
+ */
+shm_t *
+shm_create (const char * p_name, const size_t num_channels, const size_t depth);
+
+/*!
+ * @brief This function unmaps and unlinks a segment created by
+ *          shm_create. Attached clients keep their mapping.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ *
+ * @return No return value expected.
+ */
+void
+shm_destroy (shm_t * p_shm);
+
+/*!
+ * @brief This function takes waiting requests from the channels, going
+ *          round them so no channel starves the others. The server has
+ *          one poller.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ * @param[out] p_reqs The requests taken.
+ * @param[in] max_reqs The most requests to take.
+ *
+ * @return The number of requests taken. 0 on error.
+ */
+size_t
+shm_poll (shm_t * p_shm, shm_req_t * p_reqs, const size_t max_reqs);
+
+/*!
+ * @brief This function publishes the response to a request once its
+ *          response frame is filled, and wakes the client if it is
+ *          waiting. Any thread may respond, in any order.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ * @param[in] p_req The request.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+shm_respond (shm_t * p_shm, const shm_req_t * p_req);
+
+/*!
+ * @brief This function puts the poller to sleep until a client sends a
+ *          request or shm_wake is called. It returns at once if a
+ *          request is already waiting.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+shm_wait (shm_t * p_shm);
+
+/*!
+ * @brief This function wakes the poller from shm_wait, or makes its next
+ *          call return at once.
+ *
+ *          It is async-signal-safe, so it may be called from a signal
+ *              handler.
+ *
+ * @param[in/out] p_shm The server's view of the segment.
+ *
+ * @return No return value expected.
+ */
+void
+shm_wake (shm_t * p_shm);
+
+/*!
+ * @brief This function attaches to a segment and claims a free channel.
+ *
+ * @param[in] p_name The segment's name.
+ *
+ * @return Pointer to the client's view of the segment. NULL on error or
+ *          if every channel is claimed.
+ */
+shm_t *
+shm_attach (const char * p_name);
+
+/*!
+ * @brief This function waits for the responses to every request in
+ *          flight, frees the channel and detaches from the segment.
+ *
+ * @param[in/out] p_shm The client's view of the segment.
+ *
+ * @return No return value expected.
+ */
+void
+shm_detach (shm_t * p_shm);
+
+/*!
+ * @brief This function sends a request frame, waking the server if it
+ *          is waiting.
+ *
+ * @param[in/out] p_shm The client's view of the segment.
+ * @param[in] p_request The request frame, MSG_REQ_SIZE bytes.
+ *
+ * @return 0 on success, -1 on error or if depth requests are already
+ *          in flight.
+ */
+int
+shm_send (shm_t * p_shm, const unsigned char * p_request);
+
+/*!
+ * @brief This function reads the response to the oldest request in
+ *          flight.
+ *
+ * @param[in/out] p_shm The client's view of the segment.
+ * @param[out] p_response The response frame, MSG_RESP_SIZE bytes.
+ * @param[in] b_block Whether to wait for the response if it is not
+ *              ready.
+ *
+ * @return 0 on success, -1 on error, if no request is in flight, or if
+ *          the response is not ready and b_block is false.
+ */
+int
+shm_recv (shm_t * p_shm, unsigned char * p_response, const bool b_block);
+
+/*!
+ * @brief This function returns the number of requests a client may have
+ *          in flight.
+ *
+ * @param[in] p_shm The view of the segment.
+ *
+ * @return The channel depth. 0 on error.
+ */
+size_t
+shm_depth (shm_t * p_shm);
+
+#endif // COMMON_SHM_H
+
+/***   end of file   ***/
@@ -10,169 +10,2922 @@
  *          When the threadpool is destroyed, threads will be allowed
  *              to finish out any work on the job queue, then be
  *              joined to the main thread for destruction.
+ *
+ *          The job queue may optionally be bounded. When it is full,
+ *              producers wait on a second condition variable which the
+ *              threads signal as they take jobs off the queue.
+ *
+ *          Every submitted job is counted until it finishes. Handle and
+ *              idle waiters share one condition variable, and a job only
+ *              takes the mutex to wake them when someone is waiting,
+ *              which it learns from a waiter count read after publishing
+ *              its completion.
+ *
+ *          In the work-stealing mode a thread that runs out of work
+ *              registers itself as a sleeper and rechecks every queue
+ *              under the mutex before waiting. Producers publish their
+ *              job before reading the sleeper count, so either the
+ *              sleeper sees the job or the producer sees the sleeper
+ *              and wakes it.
+ *
+ *          Idle threads spin on an eventcount before they register as
+ *              sleepers. Producers bump it for every post and only
+ *              signal the condition variable when the sleeper count,
+ *              read under the same ordering, shows a parked thread.
+ *
+ *          A keyed serial queue's mutex may be held while taking the
+ *              threadpool mutex, never the other way round.
+ *
+ *          A parallel range is reference counted, so the caller can
+ *              return as soon as every chunk has run, while helper jobs
+ *              still queued behind other work release it when they
+ *              eventually start and find nothing left to claim.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "threadpool.h"
 
 /*!
- * @brief This is a static function that defines the behavior of
- *          an inactive thread in the threadpool.
- *
- *          The thread will wait for a job to be enqueued, pick up the job,
- *              perform the job, then release the job's memory.
- *
- *          If no job is available for the thread, the thread will
- *              enter a wait state dependent on the threadpool's
- *              condition variable.
+ * @brief This enumeration defines how a producer behaves when the job
+ *          queue is full.
+ */
+typedef enum _threadpool_wait
+{
+    THREADPOOL_WAIT_BLOCK,
+    THREADPOOL_WAIT_NONE,
+    THREADPOOL_WAIT_TIMED,
+} threadpool_wait_t;
+
+/*!
+ * @brief The per-thread context of the calling thread, or NULL if the
+ *          calling thread does not belong to a threadpool.
+ */
+static _Thread_local threadpool_worker_t * tp_self = NULL;
+
+static int
+threadpool_spawn (threadpool_t * p_tp);
+
+static job_t *
+threadpool_shard_next (threadpool_t * p_tp, threadpool_shard_t * p_shard,
+                       const bool b_inline);
+
+static int
+threadpool_enq_jobs (threadpool_t * p_tp, const job_t * p_jobs, const size_t num_jobs,
+                     const threadpool_wait_t wait, size_t * p_num_enqueued);
+
+/*!
+ * @brief This is a static function that reads the monotonic clock.
+ *
+ * @return The monotonic time in nanoseconds.
+ */
+static uint64_t
+threadpool_now_ns (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000u) + (uint64_t) now.tv_nsec;
+}
+
+/*!
+ * @brief This is a static function that checks whether the calling
+ *          thread is a work-stealing thread of the given threadpool, in
+ *          which case its submissions go to its own deque.
+ *
+ * @param[in] p_tp The threadpool context.
+ *
+ * @return True if submissions should go to the calling thread's deque.
+ */
+static bool
+threadpool_is_local (threadpool_t * p_tp)
+{
+    return ((THREADPOOL_MODE_STEAL == p_tp->mode) &&
+            (NULL != tp_self) &&
+            (p_tp == tp_self->p_tp));
+}
+
+/*!
+ * @brief This is a static function that wakes a sleeping thread after a
+ *          job was pushed to a deque, if any thread is sleeping. Threads
+ *          that are spinning see the job through the eventcount.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_wake_sleeper (threadpool_t * p_tp)
+{
+    atomic_fetch_add_explicit(&(p_tp->epoch), 1, memory_order_relaxed);
+    
+    // Order the push before the sleeper count read. Pairs with the fence
+    // in threadpool_stealer.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 != atomic_load_explicit(&(p_tp->num_sleepers), memory_order_relaxed))
+    {
+        pthread_mutex_lock(&(p_tp->mutex));
+        pthread_cond_signal(&(p_tp->cond));
+        pthread_mutex_unlock(&(p_tp->mutex));
+    }
+}
+
+/*!
+ * @brief This is a static function that records that jobs were posted to
+ *          the priority lanes, and reports whether a parked thread needs
+ *          a wakeup. Threads that are spinning see the jobs through the
+ *          eventcount and need none.
+ *
+ *          The threadpool mutex must be held by the caller. Sleepers
+ *              register under the mutex, so one that is not counted yet
+ *              will find the jobs before it parks.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return True if a thread is parked on the condition variable.
+ */
+static bool
+threadpool_post (threadpool_t * p_tp)
+{
+    atomic_fetch_add_explicit(&(p_tp->epoch), 1, memory_order_relaxed);
+    return (0 != atomic_load_explicit(&(p_tp->num_sleepers), memory_order_relaxed));
+}
+
+/*!
+ * @brief This is a static function that hints the processor that the
+ *          calling thread is busy-waiting.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+/*!
+ * @brief This is a static function that spins, then yields, until work
+ *          is posted, the spin budget runs out or the threadpool shuts
+ *          down. The budget then adapts to what happened: it doubles if
+ *          work arrived and halves if it did not.
+ *
+ * @param[in/out] p_worker The calling thread's context.
+ * @param[in] epoch The eventcount read when the thread last found no work.
+ *
+ * @return True if work was posted since epoch was read.
+ */
+static bool
+threadpool_spin (threadpool_worker_t * p_worker, const size_t epoch)
+{
+    threadpool_t * p_tp = p_worker->p_tp;
+    bool b_posted = false;
+    if (false == p_tp->b_spin)
+    {
+        goto EXIT;
+    }
+    
+    size_t limit = p_worker->spin_limit + THREADPOOL_SPIN_YIELDS;
+    for (size_t spins = 0; spins < limit; ++spins)
+    {
+        if (epoch != atomic_load_explicit(&(p_tp->epoch), memory_order_relaxed))
+        {
+            b_posted = true;
+            break;
+        }
+        if (true == p_tp->b_shutdown)
+        {
+            break;
+        }
+        
+        if (spins < p_worker->spin_limit)
+        {
+            threadpool_relax();
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+    
+    // Adapt the budget to the recent arrival rate.
+    if (true == b_posted)
+    {
+        p_worker->spin_limit = (2 * p_worker->spin_limit) + 1;
+        if (p_worker->spin_limit > p_tp->spin_max)
+        {
+            p_worker->spin_limit = p_tp->spin_max;
+        }
+    }
+    else
+    {
+        p_worker->spin_limit /= 2;
+    }
+    
+    EXIT:
+        return b_posted;
+}
+
+/*!
+ * @brief This is a static function that wakes the threads waiting on
+ *          handles or for the threadpool to go idle, if any.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_notify_done (threadpool_t * p_tp)
+{
+    // The completion was published with a sequentially consistent
+    // operation, so either the waiter sees it or we see the waiter.
+    if (0 != atomic_load(&(p_tp->num_done_waiters)))
+    {
+        pthread_mutex_lock(&(p_tp->mutex));
+        pthread_cond_broadcast(&(p_tp->cond_done));
+        pthread_mutex_unlock(&(p_tp->mutex));
+    }
+}
+
+/*!
+ * @brief This is a static function that settles a number of submitted
+ *          jobs, either because they finished or because they failed
+ *          to be enqueued.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] count The number of jobs to settle.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_settle (threadpool_t * p_tp, const size_t count)
+{
+    if (count == atomic_fetch_sub(&(p_tp->num_pending), count))
+    {
+        threadpool_notify_done(p_tp);
+    }
+}
+
+/*!
+ * @brief This is a static function that adds to one of the calling
+ *          thread's counters. Only the owning thread writes a counter,
+ *          so a plain load and store suffice.
+ *
+ * @param[in/out] p_counter The counter.
+ * @param[in] count The amount to add.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_count (_Atomic uint64_t * p_counter, const uint64_t count)
+{
+    uint64_t value = atomic_load_explicit(p_counter, memory_order_relaxed);
+    atomic_store_explicit(p_counter, value + count, memory_order_relaxed);
+}
+
+/*!
+ * @brief This is a static function that finds the histogram bucket of a
+ *          duration.
+ *
+ * @param[in] ns The duration in nanoseconds.
+ *
+ * @return The bucket index, the duration's base-2 logarithm.
+ */
+static size_t
+threadpool_bucket (const uint64_t ns)
+{
+    size_t bucket = 0;
+    if (0 != ns)
+    {
+        bucket = (size_t) (63 - __builtin_clzll(ns));
+    }
+    if (bucket >= THREADPOOL_HIST_BUCKETS)
+    {
+        bucket = THREADPOOL_HIST_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+/*!
+ * @brief This is a static function that performs a job, returns it to
+ *          the job pool and settles it, and records its timings in the
+ *          calling thread's counters.
+ *
+ *          A keyed job is followed by the next job of its serial queue,
+ *              up to THREADPOOL_KEY_BATCH jobs in a row.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in/out] p_job The job to perform.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_run (threadpool_t * p_tp, job_t * p_job)
+{
+    threadpool_counters_t * p_counters = &(tp_self->counters);
+    for (size_t ran = 1; NULL != p_job; ++ran)
+    {
+        threadpool_shard_t * p_shard = p_job->p_shard;
+        uint64_t start_ns = threadpool_now_ns();
+        uint64_t wait_ns = 0;
+        if (start_ns > p_job->enq_ns)
+        {
+            wait_ns = start_ns - p_job->enq_ns;
+        }
+        if (start_ns > tp_self->last_ns)
+        {
+            threadpool_count(&(p_counters->idle_ns), start_ns - tp_self->last_ns);
+        }
+        
+        p_job->job_func(&(p_tp->b_shutdown), p_job->p_arg);
+        pool_free(p_tp->p_job_pool, p_job);
+        p_job = NULL;
+        
+        uint64_t end_ns = threadpool_now_ns();
+        tp_self->last_ns = end_ns;
+        threadpool_count(&(p_counters->completed), 1);
+        threadpool_count(&(p_counters->busy_ns), end_ns - start_ns);
+        threadpool_count(p_counters->wait_hist + threadpool_bucket(wait_ns), 1);
+        threadpool_count(p_counters->run_hist + threadpool_bucket(end_ns - start_ns), 1);
+        
+        threadpool_settle(p_tp, 1);
+        
+        // Hand the serial queue on to its next job.
+        if (NULL != p_shard)
+        {
+            p_job = threadpool_shard_next(p_tp, p_shard, (ran < THREADPOOL_KEY_BATCH));
+        }
+    }
+}
+
+/*!
+ * @brief This is a static function that performs a job submitted with
+ *          threadpool_submit and completes its handle.
+ *
+ * @param[in] pb_shutdown Pointer to the threadpool's shutdown signal.
+ * @param[in/out] p_handle The completion handle.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_run_handle (_Atomic bool * pb_shutdown, threadpool_handle_t * p_handle)
+{
+    threadpool_t * p_tp = p_handle->p_tp;
+    p_handle->p_result = p_handle->task_func(pb_shutdown, p_handle->p_arg);
+    atomic_store(&(p_handle->b_done), true);
+    threadpool_notify_done(p_tp);
+    threadpool_handle_release(p_handle);
+}
+
+/*!
+ * @brief This is a static function that queues jobs on a priority lane.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] prio The priority lane.
+ * @param[in] pp_jobs The jobs to queue, in order.
+ * @param[in] count The number of jobs.
+ *
+ * @return 0 on success, -1 on error. On error no job is queued.
+ */
+static int
+threadpool_lanes_enq (threadpool_t * p_tp, const threadpool_prio_t prio,
+                      job_t * const * pp_jobs, const size_t count)
+{
+    int status = -1;
+    queue_t * p_lane = p_tp->p_lanes[prio];
+    if (-1 == queue_enq_batch(p_lane, (void * const *) pp_jobs, count))
+    {
+        goto EXIT;
+    }
+    
+    p_tp->num_queued += count;
+    if (p_tp->num_queued > p_tp->peak_queued)
+    {
+        p_tp->peak_queued = p_tp->num_queued;
+    }
+    p_tp->lane_enqueued[prio] += count;
+    if (p_lane->size > p_tp->lane_peak[prio])
+    {
+        p_tp->lane_peak[prio] = p_lane->size;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that takes jobs off the priority
+ *          lanes by weighted round-robin.
+ *
+ *          The highest lane with jobs and credit left gives up jobs
+ *              until it runs out of either. Once no lane with jobs has
+ *              credit left, every lane's credit is reset to its weight
+ *              and a new round begins. A lane with jobs waiting is
+ *              therefore served at least once per round.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[out] pp_jobs The array to fill with jobs.
+ * @param[in] max_count The maximum number of jobs to take.
+ *
+ * @return The number of jobs taken.
+ */
+static size_t
+threadpool_lanes_deq (threadpool_t * p_tp, job_t ** pp_jobs, const size_t max_count)
+{
+    size_t num_jobs = 0;
+    while ((num_jobs < max_count) &&
+           (0 != p_tp->num_queued))
+    {
+        size_t lane = 0;
+        while ((lane < THREADPOOL_NUM_PRIO) &&
+               ((0 == p_tp->p_lanes[lane]->size) ||
+                (0 == p_tp->lane_credits[lane])))
+        {
+            lane++;
+        }
+        
+        // Start a new round.
+        if (THREADPOOL_NUM_PRIO == lane)
+        {
+            memcpy(p_tp->lane_credits, p_tp->lane_weights, sizeof(p_tp->lane_credits));
+            continue;
+        }
+        
+        size_t take = max_count - num_jobs;
+        if (take > p_tp->lane_credits[lane])
+        {
+            take = p_tp->lane_credits[lane];
+        }
+        take = queue_deq_batch(p_tp->p_lanes[lane], (void **) (pp_jobs + num_jobs), take);
+        p_tp->lane_credits[lane] -= take;
+        p_tp->lane_dequeued[lane] += take;
+        p_tp->num_queued -= take;
+        num_jobs += take;
+    }
+    return num_jobs;
+}
+
+/*!
+ * @brief This is a static function that fires the high-water-mark
+ *          callback when the job queue depth crosses a water mark.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_check_water (threadpool_t * p_tp)
+{
+    if ((0 == p_tp->high_water) ||
+        (NULL == p_tp->hwm_func))
+    {
+        goto EXIT;
+    }
+    
+    size_t depth = p_tp->num_queued;
+    if ((false == p_tp->b_saturated) &&
+        (depth >= p_tp->high_water))
+    {
+        p_tp->b_saturated = true;
+        p_tp->hwm_func(p_tp, true, p_tp->p_hwm_ctx);
+    }
+    else if ((true == p_tp->b_saturated) &&
+             (depth <= p_tp->low_water))
+    {
+        p_tp->b_saturated = false;
+        p_tp->hwm_func(p_tp, false, p_tp->p_hwm_ctx);
+    }
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This is a static function that spawns a thread when the
+ *          threadpool has stayed under pressure: the job queue is deep
+ *          and no thread is idle, or a job waited too long before being
+ *          picked up.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] wait_ns How long the job just picked up waited. 0 when
+ *              called from a producer.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_check_pressure (threadpool_t * p_tp, const uint64_t wait_ns)
+{
+    if ((p_tp->num_threads >= p_tp->max_threads) ||
+        (true == p_tp->b_shutdown))
+    {
+        goto EXIT;
+    }
+    
+    bool b_pressure = (((0 != p_tp->spawn_wait_ns) &&
+                        (wait_ns >= p_tp->spawn_wait_ns)) ||
+                       ((p_tp->num_queued > (p_tp->spawn_depth * p_tp->num_threads)) &&
+                        (0 == atomic_load(&(p_tp->num_sleepers)))));
+    if (false == b_pressure)
+    {
+        p_tp->spawn_streak = 0;
+        goto EXIT;
+    }
+    
+    if (++(p_tp->spawn_streak) >= THREADPOOL_SPAWN_STREAK)
+    {
+        p_tp->spawn_streak = 0;
+        threadpool_spawn(p_tp);
+    }
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This is a static function that measures how long the oldest of
+ *          a batch of jobs just taken off the job queue waited there.
+ *
+ * @param[in] p_tp The threadpool context.
+ * @param[in] p_jobs The jobs, oldest first.
+ * @param[in] num_jobs The number of jobs.
+ *
+ * @return The wait time in nanoseconds. 0 if the wait time does not
+ *          drive spawning or there are no jobs.
+ */
+static uint64_t
+threadpool_waited (threadpool_t * p_tp, job_t * const * p_jobs, const size_t num_jobs)
+{
+    uint64_t wait_ns = 0;
+    if ((0 != p_tp->spawn_wait_ns) &&
+        (0 != num_jobs))
+    {
+        uint64_t now_ns = threadpool_now_ns();
+        if (now_ns > p_jobs[0]->enq_ns)
+        {
+            wait_ns = now_ns - p_jobs[0]->enq_ns;
+        }
+    }
+    return wait_ns;
+}
+
+/*!
+ * @brief This is a static function that checks whether the calling
+ *          thread should retire because a resize lowered the maximum
+ *          below the number of running threads.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in] p_tp The threadpool context.
+ *
+ * @return True if the calling thread must retire.
+ */
+static bool
+threadpool_over_max (threadpool_t * p_tp)
+{
+    return ((p_tp->num_threads > p_tp->max_threads) &&
+            (false == p_tp->b_shutdown));
+}
+
+/*!
+ * @brief This is a static function that waits on the threadpool's
+ *          condition variable as an idle thread. Threads above the
+ *          minimum give up after the idle timeout.
+ *
+ *          The threadpool mutex must be held by the caller, and the
+ *              caller must have counted itself in num_sleepers.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return True if the thread timed out and may retire.
+ */
+static bool
+threadpool_idle_wait (threadpool_t * p_tp)
+{
+    bool b_timeout = false;
+    if ((0 == p_tp->idle_timeout_ms) ||
+        (p_tp->num_threads <= p_tp->min_threads))
+    {
+        pthread_cond_wait(&(p_tp->cond), &(p_tp->mutex));
+        goto EXIT;
+    }
+    
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t) (p_tp->idle_timeout_ms / 1000);
+    deadline.tv_nsec += (long) (p_tp->idle_timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    
+    if (ETIMEDOUT == pthread_cond_timedwait(&(p_tp->cond), &(p_tp->mutex), &deadline))
+    {
+        b_timeout = (p_tp->num_threads > p_tp->min_threads);
+    }
+    
+    EXIT:
+        return b_timeout;
+}
+
+/*!
+ * @brief This is a static function that retires the calling thread. The
+ *          thread must return right after this without touching the
+ *          threadpool, since the slot may be joined and reused.
+ *
+ *          The threadpool mutex must be held by the caller, and is
+ *              released by this function.
+ *
+ * @param[in/out] p_worker The calling thread's context.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_leave (threadpool_worker_t * p_worker)
+{
+    threadpool_t * p_tp = p_worker->p_tp;
+    p_worker->state = THREADPOOL_SLOT_EXITED;
+    p_tp->num_threads--;
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+}
+
+/*!
+ * @brief This is a static function that waits until the job queue has
+ *          room for a number of jobs.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] count The number of jobs that need room. Must not exceed
+ *              a bounded queue's capacity.
+ * @param[in] wait How to behave while the queue is full.
+ * @param[in] p_abstime The deadline for THREADPOOL_WAIT_TIMED.
+ *
+ * @return 0 once there is room, -1 on error. errno is set to EAGAIN or
+ *          ETIMEDOUT when the queue stayed full.
+ */
+static int
+threadpool_wait_space (threadpool_t * p_tp, const size_t count,
+                       const threadpool_wait_t wait,
+                       const struct timespec * p_abstime)
+{
+    int status = -1;
+    
+    if (0 == p_tp->capacity)
+    {
+        status = 0;
+        goto EXIT;
+    }
+    
+    while ((p_tp->num_queued + count) > p_tp->capacity)
+    {
+        if (true == p_tp->b_shutdown)
+        {
+            goto EXIT;
+        }
+        
+        if (THREADPOOL_WAIT_NONE == wait)
+        {
+            errno = EAGAIN;
+            goto EXIT;
+        }
+        
+        p_tp->num_space_waiters++;
+        int result = 0;
+        if (THREADPOOL_WAIT_TIMED == wait)
+        {
+            result = pthread_cond_timedwait(&(p_tp->cond_space), &(p_tp->mutex), p_abstime);
+        }
+        else
+        {
+            result = pthread_cond_wait(&(p_tp->cond_space), &(p_tp->mutex));
+        }
+        p_tp->num_space_waiters--;
+        
+        if ((ETIMEDOUT == result) &&
+            ((p_tp->num_queued + count) > p_tp->capacity))
+        {
+            errno = ETIMEDOUT;
+            goto EXIT;
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that enqueues a single job.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] prio The priority lane.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ * @param[in] wait How to behave while the queue is full.
+ * @param[in] p_abstime The deadline for THREADPOOL_WAIT_TIMED.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+threadpool_enq_wait (threadpool_t * p_tp, const threadpool_prio_t prio,
+                     job_f job_func, void * p_arg,
+                     const threadpool_wait_t wait,
+                     const struct timespec * p_abstime)
+{
+    int status = -1;
+    job_t * p_new = NULL;
+    if ((NULL == p_tp) ||
+        (NULL == p_tp->p_job_pool) ||
+        (prio >= THREADPOOL_NUM_PRIO) ||
+        (NULL == job_func) ||
+        ((THREADPOOL_WAIT_TIMED == wait) && (NULL == p_abstime)))
+    {
+        goto EXIT;
+    }
+    
+    // Create the new job context.
+    p_new = pool_alloc(p_tp->p_job_pool);
+    if (NULL == p_new)
+    {
+        goto EXIT;
+    }
+    p_new->job_func = job_func;
+    p_new->p_arg = p_arg;
+    p_new->enq_ns = threadpool_now_ns();
+    p_new->p_shard = NULL;
+    p_new->p_next = NULL;
+    
+    // Count the job before it can be performed, so the count cannot
+    // drop to zero while it is in flight.
+    atomic_fetch_add(&(p_tp->num_pending), 1);
+    
+    // A work-stealing thread submits normal jobs to its own deque. If
+    // the deque is full the job overflows to the injection queue.
+    bool b_local = threadpool_is_local(p_tp);
+    if ((true == b_local) &&
+        (THREADPOOL_PRIO_NORMAL == prio) &&
+        (0 == deque_push(tp_self->p_deque, p_new)))
+    {
+        threadpool_count(&(tp_self->counters.enqueued), 1);
+        p_new = NULL;
+        threadpool_wake_sleeper(p_tp);
+        status = 0;
+        goto EXIT;
+    }
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    // Wait for room and enqueue the job. The pool's own threads never
+    // wait, since they are the ones that make room.
+    if (((false == b_local) &&
+         (-1 == threadpool_wait_space(p_tp, 1, wait, p_abstime))) ||
+        (-1 == threadpool_lanes_enq(p_tp, prio, &p_new, 1)))
+    {
+        pthread_mutex_unlock(&(p_tp->mutex));
+        goto EXIT;
+    }
+    threadpool_check_water(p_tp);
+    threadpool_check_pressure(p_tp, 0);
+    bool b_wake = threadpool_post(p_tp);
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    // The queue owns the job now.
+    p_new = NULL;
+    
+    // Send a signal to the threadpool's condition variable to release
+    // a parked thread to handle the job.
+    if ((true == b_wake) &&
+        (0 != pthread_cond_signal(&(p_tp->cond))))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_new))
+        {
+            pool_free(p_tp->p_job_pool, p_new);
+            p_new = NULL;
+            threadpool_settle(p_tp, 1);
+        }
+        return status;
+}
+
+/*!
+ * @brief This is a static function that posts a job that is already
+ *          counted as pending to the threadpool, bypassing a bounded
+ *          queue's capacity. A work-stealing thread posts to its own
+ *          deque.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in/out] p_job The job to post.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+threadpool_requeue (threadpool_t * p_tp, job_t * p_job)
+{
+    int status = -1;
+    if ((true == threadpool_is_local(p_tp)) &&
+        (0 == deque_push(tp_self->p_deque, p_job)))
+    {
+        threadpool_count(&(tp_self->counters.enqueued), 1);
+        threadpool_wake_sleeper(p_tp);
+        status = 0;
+        goto EXIT;
+    }
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    if (-1 == threadpool_lanes_enq(p_tp, THREADPOOL_PRIO_NORMAL, &p_job, 1))
+    {
+        pthread_mutex_unlock(&(p_tp->mutex));
+        goto EXIT;
+    }
+    threadpool_check_water(p_tp);
+    threadpool_check_pressure(p_tp, 0);
+    bool b_wake = threadpool_post(p_tp);
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    if (true == b_wake)
+    {
+        pthread_cond_signal(&(p_tp->cond));
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that takes the next job of a keyed
+ *          serial queue after its previous job finished, or marks the
+ *          queue inactive if it is empty.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in/out] p_shard The serial queue.
+ * @param[in] b_inline Whether the calling thread may run the next job
+ *              itself. If not, the job is posted to the threadpool.
+ *
+ * @return Pointer to the job for the calling thread to run next. NULL
+ *          if the queue is empty or the job was posted.
+ */
+static job_t *
+threadpool_shard_next (threadpool_t * p_tp, threadpool_shard_t * p_shard,
+                       const bool b_inline)
+{
+    // Enter critical section.
+    pthread_mutex_lock(&(p_shard->mutex));
+    
+    job_t * p_job = p_shard->p_head;
+    if (NULL == p_job)
+    {
+        p_shard->b_active = false;
+    }
+    else
+    {
+        p_shard->p_head = p_job->p_next;
+        if (NULL == p_shard->p_head)
+        {
+            p_shard->p_tail = NULL;
+        }
+        p_job->p_next = NULL;
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_shard->mutex));
+    
+    // The queue stays active while its next job is posted, so no other
+    // job of the queue can start first. A job that cannot be posted is
+    // run right away.
+    if ((NULL != p_job) &&
+        ((true == b_inline) ||
+         (-1 == threadpool_requeue(p_tp, p_job))))
+    {
+        threadpool_count(&(tp_self->counters.enqueued), 1);
+        goto EXIT;
+    }
+    p_job = NULL;
+    
+    EXIT:
+        return p_job;
+}
+
+/*!
+ * @brief The length of a timer tick, in nanoseconds.
+ */
+#define THREADPOOL_TICK_NS ((uint64_t) THREADPOOL_TIMER_TICK_MS * 1000000u)
+
+/*!
+ * @brief This is a static function that converts a monotonic time to the
+ *          timer tick in progress at that time.
+ *
+ * @param[in] p_tp The threadpool context.
+ * @param[in] ns The monotonic time in nanoseconds.
+ *
+ * @return The tick.
+ */
+static uint64_t
+threadpool_tick_at (threadpool_t * p_tp, const uint64_t ns)
+{
+    uint64_t tick = 0;
+    if (ns > p_tp->timer_base_ns)
+    {
+        tick = (ns - p_tp->timer_base_ns) / THREADPOOL_TICK_NS;
+    }
+    return tick;
+}
+
+/*!
+ * @brief This is a static function that drops a reference to a timer,
+ *          returning it to the timer pool with the last one.
+ *
+ *          The timer mutex must be held by the caller.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in/out] p_timer The timer.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_timer_unref (threadpool_t * p_tp, threadpool_timer_t * p_timer)
+{
+    if (0 == --(p_timer->refs))
+    {
+        pool_free(p_tp->p_timer_pool, p_timer);
+    }
+}
+
+/*!
+ * @brief This is a static function that defines the behavior of the
+ *          timer thread.
+ *
+ *          The thread sleeps until the next tick at which the timing
+ *              wheel has work to do, or until a sooner timer is added.
+ *              It then collects every expired timer, arms periodic ones
+ *              again, and enqueues their jobs in batches outside the
+ *              critical section. It never waits for room in a bounded
+ *              queue, since the timers behind a blocked batch would all
+ *              fire late. Jobs that do not fit, or cannot be enqueued at
+ *              all, are counted in timer_dropped.
+ *
+ * @param[in/out] vp_tp A void pointer to the threadpool context.
+ *
+ * @return No return value expected.
+ */
+static void *
+threadpool_ticker (void * vp_tp)
+{
+    threadpool_t * p_tp = (threadpool_t *) vp_tp;
+    job_t jobs[THREADPOOL_ENQ_BATCH] = {0};
+    size_t num_jobs = 0;
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->timer_mutex));
+    
+    while (false == p_tp->b_timer_stop)
+    {
+        // Sleep until the wheel has work to do.
+        uint64_t now_ns = threadpool_now_ns();
+        p_tp->timer_wake = wheel_next(p_tp->p_wheel);
+        if (p_tp->timer_wake > threadpool_tick_at(p_tp, now_ns))
+        {
+            if (UINT64_MAX == p_tp->timer_wake)
+            {
+                pthread_cond_wait(&(p_tp->timer_cond), &(p_tp->timer_mutex));
+                continue;
+            }
+            
+            uint64_t wake_ns = p_tp->timer_base_ns + (p_tp->timer_wake * THREADPOOL_TICK_NS);
+            struct timespec deadline;
+            deadline.tv_sec = (time_t) (wake_ns / 1000000000u);
+            deadline.tv_nsec = (long) (wake_ns % 1000000000u);
+            pthread_cond_timedwait(&(p_tp->timer_cond), &(p_tp->timer_mutex), &deadline);
+            continue;
+        }
+        
+        // Collect the expired timers. A periodic timer is armed again
+        // for its next period; a one-shot timer is done with the wheel.
+        wheel_timer_t * p_expired = wheel_advance(p_tp->p_wheel, threadpool_tick_at(p_tp, now_ns));
+        while (NULL != p_expired)
+        {
+            threadpool_timer_t * p_timer = (threadpool_timer_t *) p_expired;
+            p_expired = p_expired->p_next;
+            p_timer->node.p_next = NULL;
+            
+            jobs[num_jobs].job_func = p_timer->job_func;
+            jobs[num_jobs].p_arg = p_timer->p_arg;
+            num_jobs++;
+            if ((0 != p_timer->period) &&
+                (false == p_timer->b_cancelled))
+            {
+                wheel_add(p_tp->p_wheel, &(p_timer->node), p_timer->node.expiry + p_timer->period);
+            }
+            else
+            {
+                threadpool_timer_unref(p_tp, p_timer);
+            }
+            
+            // Dispatch each full batch, and the last one, outside the
+            // critical section. The rest of the expired list is detached
+            // from the wheel, so it is safe from cancellation meanwhile.
+            if ((THREADPOOL_ENQ_BATCH == num_jobs) ||
+                (NULL == p_expired))
+            {
+                pthread_mutex_unlock(&(p_tp->timer_mutex));
+                size_t num_enqueued = 0;
+                (void) threadpool_enq_jobs(p_tp, jobs, num_jobs, THREADPOOL_WAIT_NONE,
+                                           &num_enqueued);
+                pthread_mutex_lock(&(p_tp->timer_mutex));
+                
+                // Jobs that could not be enqueued are lost, and a periodic
+                // timer's next period is already armed, so count them.
+                p_tp->timer_dropped += num_jobs - num_enqueued;
+                num_jobs = 0;
+            }
+        }
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->timer_mutex));
+    
+    return NULL;
+}
+
+/*!
+ * @brief This is a static function that arms a timer for a job, starting
+ *          the timer thread if needed.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] delay_ms The delay before the first expiry, in milliseconds.
+ * @param[in] period_ms The period in milliseconds. 0 for a one-shot timer.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ * @param[out] pp_timer Receives the timer. May be NULL.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+threadpool_timer_add (threadpool_t * p_tp, const size_t delay_ms, const size_t period_ms,
+                      job_f job_func, void * p_arg, threadpool_timer_t ** pp_timer)
+{
+    int status = -1;
+    threadpool_timer_t * p_timer = NULL;
+    if ((NULL == p_tp) ||
+        (NULL == p_tp->p_timer_pool) ||
+        (NULL == job_func))
+    {
+        goto EXIT;
+    }
+    
+    // Create the new timer. The caller holds a reference only if it
+    // asked for the timer.
+    p_timer = pool_alloc(p_tp->p_timer_pool);
+    if (NULL == p_timer)
+    {
+        goto EXIT;
+    }
+    p_timer->node.p_prev = NULL;
+    p_timer->node.p_next = NULL;
+    p_timer->p_tp = p_tp;
+    p_timer->job_func = job_func;
+    p_timer->p_arg = p_arg;
+    p_timer->period = (period_ms + THREADPOOL_TIMER_TICK_MS - 1) / THREADPOOL_TIMER_TICK_MS;
+    p_timer->refs = (NULL == pp_timer) ? 1 : 2;
+    p_timer->b_cancelled = false;
+    // The timer expires on the first tick boundary at or after its
+    // deadline, so it never fires early.
+    uint64_t deadline_ns = threadpool_now_ns() + ((uint64_t) delay_ms * 1000000u);
+    uint64_t expiry = threadpool_tick_at(p_tp, deadline_ns + THREADPOOL_TICK_NS - 1);
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->timer_mutex));
+    
+    if (true == p_tp->b_timer_stop)
+    {
+        pthread_mutex_unlock(&(p_tp->timer_mutex));
+        goto EXIT;
+    }
+    if (false == p_tp->b_ticker)
+    {
+        if (0 != pthread_create(&(p_tp->ticker), NULL, threadpool_ticker, p_tp))
+        {
+            pthread_mutex_unlock(&(p_tp->timer_mutex));
+            goto EXIT;
+        }
+        p_tp->b_ticker = true;
+    }
+    wheel_add(p_tp->p_wheel, &(p_timer->node), expiry);
+    
+    // Wake the timer thread if it sleeps past the new expiry.
+    if (expiry < p_tp->timer_wake)
+    {
+        pthread_cond_signal(&(p_tp->timer_cond));
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->timer_mutex));
+    
+    if (NULL != pp_timer)
+    {
+        *pp_timer = p_timer;
+    }
+    p_timer = NULL;
+    status = 0;
+    
+    EXIT:
+        if (NULL != p_timer)
+        {
+            pool_free(p_tp->p_timer_pool, p_timer);
+            p_timer = NULL;
+        }
+        return status;
+}
+
+/*!
+ * @brief This is a static function that releases a reference to a
+ *          parallel range, and frees it with the last one.
+ *
+ * @param[in/out] p_range The parallel range.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_range_unref (threadpool_range_t * p_range)
+{
+    if (1 == atomic_fetch_sub(&(p_range->refs), 1))
+    {
+        free(p_range->p_partials);
+        p_range->p_partials = NULL;
+        free(p_range);
+        p_range = NULL;
+    }
+}
+
+/*!
+ * @brief This is a static function that claims and runs chunks of a
+ *          parallel range until none are left.
+ *
+ * @param[in/out] p_range The parallel range.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_range_work (threadpool_range_t * p_range)
+{
+    void * p_partial = NULL;
+    for (;;)
+    {
+        size_t chunk = atomic_fetch_add(&(p_range->next), 1);
+        if (chunk >= p_range->num_chunks)
+        {
+            break;
+        }
+        
+        size_t first = p_range->begin + (chunk * p_range->grain);
+        size_t last = p_range->end;
+        if ((last - first) > p_range->grain)
+        {
+            last = first + p_range->grain;
+        }
+        
+        if (NULL != p_range->for_func)
+        {
+            p_range->for_func(first, last, p_range->p_ctx);
+        }
+        else
+        {
+            // Take a partial result with the first chunk, so a thread
+            // that finds no work left does not add one.
+            if (NULL == p_partial)
+            {
+                size_t slot = atomic_fetch_add(&(p_range->num_slots), 1);
+                p_partial = p_range->p_partials + (slot * p_range->result_size);
+            }
+            p_range->reduce_func(first, last, p_range->p_ctx, p_partial);
+        }
+        
+        // The thread finishing the last chunk wakes the caller.
+        if ((p_range->num_chunks - 1) == atomic_fetch_add(&(p_range->done), 1))
+        {
+            threadpool_notify_done(p_range->p_tp);
+        }
+    }
+}
+
+/*!
+ * @brief This is a static function that defines the helper job of a
+ *          parallel range.
+ *
+ *          A helper that starts after the caller returned finds no
+ *              chunk left and only releases its reference.
+ *
+ * @param[in] pb_shutdown Pointer to the threadpool's shutdown signal.
+ * @param[in/out] p_range The parallel range.
+ *
+ * @return No return value expected.
+ */
+static void
+threadpool_range_help (_Atomic bool * pb_shutdown, threadpool_range_t * p_range)
+{
+    (void) pb_shutdown;
+    threadpool_range_work(p_range);
+    threadpool_range_unref(p_range);
+}
+
+/*!
+ * @brief This is a static function that sweeps a range in parallel for
+ *          threadpool_parallel_for and threadpool_parallel_reduce.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] begin The first index of the range.
+ * @param[in] end One past the last index of the range.
+ * @param[in] grain The number of indices in a chunk, or 0.
+ * @param[in] for_func The loop body, or NULL for a reduction.
+ * @param[in] reduce_func The reduction body, or NULL for a loop.
+ * @param[in] combine_func The function combining partial results.
+ * @param[in] p_ctx The context passed to the functions.
+ * @param[in/out] p_result The result of a reduction.
+ * @param[in] result_size The size of the result.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+threadpool_parallel (threadpool_t * p_tp, const size_t begin, const size_t end,
+                     const size_t grain, threadpool_for_f for_func,
+                     threadpool_reduce_f reduce_func, threadpool_combine_f combine_func,
+                     void * p_ctx, void * p_result, const size_t result_size)
+{
+    int status = -1;
+    threadpool_range_t * p_range = NULL;
+    if ((NULL == p_tp) ||
+        (begin > end))
+    {
+        goto EXIT;
+    }
+    if (begin == end)
+    {
+        status = 0;
+        goto EXIT;
+    }
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    size_t num_threads = p_tp->num_threads;
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    size_t count = end - begin;
+    size_t chunk_grain = grain;
+    if (0 == chunk_grain)
+    {
+        chunk_grain = count / ((num_threads + 1) * THREADPOOL_PARALLEL_CHUNKS);
+        if (0 == chunk_grain)
+        {
+            chunk_grain = 1;
+        }
+    }
+    size_t num_chunks = (count / chunk_grain) + ((0 != (count % chunk_grain)) ? 1 : 0);
+    
+    // The caller takes the first chunk itself, so more helpers than the
+    // remaining chunks, or than there are threads, would find no work.
+    size_t num_helpers = num_threads;
+    if (num_helpers > (num_chunks - 1))
+    {
+        num_helpers = num_chunks - 1;
+    }
+    
+    p_range = malloc(sizeof(threadpool_range_t));
+    if (NULL == p_range)
+    {
+        goto EXIT;
+    }
+    p_range->p_tp = p_tp;
+    p_range->begin = begin;
+    p_range->end = end;
+    p_range->grain = chunk_grain;
+    p_range->num_chunks = num_chunks;
+    atomic_init(&(p_range->next), 0);
+    atomic_init(&(p_range->done), 0);
+    p_range->for_func = for_func;
+    p_range->reduce_func = reduce_func;
+    p_range->p_ctx = p_ctx;
+    p_range->result_size = result_size;
+    atomic_init(&(p_range->num_slots), 0);
+    p_range->p_partials = NULL;
+    atomic_init(&(p_range->refs), 1);
+    
+    // Every participant, helpers and caller, may need a partial result.
+    if (NULL != reduce_func)
+    {
+        p_range->p_partials = malloc(result_size * (num_helpers + 1));
+        if (NULL == p_range->p_partials)
+        {
+            goto EXIT;
+        }
+        for (size_t slot = 0; slot <= num_helpers; ++slot)
+        {
+            memcpy(p_range->p_partials + (slot * result_size), p_result, result_size);
+        }
+    }
+    
+    // Helpers are best effort. If the job queue is full the caller and
+    // the helpers already enqueued cover the rest of the range.
+    for (size_t idx = 0; idx < num_helpers; ++idx)
+    {
+        atomic_fetch_add(&(p_range->refs), 1);
+        if (-1 == threadpool_try_enq(p_tp, (job_f) threadpool_range_help, p_range))
+        {
+            atomic_fetch_sub(&(p_range->refs), 1);
+            break;
+        }
+    }
+    
+    threadpool_range_work(p_range);
+    
+    // Wait for the chunks other threads are still running, skipping the
+    // mutex if they have all finished.
+    if (num_chunks != atomic_load(&(p_range->done)))
+    {
+        // Enter critical section.
+        pthread_mutex_lock(&(p_tp->mutex));
+        
+        // Register as a waiter before the check. Pairs with
+        // threadpool_notify_done.
+        atomic_fetch_add(&(p_tp->num_done_waiters), 1);
+        while (num_chunks != atomic_load(&(p_range->done)))
+        {
+            pthread_cond_wait(&(p_tp->cond_done), &(p_tp->mutex));
+        }
+        atomic_fetch_sub(&(p_tp->num_done_waiters), 1);
+        
+        // Exit critical section.
+        pthread_mutex_unlock(&(p_tp->mutex));
+    }
+    
+    if (NULL != reduce_func)
+    {
+        size_t num_slots = atomic_load(&(p_range->num_slots));
+        for (size_t slot = 0; slot < num_slots; ++slot)
+        {
+            combine_func(p_result, p_range->p_partials + (slot * result_size), p_ctx);
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if (NULL != p_range)
+        {
+            threadpool_range_unref(p_range);
+            p_range = NULL;
+        }
+        return status;
+}
+
+/*!
+ * @brief This is a static function that defines the behavior of
+ *          an inactive thread in the threadpool.
+ *
+ *          The thread will wait for a job to be enqueued, pick up a batch
+ *              of up to THREADPOOL_DEQ_BATCH jobs in a single critical
+ *              section, perform the jobs, then return them to the job pool.
+ *
+ *          If no job is available for the thread, the thread will
+ *              enter a wait state dependent on the threadpool's
+ *              condition variable.
+ *
+ *          The thread will exit this function when the threadpool's
+ *              shutdown signal is asserted and there are no jobs
+ *              remaining to pick up from the queue.
+ *
+ * @param[in/out] vp_worker A void pointer to the thread's context in its
+ *                  parent threadpool. This is a void pointer to be in
+ *                  compliance with the pthread_create function's specs.
+ *
+ * @return No return value expected.
+ */
+static void *
+threadpool_inactive (void * vp_worker)
+{
+    if (NULL == vp_worker)
+    {
+        goto EXIT;
+    }
+    
+    // Cast the void pointer to its appropriate type.
+    tp_self = (threadpool_worker_t *) vp_worker;
+    tp_self->last_ns = threadpool_now_ns();
+    threadpool_t * p_tp = tp_self->p_tp;
+    tp_self->spin_limit = p_tp->spin_max;
+    
+    // This holds the batch of jobs the thread is performing.
+    job_t * p_jobs[THREADPOOL_DEQ_BATCH] = {0};
+    size_t num_jobs = 0;
+    
+    // Enter main inactivity loop.
+    for (;;)
+    {
+        // Enter critical section.
+        pthread_mutex_lock(&(p_tp->mutex));
+        
+        // Retire if a resize asked for fewer threads.
+        if (true == threadpool_over_max(p_tp))
+        {
+            threadpool_leave(tp_self);
+            goto EXIT;
+        }
+        
+        // Wait while the job queue is empty. The queue is checked again
+        // after every wakeup, since the wakeup may be spurious or another
+        // thread may have taken the job.
+        bool b_spun = false;
+        while (0 == p_tp->num_queued)
+        {
+            // If the shutdown signal is asserted, we can exit.
+            if (true == p_tp->b_shutdown)
+            {
+                pthread_mutex_unlock(&(p_tp->mutex));
+                goto EXIT;
+            }
+            
+            // Retire if a resize asked for fewer threads.
+            if (true == threadpool_over_max(p_tp))
+            {
+                threadpool_leave(tp_self);
+                goto EXIT;
+            }
+            
+            // Spin outside the critical section first, in case a job
+            // arrives soon.
+            if (false == b_spun)
+            {
+                size_t epoch = atomic_load_explicit(&(p_tp->epoch), memory_order_relaxed);
+                pthread_mutex_unlock(&(p_tp->mutex));
+                b_spun = (false == threadpool_spin(tp_self, epoch));
+                pthread_mutex_lock(&(p_tp->mutex));
+                continue;
+            }
+            
+            // Enter a wait state on the condition variable. A thread
+            // above the minimum that stays idle past the timeout retires.
+            atomic_fetch_add(&(p_tp->num_sleepers), 1);
+            bool b_timeout = threadpool_idle_wait(p_tp);
+            atomic_fetch_sub(&(p_tp->num_sleepers), 1);
+            if ((true == b_timeout) &&
+                (0 == p_tp->num_queued))
+            {
+                threadpool_leave(tp_self);
+                goto EXIT;
+            }
+            b_spun = false;
+        }
+        
+        // Take a fair share of the queued jobs, at least one and at most
+        // a full batch, so one thread does not starve the others.
+        size_t share = p_tp->num_queued / p_tp->num_threads;
+        if (0 == share)
+        {
+            share = 1;
+        }
+        if (share > THREADPOOL_DEQ_BATCH)
+        {
+            share = THREADPOOL_DEQ_BATCH;
+        }
+        
+        // Pick up the jobs from the job queue.
+        num_jobs = threadpool_lanes_deq(p_tp, p_jobs, share);
+        
+        // Release producers waiting on a full queue.
+        if ((0 != num_jobs) &&
+            (0 != p_tp->num_space_waiters))
+        {
+            pthread_cond_broadcast(&(p_tp->cond_space));
+        }
+        threadpool_check_water(p_tp);
+        threadpool_check_pressure(p_tp, threadpool_waited(p_tp, p_jobs, num_jobs));
+        
+        // Exit critical section.
+        pthread_mutex_unlock(&(p_tp->mutex));
+        
+        // Perform each job, then return it to the job pool.
+        for (size_t idx = 0; idx < num_jobs; ++idx)
+        {
+            threadpool_run(p_tp, p_jobs[idx]);
+            p_jobs[idx] = NULL;
+        }
+    }
+    
+    EXIT:
+        return NULL;
+}
+
+/*!
+ * @brief This is a static function that takes a share of the jobs on the
+ *          injection queue for a work-stealing thread. The first job is
+ *          returned and the rest are pushed to the thread's own deque,
+ *          where other threads may steal them.
+ *
+ * @param[in/out] p_worker The calling thread's context.
+ *
+ * @return Pointer to a job. NULL if the injection queue is empty.
+ */
+static job_t *
+threadpool_take_injected (threadpool_worker_t * p_worker)
+{
+    threadpool_t * p_tp = p_worker->p_tp;
+    job_t * p_jobs[THREADPOOL_DEQ_BATCH] = {0};
+    size_t num_jobs = 0;
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    size_t share = p_tp->num_queued / p_tp->num_threads;
+    if (0 == share)
+    {
+        share = 1;
+    }
+    if (share > THREADPOOL_DEQ_BATCH)
+    {
+        share = THREADPOOL_DEQ_BATCH;
+    }
+    num_jobs = threadpool_lanes_deq(p_tp, p_jobs, share);
+    if (0 == num_jobs)
+    {
+        pthread_mutex_unlock(&(p_tp->mutex));
+        goto EXIT;
+    }
+    
+    // Release producers waiting on a full queue.
+    if (0 != p_tp->num_space_waiters)
+    {
+        pthread_cond_broadcast(&(p_tp->cond_space));
+    }
+    threadpool_check_water(p_tp);
+    threadpool_check_pressure(p_tp, threadpool_waited(p_tp, p_jobs, num_jobs));
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    // Keep the extra jobs where other threads can steal them. A job that
+    // does not fit is performed right away.
+    for (size_t idx = 1; idx < num_jobs; ++idx)
+    {
+        if (-1 == deque_push(p_worker->p_deque, p_jobs[idx]))
+        {
+            threadpool_run(p_tp, p_jobs[idx]);
+        }
+    }
+    if (1 < num_jobs)
+    {
+        threadpool_wake_sleeper(p_tp);
+    }
+    
+    EXIT:
+        return p_jobs[0];
+}
+
+/*!
+ * @brief This is a static function that tries to steal a job from the
+ *          deques of randomly chosen threads.
+ *
+ * @param[in/out] p_worker The calling thread's context.
+ *
+ * @return Pointer to a job. NULL if nothing was stolen.
+ */
+static job_t *
+threadpool_steal_job (threadpool_worker_t * p_worker)
+{
+    threadpool_t * p_tp = p_worker->p_tp;
+    job_t * p_job = NULL;
+    if (1 == p_tp->num_workers)
+    {
+        goto EXIT;
+    }
+    
+    size_t victim = p_worker->index;
+    size_t tries = THREADPOOL_STEAL_ROUNDS * p_tp->num_workers;
+    while ((NULL == p_job) &&
+           (0 != tries--))
+    {
+        victim = (size_t) rand_r(&(p_worker->seed)) % p_tp->num_workers;
+        if (victim == p_worker->index)
+        {
+            continue;
+        }
+        p_job = deque_steal(p_tp->p_workers[victim].p_deque);
+    }
+    
+    // Pass the wakeup on while the victim still has work to spare.
+    if ((NULL != p_job) &&
+        (0 != deque_size(p_tp->p_workers[victim].p_deque)))
+    {
+        threadpool_wake_sleeper(p_tp);
+    }
+    
+    EXIT:
+        return p_job;
+}
+
+/*!
+ * @brief This is a static function that checks whether any job is waiting
+ *          on the injection queue or on any thread's deque.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in] p_tp The threadpool context.
+ *
+ * @return True if a job is waiting anywhere in the threadpool.
+ */
+static bool
+threadpool_has_work (threadpool_t * p_tp)
+{
+    bool b_work = (0 != p_tp->num_queued);
+    for (size_t tid = 0; (false == b_work) && (tid < p_tp->num_workers); ++tid)
+    {
+        b_work = (0 != deque_size(p_tp->p_workers[tid].p_deque));
+    }
+    return b_work;
+}
+
+/*!
+ * @brief This is a static function that defines the behavior of a thread
+ *          in the work-stealing mode.
+ *
+ *          The thread looks for a job on its own deque first, then on the
+ *              injection queue, then on the deques of random victims. If
+ *              none is found, it sleeps on the threadpool's condition
+ *              variable until a job is submitted.
+ *
+ *          The thread will exit this function when the threadpool's
+ *              shutdown signal is asserted and no job is waiting anywhere
+ *              in the threadpool.
+ *
+ * @param[in/out] vp_worker A void pointer to the thread's context in its
+ *                  parent threadpool. This is a void pointer to be in
+ *                  compliance with the pthread_create function's specs.
+ *
+ * @return No return value expected.
+ */
+static void *
+threadpool_stealer (void * vp_worker)
+{
+    if (NULL == vp_worker)
+    {
+        goto EXIT;
+    }
+    
+    // Cast the void pointer to its appropriate type.
+    tp_self = (threadpool_worker_t *) vp_worker;
+    tp_self->last_ns = threadpool_now_ns();
+    threadpool_t * p_tp = tp_self->p_tp;
+    tp_self->spin_limit = p_tp->spin_max;
+    
+    for (;;)
+    {
+        size_t epoch = atomic_load_explicit(&(p_tp->epoch), memory_order_relaxed);
+        job_t * p_job = deque_pop(tp_self->p_deque);
+        if (NULL == p_job)
+        {
+            p_job = threadpool_take_injected(tp_self);
+        }
+        if (NULL == p_job)
+        {
+            p_job = threadpool_steal_job(tp_self);
+        }
+        
+        if (NULL != p_job)
+        {
+            // Perform the job, then return it to the job pool.
+            threadpool_run(p_tp, p_job);
+            continue;
+        }
+        
+        // Spin for a while before parking, in case a job arrives soon.
+        if (true == threadpool_spin(tp_self, epoch))
+        {
+            continue;
+        }
+        
+        // Enter critical section.
+        pthread_mutex_lock(&(p_tp->mutex));
+        
+        // Register as a sleeper before the final check. Pairs with the
+        // fence in threadpool_wake_sleeper.
+        atomic_fetch_add_explicit(&(p_tp->num_sleepers), 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        
+        if (false == threadpool_has_work(p_tp))
+        {
+            // If the shutdown signal is asserted, we can exit.
+            if (true == p_tp->b_shutdown)
+            {
+                atomic_fetch_sub_explicit(&(p_tp->num_sleepers), 1, memory_order_relaxed);
+                pthread_mutex_unlock(&(p_tp->mutex));
+                goto EXIT;
+            }
+            
+            // Enter a wait state on the condition variable, unless a
+            // resize asked for fewer threads. A thread above the minimum
+            // that stays idle past the timeout retires. Either way the
+            // thread's deque is empty, so no job is stranded.
+            bool b_retire = threadpool_over_max(p_tp);
+            if (false == b_retire)
+            {
+                b_retire = ((true == threadpool_idle_wait(p_tp)) &&
+                            (false == threadpool_has_work(p_tp)));
+            }
+            if (true == b_retire)
+            {
+                atomic_fetch_sub_explicit(&(p_tp->num_sleepers), 1, memory_order_relaxed);
+                threadpool_leave(tp_self);
+                goto EXIT;
+            }
+        }
+        atomic_fetch_sub_explicit(&(p_tp->num_sleepers), 1, memory_order_relaxed);
+        
+        // Exit critical section.
+        pthread_mutex_unlock(&(p_tp->mutex));
+    }
+    
+    EXIT:
+        return NULL;
+}
+
+/*!
+ * @brief This is a static function that starts a thread in a free slot,
+ *          joining the slot's previous thread first if it retired.
+ *
+ *          The threadpool mutex must be held by the caller.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return 0 on success, -1 on error or if every slot is running.
+ */
+static int
+threadpool_spawn (threadpool_t * p_tp)
+{
+    int status = -1;
+    threadpool_worker_t * p_worker = NULL;
+    for (size_t tid = 0; tid < p_tp->num_workers; ++tid)
+    {
+        if (THREADPOOL_SLOT_RUNNING != p_tp->p_workers[tid].state)
+        {
+            p_worker = p_tp->p_workers + tid;
+            break;
+        }
+    }
+    if (NULL == p_worker)
+    {
+        goto EXIT;
+    }
+    
+    // A retired thread released the mutex as its last step, so this join
+    // does not wait on anything that needs the mutex.
+    if (THREADPOOL_SLOT_EXITED == p_worker->state)
+    {
+        pthread_join(p_worker->thread, NULL);
+        p_worker->state = THREADPOOL_SLOT_FREE;
+    }
+    
+    void * (*thread_func)(void *) = threadpool_inactive;
+    if (THREADPOOL_MODE_STEAL == p_tp->mode)
+    {
+        thread_func = threadpool_stealer;
+    }
+    pthread_attr_t attr;
+    if (0 != pthread_attr_init(&attr))
+    {
+        goto EXIT;
+    }
+    if (THREADPOOL_CPU_ANY != p_tp->cpu)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(p_tp->cpu, &cpus);
+        (void) pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    int ret = pthread_create(&(p_worker->thread), &attr, thread_func, p_worker);
+    pthread_attr_destroy(&attr);
+    if (0 != ret)
+    {
+        goto EXIT;
+    }
+    p_worker->state = THREADPOOL_SLOT_RUNNING;
+    p_tp->num_threads++;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function initializes threadpool attributes to their
+ *          defaults: one thread in the shared mode and an unbounded
+ *          job queue with no high-water-mark callback.
+ *
+ * @param[out] p_attr The attributes to initialize.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_attr_init (threadpool_attr_t * p_attr)
+{
+    int status = -1;
+    if (NULL == p_attr)
+    {
+        goto EXIT;
+    }
+    
+    p_attr->num_threads = 1;
+    p_attr->max_threads = 0;
+    p_attr->idle_timeout_ms = THREADPOOL_DEFAULT_IDLE_MS;
+    p_attr->spawn_depth = THREADPOOL_DEFAULT_SPAWN_DEPTH;
+    p_attr->spawn_wait_ms = 0;
+    p_attr->capacity = 0;
+    p_attr->high_water = 0;
+    p_attr->low_water = 0;
+    p_attr->hwm_func = NULL;
+    p_attr->p_hwm_ctx = NULL;
+    p_attr->mode = THREADPOOL_MODE_SHARED;
+    p_attr->lane_weights[THREADPOOL_PRIO_HIGH] = THREADPOOL_DEFAULT_WEIGHT_HIGH;
+    p_attr->lane_weights[THREADPOOL_PRIO_NORMAL] = THREADPOOL_DEFAULT_WEIGHT_NORMAL;
+    p_attr->lane_weights[THREADPOOL_PRIO_LOW] = THREADPOOL_DEFAULT_WEIGHT_LOW;
+    p_attr->spin_max = THREADPOOL_DEFAULT_SPIN;
+    p_attr->cpu = THREADPOOL_CPU_ANY;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function instantiates a new fixed-size threadpool context.
+ *
+ * @param[in] num_threads The number of threads in the job queue.
+ *              This number must be non-zero, or error will be returned.
+ *
+ * @return Pointer to new threadpool context. NULL on error.
+ */
+threadpool_t *
+threadpool_create (const size_t num_threads)
+{
+    threadpool_attr_t attr;
+    threadpool_attr_init(&attr);
+    attr.num_threads = num_threads;
+    return threadpool_create_attr(&attr);
+}
+
+/*!
+ * @brief This function instantiates a new threadpool context from a set
+ *          of attributes.
+ *
+ * @param[in] p_attr The threadpool attributes.
+ *
+ * @return Pointer to new threadpool context. NULL on error.
+ */
+threadpool_t *
+threadpool_create_attr (const threadpool_attr_t * p_attr)
+{
+    int status = -1;
+    threadpool_t * p_tp = NULL;
+    if ((NULL == p_attr) ||
+        (0 == p_attr->num_threads) ||
+        ((0 != p_attr->max_threads) && (p_attr->max_threads < p_attr->num_threads)) ||
+        ((THREADPOOL_MODE_SHARED != p_attr->mode) && (THREADPOOL_MODE_STEAL != p_attr->mode)) ||
+        ((0 != p_attr->high_water) && (p_attr->low_water >= p_attr->high_water)) ||
+        (p_attr->cpu < THREADPOOL_CPU_ANY) ||
+        (p_attr->cpu >= CPU_SETSIZE))
+    {
+        goto EXIT;
+    }
+    for (size_t lane = 0; lane < THREADPOOL_NUM_PRIO; ++lane)
+    {
+        if (0 == p_attr->lane_weights[lane])
+        {
+            goto EXIT;
+        }
+    }
+    
+    p_tp = calloc(1, sizeof(threadpool_t));
+    if (NULL == p_tp)
+    {
+        goto EXIT;
+    }
+    p_tp->num_threads = 0;
+    p_tp->min_threads = p_attr->num_threads;
+    p_tp->max_threads = p_attr->max_threads;
+    if (0 == p_tp->max_threads)
+    {
+        p_tp->max_threads = p_attr->num_threads;
+    }
+    p_tp->idle_timeout_ms = p_attr->idle_timeout_ms;
+    p_tp->spawn_depth = p_attr->spawn_depth;
+    p_tp->spawn_wait_ns = (uint64_t) p_attr->spawn_wait_ms * 1000000u;
+    p_tp->spawn_streak = 0;
+    p_tp->num_workers = 0;
+    p_tp->b_shutdown = false;
+    p_tp->num_queued = 0;
+    p_tp->peak_queued = 0;
+    for (size_t lane = 0; lane < THREADPOOL_NUM_PRIO; ++lane)
+    {
+        p_tp->p_lanes[lane] = NULL;
+        p_tp->lane_weights[lane] = p_attr->lane_weights[lane];
+        p_tp->lane_credits[lane] = p_attr->lane_weights[lane];
+        p_tp->lane_peak[lane] = 0;
+        p_tp->lane_enqueued[lane] = 0;
+        p_tp->lane_dequeued[lane] = 0;
+    }
+    p_tp->p_job_pool = NULL;
+    p_tp->capacity = p_attr->capacity;
+    p_tp->num_space_waiters = 0;
+    p_tp->high_water = p_attr->high_water;
+    p_tp->low_water = p_attr->low_water;
+    p_tp->hwm_func = p_attr->hwm_func;
+    p_tp->p_hwm_ctx = p_attr->p_hwm_ctx;
+    p_tp->b_saturated = false;
+    p_tp->mode = p_attr->mode;
+    p_tp->p_workers = NULL;
+    atomic_init(&(p_tp->num_sleepers), 0);
+    atomic_init(&(p_tp->epoch), 0);
+    p_tp->b_spin = (0 != p_attr->spin_max);
+    p_tp->spin_max = p_attr->spin_max;
+    p_tp->cpu = p_attr->cpu;
+    if ((1 >= sysconf(_SC_NPROCESSORS_ONLN)) ||
+        (THREADPOOL_CPU_ANY != p_tp->cpu))
+    {
+        p_tp->spin_max = 0;
+    }
+    atomic_init(&(p_tp->num_pending), 0);
+    atomic_init(&(p_tp->num_done_waiters), 0);
+    p_tp->p_handle_pool = NULL;
+    p_tp->p_shards = NULL;
+    p_tp->num_shards = 0;
+    p_tp->p_wheel = NULL;
+    p_tp->p_timer_pool = NULL;
+    p_tp->b_ticker = false;
+    p_tp->b_timer_stop = false;
+    p_tp->timer_base_ns = threadpool_now_ns();
+    p_tp->timer_wake = UINT64_MAX;
+    p_tp->timer_dropped = 0;
+    
+    // Initialize the mutex and condition variables.
+    if ((0 != pthread_mutex_init(&(p_tp->mutex), NULL)) ||
+        (0 != pthread_cond_init(&(p_tp->cond), NULL)) ||
+        (0 != pthread_cond_init(&(p_tp->cond_space), NULL)) ||
+        (0 != pthread_cond_init(&(p_tp->cond_done), NULL)) ||
+        (0 != pthread_mutex_init(&(p_tp->timer_mutex), NULL)))
+    {
+        goto EXIT;
+    }
+    
+    // The timer thread sleeps against the monotonic clock.
+    pthread_condattr_t timer_attr;
+    if (0 != pthread_condattr_init(&timer_attr))
+    {
+        goto EXIT;
+    }
+    pthread_condattr_setclock(&timer_attr, CLOCK_MONOTONIC);
+    int result = pthread_cond_init(&(p_tp->timer_cond), &timer_attr);
+    pthread_condattr_destroy(&timer_attr);
+    if (0 != result)
+    {
+        goto EXIT;
+    }
+    
+    // Create the job queue of each priority lane.
+    for (size_t lane = 0; lane < THREADPOOL_NUM_PRIO; ++lane)
+    {
+        p_tp->p_lanes[lane] = queue_create();
+        if (NULL == p_tp->p_lanes[lane])
+        {
+            goto EXIT;
+        }
+    }
+    
+    // Create the job and handle pools.
+    p_tp->p_job_pool = pool_create(sizeof(job_t), 0);
+    p_tp->p_handle_pool = pool_create(sizeof(threadpool_handle_t), 0);
+    if ((NULL == p_tp->p_job_pool) ||
+        (NULL == p_tp->p_handle_pool))
+    {
+        goto EXIT;
+    }
+    
+    // Create the timing wheel and the timer pool.
+    p_tp->p_wheel = wheel_create(0);
+    p_tp->p_timer_pool = pool_create(sizeof(threadpool_timer_t), 0);
+    if ((NULL == p_tp->p_wheel) ||
+        (NULL == p_tp->p_timer_pool))
+    {
+        goto EXIT;
+    }
+    
+    // Allocate a slot for every thread the threadpool may grow to.
+    // The slots are cache line aligned for their counters.
+    size_t workers_size = p_tp->max_threads * sizeof(threadpool_worker_t);
+    p_tp->p_workers = aligned_alloc(THREADPOOL_CACHE_LINE, workers_size);
+    if (NULL == p_tp->p_workers)
+    {
+        goto EXIT;
+    }
+    memset(p_tp->p_workers, 0, workers_size);
+    
+    // Create the keyed serial queues, each on its own cache line.
+    size_t shards_size = THREADPOOL_KEY_SHARDS * sizeof(threadpool_shard_t);
+    p_tp->p_shards = aligned_alloc(THREADPOOL_CACHE_LINE, shards_size);
+    if (NULL == p_tp->p_shards)
+    {
+        goto EXIT;
+    }
+    memset(p_tp->p_shards, 0, shards_size);
+    for (size_t shard = 0; shard < THREADPOOL_KEY_SHARDS; ++shard)
+    {
+        if (0 != pthread_mutex_init(&(p_tp->p_shards[shard].mutex), NULL))
+        {
+            goto EXIT;
+        }
+        p_tp->num_shards++;
+    }
+    
+    // Set up every slot before any thread starts, since threads look at
+    // each other's deques.
+    for (size_t tid = 0; tid < p_tp->max_threads; ++tid)
+    {
+        threadpool_worker_t * p_worker = p_tp->p_workers + tid;
+        p_worker->p_tp = p_tp;
+        p_worker->index = tid;
+        p_worker->seed = (unsigned int) (tid + 1) * 2654435761u;
+        p_worker->p_deque = NULL;
+        p_worker->state = THREADPOOL_SLOT_FREE;
+        
+        if (THREADPOOL_MODE_STEAL == p_tp->mode)
+        {
+            p_worker->p_deque = deque_create(THREADPOOL_DEQUE_CAPACITY);
+            if (NULL == p_worker->p_deque)
+            {
+                goto EXIT;
+            }
+        }
+        p_tp->num_workers++;
+    }
+    
+    // Start the minimum number of threads. The mutex holds them back
+    // until all have started, so they never see a partial count.
+    pthread_mutex_lock(&(p_tp->mutex));
+    while (p_tp->num_threads < p_tp->min_threads)
+    {
+        if (-1 == threadpool_spawn(p_tp))
+        {
+            pthread_mutex_unlock(&(p_tp->mutex));
+            goto EXIT;
+        }
+    }
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_tp))
+        {
+            threadpool_destroy(p_tp);
+            p_tp = NULL;
+        }
+        return p_tp;
+}
+
+/*!
+ * @brief This function destroys a threadpool context.
+ *
+ *          Any jobs remaining on the threadpool's job queue will
+ *              be allowed to finish before the threads exit
+ *              and cleanup is conducted.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_destroy (threadpool_t * p_tp)
+{
+    int status = -1;
+    if (NULL == p_tp)
+    {
+        goto EXIT;
+    }
+    
+    // Stop the timer thread first, so every job it dispatched is queued
+    // before the threads are told to finish. Timers still pending are
+    // discarded with the timer pool.
+    pthread_mutex_lock(&(p_tp->timer_mutex));
+    p_tp->b_timer_stop = true;
+    pthread_cond_signal(&(p_tp->timer_cond));
+    bool b_ticker = p_tp->b_ticker;
+    pthread_mutex_unlock(&(p_tp->timer_mutex));
+    if ((true == b_ticker) &&
+        (0 != pthread_join(p_tp->ticker, NULL)))
+    {
+        goto EXIT;
+    }
+    
+    // Assert the threadpool's shutdown signal. This is done under the
+    // mutex so no thread is spawned afterwards.
+    pthread_mutex_lock(&(p_tp->mutex));
+    p_tp->b_shutdown = true;
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    // Send a broadcast signal on the threadpool's condition variables
+    // to release any waiting threads and producers.
+    if ((0 != pthread_cond_broadcast(&(p_tp->cond))) ||
+        (0 != pthread_cond_broadcast(&(p_tp->cond_space))))
+    {
+        goto EXIT;
+    }
+    
+    // Join every thread that was ever started, running or retired.
+    for (size_t tid = 0; tid < p_tp->num_workers; ++tid)
+    {
+        pthread_mutex_lock(&(p_tp->mutex));
+        bool b_started = (THREADPOOL_SLOT_FREE != p_tp->p_workers[tid].state);
+        pthread_mutex_unlock(&(p_tp->mutex));
+        
+        if ((true == b_started) &&
+            (0 != pthread_join(p_tp->p_workers[tid].thread, NULL)))
+        {
+            goto EXIT;
+        }
+    }
+    
+    // Free the thread slots and their deques.
+    if (NULL != p_tp->p_workers)
+    {
+        for (size_t tid = 0; tid < p_tp->num_workers; ++tid)
+        {
+            deque_destroy(p_tp->p_workers[tid].p_deque);
+        }
+        free(p_tp->p_workers);
+        p_tp->p_workers = NULL;
+    }
+    
+    // Destroy the keyed serial queues. Every keyed job has run.
+    if (NULL != p_tp->p_shards)
+    {
+        for (size_t shard = 0; shard < p_tp->num_shards; ++shard)
+        {
+            pthread_mutex_destroy(&(p_tp->p_shards[shard].mutex));
+        }
+        free(p_tp->p_shards);
+        p_tp->p_shards = NULL;
+    }
+    
+    // Destroy the job queue of each priority lane.
+    for (size_t lane = 0; lane < THREADPOOL_NUM_PRIO; ++lane)
+    {
+        queue_destroy(p_tp->p_lanes[lane]);
+        p_tp->p_lanes[lane] = NULL;
+    }
+    
+    // Destroy the job and handle pools. All jobs have been performed at
+    // this point.
+    pool_destroy(p_tp->p_job_pool);
+    p_tp->p_job_pool = NULL;
+    pool_destroy(p_tp->p_handle_pool);
+    p_tp->p_handle_pool = NULL;
+    
+    // Destroy the timing wheel and every pending timer.
+    wheel_destroy(p_tp->p_wheel);
+    p_tp->p_wheel = NULL;
+    pool_destroy(p_tp->p_timer_pool);
+    p_tp->p_timer_pool = NULL;
+    
+    // Destroy the mutex and condition variables.
+    if ((0 != pthread_mutex_destroy(&(p_tp->mutex))) ||
+        (0 != pthread_cond_destroy(&(p_tp->cond))) ||
+        (0 != pthread_cond_destroy(&(p_tp->cond_space))) ||
+        (0 != pthread_cond_destroy(&(p_tp->cond_done))) ||
+        (0 != pthread_mutex_destroy(&(p_tp->timer_mutex))) ||
+        (0 != pthread_cond_destroy(&(p_tp->timer_cond))))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if (NULL != p_tp)
+        {
+            free(p_tp);
+            p_tp = NULL;
+        }
+        return status;
+}
+
+/*!
+ * @brief This function changes the bounds on the number of threads.
+ *
+ *          Threads are spawned right away to reach the new minimum.
+ *              Threads above the new maximum retire once they run out
+ *              of the work they hold. Jobs may be enqueued concurrently.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] min_threads The new minimum. Must be non-zero.
+ * @param[in] max_threads The new maximum. Must be at least min_threads,
+ *              and at most the maximum the threadpool was created with.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_resize (threadpool_t * p_tp, const size_t min_threads, const size_t max_threads)
+{
+    int status = -1;
+    if ((NULL == p_tp) ||
+        (0 == min_threads) ||
+        (min_threads > max_threads) ||
+        (max_threads > p_tp->num_workers))
+    {
+        goto EXIT;
+    }
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    if (true == p_tp->b_shutdown)
+    {
+        pthread_mutex_unlock(&(p_tp->mutex));
+        goto EXIT;
+    }
+    
+    p_tp->min_threads = min_threads;
+    p_tp->max_threads = max_threads;
+    
+    // Grow to the new minimum.
+    while (p_tp->num_threads < min_threads)
+    {
+        if (-1 == threadpool_spawn(p_tp))
+        {
+            pthread_mutex_unlock(&(p_tp->mutex));
+            goto EXIT;
+        }
+    }
+    
+    // Shrink to the new maximum, waking idle threads so they retire.
+    if (p_tp->num_threads > max_threads)
+    {
+        pthread_cond_broadcast(&(p_tp->cond));
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function enqueues a job on the threadpool.
+ *
+ *          If the job queue is bounded and full, this blocks until a
+ *              thread makes room.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq (threadpool_t * p_tp, job_f job_func, void * p_arg)
+{
+    return threadpool_enq_wait(p_tp, THREADPOOL_PRIO_NORMAL, job_func, p_arg,
+                               THREADPOOL_WAIT_BLOCK, NULL);
+}
+
+/*!
+ * @brief This function enqueues a job on the threadpool without blocking.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return 0 on success, -1 on error. errno is set to EAGAIN if the job
+ *          queue is full.
+ */
+int
+threadpool_try_enq (threadpool_t * p_tp, job_f job_func, void * p_arg)
+{
+    return threadpool_enq_wait(p_tp, THREADPOOL_PRIO_NORMAL, job_func, p_arg,
+                               THREADPOOL_WAIT_NONE, NULL);
+}
+
+/*!
+ * @brief This function enqueues a job on the threadpool, blocking no
+ *          later than a deadline while the job queue is full.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ * @param[in] p_abstime The absolute CLOCK_REALTIME deadline.
+ *
+ * @return 0 on success, -1 on error. errno is set to ETIMEDOUT if the
+ *          deadline passed while the job queue was full.
+ */
+int
+threadpool_enq_timed (threadpool_t * p_tp, job_f job_func, void * p_arg,
+                      const struct timespec * p_abstime)
+{
+    return threadpool_enq_wait(p_tp, THREADPOOL_PRIO_NORMAL, job_func, p_arg,
+                               THREADPOOL_WAIT_TIMED, p_abstime);
+}
+
+/*!
+ * @brief This is a static function that enqueues an array of jobs on the
+ *          threadpool, as threadpool_enq_batch does, and reports how
+ *          many of them were enqueued.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] p_jobs The array of jobs to perform, in order.
+ * @param[in] num_jobs The number of jobs in the array.
+ * @param[in] wait How to behave while the queue is full. With
+ *              THREADPOOL_WAIT_NONE as many jobs as there is room for are
+ *              enqueued, and the call fails with errno set to EAGAIN for
+ *              the rest. THREADPOOL_WAIT_TIMED is not supported.
+ * @param[out] p_num_enqueued Receives the number of jobs enqueued, which
+ *              on error is less than num_jobs. May be NULL.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+threadpool_enq_jobs (threadpool_t * p_tp, const job_t * p_jobs, const size_t num_jobs,
+                     const threadpool_wait_t wait, size_t * p_num_enqueued)
+{
+    int status = -1;
+    size_t num_enqueued = 0;
+    job_t * p_batch[THREADPOOL_ENQ_BATCH] = {0};
+    size_t num_new = 0;
+    if ((NULL == p_tp) ||
+        (NULL == p_tp->p_job_pool) ||
+        (NULL == p_jobs) ||
+        (0 == num_jobs) ||
+        (THREADPOOL_WAIT_TIMED == wait))
+    {
+        goto EXIT;
+    }
+    
+    // Validate every entry first so a bad entry cannot leave the array
+    // partially enqueued.
+    for (size_t idx = 0; idx < num_jobs; ++idx)
+    {
+        if (NULL == p_jobs[idx].job_func)
+        {
+            goto EXIT;
+        }
+    }
+    
+    bool b_local = threadpool_is_local(p_tp);
+    
+    // A chunk must fit in a bounded queue, or it could never be enqueued.
+    size_t max_chunk = THREADPOOL_ENQ_BATCH;
+    if ((0 != p_tp->capacity) &&
+        (p_tp->capacity < max_chunk))
+    {
+        max_chunk = p_tp->capacity;
+    }
+    
+    for (size_t base = 0; base < num_jobs; base += max_chunk)
+    {
+        size_t chunk = num_jobs - base;
+        if (chunk > max_chunk)
+        {
+            chunk = max_chunk;
+        }
+        
+        // Create the new job contexts, stamped with one clock read.
+        uint64_t enq_ns = threadpool_now_ns();
+        for (num_new = 0; num_new < chunk; ++num_new)
+        {
+            p_batch[num_new] = pool_alloc(p_tp->p_job_pool);
+            if (NULL == p_batch[num_new])
+            {
+                goto EXIT;
+            }
+            *(p_batch[num_new]) = p_jobs[base + num_new];
+            p_batch[num_new]->enq_ns = enq_ns;
+            p_batch[num_new]->p_shard = NULL;
+            p_batch[num_new]->p_next = NULL;
+        }
+        atomic_fetch_add(&(p_tp->num_pending), chunk);
+        
+        // A work-stealing thread pushes to its own deque first, and only
+        // the jobs that do not fit overflow to the injection queue.
+        size_t first = 0;
+        if (true == b_local)
+        {
+            while ((first < chunk) &&
+                   (0 == deque_push(tp_self->p_deque, p_batch[first])))
+            {
+                first++;
+            }
+            if (0 != first)
+            {
+                threadpool_count(&(tp_self->counters.enqueued), first);
+                threadpool_wake_sleeper(p_tp);
+            }
+            if (first == chunk)
+            {
+                num_enqueued += chunk;
+                num_new = 0;
+                continue;
+            }
+        }
+        
+        // Enter critical section.
+        pthread_mutex_lock(&(p_tp->mutex));
+        
+        // A caller that will not wait takes only the room there is.
+        size_t count = chunk - first;
+        if ((false == b_local) &&
+            (THREADPOOL_WAIT_NONE == wait) &&
+            (0 != p_tp->capacity))
+        {
+            size_t room = (p_tp->capacity > p_tp->num_queued) ?
+                          (p_tp->capacity - p_tp->num_queued) : 0;
+            count = (room < count) ? room : count;
+        }
+        
+        // Wait for room and enqueue the jobs. The pool's own threads never
+        // wait, since they are the ones that make room.
+        if ((0 == count) ||
+            ((false == b_local) &&
+             (-1 == threadpool_wait_space(p_tp, count, wait, NULL))) ||
+            (-1 == threadpool_lanes_enq(p_tp, THREADPOOL_PRIO_NORMAL, p_batch + first, count)))
+        {
+            if (0 == count)
+            {
+                errno = EAGAIN;
+            }
+            // Jobs already pushed to the deque are no longer ours to free.
+            memmove(p_batch, p_batch + first, (chunk - first) * sizeof(job_t *));
+            num_new = chunk - first;
+            num_enqueued += first;
+            pthread_mutex_unlock(&(p_tp->mutex));
+            threadpool_settle(p_tp, num_new);
+            goto EXIT;
+        }
+        threadpool_check_water(p_tp);
+        threadpool_check_pressure(p_tp, 0);
+        bool b_wake = threadpool_post(p_tp);
+        
+        // Exit critical section.
+        pthread_mutex_unlock(&(p_tp->mutex));
+        
+        // The queue owns the jobs now.
+        num_enqueued += first + count;
+        num_new = 0;
+        
+        // Release the parked threads with a single wakeup.
+        if (true == b_wake)
+        {
+            if (1 == count)
+            {
+                pthread_cond_signal(&(p_tp->cond));
+            }
+            else
+            {
+                pthread_cond_broadcast(&(p_tp->cond));
+            }
+        }
+        
+        // Hand back the jobs there was no room for.
+        if (count != (chunk - first))
+        {
+            num_new = chunk - first - count;
+            memmove(p_batch, p_batch + first + count, num_new * sizeof(job_t *));
+            threadpool_settle(p_tp, num_new);
+            errno = EAGAIN;
+            goto EXIT;
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        // Return any job contexts that were not enqueued.
+        while (0 != num_new)
+        {
+            pool_free(p_tp->p_job_pool, p_batch[--num_new]);
+        }
+        if (NULL != p_num_enqueued)
+        {
+            *p_num_enqueued = num_enqueued;
+        }
+        return status;
+}
+
+/*!
+ * @brief This function enqueues an array of jobs on the threadpool.
+ *
+ *          The job contexts are prepared outside the critical section,
+ *              then the whole batch is enqueued under a single lock and
+ *              released to the threads with a single wakeup.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] p_jobs The array of jobs to perform, in order. No job
+ *              function may be NULL.
+ * @param[in] num_jobs The number of jobs in the array. Must be non-zero.
+ *              Arrays longer than THREADPOOL_ENQ_BATCH, or than the job
+ *              queue's capacity, are enqueued in chunks of that size,
+ *              one critical section per chunk. Each chunk blocks while
+ *              the job queue lacks room for it.
+ *
+ * @return 0 on success, -1 on error. On error, chunks before the one
+ *          that failed remain enqueued.
+ */
+int
+threadpool_enq_batch (threadpool_t * p_tp, const job_t * p_jobs, const size_t num_jobs)
+{
+    return threadpool_enq_jobs(p_tp, p_jobs, num_jobs, THREADPOOL_WAIT_BLOCK, NULL);
+}
+
+/*!
+ * @brief This function enqueues a job that runs in submission order with
+ *          respect to, and never at the same time as, other jobs with
+ *          the same key.
+ *
+ *          Keyed jobs run on the normal lane. They are not held back by
+ *              a bounded queue's capacity, since a producer must not wait
+ *              while it holds its key's place in line.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] key The serialization key. Distinct keys may share a serial
+ *              queue, in which case they are serialized with each other.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq_keyed (threadpool_t * p_tp, const uint64_t key,
+                      job_f job_func, void * p_arg)
+{
+    int status = -1;
+    job_t * p_new = NULL;
+    if ((NULL == p_tp) ||
+        (NULL == p_tp->p_job_pool) ||
+        (NULL == job_func))
+    {
+        goto EXIT;
+    }
+    
+    // Fibonacci hashing spreads nearby keys over the serial queues.
+    threadpool_shard_t * p_shard = p_tp->p_shards +
+        ((key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - THREADPOOL_KEY_SHARD_BITS));
+    
+    // Create the new job context.
+    p_new = pool_alloc(p_tp->p_job_pool);
+    if (NULL == p_new)
+    {
+        goto EXIT;
+    }
+    p_new->job_func = job_func;
+    p_new->p_arg = p_arg;
+    p_new->enq_ns = threadpool_now_ns();
+    p_new->p_shard = p_shard;
+    p_new->p_next = NULL;
+    atomic_fetch_add(&(p_tp->num_pending), 1);
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_shard->mutex));
+    
+    // Wait behind the queue's active job, if there is one.
+    if (true == p_shard->b_active)
+    {
+        if (NULL == p_shard->p_tail)
+        {
+            p_shard->p_head = p_new;
+        }
+        else
+        {
+            p_shard->p_tail->p_next = p_new;
+        }
+        p_shard->p_tail = p_new;
+        p_new = NULL;
+    }
+    
+    // Otherwise post the job. This is done under the queue's mutex, so
+    // the queue can be left inactive again if posting fails.
+    else if (0 == threadpool_requeue(p_tp, p_new))
+    {
+        p_shard->b_active = true;
+        p_new = NULL;
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_shard->mutex));
+    
+    if (NULL != p_new)
+    {
+        goto EXIT;
+    }
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_new))
+        {
+            pool_free(p_tp->p_job_pool, p_new);
+            p_new = NULL;
+            threadpool_settle(p_tp, 1);
+        }
+        return status;
+}
+
+/*!
+ * @brief This function enqueues a job on one of the threadpool's
+ *          priority lanes.
+ *
+ *          If the job queue is bounded and full, this blocks until a
+ *              thread makes room. In the work-stealing mode, jobs from
+ *              the threadpool's own threads only go to their deque on
+ *              the normal lane; jobs on other lanes are scheduled by
+ *              lane like jobs from outside the threadpool.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] prio The priority lane.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq_prio (threadpool_t * p_tp, const threadpool_prio_t prio,
+                     job_f job_func, void * p_arg)
+{
+    return threadpool_enq_wait(p_tp, prio, job_func, p_arg,
+                               THREADPOOL_WAIT_BLOCK, NULL);
+}
+
+/*!
+ * @brief This function takes a snapshot of a priority lane's counters.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] prio The priority lane.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_lane_stats (threadpool_t * p_tp, const threadpool_prio_t prio,
+                       threadpool_lane_stats_t * p_stats)
+{
+    int status = -1;
+    if ((NULL == p_tp) ||
+        (prio >= THREADPOOL_NUM_PRIO) ||
+        (NULL == p_stats))
+    {
+        goto EXIT;
+    }
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    p_stats->depth = p_tp->p_lanes[prio]->size;
+    p_stats->peak = p_tp->lane_peak[prio];
+    p_stats->enqueued = p_tp->lane_enqueued[prio];
+    p_stats->dequeued = p_tp->lane_dequeued[prio];
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function enqueues a job on the threadpool and returns a
+ *          completion handle for it.
  *
- *          The thread will exit this function when the threadpool's
- *              shutdown signal is asserted and there are no jobs
- *              remaining to pick up from the queue.
+ *          If the job queue is bounded and full, this blocks until a
+ *              thread makes room. The handle must be released with
+ *              threadpool_handle_release before the threadpool is
+ *              destroyed.
  *
- * @param[in/out] vp_tp A void pointer to the thread's parent threadpool
- *                  context. This is a void pointer to be in compliance with
- *                  the pthread_create function's specs.
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] task_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
  *
- * @return No return value expected.
+ * @return Pointer to the completion handle. NULL on error.
  */
-static void *
-threadpool_inactive (void * vp_tp)
+threadpool_handle_t *
+threadpool_submit (threadpool_t * p_tp, threadpool_task_f task_func, void * p_arg)
 {
-    if (NULL == vp_tp)
+    threadpool_handle_t * p_handle = NULL;
+    if ((NULL == p_tp) ||
+        (NULL == p_tp->p_handle_pool) ||
+        (NULL == task_func))
     {
         goto EXIT;
     }
     
-    // Cast the void pointer to its appropriate type.
-    threadpool_t * p_tp = (threadpool_t *) vp_tp;
+    p_handle = pool_alloc(p_tp->p_handle_pool);
+    if (NULL == p_handle)
+    {
+        goto EXIT;
+    }
+    p_handle->p_tp = p_tp;
+    p_handle->task_func = task_func;
+    p_handle->p_arg = p_arg;
+    p_handle->p_result = NULL;
+    atomic_init(&(p_handle->b_done), false);
     
-    // This holds the current job the thread is performing.
-    job_t * p_job = NULL;
+    // One reference for the submitter and one for the job.
+    atomic_init(&(p_handle->refs), 2);
     
-    // Enter main inactivity loop.
-    for (;;)
+    if (-1 == threadpool_enq_wait(p_tp, THREADPOOL_PRIO_NORMAL,
+                                  (job_f) threadpool_run_handle, p_handle,
+                                  THREADPOOL_WAIT_BLOCK, NULL))
     {
-        // Enter critical section.
-        pthread_mutex_lock(&(p_tp->mutex));
-        
-        // Check if the job queue is empty.
-        if (0 == p_tp->p_queue->size)
-        {
-            // If the shutdown signal is asserted, we can exit.
-            if (true == p_tp->b_shutdown)
-            {
-                pthread_mutex_unlock(&(p_tp->mutex));
-                goto EXIT;
-            }
-            
-            // Enter a wait state on the condition variable.
-            pthread_cond_wait(&(p_tp->cond), &(p_tp->mutex));
-        }
-        
-        // Pick up a job from the job queue.
-        p_job = queue_deq(p_tp->p_queue);
-        
-        // Exit critical section.
-        pthread_mutex_unlock(&(p_tp->mutex));
-        
-        // If the job is NULL here, something went wrong in the dequeue
-        // function. Just ignore and continue.
-        if (NULL == p_job)
-        {
-            continue;
-        }
-        
-        // Perform the job.
-        p_job->job_func(&(p_tp->b_shutdown), p_job->p_arg);
-        
-        // Free the job and set to NULL.
-        free(p_job);
-        p_job = NULL;
+        pool_free(p_tp->p_handle_pool, p_handle);
+        p_handle = NULL;
     }
     
     EXIT:
-        return NULL;
+        return p_handle;
 }
 
 /*!
- * @brief This function instantiates a new threadpool context.
+ * @brief This function checks whether a submitted job has finished.
  *
- * @param[in] num_threads The number of threads in the job queue.
- *              This cannot be changed after instantiation.
- *              This number must be non-zero, or error will be returned.
+ * @param[in] p_handle The completion handle.
  *
- * @return Pointer to new threadpool context. NULL on error.
+ * @return True if the job has finished. False if not, or on error.
  */
-threadpool_t *
-threadpool_create (const size_t num_threads)
+bool
+threadpool_handle_poll (threadpool_handle_t * p_handle)
+{
+    return ((NULL != p_handle) &&
+            (true == atomic_load(&(p_handle->b_done))));
+}
+
+/*!
+ * @brief This function blocks until a submitted job has finished.
+ *
+ *          Waiting from inside a job of the same threadpool can deadlock
+ *              if every thread ends up waiting.
+ *
+ * @param[in] p_handle The completion handle.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_handle_wait (threadpool_handle_t * p_handle)
 {
     int status = -1;
-    threadpool_t * p_tp = calloc(1, sizeof(threadpool_t));
-    if ((NULL == p_tp) ||
-        (0 == num_threads))
+    if (NULL == p_handle)
     {
         goto EXIT;
     }
-    p_tp->p_threads = NULL;
-    p_tp->num_threads = num_threads;
-    p_tp->b_shutdown = false;
-    p_tp->p_queue = NULL;
     
-    // Initialize the mutex and condition variable.
-    if ((0 != pthread_mutex_init(&(p_tp->mutex), NULL)) ||
-        (0 != pthread_cond_init(&(p_tp->cond), NULL)))
+    // Skip the mutex if the job has already finished.
+    if (true == threadpool_handle_poll(p_handle))
     {
+        status = 0;
         goto EXIT;
     }
     
-    // Create the job queue.
-    p_tp->p_queue = queue_create();
-    if (NULL == p_tp->p_queue)
+    threadpool_t * p_tp = p_handle->p_tp;
+    
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    // Register as a waiter before the check. Pairs with
+    // threadpool_notify_done.
+    atomic_fetch_add(&(p_tp->num_done_waiters), 1);
+    while (false == atomic_load(&(p_handle->b_done)))
     {
-        goto EXIT;
+        pthread_cond_wait(&(p_tp->cond_done), &(p_tp->mutex));
     }
+    atomic_fetch_sub(&(p_tp->num_done_waiters), 1);
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    status = 0;
     
-    // Allocate space for the inidividual threads.
-    p_tp->p_threads = calloc(num_threads, sizeof(pthread_t));
-    if (NULL == p_tp->p_threads)
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function retrieves the result of a finished job.
+ *
+ * @param[in] p_handle The completion handle.
+ * @param[out] pp_result The job's result.
+ *
+ * @return 0 on success, -1 on error. errno is set to EAGAIN if the job
+ *          has not finished.
+ */
+int
+threadpool_handle_result (threadpool_handle_t * p_handle, void ** pp_result)
+{
+    int status = -1;
+    if ((NULL == p_handle) ||
+        (NULL == pp_result))
     {
         goto EXIT;
     }
     
-    // Initialize the threads into the inactive function.
-    for (size_t tid = 0; tid < num_threads; ++tid)
+    if (false == threadpool_handle_poll(p_handle))
     {
-        if (0 != pthread_create(p_tp->p_threads + tid, NULL, threadpool_inactive, p_tp))
-        {
-            goto EXIT;
-        }
+        errno = EAGAIN;
+        goto EXIT;
     }
+    *pp_result = p_handle->p_result;
     
     status = 0;
     
     EXIT:
-        if ((-1 == status) &&
-            (NULL != p_tp))
-        {
-            threadpool_destroy(p_tp);
-            p_tp = NULL;
-        }
-        return p_tp;
+        return status;
 }
 
 /*!
- * @brief This function destroys a threadpool context.
+ * @brief This function releases the submitter's reference to a
+ *          completion handle. The handle may not be used afterwards.
  *
- *          Any jobs remaining on the threadpool's job queue will
- *              be allowed to finish before the threads exit
- *              and cleanup is conducted.
+ *          The job does not need to have finished; it holds its own
+ *              reference until it does.
+ *
+ * @param[in/out] p_handle The completion handle. NULL is ignored.
+ *
+ * @return No return value expected.
+ */
+void
+threadpool_handle_release (threadpool_handle_t * p_handle)
+{
+    if (NULL == p_handle)
+    {
+        goto EXIT;
+    }
+    
+    // The last reference returns the handle to its pool.
+    if (1 == atomic_fetch_sub(&(p_handle->refs), 1))
+    {
+        pool_free(p_handle->p_tp->p_handle_pool, p_handle);
+    }
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function blocks until every job submitted to the
+ *          threadpool has finished, including jobs submitted by other
+ *          jobs while waiting. The threads are left running.
  *
  * @param[in/out] p_tp The threadpool context.
  *
- * @return 0 on success, -1 on error.
+ * @return 0 on success, -1 on error. errno is set to EDEADLK if called
+ *          from one of the threadpool's own threads.
  */
 int
-threadpool_destroy (threadpool_t * p_tp)
+threadpool_wait_idle (threadpool_t * p_tp)
 {
     int status = -1;
     if (NULL == p_tp)
@@ -180,110 +2933,281 @@ threadpool_destroy (threadpool_t * p_tp)
         goto EXIT;
     }
     
-    // Assert the threadpool's shutdown signal.
-    p_tp->b_shutdown = true;
-    
-    // Send a broadcast signal on the threadpool's condition variable
-    // to release any waiting threads.
-    if (0 != pthread_cond_broadcast(&(p_tp->cond)))
+    // A job waiting for its own threadpool to go idle never would.
+    if ((NULL != tp_self) &&
+        (p_tp == tp_self->p_tp))
     {
+        errno = EDEADLK;
         goto EXIT;
     }
     
-    // Join all individual threads.
-    for (size_t tid = 0; tid < p_tp->num_threads; ++tid)
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
+    
+    // Register as a waiter before the check. Pairs with
+    // threadpool_notify_done.
+    atomic_fetch_add(&(p_tp->num_done_waiters), 1);
+    while (0 != atomic_load(&(p_tp->num_pending)))
     {
-        if (0 != pthread_join(p_tp->p_threads[tid], NULL))
-        {
-            goto EXIT;
-        }
+        pthread_cond_wait(&(p_tp->cond_done), &(p_tp->mutex));
     }
+    atomic_fetch_sub(&(p_tp->num_done_waiters), 1);
     
-    // Free the array containing the threads.
-    free(p_tp->p_threads);
-    p_tp->p_threads = NULL;
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
     
-    // Destroy the job queue.
-    queue_destroy(p_tp->p_queue);
-    p_tp->p_queue = NULL;
+    status = 0;
     
-    // Destroy the mutex and condition variables.
-    if ((0 != pthread_mutex_destroy(&(p_tp->mutex))) ||
-        (0 != pthread_cond_destroy(&(p_tp->cond))))
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function takes a snapshot of a threadpool's statistics.
+ *
+ *          Each thread's counters are read without stopping it, so the
+ *              snapshot is approximate while jobs are running.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_stats_snapshot (threadpool_t * p_tp, threadpool_stats_t * p_stats)
+{
+    int status = -1;
+    if ((NULL == p_tp) ||
+        (NULL == p_stats))
     {
         goto EXIT;
     }
+    memset(p_stats, 0, sizeof(threadpool_stats_t));
     
-    status = 0;
+    // Enter critical section.
+    pthread_mutex_lock(&(p_tp->mutex));
     
-    EXIT:
-        if (NULL != p_tp)
+    // The lane counters are protected by the mutex.
+    p_stats->num_threads = p_tp->num_threads;
+    p_stats->queued = p_tp->num_queued;
+    p_stats->peak_queued = p_tp->peak_queued;
+    for (size_t lane = 0; lane < THREADPOOL_NUM_PRIO; ++lane)
+    {
+        p_stats->enqueued += p_tp->lane_enqueued[lane];
+    }
+    
+    // Exit critical section.
+    pthread_mutex_unlock(&(p_tp->mutex));
+    
+    // The timer counters are protected by the timer mutex.
+    pthread_mutex_lock(&(p_tp->timer_mutex));
+    p_stats->timer_dropped = p_tp->timer_dropped;
+    pthread_mutex_unlock(&(p_tp->timer_mutex));
+    
+    // Merge the counters of every slot, including retired threads.
+    for (size_t tid = 0; tid < p_tp->num_workers; ++tid)
+    {
+        threadpool_worker_t * p_worker = p_tp->p_workers + tid;
+        threadpool_counters_t * p_counters = &(p_worker->counters);
+        p_stats->enqueued += atomic_load_explicit(&(p_counters->enqueued), memory_order_relaxed);
+        p_stats->completed += atomic_load_explicit(&(p_counters->completed), memory_order_relaxed);
+        p_stats->busy_ns += atomic_load_explicit(&(p_counters->busy_ns), memory_order_relaxed);
+        p_stats->idle_ns += atomic_load_explicit(&(p_counters->idle_ns), memory_order_relaxed);
+        p_stats->queued += deque_size(p_worker->p_deque);
+        for (size_t bucket = 0; bucket < THREADPOOL_HIST_BUCKETS; ++bucket)
         {
-            free(p_tp);
-            p_tp = NULL;
+            p_stats->wait_hist[bucket] +=
+                atomic_load_explicit(p_counters->wait_hist + bucket, memory_order_relaxed);
+            p_stats->run_hist[bucket] +=
+                atomic_load_explicit(p_counters->run_hist + bucket, memory_order_relaxed);
         }
+    }
+    
+    status = 0;
+    
+    EXIT:
         return status;
 }
 
 /*!
- * @brief This function enqueues a job on the threadpool.
+ * @brief This function enqueues a job to be performed once, after a delay.
  *
  * @param[in/out] p_tp The threadpool context.
+ * @param[in] delay_ms The delay in milliseconds.
  * @param[in] job_func The function to perform.
  * @param[in] p_arg The arguments associated with the job.
+ * @param[out] pp_timer Receives the timer, which must be given back with
+ *              threadpool_timer_cancel. May be NULL if the timer will
+ *              never be cancelled.
  *
  * @return 0 on success, -1 on error.
  */
 int
-threadpool_enq (threadpool_t * p_tp, job_f job_func, void * p_arg)
+threadpool_enq_after (threadpool_t * p_tp, const size_t delay_ms,
+                      job_f job_func, void * p_arg, threadpool_timer_t ** pp_timer)
+{
+    return threadpool_timer_add(p_tp, delay_ms, 0, job_func, p_arg, pp_timer);
+}
+
+/*!
+ * @brief This function enqueues a job to be performed repeatedly, first
+ *          after one period and then every period. An expiry that the
+ *          timer thread falls behind on is coalesced with the next.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] period_ms The period in milliseconds. Must be non-zero.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ * @param[out] pp_timer Receives the timer, which must be given back with
+ *              threadpool_timer_cancel. May be NULL, in which case the
+ *              job repeats until the threadpool is destroyed.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq_every (threadpool_t * p_tp, const size_t period_ms,
+                      job_f job_func, void * p_arg, threadpool_timer_t ** pp_timer)
 {
     int status = -1;
-    if ((NULL == p_tp) ||
-        (NULL == p_tp->p_queue) ||
-        (NULL == job_func))
+    if (0 == period_ms)
     {
         goto EXIT;
     }
     
-    // Create the new job context.
-    job_t * p_new = calloc(1, sizeof(job_t));
-    if (NULL == p_new)
+    status = threadpool_timer_add(p_tp, period_ms, period_ms, job_func, p_arg, pp_timer);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function cancels a timer and gives it back. The timer must
+ *          not be used afterwards.
+ *
+ *          A job that already expired may still be queued or running.
+ *              Timers must be given back before the threadpool is
+ *              destroyed; destroying it discards every pending timer.
+ *
+ * @param[in/out] p_timer The timer.
+ *
+ * @return 0 if a pending expiry was cancelled, -1 on error or if a
+ *          one-shot timer had already expired.
+ */
+int
+threadpool_timer_cancel (threadpool_timer_t * p_timer)
+{
+    int status = -1;
+    if (NULL == p_timer)
     {
         goto EXIT;
     }
-    p_new->job_func = job_func;
-    p_new->p_arg = p_arg;
+    threadpool_t * p_tp = p_timer->p_tp;
     
     // Enter critical section.
-    pthread_mutex_lock(&(p_tp->mutex));
+    pthread_mutex_lock(&(p_tp->timer_mutex));
     
-    // Enqueue the job.
-    if (-1 == queue_enq(p_tp->p_queue, p_new))
+    // Take the timer off the wheel. A periodic timer that is off the
+    // wheel is being dispatched, and the timer thread drops it instead
+    // of arming it again.
+    p_timer->b_cancelled = true;
+    if (0 == wheel_remove(p_tp->p_wheel, &(p_timer->node)))
     {
-        pthread_mutex_unlock(&(p_tp->mutex));
-        goto EXIT;
+        threadpool_timer_unref(p_tp, p_timer);
+        status = 0;
+    }
+    else if (0 != p_timer->period)
+    {
+        status = 0;
     }
+    threadpool_timer_unref(p_tp, p_timer);
     
     // Exit critical section.
-    pthread_mutex_unlock(&(p_tp->mutex));
+    pthread_mutex_unlock(&(p_tp->timer_mutex));
     
-    // Send a signal to the threadpool's condition variable to release
-    // a thread to handle the job.
-    if (0 != pthread_cond_signal(&(p_tp->cond)))
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function runs a loop body over a range of indices in
+ *          parallel and blocks until it has covered the whole range.
+ *
+ *          The range is cut into chunks of grain indices. The calling
+ *              thread runs chunks itself alongside helper jobs enqueued
+ *              on the threadpool, so it may be called from a job too.
+ *              Chunks run in no particular order.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] begin The first index of the range.
+ * @param[in] end One past the last index of the range.
+ * @param[in] grain The number of indices in a chunk. 0 picks a grain
+ *              that gives every thread several chunks.
+ * @param[in] for_func The loop body.
+ * @param[in] p_ctx The context passed to the loop body.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_parallel_for (threadpool_t * p_tp, const size_t begin, const size_t end,
+                         const size_t grain, threadpool_for_f for_func, void * p_ctx)
+{
+    int status = -1;
+    if (NULL == for_func)
     {
         goto EXIT;
     }
     
-    status = 0;
+    status = threadpool_parallel(p_tp, begin, end, grain, for_func, NULL, NULL,
+                                 p_ctx, NULL, 0);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function reduces a range of indices in parallel and blocks
+ *          until it has covered the whole range.
+ *
+ *          Every participating thread folds its chunks into a partial
+ *              result of its own, which starts as a copy of the initial
+ *              result. The partials are then combined into the result
+ *              by the calling thread, in no particular order, so the
+ *              combine function must be associative and commutative.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] begin The first index of the range.
+ * @param[in] end One past the last index of the range.
+ * @param[in] grain The number of indices in a chunk. 0 picks a grain
+ *              that gives every thread several chunks.
+ * @param[in] reduce_func The reduction body.
+ * @param[in] combine_func The function combining partial results.
+ * @param[in] p_ctx The context passed to both functions.
+ * @param[in/out] p_result The result. Holds the identity of the
+ *              reduction on entry, such as 0 for a sum.
+ * @param[in] result_size The size of the result.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_parallel_reduce (threadpool_t * p_tp, const size_t begin, const size_t end,
+                            const size_t grain, threadpool_reduce_f reduce_func,
+                            threadpool_combine_f combine_func, void * p_ctx,
+                            void * p_result, const size_t result_size)
+{
+    int status = -1;
+    if ((NULL == reduce_func) ||
+        (NULL == combine_func) ||
+        (NULL == p_result) ||
+        (0 == result_size))
+    {
+        goto EXIT;
+    }
+    
+    status = threadpool_parallel(p_tp, begin, end, grain, NULL, reduce_func,
+                                 combine_func, p_ctx, p_result, result_size);
     
     EXIT:
-        if ((-1 == status) &&
-            (NULL != p_new))
-        {
-            free(p_new);
-            p_new = NULL;
-        }
         return status;
 }
 
-/***   end of file   ***/
\ No newline at end of file
+/***   end of file   ***/
@@ -11,11 +11,101 @@
  *              to finish out any work on the job queue, then be
  *              joined to the main thread for destruction.
  *
+ *          The job queue may optionally be bounded. When it is full,
+ *              threadpool_enq blocks, threadpool_try_enq fails at once
+ *              and threadpool_enq_timed blocks up to a deadline. A
+ *              high-water-mark callback reports when the queue becomes
+ *              saturated and when it has drained again.
+ *
+ *          Jobs submitted with threadpool_submit return a completion
+ *              handle that can be polled or waited on for the job's
+ *              result, and threadpool_wait_idle waits for every job
+ *              to finish without tearing down the threads.
+ *
+ *          Jobs are queued on one of THREADPOOL_NUM_PRIO priority lanes.
+ *              Threads prefer higher lanes, but take jobs by weighted
+ *              round-robin so a busy high lane cannot starve the lower
+ *              ones: within each round a lane gets at most its weight
+ *              in jobs while lower lanes have work waiting.
+ *              The enqueue functions that take no priority use the
+ *              normal lane.
+ *
+ *          The number of threads is elastic between a minimum and a
+ *              maximum. A thread is spawned when the job queue stays
+ *              deep with no thread idle, or when jobs wait too long
+ *              before being picked up. A thread that stays idle past a
+ *              timeout retires. threadpool_resize changes the bounds
+ *              at runtime.
+ *
+ *          Every thread keeps its own counters and log2-bucketed
+ *              histograms of how long jobs waited on the queue and how
+ *              long they ran. Only the owning thread writes them, so
+ *              they cost no synchronization; threadpool_stats_snapshot
+ *              merges them without stopping the threads.
+ *
+ *          A thread that runs out of work first spins for a while,
+ *              watching an eventcount that producers bump whenever they
+ *              post work, and only parks on the condition variable when
+ *              nothing arrives. The spin budget adapts per thread: it
+ *              grows when work arrived during the spin and shrinks when
+ *              the thread had to park anyway, so it follows the recent
+ *              arrival rate. Producers only signal when a thread is
+ *              actually parked.
+ *
+ *          Jobs enqueued with a key run in submission order and never at
+ *              the same time as another job with that key. Keys hash to
+ *              one of THREADPOOL_KEY_SHARDS serial queues. Only the job
+ *              at the head of a shard is posted to the threadpool; when
+ *              it finishes, the thread that ran it takes the shard's
+ *              next job itself, so a busy key stays on one thread while
+ *              idle keys are scheduled like any other job.
+ *
+ *          Jobs may also be delayed or repeated. Timers live on a
+ *              hierarchical timing wheel, so arming and cancelling one
+ *              is O(1). A timer thread, started with the first timer,
+ *              sleeps until the wheel has work to do and dispatches
+ *              every job that expired in one batch per wakeup.
+ *
+ *          A range of indices can be swept in parallel with
+ *              threadpool_parallel_for and threadpool_parallel_reduce.
+ *              The range is cut into grain-sized chunks that the caller
+ *              and up to one helper job per thread claim from a shared
+ *              cursor, so faster threads simply take more chunks. The
+ *              caller blocks until every chunk has run.
+ *
+ *          Two scheduling modes are available. In the shared mode all
+ *              threads take jobs from one mutex-protected queue. In the
+ *              work-stealing mode each thread owns a Chase-Lev deque:
+ *              jobs submitted from a thread go to its own deque, idle
+ *              threads steal from random victims, and the shared queue
+ *              only serves as the injection queue for outside producers.
+ *
  *          Functions included are as follows:
  *
+ *              - threadpool_attr_init
  *              - threadpool_create
+ *              - threadpool_create_attr
  *              - threadpool_destroy
+ *              - threadpool_resize
  *              - threadpool_enq
+ *              - threadpool_try_enq
+ *              - threadpool_enq_timed
+ *              - threadpool_enq_batch
+ *              - threadpool_enq_keyed
+ *              - threadpool_enq_after
+ *              - threadpool_enq_every
+ *              - threadpool_timer_cancel
+ *              - threadpool_parallel_for
+ *              - threadpool_parallel_reduce
+ *              - threadpool_enq_prio
+ *              - threadpool_lane_stats
+ *              - threadpool_submit
+ *              - threadpool_handle_poll
+ *              - threadpool_handle_wait
+ *              - threadpool_handle_result
+ *              - threadpool_handle_release
+ *              - threadpool_wait_idle
+ *              - threadpool_stats_snapshot
  */
 
 #ifndef THREADPOOL_H
@@ -25,28 +115,468 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
+#include "deque.h"
+#include "pool.h"
 #include "queue.h"
+#include "wheel.h"
+
+/*!
+ * @brief The maximum number of jobs a thread takes from the job queue
+ *          in a single critical section.
+ */
+#define THREADPOOL_DEQ_BATCH 8
+
+/*!
+ * @brief The maximum number of jobs threadpool_enq_batch enqueues in a
+ *          single critical section.
+ */
+#define THREADPOOL_ENQ_BATCH 64
+
+/*!
+ * @brief The capacity of each thread's deque in the work-stealing mode.
+ *          Jobs that do not fit overflow to the injection queue.
+ */
+#define THREADPOOL_DEQUE_CAPACITY 1024
+
+/*!
+ * @brief The number of passes over the other threads an idle thread
+ *          makes trying to steal before it goes to sleep.
+ */
+#define THREADPOOL_STEAL_ROUNDS 2
+
+/*!
+ * @brief The default number of queued jobs per running thread above
+ *          which the job queue counts as deep.
+ */
+#define THREADPOOL_DEFAULT_SPAWN_DEPTH 4
+
+/*!
+ * @brief The default time a thread above the minimum stays idle before
+ *          it retires, in milliseconds.
+ */
+#define THREADPOOL_DEFAULT_IDLE_MS 10000
+
+/*!
+ * @brief The number of consecutive checks that must find the threadpool
+ *          under pressure before a thread is spawned, so a short burst
+ *          does not spawn threads that immediately go idle.
+ */
+#define THREADPOOL_SPAWN_STREAK 4
+
+/*!
+ * @brief The default maximum number of busy-wait iterations an idle
+ *          thread spins for before it yields.
+ */
+#define THREADPOOL_DEFAULT_SPIN 4096
+
+/*!
+ * @brief The number of times an idle thread yields the processor after
+ *          spinning and before it parks.
+ */
+#define THREADPOOL_SPIN_YIELDS 8
+
+/*!
+ * @brief The threadpool_attr_t cpu value that leaves threads unpinned.
+ */
+#define THREADPOOL_CPU_ANY (-1)
+
+/*!
+ * @brief The base-2 logarithm of the number of keyed serial queues.
+ */
+#define THREADPOOL_KEY_SHARD_BITS 8
+
+/*!
+ * @brief The number of keyed serial queues. Keys that hash to the same
+ *          queue are serialized with each other.
+ */
+#define THREADPOOL_KEY_SHARDS (1u << THREADPOOL_KEY_SHARD_BITS)
+
+/*!
+ * @brief The number of jobs of one keyed serial queue a thread runs back
+ *          to back before it posts the next one to the threadpool, so a
+ *          busy key does not starve other work.
+ */
+#define THREADPOOL_KEY_BATCH 16
+
+/*!
+ * @brief The length of a timer tick, in milliseconds. Timers fire on the
+ *          first tick boundary at or after their deadline.
+ */
+#define THREADPOOL_TIMER_TICK_MS 1
+
+/*!
+ * @brief The number of chunks per thread a parallel loop aims for when
+ *          no grain is given, so threads that finish early can balance
+ *          the load by taking more.
+ */
+#define THREADPOOL_PARALLEL_CHUNKS 8
+
+/*!
+ * @brief The number of job priority lanes.
+ */
+#define THREADPOOL_NUM_PRIO 3
+
+/*!
+ * @brief The number of histogram buckets. Bucket i counts durations of
+ *          2^i up to 2^(i+1) nanoseconds, bucket 0 also counts zero, and
+ *          the last bucket counts everything longer.
+ */
+#define THREADPOOL_HIST_BUCKETS 32
+
+/*!
+ * @brief The assumed cache line size. Each thread's counters start on
+ *          their own cache line to avoid false sharing.
+ */
+#define THREADPOOL_CACHE_LINE 64
+
+/*!
+ * @brief The default round-robin weights of the priority lanes, from
+ *          the highest lane to the lowest.
+ */
+#define THREADPOOL_DEFAULT_WEIGHT_HIGH 8
+#define THREADPOOL_DEFAULT_WEIGHT_NORMAL 4
+#define THREADPOOL_DEFAULT_WEIGHT_LOW 1
+
+typedef struct _threadpool threadpool_t;
+typedef struct _threadpool_shard threadpool_shard_t;
+typedef struct _threadpool_timer threadpool_timer_t;
+typedef struct _threadpool_range threadpool_range_t;
+
+/*!
+ * @brief This enumeration defines the threadpool scheduling modes.
+ *
+ * @param THREADPOOL_MODE_SHARED All threads share one job queue.
+ * @param THREADPOOL_MODE_STEAL Each thread owns a work-stealing deque.
+ */
+typedef enum _threadpool_mode
+{
+    THREADPOOL_MODE_SHARED,
+    THREADPOOL_MODE_STEAL,
+} threadpool_mode_t;
+
+/*!
+ * @brief This enumeration defines the job priority lanes.
+ *
+ * @param THREADPOOL_PRIO_HIGH The highest lane.
+ * @param THREADPOOL_PRIO_NORMAL The lane used by the enqueue functions
+ *          that take no priority.
+ * @param THREADPOOL_PRIO_LOW The lowest lane.
+ */
+typedef enum _threadpool_prio
+{
+    THREADPOOL_PRIO_HIGH,
+    THREADPOOL_PRIO_NORMAL,
+    THREADPOOL_PRIO_LOW,
+} threadpool_prio_t;
+
+/*!
+ * @brief This datatype defines a snapshot of a priority lane's counters.
+ *
+ * @param depth The number of jobs queued on the lane.
+ * @param peak The largest depth the lane has reached.
+ * @param enqueued The number of jobs ever queued on the lane.
+ * @param dequeued The number of jobs ever taken off the lane.
+ */
+typedef struct _threadpool_lane_stats
+{
+    size_t depth;
+    size_t peak;
+    size_t enqueued;
+    size_t dequeued;
+} threadpool_lane_stats_t;
+
+/*!
+ * @brief This enumeration defines the states of a thread slot.
+ *
+ * @param THREADPOOL_SLOT_FREE No thread was ever started in the slot.
+ * @param THREADPOOL_SLOT_RUNNING The slot's thread is running.
+ * @param THREADPOOL_SLOT_EXITED The slot's thread retired and must be
+ *          joined before the slot is reused.
+ */
+typedef enum _threadpool_slot
+{
+    THREADPOOL_SLOT_FREE,
+    THREADPOOL_SLOT_RUNNING,
+    THREADPOOL_SLOT_EXITED,
+} threadpool_slot_t;
+
+/*!
+ * @brief This datatype defines a thread's counters. They are written
+ *          only by the owning thread and read by snapshots.
+ *
+ * @param enqueued Jobs the thread queued itself, either on its own deque
+ *          or by taking the next job of a keyed serial queue.
+ * @param completed Jobs the thread performed.
+ * @param busy_ns Time spent performing jobs.
+ * @param idle_ns Time spent between jobs.
+ * @param wait_hist Histogram of how long jobs waited before starting.
+ * @param run_hist Histogram of how long jobs ran.
+ */
+typedef struct _threadpool_counters
+{
+    _Atomic uint64_t enqueued;
+    _Atomic uint64_t completed;
+    _Atomic uint64_t busy_ns;
+    _Atomic uint64_t idle_ns;
+    _Atomic uint64_t wait_hist[THREADPOOL_HIST_BUCKETS];
+    _Atomic uint64_t run_hist[THREADPOOL_HIST_BUCKETS];
+} threadpool_counters_t;
+
+/*!
+ * @brief This datatype defines a snapshot of a threadpool's statistics.
+ *
+ * @param num_threads The number of running threads.
+ * @param enqueued Jobs ever enqueued.
+ * @param completed Jobs ever performed.
+ * @param queued Jobs currently waiting, on the lanes and on deques.
+ * @param peak_queued The largest number of jobs waiting on the lanes.
+ * @param busy_ns Time threads spent performing jobs.
+ * @param idle_ns Time threads spent between jobs.
+ * @param wait_hist Histogram of how long jobs waited before starting.
+ * @param run_hist Histogram of how long jobs ran.
+ * @param timer_dropped Expired timer jobs that found a bounded queue full,
+ *          or could not be enqueued at all, and never ran.
+ */
+typedef struct _threadpool_stats
+{
+    size_t   num_threads;
+    uint64_t enqueued;
+    uint64_t completed;
+    size_t   queued;
+    size_t   peak_queued;
+    uint64_t busy_ns;
+    uint64_t idle_ns;
+    uint64_t wait_hist[THREADPOOL_HIST_BUCKETS];
+    uint64_t run_hist[THREADPOOL_HIST_BUCKETS];
+    uint64_t timer_dropped;
+} threadpool_stats_t;
+
+/*!
+ * @brief This datatype defines the per-thread context of a threadpool.
+ *          There is one per thread slot, whether or not a thread is
+ *          running in it.
+ *
+ * @param p_tp The parent threadpool.
+ * @param index The slot's index in the threadpool.
+ * @param p_deque The slot's deque in the work-stealing mode, else NULL.
+ * @param seed The state of the thread's victim selection generator.
+ * @param thread The slot's thread.
+ * @param state The slot's state. Protected by the threadpool mutex.
+ * @param last_ns When the thread last finished a job, or started.
+ * @param spin_limit The thread's current spin budget, adapted to the
+ *          recent arrival rate.
+ * @param counters The slot's counters, kept across the threads that
+ *          run in it.
+ */
+typedef struct _threadpool_worker
+{
+    threadpool_t *    p_tp;
+    size_t            index;
+    deque_t *         p_deque;
+    unsigned int      seed;
+    pthread_t         thread;
+    threadpool_slot_t state;
+    uint64_t          last_ns;
+    size_t            spin_limit;
+    _Alignas(THREADPOOL_CACHE_LINE) threadpool_counters_t counters;
+} threadpool_worker_t;
+
+/*!
+ * @brief This datatype defines a function template for the threadpool's
+ *          high-water-mark callback.
+ *
+ *          The callback is invoked with the threadpool mutex held, so it
+ *              must be short and must not call back into the threadpool.
+ *
+ * @param p_tp The threadpool whose job queue changed state.
+ * @param b_saturated True when the queue depth rose to the high-water
+ *          mark, false when it fell back to the low-water mark.
+ * @param p_ctx The context registered with the callback.
+ *
+ * @return No return value expected.
+ */
+typedef void (*threadpool_hwm_f)(threadpool_t * p_tp, bool b_saturated, void * p_ctx);
+
+/*!
+ * @brief This datatype defines the creation attributes of a threadpool.
+ *          It should be initialized with threadpool_attr_init before
+ *          individual fields are set.
+ *
+ * @param num_threads The minimum number of threads in the threadpool,
+ *          all started at creation. Must be non-zero.
+ * @param max_threads The maximum number of threads in the threadpool.
+ *          0 means num_threads, for a fixed-size threadpool. This also
+ *          caps later calls to threadpool_resize.
+ * @param idle_timeout_ms How long a thread above the minimum stays idle
+ *          before it retires. 0 means threads never retire on their own.
+ * @param spawn_depth The number of queued jobs per running thread above
+ *          which a thread is spawned, if no thread is idle.
+ * @param spawn_wait_ms The time a job may wait on the queue before a
+ *          thread is spawned. 0 disables this check.
+ * @param capacity The maximum number of queued jobs over all priority
+ *          lanes. 0 means unbounded.
+ *          In the work-stealing mode this bounds the injection queue;
+ *          jobs submitted from the pool's own threads are never refused.
+ * @param high_water The queue depth at which hwm_func reports saturation.
+ *          0 disables the callback.
+ * @param low_water The queue depth at which hwm_func reports the queue
+ *          has drained. Must be below high_water.
+ * @param hwm_func The high-water-mark callback. May be NULL.
+ * @param p_hwm_ctx The context passed to hwm_func.
+ * @param mode The scheduling mode.
+ * @param lane_weights The round-robin weight of each priority lane.
+ *          Each must be non-zero.
+ * @param spin_max The most busy-wait iterations an idle thread spins
+ *          for before it parks. 0 makes idle threads park right away.
+ *          On a single processor only the yielding part of the spin is
+ *          kept, since busy-waiting cannot let a producer run.
+ * @param cpu The processor every thread is pinned to, or
+ *          THREADPOOL_CPU_ANY. Pinned threads share one processor, so
+ *          they keep only the yielding part of the spin as well.
+ */
+typedef struct _threadpool_attr
+{
+    size_t            num_threads;
+    size_t            max_threads;
+    size_t            idle_timeout_ms;
+    size_t            spawn_depth;
+    size_t            spawn_wait_ms;
+    size_t            capacity;
+    size_t            high_water;
+    size_t            low_water;
+    threadpool_hwm_f  hwm_func;
+    void *            p_hwm_ctx;
+    threadpool_mode_t mode;
+    size_t            lane_weights[THREADPOOL_NUM_PRIO];
+    size_t            spin_max;
+    int               cpu;
+} threadpool_attr_t;
 
 /*!
  * @brief This datatype defines a threadpool context.
  *
- * @param p_threads The array containing the individual threads.
- * @param num_threads The number of threads in the threadpool.
+ * @param num_threads The number of running threads.
+ * @param min_threads The minimum number of running threads.
+ * @param max_threads The maximum number of running threads.
+ * @param idle_timeout_ms How long a thread above the minimum stays idle
+ *          before it retires.
+ * @param spawn_depth The queued jobs per running thread above which a
+ *          thread is spawned.
+ * @param spawn_wait_ns The job wait time above which a thread is spawned.
+ * @param spawn_streak The number of consecutive checks that found the
+ *          threadpool under pressure.
  * @param b_shutdown The threadpool's shutdown signal.
  * @param mutex The threadpool mutex.
  * @param cond The threadpool condition variable.
- * @param p_queue The threadpool job queue.
+ * @param cond_space The condition variable producers wait on when the
+ *          job queue is full.
+ * @param p_lanes The job queue of each priority lane.
+ * @param lane_weights The round-robin weight of each priority lane.
+ * @param lane_credits The jobs each lane may still give up in the
+ *          current round.
+ * @param lane_peak The largest depth each lane has reached.
+ * @param lane_enqueued The number of jobs ever queued on each lane.
+ * @param lane_dequeued The number of jobs ever taken off each lane.
+ * @param num_queued The number of jobs queued over all lanes.
+ * @param peak_queued The largest value num_queued has reached.
+ * @param p_job_pool The pool that job contexts are allocated from.
+ * @param capacity The maximum number of queued jobs. 0 means unbounded.
+ * @param num_space_waiters The number of producers waiting for space.
+ * @param high_water The high-water mark. 0 disables the callback.
+ * @param low_water The low-water mark.
+ * @param hwm_func The high-water-mark callback.
+ * @param p_hwm_ctx The context passed to the callback.
+ * @param b_saturated Whether the queue is above the high-water mark and
+ *          has not yet drained to the low-water mark.
+ * @param mode The scheduling mode.
+ * @param p_workers The array of thread slots.
+ * @param num_workers The number of thread slots, the creation-time
+ *          maximum number of threads. Unlike num_threads, this is final
+ *          before any thread starts.
+ * @param num_sleepers The number of threads waiting on the condition
+ *          variable.
+ * @param epoch The eventcount that producers bump whenever they post
+ *          work. Spinning threads watch it for a change.
+ * @param b_spin Whether idle threads spin before they park.
+ * @param spin_max The most busy-wait iterations of a spin.
+ * @param cpu The processor every thread is pinned to, or
+ *          THREADPOOL_CPU_ANY.
+ * @param cond_done The condition variable that handle and idle waiters
+ *          wait on.
+ * @param num_pending The number of jobs submitted and not yet finished.
+ * @param num_done_waiters The number of threads waiting on cond_done.
+ * @param p_handle_pool The object pool for completion handles.
+ * @param p_shards The keyed serial queues.
+ * @param num_shards The number of keyed serial queues initialized.
+ * @param timer_mutex The mutex protecting the timing wheel.
+ * @param timer_cond The condition variable the timer thread sleeps on.
+ *          It waits against CLOCK_MONOTONIC.
+ * @param p_wheel The timing wheel.
+ * @param p_timer_pool The object pool for timers.
+ * @param ticker The timer thread.
+ * @param b_ticker Whether the timer thread was started.
+ * @param b_timer_stop The timer thread's shutdown signal.
+ * @param timer_base_ns The monotonic time of tick 0.
+ * @param timer_wake The tick the timer thread sleeps until.
+ * @param timer_dropped Expired timer jobs that could not be enqueued.
  */
-typedef struct _threadpool
+struct _threadpool
 {
-    pthread_t *     p_threads;
-    size_t          num_threads;
-    _Atomic bool    b_shutdown;
-    pthread_mutex_t mutex;
-    pthread_cond_t  cond;
-    queue_t *       p_queue;
-} threadpool_t;
+    size_t                num_threads;
+    size_t                min_threads;
+    size_t                max_threads;
+    size_t                idle_timeout_ms;
+    size_t                spawn_depth;
+    uint64_t              spawn_wait_ns;
+    size_t                spawn_streak;
+    _Atomic bool          b_shutdown;
+    pthread_mutex_t       mutex;
+    pthread_cond_t        cond;
+    pthread_cond_t        cond_space;
+    queue_t *             p_lanes[THREADPOOL_NUM_PRIO];
+    size_t                lane_weights[THREADPOOL_NUM_PRIO];
+    size_t                lane_credits[THREADPOOL_NUM_PRIO];
+    size_t                lane_peak[THREADPOOL_NUM_PRIO];
+    size_t                lane_enqueued[THREADPOOL_NUM_PRIO];
+    size_t                lane_dequeued[THREADPOOL_NUM_PRIO];
+    size_t                num_queued;
+    size_t                peak_queued;
+    pool_t *              p_job_pool;
+    size_t                capacity;
+    size_t                num_space_waiters;
+    size_t                high_water;
+    size_t                low_water;
+    threadpool_hwm_f      hwm_func;
+    void *                p_hwm_ctx;
+    bool                  b_saturated;
+    threadpool_mode_t     mode;
+    threadpool_worker_t * p_workers;
+    size_t                num_workers;
+    _Atomic size_t        num_sleepers;
+    _Atomic size_t        epoch;
+    bool                  b_spin;
+    size_t                spin_max;
+    int                   cpu;
+    pthread_cond_t        cond_done;
+    _Atomic size_t        num_pending;
+    _Atomic size_t        num_done_waiters;
+    pool_t *              p_handle_pool;
+    threadpool_shard_t *  p_shards;
+    size_t                num_shards;
+    pthread_mutex_t       timer_mutex;
+    pthread_cond_t        timer_cond;
+    wheel_t *             p_wheel;
+    pool_t *              p_timer_pool;
+    pthread_t             ticker;
+    bool                  b_ticker;
+    bool                  b_timer_stop;
+    uint64_t              timer_base_ns;
+    uint64_t              timer_wake;
+    uint64_t              timer_dropped;
+};
 
 /*!
  * @brief This datatype defines a function template for a job that the
@@ -65,18 +595,192 @@ typedef void (*job_f)(_Atomic bool * pb_shutdown, void * p_arg);
  *
  * @param job_func The job function pointer.
  * @param p_arg The job arguments.
+ * @param enq_ns The monotonic time the job was enqueued, in nanoseconds.
+ *          Set by the threadpool; ignored in arrays passed to
+ *          threadpool_enq_batch.
+ * @param p_shard The keyed serial queue of a keyed job, else NULL. Set
+ *          by the threadpool like enq_ns.
+ * @param p_next The next job waiting on the same keyed serial queue.
+ *          Set by the threadpool like enq_ns.
  */
 typedef struct _job
 {
     job_f job_func;
     void * p_arg;
+    uint64_t enq_ns;
+    threadpool_shard_t * p_shard;
+    struct _job * p_next;
 } job_t;
 
 /*!
- * @brief This function instantiates a new threadpool context.
+ * @brief This datatype defines a keyed serial queue. At most one of its
+ *          jobs is posted to the threadpool or running at a time; the
+ *          rest wait on the queue.
+ *
+ * @param mutex The queue's mutex.
+ * @param p_head The oldest waiting job.
+ * @param p_tail The newest waiting job.
+ * @param b_active Whether one of the queue's jobs is posted or running.
+ */
+struct _threadpool_shard
+{
+    _Alignas(THREADPOOL_CACHE_LINE) pthread_mutex_t mutex;
+    job_t *                         p_head;
+    job_t *                         p_tail;
+    bool                            b_active;
+};
+
+/*!
+ * @brief This datatype defines a timer for a delayed or periodic job.
+ *          Protected by the threadpool's timer mutex.
+ *
+ * @param node The timer's place on the timing wheel.
+ * @param p_tp The parent threadpool.
+ * @param job_func The function to perform.
+ * @param p_arg The arguments associated with the job.
+ * @param period The period in ticks. 0 for a one-shot timer.
+ * @param refs The references held by the wheel and the caller.
+ * @param b_cancelled Whether the timer was cancelled.
+ */
+struct _threadpool_timer
+{
+    wheel_timer_t  node;
+    threadpool_t * p_tp;
+    job_f          job_func;
+    void *         p_arg;
+    uint64_t       period;
+    int            refs;
+    bool           b_cancelled;
+};
+
+/*!
+ * @brief This datatype defines a function template for the body of a
+ *          parallel loop, called once per chunk of the range.
+ *
+ * @param begin The first index of the chunk.
+ * @param end One past the last index of the chunk.
+ * @param p_ctx The context passed to threadpool_parallel_for.
+ *
+ * @return No return value expected.
+ */
+typedef void (*threadpool_for_f)(size_t begin, size_t end, void * p_ctx);
+
+/*!
+ * @brief This datatype defines a function template for the body of a
+ *          parallel reduction, called once per chunk of the range.
+ *
+ * @param begin The first index of the chunk.
+ * @param end One past the last index of the chunk.
+ * @param p_ctx The context passed to threadpool_parallel_reduce.
+ * @param p_partial The calling thread's partial result, to fold the
+ *          chunk into.
+ *
+ * @return No return value expected.
+ */
+typedef void (*threadpool_reduce_f)(size_t begin, size_t end, void * p_ctx,
+                                    void * p_partial);
+
+/*!
+ * @brief This datatype defines a function template that combines a
+ *          partial result of a parallel reduction into the result.
+ *
+ * @param p_result The result to combine into.
+ * @param p_partial The partial result.
+ * @param p_ctx The context passed to threadpool_parallel_reduce.
+ *
+ * @return No return value expected.
+ */
+typedef void (*threadpool_combine_f)(void * p_result, const void * p_partial,
+                                     void * p_ctx);
+
+/*!
+ * @brief This datatype defines a range being swept by a parallel loop.
+ *          It is shared by the caller and the helper jobs, and freed
+ *          once all of them have released it.
+ *
+ * @param p_tp The threadpool the helpers were enqueued on.
+ * @param begin The first index of the range.
+ * @param end One past the last index of the range.
+ * @param grain The number of indices in a chunk.
+ * @param num_chunks The number of chunks.
+ * @param next The next chunk to claim.
+ * @param done The number of chunks that have run.
+ * @param for_func The loop body, or NULL for a reduction.
+ * @param reduce_func The reduction body, or NULL for a loop.
+ * @param p_ctx The context passed to the body.
+ * @param result_size The size of a partial result.
+ * @param num_slots The number of partial results handed out.
+ * @param p_partials One partial result per participating thread.
+ * @param refs The references held by the caller and the helpers.
+ */
+struct _threadpool_range
+{
+    threadpool_t *        p_tp;
+    size_t                begin;
+    size_t                end;
+    size_t                grain;
+    size_t                num_chunks;
+    _Atomic size_t        next;
+    _Atomic size_t        done;
+    threadpool_for_f      for_func;
+    threadpool_reduce_f   reduce_func;
+    void *                p_ctx;
+    size_t                result_size;
+    _Atomic size_t        num_slots;
+    unsigned char *       p_partials;
+    _Atomic int           refs;
+};
+
+/*!
+ * @brief This datatype defines a function template for a job that
+ *          produces a result, submitted with threadpool_submit.
+ *
+ * @param pb_shutdown Pointer to the parent threadpool's shutdown signal.
+ * @param p_arg The arguments to be passed to the job function.
+ *
+ * @return The job's result, retrieved with threadpool_handle_result.
+ */
+typedef void * (*threadpool_task_f)(_Atomic bool * pb_shutdown, void * p_arg);
+
+/*!
+ * @brief This datatype defines a completion handle for a submitted job.
+ *
+ *          The handle is shared by the submitter and the job, and is
+ *              returned to the threadpool once both have released it.
+ *
+ * @param p_tp The threadpool the job was submitted to.
+ * @param task_func The job function pointer.
+ * @param p_arg The job arguments.
+ * @param p_result The job's result, valid once b_done is set.
+ * @param b_done Whether the job has finished.
+ * @param refs The number of references held on the handle.
+ */
+typedef struct _threadpool_handle
+{
+    threadpool_t *    p_tp;
+    threadpool_task_f task_func;
+    void *            p_arg;
+    void *            p_result;
+    _Atomic bool      b_done;
+    _Atomic int       refs;
+} threadpool_handle_t;
+
+/*!
+ * @brief This function initializes threadpool attributes to their
+ *          defaults: one thread in the shared mode and an unbounded
+ *          job queue with no high-water-mark callback.
+ *
+ * @param[out] p_attr The attributes to initialize.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_attr_init (threadpool_attr_t * p_attr);
+
+/*!
+ * @brief This function instantiates a new fixed-size threadpool context.
  *
  * @param[in] num_threads The number of threads in the job queue.
- *              This cannot be changed after instantiation.
  *              This number must be non-zero, or error will be returned.
  *
  * @return Pointer to new threadpool context. NULL on error.
@@ -84,6 +788,17 @@ typedef struct _job
 threadpool_t *
 threadpool_create (const size_t num_threads);
 
+/*!
+ * @brief This function instantiates a new threadpool context from a set
+ *          of attributes.
+ *
+ * @param[in] p_attr The threadpool attributes.
+ *
+ * @return Pointer to new threadpool context. NULL on error.
+ */
+threadpool_t *
+threadpool_create_attr (const threadpool_attr_t * p_attr);
+
 /*!
  * @brief This function destroys a threadpool context.
  *
@@ -98,9 +813,29 @@ threadpool_create (const size_t num_threads);
 int
 threadpool_destroy (threadpool_t * p_tp);
 
+/*!
+ * @brief This function changes the bounds on the number of threads.
+ *
+ *          Threads are spawned right away to reach the new minimum.
+ *              Threads above the new maximum retire once they run out
+ *              of the work they hold. Jobs may be enqueued concurrently.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] min_threads The new minimum. Must be non-zero.
+ * @param[in] max_threads The new maximum. Must be at least min_threads,
+ *              and at most the maximum the threadpool was created with.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_resize (threadpool_t * p_tp, const size_t min_threads, const size_t max_threads);
+
 /*!
  * @brief This function enqueues a job on the threadpool.
  *
+ *          If the job queue is bounded and full, this blocks until a
+ *              thread makes room.
+ *
  * @param[in/out] p_tp The threadpool context.
  * @param[in] job_func The function to perform.
  * @param[in] p_arg The arguments associated with the job.
@@ -110,6 +845,313 @@ threadpool_destroy (threadpool_t * p_tp);
 int
 threadpool_enq (threadpool_t * p_tp, job_f job_func, void * p_arg);
 
+/*!
+ * @brief This function enqueues a job on the threadpool without blocking.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return 0 on success, -1 on error. errno is set to EAGAIN if the job
+ *          queue is full.
+ */
+int
+threadpool_try_enq (threadpool_t * p_tp, job_f job_func, void * p_arg);
+
+/*!
+ * @brief This function enqueues a job on the threadpool, blocking no
+ *          later than a deadline while the job queue is full.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ * @param[in] p_abstime The absolute CLOCK_REALTIME deadline.
+ *
+ * @return 0 on success, -1 on error. errno is set to ETIMEDOUT if the
+ *          deadline passed while the job queue was full.
+ */
+int
+threadpool_enq_timed (threadpool_t * p_tp, job_f job_func, void * p_arg,
+                      const struct timespec * p_abstime);
+
+/*!
+ * @brief This function enqueues an array of jobs on the threadpool.
+ *
+ *          The job contexts are prepared outside the critical section,
+ *              then the whole batch is enqueued under a single lock and
+ *              released to the threads with a single wakeup.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] p_jobs The array of jobs to perform, in order. No job
+ *              function may be NULL.
+ * @param[in] num_jobs The number of jobs in the array. Must be non-zero.
+ *              Arrays longer than THREADPOOL_ENQ_BATCH, or than the job
+ *              queue's capacity, are enqueued in chunks of that size,
+ *              one critical section per chunk. Each chunk blocks while
+ *              the job queue lacks room for it.
+ *
+ * @return 0 on success, -1 on error. On error, chunks before the one
+ *          that failed remain enqueued.
+ */
+int
+threadpool_enq_batch (threadpool_t * p_tp, const job_t * p_jobs, const size_t num_jobs);
+
+/*!
+ * @brief This function enqueues a job that runs in submission order with
+ *          respect to, and never at the same time as, other jobs with
+ *          the same key.
+ *
+ *          Keyed jobs run on the normal lane. They are not held back by
+ *              a bounded queue's capacity, since a producer must not wait
+ *              while it holds its key's place in line.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] key The serialization key. Distinct keys may share a serial
+ *              queue, in which case they are serialized with each other.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq_keyed (threadpool_t * p_tp, const uint64_t key,
+                      job_f job_func, void * p_arg);
+
+/*!
+ * @brief This function enqueues a job on one of the threadpool's
+ *          priority lanes.
+ *
+ *          If the job queue is bounded and full, this blocks until a
+ *              thread makes room. In the work-stealing mode, jobs from
+ *              the threadpool's own threads only go to their deque on
+ *              the normal lane; jobs on other lanes are scheduled by
+ *              lane like jobs from outside the threadpool.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] prio The priority lane.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq_prio (threadpool_t * p_tp, const threadpool_prio_t prio,
+                     job_f job_func, void * p_arg);
+
+/*!
+ * @brief This function takes a snapshot of a priority lane's counters.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] prio The priority lane.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_lane_stats (threadpool_t * p_tp, const threadpool_prio_t prio,
+                       threadpool_lane_stats_t * p_stats);
+
+/*!
+ * @brief This function enqueues a job on the threadpool and returns a
+ *          completion handle for it.
+ *
+ *          If the job queue is bounded and full, this blocks until a
+ *              thread makes room. The handle must be released with
+ *              threadpool_handle_release before the threadpool is
+ *              destroyed.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] task_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ *
+ * @return Pointer to the completion handle. NULL on error.
+ */
+threadpool_handle_t *
+threadpool_submit (threadpool_t * p_tp, threadpool_task_f task_func, void * p_arg);
+
+/*!
+ * @brief This function checks whether a submitted job has finished.
+ *
+ * @param[in] p_handle The completion handle.
+ *
+ * @return True if the job has finished. False if not, or on error.
+ */
+bool
+threadpool_handle_poll (threadpool_handle_t * p_handle);
+
+/*!
+ * @brief This function blocks until a submitted job has finished.
+ *
+ *          Waiting from inside a job of the same threadpool can deadlock
+ *              if every thread ends up waiting.
+ *
+ * @param[in] p_handle The completion handle.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_handle_wait (threadpool_handle_t * p_handle);
+
+/*!
+ * @brief This function retrieves the result of a finished job.
+ *
+ * @param[in] p_handle The completion handle.
+ * @param[out] pp_result The job's result.
+ *
+ * @return 0 on success, -1 on error. errno is set to EAGAIN if the job
+ *          has not finished.
+ */
+int
+threadpool_handle_result (threadpool_handle_t * p_handle, void ** pp_result);
+
+/*!
+ * @brief This function releases the submitter's reference to a
+ *          completion handle. The handle may not be used afterwards.
+ *
+ *          The job does not need to have finished; it holds its own
+ *              reference until it does.
+ *
+ * @param[in/out] p_handle The completion handle. NULL is ignored.
+ *
+ * @return No return value expected.
+ */
+void
+threadpool_handle_release (threadpool_handle_t * p_handle);
+
+/*!
+ * @brief This function blocks until every job submitted to the
+ *          threadpool has finished, including jobs submitted by other
+ *          jobs while waiting. The threads are left running.
+ *
+ *          Timers that have not expired yet are not waited for.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ *
+ * @return 0 on success, -1 on error. errno is set to EDEADLK if called
+ *          from one of the threadpool's own threads.
+ */
+int
+threadpool_wait_idle (threadpool_t * p_tp);
+
+/*!
+ * @brief This function takes a snapshot of a threadpool's statistics.
+ *
+ *          Each thread's counters are read without stopping it, so the
+ *              snapshot is approximate while jobs are running.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_stats_snapshot (threadpool_t * p_tp, threadpool_stats_t * p_stats);
+
+/*!
+ * @brief This function enqueues a job to be performed once, after a delay.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] delay_ms The delay in milliseconds.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ * @param[out] pp_timer Receives the timer, which must be given back with
+ *              threadpool_timer_cancel. May be NULL if the timer will
+ *              never be cancelled.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq_after (threadpool_t * p_tp, const size_t delay_ms,
+                      job_f job_func, void * p_arg, threadpool_timer_t ** pp_timer);
+
+/*!
+ * @brief This function enqueues a job to be performed repeatedly, first
+ *          after one period and then every period. An expiry that the
+ *          timer thread falls behind on is coalesced with the next.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] period_ms The period in milliseconds. Must be non-zero.
+ * @param[in] job_func The function to perform.
+ * @param[in] p_arg The arguments associated with the job.
+ * @param[out] pp_timer Receives the timer, which must be given back with
+ *              threadpool_timer_cancel. May be NULL, in which case the
+ *              job repeats until the threadpool is destroyed.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_enq_every (threadpool_t * p_tp, const size_t period_ms,
+                      job_f job_func, void * p_arg, threadpool_timer_t ** pp_timer);
+
+/*!
+ * @brief This function cancels a timer and gives it back. The timer must
+ *          not be used afterwards.
+ *
+ *          A job that already expired may still be queued or running.
+ *              Timers must be given back before the threadpool is
+ *              destroyed; destroying it discards every pending timer.
+ *
+ * @param[in/out] p_timer The timer.
+ *
+ * @return 0 if a pending expiry was cancelled, -1 on error or if a
+ *          one-shot timer had already expired.
+ */
+int
+threadpool_timer_cancel (threadpool_timer_t * p_timer);
+
+/*!
+ * @brief This function runs a loop body over a range of indices in
+ *          parallel and blocks until it has covered the whole range.
+ *
+ *          The range is cut into chunks of grain indices. The calling
+ *              thread runs chunks itself alongside helper jobs enqueued
+ *              on the threadpool, so it may be called from a job too.
+ *              Chunks run in no particular order.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] begin The first index of the range.
+ * @param[in] end One past the last index of the range.
+ * @param[in] grain The number of indices in a chunk. 0 picks a grain
+ *              that gives every thread several chunks.
+ * @param[in] for_func The loop body.
+ * @param[in] p_ctx The context passed to the loop body.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_parallel_for (threadpool_t * p_tp, const size_t begin, const size_t end,
+                         const size_t grain, threadpool_for_f for_func, void * p_ctx);
+
+/*!
+ * @brief This function reduces a range of indices in parallel and blocks
+ *          until it has covered the whole range.
+ *
+ *          Every participating thread folds its chunks into a partial
+ *              result of its own, which starts as a copy of the initial
+ *              result. The partials are then combined into the result
+ *              by the calling thread, in no particular order, so the
+ *              combine function must be associative and commutative.
+ *
+ * @param[in/out] p_tp The threadpool context.
+ * @param[in] begin The first index of the range.
+ * @param[in] end One past the last index of the range.
+ * @param[in] grain The number of indices in a chunk. 0 picks a grain
+ *              that gives every thread several chunks.
+ * @param[in] reduce_func The reduction body.
+ * @param[in] combine_func The function combining partial results.
+ * @param[in] p_ctx The context passed to both functions.
+ * @param[in/out] p_result The result. Holds the identity of the
+ *              reduction on entry, such as 0 for a sum.
+ * @param[in] result_size The size of the result.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+threadpool_parallel_reduce (threadpool_t * p_tp, const size_t begin, const size_t end,
+                            const size_t grain, threadpool_reduce_f reduce_func,
+                            threadpool_combine_f combine_func, void * p_ctx,
+                            void * p_result, const size_t result_size);
+
 #endif // THREADPOOL_H
 
-/***   end of file   ***/
\ No newline at end of file
+/***   end of file   ***/
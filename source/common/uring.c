@@ -0,0 +1,470 @@
+/*!
+ * @file uring.c
+ *
+ * @brief This file contains a minimal io_uring wrapper.
+ *
+ *          The ring indices are shared with the kernel, whose layout
+ *              uses plain integers, so they are accessed with the
+ *              compiler's __atomic builtins. The application owns the
+ *              submission tail and the completion head and publishes
+ *              them with release stores; the kernel's submission head
+ *              and completion tail are read with acquire loads, which
+ *              makes the entries they cover visible.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/*!
+ * @brief The most buffers a provided buffer ring may hold.
+ */
+#define URING_BUFS_MAX 32768
+
+/*!
+ * @brief This function instantiates a new io_uring instance.
+ *
+ * @param[in] entries The number of submission entries. The kernel
+ *              rounds it up to a power of two.
+ *
+ * @return Pointer to new ring context. NULL on error, with errno set,
+ *          for instance to ENOSYS if the kernel lacks io_uring.
+ */
+uring_t *
+uring_create (const unsigned entries)
+{
+    int status = -1;
+    uring_t * p_ring = NULL;
+    if (0 == entries)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    p_ring = malloc(sizeof(uring_t));
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    memset(p_ring, 0, sizeof(uring_t));
+    p_ring->fd = -1;
+    p_ring->p_sq_ring = MAP_FAILED;
+    p_ring->p_cq_ring = MAP_FAILED;
+    p_ring->p_sqes = MAP_FAILED;
+    
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    p_ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (-1 == p_ring->fd)
+    {
+        goto EXIT;
+    }
+    
+    // Map the rings. Newer kernels map both rings with one call.
+    p_ring->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    p_ring->cq_ring_size = params.cq_off.cqes +
+                           (params.cq_entries * sizeof(struct io_uring_cqe));
+    if (0 != (params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        if (p_ring->cq_ring_size > p_ring->sq_ring_size)
+        {
+            p_ring->sq_ring_size = p_ring->cq_ring_size;
+        }
+        p_ring->cq_ring_size = p_ring->sq_ring_size;
+    }
+    p_ring->p_sq_ring = mmap(NULL, p_ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == p_ring->p_sq_ring)
+    {
+        goto EXIT;
+    }
+    if (0 != (params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        p_ring->p_cq_ring = p_ring->p_sq_ring;
+    }
+    else
+    {
+        p_ring->p_cq_ring = mmap(NULL, p_ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == p_ring->p_cq_ring)
+        {
+            goto EXIT;
+        }
+    }
+    p_ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    p_ring->p_sqes = mmap(NULL, p_ring->sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == p_ring->p_sqes)
+    {
+        goto EXIT;
+    }
+    
+    unsigned char * p_sq = p_ring->p_sq_ring;
+    unsigned char * p_cq = p_ring->p_cq_ring;
+    p_ring->p_sq_head = (unsigned *) (p_sq + params.sq_off.head);
+    p_ring->p_sq_tail = (unsigned *) (p_sq + params.sq_off.tail);
+    p_ring->p_sq_array = (unsigned *) (p_sq + params.sq_off.array);
+    p_ring->sq_mask = *(unsigned *) (p_sq + params.sq_off.ring_mask);
+    p_ring->sq_entries = params.sq_entries;
+    p_ring->sq_tail = *(p_ring->p_sq_tail);
+    p_ring->sq_submitted = p_ring->sq_tail;
+    p_ring->p_cq_head = (unsigned *) (p_cq + params.cq_off.head);
+    p_ring->p_cq_tail = (unsigned *) (p_cq + params.cq_off.tail);
+    p_ring->p_cqes = (struct io_uring_cqe *) (p_cq + params.cq_off.cqes);
+    p_ring->cq_mask = *(unsigned *) (p_cq + params.cq_off.ring_mask);
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_ring))
+        {
+            int error = errno;
+            uring_destroy(p_ring);
+            p_ring = NULL;
+            errno = error;
+        }
+        return p_ring;
+}
+
+/*!
+ * @brief This function destroys an io_uring instance. Operations still
+ *          in flight are cancelled.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return No return value expected.
+ */
+void
+uring_destroy (uring_t * p_ring)
+{
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    
+    if (MAP_FAILED != (void *) p_ring->p_sqes)
+    {
+        munmap(p_ring->p_sqes, p_ring->sqes_size);
+    }
+    if ((MAP_FAILED != p_ring->p_cq_ring) &&
+        (p_ring->p_cq_ring != p_ring->p_sq_ring))
+    {
+        munmap(p_ring->p_cq_ring, p_ring->cq_ring_size);
+    }
+    if (MAP_FAILED != p_ring->p_sq_ring)
+    {
+        munmap(p_ring->p_sq_ring, p_ring->sq_ring_size);
+    }
+    if (-1 != p_ring->fd)
+    {
+        close(p_ring->fd);
+    }
+    free(p_ring);
+    p_ring = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function takes the next free submission queue entry. It
+ *          is zeroed, and is handed to the kernel by uring_submit.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return Pointer to the entry. NULL on error or if the submission
+ *          queue is full, in which case uring_submit makes room.
+ */
+struct io_uring_sqe *
+uring_get_sqe (uring_t * p_ring)
+{
+    struct io_uring_sqe * p_sqe = NULL;
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    
+    unsigned head = __atomic_load_n(p_ring->p_sq_head, __ATOMIC_ACQUIRE);
+    if ((p_ring->sq_tail - head) >= p_ring->sq_entries)
+    {
+        goto EXIT;
+    }
+    
+    unsigned idx = p_ring->sq_tail & p_ring->sq_mask;
+    p_sqe = p_ring->p_sqes + idx;
+    memset(p_sqe, 0, sizeof(struct io_uring_sqe));
+    p_ring->p_sq_array[idx] = idx;
+    p_ring->sq_tail++;
+    
+    EXIT:
+        return p_sqe;
+}
+
+/*!
+ * @brief This function hands every queued entry to the kernel and
+ *          optionally waits for completions, in one system call.
+ *
+ * @param[in/out] p_ring The ring context.
+ * @param[in] wait_nr The number of completions to wait for. 0 returns
+ *              at once.
+ *
+ * @return The number of entries submitted, -1 on error with errno set.
+ */
+int
+uring_submit (uring_t * p_ring, const unsigned wait_nr)
+{
+    int submitted = -1;
+    if (NULL == p_ring)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // Publish the entries filled since the last call.
+    __atomic_store_n(p_ring->p_sq_tail, p_ring->sq_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = p_ring->sq_tail - p_ring->sq_submitted;
+    if ((0 == to_submit) &&
+        (0 == wait_nr))
+    {
+        submitted = 0;
+        goto EXIT;
+    }
+    
+    unsigned flags = (0 != wait_nr) ? IORING_ENTER_GETEVENTS : 0;
+    submitted = (int) syscall(__NR_io_uring_enter, p_ring->fd, to_submit, wait_nr,
+                              flags, NULL, 0);
+    if (submitted > 0)
+    {
+        p_ring->sq_submitted += (unsigned) submitted;
+    }
+    
+    EXIT:
+        return submitted;
+}
+
+/*!
+ * @brief This function returns the oldest completion without consuming
+ *          it.
+ *
+ * @param[in] p_ring The ring context.
+ *
+ * @return Pointer to the completion. NULL on error or if there is none.
+ */
+struct io_uring_cqe *
+uring_peek_cqe (uring_t * p_ring)
+{
+    struct io_uring_cqe * p_cqe = NULL;
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    
+    unsigned head = *(p_ring->p_cq_head);
+    if (head != __atomic_load_n(p_ring->p_cq_tail, __ATOMIC_ACQUIRE))
+    {
+        p_cqe = p_ring->p_cqes + (head & p_ring->cq_mask);
+    }
+    
+    EXIT:
+        return p_cqe;
+}
+
+/*!
+ * @brief This function consumes the completion returned by
+ *          uring_peek_cqe, which must not be used afterwards.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return No return value expected.
+ */
+void
+uring_cqe_seen (uring_t * p_ring)
+{
+    if (NULL == p_ring)
+    {
+        goto EXIT;
+    }
+    
+    __atomic_store_n(p_ring->p_cq_head, *(p_ring->p_cq_head) + 1, __ATOMIC_RELEASE);
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function allocates a group of buffers and registers them
+ *          as a provided buffer ring, with every buffer available.
+ *
+ * @param[in/out] p_ring The ring context.
+ * @param[in] group The buffer group id.
+ * @param[in] count The number of buffers. Must be a power of two no
+ *              larger than 32768.
+ * @param[in] buf_size The size of each buffer. Must be non-zero.
+ *
+ * @return Pointer to new buffer ring context. NULL on error, with errno
+ *          set, for instance to EINVAL if the kernel lacks buffer rings.
+ */
+uring_bufs_t *
+uring_bufs_create (uring_t * p_ring, const uint16_t group, const unsigned count,
+                   const size_t buf_size)
+{
+    int status = -1;
+    uring_bufs_t * p_bufs = NULL;
+    if ((NULL == p_ring) ||
+        (0 == count) ||
+        (count > URING_BUFS_MAX) ||
+        (0 != (count & (count - 1))) ||
+        (0 == buf_size))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    p_bufs = malloc(sizeof(uring_bufs_t));
+    if (NULL == p_bufs)
+    {
+        goto EXIT;
+    }
+    p_bufs->p_ring = p_ring;
+    p_bufs->buf_ring_size = count * sizeof(struct io_uring_buf);
+    p_bufs->buf_size = buf_size;
+    p_bufs->count = count;
+    p_bufs->group = group;
+    p_bufs->tail = 0;
+    p_bufs->p_data = malloc(count * buf_size);
+    
+    // The kernel wants the ring page aligned, which an anonymous
+    // mapping always is.
+    p_bufs->p_buf_ring = mmap(NULL, p_bufs->buf_ring_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((NULL == p_bufs->p_data) ||
+        (MAP_FAILED == (void *) p_bufs->p_buf_ring))
+    {
+        goto EXIT;
+    }
+    
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) p_bufs->p_buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (0 != syscall(__NR_io_uring_register, p_ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+    {
+        goto EXIT;
+    }
+    
+    for (unsigned bid = 0; bid < count; ++bid)
+    {
+        uring_bufs_recycle(p_bufs, (uint16_t) bid);
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_bufs))
+        {
+            int error = errno;
+            if (MAP_FAILED != (void *) p_bufs->p_buf_ring)
+            {
+                munmap(p_bufs->p_buf_ring, p_bufs->buf_ring_size);
+            }
+            free(p_bufs->p_data);
+            free(p_bufs);
+            p_bufs = NULL;
+            errno = error;
+        }
+        return p_bufs;
+}
+
+/*!
+ * @brief This function unregisters and frees a provided buffer ring.
+ *
+ * @param[in/out] p_bufs The buffer ring context.
+ *
+ * @return No return value expected.
+ */
+void
+uring_bufs_destroy (uring_bufs_t * p_bufs)
+{
+    if (NULL == p_bufs)
+    {
+        goto EXIT;
+    }
+    
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = p_bufs->group;
+    (void) syscall(__NR_io_uring_register, p_bufs->p_ring->fd, IORING_UNREGISTER_PBUF_RING,
+                   &reg, 1);
+    munmap(p_bufs->p_buf_ring, p_bufs->buf_ring_size);
+    free(p_bufs->p_data);
+    free(p_bufs);
+    p_bufs = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function returns the buffer a completion selected.
+ *
+ * @param[in] p_bufs The buffer ring context.
+ * @param[in] bid The buffer id, from the completion's flags.
+ *
+ * @return Pointer to the buffer. NULL on error.
+ */
+unsigned char *
+uring_bufs_get (uring_bufs_t * p_bufs, const uint16_t bid)
+{
+    unsigned char * p_buf = NULL;
+    if ((NULL == p_bufs) ||
+        (bid >= p_bufs->count))
+    {
+        goto EXIT;
+    }
+    
+    p_buf = p_bufs->p_data + ((size_t) bid * p_bufs->buf_size);
+    
+    EXIT:
+        return p_buf;
+}
+
+/*!
+ * @brief This function gives a buffer back to the kernel.
+ *
+ * @param[in/out] p_bufs The buffer ring context.
+ * @param[in] bid The buffer id.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+uring_bufs_recycle (uring_bufs_t * p_bufs, const uint16_t bid)
+{
+    int status = -1;
+    if ((NULL == p_bufs) ||
+        (bid >= p_bufs->count))
+    {
+        goto EXIT;
+    }
+    
+    // Fill the entry, then publish it by moving the tail.
+    struct io_uring_buf * p_buf = p_bufs->p_buf_ring->bufs + (p_bufs->tail & (p_bufs->count - 1));
+    p_buf->addr = (uint64_t) (uintptr_t) (p_bufs->p_data + ((size_t) bid * p_bufs->buf_size));
+    p_buf->len = (uint32_t) p_bufs->buf_size;
+    p_buf->bid = bid;
+    p_bufs->tail++;
+    __atomic_store_n(&(p_bufs->p_buf_ring->tail), p_bufs->tail, __ATOMIC_RELEASE);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,237 @@
+/*!
+ * @file uring.h
+ *
+ * @brief This file contains a minimal io_uring wrapper.
+ *
+ *          The wrapper talks to the kernel through the raw system calls
+ *              and maps the submission and completion rings itself, so
+ *              it needs no library beyond the kernel's own header.
+ *
+ *          Submission queue entries are filled in place and only
+ *              handed to the kernel by uring_submit, so any number of
+ *              operations queued in one pass cost a single system call,
+ *              which can also wait for completions. Completions are
+ *              read straight off the shared ring.
+ *
+ *          A provided buffer ring lends the kernel a group of equally
+ *              sized buffers. A receive that selects from the group is
+ *              given a buffer only once data arrives, so idle sockets
+ *              hold no memory. Each buffer must be given back with
+ *              uring_bufs_recycle once its data has been used.
+ *
+ *          A ring may only be used by one thread at a time.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - uring_create
+ *              - uring_destroy
+ *              - uring_get_sqe
+ *              - uring_submit
+ *              - uring_peek_cqe
+ *              - uring_cqe_seen
+ *              - uring_bufs_create
+ *              - uring_bufs_destroy
+ *              - uring_bufs_get
+ *              - uring_bufs_recycle
+ */
+
+#ifndef COMMON_URING_H
+#define COMMON_URING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*!
+ * @brief This datatype defines an io_uring instance with its rings
+ *          mapped.
+ *
+ * @param fd The ring's file descriptor.
+ * @param p_sq_ring The mapped submission ring.
+ * @param sq_ring_size The size of the submission ring mapping.
+ * @param p_cq_ring The mapped completion ring. The same mapping as the
+ *          submission ring if the kernel maps both at once.
+ * @param cq_ring_size The size of the completion ring mapping.
+ * @param p_sqes The mapped submission queue entries.
+ * @param sqes_size The size of the entries mapping.
+ * @param p_sq_head The kernel's submission head.
+ * @param p_sq_tail The submission tail shared with the kernel.
+ * @param p_sq_array The submission index array.
+ * @param sq_mask The submission ring mask.
+ * @param sq_entries The number of submission entries.
+ * @param sq_tail The submission tail, including entries not yet
+ *          published.
+ * @param sq_submitted The submission tail the kernel has consumed.
+ * @param p_cq_head The completion head shared with the kernel.
+ * @param p_cq_tail The kernel's completion tail.
+ * @param p_cqes The completion queue entries.
+ * @param cq_mask The completion ring mask.
+ */
+typedef struct _uring
+{
+    int                    fd;
+    void *                 p_sq_ring;
+    size_t                 sq_ring_size;
+    void *                 p_cq_ring;
+    size_t                 cq_ring_size;
+    struct io_uring_sqe *  p_sqes;
+    size_t                 sqes_size;
+    unsigned *             p_sq_head;
+    unsigned *             p_sq_tail;
+    unsigned *             p_sq_array;
+    unsigned               sq_mask;
+    unsigned               sq_entries;
+    unsigned               sq_tail;
+    unsigned               sq_submitted;
+    unsigned *             p_cq_head;
+    unsigned *             p_cq_tail;
+    struct io_uring_cqe *  p_cqes;
+    unsigned               cq_mask;
+} uring_t;
+
+/*!
+ * @brief This datatype defines a provided buffer ring.
+ *
+ * @param p_ring The io_uring instance the buffers are registered with.
+ * @param p_buf_ring The buffer ring shared with the kernel.
+ * @param buf_ring_size The size of the buffer ring mapping.
+ * @param p_data The buffers, back to back.
+ * @param buf_size The size of each buffer.
+ * @param count The number of buffers.
+ * @param group The buffer group id.
+ * @param tail The buffer ring's tail.
+ */
+typedef struct _uring_bufs
+{
+    uring_t *                  p_ring;
+    struct io_uring_buf_ring * p_buf_ring;
+    size_t                     buf_ring_size;
+    unsigned char *            p_data;
+    size_t                     buf_size;
+    unsigned                   count;
+    uint16_t                   group;
+    uint16_t                   tail;
+} uring_bufs_t;
+
+/*!
+ * @brief This function instantiates a new io_uring instance.
+ *
+ * @param[in] entries The number of submission entries. The kernel
+ *              rounds it up to a power of two.
+ *
+ * @return Pointer to new ring context. NULL on error, with errno set,
+ *          for instance to ENOSYS if the kernel lacks io_uring.
+ */
+uring_t *
+uring_create (const unsigned entries);
+
+/*!
+ * @brief This function destroys an io_uring instance. Operations still
+ *          in flight are cancelled.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return No return value expected.
+ */
+void
+uring_destroy (uring_t * p_ring);
+
+/*!
+ * @brief This function takes the next free submission queue entry. It
+ *          is zeroed, and is handed to the kernel by uring_submit.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return Pointer to the entry. NULL on error or if the submission
+ *          queue is full, in which case uring_submit makes room.
+ */
+struct io_uring_sqe *
+uring_get_sqe (uring_t * p_ring);
+
+/*!
+ * @brief This function hands every queued entry to the kernel and
+ *          optionally waits for completions, in one system call.
+ *
+ * @param[in/out] p_ring The ring context.
+ * @param[in] wait_nr The number of completions to wait for. 0 returns
+ *              at once.
+ *
+ * @return The number of entries submitted, -1 on error with errno set.
+ */
+int
+uring_submit (uring_t * p_ring, const unsigned wait_nr);
+
+/*!
+ * @brief This function returns the oldest completion without consuming
+ *          it.
+ *
+ * @param[in] p_ring The ring context.
+ *
+ * @return Pointer to the completion. NULL on error or if there is none.
+ */
+struct io_uring_cqe *
+uring_peek_cqe (uring_t * p_ring);
+
+/*!
+ * @brief This function consumes the completion returned by
+ *          uring_peek_cqe, which must not be used afterwards.
+ *
+ * @param[in/out] p_ring The ring context.
+ *
+ * @return No return value expected.
+ */
+void
+uring_cqe_seen (uring_t * p_ring);
+
+/*!
+ * @brief This function allocates a group of buffers and registers them
+ *          as a provided buffer ring, with every buffer available.
+ *
+ * @param[in/out] p_ring The ring context.
+ * @param[in] group The buffer group id.
+ * @param[in] count The number of buffers. Must be a power of two no
+ *              larger than 32768.
+ * @param[in] buf_size The size of each buffer. Must be non-zero.
+ *
+ * @return Pointer to new buffer ring context. NULL on error, with errno
+ *          set, for instance to EINVAL if the kernel lacks buffer rings.
+ */
+uring_bufs_t *
+uring_bufs_create (uring_t * p_ring, const uint16_t group, const unsigned count,
+                   const size_t buf_size);
+
+/*!
+ * @brief This function unregisters and frees a provided buffer ring.
+ *
+ * @param[in/out] p_bufs The buffer ring context.
+ *
+ * @return No return value expected.
+ */
+void
+uring_bufs_destroy (uring_bufs_t * p_bufs);
+
+/*!
+ * @brief This function returns the buffer a completion selected.
+ *
+ * @param[in] p_bufs The buffer ring context.
+ * @param[in] bid The buffer id, from the completion's flags.
+ *
+ * @return Pointer to the buffer. NULL on error.
+ */
+unsigned char *
+uring_bufs_get (uring_bufs_t * p_bufs, const uint16_t bid);
+
+/*!
+ * @brief This function gives a buffer back to the kernel.
+ *
+ * @param[in/out] p_bufs The buffer ring context.
+ * @param[in] bid The buffer id.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+uring_bufs_recycle (uring_bufs_t * p_bufs, const uint16_t bid);
+
+#endif // COMMON_URING_H
+
+/***   end of file   ***/
@@ -0,0 +1,360 @@
+/*!
+ * @file wheel.c
+ *
+ * @brief This file contains a hierarchical timing wheel.
+ *
+ *          A timer's level is the highest group of WHEEL_SLOT_BITS bits
+ *              in which its expiry differs from the current tick, and its
+ *              slot is its expiry's bits in that group. So a timer never
+ *              lands in the slot a level is currently on, and when the
+ *              wheel reaches the start of a slot's span, placing its
+ *              timers again moves each one down at least one level.
+ */
+
+#include "wheel.h"
+
+/*!
+ * @brief The mask of a slot index.
+ */
+#define WHEEL_MASK ((uint64_t) WHEEL_SLOTS - 1)
+
+/*!
+ * @brief This is a static function that links a timer at the tail of a
+ *          slot.
+ *
+ * @param[in/out] p_head The slot's list head.
+ * @param[in/out] p_timer The timer.
+ *
+ * @return No return value expected.
+ */
+static void
+wheel_link (wheel_timer_t * p_head, wheel_timer_t * p_timer)
+{
+    p_timer->p_prev = p_head->p_prev;
+    p_timer->p_next = p_head;
+    p_head->p_prev->p_next = p_timer;
+    p_head->p_prev = p_timer;
+}
+
+/*!
+ * @brief This is a static function that unlinks a timer from its slot
+ *          and disarms it.
+ *
+ * @param[in/out] p_timer The timer.
+ *
+ * @return No return value expected.
+ */
+static void
+wheel_unlink (wheel_timer_t * p_timer)
+{
+    p_timer->p_prev->p_next = p_timer->p_next;
+    p_timer->p_next->p_prev = p_timer->p_prev;
+    p_timer->p_prev = NULL;
+    p_timer->p_next = NULL;
+}
+
+/*!
+ * @brief This is a static function that places a timer on the level and
+ *          slot its expiry calls for, relative to the current tick.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ * @param[in/out] p_timer The timer. Its expiry must not be before the
+ *              current tick.
+ *
+ * @return No return value expected.
+ */
+static void
+wheel_place (wheel_t * p_wheel, wheel_timer_t * p_timer)
+{
+    uint64_t diff = p_timer->expiry ^ p_wheel->now;
+    size_t level = 0;
+    while ((level < (WHEEL_LEVELS - 1)) &&
+           (0 != (diff >> (WHEEL_SLOT_BITS * (level + 1)))))
+    {
+        level++;
+    }
+    
+    size_t shift = WHEEL_SLOT_BITS * level;
+    size_t slot = (size_t) ((p_timer->expiry >> shift) & WHEEL_MASK);
+    
+    // A timer beyond the wheel's span waits in the top level's first
+    // slot, which is reached when the whole wheel turns over, and is
+    // placed again from there.
+    if (0 != (diff >> (WHEEL_SLOT_BITS * WHEEL_LEVELS)))
+    {
+        slot = 0;
+    }
+    
+    wheel_link(&(p_wheel->slots[level][slot]), p_timer);
+}
+
+/*!
+ * @brief This is a static function that moves the timers of every higher
+ *          level slot whose span starts at the current tick down the
+ *          wheel.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ *
+ * @return No return value expected.
+ */
+static void
+wheel_cascade (wheel_t * p_wheel)
+{
+    for (size_t level = WHEEL_LEVELS - 1; level > 0; --level)
+    {
+        size_t shift = WHEEL_SLOT_BITS * level;
+        if (0 != (p_wheel->now & ((UINT64_C(1) << shift) - 1)))
+        {
+            continue;
+        }
+        
+        wheel_timer_t * p_head = &(p_wheel->slots[level][(p_wheel->now >> shift) & WHEEL_MASK]);
+        while (p_head->p_next != p_head)
+        {
+            wheel_timer_t * p_timer = p_head->p_next;
+            wheel_unlink(p_timer);
+            wheel_place(p_wheel, p_timer);
+        }
+    }
+}
+
+/*!
+ * @brief This function instantiates a new empty timing wheel.
+ *
+ * @param[in] now The current tick.
+ *
+ * @return Pointer to new wheel context. NULL on error.
+ */
+wheel_t *
+wheel_create (const uint64_t now)
+{
+    wheel_t * p_wheel = malloc(sizeof(wheel_t));
+    if (NULL == p_wheel)
+    {
+        goto EXIT;
+    }
+    
+    p_wheel->now = now;
+    p_wheel->size = 0;
+    for (size_t level = 0; level < WHEEL_LEVELS; ++level)
+    {
+        for (size_t slot = 0; slot < WHEEL_SLOTS; ++slot)
+        {
+            wheel_timer_t * p_head = &(p_wheel->slots[level][slot]);
+            p_head->p_prev = p_head;
+            p_head->p_next = p_head;
+            p_head->expiry = 0;
+        }
+    }
+    
+    EXIT:
+        return p_wheel;
+}
+
+/*!
+ * @brief This function destroys a timing wheel context.
+ *
+ *          Timers still armed are left as they are; the caller owns them.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ *
+ * @return No return value expected.
+ */
+void
+wheel_destroy (wheel_t * p_wheel)
+{
+    if (NULL == p_wheel)
+    {
+        goto EXIT;
+    }
+    
+    free(p_wheel);
+    p_wheel = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function arms a timer.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ * @param[in/out] p_timer The timer. Must not be armed.
+ * @param[in] expiry The tick at which the timer expires. A tick that is
+ *              not after the current tick expires on the next tick.
+ *
+ * @return 0 on success, -1 on error or if the timer is already armed.
+ */
+int
+wheel_add (wheel_t * p_wheel, wheel_timer_t * p_timer, const uint64_t expiry)
+{
+    int status = -1;
+    if ((NULL == p_wheel) ||
+        (NULL == p_timer) ||
+        (NULL != p_timer->p_prev))
+    {
+        goto EXIT;
+    }
+    
+    p_timer->expiry = expiry;
+    if (expiry <= p_wheel->now)
+    {
+        p_timer->expiry = p_wheel->now + 1;
+    }
+    wheel_place(p_wheel, p_timer);
+    p_wheel->size++;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function disarms a timer before it expires.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ * @param[in/out] p_timer The timer.
+ *
+ * @return 0 on success, -1 on error or if the timer is not armed.
+ */
+int
+wheel_remove (wheel_t * p_wheel, wheel_timer_t * p_timer)
+{
+    int status = -1;
+    if ((NULL == p_wheel) ||
+        (NULL == p_timer) ||
+        (NULL == p_timer->p_prev))
+    {
+        goto EXIT;
+    }
+    
+    wheel_unlink(p_timer);
+    p_wheel->size--;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function advances the wheel to a tick and collects every
+ *          timer that expired on the way.
+ *
+ *          The expired timers are disarmed and linked through p_next in
+ *              order of expiry. Ticks with nothing to do are skipped.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ * @param[in] now The new current tick. A tick that is not after the
+ *              current tick does nothing.
+ *
+ * @return Pointer to the first expired timer. NULL on error or if no
+ *          timer expired.
+ */
+wheel_timer_t *
+wheel_advance (wheel_t * p_wheel, const uint64_t now)
+{
+    wheel_timer_t * p_first = NULL;
+    wheel_timer_t ** pp_last = &p_first;
+    if (NULL == p_wheel)
+    {
+        goto EXIT;
+    }
+    
+    while (p_wheel->now < now)
+    {
+        // Jump straight past ticks with nothing to do. No slot span
+        // starts on the way, so every timer stays where it belongs.
+        uint64_t tick = wheel_next(p_wheel);
+        if (tick > now)
+        {
+            p_wheel->now = now;
+            break;
+        }
+        p_wheel->now = tick;
+        wheel_cascade(p_wheel);
+        
+        // Collect the timers expiring on this tick.
+        wheel_timer_t * p_head = &(p_wheel->slots[0][tick & WHEEL_MASK]);
+        while (p_head->p_next != p_head)
+        {
+            wheel_timer_t * p_timer = p_head->p_next;
+            wheel_unlink(p_timer);
+            p_wheel->size--;
+            *pp_last = p_timer;
+            pp_last = &(p_timer->p_next);
+        }
+    }
+    
+    EXIT:
+        return p_first;
+}
+
+/*!
+ * @brief This function finds the next tick at which wheel_advance has
+ *          work to do: either a timer expires, or timers move down from
+ *          a higher level. No timer expires before it.
+ *
+ * @param[in] p_wheel The wheel context.
+ *
+ * @return The next tick. UINT64_MAX on error or if no timer is armed.
+ */
+uint64_t
+wheel_next (wheel_t * p_wheel)
+{
+    uint64_t tick = UINT64_MAX;
+    if ((NULL == p_wheel) ||
+        (0 == p_wheel->size))
+    {
+        goto EXIT;
+    }
+    
+    // Look for the first occupied slot ahead on the lowest level it can
+    // be found. Every slot before it, on every level, is empty.
+    for (size_t level = 0; level < WHEEL_LEVELS; ++level)
+    {
+        size_t shift = WHEEL_SLOT_BITS * level;
+        for (uint64_t idx = (p_wheel->now >> shift) + 1; 0 != (idx & WHEEL_MASK); ++idx)
+        {
+            wheel_timer_t * p_head = &(p_wheel->slots[level][idx & WHEEL_MASK]);
+            if (p_head->p_next != p_head)
+            {
+                tick = idx << shift;
+                goto EXIT;
+            }
+        }
+    }
+    
+    // Otherwise only timers beyond the wheel's span are left, and they
+    // are placed again when the whole wheel turns over.
+    tick = ((p_wheel->now >> (WHEEL_SLOT_BITS * WHEEL_LEVELS)) + 1) <<
+           (WHEEL_SLOT_BITS * WHEEL_LEVELS);
+    
+    EXIT:
+        return tick;
+}
+
+/*!
+ * @brief This function returns the number of armed timers.
+ *
+ * @param[in] p_wheel The wheel context.
+ *
+ * @return The number of armed timers. 0 on error.
+ */
+size_t
+wheel_size (wheel_t * p_wheel)
+{
+    size_t size = 0;
+    if (NULL == p_wheel)
+    {
+        goto EXIT;
+    }
+    
+    size = p_wheel->size;
+    
+    EXIT:
+        return size;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,168 @@
+/*!
+ * @file wheel.h
+ *
+ * @brief This file contains a hierarchical timing wheel.
+ *
+ *          Time is counted in ticks whose length is up to the caller.
+ *              The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots.
+ *              A timer is placed on the lowest level whose slots still
+ *              tell its expiry apart from the current tick, and moves
+ *              down a level each time the wheel reaches its slot, until
+ *              it expires from the lowest level.
+ *
+ *          Timers are intrusive: the caller embeds a wheel_timer_t in
+ *              its own structure, so adding and removing a timer are
+ *              O(1) and never allocate. The wheel is not thread-safe;
+ *              the caller must serialize access to it.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - wheel_create
+ *              - wheel_destroy
+ *              - wheel_add
+ *              - wheel_remove
+ *              - wheel_advance
+ *              - wheel_next
+ *              - wheel_size
+ */
+
+#ifndef COMMON_WHEEL_H
+#define COMMON_WHEEL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*!
+ * @brief The number of bits of the tick each level covers.
+ */
+#define WHEEL_SLOT_BITS 8
+
+/*!
+ * @brief The number of slots on each level.
+ */
+#define WHEEL_SLOTS (1u << WHEEL_SLOT_BITS)
+
+/*!
+ * @brief The number of levels. Timers further out than the wheel spans
+ *          wait on the top level and are placed again as it turns.
+ */
+#define WHEEL_LEVELS 4
+
+/*!
+ * @brief This datatype defines a timer, to be embedded in the caller's
+ *          own structure. A timer is armed while it is on the wheel.
+ *
+ * @param p_prev The previous timer in the slot. NULL if not armed.
+ * @param p_next The next timer in the slot. In the list returned by
+ *          wheel_advance, the next expired timer.
+ * @param expiry The tick at which the timer expires.
+ */
+typedef struct _wheel_timer
+{
+    struct _wheel_timer * p_prev;
+    struct _wheel_timer * p_next;
+    uint64_t              expiry;
+} wheel_timer_t;
+
+/*!
+ * @brief This datatype defines a timing wheel context.
+ *
+ * @param now The current tick.
+ * @param size The number of armed timers.
+ * @param slots The list heads of every slot on every level.
+ */
+typedef struct _wheel
+{
+    uint64_t      now;
+    size_t        size;
+    wheel_timer_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel_t;
+
+/*!
+ * @brief This function instantiates a new empty timing wheel.
+ *
+ * @param[in] now The current tick.
+ *
+ * @return Pointer to new wheel context. NULL on error.
+ */
+wheel_t *
+wheel_create (const uint64_t now);
+
+/*!
+ * @brief This function destroys a timing wheel context.
+ *
+ *          Timers still armed are left as they are; the caller owns them.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ *
+ * @return No return value expected.
+ */
+void
+wheel_destroy (wheel_t * p_wheel);
+
+/*!
+ * @brief This function arms a timer.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ * @param[in/out] p_timer The timer. Must not be armed.
+ * @param[in] expiry The tick at which the timer expires. A tick that is
+ *              not after the current tick expires on the next tick.
+ *
+ * @return 0 on success, -1 on error or if the timer is already armed.
+ */
+int
+wheel_add (wheel_t * p_wheel, wheel_timer_t * p_timer, const uint64_t expiry);
+
+/*!
+ * @brief This function disarms a timer before it expires.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ * @param[in/out] p_timer The timer.
+ *
+ * @return 0 on success, -1 on error or if the timer is not armed.
+ */
+int
+wheel_remove (wheel_t * p_wheel, wheel_timer_t * p_timer);
+
+/*!
+ * @brief This function advances the wheel to a tick and collects every
+ *          timer that expired on the way.
+ *
+ *          The expired timers are disarmed and linked through p_next in
+ *              order of expiry. Ticks with nothing to do are skipped.
+ *
+ * @param[in/out] p_wheel The wheel context.
+ * @param[in] now The new current tick. A tick that is not after the
+ *              current tick does nothing.
+ *
+ * @return Pointer to the first expired timer. NULL on error or if no
+ *          timer expired.
+ */
+wheel_timer_t *
+wheel_advance (wheel_t * p_wheel, const uint64_t now);
+
+/*!
+ * @brief This function finds the next tick at which wheel_advance has
+ *          work to do: either a timer expires, or timers move down from
+ *          a higher level. No timer expires before it.
+ *
+ * @param[in] p_wheel The wheel context.
+ *
+ * @return The next tick. UINT64_MAX on error or if no timer is armed.
+ */
+uint64_t
+wheel_next (wheel_t * p_wheel);
+
+/*!
+ * @brief This function returns the number of armed timers.
+ *
+ * @param[in] p_wheel The wheel context.
+ *
+ * @return The number of armed timers. 0 on error.
+ */
+size_t
+wheel_size (wheel_t * p_wheel);
+
+#endif // COMMON_WHEEL_H
+
+/***   end of file   ***/
@@ -0,0 +1,1293 @@
+/*!
+ * @file server/account.c
+ *
+ * @brief This file contains the store of account balances, keyed by user
+ *          id.
+ *
+ *          A stripe's table is kept at most half full and probed
+ *              linearly. Closing an account shifts the rest of its
+ *              probe run back, so the table never holds tombstones. A
+ *              stripe's table grows under the stripe's own lock, which
+ *              only stalls writers to that stripe.
+ *
+ *          Writers follow the usual sequence lock order: make the counter
+ *              odd, fence, write, then make the counter even with a
+ *              release store. Readers load the counter with acquire, read,
+ *              fence with acquire, and load the counter again. Every field
+ *              a reader touches is atomic, so a reader racing a writer
+ *              reads stale values rather than torn ones, and then retries.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "account.h"
+
+/*!
+ * @brief The number of bits of a hash taken for the stripe index.
+ */
+#define ACCOUNT_STRIPE_BITS 8
+
+_Static_assert((1u << ACCOUNT_STRIPE_BITS) == ACCOUNT_NUM_STRIPES,
+               "stripe bits match the stripe count");
+
+/*!
+ * @brief This datatype defines what a reader saw of one account.
+ *
+ * @param p_stripe The account's stripe.
+ * @param layout The stripe's sequence counter when the read began.
+ * @param p_account The account. NULL if there was none.
+ * @param seq The account's sequence counter when the read began.
+ * @param balance The balance read.
+ */
+typedef struct _account_read
+{
+    account_stripe_t * p_stripe;
+    uint32_t           layout;
+    account_t *        p_account;
+    uint32_t           seq;
+    uint64_t           balance;
+} account_read_t;
+
+/*!
+ * @brief This is a static function that hints to the processor that the
+ *          caller is spinning.
+ *
+ * @return No return value expected.
+ */
+static void
+account_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+/*!
+ * @brief This is a static function that hashes a user id. The top bits
+ *          pick the stripe and the bits below them the slot.
+ *
+ * @param[in] id The user id.
+ *
+ * @return The hash.
+ */
+static uint64_t
+account_hash (const uint32_t id)
+{
+    return (uint64_t) id * 0x9E3779B97F4A7C15ull;
+}
+
+/*!
+ * @brief This is a static function that returns an account's stripe.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] id The user id.
+ *
+ * @return Pointer to the stripe.
+ */
+static account_stripe_t *
+account_stripe (account_store_t * p_store, const uint32_t id)
+{
+    return p_store->stripes + (account_hash(id) >> (64 - ACCOUNT_STRIPE_BITS));
+}
+
+/*!
+ * @brief This is a static function that returns the slot an account's
+ *          probe starts at.
+ *
+ * @param[in] p_table The table.
+ * @param[in] id The user id.
+ *
+ * @return The slot index.
+ */
+static size_t
+account_home (const account_table_t * p_table, const uint32_t id)
+{
+    return (size_t) (account_hash(id) >> 24) & (p_table->capacity - 1);
+}
+
+/*!
+ * @brief This is a static function that allocates an empty table.
+ *
+ * @param[in] capacity The number of slots, a power of two.
+ *
+ * @return Pointer to the table. NULL on error.
+ */
+static account_table_t *
+account_table_create (const size_t capacity)
+{
+    account_table_t * p_table = calloc(1, sizeof(account_table_t) +
+                                          (capacity * sizeof(account_t)));
+    if (NULL != p_table)
+    {
+        p_table->capacity = capacity;
+    }
+    return p_table;
+}
+
+/*!
+ * @brief This is a static function that returns a stripe's table. The
+ *          caller holds the stripe's lock.
+ *
+ * @param[in] p_stripe The stripe.
+ *
+ * @return Pointer to the table.
+ */
+static account_table_t *
+account_table (account_stripe_t * p_stripe)
+{
+    return atomic_load_explicit(&(p_stripe->p_table), memory_order_relaxed);
+}
+
+/*!
+ * @brief This is a static function that returns an account's balance.
+ *
+ * @param[in] p_account The account.
+ *
+ * @return The balance.
+ */
+static uint64_t
+account_get (account_t * p_account)
+{
+    return atomic_load_explicit(&(p_account->balance), memory_order_relaxed);
+}
+
+/*!
+ * @brief This is a static function that finds an account in a table.
+ *
+ *          The caller either holds the stripe's lock, or checks the
+ *              stripe's sequence counter afterwards. A table changing
+ *              under a reader may look full, so the probe stops after
+ *              one pass.
+ *
+ * @param[in] p_table The table.
+ * @param[in] id The user id.
+ *
+ * @return Pointer to the account. NULL if there is none.
+ */
+static account_t *
+account_find (account_table_t * p_table, const uint32_t id)
+{
+    account_t * p_account = NULL;
+    size_t mask = p_table->capacity - 1;
+    size_t slot = account_home(p_table, id);
+    for (size_t probes = 0; probes < p_table->capacity; ++probes)
+    {
+        uint32_t slot_id = atomic_load_explicit(&(p_table->slots[slot].id),
+                                                memory_order_relaxed);
+        if (id == slot_id)
+        {
+            p_account = p_table->slots + slot;
+            break;
+        }
+        if (0 == slot_id)
+        {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return p_account;
+}
+
+/*!
+ * @brief This is a static function that puts an account in a slot. The
+ *          caller holds the stripe's lock, and has made the stripe's
+ *          sequence counter odd or not yet published the table.
+ *
+ * @param[out] p_slot The slot.
+ * @param[in] id The user id. 0 to empty the slot.
+ * @param[in] balance The balance.
+ *
+ * @return No return value expected.
+ */
+static void
+account_fill (account_t * p_slot, const uint32_t id, const uint64_t balance)
+{
+    atomic_store_explicit(&(p_slot->id), id, memory_order_relaxed);
+    atomic_store_explicit(&(p_slot->balance), balance, memory_order_relaxed);
+}
+
+/*!
+ * @brief This is a static function that adds an account to a table that
+ *          does not hold it and has room for it.
+ *
+ * @param[in/out] p_table The table.
+ * @param[in] id The user id.
+ * @param[in] balance The balance.
+ *
+ * @return No return value expected.
+ */
+static void
+account_insert (account_table_t * p_table, const uint32_t id, const uint64_t balance)
+{
+    size_t mask = p_table->capacity - 1;
+    size_t slot = account_home(p_table, id);
+    while (0 != atomic_load_explicit(&(p_table->slots[slot].id), memory_order_relaxed))
+    {
+        slot = (slot + 1) & mask;
+    }
+    account_fill(p_table->slots + slot, id, balance);
+}
+
+/*!
+ * @brief This is a static function that makes a sequence counter odd
+ *          before its data changes. The caller holds the stripe's lock.
+ *
+ * @param[in/out] p_seq The sequence counter.
+ *
+ * @return No return value expected.
+ */
+static void
+account_write_begin (_Atomic uint32_t * p_seq)
+{
+    uint32_t seq = atomic_load_explicit(p_seq, memory_order_relaxed);
+    atomic_store_explicit(p_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/*!
+ * @brief This is a static function that makes a sequence counter even
+ *          again, publishing the change to its data.
+ *
+ * @param[in/out] p_seq The sequence counter.
+ *
+ * @return No return value expected.
+ */
+static void
+account_write_end (_Atomic uint32_t * p_seq)
+{
+    uint32_t seq = atomic_load_explicit(p_seq, memory_order_relaxed);
+    atomic_store_explicit(p_seq, seq + 1, memory_order_release);
+}
+
+/*!
+ * @brief This is a static function that sets an account's balance. The
+ *          caller holds the stripe's lock.
+ *
+ * @param[in/out] p_account The account.
+ * @param[in] balance The new balance.
+ *
+ * @return No return value expected.
+ */
+static void
+account_set (account_t * p_account, const uint64_t balance)
+{
+    account_write_begin(&(p_account->seq));
+    atomic_store_explicit(&(p_account->balance), balance, memory_order_relaxed);
+    account_write_end(&(p_account->seq));
+}
+
+/*!
+ * @brief This is a static function that doubles a stripe's table. The
+ *          caller holds the stripe's lock and has made its sequence
+ *          counter odd.
+ *
+ * @param[in/out] p_stripe The stripe.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+account_grow (account_stripe_t * p_stripe)
+{
+    int status = -1;
+    account_table_t * p_old = account_table(p_stripe);
+    account_table_t * p_new = account_table_create(p_old->capacity * 2);
+    if (NULL == p_new)
+    {
+        goto EXIT;
+    }
+    
+    for (size_t slot = 0; slot < p_old->capacity; ++slot)
+    {
+        uint32_t id = atomic_load_explicit(&(p_old->slots[slot].id), memory_order_relaxed);
+        if (0 != id)
+        {
+            account_insert(p_new, id, account_get(p_old->slots + slot));
+        }
+    }
+    atomic_store_explicit(&(p_stripe->p_table), p_new, memory_order_release);
+    
+    // Readers may still be probing the old table.
+    p_old->p_next = p_stripe->p_retired;
+    p_stripe->p_retired = p_old;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that removes an account from its
+ *          table, moving back any account of the same probe run that
+ *          could otherwise no longer be found. The caller holds the
+ *          stripe's lock and has made its sequence counter odd.
+ *
+ * @param[in/out] p_table The table.
+ * @param[in] p_account The account.
+ *
+ * @return No return value expected.
+ */
+static void
+account_remove (account_table_t * p_table, account_t * p_account)
+{
+    size_t mask = p_table->capacity - 1;
+    size_t hole = (size_t) (p_account - p_table->slots);
+    for (size_t slot = (hole + 1) & mask; ; slot = (slot + 1) & mask)
+    {
+        uint32_t id = atomic_load_explicit(&(p_table->slots[slot].id), memory_order_relaxed);
+        if (0 == id)
+        {
+            break;
+        }
+        
+        // An account may fill the hole if the hole lies on its probe
+        // path, from its home slot up to where it sits now.
+        size_t home = account_home(p_table, id);
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            account_fill(p_table->slots + hole, id, account_get(p_table->slots + slot));
+            hole = slot;
+        }
+    }
+    account_fill(p_table->slots + hole, 0, 0);
+}
+
+/*!
+ * @brief This is a static function that reads an account without taking
+ *          a lock. The read stands only if account_read_check later
+ *          finds no write overlapped it.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] id The user id.
+ * @param[out] p_read What was read.
+ *
+ * @return True if no write was under way, false if the read must be
+ *          tried again.
+ */
+static bool
+account_read_start (account_store_t * p_store, const uint32_t id, account_read_t * p_read)
+{
+    bool b_ok = false;
+    p_read->p_stripe = account_stripe(p_store, id);
+    p_read->layout = atomic_load_explicit(&(p_read->p_stripe->layout), memory_order_acquire);
+    if (0 != (p_read->layout & 1))
+    {
+        goto EXIT;
+    }
+    
+    account_table_t * p_table = atomic_load_explicit(&(p_read->p_stripe->p_table),
+                                                     memory_order_acquire);
+    p_read->p_account = account_find(p_table, id);
+    if (NULL != p_read->p_account)
+    {
+        p_read->seq = atomic_load_explicit(&(p_read->p_account->seq), memory_order_acquire);
+        if (0 != (p_read->seq & 1))
+        {
+            goto EXIT;
+        }
+        p_read->balance = account_get(p_read->p_account);
+    }
+    b_ok = true;
+    
+    EXIT:
+        return b_ok;
+}
+
+/*!
+ * @brief This is a static function that checks no write overlapped a
+ *          read. The caller fences with acquire between the read and the
+ *          check.
+ *
+ * @param[in] p_read What was read.
+ *
+ * @return True if the read stands.
+ */
+static bool
+account_read_check (const account_read_t * p_read)
+{
+    bool b_ok = (p_read->layout == atomic_load_explicit(&(p_read->p_stripe->layout),
+                                                         memory_order_relaxed));
+    if ((true == b_ok) &&
+        (NULL != p_read->p_account))
+    {
+        b_ok = (p_read->seq == atomic_load_explicit(&(p_read->p_account->seq),
+                                                    memory_order_relaxed));
+    }
+    return b_ok;
+}
+
+/*!
+ * @brief This is a static function that adds up every balance in a table,
+ *          and every sequence counter. Counters only move forward, so a
+ *          second pass with the same sum of counters saw the same
+ *          balances. Empty slots hold a zero balance.
+ *
+ * @param[in] p_table The table.
+ * @param[in/out] p_total The running sum of balances. Saturates at
+ *                  UINT64_MAX.
+ * @param[in/out] p_seqs The running sum of sequence counters.
+ *
+ * @return False if a balance was being written, true otherwise.
+ */
+static bool
+account_table_sum (account_table_t * p_table, uint64_t * p_total, uint64_t * p_seqs)
+{
+    bool b_ok = true;
+    for (size_t slot = 0; slot < p_table->capacity; ++slot)
+    {
+        uint32_t seq = atomic_load_explicit(&(p_table->slots[slot].seq), memory_order_acquire);
+        uint64_t balance = account_get(p_table->slots + slot);
+        b_ok = b_ok && (0 == (seq & 1));
+        *p_seqs += seq;
+        *p_total = (balance > (UINT64_MAX - *p_total)) ? UINT64_MAX : (*p_total + balance);
+    }
+    return b_ok;
+}
+
+/*!
+ * @brief This is a static function that locks a set of stripes in
+ *          ascending order.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] p_set A bit per stripe, set for the stripes to lock.
+ *
+ * @return No return value expected.
+ */
+static void
+account_lock_set (account_store_t * p_store, const uint64_t * p_set)
+{
+    for (size_t idx = 0; idx < ACCOUNT_NUM_STRIPES; ++idx)
+    {
+        if (0 != (p_set[idx / 64] & (1ull << (idx % 64))))
+        {
+            pthread_mutex_lock(&(p_store->stripes[idx].lock));
+        }
+    }
+}
+
+/*!
+ * @brief This is a static function that unlocks a set of stripes in
+ *          descending order.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] p_set A bit per stripe, set for the stripes to unlock.
+ *
+ * @return No return value expected.
+ */
+static void
+account_unlock_set (account_store_t * p_store, const uint64_t * p_set)
+{
+    for (size_t idx = ACCOUNT_NUM_STRIPES; idx > 0; --idx)
+    {
+        if (0 != (p_set[(idx - 1) / 64] & (1ull << ((idx - 1) % 64))))
+        {
+            pthread_mutex_unlock(&(p_store->stripes[idx - 1].lock));
+        }
+    }
+}
+
+/*!
+ * @brief This is a static function that hands a change's new balances to
+ *          the store's log function, if it has one. The caller holds the
+ *          accounts' stripes.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] p_balances The new balances.
+ * @param[in] count The number of accounts.
+ *
+ * @return 0 if the change may go on, -1 if the log function failed.
+ */
+static int
+account_log (account_store_t * p_store, const uint32_t * p_ids, const uint64_t * p_balances,
+             const size_t count)
+{
+    int status = 0;
+    if ((NULL != p_store->log_func) &&
+        (0 != p_store->log_func(p_ids, p_balances, count, p_store->p_log_ctx)))
+    {
+        status = -1;
+    }
+    return status;
+}
+
+/*!
+ * @brief This function instantiates a new, empty account store.
+ *
+ * @return Pointer to new account store. NULL on error.
+ */
+account_store_t *
+account_store_create (void)
+{
+    int status = -1;
+    size_t num_init = 0;
+    account_store_t * p_store = aligned_alloc(ACCOUNT_CACHE_LINE, sizeof(account_store_t));
+    if (NULL == p_store)
+    {
+        goto EXIT;
+    }
+    memset(p_store, 0, sizeof(account_store_t));
+    
+    for (; num_init < ACCOUNT_NUM_STRIPES; ++num_init)
+    {
+        account_stripe_t * p_stripe = p_store->stripes + num_init;
+        account_table_t * p_table = account_table_create(ACCOUNT_MIN_SLOTS);
+        if (NULL == p_table)
+        {
+            goto EXIT;
+        }
+        if (0 != pthread_mutex_init(&(p_stripe->lock), NULL))
+        {
+            free(p_table);
+            p_table = NULL;
+            goto EXIT;
+        }
+        atomic_init(&(p_stripe->layout), 0);
+        atomic_init(&(p_stripe->p_table), p_table);
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_store))
+        {
+            for (size_t idx = 0; idx < num_init; ++idx)
+            {
+                pthread_mutex_destroy(&(p_store->stripes[idx].lock));
+                free(account_table(p_store->stripes + idx));
+            }
+            free(p_store);
+            p_store = NULL;
+        }
+        return p_store;
+}
+
+/*!
+ * @brief This function destroys an account store. No other thread may be
+ *          using it.
+ *
+ * @param[in/out] p_store The account store.
+ *
+ * @return No return value expected.
+ */
+void
+account_store_destroy (account_store_t * p_store)
+{
+    if (NULL == p_store)
+    {
+        goto EXIT;
+    }
+    
+    for (size_t idx = 0; idx < ACCOUNT_NUM_STRIPES; ++idx)
+    {
+        account_stripe_t * p_stripe = p_store->stripes + idx;
+        pthread_mutex_destroy(&(p_stripe->lock));
+        free(account_table(p_stripe));
+        while (NULL != p_stripe->p_retired)
+        {
+            account_table_t * p_next = p_stripe->p_retired->p_next;
+            free(p_stripe->p_retired);
+            p_stripe->p_retired = p_next;
+        }
+    }
+    free(p_store);
+    p_store = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function sets the function every deposit, withdrawal and
+ *          transfer hands its new balances to before making them. A
+ *          change it fails is not made. Opening, closing and restoring
+ *          accounts are not handed to it. No other thread may be using
+ *          the store.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] log_func The function. NULL to stop handing changes on.
+ * @param[in/out] p_ctx The context passed to log_func.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+account_store_set_log (account_store_t * p_store, account_log_f log_func, void * p_ctx)
+{
+    int status = -1;
+    if (NULL == p_store)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    p_store->log_func = log_func;
+    p_store->p_log_ctx = p_ctx;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function opens an account with a zero balance.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id. Must be non-zero.
+ *
+ * @return 0 on success, -1 on error. errno is set to EEXIST if the
+ *          account is already open.
+ */
+int
+account_open (account_store_t * p_store, const uint32_t id)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (0 == id))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    account_stripe_t * p_stripe = account_stripe(p_store, id);
+    pthread_mutex_lock(&(p_stripe->lock));
+    if (NULL != account_find(account_table(p_stripe), id))
+    {
+        errno = EEXIST;
+        goto UNLOCK;
+    }
+    account_write_begin(&(p_stripe->layout));
+    if (((p_stripe->count + 1) * 2 > account_table(p_stripe)->capacity) &&
+        (-1 == account_grow(p_stripe)))
+    {
+        errno = ENOMEM;
+        account_write_end(&(p_stripe->layout));
+        goto UNLOCK;
+    }
+    account_insert(account_table(p_stripe), id, 0);
+    account_write_end(&(p_stripe->layout));
+    p_stripe->count++;
+    status = 0;
+    
+    UNLOCK:
+        pthread_mutex_unlock(&(p_stripe->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function closes an account.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[out] p_balance The balance the account held. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account.
+ */
+int
+account_close (account_store_t * p_store, const uint32_t id, uint64_t * p_balance)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (0 == id))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    account_stripe_t * p_stripe = account_stripe(p_store, id);
+    pthread_mutex_lock(&(p_stripe->lock));
+    account_t * p_account = account_find(account_table(p_stripe), id);
+    if (NULL == p_account)
+    {
+        errno = ENOENT;
+        goto UNLOCK;
+    }
+    if (NULL != p_balance)
+    {
+        *p_balance = account_get(p_account);
+    }
+    account_write_begin(&(p_stripe->layout));
+    account_remove(account_table(p_stripe), p_account);
+    account_write_end(&(p_stripe->layout));
+    p_stripe->count--;
+    status = 0;
+    
+    UNLOCK:
+        pthread_mutex_unlock(&(p_stripe->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function reads an account's balance without taking a lock.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[out] p_balance The balance.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account.
+ */
+int
+account_balance (account_store_t * p_store, const uint32_t id, uint64_t * p_balance)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (0 == id) ||
+        (NULL == p_balance))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // A writer holds its counter odd only for a few stores, so spin, and
+    // yield in case it was preempted mid-write.
+    account_read_t read = {0};
+    for (size_t tries = 0; ; ++tries)
+    {
+        if (true == account_read_start(p_store, id, &read))
+        {
+            atomic_thread_fence(memory_order_acquire);
+            if (true == account_read_check(&read))
+            {
+                break;
+            }
+        }
+        if (tries < ACCOUNT_READ_RETRIES)
+        {
+            account_relax();
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+    if (NULL == read.p_account)
+    {
+        errno = ENOENT;
+        goto EXIT;
+    }
+    *p_balance = read.balance;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function reads several accounts' balances as of a single
+ *          moment, so no transfer between them is seen half done.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] num_ids The number of ids, from 1 to ACCOUNT_MAX_READ.
+ * @param[out] p_balances The balances, one per id.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if any of the
+ *          accounts does not exist.
+ */
+int
+account_balances (account_store_t * p_store, const uint32_t * p_ids, const size_t num_ids,
+                  uint64_t * p_balances)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (NULL == p_ids) ||
+        (NULL == p_balances) ||
+        (0 == num_ids) ||
+        (num_ids > ACCOUNT_MAX_READ))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    for (size_t idx = 0; idx < num_ids; ++idx)
+    {
+        if (0 == p_ids[idx])
+        {
+            errno = EINVAL;
+            goto EXIT;
+        }
+    }
+    
+    // Try without locks first. Every account is read before any of their
+    // counters is checked, so the reads stand together or not at all.
+    account_read_t reads[ACCOUNT_MAX_READ] = {0};
+    bool b_ok = false;
+    for (size_t tries = 0; (false == b_ok) && (tries < ACCOUNT_READ_RETRIES); ++tries)
+    {
+        b_ok = true;
+        for (size_t idx = 0; (true == b_ok) && (idx < num_ids); ++idx)
+        {
+            b_ok = account_read_start(p_store, p_ids[idx], reads + idx);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        for (size_t idx = 0; (true == b_ok) && (idx < num_ids); ++idx)
+        {
+            b_ok = account_read_check(reads + idx);
+        }
+        if (false == b_ok)
+        {
+            account_relax();
+        }
+    }
+    
+    // Writes keep overlapping, so hold them off instead.
+    if (false == b_ok)
+    {
+        uint64_t set[ACCOUNT_NUM_STRIPES / 64] = {0};
+        for (size_t idx = 0; idx < num_ids; ++idx)
+        {
+            size_t stripe = (size_t) (account_stripe(p_store, p_ids[idx]) - p_store->stripes);
+            set[stripe / 64] |= 1ull << (stripe % 64);
+        }
+        account_lock_set(p_store, set);
+        for (size_t idx = 0; idx < num_ids; ++idx)
+        {
+            account_stripe_t * p_stripe = account_stripe(p_store, p_ids[idx]);
+            reads[idx].p_account = account_find(account_table(p_stripe), p_ids[idx]);
+            if (NULL != reads[idx].p_account)
+            {
+                reads[idx].balance = account_get(reads[idx].p_account);
+            }
+        }
+        account_unlock_set(p_store, set);
+    }
+    
+    for (size_t idx = 0; idx < num_ids; ++idx)
+    {
+        if (NULL == reads[idx].p_account)
+        {
+            errno = ENOENT;
+            goto EXIT;
+        }
+        p_balances[idx] = reads[idx].balance;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function adds to an account's balance.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[in] amount The amount.
+ * @param[out] p_balance The new balance. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account, and to EOVERFLOW if the balance would
+ *          overflow. If the log function fails, errno is left as it set
+ *          it.
+ */
+int
+account_deposit (account_store_t * p_store, const uint32_t id, const uint64_t amount,
+                 uint64_t * p_balance)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (0 == id))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    account_stripe_t * p_stripe = account_stripe(p_store, id);
+    pthread_mutex_lock(&(p_stripe->lock));
+    account_t * p_account = account_find(account_table(p_stripe), id);
+    if (NULL == p_account)
+    {
+        errno = ENOENT;
+        goto UNLOCK;
+    }
+    uint64_t balance = account_get(p_account);
+    if (amount > (UINT64_MAX - balance))
+    {
+        errno = EOVERFLOW;
+        goto UNLOCK;
+    }
+    balance += amount;
+    if (-1 == account_log(p_store, &id, &balance, 1))
+    {
+        goto UNLOCK;
+    }
+    account_set(p_account, balance);
+    if (NULL != p_balance)
+    {
+        *p_balance = balance;
+    }
+    status = 0;
+    
+    UNLOCK:
+        pthread_mutex_unlock(&(p_stripe->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function takes from an account's balance.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[in] amount The amount.
+ * @param[out] p_balance The new balance. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account, and to ERANGE if the balance is too low. If
+ *          the log function fails, errno is left as it set it.
+ */
+int
+account_withdraw (account_store_t * p_store, const uint32_t id, const uint64_t amount,
+                  uint64_t * p_balance)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (0 == id))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    account_stripe_t * p_stripe = account_stripe(p_store, id);
+    pthread_mutex_lock(&(p_stripe->lock));
+    account_t * p_account = account_find(account_table(p_stripe), id);
+    if (NULL == p_account)
+    {
+        errno = ENOENT;
+        goto UNLOCK;
+    }
+    uint64_t balance = account_get(p_account);
+    if (amount > balance)
+    {
+        errno = ERANGE;
+        goto UNLOCK;
+    }
+    balance -= amount;
+    if (-1 == account_log(p_store, &id, &balance, 1))
+    {
+        goto UNLOCK;
+    }
+    account_set(p_account, balance);
+    if (NULL != p_balance)
+    {
+        *p_balance = balance;
+    }
+    status = 0;
+    
+    UNLOCK:
+        pthread_mutex_unlock(&(p_stripe->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function moves an amount from one account to another, as
+ *          one step: no other caller sees one side done without the
+ *          other.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] from The payer's user id.
+ * @param[in] to The payee's user id. Must differ from the payer's.
+ * @param[in] amount The amount.
+ * @param[out] p_balance The payer's new balance. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if either
+ *          account does not exist, to ERANGE if the payer's balance is
+ *          too low, and to EOVERFLOW if the payee's would overflow. If
+ *          the log function fails, errno is left as it set it.
+ */
+int
+account_transfer (account_store_t * p_store, const uint32_t from, const uint32_t to,
+                  const uint64_t amount, uint64_t * p_balance)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (0 == from) ||
+        (0 == to) ||
+        (from == to))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // Lock the lower stripe first, and a shared stripe only once.
+    account_stripe_t * p_from = account_stripe(p_store, from);
+    account_stripe_t * p_to = account_stripe(p_store, to);
+    account_stripe_t * p_first = (p_from < p_to) ? p_from : p_to;
+    account_stripe_t * p_second = (p_from < p_to) ? p_to : p_from;
+    pthread_mutex_lock(&(p_first->lock));
+    if (p_second != p_first)
+    {
+        pthread_mutex_lock(&(p_second->lock));
+    }
+    
+    account_t * p_payer = account_find(account_table(p_from), from);
+    account_t * p_payee = account_find(account_table(p_to), to);
+    if ((NULL == p_payer) ||
+        (NULL == p_payee))
+    {
+        errno = ENOENT;
+        goto UNLOCK;
+    }
+    uint64_t payer_balance = account_get(p_payer);
+    uint64_t payee_balance = account_get(p_payee);
+    if (amount > payer_balance)
+    {
+        errno = ERANGE;
+        goto UNLOCK;
+    }
+    if (amount > (UINT64_MAX - payee_balance))
+    {
+        errno = EOVERFLOW;
+        goto UNLOCK;
+    }
+    uint32_t ids[2] = {from, to};
+    uint64_t balances[2] = {payer_balance - amount, payee_balance + amount};
+    if (-1 == account_log(p_store, ids, balances, 2))
+    {
+        goto UNLOCK;
+    }
+    
+    // Both counters stay odd while either balance changes, so a reader of
+    // both never sees the money in neither account or in both.
+    account_write_begin(&(p_payer->seq));
+    account_write_begin(&(p_payee->seq));
+    atomic_store_explicit(&(p_payer->balance), balances[0], memory_order_relaxed);
+    atomic_store_explicit(&(p_payee->balance), balances[1], memory_order_relaxed);
+    account_write_end(&(p_payee->seq));
+    account_write_end(&(p_payer->seq));
+    if (NULL != p_balance)
+    {
+        *p_balance = balances[0];
+    }
+    status = 0;
+    
+    UNLOCK:
+        if (p_second != p_first)
+        {
+            pthread_mutex_unlock(&(p_second->lock));
+        }
+        pthread_mutex_unlock(&(p_first->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function adds up every balance as of a single moment, so
+ *          the sum is exact even while transfers run.
+ *
+ * @param[in] p_store The account store.
+ * @param[out] p_total The sum. Saturates at UINT64_MAX.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+account_total (account_store_t * p_store, uint64_t * p_total)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (NULL == p_total))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // Try without locks first: sum every table, then sum the counters
+    // again and check no stripe's table changed in between.
+    uint32_t layouts[ACCOUNT_NUM_STRIPES] = {0};
+    account_table_t * p_tables[ACCOUNT_NUM_STRIPES] = {0};
+    uint64_t total = 0;
+    bool b_ok = false;
+    for (size_t tries = 0; (false == b_ok) && (tries < ACCOUNT_READ_RETRIES); ++tries)
+    {
+        uint64_t seqs = 0;
+        total = 0;
+        b_ok = true;
+        for (size_t idx = 0; (true == b_ok) && (idx < ACCOUNT_NUM_STRIPES); ++idx)
+        {
+            account_stripe_t * p_stripe = p_store->stripes + idx;
+            layouts[idx] = atomic_load_explicit(&(p_stripe->layout), memory_order_acquire);
+            p_tables[idx] = atomic_load_explicit(&(p_stripe->p_table), memory_order_acquire);
+            b_ok = (0 == (layouts[idx] & 1)) &&
+                   (true == account_table_sum(p_tables[idx], &total, &seqs));
+        }
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t check_total = 0;
+        uint64_t check_seqs = 0;
+        for (size_t idx = 0; (true == b_ok) && (idx < ACCOUNT_NUM_STRIPES); ++idx)
+        {
+            (void) account_table_sum(p_tables[idx], &check_total, &check_seqs);
+        }
+        for (size_t idx = 0; (true == b_ok) && (idx < ACCOUNT_NUM_STRIPES); ++idx)
+        {
+            b_ok = (layouts[idx] == atomic_load_explicit(&(p_store->stripes[idx].layout),
+                                                         memory_order_relaxed));
+        }
+        b_ok = b_ok && (seqs == check_seqs) && (total == check_total);
+        if (false == b_ok)
+        {
+            account_relax();
+        }
+    }
+    
+    // Writes keep overlapping, so hold them off instead.
+    if (false == b_ok)
+    {
+        uint64_t set[ACCOUNT_NUM_STRIPES / 64] = {0};
+        memset(set, 0xFF, sizeof(set));
+        account_lock_set(p_store, set);
+        uint64_t seqs = 0;
+        total = 0;
+        for (size_t idx = 0; idx < ACCOUNT_NUM_STRIPES; ++idx)
+        {
+            (void) account_table_sum(account_table(p_store->stripes + idx), &total, &seqs);
+        }
+        account_unlock_set(p_store, set);
+    }
+    *p_total = total;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function returns the number of open accounts.
+ *
+ *          While other threads are using the store this is only an
+ *              estimate.
+ *
+ * @param[in] p_store The account store.
+ *
+ * @return The number of accounts. 0 on error.
+ */
+size_t
+account_count (account_store_t * p_store)
+{
+    size_t count = 0;
+    if (NULL == p_store)
+    {
+        goto EXIT;
+    }
+    
+    for (size_t idx = 0; idx < ACCOUNT_NUM_STRIPES; ++idx)
+    {
+        account_stripe_t * p_stripe = p_store->stripes + idx;
+        pthread_mutex_lock(&(p_stripe->lock));
+        count += p_stripe->count;
+        pthread_mutex_unlock(&(p_stripe->lock));
+    }
+    
+    EXIT:
+        return count;
+}
+
+/*!
+ * @brief This function hands every open account to a function. It holds
+ *          one stripe's lock at a time, so it only stalls writers to the
+ *          stripe it is visiting, and the accounts are not seen as of a
+ *          single moment.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] visit_func The function.
+ * @param[in/out] p_ctx The context passed to visit_func.
+ *
+ * @return 0 on success, -1 on error or if visit_func failed.
+ */
+int
+account_foreach (account_store_t * p_store, account_visit_f visit_func, void * p_ctx)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (NULL == visit_func))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    for (size_t idx = 0; idx < ACCOUNT_NUM_STRIPES; ++idx)
+    {
+        account_stripe_t * p_stripe = p_store->stripes + idx;
+        pthread_mutex_lock(&(p_stripe->lock));
+        account_table_t * p_table = account_table(p_stripe);
+        int visited = 0;
+        for (size_t slot = 0; (0 == visited) && (slot < p_table->capacity); ++slot)
+        {
+            uint32_t id = atomic_load_explicit(&(p_table->slots[slot].id),
+                                               memory_order_relaxed);
+            if (0 != id)
+            {
+                visited = visit_func(id, account_get(p_table->slots + slot), p_ctx);
+            }
+        }
+        pthread_mutex_unlock(&(p_stripe->lock));
+        if (0 != visited)
+        {
+            goto EXIT;
+        }
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function sets an account's balance, opening the account
+ *          if needed, as when rebuilding the store from a snapshot or the
+ *          log.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id. Must be non-zero.
+ * @param[in] balance The balance.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+account_restore (account_store_t * p_store, const uint32_t id, const uint64_t balance)
+{
+    int status = -1;
+    if ((NULL == p_store) ||
+        (0 == id))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    account_stripe_t * p_stripe = account_stripe(p_store, id);
+    pthread_mutex_lock(&(p_stripe->lock));
+    account_t * p_account = account_find(account_table(p_stripe), id);
+    if (NULL != p_account)
+    {
+        account_set(p_account, balance);
+        status = 0;
+        goto UNLOCK;
+    }
+    account_write_begin(&(p_stripe->layout));
+    if (((p_stripe->count + 1) * 2 > account_table(p_stripe)->capacity) &&
+        (-1 == account_grow(p_stripe)))
+    {
+        errno = ENOMEM;
+        account_write_end(&(p_stripe->layout));
+        goto UNLOCK;
+    }
+    account_insert(account_table(p_stripe), id, balance);
+    account_write_end(&(p_stripe->layout));
+    p_stripe->count++;
+    status = 0;
+    
+    UNLOCK:
+        pthread_mutex_unlock(&(p_stripe->lock));
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
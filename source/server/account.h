@@ -0,0 +1,384 @@
+/*!
+ * @file server/account.h
+ *
+ * @brief This file contains the store of account balances, keyed by user
+ *          id.
+ *
+ *          The accounts are spread over a fixed array of stripes by a
+ *              hash of their id. Each stripe has a lock of its own, on a
+ *              cache line of its own, and a small open-addressing table
+ *              of the accounts that hash to it. Operations on accounts
+ *              in different stripes never contend, so workers only wait
+ *              for each other when they touch the same stripe.
+ *
+ *          A transfer locks both accounts' stripes, lower index first,
+ *              or the one stripe when both accounts hash to it. Every
+ *              caller that holds more than one stripe takes them in that
+ *              order, so no two callers can each hold a stripe the other
+ *              waits for.
+ *
+ *          A store can be given a function that every deposit, withdrawal
+ *              and transfer hands its new balances to, with the stripes
+ *              still locked and before the balances change. Changes to an
+ *              account reach it in the order they are made, which is what
+ *              a log of them needs (see journal.h).
+ *
+ *          Reads take no lock. Every account carries a sequence counter
+ *              that a writer makes odd before changing the balance and
+ *              even again after, and every stripe carries one for changes
+ *              to its table. A reader notes the counters, reads, and
+ *              checks the counters did not move, retrying only when a
+ *              write overlapped. Reads of several accounts check all of
+ *              their counters at once, and fall back to the stripe locks
+ *              if writes keep overlapping.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - account_store_create
+ *              - account_store_destroy
+ *              - account_store_set_log
+ *              - account_open
+ *              - account_close
+ *              - account_balance
+ *              - account_balances
+ *              - account_deposit
+ *              - account_withdraw
+ *              - account_transfer
+ *              - account_total
+ *              - account_count
+ *              - account_foreach
+ *              - account_restore
+ */
+
+#ifndef SERVER_ACCOUNT_H
+#define SERVER_ACCOUNT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*!
+ * @brief The assumed cache line size. Each stripe has a line of its own,
+ *          so threads locking different stripes do not share one.
+ */
+#define ACCOUNT_CACHE_LINE 64
+
+/*!
+ * @brief The number of stripes. A power of two.
+ */
+#define ACCOUNT_NUM_STRIPES 256
+
+/*!
+ * @brief The number of slots a stripe's table starts with. A power of
+ *          two.
+ */
+#define ACCOUNT_MIN_SLOTS 8
+
+/*!
+ * @brief The number of times a read of several accounts is tried without
+ *          locks before it takes their stripes' locks instead. A read of
+ *          one account yields after this many tries, but never locks.
+ */
+#define ACCOUNT_READ_RETRIES 16
+
+/*!
+ * @brief The most accounts account_balances reads at once.
+ */
+#define ACCOUNT_MAX_READ 16
+
+/*!
+ * @brief This datatype defines an account.
+ *
+ * @param id The owner's user id. 0 if the slot is empty.
+ * @param seq The sequence counter. Odd while the balance is changing.
+ * @param balance The balance. 0 if the slot is empty.
+ */
+typedef struct _account
+{
+    _Atomic uint32_t id;
+    _Atomic uint32_t seq;
+    _Atomic uint64_t balance;
+} account_t;
+
+/*!
+ * @brief This datatype defines a stripe's table.
+ *
+ * @param p_next The next older table, while the table is retired.
+ * @param capacity The number of slots, a power of two.
+ * @param slots The slots, probed linearly.
+ */
+typedef struct _account_table
+{
+    struct _account_table * p_next;
+    size_t                  capacity;
+    account_t               slots[];
+} account_table_t;
+
+/*!
+ * @brief This datatype defines a stripe.
+ *
+ *          A table the stripe outgrows is retired rather than freed, as
+ *              a reader may still be probing it. Tables double as they
+ *              grow, so the retired ones never take more memory than the
+ *              live one.
+ *
+ * @param lock Taken by writers.
+ * @param p_retired The tables the stripe has outgrown, newest first.
+ * @param count The number of accounts.
+ * @param layout The sequence counter of the table. Odd while accounts are
+ *          being added, removed or moved. On a line of its own, so
+ *          readers are not slowed by writers taking the lock.
+ * @param p_table The table.
+ */
+typedef struct _account_stripe
+{
+    _Alignas(ACCOUNT_CACHE_LINE) pthread_mutex_t lock;
+    account_table_t *          p_retired;
+    size_t                     count;
+    _Alignas(ACCOUNT_CACHE_LINE) _Atomic uint32_t layout;
+    _Atomic(account_table_t *) p_table;
+} account_stripe_t;
+
+/*!
+ * @brief This datatype defines the function a store hands the new
+ *          balances of a change to, before making it. It is called with
+ *          the accounts' stripes locked, so it must not call back into
+ *          the store.
+ *
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] p_balances The new balances, one per id.
+ * @param[in] count The number of accounts, 1, or 2 for a transfer.
+ * @param[in/out] p_ctx The context passed to account_store_set_log.
+ *
+ * @return 0 to go on with the change, -1 to fail it.
+ */
+typedef int (* account_log_f) (const uint32_t * p_ids, const uint64_t * p_balances,
+                               const size_t count, void * p_ctx);
+
+/*!
+ * @brief This datatype defines an account store.
+ *
+ * @param stripes The stripes.
+ * @param log_func The function changes are handed to. NULL if there is
+ *          none.
+ * @param p_log_ctx The context passed to log_func.
+ */
+typedef struct _account_store
+{
+    account_stripe_t stripes[ACCOUNT_NUM_STRIPES];
+    account_log_f    log_func;
+    void *           p_log_ctx;
+} account_store_t;
+
+/*!
+ * @brief This datatype defines the function account_foreach hands each
+ *          account to. It is called with the account's stripe locked, so
+ *          it must not call back into the store.
+ *
+ * @param[in] id The owner's user id.
+ * @param[in] balance The balance.
+ * @param[in/out] p_ctx The context passed to account_foreach.
+ *
+ * @return 0 to go on, -1 to stop with an error.
+ */
+typedef int (* account_visit_f) (const uint32_t id, const uint64_t balance, void * p_ctx);
+
+/*!
+ * @brief This function instantiates a new, empty account store.
+ *
+ * @return Pointer to new account store. NULL on error.
+ */
+account_store_t *
+account_store_create (void);
+
+/*!
+ * @brief This function destroys an account store. No other thread may be
+ *          using it.
+ *
+ * @param[in/out] p_store The account store.
+ *
+ * @return No return value expected.
+ */
+void
+account_store_destroy (account_store_t * p_store);
+
+/*!
+ * @brief This function sets the function every deposit, withdrawal and
+ *          transfer hands its new balances to before making them. A
+ *          change it fails is not made. Opening, closing and restoring
+ *          accounts are not handed to it. No other thread may be using
+ *          the store.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] log_func The function. NULL to stop handing changes on.
+ * @param[in/out] p_ctx The context passed to log_func.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+account_store_set_log (account_store_t * p_store, account_log_f log_func, void * p_ctx);
+
+/*!
+ * @brief This function opens an account with a zero balance.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id. Must be non-zero.
+ *
+ * @return 0 on success, -1 on error. errno is set to EEXIST if the
+ *          account is already open.
+ */
+int
+account_open (account_store_t * p_store, const uint32_t id);
+
+/*!
+ * @brief This function closes an account.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[out] p_balance The balance the account held. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account.
+ */
+int
+account_close (account_store_t * p_store, const uint32_t id, uint64_t * p_balance);
+
+/*!
+ * @brief This function reads an account's balance without taking a lock.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[out] p_balance The balance.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account.
+ */
+int
+account_balance (account_store_t * p_store, const uint32_t id, uint64_t * p_balance);
+
+/*!
+ * @brief This function reads several accounts' balances as of a single
+ *          moment, so no transfer between them is seen half done.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] num_ids The number of ids, from 1 to ACCOUNT_MAX_READ.
+ * @param[out] p_balances The balances, one per id.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if any of the
+ *          accounts does not exist.
+ */
+int
+account_balances (account_store_t * p_store, const uint32_t * p_ids, const size_t num_ids,
+                  uint64_t * p_balances);
+
+/*!
+ * @brief This function adds to an account's balance.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[in] amount The amount.
+ * @param[out] p_balance The new balance. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account, and to EOVERFLOW if the balance would
+ *          overflow. If the log function fails, errno is left as it set
+ *          it.
+ */
+int
+account_deposit (account_store_t * p_store, const uint32_t id, const uint64_t amount,
+                 uint64_t * p_balance);
+
+/*!
+ * @brief This function takes from an account's balance.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id.
+ * @param[in] amount The amount.
+ * @param[out] p_balance The new balance. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no such account, and to ERANGE if the balance is too low. If
+ *          the log function fails, errno is left as it set it.
+ */
+int
+account_withdraw (account_store_t * p_store, const uint32_t id, const uint64_t amount,
+                  uint64_t * p_balance);
+
+/*!
+ * @brief This function moves an amount from one account to another, as
+ *          one step: no other caller sees one side done without the
+ *          other.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] from The payer's user id.
+ * @param[in] to The payee's user id. Must differ from the payer's.
+ * @param[in] amount The amount.
+ * @param[out] p_balance The payer's new balance. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if either
+ *          account does not exist, to ERANGE if the payer's balance is
+ *          too low, and to EOVERFLOW if the payee's would overflow. If
+ *          the log function fails, errno is left as it set it.
+ */
+int
+account_transfer (account_store_t * p_store, const uint32_t from, const uint32_t to,
+                  const uint64_t amount, uint64_t * p_balance);
+
+/*!
+ * @brief This function adds up every balance as of a single moment, so
+ *          the sum is exact even while transfers run.
+ *
+ * @param[in] p_store The account store.
+ * @param[out] p_total The sum. Saturates at UINT64_MAX.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+account_total (account_store_t * p_store, uint64_t * p_total);
+
+/*!
+ * @brief This function returns the number of open accounts.
+ *
+ *          While other threads are using the store this is only an
+ *              estimate.
+ *
+ * @param[in] p_store The account store.
+ *
+ * @return The number of accounts. 0 on error.
+ */
+size_t
+account_count (account_store_t * p_store);
+
+/*!
+ * @brief This function hands every open account to a function. It holds
+ *          one stripe's lock at a time, so it only stalls writers to the
+ *          stripe it is visiting, and the accounts are not seen as of a
+ *          single moment.
+ *
+ * @param[in] p_store The account store.
+ * @param[in] visit_func The function.
+ * @param[in/out] p_ctx The context passed to visit_func.
+ *
+ * @return 0 on success, -1 on error or if visit_func failed.
+ */
+int
+account_foreach (account_store_t * p_store, account_visit_f visit_func, void * p_ctx);
+
+/*!
+ * @brief This function sets an account's balance, opening the account
+ *          if needed, as when rebuilding the store from a snapshot or the
+ *          log.
+ *
+ * @param[in/out] p_store The account store.
+ * @param[in] id The owner's user id. Must be non-zero.
+ * @param[in] balance The balance.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+account_restore (account_store_t * p_store, const uint32_t id, const uint64_t balance);
+
+#endif // SERVER_ACCOUNT_H
+
+/***   end of file   ***/
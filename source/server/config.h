@@ -12,13 +12,22 @@
  * @brief User database configurations
  */
 
-// The maximum number of users.
-#define USER_DB_MAX_USERS 50
+// The number of users the index has room for at startup. It grows past
+// this as users register.
+#define USER_DB_INITIAL_USERS 1024
 
 // The maxmimum length of a username and password.
 #define USER_DB_UNAME_MAX 30
 #define USER_DB_PWORD_MAX 30
 
+/*!
+ * @brief Persistence configurations
+ */
+
+// The directory the log and snapshots are kept in, and the name its segments extend.
+#define PERSIST_DEFAULT_DIR "."
+#define PERSIST_LOG_NAME "bank.wal"
+
 #endif // SERVER_CONFIG_H
 
 /***   end of file   ***/
@@ -0,0 +1,421 @@
+/*!
+ * @file server/journal.c
+ *
+ * @brief This file contains the records the server writes to its log, and
+ *          the function that replays them into the user index and the
+ *          account store.
+ *
+ *          Replay never fails on a state a record's effect already
+ *              reached: putting a user that exists replaces it, opening
+ *              an open account and deleting what is gone are no-ops.
+ *              Nor on a balance for an account that is gone, which a
+ *              change racing its user's deletion logs after the delete.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <endian.h>
+
+#include "journal.h"
+
+/*!
+ * @brief The sequence number of the last record the log functions
+ *          appended on this thread.
+ */
+static _Thread_local uint64_t g_journal_lsn = 0;
+
+/*!
+ * @brief This is a static function that copies a string into a
+ *          zero-padded record field.
+ *
+ * @param[out] p_field The field.
+ * @param[in] size The field's size, the terminator included.
+ * @param[in] p_str The string.
+ *
+ * @return 0 on success, -1 if the string is empty or does not fit.
+ */
+static int
+journal_field (char * p_field, const size_t size, const char * p_str)
+{
+    int status = -1;
+    size_t len = strnlen(p_str, size);
+    if ((0 == len) ||
+        (size == len))
+    {
+        goto EXIT;
+    }
+    
+    memset(p_field, 0, size);
+    memcpy(p_field, p_str, len);
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that checks a record field holds a
+ *          terminated string.
+ *
+ * @param[in] p_field The field.
+ * @param[in] size The field's size.
+ *
+ * @return true if it does, false otherwise.
+ */
+static bool
+journal_field_ok (const char * p_field, const size_t size)
+{
+    return (NULL != memchr(p_field, '\0', size));
+}
+
+/*!
+ * @brief This is a static function that logs a user record.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] type The record type.
+ * @param[in] id The user's id.
+ * @param[in] p_username The username.
+ * @param[in] p_password The password. NULL to leave it empty.
+ * @param[out] p_lsn The record's sequence number.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+journal_user (wal_t * p_wal, const journal_type_t type, const uint32_t id,
+              const char * p_username, const char * p_password, uint64_t * p_lsn)
+{
+    int status = -1;
+    journal_user_t record;
+    memset(&record, 0, sizeof(record));
+    if ((NULL == p_wal) ||
+        (0 == id) ||
+        (NULL == p_username) ||
+        (-1 == journal_field(record.username, JOURNAL_UNAME_SIZE, p_username)) ||
+        ((NULL != p_password) &&
+         (-1 == journal_field(record.password, JOURNAL_PWORD_SIZE, p_password))))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    record.type = (uint8_t) type;
+    record.id = htobe32(id);
+    status = wal_append(p_wal, &record, sizeof(record), p_lsn);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that replays a user record.
+ *
+ * @param[in/out] p_journal What to apply it to.
+ * @param[in] p_record The record.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+journal_apply_user (journal_t * p_journal, const journal_user_t * p_record)
+{
+    int status = -1;
+    uint32_t id = be32toh(p_record->id);
+    if ((0 == id) ||
+        (false == journal_field_ok(p_record->username, JOURNAL_UNAME_SIZE)) ||
+        (false == journal_field_ok(p_record->password, JOURNAL_PWORD_SIZE)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    if (JOURNAL_USER_PUT == p_record->type)
+    {
+        if ((-1 == user_restore(p_journal->p_users, p_record->username,
+                                p_record->password, id)) ||
+            ((-1 == account_open(p_journal->p_accounts, id)) && (EEXIST != errno)))
+        {
+            goto EXIT;
+        }
+    }
+    else
+    {
+        // The user's id stays taken, so it is not handed out again.
+        if (((-1 == user_delete(p_journal->p_users, p_record->username)) &&
+             (ENOENT != errno)) ||
+            ((-1 == account_close(p_journal->p_accounts, id, NULL)) && (ENOENT != errno)) ||
+            (-1 == user_skip_ids(p_journal->p_users, id + 1)))
+        {
+            goto EXIT;
+        }
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function logs a user registered, or a user's password
+ *          changed. Replaying it also opens the user's account if it is
+ *          not open.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] id The user's id.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[in] p_password The password, non-empty and at most
+ *              USER_DB_PWORD_MAX long.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_user_put (wal_t * p_wal, const uint32_t id, const char * p_username,
+                  const char * p_password, uint64_t * p_lsn)
+{
+    int status = -1;
+    if (NULL == p_password)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    status = journal_user(p_wal, JOURNAL_USER_PUT, id, p_username, p_password, p_lsn);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function logs a user deleted, along with the user's
+ *          account.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] id The user's id.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_user_delete (wal_t * p_wal, const uint32_t id, const char * p_username,
+                     uint64_t * p_lsn)
+{
+    return journal_user(p_wal, JOURNAL_USER_DELETE, id, p_username, NULL, p_lsn);
+}
+
+/*!
+ * @brief This function logs the new balances of accounts changed in one
+ *          step, such as both sides of a transfer.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] p_balances The balances, one per id.
+ * @param[in] count The number of accounts, from 1 to
+ *              JOURNAL_MAX_BALANCES.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_balances (wal_t * p_wal, const uint32_t * p_ids, const uint64_t * p_balances,
+                  const size_t count, uint64_t * p_lsn)
+{
+    int status = -1;
+    if ((NULL == p_wal) ||
+        (NULL == p_ids) ||
+        (NULL == p_balances) ||
+        (0 == count) ||
+        (count > JOURNAL_MAX_BALANCES))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    journal_balances_t record;
+    memset(&record, 0, sizeof(record));
+    record.type = JOURNAL_BALANCES;
+    record.count = (uint8_t) count;
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        if (0 == p_ids[idx])
+        {
+            errno = EINVAL;
+            goto EXIT;
+        }
+        record.balances[idx].id = htobe32(p_ids[idx]);
+        record.balances[idx].balance = htobe64(p_balances[idx]);
+    }
+    status = wal_append(p_wal, &record, 2 + (count * sizeof(journal_balance_t)), p_lsn);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function logs a user being registered or deleted. It is a
+ *          user_log_f, to hand to user_index_set_log with the log as its
+ *          context, so the record is appended under the index's lock. The
+ *          record's sequence number is read back with journal_lsn.
+ *
+ * @param[in] p_entry The user's entry.
+ * @param[in] b_deleted Whether the user is being deleted.
+ * @param[in/out] p_ctx The log, a wal_t.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_log_user (const user_entry_t * p_entry, const bool b_deleted, void * p_ctx)
+{
+    int status = -1;
+    if (NULL == p_entry)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    if (true == b_deleted)
+    {
+        status = journal_user((wal_t *) p_ctx, JOURNAL_USER_DELETE, p_entry->id,
+                              p_entry->username, NULL, &g_journal_lsn);
+    }
+    else
+    {
+        status = journal_user((wal_t *) p_ctx, JOURNAL_USER_PUT, p_entry->id,
+                              p_entry->username, p_entry->password, &g_journal_lsn);
+    }
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function logs the new balances of a deposit, withdrawal or
+ *          transfer. It is an account_log_f, to hand to
+ *          account_store_set_log with the log as its context, so the
+ *          record is appended under the accounts' stripe locks. The
+ *          record's sequence number is read back with journal_lsn.
+ *
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] p_balances The new balances, one per id.
+ * @param[in] count The number of accounts.
+ * @param[in/out] p_ctx The log, a wal_t.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_log_balances (const uint32_t * p_ids, const uint64_t * p_balances, const size_t count,
+                      void * p_ctx)
+{
+    return journal_balances((wal_t *) p_ctx, p_ids, p_balances, count, &g_journal_lsn);
+}
+
+/*!
+ * @brief This function returns the sequence number of the last record
+ *          journal_log_user or journal_log_balances appended on the
+ *          calling thread, to pass to wal_commit once the change returns.
+ *
+ * @return The sequence number. 0 if the thread has appended none.
+ */
+uint64_t
+journal_lsn (void)
+{
+    return g_journal_lsn;
+}
+
+/*!
+ * @brief This function applies a record to the user index and account
+ *          store. It is a wal_replay_f.
+ *
+ * @param[in] lsn The record's sequence number.
+ * @param[in] p_data The record.
+ * @param[in] len The record's length.
+ * @param[in/out] p_ctx The journal_t to apply it to.
+ *
+ * @return 0 on success, -1 on error. errno is set to EINVAL if the record
+ *          is malformed. A balance for an account that is not open is
+ *          skipped.
+ */
+int
+journal_apply (const uint64_t lsn, const void * p_data, const size_t len, void * p_ctx)
+{
+    int status = -1;
+    journal_t * p_journal = (journal_t *) p_ctx;
+    const uint8_t * p_type = p_data;
+    (void) lsn;
+    if ((NULL == p_journal) ||
+        (NULL == p_data) ||
+        (0 == len))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    switch (*p_type)
+    {
+        case JOURNAL_USER_PUT:
+        case JOURNAL_USER_DELETE:
+        {
+            journal_user_t user;
+            if (sizeof(user) != len)
+            {
+                errno = EINVAL;
+                goto EXIT;
+            }
+            memcpy(&user, p_data, sizeof(user));
+            if (-1 == journal_apply_user(p_journal, &user))
+            {
+                goto EXIT;
+            }
+            break;
+        }
+        case JOURNAL_BALANCES:
+        {
+            journal_balances_t balances;
+            if ((len < 2) ||
+                (len > sizeof(balances)))
+            {
+                errno = EINVAL;
+                goto EXIT;
+            }
+            memcpy(&balances, p_data, len);
+            if ((0 == balances.count) ||
+                (balances.count > JOURNAL_MAX_BALANCES) ||
+                (len != (2 + (balances.count * sizeof(journal_balance_t)))))
+            {
+                errno = EINVAL;
+                goto EXIT;
+            }
+            for (size_t idx = 0; idx < balances.count; ++idx)
+            {
+                uint32_t id = be32toh(balances.balances[idx].id);
+                uint64_t balance = 0;
+                if (-1 == account_balance(p_journal->p_accounts, id, &balance))
+                {
+                    if (ENOENT != errno)
+                    {
+                        goto EXIT;
+                    }
+                    continue;
+                }
+                if (-1 == account_restore(p_journal->p_accounts, id,
+                                          be64toh(balances.balances[idx].balance)))
+                {
+                    goto EXIT;
+                }
+            }
+            break;
+        }
+        default:
+            errno = EINVAL;
+            goto EXIT;
+    }
+    p_journal->applied++;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,251 @@
+/*!
+ * @file server/journal.h
+ *
+ * @brief This file contains the records the server writes to its log, and
+ *          the function that replays them into the user index and the
+ *          account store.
+ *
+ *          A record holds what a change left behind rather than the change
+ *              itself: a user's entry, or an account's new balance. Applying
+ *              a record twice, or over a snapshot that already holds its
+ *              effect, leaves the same state as applying it once. That is
+ *              what lets a snapshot be taken while the tables change: the
+ *              log from the snapshot's sequence number on is replayed over
+ *              it, and every record brings what it touched up to date.
+ *
+ *          For that to hold, the log must order the changes to each user
+ *              and each account the way they were made. A change's record
+ *              is appended while the lock guarding what it changed is
+ *              held: journal_log_user and journal_log_balances are the
+ *              functions the user index and the account store hand their
+ *              changes to under their locks.
+ *
+ *          A balance is only written for an account that was open when the
+ *              change was made. One changed while its user was being
+ *              deleted is logged after the delete, so replay skips
+ *              balances for accounts that are not open.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - journal_user_put
+ *              - journal_user_delete
+ *              - journal_balances
+ *              - journal_log_user
+ *              - journal_log_balances
+ *              - journal_lsn
+ *              - journal_apply
+ */
+
+#ifndef SERVER_JOURNAL_H
+#define SERVER_JOURNAL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "user.h"
+#include "account.h"
+#include "wal.h"
+
+/*!
+ * @brief The size of a username and of a password field, including the
+ *          terminator.
+ */
+#define JOURNAL_UNAME_SIZE (USER_DB_UNAME_MAX + 1)
+#define JOURNAL_PWORD_SIZE (USER_DB_PWORD_MAX + 1)
+
+_Static_assert(JOURNAL_UNAME_SIZE <= USER_STR_SIZE, "usernames fit the user index");
+_Static_assert(JOURNAL_PWORD_SIZE <= USER_STR_SIZE, "passwords fit the user index");
+
+/*!
+ * @brief The most balances a record holds, enough for both sides of a
+ *          transfer.
+ */
+#define JOURNAL_MAX_BALANCES 2
+
+/*!
+ * @brief This enumeration defines the record types.
+ */
+typedef enum _journal_type
+{
+    JOURNAL_USER_PUT    = 0x01,
+    JOURNAL_USER_DELETE = 0x02,
+    JOURNAL_BALANCES    = 0x03,
+} journal_type_t;
+
+/*!
+ * @brief This datatype defines a user record, laid out as in the log. A
+ *          delete leaves the password empty.
+ *
+ * @param type The record type, one of journal_type_t.
+ * @param id The user's id, in network byte order.
+ * @param username The username, zero-padded.
+ * @param password The password, zero-padded.
+ */
+typedef struct __attribute__((packed)) _journal_user
+{
+    uint8_t  type;
+    uint32_t id;
+    char     username[JOURNAL_UNAME_SIZE];
+    char     password[JOURNAL_PWORD_SIZE];
+} journal_user_t;
+
+/*!
+ * @brief This datatype defines one account's balance in a record.
+ *
+ * @param id The owner's user id, in network byte order.
+ * @param balance The balance, in network byte order.
+ */
+typedef struct __attribute__((packed)) _journal_balance
+{
+    uint32_t id;
+    uint64_t balance;
+} journal_balance_t;
+
+/*!
+ * @brief This datatype defines a balances record, laid out as in the log.
+ *          Only the first count balances are written.
+ *
+ * @param type The record type, JOURNAL_BALANCES.
+ * @param count The number of balances, from 1 to JOURNAL_MAX_BALANCES.
+ * @param balances The balances.
+ */
+typedef struct __attribute__((packed)) _journal_balances
+{
+    uint8_t           type;
+    uint8_t           count;
+    journal_balance_t balances[JOURNAL_MAX_BALANCES];
+} journal_balances_t;
+
+_Static_assert(sizeof(journal_user_t) <= WAL_MAX_RECORD, "user records fit the log");
+_Static_assert(sizeof(journal_balances_t) <= WAL_MAX_RECORD, "balance records fit the log");
+
+/*!
+ * @brief This datatype defines what records are replayed into.
+ *
+ * @param p_users The user index.
+ * @param p_accounts The account store.
+ * @param applied The number of records applied.
+ */
+typedef struct _journal
+{
+    user_index_t *    p_users;
+    account_store_t * p_accounts;
+    uint64_t          applied;
+} journal_t;
+
+/*!
+ * @brief This function logs a user registered, or a user's password
+ *          changed. Replaying it also opens the user's account if it is
+ *          not open.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] id The user's id.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[in] p_password The password, non-empty and at most
+ *              USER_DB_PWORD_MAX long.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_user_put (wal_t * p_wal, const uint32_t id, const char * p_username,
+                  const char * p_password, uint64_t * p_lsn);
+
+/*!
+ * @brief This function logs a user deleted, along with the user's
+ *          account.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] id The user's id.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_user_delete (wal_t * p_wal, const uint32_t id, const char * p_username,
+                     uint64_t * p_lsn);
+
+/*!
+ * @brief This function logs the new balances of accounts changed in one
+ *          step, such as both sides of a transfer.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] p_balances The balances, one per id.
+ * @param[in] count The number of accounts, from 1 to
+ *              JOURNAL_MAX_BALANCES.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_balances (wal_t * p_wal, const uint32_t * p_ids, const uint64_t * p_balances,
+                  const size_t count, uint64_t * p_lsn);
+
+/*!
+ * @brief This function logs a user being registered or deleted. It is a
+ *          user_log_f, to hand to user_index_set_log with the log as its
+ *          context, so the record is appended under the index's lock. The
+ *          record's sequence number is read back with journal_lsn.
+ *
+ * @param[in] p_entry The user's entry.
+ * @param[in] b_deleted Whether the user is being deleted.
+ * @param[in/out] p_ctx The log, a wal_t.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_log_user (const user_entry_t * p_entry, const bool b_deleted, void * p_ctx);
+
+/*!
+ * @brief This function logs the new balances of a deposit, withdrawal or
+ *          transfer. It is an account_log_f, to hand to
+ *          account_store_set_log with the log as its context, so the
+ *          record is appended under the accounts' stripe locks. The
+ *          record's sequence number is read back with journal_lsn.
+ *
+ * @param[in] p_ids The owners' user ids.
+ * @param[in] p_balances The new balances, one per id.
+ * @param[in] count The number of accounts.
+ * @param[in/out] p_ctx The log, a wal_t.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+journal_log_balances (const uint32_t * p_ids, const uint64_t * p_balances, const size_t count,
+                      void * p_ctx);
+
+/*!
+ * @brief This function returns the sequence number of the last record
+ *          journal_log_user or journal_log_balances appended on the
+ *          calling thread, to pass to wal_commit once the change returns.
+ *
+ * @return The sequence number. 0 if the thread has appended none.
+ */
+uint64_t
+journal_lsn (void);
+
+/*!
+ * @brief This function applies a record to the user index and account
+ *          store. It is a wal_replay_f.
+ *
+ * @param[in] lsn The record's sequence number.
+ * @param[in] p_data The record.
+ * @param[in] len The record's length.
+ * @param[in/out] p_ctx The journal_t to apply it to.
+ *
+ * @return 0 on success, -1 on error. errno is set to EINVAL if the record
+ *          is malformed. A balance for an account that is not open is
+ *          skipped.
+ */
+int
+journal_apply (const uint64_t lsn, const void * p_data, const size_t len, void * p_ctx);
+
+#endif // SERVER_JOURNAL_H
+
+/***   end of file   ***/
@@ -4,20 +4,459 @@
  * @brief This file contains the entry point for the server program.
  */
 
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "server.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "../common/msg.h"
+
+_Static_assert(SERVER_REQ_SIZE == MSG_REQ_SIZE, "server reads whole request frames");
+_Static_assert(SERVER_RESP_SIZE == MSG_RESP_SIZE, "server writes whole response frames");
+
+/*!
+ * @brief The dispatcher routing requests to their operations.
+ */
+static msg_dispatch_t g_dispatch;
+
+/*!
+ * @brief The server the signal handler stops.
+ */
+static server_t * gp_server = NULL;
+
+/*!
+ * @brief This is a static function that stops the server on SIGINT and
+ *          SIGTERM.
+ *
+ * @param[in] signum The signal number.
+ *
+ * @return No return value expected.
+ */
+static void
+on_signal (int signum)
+{
+    (void) signum;
+    server_stop(gp_server);
+}
+
+/*!
+ * @brief This is a static function that handles a request by
+ *          dispatching it to its operation.
+ *
+ *          No operation is implemented yet, so every request fails. The
+ *              session id is echoed back.
+ *
+ * @param[in] p_request The request frame.
+ * @param[out] p_response The response frame.
+ * @param[in] p_ctx The dispatcher.
+ *
+ * @return No return value expected.
+ */
+static void
+handle_request (const unsigned char * p_request, unsigned char * p_response, void * p_ctx)
+{
+    (void) msg_dispatch(p_ctx, p_request, p_response);
+}
+
+/*!
+ * @brief This is a static function that rebuilds the user index and
+ *          account store from the newest valid snapshot, then replays
+ *          the log records after it.
+ *
+ * @param[in] p_dir The directory the snapshots are in.
+ * @param[in] p_log The log's path.
+ * @param[out] p_journal The tables, created here.
+ * @param[out] p_snapshot_lsn The snapshot's sequence number, 0 if there
+ *              was none.
+ * @param[out] p_last_lsn The sequence number of the log's last record, so
+ *              the log can be opened without reading it again.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+restore_state (const char * p_dir, const char * p_log, journal_t * p_journal,
+               uint64_t * p_snapshot_lsn, uint64_t * p_last_lsn)
+{
+    int status = -1;
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    p_journal->applied = 0;
+    p_journal->p_users = NULL;
+    p_journal->p_accounts = NULL;
+    bool b_mapped = (0 == snapshot_open(p_dir, &snapshot));
+    if ((false == b_mapped) &&
+        (ENOENT != errno))
+    {
+        perror("snapshot_open");
+        goto EXIT;
+    }
+    
+    size_t capacity = USER_DB_INITIAL_USERS;
+    if (snapshot.num_users > capacity)
+    {
+        capacity = snapshot.num_users;
+    }
+    p_journal->p_users = user_index_create(capacity);
+    p_journal->p_accounts = account_store_create();
+    if ((NULL == p_journal->p_users) ||
+        (NULL == p_journal->p_accounts))
+    {
+        perror("restore_state");
+        goto EXIT;
+    }
+    if ((true == b_mapped) &&
+        (-1 == snapshot_load(&snapshot, p_journal->p_users, p_journal->p_accounts)))
+    {
+        perror("snapshot_load");
+        goto EXIT;
+    }
+    
+    // A log that ends before the snapshot lost records the snapshot holds,
+    // and new records would reuse their sequence numbers.
+    uint64_t last_lsn = 0;
+    if (-1 == wal_replay(p_log, snapshot.lsn, journal_apply, p_journal, &last_lsn))
+    {
+        perror("wal_replay");
+        goto EXIT;
+    }
+    if (last_lsn < snapshot.lsn)
+    {
+        fprintf(stderr, "%s ends at record %" PRIu64 ", before the snapshot at %" PRIu64 "\n",
+                p_log, last_lsn, snapshot.lsn);
+        goto EXIT;
+    }
+    *p_snapshot_lsn = snapshot.lsn;
+    *p_last_lsn = last_lsn;
+    status = 0;
+    
+    EXIT:
+        if (true == b_mapped)
+        {
+            snapshot_close(&snapshot);
+        }
+        if (-1 == status)
+        {
+            user_index_destroy(p_journal->p_users);
+            account_store_destroy(p_journal->p_accounts);
+            p_journal->p_users = NULL;
+            p_journal->p_accounts = NULL;
+        }
+        return status;
+}
+
+/*!
+ * @brief This is a static function that prints the program's usage.
+ *
+ * @param[in] p_prog The program name.
+ *
+ * @return No return value expected.
+ */
+static void
+usage (const char * p_prog)
+{
+    fprintf(stderr,
+            "usage: %s [-p port] [-w workers] [-b backlog] [-c max_conns] [-r requests]\n"
+            "          [-i backend] [-n reactors] [-a] [-s shm_name] [-d dir] [-t seconds]\n"
+            "  -p port       TCP port to listen on (default %d)\n"
+            "  -w workers    number of worker threads, split among pinned reactors (default %d)\n"
+            "  -b backlog    listen backlog (default %d)\n"
+            "  -c max_conns  most connections open at once (default %d)\n"
+            "  -r requests   most requests in flight per connection (default %d)\n"
+            "  -i backend    I/O backend, epoll or uring (default epoll)\n"
+            "  -n reactors   number of reactor threads sharing the port (default %d)\n"
+            "  -a            pin each reactor and its own workers to a processor\n"
+            "  -s shm_name   also serve local clients over this shared-memory segment\n"
+            "  -d dir        directory for the log and snapshots (default %s)\n"
+            "  -t seconds    time between snapshots (default %d)\n",
+            p_prog, SERVER_DEFAULT_PORT, SERVER_DEFAULT_WORKERS,
+            SERVER_DEFAULT_BACKLOG, SERVER_DEFAULT_MAX_CONNS,
+            SERVER_DEFAULT_MAX_INFLIGHT, SERVER_DEFAULT_REACTORS, PERSIST_DEFAULT_DIR,
+            SNAPSHOT_DEFAULT_INTERVAL_MS / 1000);
+}
+
+/*!
+ * @brief This is a static function that parses a numeric command line
+ *          argument.
+ *
+ * @param[in] p_arg The argument.
+ * @param[in] min The smallest value accepted.
+ * @param[in] max The largest value accepted.
+ * @param[out] p_value The parsed value.
+ *
+ * @return 0 on success, -1 if the argument is not a number in range.
+ */
+static int
+parse_num (const char * p_arg, const unsigned long min, const unsigned long max,
+           unsigned long * p_value)
+{
+    int status = -1;
+    char * p_end = NULL;
+    errno = 0;
+    unsigned long value = strtoul(p_arg, &p_end, 10);
+    if ((0 != errno) ||
+        (p_end == p_arg) ||
+        ('\0' != *p_end) ||
+        (value < min) ||
+        (value > max))
+    {
+        goto EXIT;
+    }
+    
+    *p_value = value;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
 
 /*!
  * @brief This is the entry point for the server program. It handles
  *          parsing of command line arguments and dispatch of the main
  *          server context.
- * 
+ *
  * @return 0 on success, 1 on error.
  */
 int
-main ()
+main (int argc, char ** argv)
 {
-    printf("success\n");
-    return 0;
+    int status = 1;
+    server_attr_t attr;
+    server_attr_init(&attr);
+    
+    const char * p_dir = PERSIST_DEFAULT_DIR;
+    uint64_t interval_ms = SNAPSHOT_DEFAULT_INTERVAL_MS;
+    journal_t journal;
+    memset(&journal, 0, sizeof(journal));
+    wal_t * p_wal = NULL;
+    snapshot_writer_t * p_writer = NULL;
+    
+    int opt = 0;
+    unsigned long value = 0;
+    while (-1 != (opt = getopt(argc, argv, "p:w:b:c:r:i:n:as:d:t:h")))
+    {
+        switch (opt)
+        {
+            case 'p':
+                if (-1 == parse_num(optarg, 0, UINT16_MAX, &value))
+                {
+                    fprintf(stderr, "invalid port: %s\n", optarg);
+                    goto EXIT;
+                }
+                attr.port = (uint16_t) value;
+                break;
+            case 'w':
+                if (-1 == parse_num(optarg, 1, 1024, &value))
+                {
+                    fprintf(stderr, "invalid worker count: %s\n", optarg);
+                    goto EXIT;
+                }
+                attr.num_workers = value;
+                break;
+            case 'b':
+                if (-1 == parse_num(optarg, 1, 65535, &value))
+                {
+                    fprintf(stderr, "invalid backlog: %s\n", optarg);
+                    goto EXIT;
+                }
+                attr.backlog = (int) value;
+                break;
+            case 'c':
+                if (-1 == parse_num(optarg, 1, 1u << 20, &value))
+                {
+                    fprintf(stderr, "invalid connection limit: %s\n", optarg);
+                    goto EXIT;
+                }
+                attr.max_conns = value;
+                break;
+            case 'r':
+                if (-1 == parse_num(optarg, 1, SERVER_MAX_INFLIGHT, &value))
+                {
+                    fprintf(stderr, "invalid in-flight limit: %s\n", optarg);
+                    goto EXIT;
+                }
+                attr.max_inflight = value;
+                break;
+            case 'i':
+                if (0 == strcmp(optarg, "epoll"))
+                {
+                    attr.backend = SERVER_BACKEND_EPOLL;
+                }
+                else if (0 == strcmp(optarg, "uring"))
+                {
+                    attr.backend = SERVER_BACKEND_URING;
+                }
+                else
+                {
+                    fprintf(stderr, "invalid backend: %s\n", optarg);
+                    goto EXIT;
+                }
+                break;
+            case 'n':
+                if (-1 == parse_num(optarg, 1, 1024, &value))
+                {
+                    fprintf(stderr, "invalid reactor count: %s\n", optarg);
+                    goto EXIT;
+                }
+                attr.num_reactors = value;
+                break;
+            case 'a':
+                attr.b_pinned = true;
+                break;
+            case 's':
+                if (('/' != optarg[0]) ||
+                    (strlen(optarg) >= SHM_NAME_MAX))
+                {
+                    fprintf(stderr, "invalid shared-memory name: %s\n", optarg);
+                    goto EXIT;
+                }
+                attr.p_shm_name = optarg;
+                break;
+            case 'd':
+                p_dir = optarg;
+                break;
+            case 't':
+                if (-1 == parse_num(optarg, 1, 86400, &value))
+                {
+                    fprintf(stderr, "invalid snapshot interval: %s\n", optarg);
+                    goto EXIT;
+                }
+                interval_ms = value * 1000;
+                break;
+            case 'h':
+                usage(argv[0]);
+                status = 0;
+                goto EXIT;
+            default:
+                usage(argv[0]);
+                goto EXIT;
+        }
+    }
+    
+    // Restore the tables before serving anything, then keep snapshotting
+    // them in the background.
+    char log_path[SNAPSHOT_PATH_MAX];
+    if (snprintf(log_path, sizeof(log_path), "%s/%s", p_dir, PERSIST_LOG_NAME) >=
+        (int) sizeof(log_path))
+    {
+        fprintf(stderr, "invalid directory: %s\n", p_dir);
+        goto EXIT;
+    }
+    uint64_t snapshot_lsn = 0;
+    uint64_t last_lsn = 0;
+    if (-1 == restore_state(p_dir, log_path, &journal, &snapshot_lsn, &last_lsn))
+    {
+        goto EXIT;
+    }
+    printf("restored %zu users and %zu accounts from the snapshot at record %" PRIu64
+           " and %zu log records after it\n", user_count(journal.p_users),
+           account_count(journal.p_accounts), snapshot_lsn, journal.applied);
+    wal_attr_t wal_attr;
+    wal_attr_init(&wal_attr);
+    wal_attr.last_lsn = last_lsn;
+    p_wal = wal_open(log_path, &wal_attr);
+    if (NULL == p_wal)
+    {
+        perror("wal_open");
+        goto EXIT;
+    }
+    
+    // Changes are logged by the tables themselves, under the locks that
+    // order them.
+    (void) user_index_set_log(journal.p_users, journal_log_user, p_wal);
+    (void) account_store_set_log(journal.p_accounts, journal_log_balances, p_wal);
+    p_writer = snapshot_writer_start(p_dir, interval_ms, journal.p_users, journal.p_accounts,
+                                     p_wal);
+    if (NULL == p_writer)
+    {
+        perror("snapshot_writer_start");
+        goto EXIT;
+    }
+    
+    msg_dispatch_init(&g_dispatch, NULL);
+    gp_server = server_create(&attr, handle_request, &g_dispatch);
+    if (NULL == gp_server)
+    {
+        perror("server_create");
+        goto EXIT;
+    }
+    
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    
+    printf("listening on port %u (%s, %zu reactors)\n", server_port(gp_server),
+           (SERVER_BACKEND_URING == server_backend(gp_server)) ? "io_uring" : "epoll",
+           server_num_reactors(gp_server));
+    if (NULL != attr.p_shm_name)
+    {
+        printf("serving local clients on %s (%zu channels)\n", attr.p_shm_name,
+               attr.shm_channels);
+    }
+    fflush(stdout);
+    if (0 == server_run(gp_server))
+    {
+        status = 0;
+    }
+    else
+    {
+        perror("server_run");
+    }
+    
+    // Report how the load spread over the reactors.
+    for (size_t idx = 0; idx < server_num_reactors(gp_server); ++idx)
+    {
+        server_stats_t stats;
+        if (0 == server_reactor_stats(gp_server, idx, &stats))
+        {
+            printf("reactor %zu: %llu connections (%llu rejected), %llu requests, "
+                   "%llu bytes in, %llu bytes out\n", idx,
+                   (unsigned long long) stats.accepted, (unsigned long long) stats.rejected,
+                   (unsigned long long) stats.requests, (unsigned long long) stats.bytes_in,
+                   (unsigned long long) stats.bytes_out);
+        }
+    }
+    
+    server_t * p_server = gp_server;
+    gp_server = NULL;
+    server_destroy(p_server);
+    
+    snapshot_stats_t snapshot_stats;
+    if (0 == snapshot_writer_stats(p_writer, &snapshot_stats))
+    {
+        printf("snapshots: %" PRIu64 " written (%" PRIu64 " failed), last at record %" PRIu64
+               " in %.1f ms\n", snapshot_stats.written, snapshot_stats.failed,
+               snapshot_stats.lsn, (double) snapshot_stats.write_ns / 1e6);
+    }
+    
+    EXIT:
+        if ((NULL != p_writer) &&
+            (-1 == snapshot_writer_stop(p_writer)))
+        {
+            perror("snapshot_writer_stop");
+            status = 1;
+        }
+        (void) user_index_set_log(journal.p_users, NULL, NULL);
+        (void) account_store_set_log(journal.p_accounts, NULL, NULL);
+        if ((NULL != p_wal) &&
+            (-1 == wal_close(p_wal)))
+        {
+            perror("wal_close");
+            status = 1;
+        }
+        user_index_destroy(journal.p_users);
+        account_store_destroy(journal.p_accounts);
+        return status;
 }
 
 /***   end of file   ***/
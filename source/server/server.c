@@ -0,0 +1,1923 @@
+/*!
+ * @file server/server.c
+ *
+ * @brief This file contains the server's network front end.
+ *
+ *          Edge-triggered epoll only reports a socket again once new
+ *              bytes arrive or new room opens up, so the reactor keeps
+ *              a per-connection flag for a socket it stopped reading
+ *              before it would block, and reads it again as soon as
+ *              its buffer has room.
+ *
+ *          Pool threads never touch a connection's socket or buffers.
+ *              A handled request's slot is posted to the done ring, and
+ *              the eventfd is written only by the first completion since
+ *              the reactor last drained it, so a burst of completions
+ *              costs one wakeup. The reactor drains the whole ring
+ *              before moving any connection along, so the responses a
+ *              connection completed in a burst go out in one write.
+ *
+ *          Connections are only freed by the reactor. One closed with
+ *              requests in flight is unlinked at once and freed when the
+ *              last completion comes back, and completions are drained only
+ *              after every socket event of a wakeup was handled, so no
+ *              event can refer to a connection freed in the same batch.
+ *
+ *          With io_uring, the kernel owns part of a connection while an
+ *              operation on it is in flight. A send reads its responses
+ *              in place, so their slots are only reused once it has
+ *              completed. An operation also holds its socket open, so a
+ *              connection closed with operations in flight has its socket
+ *              shut down first, which completes them, and is freed with
+ *              the last of their completions. The submission's user data
+ *              carries the reactor or connection with the operation in
+ *              its low bits.
+ *
+ *          Reactors share nothing but the server's read-only settings,
+ *              its stop flag and, unless pinned, the threadpool. A slot
+ *              finished by a shared thread is posted to the done ring
+ *              of its connection's reactor.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "server.h"
+
+/*!
+ * @brief This enumeration defines the operations the io_uring backend
+ *          keeps in flight.
+ */
+typedef enum _server_op
+{
+    SERVER_OP_ACCEPT,
+    SERVER_OP_WAKE,
+    SERVER_OP_RECV,
+    SERVER_OP_SEND,
+} server_op_t;
+
+/*!
+ * @brief The user data bits holding a server_op_t. Reactors and
+ *          connections are aligned well past them.
+ */
+#define SERVER_OP_MASK ((uint64_t) 3)
+
+/*!
+ * @brief This is a static function that adds to one of a reactor's
+ *          counters. Only the reactor thread writes a counter, so a
+ *          plain load and store suffice.
+ *
+ * @param[in/out] p_counter The counter.
+ * @param[in] count The amount to add.
+ *
+ * @return No return value expected.
+ */
+static void
+server_count (_Atomic uint64_t * p_counter, const uint64_t count)
+{
+    uint64_t value = atomic_load_explicit(p_counter, memory_order_relaxed);
+    atomic_store_explicit(p_counter, value + count, memory_order_relaxed);
+}
+
+/*!
+ * @brief This is a static function that wakes the reactor, unless it
+ *          has already been woken and not drained the eventfd since.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return No return value expected.
+ */
+static void
+server_kick (server_reactor_t * p_reactor)
+{
+    if (false == atomic_exchange(&(p_reactor->b_kicked), true))
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(p_reactor->event_fd, &one, sizeof(one));
+        (void) ret;
+    }
+}
+
+/*!
+ * @brief This is a static function that defines the threadpool job
+ *          running the request handler for a slot.
+ *
+ * @param[in] pb_shutdown Pointer to the threadpool's shutdown signal.
+ * @param[in/out] p_slot The slot.
+ *
+ * @return No return value expected.
+ */
+static void
+server_work (_Atomic bool * pb_shutdown, server_slot_t * p_slot)
+{
+    (void) pb_shutdown;
+    server_reactor_t * p_reactor = p_slot->p_conn->p_reactor;
+    memset(p_slot->response, 0, SERVER_RESP_SIZE);
+    server_t * p_server = p_reactor->p_server;
+    p_server->handle_func(p_slot->request, p_slot->response, p_server->p_ctx);
+    
+    // The ring holds every slot, so this cannot fail.
+    (void) ring_try_enq(p_reactor->p_done, p_slot);
+    server_kick(p_reactor);
+}
+
+/*!
+ * @brief This is a static function that returns a connection to the
+ *          pool.
+ *
+ * @param[in/out] p_conn The connection. It must be closed.
+ *
+ * @return No return value expected.
+ */
+static void
+server_free (server_conn_t * p_conn)
+{
+    server_reactor_t * p_reactor = p_conn->p_reactor;
+    p_reactor->num_conns--;
+    pool_free(p_reactor->p_conn_pool, p_conn);
+}
+
+/*!
+ * @brief This is a static function that frees a closed connection once
+ *          neither a request nor an io_uring operation is in flight.
+ *
+ * @param[in/out] p_conn The connection. It must be closed.
+ *
+ * @return No return value expected.
+ */
+static void
+server_release (server_conn_t * p_conn)
+{
+    if ((0 == p_conn->num_busy) &&
+        (0 == p_conn->pending))
+    {
+        server_free(p_conn);
+    }
+}
+
+/*!
+ * @brief This is a static function that closes a connection. It is
+ *          freed now, or when what it has in flight completes.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return No return value expected.
+ */
+static void
+server_close (server_conn_t * p_conn)
+{
+    server_reactor_t * p_reactor = p_conn->p_reactor;
+    
+    // Shutting the socket down completes the io_uring operations that
+    // hold it open. Closing it also removes it from the epoll instance.
+    if (0 != p_conn->pending)
+    {
+        (void) shutdown(p_conn->fd, SHUT_RDWR);
+    }
+    close(p_conn->fd);
+    p_conn->fd = -1;
+    server_count(&(p_reactor->counters.closed), 1);
+    
+    if (NULL != p_conn->p_prev)
+    {
+        p_conn->p_prev->p_next = p_conn->p_next;
+    }
+    else
+    {
+        p_reactor->p_conns = p_conn->p_next;
+    }
+    if (NULL != p_conn->p_next)
+    {
+        p_conn->p_next->p_prev = p_conn->p_prev;
+    }
+    p_conn->p_prev = NULL;
+    p_conn->p_next = NULL;
+    
+    server_release(p_conn);
+}
+
+/*!
+ * @brief This is a static function that points a connection's message
+ *          header at every ready response, in request order, past the
+ *          bytes already sent.
+ *
+ * @param[in/out] p_conn The connection. It must have a ready response.
+ *
+ * @return No return value expected.
+ */
+static void
+server_gather (server_conn_t * p_conn)
+{
+    size_t max_inflight = p_conn->p_reactor->max_inflight;
+    for (size_t idx = 0; idx < p_conn->num_ready; ++idx)
+    {
+        server_slot_t * p_slot = &(p_conn->slots[(p_conn->head + idx) % max_inflight]);
+        p_conn->iov[idx].iov_base = p_slot->response;
+        p_conn->iov[idx].iov_len = SERVER_RESP_SIZE;
+    }
+    p_conn->iov[0].iov_base = (unsigned char *) p_conn->iov[0].iov_base + p_conn->send_off;
+    p_conn->iov[0].iov_len -= p_conn->send_off;
+    
+    memset(&(p_conn->msg), 0, sizeof(p_conn->msg));
+    p_conn->msg.msg_iov = p_conn->iov;
+    p_conn->msg.msg_iovlen = p_conn->num_ready;
+}
+
+/*!
+ * @brief This is a static function that accounts for bytes sent from a
+ *          connection's ready responses, reusing every slot whose
+ *          response went out in full.
+ *
+ * @param[in/out] p_conn The connection.
+ * @param[in] sent The number of bytes sent.
+ *
+ * @return No return value expected.
+ */
+static void
+server_advance (server_conn_t * p_conn, const size_t sent)
+{
+    size_t max_inflight = p_conn->p_reactor->max_inflight;
+    server_count(&(p_conn->p_reactor->counters.bytes_out), sent);
+    p_conn->send_off += sent;
+    while (p_conn->send_off >= SERVER_RESP_SIZE)
+    {
+        p_conn->slots[p_conn->head].b_done = false;
+        p_conn->head = (p_conn->head + 1) % max_inflight;
+        p_conn->num_slots--;
+        p_conn->num_ready--;
+        p_conn->send_off -= SERVER_RESP_SIZE;
+    }
+}
+
+/*!
+ * @brief This is a static function that sends as much of a connection's
+ *          ready responses as the socket takes, gathering all of them
+ *          into each write.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return 0 on success, -1 if the connection failed.
+ */
+static int
+server_flush (server_conn_t * p_conn)
+{
+    int status = -1;
+    while (0 != p_conn->num_ready)
+    {
+        server_gather(p_conn);
+        ssize_t sent = sendmsg(p_conn->fd, &(p_conn->msg), MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            server_advance(p_conn, (size_t) sent);
+        }
+        else if (EINTR != errno)
+        {
+            if ((EAGAIN == errno) ||
+                (EWOULDBLOCK == errno))
+            {
+                status = 0;
+            }
+            goto EXIT;
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that reads from a connection's socket
+ *          until it would block or the read buffer is full.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return 0 on success, -1 if the connection failed.
+ */
+static int
+server_read (server_conn_t * p_conn)
+{
+    int status = -1;
+    while (p_conn->read_len < sizeof(p_conn->read_buf))
+    {
+        ssize_t got = recv(p_conn->fd, p_conn->read_buf + p_conn->read_len,
+                           sizeof(p_conn->read_buf) - p_conn->read_len, 0);
+        if (got > 0)
+        {
+            p_conn->read_len += (size_t) got;
+            server_count(&(p_conn->p_reactor->counters.bytes_in), (uint64_t) got);
+        }
+        else if (0 == got)
+        {
+            p_conn->b_eof = true;
+            p_conn->b_readable = false;
+            break;
+        }
+        else if (EINTR != errno)
+        {
+            if ((EAGAIN != errno) &&
+                (EWOULDBLOCK != errno))
+            {
+                goto EXIT;
+            }
+            p_conn->b_readable = false;
+            break;
+        }
+    }
+    
+    // A full buffer leaves b_readable set, so the socket is read again
+    // once a frame has been taken out of it.
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that hands every complete request
+ *          frame of a connection to the threadpool in one batch, as far
+ *          as the connection has free slots.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return 0 on success, -1 if the requests could not be enqueued.
+ */
+static int
+server_dispatch (server_conn_t * p_conn)
+{
+    int status = -1;
+    server_reactor_t * p_reactor = p_conn->p_reactor;
+    job_t jobs[SERVER_MAX_INFLIGHT];
+    size_t num_jobs = 0;
+    size_t offset = 0;
+    while (((p_conn->read_len - offset) >= SERVER_REQ_SIZE) &&
+           (p_conn->num_slots < p_reactor->max_inflight))
+    {
+        size_t idx = (p_conn->head + p_conn->num_slots) % p_reactor->max_inflight;
+        server_slot_t * p_slot = &(p_conn->slots[idx]);
+        memcpy(p_slot->request, p_conn->read_buf + offset, SERVER_REQ_SIZE);
+        jobs[num_jobs].job_func = (job_f) server_work;
+        jobs[num_jobs].p_arg = p_slot;
+        num_jobs++;
+        p_conn->num_slots++;
+        offset += SERVER_REQ_SIZE;
+    }
+    if (0 == num_jobs)
+    {
+        status = 0;
+        goto EXIT;
+    }
+    
+    p_conn->read_len -= offset;
+    memmove(p_conn->read_buf, p_conn->read_buf + offset, p_conn->read_len);
+    
+    // No more than SERVER_MAX_INFLIGHT jobs take a single critical
+    // section, so the batch is enqueued whole or not at all.
+    p_conn->num_busy += num_jobs;
+    if (-1 == threadpool_enq_batch(p_reactor->p_tp, jobs, num_jobs))
+    {
+        p_conn->num_busy -= num_jobs;
+        p_conn->num_slots -= num_jobs;
+        goto EXIT;
+    }
+    server_count(&(p_reactor->counters.requests), num_jobs);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that moves an epoll connection along
+ *          after anything happened to it: it sends pending responses,
+ *          reads and dispatches requests, and closes the connection once
+ *          it failed or the peer left with nothing more to answer.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return No return value expected.
+ */
+static void
+server_epoll_service (server_conn_t * p_conn)
+{
+    if (-1 == server_flush(p_conn))
+    {
+        goto CLOSE;
+    }
+    if ((true == p_conn->b_readable) &&
+        (-1 == server_read(p_conn)))
+    {
+        goto CLOSE;
+    }
+    if (-1 == server_dispatch(p_conn))
+    {
+        goto CLOSE;
+    }
+    
+    // A peer that has left is done with once every complete frame it
+    // sent has been answered and the answers sent.
+    if ((true == p_conn->b_eof) &&
+        (0 == p_conn->num_slots))
+    {
+        goto CLOSE;
+    }
+    return;
+    
+    CLOSE:
+        server_close(p_conn);
+}
+
+/*!
+ * @brief This is a static function that takes a submission queue entry
+ *          for an operation, submitting the queue early if it is full.
+ *
+ * @param[in/out] p_reactor The reactor.
+ * @param[in] p_owner The reactor or connection the operation belongs to.
+ * @param[in] op The operation.
+ *
+ * @return Pointer to the entry. NULL on error.
+ */
+static struct io_uring_sqe *
+server_sqe (server_reactor_t * p_reactor, void * p_owner, const server_op_t op)
+{
+    struct io_uring_sqe * p_sqe = uring_get_sqe(p_reactor->p_ring);
+    if (NULL == p_sqe)
+    {
+        // The kernel takes every entry it is handed, so this makes room.
+        if (-1 == uring_submit(p_reactor->p_ring, 0))
+        {
+            goto EXIT;
+        }
+        p_sqe = uring_get_sqe(p_reactor->p_ring);
+        if (NULL == p_sqe)
+        {
+            goto EXIT;
+        }
+    }
+    
+    p_sqe->user_data = ((uint64_t) (uintptr_t) p_owner) | (uint64_t) op;
+    
+    EXIT:
+        return p_sqe;
+}
+
+/*!
+ * @brief This is a static function that queues a multishot accept on
+ *          the listening socket.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+server_uring_accept (server_reactor_t * p_reactor)
+{
+    int status = -1;
+    struct io_uring_sqe * p_sqe = server_sqe(p_reactor, p_reactor, SERVER_OP_ACCEPT);
+    if (NULL == p_sqe)
+    {
+        goto EXIT;
+    }
+    
+    // Multishot accept predates provided buffer rings, so a kernel that
+    // registered the buffers supports it.
+    p_sqe->opcode = IORING_OP_ACCEPT;
+    p_sqe->fd = p_reactor->listen_fd;
+    p_sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    p_sqe->accept_flags = SOCK_CLOEXEC;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that queues a read of the eventfd,
+ *          which completes when the reactor is woken.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+server_uring_wake (server_reactor_t * p_reactor)
+{
+    int status = -1;
+    struct io_uring_sqe * p_sqe = server_sqe(p_reactor, p_reactor, SERVER_OP_WAKE);
+    if (NULL == p_sqe)
+    {
+        goto EXIT;
+    }
+    
+    p_sqe->opcode = IORING_OP_READ;
+    p_sqe->fd = p_reactor->event_fd;
+    p_sqe->addr = (uint64_t) (uintptr_t) &(p_reactor->wake_count);
+    p_sqe->len = sizeof(p_reactor->wake_count);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that queues a receive on a
+ *          connection, unless one is in flight, the peer has left, or the
+ *          read buffer has no room for a whole provided buffer.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+server_uring_recv (server_conn_t * p_conn)
+{
+    int status = -1;
+    server_reactor_t * p_reactor = p_conn->p_reactor;
+    if ((true == p_conn->b_receiving) ||
+        (true == p_conn->b_eof) ||
+        ((p_conn->read_len + p_reactor->p_bufs->buf_size) > sizeof(p_conn->read_buf)))
+    {
+        status = 0;
+        goto EXIT;
+    }
+    
+    struct io_uring_sqe * p_sqe = server_sqe(p_reactor, p_conn, SERVER_OP_RECV);
+    if (NULL == p_sqe)
+    {
+        goto EXIT;
+    }
+    
+    // The buffer is picked only once data arrives.
+    p_sqe->opcode = IORING_OP_RECV;
+    p_sqe->fd = p_conn->fd;
+    p_sqe->len = (uint32_t) p_reactor->p_bufs->buf_size;
+    p_sqe->flags = IOSQE_BUFFER_SELECT;
+    p_sqe->buf_group = p_reactor->p_bufs->group;
+    
+    p_conn->b_receiving = true;
+    p_conn->pending++;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that queues a gathered send of a
+ *          connection's ready responses, unless one is in flight.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+server_uring_send (server_conn_t * p_conn)
+{
+    int status = -1;
+    if ((true == p_conn->b_sending) ||
+        (0 == p_conn->num_ready))
+    {
+        status = 0;
+        goto EXIT;
+    }
+    
+    struct io_uring_sqe * p_sqe = server_sqe(p_conn->p_reactor, p_conn, SERVER_OP_SEND);
+    if (NULL == p_sqe)
+    {
+        goto EXIT;
+    }
+    
+    // Responses completed while the send is in flight wait for the next
+    // one, so the message header stays as the kernel saw it.
+    server_gather(p_conn);
+    p_sqe->opcode = IORING_OP_SENDMSG;
+    p_sqe->fd = p_conn->fd;
+    p_sqe->addr = (uint64_t) (uintptr_t) &(p_conn->msg);
+    p_sqe->len = 1;
+    p_sqe->msg_flags = MSG_NOSIGNAL;
+    
+    p_conn->b_sending = true;
+    p_conn->pending++;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that moves an io_uring connection
+ *          along after anything happened to it: it dispatches requests,
+ *          queues a send and a receive where there is something to do,
+ *          and closes the connection once it failed or the peer left
+ *          with nothing more to answer.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return No return value expected.
+ */
+static void
+server_uring_service (server_conn_t * p_conn)
+{
+    if (-1 == server_dispatch(p_conn))
+    {
+        goto CLOSE;
+    }
+    
+    // The end of the stream is only seen by a completed receive, and a
+    // send in flight holds a slot, so nothing is in flight.
+    if ((true == p_conn->b_eof) &&
+        (0 == p_conn->num_slots))
+    {
+        goto CLOSE;
+    }
+    if ((-1 == server_uring_send(p_conn)) ||
+        (-1 == server_uring_recv(p_conn)))
+    {
+        goto CLOSE;
+    }
+    return;
+    
+    CLOSE:
+        server_close(p_conn);
+}
+
+/*!
+ * @brief This is a static function that moves a connection along with
+ *          the reactor's backend.
+ *
+ * @param[in/out] p_conn The connection.
+ *
+ * @return No return value expected.
+ */
+static void
+server_service (server_conn_t * p_conn)
+{
+    if (SERVER_BACKEND_URING == p_conn->p_reactor->backend)
+    {
+        server_uring_service(p_conn);
+    }
+    else
+    {
+        server_epoll_service(p_conn);
+    }
+}
+
+/*!
+ * @brief This is a static function that sets up an accepted socket as a
+ *          new connection, or closes it if the server is stopping or the
+ *          reactor is full.
+ *
+ * @param[in/out] p_reactor The reactor.
+ * @param[in] fd The accepted socket.
+ *
+ * @return Pointer to the connection. NULL if the socket was closed.
+ */
+static server_conn_t *
+server_open (server_reactor_t * p_reactor, const int fd)
+{
+    server_conn_t * p_conn = NULL;
+    if ((false == atomic_load(&(p_reactor->p_server->b_stop))) &&
+        (p_reactor->num_conns < p_reactor->max_conns))
+    {
+        p_conn = pool_alloc(p_reactor->p_conn_pool);
+    }
+    if (NULL == p_conn)
+    {
+        goto EXIT;
+    }
+    
+    int one = 1;
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    p_conn->p_reactor = p_reactor;
+    p_conn->p_prev = NULL;
+    p_conn->p_next = NULL;
+    p_conn->p_completed = NULL;
+    p_conn->fd = fd;
+    p_conn->read_len = 0;
+    p_conn->head = 0;
+    p_conn->num_slots = 0;
+    p_conn->num_busy = 0;
+    p_conn->num_ready = 0;
+    p_conn->send_off = 0;
+    p_conn->pending = 0;
+    p_conn->b_completed = false;
+    p_conn->b_readable = true;
+    p_conn->b_eof = false;
+    p_conn->b_receiving = false;
+    p_conn->b_sending = false;
+    for (size_t idx = 0; idx < p_reactor->max_inflight; ++idx)
+    {
+        p_conn->slots[idx].p_conn = p_conn;
+        p_conn->slots[idx].b_done = false;
+    }
+    
+    if (SERVER_BACKEND_EPOLL == p_reactor->backend)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = p_conn;
+        if (-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event))
+        {
+            pool_free(p_reactor->p_conn_pool, p_conn);
+            p_conn = NULL;
+            goto EXIT;
+        }
+    }
+    
+    p_conn->p_next = p_reactor->p_conns;
+    if (NULL != p_reactor->p_conns)
+    {
+        p_reactor->p_conns->p_prev = p_conn;
+    }
+    p_reactor->p_conns = p_conn;
+    p_reactor->num_conns++;
+    server_count(&(p_reactor->counters.accepted), 1);
+    
+    EXIT:
+        if (NULL == p_conn)
+        {
+            close(fd);
+            server_count(&(p_reactor->counters.rejected), 1);
+        }
+        return p_conn;
+}
+
+/*!
+ * @brief This is a static function that accepts every pending
+ *          connection on the listening socket.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return No return value expected.
+ */
+static void
+server_accept (server_reactor_t * p_reactor)
+{
+    for (;;)
+    {
+        int fd = accept4(p_reactor->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (-1 == fd)
+        {
+            if ((EINTR == errno) ||
+                (ECONNABORTED == errno))
+            {
+                continue;
+            }
+            
+            // Out of descriptors or would block. Either way the
+            // remaining connections wait for the next event.
+            break;
+        }
+        
+        // Bytes may have arrived before the socket was registered.
+        server_conn_t * p_conn = server_open(p_reactor, fd);
+        if (NULL != p_conn)
+        {
+            server_epoll_service(p_conn);
+        }
+    }
+}
+
+/*!
+ * @brief This is a static function that handles a completed accept. The
+ *          accept is queued again once the kernel ends it.
+ *
+ * @param[in/out] p_reactor The reactor.
+ * @param[in] res The accepted socket, or a negated error code.
+ * @param[in] flags The completion flags.
+ *
+ * @return 0 on success, -1 if the accept could not be queued again.
+ */
+static int
+server_uring_accepted (server_reactor_t * p_reactor, const int res, const uint32_t flags)
+{
+    int status = -1;
+    
+    // Failed accepts, such as connections aborted while queued, leave
+    // the listening socket usable.
+    if (res >= 0)
+    {
+        server_conn_t * p_conn = server_open(p_reactor, res);
+        if (NULL != p_conn)
+        {
+            server_uring_service(p_conn);
+        }
+    }
+    if ((0 == (flags & IORING_CQE_F_MORE)) &&
+        (-1 == server_uring_accept(p_reactor)))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that handles a completed receive,
+ *          moving its bytes into the read buffer and giving the provided
+ *          buffer back.
+ *
+ * @param[in/out] p_conn The connection.
+ * @param[in] res The number of bytes received, or a negated error code.
+ * @param[in] flags The completion flags.
+ *
+ * @return No return value expected.
+ */
+static void
+server_uring_received (server_conn_t * p_conn, const int res, const uint32_t flags)
+{
+    uring_bufs_t * p_bufs = p_conn->p_reactor->p_bufs;
+    p_conn->pending--;
+    p_conn->b_receiving = false;
+    
+    if (0 != (flags & IORING_CQE_F_BUFFER))
+    {
+        uint16_t bid = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+        if ((res > 0) &&
+            (-1 != p_conn->fd))
+        {
+            memcpy(p_conn->read_buf + p_conn->read_len, uring_bufs_get(p_bufs, bid),
+                   (size_t) res);
+            p_conn->read_len += (size_t) res;
+            server_count(&(p_conn->p_reactor->counters.bytes_in), (uint64_t) res);
+        }
+        (void) uring_bufs_recycle(p_bufs, bid);
+    }
+    
+    if (-1 == p_conn->fd)
+    {
+        server_release(p_conn);
+        return;
+    }
+    if (0 == res)
+    {
+        p_conn->b_eof = true;
+    }
+    else if ((res < 0) &&
+             (-ENOBUFS != res) &&
+             (-EINTR != res))
+    {
+        server_close(p_conn);
+        return;
+    }
+    
+    server_uring_service(p_conn);
+}
+
+/*!
+ * @brief This is a static function that handles a completed send.
+ *
+ * @param[in/out] p_conn The connection.
+ * @param[in] res The number of bytes sent, or a negated error code.
+ *
+ * @return No return value expected.
+ */
+static void
+server_uring_sent (server_conn_t * p_conn, const int res)
+{
+    p_conn->pending--;
+    p_conn->b_sending = false;
+    
+    if (-1 == p_conn->fd)
+    {
+        server_release(p_conn);
+        return;
+    }
+    if (res < 0)
+    {
+        if ((-EINTR != res) &&
+            (-EAGAIN != res))
+        {
+            server_close(p_conn);
+            return;
+        }
+    }
+    else
+    {
+        server_advance(p_conn, (size_t) res);
+    }
+    
+    server_uring_service(p_conn);
+}
+
+/*!
+ * @brief This is a static function that handles every completion on the
+ *          ring.
+ *
+ * @param[in/out] p_reactor The reactor.
+ * @param[out] pb_complete Set if the reactor was woken.
+ *
+ * @return 0 on success, -1 if an operation could not be queued again.
+ */
+static int
+server_uring_reap (server_reactor_t * p_reactor, bool * pb_complete)
+{
+    int status = -1;
+    struct io_uring_cqe * p_cqe = NULL;
+    while (NULL != (p_cqe = uring_peek_cqe(p_reactor->p_ring)))
+    {
+        uint64_t user_data = p_cqe->user_data;
+        int res = p_cqe->res;
+        uint32_t flags = p_cqe->flags;
+        uring_cqe_seen(p_reactor->p_ring);
+        
+        void * p_owner = (void *) (uintptr_t) (user_data & ~SERVER_OP_MASK);
+        switch ((server_op_t) (user_data & SERVER_OP_MASK))
+        {
+            case SERVER_OP_ACCEPT:
+                if (-1 == server_uring_accepted(p_reactor, res, flags))
+                {
+                    goto EXIT;
+                }
+                break;
+            
+            case SERVER_OP_WAKE:
+                *pb_complete = true;
+                if (-1 == server_uring_wake(p_reactor))
+                {
+                    goto EXIT;
+                }
+                break;
+            
+            case SERVER_OP_RECV:
+                server_uring_received(p_owner, res, flags);
+                break;
+            
+            default:
+                server_uring_sent(p_owner, res);
+                break;
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that takes every handled request off
+ *          the done ring, then sends the responses each connection has
+ *          ready in request order.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return No return value expected.
+ */
+static void
+server_complete (server_reactor_t * p_reactor)
+{
+    // Rearm the kick before draining, so a completion posted after the
+    // ring was found empty writes the eventfd again.
+    atomic_store(&(p_reactor->b_kicked), false);
+    
+    server_conn_t * p_completed = NULL;
+    server_slot_t * p_slot = NULL;
+    while (NULL != (p_slot = ring_try_deq(p_reactor->p_done)))
+    {
+        server_conn_t * p_conn = p_slot->p_conn;
+        p_conn->num_busy--;
+        p_slot->b_done = true;
+        if (-1 == p_conn->fd)
+        {
+            server_release(p_conn);
+            continue;
+        }
+        if (false == p_conn->b_completed)
+        {
+            p_conn->b_completed = true;
+            p_conn->p_completed = p_completed;
+            p_completed = p_conn;
+        }
+    }
+    
+    while (NULL != p_completed)
+    {
+        server_conn_t * p_conn = p_completed;
+        p_completed = p_conn->p_completed;
+        p_conn->p_completed = NULL;
+        p_conn->b_completed = false;
+        
+        // A response finished ahead of an earlier request's waits for it.
+        while ((p_conn->num_ready < p_conn->num_slots) &&
+               (true == p_conn->slots[(p_conn->head + p_conn->num_ready) %
+                                      p_reactor->max_inflight].b_done))
+        {
+            p_conn->num_ready++;
+        }
+        server_service(p_conn);
+    }
+}
+
+/*!
+ * @brief This is a static function that runs the epoll reactor until
+ *          server_stop is called.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+server_epoll_run (server_reactor_t * p_reactor)
+{
+    int status = -1;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (false == atomic_load(&(p_reactor->p_server->b_stop)))
+    {
+        int num_events = epoll_wait(p_reactor->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (-1 == num_events)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            goto EXIT;
+        }
+        
+        bool b_complete = false;
+        for (int idx = 0; idx < num_events; ++idx)
+        {
+            void * p_data = events[idx].data.ptr;
+            if (&(p_reactor->listen_fd) == p_data)
+            {
+                server_accept(p_reactor);
+            }
+            else if (&(p_reactor->event_fd) == p_data)
+            {
+                b_complete = true;
+            }
+            else
+            {
+                server_conn_t * p_conn = p_data;
+                if (0 != (events[idx].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                {
+                    p_conn->b_readable = true;
+                }
+                server_epoll_service(p_conn);
+            }
+        }
+        
+        // Completions free closed connections, so they are handled last.
+        if (true == b_complete)
+        {
+            uint64_t count = 0;
+            ssize_t ret = read(p_reactor->event_fd, &count, sizeof(count));
+            (void) ret;
+            server_complete(p_reactor);
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that runs the io_uring reactor until
+ *          server_stop is called.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+server_uring_run (server_reactor_t * p_reactor)
+{
+    int status = -1;
+    if ((-1 == server_uring_accept(p_reactor)) ||
+        (-1 == server_uring_wake(p_reactor)))
+    {
+        goto EXIT;
+    }
+    
+    while (false == atomic_load(&(p_reactor->p_server->b_stop)))
+    {
+        // One system call submits everything queued since the last pass
+        // and waits for the next completion.
+        if (-1 == uring_submit(p_reactor->p_ring, 1))
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            goto EXIT;
+        }
+        
+        bool b_complete = false;
+        if (-1 == server_uring_reap(p_reactor, &b_complete))
+        {
+            goto EXIT;
+        }
+        
+        // Completions free closed connections, so they are handled last.
+        if (true == b_complete)
+        {
+            server_complete(p_reactor);
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that defines a reactor thread. It
+ *          runs the reactor's event loop, and stops the other reactors
+ *          if the loop fails.
+ *
+ * @param[in/out] p_arg The reactor. Void pointer is used for compliance
+ *                  with the pthread_create function's specs.
+ *
+ * @return NULL.
+ */
+static void *
+server_reactor_main (void * p_arg)
+{
+    server_reactor_t * p_reactor = p_arg;
+    if (SERVER_BACKEND_URING == p_reactor->backend)
+    {
+        p_reactor->status = server_uring_run(p_reactor);
+    }
+    else
+    {
+        p_reactor->status = server_epoll_run(p_reactor);
+    }
+    if (-1 == p_reactor->status)
+    {
+        server_stop(p_reactor->p_server);
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This is a static function that defines a threadpool job that
+ *          handles a request from the shared-memory segment, in place,
+ *          and publishes its response.
+ *
+ * @param[in] pb_shutdown Unused.
+ * @param[in/out] p_job The request's job.
+ *
+ * @return No return value expected.
+ */
+static void
+server_shm_work (_Atomic bool * pb_shutdown, server_shm_job_t * p_job)
+{
+    (void) pb_shutdown;
+    server_t * p_server = p_job->p_server;
+    memset(p_job->req.p_response, 0, SERVER_RESP_SIZE);
+    p_server->handle_func(p_job->req.p_request, p_job->req.p_response, p_server->p_ctx);
+    (void) shm_respond(p_server->p_shm, &(p_job->req));
+}
+
+/*!
+ * @brief This is a static function that defines the thread polling the
+ *          shared-memory segment. It hands the requests it takes to the
+ *          first reactor's threadpool in batches, and sleeps while no
+ *          client sends any.
+ *
+ * @param[in/out] p_arg The server. Void pointer is used for compliance
+ *                  with the pthread_create function's specs.
+ *
+ * @return NULL.
+ */
+static void *
+server_shm_main (void * p_arg)
+{
+    server_t * p_server = p_arg;
+    shm_t * p_shm = p_server->p_shm;
+    size_t depth = shm_depth(p_shm);
+    shm_req_t reqs[THREADPOOL_ENQ_BATCH];
+    job_t jobs[THREADPOOL_ENQ_BATCH];
+    while (false == atomic_load(&(p_server->b_stop)))
+    {
+        size_t num_reqs = shm_poll(p_shm, reqs, THREADPOOL_ENQ_BATCH);
+        if (0 == num_reqs)
+        {
+            (void) shm_wait(p_shm);
+            continue;
+        }
+        
+        // A slot's job is free again once its response was read, as the
+        // client cannot reuse the slot before then.
+        for (size_t idx = 0; idx < num_reqs; ++idx)
+        {
+            server_shm_job_t * p_job = p_server->p_shm_jobs +
+                                       (reqs[idx].channel * depth) +
+                                       (reqs[idx].seq & (depth - 1));
+            p_job->req = reqs[idx];
+            jobs[idx].job_func = (job_f) server_shm_work;
+            jobs[idx].p_arg = p_job;
+        }
+        if (-1 == threadpool_enq_batch(p_server->p_reactors[0].p_tp, jobs, num_reqs))
+        {
+            for (size_t idx = 0; idx < num_reqs; ++idx)
+            {
+                server_shm_work(NULL, jobs[idx].p_arg);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This is a static function that sets up a reactor: its I/O
+ *          backend, its listening socket and eventfd, its connection
+ *          pool and done ring, and its threadpool shard if pinned.
+ *
+ * @param[in/out] p_reactor The reactor, with its descriptors set to -1.
+ * @param[in] p_attr The server's creation attributes.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+server_reactor_setup (server_reactor_t * p_reactor, const server_attr_t * p_attr)
+{
+    int status = -1;
+    server_t * p_server = p_reactor->p_server;
+    p_reactor->backend = p_server->backend;
+    p_reactor->max_conns = (p_attr->max_conns + p_attr->num_reactors - 1) / p_attr->num_reactors;
+    p_reactor->max_inflight = p_attr->max_inflight;
+    
+    // Set up io_uring first, as the other descriptors depend on the
+    // backend in use. If the first reactor's kernel cannot run it, the
+    // whole server falls back to epoll. A connection has at most one
+    // receive in flight, so a buffer per connection keeps receives from
+    // running dry.
+    if (SERVER_BACKEND_URING == p_reactor->backend)
+    {
+        unsigned num_bufs = 1;
+        while ((num_bufs < p_reactor->max_conns) &&
+               (num_bufs < SERVER_URING_MAX_BUFS))
+        {
+            num_bufs <<= 1;
+        }
+        p_reactor->p_ring = uring_create(SERVER_URING_ENTRIES);
+        if (NULL != p_reactor->p_ring)
+        {
+            p_reactor->p_bufs = uring_bufs_create(p_reactor->p_ring, 0, num_bufs,
+                                                  SERVER_URING_BUF_SIZE);
+        }
+        if (NULL == p_reactor->p_bufs)
+        {
+            uring_destroy(p_reactor->p_ring);
+            p_reactor->p_ring = NULL;
+            if (0 != p_reactor->index)
+            {
+                goto EXIT;
+            }
+            p_server->backend = SERVER_BACKEND_EPOLL;
+            p_reactor->backend = SERVER_BACKEND_EPOLL;
+        }
+    }
+    
+    // Bind the listening socket. io_uring waits for sockets itself, so
+    // they are only non-blocking for epoll. Reactors after the first
+    // bind the port the first one got.
+    int sock_flags = SOCK_CLOEXEC;
+    if (SERVER_BACKEND_EPOLL == p_reactor->backend)
+    {
+        sock_flags |= SOCK_NONBLOCK;
+    }
+    p_reactor->listen_fd = socket(AF_INET, SOCK_STREAM | sock_flags, 0);
+    if (-1 == p_reactor->listen_fd)
+    {
+        goto EXIT;
+    }
+    int one = 1;
+    (void) setsockopt(p_reactor->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if ((p_attr->num_reactors > 1) &&
+        (-1 == setsockopt(p_reactor->listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))))
+    {
+        goto EXIT;
+    }
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((0 == p_reactor->index) ? p_attr->port : p_server->port);
+    socklen_t addr_len = sizeof(addr);
+    if ((-1 == bind(p_reactor->listen_fd, (struct sockaddr *) &addr, sizeof(addr))) ||
+        (-1 == listen(p_reactor->listen_fd, p_attr->backlog)) ||
+        (-1 == getsockname(p_reactor->listen_fd, (struct sockaddr *) &addr, &addr_len)))
+    {
+        goto EXIT;
+    }
+    p_server->port = ntohs(addr.sin_port);
+    
+    p_reactor->event_fd = eventfd(0, EFD_CLOEXEC |
+                                  ((SERVER_BACKEND_EPOLL == p_reactor->backend) ? EFD_NONBLOCK : 0));
+    if (-1 == p_reactor->event_fd)
+    {
+        goto EXIT;
+    }
+    
+    // Register the listening socket and the eventfd. Their addresses in
+    // the reactor tell their events apart from connections.
+    if (SERVER_BACKEND_EPOLL == p_reactor->backend)
+    {
+        p_reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (-1 == p_reactor->epoll_fd)
+        {
+            goto EXIT;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = &(p_reactor->listen_fd);
+        if (-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, p_reactor->listen_fd, &event))
+        {
+            goto EXIT;
+        }
+        event.data.ptr = &(p_reactor->event_fd);
+        if (-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, p_reactor->event_fd, &event))
+        {
+            goto EXIT;
+        }
+    }
+    
+    // A done ring with room for every slot of every connection never
+    // fills.
+    size_t ring_size = 1;
+    while (ring_size < (p_reactor->max_conns * p_reactor->max_inflight))
+    {
+        ring_size <<= 1;
+    }
+    p_reactor->p_conn_pool = pool_create(sizeof(server_conn_t) +
+                                         (p_reactor->max_inflight * sizeof(server_slot_t)), 0);
+    p_reactor->p_done = ring_create(ring_size);
+    if ((NULL == p_reactor->p_conn_pool) ||
+        (NULL == p_reactor->p_done))
+    {
+        goto EXIT;
+    }
+    
+    // A pinned reactor's shard runs on the reactor's processor, with its
+    // share of the workers. Every shard gets at least one.
+    p_reactor->p_tp = p_server->p_tp;
+    if (true == p_server->b_pinned)
+    {
+        threadpool_attr_t tp_attr;
+        (void) threadpool_attr_init(&tp_attr);
+        tp_attr.num_threads = p_attr->num_workers / p_attr->num_reactors;
+        if (p_reactor->index < (p_attr->num_workers % p_attr->num_reactors))
+        {
+            tp_attr.num_threads++;
+        }
+        if (0 == tp_attr.num_threads)
+        {
+            tp_attr.num_threads = 1;
+        }
+        tp_attr.cpu = p_reactor->cpu;
+        p_reactor->p_tp = threadpool_create_attr(&tp_attr);
+        if (NULL == p_reactor->p_tp)
+        {
+            goto EXIT;
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that closes every connection of a
+ *          reactor and releases its resources. Its threadpool must have
+ *          been destroyed.
+ *
+ * @param[in/out] p_reactor The reactor.
+ *
+ * @return No return value expected.
+ */
+static void
+server_reactor_teardown (server_reactor_t * p_reactor)
+{
+    // Free the connections of requests that finished while closed, then
+    // close every open one.
+    if (NULL != p_reactor->p_done)
+    {
+        server_slot_t * p_slot = NULL;
+        while (NULL != (p_slot = ring_try_deq(p_reactor->p_done)))
+        {
+            server_conn_t * p_conn = p_slot->p_conn;
+            p_conn->num_busy--;
+            p_slot->b_done = true;
+            if (-1 == p_conn->fd)
+            {
+                server_release(p_conn);
+            }
+        }
+    }
+    while (NULL != p_reactor->p_conns)
+    {
+        server_close(p_reactor->p_conns);
+    }
+    
+    // Closed connections with io_uring operations in flight are freed as
+    // the operations complete, before the kernel lets go of the ring.
+    if (NULL != p_reactor->p_ring)
+    {
+        while (0 != p_reactor->num_conns)
+        {
+            if (-1 == uring_submit(p_reactor->p_ring, 1))
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                break;
+            }
+            bool b_complete = false;
+            (void) server_uring_reap(p_reactor, &b_complete);
+        }
+    }
+    uring_bufs_destroy(p_reactor->p_bufs);
+    p_reactor->p_bufs = NULL;
+    uring_destroy(p_reactor->p_ring);
+    p_reactor->p_ring = NULL;
+    
+    ring_destroy(p_reactor->p_done);
+    p_reactor->p_done = NULL;
+    pool_destroy(p_reactor->p_conn_pool);
+    p_reactor->p_conn_pool = NULL;
+    
+    if (-1 != p_reactor->event_fd)
+    {
+        close(p_reactor->event_fd);
+    }
+    if (-1 != p_reactor->epoll_fd)
+    {
+        close(p_reactor->epoll_fd);
+    }
+    if (-1 != p_reactor->listen_fd)
+    {
+        close(p_reactor->listen_fd);
+    }
+}
+
+/*!
+ * @brief This function initializes server attributes to their defaults.
+ *
+ * @param[out] p_attr The attributes to initialize.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+server_attr_init (server_attr_t * p_attr)
+{
+    int status = -1;
+    if (NULL == p_attr)
+    {
+        goto EXIT;
+    }
+    
+    p_attr->port = SERVER_DEFAULT_PORT;
+    p_attr->num_workers = SERVER_DEFAULT_WORKERS;
+    p_attr->backlog = SERVER_DEFAULT_BACKLOG;
+    p_attr->max_conns = SERVER_DEFAULT_MAX_CONNS;
+    p_attr->backend = SERVER_BACKEND_EPOLL;
+    p_attr->max_inflight = SERVER_DEFAULT_MAX_INFLIGHT;
+    p_attr->num_reactors = SERVER_DEFAULT_REACTORS;
+    p_attr->b_pinned = false;
+    p_attr->p_shm_name = NULL;
+    p_attr->shm_channels = SERVER_DEFAULT_SHM_CHANNELS;
+    p_attr->shm_depth = SERVER_DEFAULT_SHM_DEPTH;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function instantiates a new server, bound and listening,
+ *          with its threadpool started.
+ *
+ * @param[in] p_attr The creation attributes.
+ * @param[in] handle_func The request handler.
+ * @param[in] p_ctx The context passed to the request handler.
+ *
+ * @return Pointer to new server context. NULL on error.
+ */
+server_t *
+server_create (const server_attr_t * p_attr, server_handle_f handle_func, void * p_ctx)
+{
+    int status = -1;
+    server_t * p_server = NULL;
+    if ((NULL == p_attr) ||
+        (NULL == handle_func) ||
+        (0 == p_attr->num_workers) ||
+        (0 == p_attr->max_conns) ||
+        (0 == p_attr->max_inflight) ||
+        (p_attr->max_inflight > SERVER_MAX_INFLIGHT) ||
+        (0 == p_attr->num_reactors))
+    {
+        goto EXIT;
+    }
+    
+    p_server = malloc(sizeof(server_t));
+    if (NULL == p_server)
+    {
+        goto EXIT;
+    }
+    p_server->backend = p_attr->backend;
+    p_server->port = 0;
+    p_server->p_reactors = NULL;
+    p_server->num_reactors = 0;
+    p_server->b_pinned = p_attr->b_pinned;
+    p_server->p_tp = NULL;
+    p_server->handle_func = handle_func;
+    p_server->p_ctx = p_ctx;
+    atomic_init(&(p_server->b_stop), false);
+    p_server->p_shm = NULL;
+    p_server->p_shm_jobs = NULL;
+    p_server->b_shm_thread = false;
+    
+    // The reactors are cache line aligned for their counters.
+    size_t reactors_size = p_attr->num_reactors * sizeof(server_reactor_t);
+    p_server->p_reactors = aligned_alloc(SERVER_CACHE_LINE, reactors_size);
+    if (NULL == p_server->p_reactors)
+    {
+        goto EXIT;
+    }
+    memset(p_server->p_reactors, 0, reactors_size);
+    
+    // Pinned reactors take the processors the process may run on in
+    // turn.
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if ((true == p_server->b_pinned) &&
+        (-1 == sched_getaffinity(0, sizeof(cpus), &cpus)))
+    {
+        goto EXIT;
+    }
+    int cpu = THREADPOOL_CPU_ANY;
+    for (size_t idx = 0; idx < p_attr->num_reactors; ++idx)
+    {
+        server_reactor_t * p_reactor = p_server->p_reactors + idx;
+        p_reactor->p_server = p_server;
+        p_reactor->index = idx;
+        p_reactor->cpu = THREADPOOL_CPU_ANY;
+        p_reactor->listen_fd = -1;
+        p_reactor->epoll_fd = -1;
+        p_reactor->event_fd = -1;
+        atomic_init(&(p_reactor->b_kicked), false);
+        if (true == p_server->b_pinned)
+        {
+            do
+            {
+                cpu = (cpu + 1) % CPU_SETSIZE;
+            } while (!CPU_ISSET(cpu, &cpus));
+            p_reactor->cpu = cpu;
+        }
+    }
+    p_server->num_reactors = p_attr->num_reactors;
+    
+    if (false == p_server->b_pinned)
+    {
+        p_server->p_tp = threadpool_create(p_attr->num_workers);
+        if (NULL == p_server->p_tp)
+        {
+            goto EXIT;
+        }
+    }
+    for (size_t idx = 0; idx < p_server->num_reactors; ++idx)
+    {
+        if (-1 == server_reactor_setup(p_server->p_reactors + idx, p_attr))
+        {
+            goto EXIT;
+        }
+    }
+    
+    if (NULL != p_attr->p_shm_name)
+    {
+        p_server->p_shm = shm_create(p_attr->p_shm_name, p_attr->shm_channels,
+                                     p_attr->shm_depth);
+        if (NULL == p_server->p_shm)
+        {
+            goto EXIT;
+        }
+        p_server->p_shm_jobs = calloc(p_attr->shm_channels * p_attr->shm_depth,
+                                      sizeof(server_shm_job_t));
+        if (NULL == p_server->p_shm_jobs)
+        {
+            goto EXIT;
+        }
+        for (size_t idx = 0; idx < (p_attr->shm_channels * p_attr->shm_depth); ++idx)
+        {
+            p_server->p_shm_jobs[idx].p_server = p_server;
+        }
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_server))
+        {
+            server_destroy(p_server);
+            p_server = NULL;
+        }
+        return p_server;
+}
+
+/*!
+ * @brief This function destroys a server context, closing every
+ *          connection. server_run must have returned.
+ *
+ * @param[in/out] p_server The server context.
+ *
+ * @return No return value expected.
+ */
+void
+server_destroy (server_t * p_server)
+{
+    if (NULL == p_server)
+    {
+        goto EXIT;
+    }
+    
+    // Let requests in flight finish on every threadpool first, as a
+    // shared one posts to every reactor. Nothing accepted from here on
+    // is kept.
+    atomic_store(&(p_server->b_stop), true);
+    for (size_t idx = 0; idx < p_server->num_reactors; ++idx)
+    {
+        server_reactor_t * p_reactor = p_server->p_reactors + idx;
+        if ((NULL != p_reactor->p_tp) &&
+            (p_server->p_tp != p_reactor->p_tp))
+        {
+            threadpool_destroy(p_reactor->p_tp);
+        }
+        p_reactor->p_tp = NULL;
+    }
+    if (NULL != p_server->p_tp)
+    {
+        threadpool_destroy(p_server->p_tp);
+        p_server->p_tp = NULL;
+    }
+    
+    for (size_t idx = 0; idx < p_server->num_reactors; ++idx)
+    {
+        server_reactor_teardown(p_server->p_reactors + idx);
+    }
+    free(p_server->p_reactors);
+    p_server->p_reactors = NULL;
+    shm_destroy(p_server->p_shm);
+    p_server->p_shm = NULL;
+    free(p_server->p_shm_jobs);
+    p_server->p_shm_jobs = NULL;
+    
+    free(p_server);
+    p_server = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function runs the reactors, each on its own thread, and
+ *          the shared-memory poller if any, until server_stop is called,
+ *          and waits for them.
+ *
+ * @param[in/out] p_server The server context.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+server_run (server_t * p_server)
+{
+    int status = -1;
+    if (NULL == p_server)
+    {
+        goto EXIT;
+    }
+    
+    // Start every reactor, pinned if asked for. If one cannot start, the
+    // ones already running are stopped.
+    status = 0;
+    for (size_t idx = 0; idx < p_server->num_reactors; ++idx)
+    {
+        server_reactor_t * p_reactor = p_server->p_reactors + idx;
+        pthread_attr_t attr;
+        if (0 != pthread_attr_init(&attr))
+        {
+            status = -1;
+            break;
+        }
+        if (THREADPOOL_CPU_ANY != p_reactor->cpu)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(p_reactor->cpu, &cpus);
+            (void) pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        int ret = pthread_create(&(p_reactor->thread), &attr, server_reactor_main, p_reactor);
+        pthread_attr_destroy(&attr);
+        if (0 != ret)
+        {
+            status = -1;
+            break;
+        }
+        p_reactor->b_thread = true;
+    }
+    if ((0 == status) &&
+        (NULL != p_server->p_shm))
+    {
+        if (0 != pthread_create(&(p_server->shm_thread), NULL, server_shm_main, p_server))
+        {
+            status = -1;
+        }
+        else
+        {
+            p_server->b_shm_thread = true;
+        }
+    }
+    if (-1 == status)
+    {
+        server_stop(p_server);
+    }
+    
+    if (true == p_server->b_shm_thread)
+    {
+        pthread_join(p_server->shm_thread, NULL);
+        p_server->b_shm_thread = false;
+    }    
+    for (size_t idx = 0; idx < p_server->num_reactors; ++idx)
+    {
+        server_reactor_t * p_reactor = p_server->p_reactors + idx;
+        if (true == p_reactor->b_thread)
+        {
+            pthread_join(p_reactor->thread, NULL);
+            p_reactor->b_thread = false;
+            if (-1 == p_reactor->status)
+            {
+                status = -1;
+            }
+        }
+    }
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function asks the reactors and the shared-memory poller to
+ *          return from server_run.
+ *
+ *          It is async-signal-safe, so it may be called from a signal
+ *              handler.
+ *
+ * @param[in/out] p_server The server context.
+ *
+ * @return No return value expected.
+ */
+void
+server_stop (server_t * p_server)
+{
+    if (NULL == p_server)
+    {
+        goto EXIT;
+    }
+    
+    atomic_store(&(p_server->b_stop), true);
+    for (size_t idx = 0; idx < p_server->num_reactors; ++idx)
+    {
+        server_kick(p_server->p_reactors + idx);
+    }
+    shm_wake(p_server->p_shm);
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function returns the port the server listens on.
+ *
+ * @param[in] p_server The server context.
+ *
+ * @return The port. 0 on error.
+ */
+uint16_t
+server_port (server_t * p_server)
+{
+    uint16_t port = 0;
+    if (NULL == p_server)
+    {
+        goto EXIT;
+    }
+    
+    port = p_server->port;
+    
+    EXIT:
+        return port;
+}
+
+/*!
+ * @brief This function returns the I/O backend the server uses, which
+ *          is the epoll backend if io_uring was asked for but is not
+ *          supported.
+ *
+ * @param[in] p_server The server context.
+ *
+ * @return The I/O backend. SERVER_BACKEND_EPOLL on error.
+ */
+server_backend_t
+server_backend (server_t * p_server)
+{
+    server_backend_t backend = SERVER_BACKEND_EPOLL;
+    if (NULL == p_server)
+    {
+        goto EXIT;
+    }
+    
+    backend = p_server->backend;
+    
+    EXIT:
+        return backend;
+}
+
+/*!
+ * @brief This function returns the number of reactors of a server.
+ *
+ * @param[in] p_server The server context.
+ *
+ * @return The number of reactors. 0 on error.
+ */
+size_t
+server_num_reactors (server_t * p_server)
+{
+    size_t num_reactors = 0;
+    if (NULL == p_server)
+    {
+        goto EXIT;
+    }
+    
+    num_reactors = p_server->num_reactors;
+    
+    EXIT:
+        return num_reactors;
+}
+
+/*!
+ * @brief This function takes a snapshot of a reactor's statistics.
+ *
+ *          The counters are read without stopping the reactor, so the
+ *              snapshot is approximate while it runs.
+ *
+ * @param[in] p_server The server context.
+ * @param[in] index The reactor's index, below server_num_reactors.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+server_reactor_stats (server_t * p_server, const size_t index, server_stats_t * p_stats)
+{
+    int status = -1;
+    if ((NULL == p_server) ||
+        (NULL == p_stats) ||
+        (index >= p_server->num_reactors))
+    {
+        goto EXIT;
+    }
+    
+    server_counters_t * p_counters = &(p_server->p_reactors[index].counters);
+    p_stats->accepted = atomic_load_explicit(&(p_counters->accepted), memory_order_relaxed);
+    p_stats->rejected = atomic_load_explicit(&(p_counters->rejected), memory_order_relaxed);
+    p_stats->requests = atomic_load_explicit(&(p_counters->requests), memory_order_relaxed);
+    p_stats->bytes_in = atomic_load_explicit(&(p_counters->bytes_in), memory_order_relaxed);
+    p_stats->bytes_out = atomic_load_explicit(&(p_counters->bytes_out), memory_order_relaxed);
+    
+    // A connection is only counted closed after it was counted accepted.
+    uint64_t closed = atomic_load_explicit(&(p_counters->closed), memory_order_relaxed);
+    p_stats->num_conns = (closed < p_stats->accepted) ? (size_t) (p_stats->accepted - closed) : 0;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
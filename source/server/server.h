@@ -0,0 +1,554 @@
+/*!
+ * @file server/server.h
+ *
+ * @brief This file contains the server's network front end.
+ *
+ *          A reactor thread owns every socket it serves and never
+ *              waits on any one of them. A server runs one or more
+ *              reactors. Each has its own listening socket bound to the
+ *              same port with SO_REUSEPORT, so the kernel spreads new
+ *              connections across them, and its own event loop,
+ *              connections and done ring. With pinning, each reactor
+ *              also gets its own threadpool shard, and the reactor and
+ *              its shard run on one processor, so a request never
+ *              crosses processors between its bytes arriving and its
+ *              response leaving.
+ *
+ *          Each connection has a read buffer that collects bytes until
+ *              complete SERVER_REQ_SIZE request frames are available.
+ *              Every complete frame in the buffer is copied into a
+ *              request slot and the whole pass is handed to a
+ *              threadpool in one batch; the request handler runs on a
+ *              pool thread, and the slot is passed back to the reactor
+ *              through a lock-free ring and an eventfd, so only the
+ *              reactor ever touches a socket.
+ *
+ *          Two I/O backends are available. With the epoll backend, the
+ *              listening socket and all connections are non-blocking
+ *              and registered edge-triggered with one epoll instance,
+ *              and the reactor reads and writes each socket until it
+ *              would block.
+ *              The io_uring backend keeps a multishot accept, one
+ *              receive per connection that picks a buffer from a
+ *              provided buffer ring only when data arrives, and one
+ *              send per connection in flight on the ring, and submits
+ *              everything queued in a pass with the same system call
+ *              that waits for completions. If the kernel cannot run
+ *              the io_uring backend the server falls back to epoll.
+ *
+ *          A client may pipeline requests. A connection's slots form a
+ *              ring in request order, so responses are sent in request
+ *              order however the threads finish them: every finished
+ *              response at the head of the ring is sent with one
+ *              gathered write, straight from the slots. A slot is reused
+ *              once its response is sent, so a connection has at most
+ *              max_inflight requests handled or unsent. Beyond that,
+ *              bytes are left in the read buffer, and a connection whose
+ *              read buffer is full is simply not read from, pushing back
+ *              on the client through TCP.
+ *
+ *          Clients on the same host may also talk to the server through
+ *              a shared-memory segment instead of TCP, with the same
+ *              frames. A poller thread takes their requests off the
+ *              segment in batches and hands them to the first reactor's
+ *              threadpool, whose threads write the responses straight
+ *              back into the segment.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - server_attr_init
+ *              - server_create
+ *              - server_destroy
+ *              - server_run
+ *              - server_stop
+ *              - server_port
+ *              - server_backend
+ *              - server_num_reactors
+ *              - server_reactor_stats
+ */
+
+#ifndef SERVER_SERVER_H
+#define SERVER_SERVER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "../common/pool.h"
+#include "../common/ring.h"
+#include "../common/shm.h"
+#include "../common/threadpool.h"
+#include "../common/uring.h"
+
+/*!
+ * @brief The size of a request frame, in bytes.
+ */
+#define SERVER_REQ_SIZE 256
+
+/*!
+ * @brief The size of a response frame, in bytes.
+ */
+#define SERVER_RESP_SIZE 128
+
+/*!
+ * @brief The number of request frames a connection's read buffer holds.
+ */
+#define SERVER_READ_FRAMES 16
+
+/*!
+ * @brief The largest per-connection in-flight limit. A connection's
+ *          requests of one pass then fit a single critical section of
+ *          threadpool_enq_batch.
+ */
+#define SERVER_MAX_INFLIGHT THREADPOOL_ENQ_BATCH
+
+/*!
+ * @brief The cache line size reactors are aligned to.
+ */
+#define SERVER_CACHE_LINE 64
+
+/*!
+ * @brief The most events the reactor takes from epoll per wakeup.
+ */
+#define SERVER_MAX_EVENTS 64
+
+/*!
+ * @brief The number of submission entries of the io_uring backend. A
+ *          pass that queues more submits the ring early.
+ */
+#define SERVER_URING_ENTRIES 256
+
+/*!
+ * @brief The most buffers in the io_uring backend's provided buffer
+ *          ring.
+ */
+#define SERVER_URING_MAX_BUFS 4096
+
+/*!
+ * @brief The size of each provided buffer, and so the most bytes one
+ *          io_uring receive takes.
+ */
+#define SERVER_URING_BUF_SIZE (SERVER_REQ_SIZE * 4)
+
+/*!
+ * @brief Default server attributes.
+ */
+#define SERVER_DEFAULT_PORT 8000
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_DEFAULT_BACKLOG 128
+#define SERVER_DEFAULT_MAX_CONNS 1024
+#define SERVER_DEFAULT_MAX_INFLIGHT 8
+#define SERVER_DEFAULT_REACTORS 1
+#define SERVER_DEFAULT_SHM_CHANNELS 16
+#define SERVER_DEFAULT_SHM_DEPTH 64
+
+typedef struct _server server_t;
+typedef struct _server_reactor server_reactor_t;
+typedef struct _server_conn server_conn_t;
+
+/*!
+ * @brief This enumeration defines the server's I/O backends.
+ */
+typedef enum _server_backend
+{
+    SERVER_BACKEND_EPOLL,
+    SERVER_BACKEND_URING,
+} server_backend_t;
+
+/*!
+ * @brief This datatype defines a function template for the request
+ *          handler. It runs on a threadpool thread.
+ *
+ * @param p_request The request frame, SERVER_REQ_SIZE bytes.
+ * @param p_response The response frame to fill, SERVER_RESP_SIZE bytes.
+ *          It is zeroed before the call.
+ * @param p_ctx The context registered with the handler.
+ *
+ * @return No return value expected.
+ */
+typedef void (*server_handle_f)(const unsigned char * p_request,
+                                unsigned char * p_response, void * p_ctx);
+
+/*!
+ * @brief This datatype defines the creation attributes of a server. It
+ *          should be initialized with server_attr_init before individual
+ *          fields are set.
+ *
+ * @param port The TCP port to listen on. 0 picks an ephemeral port,
+ *          reported by server_port.
+ * @param num_workers The number of threadpool threads running the
+ *          request handler, in all. Must be non-zero. Pinned reactors
+ *          split them as evenly as they can, each getting at least one.
+ * @param backlog The listen backlog.
+ * @param max_conns The most connections open at once, split evenly
+ *          among the reactors. Connections beyond a reactor's share are
+ *          accepted and closed at once. Must be non-zero.
+ * @param backend The I/O backend. SERVER_BACKEND_URING falls back to
+ *          SERVER_BACKEND_EPOLL if the kernel cannot run it.
+ * @param max_inflight The most requests per connection handled or with
+ *          their response unsent. Must be between 1 and
+ *          SERVER_MAX_INFLIGHT.
+ * @param num_reactors The number of reactor threads. Must be non-zero.
+ * @param b_pinned Whether each reactor gets its own threadpool shard of
+ *          its share of num_workers, pinned with the reactor to one of the
+ *          processors the process may run on, taken in turn. Otherwise
+ *          all reactors share one threadpool of num_workers threads and
+ *          nothing is pinned.
+ * @param p_shm_name The name of the shared-memory segment to serve local
+ *          clients on, starting with a slash. NULL serves TCP only.
+ * @param shm_channels The number of local clients attached at once.
+ * @param shm_depth The most requests in flight per local client. Must
+ *          be a power of two.
+ */
+typedef struct _server_attr
+{
+    uint16_t         port;
+    size_t           num_workers;
+    int              backlog;
+    size_t           max_conns;
+    server_backend_t backend;
+    size_t           max_inflight;
+    size_t           num_reactors;
+    bool             b_pinned;
+    const char *     p_shm_name;
+    size_t           shm_channels;
+    size_t           shm_depth;
+} server_attr_t;
+
+/*!
+ * @brief This datatype defines a reactor's counters. They are written
+ *          only by the reactor thread and read by snapshots.
+ *
+ * @param accepted Connections accepted and kept.
+ * @param rejected Connections accepted and closed at once, because the
+ *          reactor was full or stopping.
+ * @param closed Connections closed.
+ * @param requests Requests handed to the threadpool.
+ * @param bytes_in Bytes received.
+ * @param bytes_out Bytes sent.
+ */
+typedef struct _server_counters
+{
+    _Atomic uint64_t accepted;
+    _Atomic uint64_t rejected;
+    _Atomic uint64_t closed;
+    _Atomic uint64_t requests;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+} server_counters_t;
+
+/*!
+ * @brief This datatype defines a snapshot of a reactor's statistics.
+ *          Throughput is the difference between two snapshots.
+ *
+ * @param num_conns The number of connections open.
+ * @param accepted Connections accepted and kept.
+ * @param rejected Connections accepted and closed at once.
+ * @param requests Requests handed to the threadpool.
+ * @param bytes_in Bytes received.
+ * @param bytes_out Bytes sent.
+ */
+typedef struct _server_stats
+{
+    size_t   num_conns;
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t requests;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} server_stats_t;
+
+/*!
+ * @brief This datatype defines a request slot of a connection. It is
+ *          owned by a threadpool thread while its request is handled,
+ *          and by the reactor otherwise.
+ *
+ * @param p_conn The connection the slot belongs to.
+ * @param b_done Whether the response is ready to send.
+ * @param request The request frame.
+ * @param response The response frame.
+ */
+typedef struct _server_slot
+{
+    server_conn_t *  p_conn;
+    bool             b_done;
+    unsigned char    request[SERVER_REQ_SIZE];
+    unsigned char    response[SERVER_RESP_SIZE];
+} server_slot_t;
+
+/*!
+ * @brief This datatype defines a client connection. It is owned by the
+ *          reactor thread, except for the slots being handled.
+ *
+ * @param p_reactor The reactor serving the connection.
+ * @param p_prev The previous open connection.
+ * @param p_next The next open connection.
+ * @param p_completed The next connection with responses completed in
+ *          the same drain of the done ring.
+ * @param fd The socket. -1 once closed.
+ * @param read_len The number of bytes in the read buffer.
+ * @param head The slot of the oldest request.
+ * @param num_slots The number of slots in use, from head on.
+ * @param num_busy The number of slots being handled.
+ * @param num_ready The number of slots from head on whose response is
+ *          ready to send.
+ * @param send_off The number of bytes of the head slot's response
+ *          already sent.
+ * @param pending The number of io_uring operations in flight.
+ * @param b_completed Whether the connection is on a completed list.
+ * @param b_readable Whether the socket may have bytes left to read.
+ * @param b_eof Whether the peer has shut down its side.
+ * @param b_receiving Whether an io_uring receive is in flight.
+ * @param b_sending Whether an io_uring send is in flight. The slots it
+ *          sends stay in place until it completes.
+ * @param read_buf The read buffer.
+ * @param msg The message header of the gathered write.
+ * @param iov The gathered write's pieces, one per ready response.
+ * @param slots The request slots, max_inflight of them.
+ */
+struct _server_conn
+{
+    server_reactor_t *  p_reactor;
+    server_conn_t *     p_prev;
+    server_conn_t *     p_next;
+    server_conn_t *     p_completed;
+    int                 fd;
+    size_t              read_len;
+    size_t              head;
+    size_t              num_slots;
+    size_t              num_busy;
+    size_t              num_ready;
+    size_t              send_off;
+    size_t              pending;
+    bool                b_completed;
+    bool                b_readable;
+    bool                b_eof;
+    bool                b_receiving;
+    bool                b_sending;
+    unsigned char      read_buf[SERVER_REQ_SIZE *SERVER_READ_FRAMES];
+    struct msghdr       msg;
+    struct iovec        iov[SERVER_MAX_INFLIGHT];
+    server_slot_t       slots[];
+};
+
+/*!
+ * @brief This datatype defines a reactor. Everything but the shared
+ *          threadpool is owned by the reactor thread, apart from the
+ *          done ring and the wakeup, which the threadpool posts to.
+ *
+ * @param p_server The parent server.
+ * @param index The reactor's index in the server.
+ * @param cpu The processor the reactor is pinned to, or
+ *          THREADPOOL_CPU_ANY.
+ * @param thread The reactor thread.
+ * @param b_thread Whether the reactor thread was started.
+ * @param status The result of the reactor's event loop.
+ * @param backend The I/O backend in use.
+ * @param listen_fd The listening socket.
+ * @param epoll_fd The reactor's epoll instance, with the epoll backend.
+ * @param p_ring The reactor's io_uring instance, with the io_uring
+ *          backend.
+ * @param p_bufs The provided buffer ring receives select from.
+ * @param wake_count The eventfd counter read by the io_uring backend.
+ * @param event_fd The eventfd that wakes the reactor for completed
+ *          requests and for server_stop.
+ * @param max_conns The most connections open at once.
+ * @param max_inflight The most slots per connection.
+ * @param num_conns The number of connections open, or closed with
+ *          requests or io_uring operations still in flight.
+ * @param p_conns The open connections.
+ * @param p_conn_pool The object pool for connections.
+ * @param p_done The slots whose request has been handled.
+ * @param p_tp The threadpool running the request handler, either the
+ *          reactor's shard or the server's shared one.
+ * @param b_kicked Whether the eventfd has been written since the reactor
+ *          last drained it.
+ * @param counters The reactor's counters, on their own cache line.
+ */
+struct _server_reactor
+{
+    server_t *          p_server;
+    size_t              index;
+    int                 cpu;
+    pthread_t           thread;
+    bool                b_thread;
+    int                 status;
+    server_backend_t    backend;
+    int                 listen_fd;
+    int                 epoll_fd;
+    uring_t *           p_ring;
+    uring_bufs_t *      p_bufs;
+    uint64_t            wake_count;
+    int                 event_fd;
+    size_t              max_conns;
+    size_t              max_inflight;
+    size_t              num_conns;
+    server_conn_t *     p_conns;
+    pool_t *            p_conn_pool;
+    ring_t *            p_done;
+    threadpool_t *      p_tp;
+    _Atomic bool        b_kicked;
+    _Alignas(SERVER_CACHE_LINE) server_counters_t counters;
+};
+
+/*!
+ * @brief This datatype defines a request taken from the shared-memory
+ *          segment, as handed to the threadpool.
+ *
+ * @param p_server The server.
+ * @param req The request.
+ */
+typedef struct _server_shm_job
+{
+    server_t * p_server;
+    shm_req_t  req;
+} server_shm_job_t;
+
+/*!
+ * @brief This datatype defines a server context.
+ *
+ * @param backend The I/O backend in use.
+ * @param port The port the server listens on.
+ * @param p_reactors The reactors, each on its own cache lines.
+ * @param num_reactors The number of reactors.
+ * @param b_pinned Whether each reactor has its own pinned shard.
+ * @param p_tp The threadpool shared by the reactors, if not pinned.
+ * @param handle_func The request handler.
+ * @param p_ctx The context passed to the request handler.
+ * @param b_stop The reactors' shutdown signal.
+ * @param p_shm The shared-memory segment. NULL if not serving one.
+ * @param p_shm_jobs The jobs of the segment's slots, one per slot.
+ * @param shm_thread The thread polling the segment.
+ * @param b_shm_thread Whether the polling thread is running.
+ */
+struct _server
+{
+    server_backend_t    backend;
+    uint16_t            port;
+    server_reactor_t *  p_reactors;
+    size_t              num_reactors;
+    bool                b_pinned;
+    threadpool_t *      p_tp;
+    server_handle_f     handle_func;
+    void *              p_ctx;
+    _Atomic bool        b_stop;
+    shm_t *             p_shm;
+    server_shm_job_t *  p_shm_jobs;
+    pthread_t           shm_thread;
+    bool                b_shm_thread;
+};
+
+/*!
+ * @brief This function initializes server attributes to their defaults.
+ *
+ * @param[out] p_attr The attributes to initialize.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+server_attr_init (server_attr_t * p_attr);
+
+/*!
+ * @brief This function instantiates a new server, bound and listening,
+ *          with its threadpool started.
+ *
+ * @param[in] p_attr The creation attributes.
+ * @param[in] handle_func The request handler.
+ * @param[in] p_ctx The context passed to the request handler.
+ *
+ * @return Pointer to new server context. NULL on error.
+ */
+server_t *
+server_create (const server_attr_t * p_attr, server_handle_f handle_func, void * p_ctx);
+
+/*!
+ * @brief This function destroys a server context, closing every
+ *          connection. server_run must have returned.
+ *
+ * @param[in/out] p_server The server context.
+ *
+ * @return No return value expected.
+ */
+void
+server_destroy (server_t * p_server);
+
+/*!
+ * @brief This function runs the reactors, each on its own thread, and
+ *          the shared-memory poller if any, until server_stop is called,
+ *          and waits for them.
+ *
+ * @param[in/out] p_server The server context.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+server_run (server_t * p_server);
+
+/*!
+ * @brief This function asks the reactors and the shared-memory poller to
+ *          return from server_run.
+ *
+ *          It is async-signal-safe, so it may be called from a signal
+ *              handler.
+ *
+ * @param[in/out] p_server The server context.
+ *
+ * @return No return value expected.
+ */
+void
+server_stop (server_t * p_server);
+
+/*!
+ * @brief This function returns the port the server listens on.
+ *
+ * @param[in] p_server The server context.
+ *
+ * @return The port. 0 on error.
+ */
+uint16_t
+server_port (server_t * p_server);
+
+/*!
+ * @brief This function returns the I/O backend the server uses, which
+ *          is the epoll backend if io_uring was asked for but is not
+ *          supported.
+ *
+ * @param[in] p_server The server context.
+ *
+ * @return The I/O backend. SERVER_BACKEND_EPOLL on error.
+ */
+server_backend_t
+server_backend (server_t * p_server);
+
+/*!
+ * @brief This function returns the number of reactors of a server.
+ *
+ * @param[in] p_server The server context.
+ *
+ * @return The number of reactors. 0 on error.
+ */
+size_t
+server_num_reactors (server_t * p_server);
+
+/*!
+ * @brief This function takes a snapshot of a reactor's statistics.
+ *
+ *          The counters are read without stopping the reactor, so the
+ *              snapshot is approximate while it runs.
+ *
+ * @param[in] p_server The server context.
+ * @param[in] index The reactor's index, below server_num_reactors.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+server_reactor_stats (server_t * p_server, const size_t index, server_stats_t * p_stats);
+
+#endif // SERVER_SERVER_H
+
+/***   end of file   ***/
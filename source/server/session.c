@@ -0,0 +1,399 @@
+/*!
+ * @file server/session.c
+ *
+ * @brief This file contains the table of logged in sessions.
+ *
+ *          A slot's sid is the only thing that says whether it is open.
+ *              Opening a slot fills in its user and stamp before
+ *              publishing its sid, and closing it swaps the sid to 0
+ *              before the slot goes back on the free stack, so exactly
+ *              one closer wins and a lookup never sees a half open
+ *              slot. A lookup checks the sid again after reading the
+ *              user, in case the slot was closed and reopened for
+ *              another user in between.
+ */
+
+#include <string.h>
+
+#include "session.h"
+
+/*!
+ * @brief The index ending the free stack.
+ */
+#define SESSION_NONE UINT32_MAX
+
+/*!
+ * @brief The mask of a session id's slot index.
+ */
+#define SESSION_INDEX_MASK (SESSION_MAX_CAPACITY - 1)
+
+/*!
+ * @brief The largest generation.
+ */
+#define SESSION_GEN_MAX (UINT32_MAX >> SESSION_INDEX_BITS)
+
+/*!
+ * @brief This is a static function that pushes a slot onto the free
+ *          stack.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] index The slot's index.
+ *
+ * @return No return value expected.
+ */
+static void
+session_push (session_table_t * p_table, const uint32_t index)
+{
+    uint64_t head = atomic_load_explicit(&(p_table->free_head), memory_order_relaxed);
+    uint64_t new_head = 0;
+    do
+    {
+        atomic_store_explicit(&(p_table->p_slots[index].next), (uint32_t) head,
+                              memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) | index;
+    } while (!atomic_compare_exchange_weak_explicit(&(p_table->free_head), &head, new_head,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/*!
+ * @brief This is a static function that pops a slot off the free stack.
+ *
+ * @param[in/out] p_table The session table.
+ *
+ * @return The slot's index. SESSION_NONE if every slot is in use.
+ */
+static uint32_t
+session_pop (session_table_t * p_table)
+{
+    uint64_t head = atomic_load_explicit(&(p_table->free_head), memory_order_acquire);
+    uint32_t index = SESSION_NONE;
+    uint64_t new_head = 0;
+    do
+    {
+        index = (uint32_t) head;
+        if (SESSION_NONE == index)
+        {
+            break;
+        }
+        uint32_t next = atomic_load_explicit(&(p_table->p_slots[index].next),
+                                             memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) | next;
+    } while (!atomic_compare_exchange_weak_explicit(&(p_table->free_head), &head, new_head,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+    return index;
+}
+
+/*!
+ * @brief This function instantiates a new session table with every slot
+ *          free and its clock at 0.
+ *
+ * @param[in] capacity The most sessions open at once. Must be non-zero
+ *              and at most SESSION_MAX_CAPACITY.
+ *
+ * @return Pointer to new session table. NULL on error.
+ */
+session_table_t *
+session_create (const size_t capacity)
+{
+    int status = -1;
+    session_table_t * p_table = NULL;
+    if ((0 == capacity) ||
+        (capacity > SESSION_MAX_CAPACITY))
+    {
+        goto EXIT;
+    }
+    
+    p_table = aligned_alloc(SESSION_CACHE_LINE, sizeof(session_table_t));
+    if (NULL == p_table)
+    {
+        goto EXIT;
+    }
+    memset(p_table, 0, sizeof(session_table_t));
+    p_table->capacity = capacity;
+    atomic_init(&(p_table->free_head), 0);
+    atomic_init(&(p_table->num_open), 0);
+    atomic_init(&(p_table->now), 0);
+    
+    p_table->p_slots = aligned_alloc(SESSION_CACHE_LINE, capacity * sizeof(session_slot_t));
+    if (NULL == p_table->p_slots)
+    {
+        goto EXIT;
+    }
+    
+    // Every slot starts free, stacked in index order.
+    for (size_t idx = 0; idx < capacity; ++idx)
+    {
+        session_slot_t * p_slot = p_table->p_slots + idx;
+        atomic_init(&(p_slot->sid), 0);
+        atomic_init(&(p_slot->next), ((idx + 1) < capacity) ? (uint32_t) (idx + 1) : SESSION_NONE);
+        p_slot->gen = 1;
+        atomic_init(&(p_slot->user), 0);
+        atomic_init(&(p_slot->last_active), 0);
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_table))
+        {
+            session_destroy(p_table);
+            p_table = NULL;
+        }
+        return p_table;
+}
+
+/*!
+ * @brief This function destroys a session table. No other thread may be
+ *          using it.
+ *
+ * @param[in/out] p_table The session table.
+ *
+ * @return No return value expected.
+ */
+void
+session_destroy (session_table_t * p_table)
+{
+    if (NULL == p_table)
+    {
+        goto EXIT;
+    }
+    
+    free(p_table->p_slots);
+    p_table->p_slots = NULL;
+    free(p_table);
+    p_table = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function opens a session for a user, stamped with the
+ *          table's clock.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] user The user the session belongs to.
+ * @param[out] p_sid The new session's id.
+ *
+ * @return 0 on success, -1 on error or if every slot is in use.
+ */
+int
+session_open (session_table_t * p_table, const uint32_t user, uint32_t * p_sid)
+{
+    int status = -1;
+    if ((NULL == p_table) ||
+        (NULL == p_sid))
+    {
+        goto EXIT;
+    }
+    
+    uint32_t index = session_pop(p_table);
+    if (SESSION_NONE == index)
+    {
+        goto EXIT;
+    }
+    
+    // The slot is ours until its sid is published.
+    session_slot_t * p_slot = p_table->p_slots + index;
+    uint32_t sid = (p_slot->gen << SESSION_INDEX_BITS) | index;
+    atomic_store_explicit(&(p_slot->user), user, memory_order_relaxed);
+    atomic_store_explicit(&(p_slot->last_active),
+                          atomic_load_explicit(&(p_table->now), memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&(p_slot->sid), sid, memory_order_release);
+    atomic_fetch_add_explicit(&(p_table->num_open), 1, memory_order_relaxed);
+    *p_sid = sid;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function checks a session id names an open session, and
+ *          stamps the session with the table's clock.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] sid The session id.
+ * @param[out] p_user The user the session belongs to. May be NULL.
+ *
+ * @return 0 if the session is open, -1 on error or if it is not.
+ */
+int
+session_lookup (session_table_t * p_table, const uint32_t sid, uint32_t * p_user)
+{
+    int status = -1;
+    if ((NULL == p_table) ||
+        (0 == sid) ||
+        ((sid & SESSION_INDEX_MASK) >= p_table->capacity))
+    {
+        goto EXIT;
+    }
+    
+    session_slot_t * p_slot = p_table->p_slots + (sid & SESSION_INDEX_MASK);
+    if (sid != atomic_load_explicit(&(p_slot->sid), memory_order_acquire))
+    {
+        goto EXIT;
+    }
+    uint32_t user = atomic_load_explicit(&(p_slot->user), memory_order_acquire);
+    if (sid != atomic_load_explicit(&(p_slot->sid), memory_order_relaxed))
+    {
+        goto EXIT;
+    }
+    
+    // Only write the stamp when the clock has moved, so a busy session's
+    // line is not dirtied on every request.
+    uint64_t now = atomic_load_explicit(&(p_table->now), memory_order_relaxed);
+    if (now != atomic_load_explicit(&(p_slot->last_active), memory_order_relaxed))
+    {
+        atomic_store_explicit(&(p_slot->last_active), now, memory_order_relaxed);
+    }
+    if (NULL != p_user)
+    {
+        *p_user = user;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function closes a session, after which its id is rejected.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] sid The session id.
+ *
+ * @return 0 on success, -1 on error or if the session is not open.
+ */
+int
+session_close (session_table_t * p_table, const uint32_t sid)
+{
+    int status = -1;
+    if ((NULL == p_table) ||
+        (0 == sid) ||
+        ((sid & SESSION_INDEX_MASK) >= p_table->capacity))
+    {
+        goto EXIT;
+    }
+    
+    // Only one closer can swap the sid out.
+    uint32_t index = sid & SESSION_INDEX_MASK;
+    session_slot_t * p_slot = p_table->p_slots + index;
+    uint32_t expected = sid;
+    if (!atomic_compare_exchange_strong_explicit(&(p_slot->sid), &expected, 0,
+                                                 memory_order_acq_rel,
+                                                 memory_order_relaxed))
+    {
+        goto EXIT;
+    }
+    
+    // Move the generation on, skipping 0 so no id is ever 0.
+    uint32_t gen = (sid >> SESSION_INDEX_BITS) + 1;
+    p_slot->gen = (gen > SESSION_GEN_MAX) ? 1 : gen;
+    atomic_fetch_sub_explicit(&(p_table->num_open), 1, memory_order_relaxed);
+    session_push(p_table, index);
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function sets the table's clock, in whatever unit the
+ *          caller measures idle time in. The clock should not go back.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] now The new clock value.
+ *
+ * @return No return value expected.
+ */
+void
+session_tick (session_table_t * p_table, const uint64_t now)
+{
+    if (NULL == p_table)
+    {
+        goto EXIT;
+    }
+    
+    atomic_store_explicit(&(p_table->now), now, memory_order_relaxed);
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function closes every session that has not been used for
+ *          more than max_idle ticks of the table's clock.
+ *
+ *          A session looked up while it is being expired may either be
+ *              closed or kept.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] max_idle The longest idle time kept.
+ *
+ * @return The number of sessions closed. 0 on error.
+ */
+size_t
+session_expire (session_table_t * p_table, const uint64_t max_idle)
+{
+    size_t num_expired = 0;
+    if (NULL == p_table)
+    {
+        goto EXIT;
+    }
+    
+    uint64_t now = atomic_load_explicit(&(p_table->now), memory_order_relaxed);
+    for (size_t idx = 0; idx < p_table->capacity; ++idx)
+    {
+        session_slot_t * p_slot = p_table->p_slots + idx;
+        uint32_t sid = atomic_load_explicit(&(p_slot->sid), memory_order_relaxed);
+        if (0 == sid)
+        {
+            continue;
+        }
+        uint64_t last_active = atomic_load_explicit(&(p_slot->last_active), memory_order_relaxed);
+        if ((last_active < now) &&
+            ((now - last_active) > max_idle) &&
+            (0 == session_close(p_table, sid)))
+        {
+            num_expired++;
+        }
+    }
+    
+    EXIT:
+        return num_expired;
+}
+
+/*!
+ * @brief This function returns the number of open sessions.
+ *
+ *          While other threads are using the table this is only an
+ *              estimate.
+ *
+ * @param[in] p_table The session table.
+ *
+ * @return The number of open sessions. 0 on error.
+ */
+size_t
+session_count (session_table_t * p_table)
+{
+    size_t num_open = 0;
+    if (NULL == p_table)
+    {
+        goto EXIT;
+    }
+    
+    num_open = atomic_load_explicit(&(p_table->num_open), memory_order_relaxed);
+    
+    EXIT:
+        return num_open;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,203 @@
+/*!
+ * @file server/session.h
+ *
+ * @brief This file contains the table of logged in sessions.
+ *
+ *          The table is a fixed array of slots allocated at creation
+ *              time, so opening, checking and closing a session never
+ *              allocate and never hash.
+ *
+ *          A session id is a handle naming a slot by its index, along
+ *              with the slot's generation. A slot's generation moves on
+ *              every time its session is closed, so an id is checked in
+ *              O(1) by comparing it to the id the slot holds, and ids of
+ *              closed sessions are rejected even once their slot is
+ *              reused. Generations start at 1, so 0 is never a valid
+ *              session id.
+ *
+ *          Free slots form a lock-free stack, so any number of threads
+ *              may open, look up and close sessions concurrently.
+ *
+ *          Each session is stamped with the table's clock whenever it
+ *              is looked up, for idle expiry. The clock is only
+ *              advanced by session_tick, so a lookup costs no clock
+ *              read, and a stamp is only written when it changes.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - session_create
+ *              - session_destroy
+ *              - session_open
+ *              - session_lookup
+ *              - session_close
+ *              - session_tick
+ *              - session_expire
+ *              - session_count
+ */
+
+#ifndef SERVER_SESSION_H
+#define SERVER_SESSION_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*!
+ * @brief The assumed cache line size. Each slot has a line of its own,
+ *          so sessions used by different threads do not share one.
+ */
+#define SESSION_CACHE_LINE 64
+
+/*!
+ * @brief The number of low bits of a session id holding the slot index.
+ *          The high bits hold the generation.
+ */
+#define SESSION_INDEX_BITS 16
+
+/*!
+ * @brief The largest number of sessions a table may hold.
+ */
+#define SESSION_MAX_CAPACITY (1u << SESSION_INDEX_BITS)
+
+/*!
+ * @brief This datatype defines a session slot.
+ *
+ * @param sid The id of the slot's open session. 0 if the slot is free.
+ * @param next The index of the next free slot, while free.
+ * @param gen The generation of the slot's next session.
+ * @param user The user the session belongs to.
+ * @param last_active The table's clock when the session was last used.
+ */
+typedef struct _session_slot
+{
+    _Alignas(SESSION_CACHE_LINE) _Atomic uint32_t sid;
+    _Atomic uint32_t next;
+    uint32_t         gen;
+    _Atomic uint32_t user;
+    _Atomic uint64_t last_active;
+} session_slot_t;
+
+/*!
+ * @brief This datatype defines a session table.
+ *
+ * @param p_slots The slots.
+ * @param capacity The number of slots.
+ * @param free_head The free stack's top slot index in the low 32 bits,
+ *          and a count of changes to it in the high 32 bits, so a
+ *          slot popped and pushed back meanwhile fails a pop's
+ *          compare-and-swap.
+ * @param num_open The number of open sessions.
+ * @param now The table's clock.
+ */
+typedef struct _session_table
+{
+    session_slot_t * p_slots;
+    size_t           capacity;
+    _Alignas(SESSION_CACHE_LINE) _Atomic uint64_t free_head;
+    _Atomic size_t   num_open;
+    _Alignas(SESSION_CACHE_LINE) _Atomic uint64_t now;
+} session_table_t;
+
+/*!
+ * @brief This function instantiates a new session table with every slot
+ *          free and its clock at 0.
+ *
+ * @param[in] capacity The most sessions open at once. Must be non-zero
+ *              and at most SESSION_MAX_CAPACITY.
+ *
+ * @return Pointer to new session table. NULL on error.
+ */
+session_table_t *
+session_create (const size_t capacity);
+
+/*!
+ * @brief This function destroys a session table. No other thread may be
+ *          using it.
+ *
+ * @param[in/out] p_table The session table.
+ *
+ * @return No return value expected.
+ */
+void
+session_destroy (session_table_t * p_table);
+
+/*!
+ * @brief This function opens a session for a user, stamped with the
+ *          table's clock.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] user The user the session belongs to.
+ * @param[out] p_sid The new session's id.
+ *
+ * @return 0 on success, -1 on error or if every slot is in use.
+ */
+int
+session_open (session_table_t * p_table, const uint32_t user, uint32_t * p_sid);
+
+/*!
+ * @brief This function checks a session id names an open session, and
+ *          stamps the session with the table's clock.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] sid The session id.
+ * @param[out] p_user The user the session belongs to. May be NULL.
+ *
+ * @return 0 if the session is open, -1 on error or if it is not.
+ */
+int
+session_lookup (session_table_t * p_table, const uint32_t sid, uint32_t * p_user);
+
+/*!
+ * @brief This function closes a session, after which its id is rejected.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] sid The session id.
+ *
+ * @return 0 on success, -1 on error or if the session is not open.
+ */
+int
+session_close (session_table_t * p_table, const uint32_t sid);
+
+/*!
+ * @brief This function sets the table's clock, in whatever unit the
+ *          caller measures idle time in. The clock should not go back.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] now The new clock value.
+ *
+ * @return No return value expected.
+ */
+void
+session_tick (session_table_t * p_table, const uint64_t now);
+
+/*!
+ * @brief This function closes every session that has not been used for
+ *          more than max_idle ticks of the table's clock.
+ *
+ *          A session looked up while it is being expired may either be
+ *              closed or kept.
+ *
+ * @param[in/out] p_table The session table.
+ * @param[in] max_idle The longest idle time kept.
+ *
+ * @return The number of sessions closed. 0 on error.
+ */
+size_t
+session_expire (session_table_t * p_table, const uint64_t max_idle);
+
+/*!
+ * @brief This function returns the number of open sessions.
+ *
+ *          While other threads are using the table this is only an
+ *              estimate.
+ *
+ * @param[in] p_table The session table.
+ *
+ * @return The number of open sessions. 0 on error.
+ */
+size_t
+session_count (session_table_t * p_table);
+
+#endif // SERVER_SESSION_H
+
+/***   end of file   ***/
@@ -0,0 +1,1216 @@
+/*!
+ * @file server/snapshot.c
+ *
+ * @brief This file contains the snapshots of the user index and account
+ *          store that let the server restart without replaying its whole
+ *          log.
+ *
+ *          A snapshot file is named snapshot.<lsn>, the sequence number
+ *              in sixteen hex digits, and written as snapshot.<lsn>.tmp
+ *              first. Loading maps the file read-only and reads the
+ *              records straight out of the mapping, so nothing is copied
+ *              through a buffer and pages the kernel already holds from
+ *              the write are not read again.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+/*!
+ * @brief The prefix of a snapshot's file name, and the suffix of a
+ *          snapshot still being written.
+ */
+#define SNAPSHOT_PREFIX "snapshot."
+#define SNAPSHOT_TEMP ".tmp"
+
+/*!
+ * @brief The number of hex digits of the sequence number in a file name.
+ */
+#define SNAPSHOT_LSN_DIGITS 16
+
+/*!
+ * @brief The smallest capacity of a copy buffer.
+ */
+#define SNAPSHOT_MIN_BUF 4096
+
+/*!
+ * @brief The share of records, as a shift, a copy buffer is sized above
+ *          the table's count, for what is added while it is copied.
+ */
+#define SNAPSHOT_SLACK_SHIFT 3
+
+_Static_assert(sizeof(SNAPSHOT_MAGIC) - 1 == sizeof(((snapshot_header_t *) 0)->magic),
+               "magic fills its field");
+
+/*!
+ * @brief This datatype defines a growing buffer the tables are copied
+ *          into.
+ *
+ * @param p_data The bytes.
+ * @param len The number of bytes used.
+ * @param capacity The number of bytes allocated.
+ * @param count The number of records.
+ */
+typedef struct _snapshot_buf
+{
+    unsigned char * p_data;
+    size_t          len;
+    size_t          capacity;
+    uint64_t        count;
+} snapshot_buf_t;
+
+/*!
+ * @brief This is a static function that returns the current time.
+ *
+ * @return Nanoseconds since an arbitrary point.
+ */
+static uint64_t
+snapshot_now_ns (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000u) + (uint64_t) now.tv_nsec;
+}
+
+/*!
+ * @brief This is a static function that appends a record to a buffer,
+ *          growing it as needed.
+ *
+ * @param[in/out] p_buf The buffer.
+ * @param[in] p_record The record.
+ * @param[in] size The record's size.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_buf_add (snapshot_buf_t * p_buf, const void * p_record, const size_t size)
+{
+    int status = -1;
+    if ((p_buf->len + size) > p_buf->capacity)
+    {
+        size_t capacity = (0 == p_buf->capacity) ? SNAPSHOT_MIN_BUF : (p_buf->capacity * 2);
+        while ((p_buf->len + size) > capacity)
+        {
+            capacity *= 2;
+        }
+        unsigned char * p_data = realloc(p_buf->p_data, capacity);
+        if (NULL == p_data)
+        {
+            errno = ENOMEM;
+            goto EXIT;
+        }
+        p_buf->p_data = p_data;
+        p_buf->capacity = capacity;
+    }
+    
+    memcpy(p_buf->p_data + p_buf->len, p_record, size);
+    p_buf->len += size;
+    p_buf->count++;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that sizes an empty buffer for a
+ *          table's records up front, with some slack, so copying the table
+ *          does not grow it while holding the table's locks.
+ *
+ * @param[in/out] p_buf The buffer.
+ * @param[in] count The number of records in the table.
+ * @param[in] size The size of a record.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_buf_reserve (snapshot_buf_t * p_buf, const size_t count, const size_t size)
+{
+    int status = -1;
+    size_t records = count + (count >> SNAPSHOT_SLACK_SHIFT);
+    if (records > ((SIZE_MAX - SNAPSHOT_MIN_BUF) / size))
+    {
+        errno = ENOMEM;
+        goto EXIT;
+    }
+    
+    size_t capacity = SNAPSHOT_MIN_BUF + (records * size);
+    p_buf->p_data = malloc(capacity);
+    if (NULL == p_buf->p_data)
+    {
+        errno = ENOMEM;
+        goto EXIT;
+    }
+    p_buf->capacity = capacity;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that copies a user into a buffer. It
+ *          is a user_visit_f.
+ *
+ * @param[in] p_entry The user's entry.
+ * @param[in/out] p_ctx The buffer.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_copy_user (const user_entry_t * p_entry, void * p_ctx)
+{
+    int status = -1;
+    size_t uname_len = strnlen(p_entry->username, USER_STR_SIZE);
+    size_t pword_len = strnlen(p_entry->password, USER_STR_SIZE);
+    if ((uname_len >= SNAPSHOT_UNAME_SIZE) ||
+        (pword_len >= SNAPSHOT_PWORD_SIZE))
+    {
+        errno = ENAMETOOLONG;
+        goto EXIT;
+    }
+    
+    snapshot_user_t record;
+    memset(&record, 0, sizeof(record));
+    record.id = htobe32(p_entry->id);
+    memcpy(record.username, p_entry->username, uname_len);
+    memcpy(record.password, p_entry->password, pword_len);
+    status = snapshot_buf_add(p_ctx, &record, sizeof(record));
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that copies an account into a buffer.
+ *          It is an account_visit_f.
+ *
+ * @param[in] id The owner's user id.
+ * @param[in] balance The balance.
+ * @param[in/out] p_ctx The buffer.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_copy_account (const uint32_t id, const uint64_t balance, void * p_ctx)
+{
+    snapshot_account_t record;
+    record.id = htobe32(id);
+    record.balance = htobe64(balance);
+    return snapshot_buf_add(p_ctx, &record, sizeof(record));
+}
+
+/*!
+ * @brief This is a static function that drops users copied twice, and
+ *          makes the copied accounts agree with the copied users. A user
+ *          moved between the index's tables while it was copied can be
+ *          copied twice, alike both times. A user and its account are
+ *          copied at different times, and a registration or deletion
+ *          logged before the snapshot's sequence number may have opened
+ *          or closed the account in between, which replay would not redo.
+ *          An account whose user was not copied is dropped: if the user is
+ *          live, its registration is replayed and opens it again. A user
+ *          copied without an account gets an empty one: the account was
+ *          opened after its stripe was copied, so every balance it has had
+ *          is replayed.
+ *
+ * @param[in/out] p_users The copied users.
+ * @param[in/out] p_accounts The copied accounts.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_reconcile (snapshot_buf_t * p_users, snapshot_buf_t * p_accounts)
+{
+    int status = -1;
+    snapshot_user_t * p_user_recs = (snapshot_user_t *) p_users->p_data;
+    snapshot_account_t * p_account_recs = (snapshot_account_t *) p_accounts->p_data;
+    uint32_t max_id = 0;
+    for (uint64_t idx = 0; idx < p_users->count; ++idx)
+    {
+        uint32_t id = be32toh(p_user_recs[idx].id);
+        max_id = (id > max_id) ? id : max_id;
+    }
+    
+    // Ids are handed out in order, so a bit per id up to the largest is
+    // small next to the copies. The first half marks the copied users, the
+    // second the accounts kept.
+    size_t words = ((size_t) max_id / 64) + 1;
+    uint64_t * p_bits = calloc(2 * words, sizeof(uint64_t));
+    if (NULL == p_bits)
+    {
+        errno = ENOMEM;
+        goto EXIT;
+    }
+    uint64_t * p_has_account = p_bits + words;
+    uint64_t kept = 0;
+    for (uint64_t idx = 0; idx < p_users->count; ++idx)
+    {
+        uint32_t id = be32toh(p_user_recs[idx].id);
+        if (0 != (p_bits[id / 64] & ((uint64_t) 1 << (id % 64))))
+        {
+            continue;
+        }
+        p_bits[id / 64] |= (uint64_t) 1 << (id % 64);
+        p_user_recs[kept++] = p_user_recs[idx];
+    }
+    p_users->count = kept;
+    p_users->len = kept * sizeof(snapshot_user_t);
+    
+    kept = 0;
+    for (uint64_t idx = 0; idx < p_accounts->count; ++idx)
+    {
+        uint32_t id = be32toh(p_account_recs[idx].id);
+        if ((id > max_id) ||
+            (0 == (p_bits[id / 64] & ((uint64_t) 1 << (id % 64)))))
+        {
+            continue;
+        }
+        p_has_account[id / 64] |= (uint64_t) 1 << (id % 64);
+        p_account_recs[kept++] = p_account_recs[idx];
+    }
+    p_accounts->count = kept;
+    p_accounts->len = kept * sizeof(snapshot_account_t);
+    
+    for (uint64_t idx = 0; idx < p_users->count; ++idx)
+    {
+        uint32_t id = be32toh(p_user_recs[idx].id);
+        if (0 != (p_has_account[id / 64] & ((uint64_t) 1 << (id % 64))))
+        {
+            continue;
+        }
+        snapshot_account_t record;
+        record.id = htobe32(id);
+        record.balance = 0;
+        if (-1 == snapshot_buf_add(p_accounts, &record, sizeof(record)))
+        {
+            goto EXIT;
+        }
+    }
+    status = 0;
+    
+    EXIT:
+        free(p_bits);
+        return status;
+}
+
+/*!
+ * @brief This is a static function that builds the path of a snapshot.
+ *
+ * @param[out] p_path The path, SNAPSHOT_PATH_MAX bytes.
+ * @param[in] p_dir The directory.
+ * @param[in] lsn The snapshot's sequence number.
+ * @param[in] b_temp Whether to build the temporary name.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_path (char * p_path, const char * p_dir, const uint64_t lsn, const bool b_temp)
+{
+    int status = -1;
+    int len = snprintf(p_path, SNAPSHOT_PATH_MAX, "%s/" SNAPSHOT_PREFIX "%016" PRIx64 "%s",
+                       p_dir, lsn, (true == b_temp) ? SNAPSHOT_TEMP : "");
+    if ((len < 0) ||
+        (len >= SNAPSHOT_PATH_MAX))
+    {
+        errno = ENAMETOOLONG;
+        goto EXIT;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that parses a file name as a
+ *          snapshot's.
+ *
+ * @param[in] p_name The file name.
+ * @param[out] p_lsn The snapshot's sequence number.
+ * @param[out] p_temp Whether it is a temporary name.
+ *
+ * @return true if the name is a snapshot's, false otherwise.
+ */
+static bool
+snapshot_parse_name (const char * p_name, uint64_t * p_lsn, bool * p_temp)
+{
+    bool b_match = false;
+    size_t prefix_len = sizeof(SNAPSHOT_PREFIX) - 1;
+    if (0 != strncmp(p_name, SNAPSHOT_PREFIX, prefix_len))
+    {
+        goto EXIT;
+    }
+    
+    uint64_t lsn = 0;
+    const char * p_digit = p_name + prefix_len;
+    for (size_t idx = 0; idx < SNAPSHOT_LSN_DIGITS; ++idx)
+    {
+        char digit = p_digit[idx];
+        if (('0' <= digit) && ('9' >= digit))
+        {
+            lsn = (lsn << 4) | (uint64_t) (digit - '0');
+        }
+        else if (('a' <= digit) && ('f' >= digit))
+        {
+            lsn = (lsn << 4) | (uint64_t) (digit - 'a' + 10);
+        }
+        else
+        {
+            goto EXIT;
+        }
+    }
+    
+    const char * p_rest = p_digit + SNAPSHOT_LSN_DIGITS;
+    if ('\0' == *p_rest)
+    {
+        *p_temp = false;
+    }
+    else if (0 == strcmp(p_rest, SNAPSHOT_TEMP))
+    {
+        *p_temp = true;
+    }
+    else
+    {
+        goto EXIT;
+    }
+    *p_lsn = lsn;
+    b_match = true;
+    
+    EXIT:
+        return b_match;
+}
+
+/*!
+ * @brief This is a static function that orders sequence numbers from the
+ *          highest down, for qsort.
+ *
+ * @param[in] vp_lhs A void pointer to the first sequence number.
+ * @param[in] vp_rhs A void pointer to the second sequence number.
+ *
+ * @return Less than, equal to or greater than 0 as the first sorts
+ *          before, with or after the second.
+ */
+static int
+snapshot_compare (const void * vp_lhs, const void * vp_rhs)
+{
+    uint64_t lhs = *(const uint64_t *) vp_lhs;
+    uint64_t rhs = *(const uint64_t *) vp_rhs;
+    return (lhs < rhs) - (lhs > rhs);
+}
+
+/*!
+ * @brief This is a static function that lists the sequence numbers of the
+ *          snapshots in a directory, newest first, and optionally removes
+ *          leftover temporary files.
+ *
+ * @param[in] p_dir The directory.
+ * @param[in] b_clean Whether to remove temporary files.
+ * @param[out] pp_lsns The sequence numbers, to free. NULL if there are
+ *              none.
+ * @param[out] p_count The number of sequence numbers.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_list (const char * p_dir, const bool b_clean, uint64_t ** pp_lsns, size_t * p_count)
+{
+    int status = -1;
+    uint64_t * p_lsns = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    DIR * p_handle = opendir(p_dir);
+    if (NULL == p_handle)
+    {
+        goto EXIT;
+    }
+    
+    struct dirent * p_entry = NULL;
+    while (NULL != (p_entry = readdir(p_handle)))
+    {
+        uint64_t lsn = 0;
+        bool b_temp = false;
+        if (false == snapshot_parse_name(p_entry->d_name, &lsn, &b_temp))
+        {
+            continue;
+        }
+        if (true == b_temp)
+        {
+            if (true == b_clean)
+            {
+                (void) unlinkat(dirfd(p_handle), p_entry->d_name, 0);
+            }
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = (0 == capacity) ? 8 : (capacity * 2);
+            uint64_t * p_grown = realloc(p_lsns, capacity * sizeof(uint64_t));
+            if (NULL == p_grown)
+            {
+                errno = ENOMEM;
+                goto CLOSE;
+            }
+            p_lsns = p_grown;
+        }
+        p_lsns[count++] = lsn;
+    }
+    if (0 != count)
+    {
+        qsort(p_lsns, count, sizeof(uint64_t), snapshot_compare);
+    }
+    *pp_lsns = p_lsns;
+    *p_count = count;
+    p_lsns = NULL;
+    status = 0;
+    
+    CLOSE:
+        closedir(p_handle);
+    EXIT:
+        free(p_lsns);
+        return status;
+}
+
+/*!
+ * @brief This is a static function that writes a whole buffer to a file.
+ *
+ * @param[in] fd The file.
+ * @param[in] p_buf The buffer.
+ * @param[in] len The buffer's length.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_write_all (const int fd, const unsigned char * p_buf, size_t len)
+{
+    int status = -1;
+    while (0 != len)
+    {
+        ssize_t written = write(fd, p_buf, len);
+        if (-1 == written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            goto EXIT;
+        }
+        p_buf += written;
+        len -= (size_t) written;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that syncs a directory, so the files
+ *          renamed into it survive a crash.
+ *
+ * @param[in] p_dir The directory.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_sync_dir (const char * p_dir)
+{
+    int status = -1;
+    int fd = open(p_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == fd)
+    {
+        goto EXIT;
+    }
+    status = fsync(fd);
+    close(fd);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that writes a snapshot file under its
+ *          temporary name, syncs it and renames it into place.
+ *
+ * @param[in] p_dir The directory.
+ * @param[in] p_header The header, checksum filled in.
+ * @param[in] p_users The user records.
+ * @param[in] p_accounts The account records.
+ * @param[in] lsn The snapshot's sequence number.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_store (const char * p_dir, const snapshot_header_t * p_header,
+                const snapshot_buf_t * p_users, const snapshot_buf_t * p_accounts,
+                const uint64_t lsn)
+{
+    int status = -1;
+    char temp[SNAPSHOT_PATH_MAX];
+    char path[SNAPSHOT_PATH_MAX];
+    if ((-1 == snapshot_path(temp, p_dir, lsn, true)) ||
+        (-1 == snapshot_path(path, p_dir, lsn, false)))
+    {
+        goto EXIT;
+    }
+    
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (-1 == fd)
+    {
+        goto EXIT;
+    }
+    if ((-1 == snapshot_write_all(fd, (const unsigned char *) p_header,
+                                  sizeof(snapshot_header_t))) ||
+        (-1 == snapshot_write_all(fd, p_users->p_data, p_users->len)) ||
+        (-1 == snapshot_write_all(fd, p_accounts->p_data, p_accounts->len)) ||
+        (-1 == fdatasync(fd)))
+    {
+        int error = errno;
+        close(fd);
+        unlink(temp);
+        errno = error;
+        goto EXIT;
+    }
+    close(fd);
+    if (-1 == rename(temp, path))
+    {
+        int error = errno;
+        unlink(temp);
+        errno = error;
+        goto EXIT;
+    }
+    status = snapshot_sync_dir(p_dir);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that removes all but the newest
+ *          SNAPSHOT_KEEP snapshots in a directory, and any leftover
+ *          temporary files.
+ *
+ * @param[in] p_dir The directory.
+ *
+ * @return The sequence number of the oldest snapshot kept. 0 if there is
+ *          none or on error.
+ */
+static uint64_t
+snapshot_prune (const char * p_dir)
+{
+    uint64_t oldest = 0;
+    uint64_t * p_lsns = NULL;
+    size_t count = 0;
+    if (-1 == snapshot_list(p_dir, true, &p_lsns, &count))
+    {
+        goto EXIT;
+    }
+    
+    for (size_t idx = SNAPSHOT_KEEP; idx < count; ++idx)
+    {
+        char path[SNAPSHOT_PATH_MAX];
+        if (0 == snapshot_path(path, p_dir, p_lsns[idx], false))
+        {
+            (void) unlink(path);
+        }
+    }
+    if (0 != count)
+    {
+        oldest = p_lsns[((count < SNAPSHOT_KEEP) ? count : SNAPSHOT_KEEP) - 1];
+    }
+    free(p_lsns);
+    
+    EXIT:
+        return oldest;
+}
+
+/*!
+ * @brief This is a static function that takes a snapshot and writes it to
+ *          a directory.
+ *
+ * @param[in] p_dir The directory.
+ * @param[in] p_users The user index.
+ * @param[in] p_accounts The account store.
+ * @param[in/out] p_wal The log. May be NULL.
+ * @param[out] p_lsn The snapshot's sequence number.
+ * @param[out] p_copy_ns How long copying the tables took.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+snapshot_take (const char * p_dir, user_index_t * p_users, account_store_t * p_accounts,
+               wal_t * p_wal, uint64_t * p_lsn, uint64_t * p_copy_ns)
+{
+    int status = -1;
+    snapshot_buf_t users;
+    snapshot_buf_t accounts;
+    memset(&users, 0, sizeof(users));
+    memset(&accounts, 0, sizeof(accounts));
+    
+    // Every record up to here changed the tables before they are copied,
+    // as records are appended while what they change is still locked.
+    uint64_t start_ns = snapshot_now_ns();
+    uint64_t lsn = (NULL == p_wal) ? 0 : wal_last_lsn(p_wal);
+    if ((-1 == snapshot_buf_reserve(&users, user_count(p_users), sizeof(snapshot_user_t))) ||
+        (-1 == snapshot_buf_reserve(&accounts, account_count(p_accounts),
+                                    sizeof(snapshot_account_t))) ||
+        (-1 == user_foreach(p_users, snapshot_copy_user, &users)) ||
+        (-1 == account_foreach(p_accounts, snapshot_copy_account, &accounts)) ||
+        (-1 == snapshot_reconcile(&users, &accounts)))
+    {
+        goto EXIT;
+    }
+    uint32_t next_id = user_next_id(p_users);
+    *p_copy_ns = snapshot_now_ns() - start_ns;
+    
+    // The copy may hold changes logged after lsn. Their records must
+    // outlive a crash as surely as the snapshot does.
+    uint64_t copied_lsn = (NULL == p_wal) ? 0 : wal_last_lsn(p_wal);
+    if ((0 != copied_lsn) &&
+        (-1 == wal_commit(p_wal, copied_lsn)))
+    {
+        goto EXIT;
+    }
+    
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = htobe32(SNAPSHOT_VERSION);
+    header.next_id = htobe32(next_id);
+    header.lsn = htobe64(lsn);
+    header.num_users = htobe64(users.count);
+    header.num_accounts = htobe64(accounts.count);
+    header.user_size = htobe32(sizeof(snapshot_user_t));
+    header.account_size = htobe32(sizeof(snapshot_account_t));
+    uint32_t crc = wal_checksum(0, &header, offsetof(snapshot_header_t, checksum));
+    crc = wal_checksum(crc, users.p_data, users.len);
+    crc = wal_checksum(crc, accounts.p_data, accounts.len);
+    header.checksum = htobe32(crc);
+    if (-1 == snapshot_store(p_dir, &header, &users, &accounts, lsn))
+    {
+        goto EXIT;
+    }
+    
+    // Any snapshot kept may be the one restarted from, should the newer
+    // ones turn out corrupt, so the log is kept from the oldest one on.
+    uint64_t oldest = snapshot_prune(p_dir);
+    if ((NULL != p_wal) &&
+        (0 != oldest))
+    {
+        (void) wal_truncate(p_wal, oldest);
+    }
+    *p_lsn = lsn;
+    status = 0;
+    
+    EXIT:
+        free(users.p_data);
+        free(accounts.p_data);
+        return status;
+}
+
+/*!
+ * @brief This is a static function that maps a snapshot file and checks
+ *          its header and checksum.
+ *
+ * @param[in] p_path The file's path.
+ * @param[in] lsn The sequence number its name carries.
+ * @param[out] p_snapshot The snapshot.
+ *
+ * @return 0 on success, -1 on error. errno is set to EINVAL if the file
+ *          does not check out.
+ */
+static int
+snapshot_map (const char * p_path, const uint64_t lsn, snapshot_t * p_snapshot)
+{
+    int status = -1;
+    void * p_map = MAP_FAILED;
+    size_t size = 0;
+    int fd = open(p_path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
+    {
+        goto EXIT;
+    }
+    struct stat info;
+    if (-1 == fstat(fd, &info))
+    {
+        close(fd);
+        goto EXIT;
+    }
+    size = (size_t) info.st_size;
+    if (size < sizeof(snapshot_header_t))
+    {
+        close(fd);
+        errno = EINVAL;
+        goto EXIT;
+    }
+    p_map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p_map)
+    {
+        goto EXIT;
+    }
+    (void) madvise(p_map, size, MADV_SEQUENTIAL);
+    
+    snapshot_header_t header;
+    memcpy(&header, p_map, sizeof(header));
+    uint64_t num_users = be64toh(header.num_users);
+    uint64_t num_accounts = be64toh(header.num_accounts);
+    size_t body = size - sizeof(header);
+    if ((0 != memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic))) ||
+        (SNAPSHOT_VERSION != be32toh(header.version)) ||
+        (sizeof(snapshot_user_t) != be32toh(header.user_size)) ||
+        (sizeof(snapshot_account_t) != be32toh(header.account_size)) ||
+        (lsn != be64toh(header.lsn)) ||
+        (num_users > (body / sizeof(snapshot_user_t))) ||
+        (num_accounts != ((body - (num_users * sizeof(snapshot_user_t))) /
+                          sizeof(snapshot_account_t))) ||
+        (body != ((num_users * sizeof(snapshot_user_t)) +
+                  (num_accounts * sizeof(snapshot_account_t)))))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    const unsigned char * p_body = (const unsigned char *) p_map + sizeof(header);
+    uint32_t crc = wal_checksum(0, &header, offsetof(snapshot_header_t, checksum));
+    if (be32toh(header.checksum) != wal_checksum(crc, p_body, body))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    p_snapshot->p_map = p_map;
+    p_snapshot->size = size;
+    p_snapshot->lsn = lsn;
+    p_snapshot->next_id = be32toh(header.next_id);
+    p_snapshot->num_users = (size_t) num_users;
+    p_snapshot->num_accounts = (size_t) num_accounts;
+    p_snapshot->p_users = (const snapshot_user_t *) p_body;
+    p_snapshot->p_accounts = (const snapshot_account_t *)
+                             (p_body + (num_users * sizeof(snapshot_user_t)));
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (MAP_FAILED != p_map))
+        {
+            int error = errno;
+            munmap(p_map, size);
+            errno = error;
+        }
+        return status;
+}
+
+/*!
+ * @brief This is a static function that takes a writer's snapshot, unless
+ *          nothing was logged since its last one, and records the outcome
+ *          in its counters.
+ *
+ * @param[in/out] p_writer The writer.
+ *
+ * @return 0 on success or if there was nothing to write, -1 on error.
+ */
+static int
+snapshot_writer_run (snapshot_writer_t * p_writer)
+{
+    int status = 0;
+    pthread_mutex_lock(&(p_writer->mutex));
+    bool b_fresh = (0 != p_writer->stats.written) &&
+                   (NULL != p_writer->p_wal) &&
+                   (wal_last_lsn(p_writer->p_wal) == p_writer->stats.lsn);
+    pthread_mutex_unlock(&(p_writer->mutex));
+    if (true == b_fresh)
+    {
+        goto EXIT;
+    }
+    
+    uint64_t lsn = 0;
+    uint64_t copy_ns = 0;
+    uint64_t start_ns = snapshot_now_ns();
+    status = snapshot_take(p_writer->dir, p_writer->p_users, p_writer->p_accounts,
+                           p_writer->p_wal, &lsn, &copy_ns);
+    int error = errno;
+    pthread_mutex_lock(&(p_writer->mutex));
+    if (0 == status)
+    {
+        p_writer->stats.written++;
+        p_writer->stats.lsn = lsn;
+        p_writer->stats.write_ns = snapshot_now_ns() - start_ns;
+        p_writer->stats.copy_ns = copy_ns;
+    }
+    else
+    {
+        p_writer->stats.failed++;
+        p_writer->stats.error = error;
+    }
+    pthread_mutex_unlock(&(p_writer->mutex));
+    errno = error;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that defines the behavior of the
+ *          writer thread: sleep for an interval, take a snapshot, and
+ *          repeat until asked to stop.
+ *
+ * @param[in/out] vp_writer A void pointer to the writer.
+ *
+ * @return No return value expected.
+ */
+static void *
+snapshot_writer_thread (void * vp_writer)
+{
+    snapshot_writer_t * p_writer = (snapshot_writer_t *) vp_writer;
+    pthread_mutex_lock(&(p_writer->mutex));
+    while (false == p_writer->b_shutdown)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        uint64_t nsec = (uint64_t) deadline.tv_nsec + ((p_writer->interval_ms % 1000) * 1000000u);
+        deadline.tv_sec += (time_t) ((p_writer->interval_ms / 1000) + (nsec / 1000000000u));
+        deadline.tv_nsec = (long) (nsec % 1000000000u);
+        int waited = 0;
+        while ((false == p_writer->b_shutdown) &&
+               (ETIMEDOUT != waited))
+        {
+            waited = pthread_cond_timedwait(&(p_writer->cond), &(p_writer->mutex), &deadline);
+        }
+        if (true == p_writer->b_shutdown)
+        {
+            break;
+        }
+        
+        pthread_mutex_unlock(&(p_writer->mutex));
+        (void) snapshot_writer_run(p_writer);
+        pthread_mutex_lock(&(p_writer->mutex));
+    }
+    pthread_mutex_unlock(&(p_writer->mutex));
+    return NULL;
+}
+
+/*!
+ * @brief This function takes a snapshot and writes it to a directory,
+ *          then removes all but the newest SNAPSHOT_KEEP snapshots there,
+ *          and the log segments the oldest one kept already holds. Only
+ *          one snapshot may be written to a directory at a time.
+ *
+ *          Every log record the snapshot may hold the effect of is made
+ *              durable before the snapshot is renamed into place.
+ *
+ * @param[in] p_dir The directory.
+ * @param[in] p_users The user index.
+ * @param[in] p_accounts The account store.
+ * @param[in/out] p_wal The log the tables' changes are appended to. May
+ *              be NULL if they are not logged.
+ * @param[out] p_lsn The snapshot's sequence number. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENAMETOOLONG if a
+ *          username or password is longer than config.h allows.
+ */
+int
+snapshot_write (const char * p_dir, user_index_t * p_users, account_store_t * p_accounts,
+                wal_t * p_wal, uint64_t * p_lsn)
+{
+    int status = -1;
+    if ((NULL == p_dir) ||
+        (NULL == p_users) ||
+        (NULL == p_accounts))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    uint64_t lsn = 0;
+    uint64_t copy_ns = 0;
+    if (-1 == snapshot_take(p_dir, p_users, p_accounts, p_wal, &lsn, &copy_ns))
+    {
+        goto EXIT;
+    }
+    if (NULL != p_lsn)
+    {
+        *p_lsn = lsn;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function maps the newest snapshot in a directory whose
+ *          header and checksum check out. Snapshots that do not are
+ *          skipped.
+ *
+ * @param[in] p_dir The directory.
+ * @param[out] p_snapshot The snapshot.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no valid snapshot.
+ */
+int
+snapshot_open (const char * p_dir, snapshot_t * p_snapshot)
+{
+    int status = -1;
+    uint64_t * p_lsns = NULL;
+    size_t count = 0;
+    if ((NULL == p_dir) ||
+        (NULL == p_snapshot))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    memset(p_snapshot, 0, sizeof(snapshot_t));
+    if (-1 == snapshot_list(p_dir, false, &p_lsns, &count))
+    {
+        goto EXIT;
+    }
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        char path[SNAPSHOT_PATH_MAX];
+        if ((0 == snapshot_path(path, p_dir, p_lsns[idx], false)) &&
+            (0 == snapshot_map(path, p_lsns[idx], p_snapshot)))
+        {
+            status = 0;
+            goto EXIT;
+        }
+    }
+    errno = ENOENT;
+    
+    EXIT:
+        free(p_lsns);
+        return status;
+}
+
+/*!
+ * @brief This function loads a mapped snapshot into a user index and an
+ *          account store.
+ *
+ * @param[in] p_snapshot The snapshot.
+ * @param[in/out] p_users The user index.
+ * @param[in/out] p_accounts The account store.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+snapshot_load (const snapshot_t * p_snapshot, user_index_t * p_users,
+               account_store_t * p_accounts)
+{
+    int status = -1;
+    if ((NULL == p_snapshot) ||
+        (NULL == p_snapshot->p_map) ||
+        (NULL == p_users) ||
+        (NULL == p_accounts))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    for (size_t idx = 0; idx < p_snapshot->num_users; ++idx)
+    {
+        const snapshot_user_t * p_record = p_snapshot->p_users + idx;
+        if ((NULL == memchr(p_record->username, '\0', SNAPSHOT_UNAME_SIZE)) ||
+            (NULL == memchr(p_record->password, '\0', SNAPSHOT_PWORD_SIZE)))
+        {
+            errno = EINVAL;
+            goto EXIT;
+        }
+        if (-1 == user_restore(p_users, p_record->username, p_record->password,
+                               be32toh(p_record->id)))
+        {
+            goto EXIT;
+        }
+    }
+    for (size_t idx = 0; idx < p_snapshot->num_accounts; ++idx)
+    {
+        const snapshot_account_t * p_record = p_snapshot->p_accounts + idx;
+        if (-1 == account_restore(p_accounts, be32toh(p_record->id),
+                                  be64toh(p_record->balance)))
+        {
+            goto EXIT;
+        }
+    }
+    status = user_skip_ids(p_users, p_snapshot->next_id);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function unmaps a snapshot.
+ *
+ * @param[in/out] p_snapshot The snapshot.
+ *
+ * @return No return value expected.
+ */
+void
+snapshot_close (snapshot_t * p_snapshot)
+{
+    if ((NULL == p_snapshot) ||
+        (NULL == p_snapshot->p_map))
+    {
+        goto EXIT;
+    }
+    
+    munmap(p_snapshot->p_map, p_snapshot->size);
+    memset(p_snapshot, 0, sizeof(snapshot_t));
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function starts a thread that writes a snapshot to a
+ *          directory periodically, skipping a period when nothing was
+ *          logged since the last snapshot.
+ *
+ * @param[in] p_dir The directory.
+ * @param[in] interval_ms The time between snapshots. Must be non-zero.
+ * @param[in] p_users The user index.
+ * @param[in] p_accounts The account store.
+ * @param[in/out] p_wal The log. May be NULL, then every period writes a
+ *              snapshot.
+ *
+ * @return Pointer to the writer. NULL on error.
+ */
+snapshot_writer_t *
+snapshot_writer_start (const char * p_dir, const uint64_t interval_ms, user_index_t * p_users,
+                       account_store_t * p_accounts, wal_t * p_wal)
+{
+    int status = -1;
+    snapshot_writer_t * p_writer = NULL;
+    bool b_mutex = false;
+    bool b_cond = false;
+    if ((NULL == p_dir) ||
+        (strlen(p_dir) >= SNAPSHOT_PATH_MAX) ||
+        (0 == interval_ms) ||
+        (NULL == p_users) ||
+        (NULL == p_accounts))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    p_writer = calloc(1, sizeof(snapshot_writer_t));
+    if (NULL == p_writer)
+    {
+        goto EXIT;
+    }
+    strcpy(p_writer->dir, p_dir);
+    p_writer->interval_ms = interval_ms;
+    p_writer->p_users = p_users;
+    p_writer->p_accounts = p_accounts;
+    p_writer->p_wal = p_wal;
+    
+    b_mutex = (0 == pthread_mutex_init(&(p_writer->mutex), NULL));
+    pthread_condattr_t cond_attr;
+    if ((false == b_mutex) ||
+        (0 != pthread_condattr_init(&cond_attr)))
+    {
+        goto EXIT;
+    }
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    b_cond = (0 == pthread_cond_init(&(p_writer->cond), &cond_attr));
+    pthread_condattr_destroy(&cond_attr);
+    if ((false == b_cond) ||
+        (0 != pthread_create(&(p_writer->thread), NULL, snapshot_writer_thread, p_writer)))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_writer))
+        {
+            if (true == b_cond)
+            {
+                pthread_cond_destroy(&(p_writer->cond));
+            }
+            if (true == b_mutex)
+            {
+                pthread_mutex_destroy(&(p_writer->mutex));
+            }
+            free(p_writer);
+            p_writer = NULL;
+        }
+        return p_writer;
+}
+
+/*!
+ * @brief This function stops a writer, first writing one last snapshot if
+ *          anything was logged since the last one, and frees it.
+ *
+ * @param[in/out] p_writer The writer.
+ *
+ * @return 0 on success, -1 if the last snapshot failed.
+ */
+int
+snapshot_writer_stop (snapshot_writer_t * p_writer)
+{
+    int status = -1;
+    if (NULL == p_writer)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_mutex_lock(&(p_writer->mutex));
+    p_writer->b_shutdown = true;
+    pthread_cond_signal(&(p_writer->cond));
+    pthread_mutex_unlock(&(p_writer->mutex));
+    pthread_join(p_writer->thread, NULL);
+    
+    status = snapshot_writer_run(p_writer);
+    pthread_cond_destroy(&(p_writer->cond));
+    pthread_mutex_destroy(&(p_writer->mutex));
+    free(p_writer);
+    p_writer = NULL;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function takes a snapshot of a writer's counters.
+ *
+ * @param[in/out] p_writer The writer.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+snapshot_writer_stats (snapshot_writer_t * p_writer, snapshot_stats_t * p_stats)
+{
+    int status = -1;
+    if ((NULL == p_writer) ||
+        (NULL == p_stats))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_mutex_lock(&(p_writer->mutex));
+    *p_stats = p_writer->stats;
+    pthread_mutex_unlock(&(p_writer->mutex));
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
@@ -0,0 +1,331 @@
+/*!
+ * @file server/snapshot.h
+ *
+ * @brief This file contains the snapshots of the user index and account
+ *          store that let the server restart without replaying its whole
+ *          log.
+ *
+ *          A snapshot is one file: a header, then every user and then
+ *              every account as fixed-width records. The header holds the
+ *              log sequence number the snapshot is current to, the id the
+ *              next user gets, the record counts and a CRC-32C of the
+ *              whole file. Snapshots are named after their sequence
+ *              number, written under a temporary name, synced and then
+ *              renamed into place, so a crash never leaves a partial one
+ *              under a snapshot's name.
+ *
+ *          Taking a snapshot only copies the tables into memory, into
+ *              buffers sized from the tables' counts beforehand: the
+ *              users a slice at a time under the index's shared lock, so
+ *              logins go on and writers wait for one slice at most, and
+ *              the accounts one stripe at a time, so only writers to the
+ *              stripe being copied wait. Writing and syncing the copy
+ *              takes no lock at all. Since the tables change while they
+ *              are copied, the snapshot is not of a single moment. It
+ *              holds every change logged up to its sequence number and
+ *              some later ones, and replaying the log after that sequence
+ *              number brings each record it touches up to date (see
+ *              journal.h). A user and its account are copied at
+ *              different times, so before it is written the copy drops
+ *              users it holds twice, accounts whose user it does not hold and opens an empty
+ *              account for each user it holds without one. Replay then
+ *              puts back whatever either side missed.
+ *
+ *          Restarting maps the newest snapshot that checks out, loads it
+ *              and replays only the log records after it, starting at the
+ *              log segment that holds the first of them. Once a snapshot
+ *              is written, the log segments every snapshot kept already
+ *              holds are removed.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - snapshot_write
+ *              - snapshot_open
+ *              - snapshot_load
+ *              - snapshot_close
+ *              - snapshot_writer_start
+ *              - snapshot_writer_stop
+ *              - snapshot_writer_stats
+ */
+
+#ifndef SERVER_SNAPSHOT_H
+#define SERVER_SNAPSHOT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "user.h"
+#include "account.h"
+#include "wal.h"
+
+/*!
+ * @brief The bytes a snapshot file starts with, and its format version.
+ */
+#define SNAPSHOT_MAGIC "BANKSNAP"
+#define SNAPSHOT_VERSION 1
+
+/*!
+ * @brief The size of a username and of a password field, including the
+ *          terminator.
+ */
+#define SNAPSHOT_UNAME_SIZE (USER_DB_UNAME_MAX + 1)
+#define SNAPSHOT_PWORD_SIZE (USER_DB_PWORD_MAX + 1)
+
+_Static_assert(SNAPSHOT_UNAME_SIZE <= USER_STR_SIZE, "usernames fit the user index");
+_Static_assert(SNAPSHOT_PWORD_SIZE <= USER_STR_SIZE, "passwords fit the user index");
+
+/*!
+ * @brief The number of snapshots kept. Older ones are removed once a new
+ *          one is in place.
+ */
+#define SNAPSHOT_KEEP 2
+
+/*!
+ * @brief The longest path of a snapshot file.
+ */
+#define SNAPSHOT_PATH_MAX 4096
+
+/*!
+ * @brief The default time between snapshots taken by a writer.
+ */
+#define SNAPSHOT_DEFAULT_INTERVAL_MS 60000
+
+/*!
+ * @brief This datatype defines a snapshot's header, laid out as on disk.
+ *          Numbers are in network byte order.
+ *
+ * @param magic SNAPSHOT_MAGIC, without a terminator.
+ * @param version SNAPSHOT_VERSION.
+ * @param next_id The id the next registered user gets.
+ * @param lsn The sequence number of the last log record the snapshot is
+ *          sure to hold. 0 if it was taken without a log.
+ * @param num_users The number of user records.
+ * @param num_accounts The number of account records.
+ * @param user_size The size of a user record.
+ * @param account_size The size of an account record.
+ * @param reserved Zero.
+ * @param checksum The CRC-32C of the header up to this field, then of
+ *          the records.
+ */
+typedef struct __attribute__((packed)) _snapshot_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t next_id;
+    uint64_t lsn;
+    uint64_t num_users;
+    uint64_t num_accounts;
+    uint32_t user_size;
+    uint32_t account_size;
+    uint32_t reserved;
+    uint32_t checksum;
+} snapshot_header_t;
+
+/*!
+ * @brief This datatype defines a user record, laid out as on disk.
+ *
+ * @param id The user's id, in network byte order.
+ * @param username The username, zero-padded.
+ * @param password The password, zero-padded.
+ */
+typedef struct __attribute__((packed)) _snapshot_user
+{
+    uint32_t id;
+    char     username[SNAPSHOT_UNAME_SIZE];
+    char     password[SNAPSHOT_PWORD_SIZE];
+} snapshot_user_t;
+
+/*!
+ * @brief This datatype defines an account record, laid out as on disk.
+ *
+ * @param id The owner's user id, in network byte order.
+ * @param balance The balance, in network byte order.
+ */
+typedef struct __attribute__((packed)) _snapshot_account
+{
+    uint32_t id;
+    uint64_t balance;
+} snapshot_account_t;
+
+/*!
+ * @brief This datatype defines a snapshot mapped into memory.
+ *
+ * @param p_map The mapping.
+ * @param size The mapping's size.
+ * @param lsn See snapshot_header_t.
+ * @param next_id See snapshot_header_t.
+ * @param num_users See snapshot_header_t.
+ * @param num_accounts See snapshot_header_t.
+ * @param p_users The user records.
+ * @param p_accounts The account records.
+ */
+typedef struct _snapshot
+{
+    void *                     p_map;
+    size_t                     size;
+    uint64_t                   lsn;
+    uint32_t                   next_id;
+    size_t                     num_users;
+    size_t                     num_accounts;
+    const snapshot_user_t *    p_users;
+    const snapshot_account_t * p_accounts;
+} snapshot_t;
+
+/*!
+ * @brief This datatype defines a snapshot writer's counters.
+ *
+ * @param written Snapshots written.
+ * @param failed Snapshots that failed.
+ * @param error The errno of the last failure. 0 if there was none.
+ * @param lsn The sequence number of the last snapshot written.
+ * @param write_ns How long the last snapshot took, copy included, in
+ *          nanoseconds.
+ * @param copy_ns How long the last snapshot spent copying the tables, in
+ *          nanoseconds.
+ */
+typedef struct _snapshot_stats
+{
+    uint64_t written;
+    uint64_t failed;
+    int      error;
+    uint64_t lsn;
+    uint64_t write_ns;
+    uint64_t copy_ns;
+} snapshot_stats_t;
+
+/*!
+ * @brief This datatype defines a thread that takes snapshots
+ *          periodically.
+ *
+ * @param mutex Guards everything below.
+ * @param cond Signalled when the writer must stop.
+ * @param b_shutdown Whether the writer must stop.
+ * @param thread The writer thread.
+ * @param dir The directory snapshots are written to.
+ * @param interval_ms The time between snapshots.
+ * @param p_users The user index.
+ * @param p_accounts The account store.
+ * @param p_wal The log.
+ * @param stats The counters.
+ */
+typedef struct _snapshot_writer
+{
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;
+    bool              b_shutdown;
+    pthread_t         thread;
+    char              dir[SNAPSHOT_PATH_MAX];
+    uint64_t          interval_ms;
+    user_index_t *    p_users;
+    account_store_t * p_accounts;
+    wal_t *           p_wal;
+    snapshot_stats_t  stats;
+} snapshot_writer_t;
+
+/*!
+ * @brief This function takes a snapshot and writes it to a directory,
+ *          then removes all but the newest SNAPSHOT_KEEP snapshots there,
+ *          and the log segments the oldest one kept already holds. Only
+ *          one snapshot may be written to a directory at a time.
+ *
+ *          Every log record the snapshot may hold the effect of is made
+ *              durable before the snapshot is renamed into place.
+ *
+ * @param[in] p_dir The directory.
+ * @param[in] p_users The user index.
+ * @param[in] p_accounts The account store.
+ * @param[in/out] p_wal The log the tables' changes are appended to. May
+ *              be NULL if they are not logged.
+ * @param[out] p_lsn The snapshot's sequence number. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENAMETOOLONG if a
+ *          username or password is longer than config.h allows.
+ */
+int
+snapshot_write (const char * p_dir, user_index_t * p_users, account_store_t * p_accounts,
+                wal_t * p_wal, uint64_t * p_lsn);
+
+/*!
+ * @brief This function maps the newest snapshot in a directory whose
+ *          header and checksum check out. Snapshots that do not are
+ *          skipped.
+ *
+ * @param[in] p_dir The directory.
+ * @param[out] p_snapshot The snapshot.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if there is
+ *          no valid snapshot.
+ */
+int
+snapshot_open (const char * p_dir, snapshot_t * p_snapshot);
+
+/*!
+ * @brief This function loads a mapped snapshot into a user index and an
+ *          account store.
+ *
+ * @param[in] p_snapshot The snapshot.
+ * @param[in/out] p_users The user index.
+ * @param[in/out] p_accounts The account store.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+snapshot_load (const snapshot_t * p_snapshot, user_index_t * p_users,
+               account_store_t * p_accounts);
+
+/*!
+ * @brief This function unmaps a snapshot.
+ *
+ * @param[in/out] p_snapshot The snapshot.
+ *
+ * @return No return value expected.
+ */
+void
+snapshot_close (snapshot_t * p_snapshot);
+
+/*!
+ * @brief This function starts a thread that writes a snapshot to a
+ *          directory periodically, skipping a period when nothing was
+ *          logged since the last snapshot.
+ *
+ * @param[in] p_dir The directory.
+ * @param[in] interval_ms The time between snapshots. Must be non-zero.
+ * @param[in] p_users The user index.
+ * @param[in] p_accounts The account store.
+ * @param[in/out] p_wal The log. May be NULL, then every period writes a
+ *              snapshot.
+ *
+ * @return Pointer to the writer. NULL on error.
+ */
+snapshot_writer_t *
+snapshot_writer_start (const char * p_dir, const uint64_t interval_ms, user_index_t * p_users,
+                       account_store_t * p_accounts, wal_t * p_wal);
+
+/*!
+ * @brief This function stops a writer, first writing one last snapshot if
+ *          anything was logged since the last one, and frees it.
+ *
+ * @param[in/out] p_writer The writer.
+ *
+ * @return 0 on success, -1 if the last snapshot failed.
+ */
+int
+snapshot_writer_stop (snapshot_writer_t * p_writer);
+
+/*!
+ * @brief This function takes a snapshot of a writer's counters.
+ *
+ * @param[in/out] p_writer The writer.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+snapshot_writer_stats (snapshot_writer_t * p_writer, snapshot_stats_t * p_stats);
+
+#endif // SERVER_SNAPSHOT_H
+
+/***   end of file   ***/
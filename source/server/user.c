@@ -0,0 +1,1072 @@
+/*!
+ * @file server/user.c
+ *
+ * @brief This file contains the index of registered users, keyed by
+ *          username.
+ *
+ *          A control byte is 0 for an empty slot, 1 for a deleted one,
+ *              and the top bit plus seven bits of the hash for a full
+ *              one. Tables are split into aligned
+ *              groups of USER_GROUP_SIZE slots, and a key's probe
+ *              visits whole groups in triangular order until it meets
+ *              a group with an empty slot.
+ *
+ *          Tables are mapped straight from the kernel, which hands out
+ *              zeroed pages as they are first touched. Empty being 0
+ *              means a new table costs no pass over its control bytes,
+ *              however large. The old table's entry pages are given
+ *              back as the move passes them, so retiring a large table
+ *              does not free all of it in one call either.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "user.h"
+
+/*!
+ * @brief The control byte of an empty slot and of a deleted one.
+ */
+#define USER_CTRL_EMPTY   0x00
+#define USER_CTRL_DELETED 0x01
+
+/*!
+ * @brief The bit set in the control byte of a full slot.
+ */
+#define USER_CTRL_FULL 0x80
+
+/*!
+ * @brief Every byte of a group word set to 0x01, to 0x7F and to 0x80.
+ */
+#define USER_BYTES_01 0x0101010101010101ull
+#define USER_BYTES_7F 0x7F7F7F7F7F7F7F7Full
+#define USER_BYTES_80 0x8080808080808080ull
+
+/*!
+ * @brief The largest fraction of a table's slots, in sixteenths, that
+ *          may be full or deleted.
+ */
+#define USER_MAX_LOAD 14
+
+/*!
+ * @brief The slot index returned by a probe that found nothing.
+ */
+#define USER_NONE SIZE_MAX
+
+/*!
+ * @brief This is a static function that copies a string into a
+ *          zero-padded field.
+ *
+ * @param[out] p_field The field, USER_STR_SIZE bytes.
+ * @param[in] p_str The string.
+ * @param[in] max_len The longest string accepted, from config.h.
+ *
+ * @return 0 on success, -1 if the string is empty or too long.
+ */
+static int
+user_field (char * p_field, const char * p_str, const size_t max_len)
+{
+    int status = -1;
+    size_t len = strnlen(p_str, max_len + 1);
+    if ((0 == len) ||
+        (len > max_len))
+    {
+        goto EXIT;
+    }
+    
+    memset(p_field, 0, USER_STR_SIZE);
+    memcpy(p_field, p_str, len);
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that hashes a zero-padded username a
+ *          word at a time.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] p_key The username field.
+ *
+ * @return The hash.
+ */
+static uint64_t
+user_hash (const user_index_t * p_index, const char * p_key)
+{
+    uint64_t hash = p_index->seed;
+    for (size_t offset = 0; offset < USER_STR_SIZE; offset += sizeof(uint64_t))
+    {
+        uint64_t word = 0;
+        memcpy(&word, p_key + offset, sizeof(word));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    
+    // Finish with the splitmix64 mixer, so both the group index and the
+    // control bits depend on every input bit.
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBull;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+/*!
+ * @brief This is a static function that loads a group's control bytes
+ *          into a word, the group's first slot in the lowest byte.
+ *
+ * @param[in] p_ctrl The group's first control byte.
+ *
+ * @return The group word.
+ */
+static uint64_t
+user_group_load (const uint8_t * p_ctrl)
+{
+    uint64_t word = 0;
+    memcpy(&word, p_ctrl, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/*!
+ * @brief This is a static function that finds the zero bytes of a group
+ *          word.
+ *
+ * @param[in] word The group word.
+ *
+ * @return A word with 0x80 in every byte that was zero, and 0 elsewhere.
+ */
+static uint64_t
+user_group_zeros (const uint64_t word)
+{
+    return ~(((word & USER_BYTES_7F) + USER_BYTES_7F) | word | USER_BYTES_7F);
+}
+
+/*!
+ * @brief This is a static function that unmaps a table.
+ *
+ * @param[in/out] p_table The table.
+ *
+ * @return No return value expected.
+ */
+static void
+user_table_free (user_table_t * p_table)
+{
+    if (NULL != p_table->p_ctrl)
+    {
+        munmap(p_table->p_ctrl, p_table->capacity);
+    }
+    if (NULL != p_table->p_entries)
+    {
+        munmap(p_table->p_entries, p_table->capacity * sizeof(user_entry_t));
+    }
+    memset(p_table, 0, sizeof(user_table_t));
+}
+
+/*!
+ * @brief This is a static function that maps an empty table.
+ *
+ * @param[out] p_table The table.
+ * @param[in] capacity The number of slots, a power of two of at least
+ *              USER_MIN_CAPACITY.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+user_table_alloc (user_table_t * p_table, const size_t capacity)
+{
+    int status = -1;
+    memset(p_table, 0, sizeof(user_table_t));
+    p_table->capacity = capacity;
+    void * p_ctrl = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void * p_entries = mmap(NULL, capacity * sizeof(user_entry_t), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    p_table->p_ctrl = (MAP_FAILED == p_ctrl) ? NULL : p_ctrl;
+    p_table->p_entries = (MAP_FAILED == p_entries) ? NULL : p_entries;
+    if ((NULL == p_table->p_ctrl) ||
+        (NULL == p_table->p_entries))
+    {
+        user_table_free(p_table);
+        goto EXIT;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that finds a username in a table.
+ *
+ * @param[in] p_table The table.
+ * @param[in] p_key The username field.
+ * @param[in] hash The username's hash.
+ *
+ * @return The slot holding the username. USER_NONE if there is none.
+ */
+static size_t
+user_table_find (const user_table_t * p_table, const char * p_key, const uint64_t hash)
+{
+    size_t found = USER_NONE;
+    if (0 == p_table->capacity)
+    {
+        goto EXIT;
+    }
+    
+    size_t mask = (p_table->capacity / USER_GROUP_SIZE) - 1;
+    size_t group = (hash >> 7) & mask;
+    uint64_t tags = USER_BYTES_01 * (USER_CTRL_FULL | (hash & 0x7F));
+    for (size_t step = 1; step <= (mask + 1); ++step)
+    {
+        const uint8_t * p_ctrl = p_table->p_ctrl + (group * USER_GROUP_SIZE);
+        uint64_t word = user_group_load(p_ctrl);
+        for (uint64_t matches = user_group_zeros(word ^ tags); 0 != matches;
+             matches &= matches - 1)
+        {
+            size_t slot = (group * USER_GROUP_SIZE) + ((size_t) __builtin_ctzll(matches) / 8);
+            if (0 == memcmp(p_table->p_entries[slot].username, p_key, USER_STR_SIZE))
+            {
+                found = slot;
+                goto EXIT;
+            }
+        }
+        if (0 != user_group_zeros(word))
+        {
+            goto EXIT;
+        }
+        group = (group + step) & mask;
+    }
+    
+    EXIT:
+        return found;
+}
+
+/*!
+ * @brief This is a static function that adds an entry to a table that
+ *          does not hold its username and has room for it.
+ *
+ * @param[in/out] p_table The table.
+ * @param[in] p_entry The entry.
+ * @param[in] hash The entry's username's hash.
+ *
+ * @return No return value expected.
+ */
+static void
+user_table_insert (user_table_t * p_table, const user_entry_t * p_entry, const uint64_t hash)
+{
+    size_t mask = (p_table->capacity / USER_GROUP_SIZE) - 1;
+    size_t group = (hash >> 7) & mask;
+    for (size_t step = 1; ; ++step)
+    {
+        uint8_t * p_ctrl = p_table->p_ctrl + (group * USER_GROUP_SIZE);
+        uint64_t free_slots = ~user_group_load(p_ctrl) & USER_BYTES_80;
+        if (0 != free_slots)
+        {
+            size_t offset = (size_t) __builtin_ctzll(free_slots) / 8;
+            if (USER_CTRL_EMPTY == p_ctrl[offset])
+            {
+                p_table->num_used++;
+            }
+            p_ctrl[offset] = (uint8_t) (USER_CTRL_FULL | (hash & 0x7F));
+            p_table->p_entries[(group * USER_GROUP_SIZE) + offset] = *p_entry;
+            p_table->num_live++;
+            break;
+        }
+        group = (group + step) & mask;
+    }
+}
+
+/*!
+ * @brief This is a static function that empties a full slot of a table.
+ *
+ * @param[in/out] p_table The table.
+ * @param[in] slot The slot.
+ *
+ * @return No return value expected.
+ */
+static void
+user_table_erase (user_table_t * p_table, const size_t slot)
+{
+    // No probe ever went past a group that still has an empty slot, so a
+    // slot in such a group can be made empty rather than deleted.
+    size_t first = slot - (slot % USER_GROUP_SIZE);
+    if (0 != user_group_zeros(user_group_load(p_table->p_ctrl + first)))
+    {
+        p_table->p_ctrl[slot] = USER_CTRL_EMPTY;
+        p_table->num_used--;
+    }
+    else
+    {
+        p_table->p_ctrl[slot] = USER_CTRL_DELETED;
+    }
+    p_table->num_live--;
+}
+
+/*!
+ * @brief This is a static function that moves up to max_slots slots of
+ *          the old table into the new one, and frees the old table once
+ *          it is empty.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] max_slots The most slots to look at.
+ *
+ * @return No return value expected.
+ */
+static void
+user_migrate (user_index_t * p_index, const size_t max_slots)
+{
+    user_table_t * p_old = &(p_index->old);
+    size_t end = p_index->migrate_pos + max_slots;
+    if (end > p_old->capacity)
+    {
+        end = p_old->capacity;
+    }
+    for (size_t slot = p_index->migrate_pos; slot < end; ++slot)
+    {
+        if (0 != (p_old->p_ctrl[slot] & USER_CTRL_FULL))
+        {
+            user_entry_t * p_entry = p_old->p_entries + slot;
+            user_table_insert(&(p_index->table), p_entry,
+                              user_hash(p_index, p_entry->username));
+            p_old->p_ctrl[slot] = USER_CTRL_DELETED;
+            p_old->num_live--;
+        }
+    }
+    
+    // Give back the entry pages the move has passed.
+    size_t page = p_index->page_size;
+    size_t done = ((p_index->migrate_pos * sizeof(user_entry_t)) / page) * page;
+    size_t passed = ((end * sizeof(user_entry_t)) / page) * page;
+    if (passed > done)
+    {
+        (void) madvise((char *) p_old->p_entries + done, passed - done, MADV_DONTNEED);
+    }
+    p_index->migrate_pos = end;
+    if (p_index->migrate_pos == p_old->capacity)
+    {
+        user_table_free(p_old);
+        p_index->migrate_pos = 0;
+    }
+}
+
+/*!
+ * @brief This is a static function that makes room for one more entry
+ *          in the new table, starting a move to a fresh table if it is
+ *          full. The fresh table is twice as large if the live entries
+ *          need it, or the same size if deleted slots filled the table.
+ *
+ * @param[in/out] p_index The user index.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+user_reserve (user_index_t * p_index)
+{
+    int status = -1;
+    user_table_t * p_table = &(p_index->table);
+    if (((p_table->num_used + 1) * 16) <= (p_table->capacity * USER_MAX_LOAD))
+    {
+        status = 0;
+        goto EXIT;
+    }
+    
+    // A move is always done well before the new table fills up, but
+    // finish any move still under way to be sure.
+    if (0 != p_index->old.capacity)
+    {
+        user_migrate(p_index, p_index->old.capacity);
+    }
+    
+    size_t capacity = p_table->capacity;
+    if ((p_table->num_live * 16) > (capacity * (USER_MAX_LOAD / 2)))
+    {
+        capacity *= 2;
+    }
+    user_table_t fresh;
+    if (-1 == user_table_alloc(&fresh, capacity))
+    {
+        goto EXIT;
+    }
+    p_index->old = *p_table;
+    p_index->table = fresh;
+    p_index->migrate_pos = 0;
+    p_index->generation++;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that finds a username in the index.
+ *          The caller holds the index's lock.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] p_key The username field.
+ *
+ * @return Pointer to the user's entry. NULL if there is none.
+ */
+static user_entry_t *
+user_lookup (user_index_t * p_index, const char * p_key)
+{
+    user_entry_t * p_entry = NULL;
+    uint64_t hash = user_hash(p_index, p_key);
+    size_t slot = user_table_find(&(p_index->table), p_key, hash);
+    if (USER_NONE != slot)
+    {
+        p_entry = p_index->table.p_entries + slot;
+        goto EXIT;
+    }
+    slot = user_table_find(&(p_index->old), p_key, hash);
+    if (USER_NONE != slot)
+    {
+        p_entry = p_index->old.p_entries + slot;
+    }
+    
+    EXIT:
+        return p_entry;
+}
+
+/*!
+ * @brief This is a static function that hands every full slot of a range
+ *          of a table to a function. The caller holds the index's lock.
+ *
+ * @param[in] p_table The table.
+ * @param[in] first The first slot.
+ * @param[in] end The slot past the last, at most the table's capacity.
+ * @param[in] visit_func The function.
+ * @param[in/out] p_ctx The context passed to visit_func.
+ *
+ * @return 0 on success, -1 if visit_func failed.
+ */
+static int
+user_table_visit (const user_table_t * p_table, const size_t first, const size_t end,
+                  user_visit_f visit_func, void * p_ctx)
+{
+    int status = -1;
+    for (size_t slot = first; slot < end; ++slot)
+    {
+        if ((0 != (p_table->p_ctrl[slot] & USER_CTRL_FULL)) &&
+            (0 != visit_func(p_table->p_entries + slot, p_ctx)))
+        {
+            goto EXIT;
+        }
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that hands a change to the index's
+ *          log function, if it has one. The caller holds the lock
+ *          exclusively.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] p_entry The user's entry.
+ * @param[in] b_deleted Whether the user is being deleted.
+ *
+ * @return 0 if the change may go on, -1 if the log function failed.
+ */
+static int
+user_log (user_index_t * p_index, const user_entry_t * p_entry, const bool b_deleted)
+{
+    int status = 0;
+    if ((NULL != p_index->log_func) &&
+        (0 != p_index->log_func(p_entry, b_deleted, p_index->p_log_ctx)))
+    {
+        status = -1;
+    }
+    return status;
+}
+
+/*!
+ * @brief This function instantiates a new, empty user index.
+ *
+ * @param[in] capacity The number of users to make room for up front.
+ *              The index grows past it as needed.
+ *
+ * @return Pointer to new user index. NULL on error.
+ */
+user_index_t *
+user_index_create (const size_t capacity)
+{
+    int status = -1;
+    user_index_t * p_index = NULL;
+    if (capacity > (SIZE_MAX / 32))
+    {
+        goto EXIT;
+    }
+    
+    p_index = calloc(1, sizeof(user_index_t));
+    if (NULL == p_index)
+    {
+        goto EXIT;
+    }
+    if (0 != pthread_rwlock_init(&(p_index->lock), NULL))
+    {
+        free(p_index);
+        p_index = NULL;
+        goto EXIT;
+    }
+    
+    // Seed the hash per index, so which usernames collide cannot be
+    // worked out ahead of time.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    p_index->seed = ((uint64_t) now.tv_sec * 1000000000u) ^ (uint64_t) now.tv_nsec ^
+                    (uint64_t) (uintptr_t) p_index;
+    p_index->next_id = 1;
+    p_index->page_size = (size_t) sysconf(_SC_PAGESIZE);
+    
+    size_t slots = USER_MIN_CAPACITY;
+    while ((capacity * 16) > (slots * USER_MAX_LOAD))
+    {
+        slots *= 2;
+    }
+    if (-1 == user_table_alloc(&(p_index->table), slots))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_index))
+        {
+            user_index_destroy(p_index);
+            p_index = NULL;
+        }
+        return p_index;
+}
+
+/*!
+ * @brief This function destroys a user index. No other thread may be
+ *          using it.
+ *
+ * @param[in/out] p_index The user index.
+ *
+ * @return No return value expected.
+ */
+void
+user_index_destroy (user_index_t * p_index)
+{
+    if (NULL == p_index)
+    {
+        goto EXIT;
+    }
+    
+    user_table_free(&(p_index->table));
+    user_table_free(&(p_index->old));
+    pthread_rwlock_destroy(&(p_index->lock));
+    free(p_index);
+    p_index = NULL;
+    
+    EXIT:
+        return;
+}
+
+/*!
+ * @brief This function sets the function every registration and deletion
+ *          hands its user to before making it. A change it fails is not
+ *          made. Restoring users is not handed to it. No other thread may
+ *          be using the index.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] log_func The function. NULL to stop handing changes on.
+ * @param[in/out] p_ctx The context passed to log_func.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+user_index_set_log (user_index_t * p_index, user_log_f log_func, void * p_ctx)
+{
+    int status = -1;
+    if (NULL == p_index)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    p_index->log_func = log_func;
+    p_index->p_log_ctx = p_ctx;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function registers a new user.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[in] p_password The password, non-empty and at most
+ *              USER_DB_PWORD_MAX long.
+ * @param[out] p_id The new user's id. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to EEXIST if the
+ *          username is taken. If the log function fails, errno is left
+ *          as it set it, and no id is used up.
+ */
+int
+user_register (user_index_t * p_index, const char * p_username, const char * p_password,
+               uint32_t * p_id)
+{
+    int status = -1;
+    user_entry_t entry;
+    if ((NULL == p_index) ||
+        (NULL == p_username) ||
+        (NULL == p_password) ||
+        (-1 == user_field(entry.username, p_username, USER_DB_UNAME_MAX)) ||
+        (-1 == user_field(entry.password, p_password, USER_DB_PWORD_MAX)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_rwlock_wrlock(&(p_index->lock));
+    if (NULL != user_lookup(p_index, entry.username))
+    {
+        errno = EEXIST;
+        goto UNLOCK;
+    }
+    if (0 == p_index->next_id)
+    {
+        errno = ENOSPC;
+        goto UNLOCK;
+    }
+    if (-1 == user_reserve(p_index))
+    {
+        errno = ENOMEM;
+        goto UNLOCK;
+    }
+    entry.id = p_index->next_id;
+    if (-1 == user_log(p_index, &entry, false))
+    {
+        goto UNLOCK;
+    }
+    p_index->next_id++;
+    user_table_insert(&(p_index->table), &entry, user_hash(p_index, entry.username));
+    if (0 != p_index->old.capacity)
+    {
+        user_migrate(p_index, USER_MIGRATE_SLOTS);
+    }
+    if (NULL != p_id)
+    {
+        *p_id = entry.id;
+    }
+    status = 0;
+    
+    UNLOCK:
+        pthread_rwlock_unlock(&(p_index->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function deletes a user.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] p_username The username.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if no user
+ *          has the username. If the log function fails, errno is left as
+ *          it set it.
+ */
+int
+user_delete (user_index_t * p_index, const char * p_username)
+{
+    int status = -1;
+    char key[USER_STR_SIZE];
+    if ((NULL == p_index) ||
+        (NULL == p_username) ||
+        (-1 == user_field(key, p_username, USER_DB_UNAME_MAX)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_rwlock_wrlock(&(p_index->lock));
+    uint64_t hash = user_hash(p_index, key);
+    user_table_t * p_table = &(p_index->table);
+    size_t slot = user_table_find(p_table, key, hash);
+    if (USER_NONE == slot)
+    {
+        p_table = &(p_index->old);
+        slot = user_table_find(p_table, key, hash);
+    }
+    if (USER_NONE == slot)
+    {
+        errno = ENOENT;
+        goto UNLOCK;
+    }
+    if (-1 == user_log(p_index, &(p_table->p_entries[slot]), true))
+    {
+        goto UNLOCK;
+    }
+    if (p_table == &(p_index->table))
+    {
+        user_table_erase(p_table, slot);
+    }
+    else
+    {
+        // The old table's slots are only ever marked deleted, as its
+        // probe chains are still being walked.
+        p_table->p_ctrl[slot] = USER_CTRL_DELETED;
+        p_table->num_live--;
+    }
+    if (0 != p_index->old.capacity)
+    {
+        user_migrate(p_index, USER_MIGRATE_SLOTS);
+    }
+    status = 0;
+    
+    UNLOCK:
+        pthread_rwlock_unlock(&(p_index->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function checks a user's password.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] p_username The username.
+ * @param[in] p_password The password.
+ * @param[out] p_id The user's id. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if no user
+ *          has the username, and to EACCES if the password is wrong.
+ */
+int
+user_login (user_index_t * p_index, const char * p_username, const char * p_password,
+            uint32_t * p_id)
+{
+    int status = -1;
+    char key[USER_STR_SIZE];
+    char password[USER_STR_SIZE];
+    if ((NULL == p_index) ||
+        (NULL == p_username) ||
+        (NULL == p_password) ||
+        (-1 == user_field(key, p_username, USER_DB_UNAME_MAX)) ||
+        (-1 == user_field(password, p_password, USER_DB_PWORD_MAX)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_rwlock_rdlock(&(p_index->lock));
+    user_entry_t * p_entry = user_lookup(p_index, key);
+    if (NULL == p_entry)
+    {
+        errno = ENOENT;
+        goto UNLOCK;
+    }
+    
+    // Compare every byte, so the time taken does not say how much of
+    // the password was right.
+    uint8_t diff = 0;
+    for (size_t idx = 0; idx < USER_STR_SIZE; ++idx)
+    {
+        diff |= (uint8_t) (p_entry->password[idx] ^ password[idx]);
+    }
+    if (0 != diff)
+    {
+        errno = EACCES;
+        goto UNLOCK;
+    }
+    if (NULL != p_id)
+    {
+        *p_id = p_entry->id;
+    }
+    status = 0;
+    
+    UNLOCK:
+        pthread_rwlock_unlock(&(p_index->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function looks a user up by username.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] p_username The username.
+ * @param[out] p_id The user's id. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if no user
+ *          has the username.
+ */
+int
+user_find (user_index_t * p_index, const char * p_username, uint32_t * p_id)
+{
+    int status = -1;
+    char key[USER_STR_SIZE];
+    if ((NULL == p_index) ||
+        (NULL == p_username) ||
+        (-1 == user_field(key, p_username, USER_DB_UNAME_MAX)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_rwlock_rdlock(&(p_index->lock));
+    user_entry_t * p_entry = user_lookup(p_index, key);
+    if (NULL == p_entry)
+    {
+        errno = ENOENT;
+        goto UNLOCK;
+    }
+    if (NULL != p_id)
+    {
+        *p_id = p_entry->id;
+    }
+    status = 0;
+    
+    UNLOCK:
+        pthread_rwlock_unlock(&(p_index->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function returns the number of registered users.
+ *
+ * @param[in] p_index The user index.
+ *
+ * @return The number of users. 0 on error.
+ */
+size_t
+user_count (user_index_t * p_index)
+{
+    size_t count = 0;
+    if (NULL == p_index)
+    {
+        goto EXIT;
+    }
+    
+    pthread_rwlock_rdlock(&(p_index->lock));
+    count = p_index->table.num_live + p_index->old.num_live;
+    pthread_rwlock_unlock(&(p_index->lock));
+    
+    EXIT:
+        return count;
+}
+
+/*!
+ * @brief This function hands every registered user to a function. It
+ *          shares the index's lock USER_VISIT_SLOTS slots at a time, so
+ *          logins go on while it runs and writers wait for one slice at
+ *          most. Every user registered throughout is handed over at least
+ *          once, but one moved between tables during the walk may be
+ *          handed over twice, and users registered or deleted during it
+ *          may or may not be.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] visit_func The function.
+ * @param[in/out] p_ctx The context passed to visit_func.
+ *
+ * @return 0 on success, -1 on error or if visit_func failed.
+ */
+int
+user_foreach (user_index_t * p_index, user_visit_f visit_func, void * p_ctx)
+{
+    int status = -1;
+    if ((NULL == p_index) ||
+        (NULL == visit_func))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // Moves only take entries from the old table to the new one, and
+    // entries never shift within a table, so walking the old table first
+    // reaches every entry that stays. A move started while the lock was
+    // let go swaps the tables, and the walk starts over.
+    pthread_rwlock_rdlock(&(p_index->lock));
+    uint64_t generation = p_index->generation;
+    bool b_old = true;
+    size_t slot = 0;
+    for (;;)
+    {
+        if (generation != p_index->generation)
+        {
+            generation = p_index->generation;
+            b_old = true;
+            slot = 0;
+        }
+        
+        // The old table is freed once its last entry is moved, leaving
+        // its capacity 0.
+        user_table_t * p_table = (true == b_old) ? &(p_index->old) : &(p_index->table);
+        if (slot >= p_table->capacity)
+        {
+            if (false == b_old)
+            {
+                status = 0;
+                break;
+            }
+            b_old = false;
+            slot = 0;
+            continue;
+        }
+        size_t end = slot + USER_VISIT_SLOTS;
+        if (end > p_table->capacity)
+        {
+            end = p_table->capacity;
+        }
+        if (-1 == user_table_visit(p_table, slot, end, visit_func, p_ctx))
+        {
+            break;
+        }
+        slot = end;
+        
+        // Let writers in between slices.
+        pthread_rwlock_unlock(&(p_index->lock));
+        pthread_rwlock_rdlock(&(p_index->lock));
+    }
+    pthread_rwlock_unlock(&(p_index->lock));
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function puts back a user with a known id, as when
+ *          rebuilding the index from a snapshot or the log. A user with
+ *          the same username is replaced. Later registrations get ids
+ *          above the restored one.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[in] p_password The password, non-empty and at most
+ *              USER_DB_PWORD_MAX long.
+ * @param[in] id The user's id. Must be non-zero.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+user_restore (user_index_t * p_index, const char * p_username, const char * p_password,
+              const uint32_t id)
+{
+    int status = -1;
+    user_entry_t entry;
+    if ((NULL == p_index) ||
+        (NULL == p_username) ||
+        (NULL == p_password) ||
+        (0 == id) ||
+        (-1 == user_field(entry.username, p_username, USER_DB_UNAME_MAX)) ||
+        (-1 == user_field(entry.password, p_password, USER_DB_PWORD_MAX)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    entry.id = id;
+    
+    pthread_rwlock_wrlock(&(p_index->lock));
+    user_entry_t * p_entry = user_lookup(p_index, entry.username);
+    if (NULL != p_entry)
+    {
+        *p_entry = entry;
+    }
+    else
+    {
+        if (-1 == user_reserve(p_index))
+        {
+            errno = ENOMEM;
+            goto UNLOCK;
+        }
+        user_table_insert(&(p_index->table), &entry, user_hash(p_index, entry.username));
+        if (0 != p_index->old.capacity)
+        {
+            user_migrate(p_index, USER_MIGRATE_SLOTS);
+        }
+    }
+    
+    // An id of UINT32_MAX leaves next_id at 0, which means every id is
+    // taken.
+    if ((0 != p_index->next_id) &&
+        (id >= p_index->next_id))
+    {
+        p_index->next_id = id + 1;
+    }
+    status = 0;
+    
+    UNLOCK:
+        pthread_rwlock_unlock(&(p_index->lock));
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function returns the id the next registered user gets.
+ *
+ * @param[in] p_index The user index.
+ *
+ * @return The id. 0 on error, or if every id is taken.
+ */
+uint32_t
+user_next_id (user_index_t * p_index)
+{
+    uint32_t next_id = 0;
+    if (NULL == p_index)
+    {
+        goto EXIT;
+    }
+    
+    pthread_rwlock_rdlock(&(p_index->lock));
+    next_id = p_index->next_id;
+    pthread_rwlock_unlock(&(p_index->lock));
+    
+    EXIT:
+        return next_id;
+}
+
+/*!
+ * @brief This function makes sure no user registered from now on gets an
+ *          id below a given one, so the ids of deleted users are not
+ *          handed out again after a restart.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] next_id The lowest id a new user may get. 0 means every id
+ *              is taken.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+user_skip_ids (user_index_t * p_index, const uint32_t next_id)
+{
+    int status = -1;
+    if (NULL == p_index)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_rwlock_wrlock(&(p_index->lock));
+    if ((0 != p_index->next_id) &&
+        ((0 == next_id) || (next_id > p_index->next_id)))
+    {
+        p_index->next_id = next_id;
+    }
+    pthread_rwlock_unlock(&(p_index->lock));
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/***   end of file   ***/
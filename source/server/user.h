@@ -0,0 +1,351 @@
+/*!
+ * @file server/user.h
+ *
+ * @brief This file contains the index of registered users, keyed by
+ *          username.
+ *
+ *          The index is an open-addressing hash table in the style of a
+ *              Swiss table. Every slot has a control byte saying whether
+ *              it is empty, deleted, or full, and for a full slot seven
+ *              bits of the key's hash. The control bytes are kept apart
+ *              from the entries and probed a group of eight at a time
+ *              with word-wide bit tricks, so a lookup usually compares
+ *              a single key. Keys and passwords are stored inline at
+ *              their fixed protocol width, so a probe never chases a
+ *              pointer.
+ *
+ *          When the table fills up, a larger table is allocated and the
+ *              entries are moved over a few at a time by later writes,
+ *              so no single call pays for rehashing the whole table.
+ *              While the move is under way, lookups check the new table
+ *              and then the old one.
+ *
+ *          Registering, deleting and logging in are O(1). Writers take
+ *              the index's lock exclusively, and logins share it. Walking
+ *              every user shares it a slice at a time, walking the old
+ *              table before the new one so an entry moved mid-walk is
+ *              still reached.
+ *
+ *          An index can be given a function that every registration and
+ *              deletion hands its user to, with the lock still held and
+ *              before the index changes, so a log of them is in the
+ *              order they were made (see journal.h).
+ *
+ *          Functions supported are as follows:
+ *
+ *              - user_index_create
+ *              - user_index_destroy
+ *              - user_index_set_log
+ *              - user_register
+ *              - user_delete
+ *              - user_login
+ *              - user_find
+ *              - user_count
+ *              - user_foreach
+ *              - user_restore
+ *              - user_next_id
+ *              - user_skip_ids
+ */
+
+#ifndef SERVER_USER_H
+#define SERVER_USER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "../common/msg.h"
+
+/*!
+ * @brief The size of a username and of a password field, including the
+ *          terminator. A string fills the rest of its field with zeros.
+ *          The strings themselves are limited by config.h.
+ */
+#define USER_STR_SIZE MSG_STR_SIZE
+
+_Static_assert(USER_DB_UNAME_MAX < USER_STR_SIZE, "usernames fit their field");
+_Static_assert(USER_DB_PWORD_MAX < USER_STR_SIZE, "passwords fit their field");
+
+/*!
+ * @brief The number of control bytes probed at once.
+ */
+#define USER_GROUP_SIZE 8
+
+/*!
+ * @brief The smallest number of slots a table has.
+ */
+#define USER_MIN_CAPACITY 16
+
+/*!
+ * @brief The number of old table slots each write moves to the new
+ *          table while a table is being grown.
+ */
+#define USER_MIGRATE_SLOTS 16
+
+/*!
+ * @brief The number of slots user_foreach walks per hold of the lock.
+ */
+#define USER_VISIT_SLOTS 1024
+
+/*!
+ * @brief This datatype defines a user entry.
+ *
+ * @param username The username, zero-padded.
+ * @param password The password, zero-padded.
+ * @param id The user's id, handed out in registration order from 1.
+ */
+typedef struct _user_entry
+{
+    char     username[USER_STR_SIZE];
+    char     password[USER_STR_SIZE];
+    uint32_t id;
+} user_entry_t;
+
+/*!
+ * @brief This datatype defines a table of the index.
+ *
+ * @param p_ctrl The control bytes, one per slot.
+ * @param p_entries The entries, one per slot.
+ * @param capacity The number of slots, a power of two.
+ * @param num_used The number of slots that are full or deleted.
+ * @param num_live The number of slots that are full.
+ */
+typedef struct _user_table
+{
+    uint8_t *      p_ctrl;
+    user_entry_t * p_entries;
+    size_t         capacity;
+    size_t         num_used;
+    size_t         num_live;
+} user_table_t;
+
+/*!
+ * @brief This datatype defines the function an index hands a user being
+ *          registered or deleted to, before making the change. It is
+ *          called with the index's lock held, so it must not call back
+ *          into the index.
+ *
+ * @param[in] p_entry The user's entry. A new user's carries the id it
+ *              is about to get.
+ * @param[in] b_deleted Whether the user is being deleted.
+ * @param[in/out] p_ctx The context passed to user_index_set_log.
+ *
+ * @return 0 to go on with the change, -1 to fail it.
+ */
+typedef int (* user_log_f) (const user_entry_t * p_entry, const bool b_deleted, void * p_ctx);
+
+/*!
+ * @brief This datatype defines a user index.
+ *
+ * @param lock Taken exclusively by writers and shared by readers.
+ * @param table The table new users are added to.
+ * @param old The table being moved into the new one. Its capacity is 0
+ *          when no move is under way.
+ * @param migrate_pos The next slot of the old table to move.
+ * @param generation The number of moves started, so a walk of the
+ *          tables can tell they were swapped while it let go of the lock.
+ * @param seed The hash seed.
+ * @param next_id The id the next registered user gets.
+ * @param page_size The system's page size.
+ * @param log_func The function changes are handed to. NULL if there is
+ *          none.
+ * @param p_log_ctx The context passed to log_func.
+ */
+typedef struct _user_index
+{
+    pthread_rwlock_t lock;
+    user_table_t     table;
+    user_table_t     old;
+    size_t           migrate_pos;
+    uint64_t         generation;
+    uint64_t         seed;
+    uint32_t         next_id;
+    size_t           page_size;
+    user_log_f       log_func;
+    void *           p_log_ctx;
+} user_index_t;
+
+/*!
+ * @brief This datatype defines the function user_foreach hands each user
+ *          to. It is called with the index's lock held, so it must not
+ *          call back into the index.
+ *
+ * @param[in] p_entry The user's entry.
+ * @param[in/out] p_ctx The context passed to user_foreach.
+ *
+ * @return 0 to go on, -1 to stop with an error.
+ */
+typedef int (* user_visit_f) (const user_entry_t * p_entry, void * p_ctx);
+
+/*!
+ * @brief This function instantiates a new, empty user index.
+ *
+ * @param[in] capacity The number of users to make room for up front.
+ *              The index grows past it as needed.
+ *
+ * @return Pointer to new user index. NULL on error.
+ */
+user_index_t *
+user_index_create (const size_t capacity);
+
+/*!
+ * @brief This function destroys a user index. No other thread may be
+ *          using it.
+ *
+ * @param[in/out] p_index The user index.
+ *
+ * @return No return value expected.
+ */
+void
+user_index_destroy (user_index_t * p_index);
+
+/*!
+ * @brief This function sets the function every registration and deletion
+ *          hands its user to before making it. A change it fails is not
+ *          made. Restoring users is not handed to it. No other thread may
+ *          be using the index.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] log_func The function. NULL to stop handing changes on.
+ * @param[in/out] p_ctx The context passed to log_func.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+user_index_set_log (user_index_t * p_index, user_log_f log_func, void * p_ctx);
+
+/*!
+ * @brief This function registers a new user.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[in] p_password The password, non-empty and at most
+ *              USER_DB_PWORD_MAX long.
+ * @param[out] p_id The new user's id. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to EEXIST if the
+ *          username is taken. If the log function fails, errno is left
+ *          as it set it, and no id is used up.
+ */
+int
+user_register (user_index_t * p_index, const char * p_username, const char * p_password,
+               uint32_t * p_id);
+
+/*!
+ * @brief This function deletes a user.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] p_username The username.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if no user
+ *          has the username. If the log function fails, errno is left as
+ *          it set it.
+ */
+int
+user_delete (user_index_t * p_index, const char * p_username);
+
+/*!
+ * @brief This function checks a user's password.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] p_username The username.
+ * @param[in] p_password The password.
+ * @param[out] p_id The user's id. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if no user
+ *          has the username, and to EACCES if the password is wrong.
+ */
+int
+user_login (user_index_t * p_index, const char * p_username, const char * p_password,
+            uint32_t * p_id);
+
+/*!
+ * @brief This function looks a user up by username.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] p_username The username.
+ * @param[out] p_id The user's id. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENOENT if no user
+ *          has the username.
+ */
+int
+user_find (user_index_t * p_index, const char * p_username, uint32_t * p_id);
+
+/*!
+ * @brief This function returns the number of registered users.
+ *
+ * @param[in] p_index The user index.
+ *
+ * @return The number of users. 0 on error.
+ */
+size_t
+user_count (user_index_t * p_index);
+
+/*!
+ * @brief This function hands every registered user to a function. It
+ *          shares the index's lock USER_VISIT_SLOTS slots at a time, so
+ *          logins go on while it runs and writers wait for one slice at
+ *          most. Every user registered throughout is handed over at least
+ *          once, but one moved between tables during the walk may be
+ *          handed over twice, and users registered or deleted during it
+ *          may or may not be.
+ *
+ * @param[in] p_index The user index.
+ * @param[in] visit_func The function.
+ * @param[in/out] p_ctx The context passed to visit_func.
+ *
+ * @return 0 on success, -1 on error or if visit_func failed.
+ */
+int
+user_foreach (user_index_t * p_index, user_visit_f visit_func, void * p_ctx);
+
+/*!
+ * @brief This function puts back a user with a known id, as when
+ *          rebuilding the index from a snapshot or the log. A user with
+ *          the same username is replaced. Later registrations get ids
+ *          above the restored one.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] p_username The username, non-empty and at most
+ *              USER_DB_UNAME_MAX long.
+ * @param[in] p_password The password, non-empty and at most
+ *              USER_DB_PWORD_MAX long.
+ * @param[in] id The user's id. Must be non-zero.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+user_restore (user_index_t * p_index, const char * p_username, const char * p_password,
+              const uint32_t id);
+
+/*!
+ * @brief This function returns the id the next registered user gets.
+ *
+ * @param[in] p_index The user index.
+ *
+ * @return The id. 0 on error, or if every id is taken.
+ */
+uint32_t
+user_next_id (user_index_t * p_index);
+
+/*!
+ * @brief This function makes sure no user registered from now on gets an
+ *          id below a given one, so the ids of deleted users are not
+ *          handed out again after a restart.
+ *
+ * @param[in/out] p_index The user index.
+ * @param[in] next_id The lowest id a new user may get. 0 means every id
+ *              is taken.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+user_skip_ids (user_index_t * p_index, const uint32_t next_id);
+
+#endif // SERVER_USER_H
+
+/***   end of file   ***/
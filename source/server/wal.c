@@ -0,0 +1,1175 @@
+/*!
+ * @file server/wal.c
+ *
+ * @brief This file contains the write-ahead log that makes changes to the
+ *          server's state durable.
+ *
+ *          A record's checksum covers its payload, then its length and
+ *              sequence number, so appenders checksum the payload before
+ *              taking the mutex and only extend it by the header inside.
+ *
+ *          Appenders and the flusher share one mutex. Appenders hold it
+ *              only to copy a record in; the flusher holds it only to
+ *              swap buffers and to publish a batch's result, never while
+ *              writing or syncing.
+ *
+ *          The flusher starts a new segment only between batches, after
+ *              the last one was synced, so every segment but the newest
+ *              is durable to its end, and a segment is created and its
+ *              entry synced before any record is written to it.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "wal.h"
+
+/*!
+ * @brief The CRC-32C polynomial, reflected.
+ */
+#define WAL_CRC_POLY 0x82F63B78u
+
+/*!
+ * @brief The size of a segment's path, and of its directory's.
+ */
+#define WAL_PATH_MAX 4096
+
+/*!
+ * @brief The CRC-32C lookup table, built once.
+ */
+static uint32_t g_crc_table[256];
+static pthread_once_t g_crc_once = PTHREAD_ONCE_INIT;
+
+/*!
+ * @brief This is a static function that builds the CRC-32C lookup table.
+ *
+ * @return No return value expected.
+ */
+static void
+wal_crc_init (void)
+{
+    for (uint32_t byte = 0; byte < 256; ++byte)
+    {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc >> 1) ^ ((0 != (crc & 1)) ? WAL_CRC_POLY : 0);
+        }
+        g_crc_table[byte] = crc;
+    }
+}
+
+/*!
+ * @brief This is a static function that returns the monotonic time.
+ *
+ * @return The time in nanoseconds.
+ */
+static uint64_t
+wal_now_ns (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000u) + (uint64_t) now.tv_nsec;
+}
+
+/*!
+ * @brief This is a static function that returns the histogram bucket of
+ *          a value.
+ *
+ * @param[in] value The value.
+ *
+ * @return The bucket index.
+ */
+static size_t
+wal_bucket (const uint64_t value)
+{
+    size_t bucket = 0;
+    if (0 != value)
+    {
+        bucket = (size_t) (63 - __builtin_clzll(value));
+    }
+    if (bucket >= WAL_HIST_BUCKETS)
+    {
+        bucket = WAL_HIST_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+/*!
+ * @brief This is a static function that stores a value big-endian.
+ *
+ * @param[out] p_buf Where to store it.
+ * @param[in] value The value.
+ * @param[in] size The number of bytes, 4 or 8.
+ *
+ * @return No return value expected.
+ */
+static void
+wal_put (unsigned char * p_buf, const uint64_t value, const size_t size)
+{
+    for (size_t idx = 0; idx < size; ++idx)
+    {
+        p_buf[idx] = (unsigned char) (value >> (8 * (size - 1 - idx)));
+    }
+}
+
+/*!
+ * @brief This is a static function that loads a big-endian value.
+ *
+ * @param[in] p_buf Where to load it from.
+ * @param[in] size The number of bytes, 4 or 8.
+ *
+ * @return The value.
+ */
+static uint64_t
+wal_get (const unsigned char * p_buf, const size_t size)
+{
+    uint64_t value = 0;
+    for (size_t idx = 0; idx < size; ++idx)
+    {
+        value = (value << 8) | p_buf[idx];
+    }
+    return value;
+}
+
+/*!
+ * @brief This is a static function that extends a payload's checksum by
+ *          its record's length and sequence number.
+ *
+ * @param[in] crc The payload's checksum.
+ * @param[in] p_header The record header, with the length and sequence
+ *              number filled in.
+ *
+ * @return The record's checksum.
+ */
+static uint32_t
+wal_header_checksum (const uint32_t crc, const unsigned char * p_header)
+{
+    return wal_checksum(wal_checksum(crc, p_header, 4), p_header + 8, 8);
+}
+
+/*!
+ * @brief This is a static function that splits a log's path into the
+ *          directory its segments are in and the name they extend.
+ *
+ * @param[in] p_path The log's path.
+ * @param[out] p_dir The directory, of WAL_PATH_MAX bytes.
+ * @param[out] pp_name The name, within p_path.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+wal_dir (const char * p_path, char * p_dir, const char ** pp_name)
+{
+    int status = -1;
+    const char * p_slash = strrchr(p_path, '/');
+    strcpy(p_dir, ".");
+    *pp_name = p_path;
+    if (NULL != p_slash)
+    {
+        size_t len = (p_slash == p_path) ? 1 : (size_t) (p_slash - p_path);
+        if (len >= WAL_PATH_MAX)
+        {
+            errno = ENAMETOOLONG;
+            goto EXIT;
+        }
+        memcpy(p_dir, p_path, len);
+        p_dir[len] = '\0';
+        *pp_name = p_slash + 1;
+    }
+    if ('\0' == **pp_name)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that builds the path of a segment.
+ *
+ * @param[out] p_buf The path, of WAL_PATH_MAX bytes.
+ * @param[in] p_path The log's path.
+ * @param[in] first_lsn The sequence number of the segment's first record.
+ *
+ * @return 0 on success, -1 if the path is too long.
+ */
+static int
+wal_segment_path (char * p_buf, const char * p_path, const uint64_t first_lsn)
+{
+    int status = -1;
+    if (snprintf(p_buf, WAL_PATH_MAX, "%s.%016" PRIx64, p_path, first_lsn) >= WAL_PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        goto EXIT;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that compares two sequence numbers,
+ *          for sorting them in ascending order.
+ *
+ * @param[in] vp_lhs The first sequence number.
+ * @param[in] vp_rhs The second sequence number.
+ *
+ * @return Less than, equal to or greater than 0 as the first sorts
+ *          before, with or after the second.
+ */
+static int
+wal_compare (const void * vp_lhs, const void * vp_rhs)
+{
+    uint64_t lhs = *(const uint64_t *) vp_lhs;
+    uint64_t rhs = *(const uint64_t *) vp_rhs;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/*!
+ * @brief This is a static function that lists the sequence numbers the
+ *          segments of a log start at, oldest first.
+ *
+ * @param[in] p_path The log's path.
+ * @param[out] pp_firsts The sequence numbers, to free. NULL if there are
+ *              none.
+ * @param[out] p_count The number of sequence numbers.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+wal_list (const char * p_path, uint64_t ** pp_firsts, size_t * p_count)
+{
+    int status = -1;
+    uint64_t * p_firsts = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    char dir[WAL_PATH_MAX];
+    const char * p_name = NULL;
+    if (-1 == wal_dir(p_path, dir, &p_name))
+    {
+        goto EXIT;
+    }
+    size_t name_len = strlen(p_name);
+    DIR * p_handle = opendir(dir);
+    if (NULL == p_handle)
+    {
+        goto EXIT;
+    }
+    
+    struct dirent * p_entry = NULL;
+    while (NULL != (p_entry = readdir(p_handle)))
+    {
+        if ((0 != strncmp(p_entry->d_name, p_name, name_len)) ||
+            ('.' != p_entry->d_name[name_len]))
+        {
+            continue;
+        }
+        const char * p_digits = p_entry->d_name + name_len + 1;
+        if ((16 != strlen(p_digits)) ||
+            (16 != strspn(p_digits, "0123456789abcdef")))
+        {
+            continue;
+        }
+        uint64_t first_lsn = strtoull(p_digits, NULL, 16);
+        if (0 == first_lsn)
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = (0 == capacity) ? 8 : (capacity * 2);
+            uint64_t * p_grown = realloc(p_firsts, capacity * sizeof(uint64_t));
+            if (NULL == p_grown)
+            {
+                errno = ENOMEM;
+                goto CLOSE;
+            }
+            p_firsts = p_grown;
+        }
+        p_firsts[count++] = first_lsn;
+    }
+    if (0 != count)
+    {
+        qsort(p_firsts, count, sizeof(uint64_t), wal_compare);
+    }
+    *pp_firsts = p_firsts;
+    *p_count = count;
+    p_firsts = NULL;
+    status = 0;
+    
+    CLOSE:
+        closedir(p_handle);
+    EXIT:
+        free(p_firsts);
+        return status;
+}
+
+/*!
+ * @brief This is a static function that reads the whole records of a
+ *          segment.
+ *
+ * @param[in] p_path The log's path.
+ * @param[in] first_lsn The sequence number the segment starts at.
+ * @param[in] after_lsn Records up to this sequence number are skipped.
+ * @param[in] replay_func The function to hand records to. May be NULL.
+ * @param[in/out] p_ctx The context passed to replay_func.
+ * @param[out] p_last_lsn The sequence number of the last whole record,
+ *              first_lsn - 1 if there is none.
+ *
+ * @return 0 on success, -1 on a read error or if replay_func failed.
+ */
+static int
+wal_scan (const char * p_path, const uint64_t first_lsn, const uint64_t after_lsn,
+          wal_replay_f replay_func, void * p_ctx, uint64_t * p_last_lsn)
+{
+    int status = -1;
+    unsigned char header[WAL_HEADER_SIZE];
+    unsigned char payload[WAL_MAX_RECORD];
+    uint64_t last_lsn = first_lsn - 1;
+    char path[WAL_PATH_MAX];
+    if (-1 == wal_segment_path(path, p_path, first_lsn))
+    {
+        goto EXIT;
+    }
+    FILE * p_file = fopen(path, "rb");
+    if (NULL == p_file)
+    {
+        goto EXIT;
+    }
+    
+    for (;;)
+    {
+        if (1 != fread(header, WAL_HEADER_SIZE, 1, p_file))
+        {
+            break;
+        }
+        size_t len = (size_t) wal_get(header, 4);
+        uint64_t lsn = wal_get(header + 8, 8);
+        if ((0 == len) ||
+            (len > WAL_MAX_RECORD) ||
+            ((last_lsn + 1) != lsn) ||
+            (1 != fread(payload, len, 1, p_file)) ||
+            (wal_get(header + 4, 4) != wal_header_checksum(wal_checksum(0, payload, len),
+                                                           header)))
+        {
+            break;
+        }
+        
+        if ((lsn > after_lsn) &&
+            (NULL != replay_func) &&
+            (0 != replay_func(lsn, payload, len, p_ctx)))
+        {
+            goto CLOSE;
+        }
+        last_lsn = lsn;
+    }
+    if (0 != ferror(p_file))
+    {
+        errno = EIO;
+        goto CLOSE;
+    }
+    
+    *p_last_lsn = last_lsn;
+    status = 0;
+    
+    CLOSE:
+        fclose(p_file);
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that syncs the directory holding a
+ *          log's segments, so their entries survive a crash.
+ *
+ * @param[in] p_path The log's path.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+wal_sync_dir (const char * p_path)
+{
+    int status = -1;
+    char dir[WAL_PATH_MAX];
+    const char * p_name = NULL;
+    if (-1 == wal_dir(p_path, dir, &p_name))
+    {
+        goto EXIT;
+    }
+    
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == fd)
+    {
+        goto EXIT;
+    }
+    status = fsync(fd);
+    close(fd);
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that writes a whole buffer to a file.
+ *
+ * @param[in] fd The file.
+ * @param[in] p_buf The buffer.
+ * @param[in] len The buffer's length.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+wal_write_all (const int fd, const unsigned char * p_buf, size_t len)
+{
+    int status = -1;
+    while (0 != len)
+    {
+        ssize_t written = write(fd, p_buf, len);
+        if (-1 == written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            goto EXIT;
+        }
+        p_buf += written;
+        len -= (size_t) written;
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that creates an empty segment, or
+ *          empties one left over from a crash, and makes its entry
+ *          durable.
+ *
+ * @param[in] p_path The log's path.
+ * @param[in] first_lsn The sequence number of its first record.
+ *
+ * @return The segment's file descriptor. -1 on error.
+ */
+static int
+wal_segment_create (const char * p_path, const uint64_t first_lsn)
+{
+    int fd = -1;
+    char path[WAL_PATH_MAX];
+    if (-1 == wal_segment_path(path, p_path, first_lsn))
+    {
+        goto EXIT;
+    }
+    
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ((-1 != fd) &&
+        ((-1 == fdatasync(fd)) ||
+         (-1 == wal_sync_dir(p_path))))
+    {
+        int error = errno;
+        close(fd);
+        fd = -1;
+        errno = error;
+    }
+    
+    EXIT:
+        return fd;
+}
+
+/*!
+ * @brief This is a static function that moves the flusher on to a new
+ *          segment. The old one is kept open if the new one cannot be
+ *          created.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] first_lsn The sequence number of the new segment's first
+ *              record.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int
+wal_roll (wal_t * p_wal, const uint64_t first_lsn)
+{
+    int status = -1;
+    int fd = wal_segment_create(p_wal->p_path, first_lsn);
+    if (-1 == fd)
+    {
+        goto EXIT;
+    }
+    
+    close(p_wal->fd);
+    p_wal->fd = fd;
+    p_wal->segment_len = 0;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This is a static function that defines the behavior of the
+ *          flusher thread.
+ *
+ *          The flusher waits for records, optionally holds the batch
+ *              open until it is large or old enough, swaps the buffers,
+ *              then writes and syncs the batch outside the mutex, in a
+ *              new segment if the current one is full. Once the log is
+ *              asked to stop, it drains what is left first.
+ *
+ * @param[in/out] vp_wal A void pointer to the log.
+ *
+ * @return No return value expected.
+ */
+static void *
+wal_flusher (void * vp_wal)
+{
+    wal_t * p_wal = (wal_t *) vp_wal;
+    uint64_t delay_ns = p_wal->attr.max_delay_us * 1000u;
+    
+    pthread_mutex_lock(&(p_wal->mutex));
+    for (;;)
+    {
+        while ((0 == p_wal->fill_len) &&
+               (false == p_wal->b_shutdown))
+        {
+            pthread_cond_wait(&(p_wal->cond_data), &(p_wal->mutex));
+        }
+        if (0 == p_wal->fill_len)
+        {
+            break;
+        }
+        
+        // Hold the batch open until it is large enough, or its first
+        // record has waited long enough.
+        if (0 != delay_ns)
+        {
+            uint64_t deadline_ns = p_wal->fill_first_ns + delay_ns;
+            struct timespec deadline;
+            deadline.tv_sec = (time_t) (deadline_ns / 1000000000u);
+            deadline.tv_nsec = (long) (deadline_ns % 1000000000u);
+            int waited = 0;
+            while ((false == p_wal->b_shutdown) &&
+                   (p_wal->fill_len < p_wal->attr.max_batch) &&
+                   (ETIMEDOUT != waited))
+            {
+                waited = pthread_cond_timedwait(&(p_wal->cond_data), &(p_wal->mutex), &deadline);
+            }
+        }
+        
+        // Take the batch, and let appenders waiting for room go on.
+        unsigned char * p_batch = p_wal->p_fill;
+        size_t batch_len = p_wal->fill_len;
+        uint64_t batch_first = p_wal->durable_lsn + 1;
+        uint64_t batch_last = p_wal->next_lsn - 1;
+        uint64_t batch_records = batch_last - p_wal->durable_lsn;
+        p_wal->p_fill = p_wal->p_flush;
+        p_wal->p_flush = p_batch;
+        p_wal->fill_len = 0;
+        bool b_failed = (0 != p_wal->error);
+        pthread_cond_broadcast(&(p_wal->cond_durable));
+        pthread_mutex_unlock(&(p_wal->mutex));
+        
+        // A failed log writes nothing more, so it never holds a gap.
+        int error = 0;
+        uint64_t start_ns = wal_now_ns();
+        if ((false == b_failed) &&
+            (((p_wal->segment_len >= p_wal->attr.segment_size) &&
+              (-1 == wal_roll(p_wal, batch_first))) ||
+             (-1 == wal_write_all(p_wal->fd, p_batch, batch_len)) ||
+             (-1 == fdatasync(p_wal->fd))))
+        {
+            error = errno;
+        }
+        uint64_t sync_ns = wal_now_ns() - start_ns;
+        
+        pthread_mutex_lock(&(p_wal->mutex));
+        if ((0 == error) &&
+            (false == b_failed))
+        {
+            p_wal->durable_lsn = batch_last;
+            p_wal->segment_len += batch_len;
+            atomic_fetch_add_explicit(&(p_wal->batches), 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(p_wal->batch_hist + wal_bucket(batch_records), 1,
+                                      memory_order_relaxed);
+            atomic_fetch_add_explicit(p_wal->sync_hist + wal_bucket(sync_ns), 1,
+                                      memory_order_relaxed);
+        }
+        else if (0 == p_wal->error)
+        {
+            p_wal->error = error;
+        }
+        pthread_cond_broadcast(&(p_wal->cond_durable));
+    }
+    pthread_mutex_unlock(&(p_wal->mutex));
+    
+    return NULL;
+}
+
+/*!
+ * @brief This function initializes log creation attributes to their
+ *          defaults.
+ *
+ * @param[out] p_attr The attributes.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+wal_attr_init (wal_attr_t * p_attr)
+{
+    int status = -1;
+    if (NULL == p_attr)
+    {
+        goto EXIT;
+    }
+    
+    p_attr->buf_size = WAL_DEFAULT_BUF_SIZE;
+    p_attr->max_batch = WAL_DEFAULT_MAX_BATCH;
+    p_attr->max_delay_us = WAL_DEFAULT_MAX_DELAY_US;
+    p_attr->segment_size = WAL_DEFAULT_SEGMENT_SIZE;
+    p_attr->last_lsn = WAL_LSN_UNKNOWN;
+    
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function opens a log for appending, creating it if needed,
+ *          and starts its flusher.
+ *
+ *          Numbering goes on after the last whole record, in a new
+ *              segment, so a record torn by a crash is never followed by
+ *              new ones in its own segment.
+ *
+ * @param[in] p_path The log's path, which segment names extend.
+ * @param[in] p_attr The creation attributes.
+ *
+ * @return Pointer to the log. NULL on error. errno is set to EINVAL if
+ *          the log holds a segment past the last_lsn it was given.
+ */
+wal_t *
+wal_open (const char * p_path, const wal_attr_t * p_attr)
+{
+    int status = -1;
+    wal_t * p_wal = NULL;
+    uint64_t * p_firsts = NULL;
+    size_t count = 0;
+    bool b_mutex = false;
+    bool b_cond_data = false;
+    bool b_cond_durable = false;
+    if ((NULL == p_path) ||
+        (NULL == p_attr) ||
+        (p_attr->buf_size < (WAL_HEADER_SIZE + WAL_MAX_RECORD)) ||
+        (0 == p_attr->max_batch) ||
+        (p_attr->max_batch > p_attr->buf_size) ||
+        (0 == p_attr->segment_size))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    p_wal = calloc(1, sizeof(wal_t));
+    if (NULL == p_wal)
+    {
+        goto EXIT;
+    }
+    p_wal->fd = -1;
+    p_wal->attr = *p_attr;
+    p_wal->p_path = strdup(p_path);
+    if ((NULL == p_wal->p_path) ||
+        (-1 == wal_list(p_path, &p_firsts, &count)))
+    {
+        goto EXIT;
+    }
+    
+    // Find where the whole records end, unless the replay that came
+    // before already did. Only the newest segment can end early.
+    uint64_t last_lsn = p_attr->last_lsn;
+    if (WAL_LSN_UNKNOWN == last_lsn)
+    {
+        last_lsn = 0;
+        if ((0 != count) &&
+            (-1 == wal_scan(p_path, p_firsts[count - 1], UINT64_MAX, NULL, NULL, &last_lsn)))
+        {
+            goto EXIT;
+        }
+    }
+    else if ((0 != count) &&
+             (p_firsts[count - 1] > (last_lsn + 1)))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // Go on in a new segment, past any torn record.
+    p_wal->fd = wal_segment_create(p_path, last_lsn + 1);
+    if (-1 == p_wal->fd)
+    {
+        goto EXIT;
+    }
+    p_wal->next_lsn = last_lsn + 1;
+    p_wal->durable_lsn = last_lsn;
+    
+    p_wal->p_fill = malloc(p_attr->buf_size);
+    p_wal->p_flush = malloc(p_attr->buf_size);
+    if ((NULL == p_wal->p_fill) ||
+        (NULL == p_wal->p_flush))
+    {
+        goto EXIT;
+    }
+    
+    b_mutex = (0 == pthread_mutex_init(&(p_wal->mutex), NULL));
+    pthread_condattr_t cond_attr;
+    if ((false == b_mutex) ||
+        (0 != pthread_condattr_init(&cond_attr)))
+    {
+        goto EXIT;
+    }
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    b_cond_data = (0 == pthread_cond_init(&(p_wal->cond_data), &cond_attr));
+    pthread_condattr_destroy(&cond_attr);
+    b_cond_durable = (0 == pthread_cond_init(&(p_wal->cond_durable), NULL));
+    if ((false == b_cond_data) ||
+        (false == b_cond_durable) ||
+        (0 != pthread_create(&(p_wal->flusher), NULL, wal_flusher, p_wal)))
+    {
+        goto EXIT;
+    }
+    
+    status = 0;
+    
+    EXIT:
+        if ((-1 == status) &&
+            (NULL != p_wal))
+        {
+            if (true == b_cond_durable)
+            {
+                pthread_cond_destroy(&(p_wal->cond_durable));
+            }
+            if (true == b_cond_data)
+            {
+                pthread_cond_destroy(&(p_wal->cond_data));
+            }
+            if (true == b_mutex)
+            {
+                pthread_mutex_destroy(&(p_wal->mutex));
+            }
+            if (-1 != p_wal->fd)
+            {
+                close(p_wal->fd);
+            }
+            free(p_wal->p_fill);
+            free(p_wal->p_flush);
+            free(p_wal->p_path);
+            free(p_wal);
+            p_wal = NULL;
+        }
+        free(p_firsts);
+        return p_wal;
+}
+
+/*!
+ * @brief This function makes every appended record durable, stops the
+ *          flusher and closes the log. No other thread may be using it.
+ *
+ * @param[in/out] p_wal The log.
+ *
+ * @return 0 on success, -1 if any record could not be made durable.
+ */
+int
+wal_close (wal_t * p_wal)
+{
+    int status = -1;
+    if (NULL == p_wal)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_mutex_lock(&(p_wal->mutex));
+    p_wal->b_shutdown = true;
+    pthread_cond_signal(&(p_wal->cond_data));
+    pthread_mutex_unlock(&(p_wal->mutex));
+    pthread_join(p_wal->flusher, NULL);
+    
+    status = 0;
+    if (0 != p_wal->error)
+    {
+        errno = EIO;
+        status = -1;
+    }
+    if (0 != close(p_wal->fd))
+    {
+        status = -1;
+    }
+    pthread_cond_destroy(&(p_wal->cond_durable));
+    pthread_cond_destroy(&(p_wal->cond_data));
+    pthread_mutex_destroy(&(p_wal->mutex));
+    free(p_wal->p_fill);
+    free(p_wal->p_flush);
+    free(p_wal->p_path);
+    free(p_wal);
+    p_wal = NULL;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function appends a record. It returns once the record is
+ *          buffered, before it is durable.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] p_data The payload.
+ * @param[in] len The payload's length, from 1 to WAL_MAX_RECORD.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error. errno is set to EIO if the log has
+ *          failed.
+ */
+int
+wal_append (wal_t * p_wal, const void * p_data, const size_t len, uint64_t * p_lsn)
+{
+    int status = -1;
+    if ((NULL == p_wal) ||
+        (NULL == p_data) ||
+        (NULL == p_lsn) ||
+        (0 == len) ||
+        (len > WAL_MAX_RECORD))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    uint32_t crc = wal_checksum(0, p_data, len);
+    size_t total = WAL_HEADER_SIZE + len;
+    
+    pthread_mutex_lock(&(p_wal->mutex));
+    while ((0 == p_wal->error) &&
+           ((p_wal->fill_len + total) > p_wal->attr.buf_size))
+    {
+        pthread_cond_wait(&(p_wal->cond_durable), &(p_wal->mutex));
+    }
+    if (0 != p_wal->error)
+    {
+        pthread_mutex_unlock(&(p_wal->mutex));
+        errno = EIO;
+        goto EXIT;
+    }
+    
+    unsigned char * p_header = p_wal->p_fill + p_wal->fill_len;
+    uint64_t lsn = p_wal->next_lsn++;
+    wal_put(p_header, len, 4);
+    wal_put(p_header + 8, lsn, 8);
+    wal_put(p_header + 4, wal_header_checksum(crc, p_header), 4);
+    memcpy(p_header + WAL_HEADER_SIZE, p_data, len);
+    
+    // Wake the flusher when it has a batch to start, or when a batch it
+    // is holding open has grown large enough.
+    size_t old_len = p_wal->fill_len;
+    p_wal->fill_len += total;
+    if (0 == old_len)
+    {
+        p_wal->fill_first_ns = wal_now_ns();
+        pthread_cond_signal(&(p_wal->cond_data));
+    }
+    else if ((old_len < p_wal->attr.max_batch) &&
+             (p_wal->fill_len >= p_wal->attr.max_batch))
+    {
+        pthread_cond_signal(&(p_wal->cond_data));
+    }
+    pthread_mutex_unlock(&(p_wal->mutex));
+    
+    atomic_fetch_add_explicit(&(p_wal->records), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(p_wal->bytes), total, memory_order_relaxed);
+    *p_lsn = lsn;
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function waits until a record, and every record before it,
+ *          is durable.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] lsn The record's sequence number.
+ *
+ * @return 0 on success, -1 on error. errno is set to EIO if the record
+ *          could not be made durable.
+ */
+int
+wal_commit (wal_t * p_wal, const uint64_t lsn)
+{
+    int status = -1;
+    if ((NULL == p_wal) ||
+        (0 == lsn))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    uint64_t start_ns = wal_now_ns();
+    pthread_mutex_lock(&(p_wal->mutex));
+    if (lsn >= p_wal->next_lsn)
+    {
+        pthread_mutex_unlock(&(p_wal->mutex));
+        errno = EINVAL;
+        goto EXIT;
+    }
+    while ((p_wal->durable_lsn < lsn) &&
+           (0 == p_wal->error))
+    {
+        pthread_cond_wait(&(p_wal->cond_durable), &(p_wal->mutex));
+    }
+    bool b_durable = (p_wal->durable_lsn >= lsn);
+    pthread_mutex_unlock(&(p_wal->mutex));
+    if (false == b_durable)
+    {
+        errno = EIO;
+        goto EXIT;
+    }
+    
+    atomic_fetch_add_explicit(p_wal->commit_hist + wal_bucket(wal_now_ns() - start_ns), 1,
+                              memory_order_relaxed);
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function returns the sequence number of the last record
+ *          appended, durable or not.
+ *
+ * @param[in/out] p_wal The log.
+ *
+ * @return The sequence number. 0 if no record was appended or on error.
+ */
+uint64_t
+wal_last_lsn (wal_t * p_wal)
+{
+    uint64_t lsn = 0;
+    if (NULL == p_wal)
+    {
+        goto EXIT;
+    }
+    
+    pthread_mutex_lock(&(p_wal->mutex));
+    lsn = p_wal->next_lsn - 1;
+    pthread_mutex_unlock(&(p_wal->mutex));
+    
+    EXIT:
+        return lsn;
+}
+
+/*!
+ * @brief This function takes a snapshot of a log's counters.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+wal_stats_snapshot (wal_t * p_wal, wal_stats_t * p_stats)
+{
+    int status = -1;
+    if ((NULL == p_wal) ||
+        (NULL == p_stats))
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    pthread_mutex_lock(&(p_wal->mutex));
+    p_stats->durable = p_wal->durable_lsn;
+    pthread_mutex_unlock(&(p_wal->mutex));
+    p_stats->records = atomic_load_explicit(&(p_wal->records), memory_order_relaxed);
+    p_stats->bytes = atomic_load_explicit(&(p_wal->bytes), memory_order_relaxed);
+    p_stats->batches = atomic_load_explicit(&(p_wal->batches), memory_order_relaxed);
+    for (size_t idx = 0; idx < WAL_HIST_BUCKETS; ++idx)
+    {
+        p_stats->batch_hist[idx] = atomic_load_explicit(p_wal->batch_hist + idx,
+                                                        memory_order_relaxed);
+        p_stats->sync_hist[idx] = atomic_load_explicit(p_wal->sync_hist + idx,
+                                                       memory_order_relaxed);
+        p_stats->commit_hist[idx] = atomic_load_explicit(p_wal->commit_hist + idx,
+                                                         memory_order_relaxed);
+    }
+    status = 0;
+    
+    EXIT:
+        return status;
+}
+
+/*!
+ * @brief This function removes the segments that hold only records up to
+ *          a sequence number, once something else, such as a snapshot,
+ *          holds their effect. The segment being appended to is kept.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] lsn The sequence number.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+wal_truncate (wal_t * p_wal, const uint64_t lsn)
+{
+    int status = -1;
+    uint64_t * p_firsts = NULL;
+    size_t count = 0;
+    if (NULL == p_wal)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // A segment the flusher starts meanwhile is either listed or newer
+    // than every segment listed, so it is never taken for a full one.
+    if (-1 == wal_list(p_wal->p_path, &p_firsts, &count))
+    {
+        goto EXIT;
+    }
+    size_t removed = 0;
+    while (((removed + 1) < count) &&
+           (p_firsts[removed + 1] <= (lsn + 1)))
+    {
+        char path[WAL_PATH_MAX];
+        if ((-1 == wal_segment_path(path, p_wal->p_path, p_firsts[removed])) ||
+            ((-1 == unlink(path)) && (ENOENT != errno)))
+        {
+            goto EXIT;
+        }
+        removed++;
+    }
+    if ((0 != removed) &&
+        (-1 == wal_sync_dir(p_wal->p_path)))
+    {
+        goto EXIT;
+    }
+    status = 0;
+    
+    EXIT:
+        free(p_firsts);
+        return status;
+}
+
+/*!
+ * @brief This function reads a log, handing each record after a given
+ *          sequence number to a function. It starts at the segment that
+ *          holds the record after that number, and stops at the end of
+ *          the newest segment. A record that is torn, corrupt or out of
+ *          sequence ends its segment. The log must not be open for
+ *          appending.
+ *
+ * @param[in] p_path The log's path. A log without segments is empty.
+ * @param[in] after_lsn Records up to this sequence number are skipped.
+ * @param[in] replay_func The function. May be NULL to only scan.
+ * @param[in/out] p_ctx The context passed to replay_func.
+ * @param[out] p_last_lsn The sequence number of the last whole record,
+ *              0 if there is none. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENODATA if records
+ *          after after_lsn are missing, because their segments were
+ *          removed or a segment does not end where the next one starts.
+ */
+int
+wal_replay (const char * p_path, const uint64_t after_lsn, wal_replay_f replay_func,
+            void * p_ctx, uint64_t * p_last_lsn)
+{
+    int status = -1;
+    uint64_t * p_firsts = NULL;
+    size_t count = 0;
+    uint64_t last_lsn = 0;
+    if (NULL == p_path)
+    {
+        errno = EINVAL;
+        goto EXIT;
+    }
+    
+    // Skip the segments wholly before the first record wanted.
+    if (-1 == wal_list(p_path, &p_firsts, &count))
+    {
+        goto EXIT;
+    }
+    size_t start = 0;
+    while (((start + 1) < count) &&
+           (p_firsts[start + 1] <= (after_lsn + 1)))
+    {
+        start++;
+    }
+    if (0 != count)
+    {
+        if (p_firsts[start] > (after_lsn + 1))
+        {
+            errno = ENODATA;
+            goto EXIT;
+        }
+        last_lsn = p_firsts[start] - 1;
+    }
+    
+    for (size_t idx = start; idx < count; ++idx)
+    {
+        if (p_firsts[idx] != (last_lsn + 1))
+        {
+            errno = ENODATA;
+            goto EXIT;
+        }
+        if (-1 == wal_scan(p_path, p_firsts[idx], after_lsn, replay_func, p_ctx, &last_lsn))
+        {
+            goto EXIT;
+        }
+    }
+    if (NULL != p_last_lsn)
+    {
+        *p_last_lsn = last_lsn;
+    }
+    status = 0;
+    
+    EXIT:
+        free(p_firsts);
+        return status;
+}
+
+/*!
+ * @brief This function computes the CRC-32C of a buffer, as used for log
+ *          records.
+ *
+ * @param[in] crc The CRC of the data before the buffer, 0 to start.
+ * @param[in] p_data The buffer.
+ * @param[in] len The buffer's length.
+ *
+ * @return The CRC of the data up to the end of the buffer.
+ */
+uint32_t
+wal_checksum (uint32_t crc, const void * p_data, const size_t len)
+{
+    pthread_once(&g_crc_once, wal_crc_init);
+    const unsigned char * p_byte = p_data;
+    crc = ~crc;
+    for (size_t idx = 0; idx < len; ++idx)
+    {
+        crc = g_crc_table[(crc ^ p_byte[idx]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/***   end of file   ***/
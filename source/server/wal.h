@@ -0,0 +1,356 @@
+/*!
+ * @file server/wal.h
+ *
+ * @brief This file contains the write-ahead log that makes changes to the
+ *          server's state durable.
+ *
+ *          The log is a sequence of append-only segment files of
+ *              records. Each record has a header holding its length, its
+ *              log sequence number and a checksum, followed by an opaque
+ *              payload. Sequence numbers start at 1 and have no gaps, so
+ *              replay can tell a record left over from a crash from one
+ *              that belongs.
+ *
+ *          A segment is named after the log's path and the sequence number
+ *              of its first record, in 16 hex digits, e.g.
+ *              bank.wal.0000000000000001. Opening the log starts a new
+ *              segment, and so does the flusher once the current one has
+ *              grown past a size bound. Replay skips the segments wholly
+ *              before the record it starts from without reading them, and
+ *              segments whose records a snapshot already holds can be
+ *              removed, so neither restart time nor disk use grows with
+ *              the age of the log.
+ *
+ *          Appending only copies the record into a shared in-memory
+ *              buffer under a mutex. A dedicated flusher thread swaps that
+ *              buffer for a second one, writes it out and issues one
+ *              fdatasync for the whole batch, then wakes every thread
+ *              waiting on a record of the batch at once. Records appended
+ *              while a batch is being synced gather into the next one, so
+ *              the sync cost is shared by however many threads committed
+ *              in the meantime.
+ *
+ *          The flusher can also hold a batch open for a while, up to a
+ *              size bound, to gather more records per sync at the cost of
+ *              latency.
+ *
+ *          Functions supported are as follows:
+ *
+ *              - wal_attr_init
+ *              - wal_open
+ *              - wal_close
+ *              - wal_append
+ *              - wal_commit
+ *              - wal_last_lsn
+ *              - wal_stats_snapshot
+ *              - wal_truncate
+ *              - wal_replay
+ *              - wal_checksum
+ */
+
+#ifndef SERVER_WAL_H
+#define SERVER_WAL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/*!
+ * @brief The size of a record header: the payload length, the checksum
+ *          and the sequence number, all big-endian.
+ */
+#define WAL_HEADER_SIZE 16
+
+/*!
+ * @brief The largest record payload.
+ */
+#define WAL_MAX_RECORD 4096
+
+/*!
+ * @brief The number of histogram buckets. Bucket i counts values of 2^i
+ *          up to 2^(i+1), bucket 0 also counts zero, and the last bucket
+ *          counts everything larger.
+ */
+#define WAL_HIST_BUCKETS 32
+
+/*!
+ * @brief The default creation attributes.
+ */
+#define WAL_DEFAULT_BUF_SIZE (1024 * 1024)
+#define WAL_DEFAULT_MAX_BATCH (256 * 1024)
+#define WAL_DEFAULT_MAX_DELAY_US 0
+#define WAL_DEFAULT_SEGMENT_SIZE (16 * 1024 * 1024)
+
+/*!
+ * @brief The last sequence number of a log that wal_open must find out
+ *          for itself.
+ */
+#define WAL_LSN_UNKNOWN UINT64_MAX
+
+/*!
+ * @brief This datatype defines the creation attributes of a log. It
+ *          should be initialized with wal_attr_init before individual
+ *          fields are set.
+ *
+ * @param buf_size The size of each of the two in-memory buffers. Appends
+ *          wait while the buffer being filled is full. Must hold at
+ *          least one record of WAL_MAX_RECORD bytes.
+ * @param max_batch The number of buffered bytes at which the flusher
+ *          starts a batch without waiting any longer. Must be non-zero
+ *          and at most buf_size, or a full buffer would still wait out
+ *          max_delay_us.
+ * @param max_delay_us The longest the flusher holds a batch open after
+ *          its first record, waiting for it to reach max_batch bytes. 0
+ *          starts every batch as soon as the last one is synced.
+ * @param segment_size The size past which the flusher starts a new
+ *          segment before its next batch. Must be non-zero.
+ * @param last_lsn The sequence number of the last whole record, as
+ *          wal_replay reported it, so wal_open need not read the log to
+ *          find it. WAL_LSN_UNKNOWN makes wal_open read the newest
+ *          segment.
+ */
+typedef struct _wal_attr
+{
+    size_t   buf_size;
+    size_t   max_batch;
+    uint64_t max_delay_us;
+    uint64_t segment_size;
+    uint64_t last_lsn;
+} wal_attr_t;
+
+/*!
+ * @brief This datatype defines a log's counters.
+ *
+ * @param records Records appended.
+ * @param bytes Bytes appended, headers included.
+ * @param batches Batches written and synced.
+ * @param durable The sequence number of the last durable record.
+ * @param batch_hist Histogram of the number of records per batch.
+ * @param sync_hist Histogram of how long each batch took to write and
+ *          sync, in nanoseconds.
+ * @param commit_hist Histogram of how long wal_commit waited for its
+ *          record to be durable, in nanoseconds.
+ */
+typedef struct _wal_stats
+{
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t batches;
+    uint64_t durable;
+    uint64_t batch_hist[WAL_HIST_BUCKETS];
+    uint64_t sync_hist[WAL_HIST_BUCKETS];
+    uint64_t commit_hist[WAL_HIST_BUCKETS];
+} wal_stats_t;
+
+/*!
+ * @brief This datatype defines a log.
+ *
+ * @param mutex Guards everything below except the counters.
+ * @param cond_data Signalled when the flusher has records to write or
+ *          must stop.
+ * @param cond_durable Broadcast when a batch is synced or fails, and
+ *          when the buffer being filled is swapped out.
+ * @param fd The segment being appended to. Only the flusher changes it.
+ * @param segment_len The number of bytes in the segment. Only the flusher
+ *          touches it.
+ * @param p_path The log's path, which segment names extend.
+ * @param attr The creation attributes.
+ * @param p_fill The buffer records are appended to.
+ * @param fill_len The number of bytes in p_fill.
+ * @param fill_first_ns When the first record of p_fill was appended.
+ * @param p_flush The buffer the flusher writes out.
+ * @param next_lsn The sequence number of the next record.
+ * @param durable_lsn The sequence number of the last durable record.
+ * @param error The errno of the first failed write or sync. 0 while the
+ *          log is healthy. A failed log takes no more records.
+ * @param b_shutdown Whether the flusher must drain and stop.
+ * @param flusher The flusher thread.
+ * @param records See wal_stats_t.
+ * @param bytes See wal_stats_t.
+ * @param batches See wal_stats_t.
+ * @param batch_hist See wal_stats_t.
+ * @param sync_hist See wal_stats_t.
+ * @param commit_hist See wal_stats_t.
+ */
+typedef struct _wal
+{
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond_data;
+    pthread_cond_t   cond_durable;
+    int              fd;
+    uint64_t         segment_len;
+    char *           p_path;
+    wal_attr_t       attr;
+    unsigned char *  p_fill;
+    size_t           fill_len;
+    uint64_t         fill_first_ns;
+    unsigned char *  p_flush;
+    uint64_t         next_lsn;
+    uint64_t         durable_lsn;
+    int              error;
+    bool             b_shutdown;
+    pthread_t        flusher;
+    _Atomic uint64_t records;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t batches;
+    _Atomic uint64_t batch_hist[WAL_HIST_BUCKETS];
+    _Atomic uint64_t sync_hist[WAL_HIST_BUCKETS];
+    _Atomic uint64_t commit_hist[WAL_HIST_BUCKETS];
+} wal_t;
+
+/*!
+ * @brief This datatype defines the function wal_replay hands each record
+ *          to.
+ *
+ * @param[in] lsn The record's sequence number.
+ * @param[in] p_data The record's payload.
+ * @param[in] len The payload's length.
+ * @param[in/out] p_ctx The context passed to wal_replay.
+ *
+ * @return 0 to go on, -1 to stop the replay with an error.
+ */
+typedef int (* wal_replay_f) (const uint64_t lsn, const void * p_data, const size_t len,
+                              void * p_ctx);
+
+/*!
+ * @brief This function initializes log creation attributes to their
+ *          defaults.
+ *
+ * @param[out] p_attr The attributes.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+wal_attr_init (wal_attr_t * p_attr);
+
+/*!
+ * @brief This function opens a log for appending, creating it if needed,
+ *          and starts its flusher.
+ *
+ *          Numbering goes on after the last whole record, in a new
+ *              segment, so a record torn by a crash is never followed by
+ *              new ones in its own segment.
+ *
+ * @param[in] p_path The log's path, which segment names extend.
+ * @param[in] p_attr The creation attributes.
+ *
+ * @return Pointer to the log. NULL on error. errno is set to EINVAL if
+ *          the log holds a segment past the last_lsn it was given.
+ */
+wal_t *
+wal_open (const char * p_path, const wal_attr_t * p_attr);
+
+/*!
+ * @brief This function makes every appended record durable, stops the
+ *          flusher and closes the log. No other thread may be using it.
+ *
+ * @param[in/out] p_wal The log.
+ *
+ * @return 0 on success, -1 if any record could not be made durable.
+ */
+int
+wal_close (wal_t * p_wal);
+
+/*!
+ * @brief This function appends a record. It returns once the record is
+ *          buffered, before it is durable.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] p_data The payload.
+ * @param[in] len The payload's length, from 1 to WAL_MAX_RECORD.
+ * @param[out] p_lsn The record's sequence number, to pass to wal_commit.
+ *
+ * @return 0 on success, -1 on error. errno is set to EIO if the log has
+ *          failed.
+ */
+int
+wal_append (wal_t * p_wal, const void * p_data, const size_t len, uint64_t * p_lsn);
+
+/*!
+ * @brief This function waits until a record, and every record before it,
+ *          is durable.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] lsn The record's sequence number.
+ *
+ * @return 0 on success, -1 on error. errno is set to EIO if the record
+ *          could not be made durable.
+ */
+int
+wal_commit (wal_t * p_wal, const uint64_t lsn);
+
+/*!
+ * @brief This function returns the sequence number of the last record
+ *          appended, durable or not.
+ *
+ * @param[in/out] p_wal The log.
+ *
+ * @return The sequence number. 0 if no record was appended or on error.
+ */
+uint64_t
+wal_last_lsn (wal_t * p_wal);
+
+/*!
+ * @brief This function takes a snapshot of a log's counters.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[out] p_stats The snapshot to fill.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+wal_stats_snapshot (wal_t * p_wal, wal_stats_t * p_stats);
+
+/*!
+ * @brief This function removes the segments that hold only records up to
+ *          a sequence number, once something else, such as a snapshot,
+ *          holds their effect. The segment being appended to is kept.
+ *
+ * @param[in/out] p_wal The log.
+ * @param[in] lsn The sequence number.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int
+wal_truncate (wal_t * p_wal, const uint64_t lsn);
+
+/*!
+ * @brief This function reads a log, handing each record after a given
+ *          sequence number to a function. It starts at the segment that
+ *          holds the record after that number, and stops at the end of
+ *          the newest segment. A record that is torn, corrupt or out of
+ *          sequence ends its segment. The log must not be open for
+ *          appending.
+ *
+ * @param[in] p_path The log's path. A log without segments is empty.
+ * @param[in] after_lsn Records up to this sequence number are skipped.
+ * @param[in] replay_func The function. May be NULL to only scan.
+ * @param[in/out] p_ctx The context passed to replay_func.
+ * @param[out] p_last_lsn The sequence number of the last whole record,
+ *              0 if there is none. May be NULL.
+ *
+ * @return 0 on success, -1 on error. errno is set to ENODATA if records
+ *          after after_lsn are missing, because their segments were
+ *          removed or a segment ends before the next one starts.
+ */
+int
+wal_replay (const char * p_path, const uint64_t after_lsn, wal_replay_f replay_func,
+            void * p_ctx, uint64_t * p_last_lsn);
+
+/*!
+ * @brief This function computes the CRC-32C of a buffer, as used for log
+ *          records.
+ *
+ * @param[in] crc The CRC of the data before the buffer, 0 to start.
+ * @param[in] p_data The buffer.
+ * @param[in] len The buffer's length.
+ *
+ * @return The CRC of the data up to the end of the buffer.
+ */
+uint32_t
+wal_checksum (uint32_t crc, const void * p_data, const size_t len);
+
+#endif // SERVER_WAL_H
+
+/***   end of file   ***/
@@ -0,0 +1,753 @@
+/*!
+ * @file test_account.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          account store implemented in source/server/account.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../source/server/account.h"
+#include "../source/common/threadpool.h"
+
+/*!
+ * @brief This function tests single account operations, transfers, and
+ *          bad parameters.
+ */
+void
+test_account_basic (void)
+{
+    uint64_t balance = 0;
+
+    // Test bad parameters.
+    CU_ASSERT_EQUAL(-1, account_open(NULL, 1));
+    CU_ASSERT_EQUAL(-1, account_close(NULL, 1, &balance));
+    CU_ASSERT_EQUAL(-1, account_balance(NULL, 1, &balance));
+    CU_ASSERT_EQUAL(-1, account_deposit(NULL, 1, 1, &balance));
+    CU_ASSERT_EQUAL(-1, account_withdraw(NULL, 1, 1, &balance));
+    CU_ASSERT_EQUAL(-1, account_transfer(NULL, 1, 2, 1, &balance));
+    CU_ASSERT_EQUAL(-1, account_total(NULL, &balance));
+    CU_ASSERT_EQUAL(0, account_count(NULL));
+    account_store_destroy(NULL);
+
+    account_store_t * p_store = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_store);
+    if (NULL == p_store)
+    {
+        return;
+    }
+    CU_ASSERT_EQUAL(-1, account_open(p_store, 0));
+    CU_ASSERT_EQUAL(-1, account_balance(p_store, 1, NULL));
+
+    // Test accounts open empty, and only once.
+    CU_ASSERT_EQUAL(0, account_open(p_store, 1));
+    CU_ASSERT_EQUAL(0, account_open(p_store, 2));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_open(p_store, 1));
+    CU_ASSERT_EQUAL(EEXIST, errno);
+    CU_ASSERT_EQUAL(0, account_balance(p_store, 1, &balance));
+    CU_ASSERT_EQUAL(0, balance);
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_balance(p_store, 3, &balance));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+    CU_ASSERT_EQUAL(2, account_count(p_store));
+
+    // Test deposits and withdrawals stop at the balance's limits.
+    CU_ASSERT_EQUAL(0, account_deposit(p_store, 1, 100, &balance));
+    CU_ASSERT_EQUAL(100, balance);
+    CU_ASSERT_EQUAL(0, account_withdraw(p_store, 1, 30, &balance));
+    CU_ASSERT_EQUAL(70, balance);
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_withdraw(p_store, 1, 71, &balance));
+    CU_ASSERT_EQUAL(ERANGE, errno);
+    CU_ASSERT_EQUAL(0, account_deposit(p_store, 2, UINT64_MAX - 10, NULL));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_deposit(p_store, 2, 11, &balance));
+    CU_ASSERT_EQUAL(EOVERFLOW, errno);
+    CU_ASSERT_EQUAL(-1, account_deposit(p_store, 3, 1, &balance));
+    CU_ASSERT_EQUAL(-1, account_withdraw(p_store, 3, 1, &balance));
+
+    // Test transfers move money only when both sides allow it.
+    CU_ASSERT_EQUAL(0, account_open(p_store, 3));
+    CU_ASSERT_EQUAL(0, account_transfer(p_store, 1, 3, 20, &balance));
+    CU_ASSERT_EQUAL(50, balance);
+    CU_ASSERT_EQUAL(0, account_balance(p_store, 3, &balance));
+    CU_ASSERT_EQUAL(20, balance);
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_transfer(p_store, 1, 3, 51, &balance));
+    CU_ASSERT_EQUAL(ERANGE, errno);
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_transfer(p_store, 1, 2, 11, &balance));
+    CU_ASSERT_EQUAL(EOVERFLOW, errno);
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_transfer(p_store, 1, 4, 1, &balance));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+    CU_ASSERT_EQUAL(-1, account_transfer(p_store, 4, 1, 1, &balance));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_transfer(p_store, 1, 1, 1, &balance));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+    CU_ASSERT_EQUAL(0, account_balance(p_store, 1, &balance));
+    CU_ASSERT_EQUAL(50, balance);
+
+    // Test several balances read at once.
+    uint32_t ids[ACCOUNT_MAX_READ + 1] = {1, 3, 1, 2};
+    uint64_t balances[ACCOUNT_MAX_READ + 1] = {0};
+    CU_ASSERT_EQUAL(0, account_balances(p_store, ids, 3, balances));
+    CU_ASSERT_EQUAL(50, balances[0]);
+    CU_ASSERT_EQUAL(20, balances[1]);
+    CU_ASSERT_EQUAL(50, balances[2]);
+    ids[1] = 4;
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_balances(p_store, ids, 3, balances));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+    ids[1] = 0;
+    CU_ASSERT_EQUAL(-1, account_balances(p_store, ids, 3, balances));
+    ids[1] = 3;
+    CU_ASSERT_EQUAL(-1, account_balances(NULL, ids, 3, balances));
+    CU_ASSERT_EQUAL(-1, account_balances(p_store, NULL, 3, balances));
+    CU_ASSERT_EQUAL(-1, account_balances(p_store, ids, 3, NULL));
+    CU_ASSERT_EQUAL(-1, account_balances(p_store, ids, 0, balances));
+    CU_ASSERT_EQUAL(-1, account_balances(p_store, ids, ACCOUNT_MAX_READ + 1, balances));
+
+    // Test a total that does not fit saturates.
+    CU_ASSERT_EQUAL(0, account_total(p_store, &balance));
+    CU_ASSERT_EQUAL(UINT64_MAX, balance);
+
+    // Test closing an account hands back its balance.
+    CU_ASSERT_EQUAL(0, account_close(p_store, 2, &balance));
+    CU_ASSERT_EQUAL(UINT64_MAX - 10, balance);
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_close(p_store, 2, &balance));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+    CU_ASSERT_EQUAL(0, account_total(p_store, &balance));
+    CU_ASSERT_EQUAL(70, balance);
+    CU_ASSERT_EQUAL(2, account_count(p_store));
+
+    account_store_destroy(p_store);
+}
+
+/*!
+ * @brief This datatype records what a store hands its log function.
+ *
+ * @param p_store The store, read back from inside the call.
+ * @param calls The number of calls.
+ * @param ids The last call's ids.
+ * @param balances The last call's balances.
+ * @param count The last call's count.
+ * @param old_balance The first account's balance as the call saw it.
+ * @param b_fail Whether to fail the calls.
+ */
+typedef struct _log_record
+{
+    account_store_t * p_store;
+    size_t            calls;
+    uint32_t          ids[2];
+    uint64_t          balances[2];
+    size_t            count;
+    uint64_t          old_balance;
+    bool              b_fail;
+} log_record_t;
+
+/*!
+ * @brief This function records a change handed to the log. It is an
+ *          account_log_f.
+ */
+static int
+record_log (const uint32_t * p_ids, const uint64_t * p_balances, const size_t count,
+            void * p_ctx)
+{
+    log_record_t * p_record = p_ctx;
+    p_record->calls++;
+    p_record->count = count;
+    for (size_t idx = 0; (idx < count) && (idx < 2); ++idx)
+    {
+        p_record->ids[idx] = p_ids[idx];
+        p_record->balances[idx] = p_balances[idx];
+    }
+    (void) account_balance(p_record->p_store, p_ids[0], &(p_record->old_balance));
+    if (true == p_record->b_fail)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief This function tests the log function sees every deposit,
+ *          withdrawal and transfer before it is made, and that one it
+ *          fails is not made.
+ */
+void
+test_account_log (void)
+{
+    uint64_t balance = 0;
+    log_record_t record;
+    memset(&record, 0, sizeof(record));
+
+    CU_ASSERT_EQUAL(-1, account_store_set_log(NULL, record_log, &record));
+    account_store_t * p_store = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_store);
+    if (NULL == p_store)
+    {
+        return;
+    }
+    record.p_store = p_store;
+    CU_ASSERT_EQUAL(0, account_store_set_log(p_store, record_log, &record));
+
+    // Test opening accounts is not logged, and changes are logged with
+    // their new balances before they are made.
+    CU_ASSERT_EQUAL(0, account_open(p_store, 1));
+    CU_ASSERT_EQUAL(0, account_open(p_store, 2));
+    CU_ASSERT_EQUAL(0, record.calls);
+    CU_ASSERT_EQUAL(0, account_deposit(p_store, 1, 100, &balance));
+    CU_ASSERT_EQUAL(1, record.calls);
+    CU_ASSERT_EQUAL(1, record.count);
+    CU_ASSERT_EQUAL(1, record.ids[0]);
+    CU_ASSERT_EQUAL(100, record.balances[0]);
+    CU_ASSERT_EQUAL(0, record.old_balance);
+    CU_ASSERT_EQUAL(0, account_withdraw(p_store, 1, 30, &balance));
+    CU_ASSERT_EQUAL(2, record.calls);
+    CU_ASSERT_EQUAL(70, record.balances[0]);
+    CU_ASSERT_EQUAL(100, record.old_balance);
+    CU_ASSERT_EQUAL(0, account_transfer(p_store, 1, 2, 20, &balance));
+    CU_ASSERT_EQUAL(3, record.calls);
+    CU_ASSERT_EQUAL(2, record.count);
+    CU_ASSERT_EQUAL(1, record.ids[0]);
+    CU_ASSERT_EQUAL(2, record.ids[1]);
+    CU_ASSERT_EQUAL(50, record.balances[0]);
+    CU_ASSERT_EQUAL(20, record.balances[1]);
+
+    // Test changes that fail on their own are not logged.
+    CU_ASSERT_EQUAL(-1, account_withdraw(p_store, 1, 51, &balance));
+    CU_ASSERT_EQUAL(-1, account_deposit(p_store, 3, 1, &balance));
+    CU_ASSERT_EQUAL(-1, account_transfer(p_store, 1, 3, 1, &balance));
+    CU_ASSERT_EQUAL(3, record.calls);
+
+    // Test a change the log fails is not made, and keeps its errno.
+    record.b_fail = true;
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, account_deposit(p_store, 1, 5, &balance));
+    CU_ASSERT_EQUAL(EIO, errno);
+    CU_ASSERT_EQUAL(-1, account_withdraw(p_store, 1, 5, &balance));
+    CU_ASSERT_EQUAL(-1, account_transfer(p_store, 1, 2, 5, &balance));
+    CU_ASSERT_EQUAL(6, record.calls);
+    CU_ASSERT_EQUAL(0, account_balance(p_store, 1, &balance));
+    CU_ASSERT_EQUAL(50, balance);
+    CU_ASSERT_EQUAL(0, account_balance(p_store, 2, &balance));
+    CU_ASSERT_EQUAL(20, balance);
+
+    // Test closing and restoring are not logged, nor anything once the
+    // log function is cleared.
+    CU_ASSERT_EQUAL(0, account_restore(p_store, 3, 7));
+    CU_ASSERT_EQUAL(0, account_close(p_store, 3, &balance));
+    CU_ASSERT_EQUAL(0, account_store_set_log(p_store, NULL, NULL));
+    CU_ASSERT_EQUAL(0, account_deposit(p_store, 1, 5, &balance));
+    CU_ASSERT_EQUAL(6, record.calls);
+
+    account_store_destroy(p_store);
+}
+
+/*!
+ * @brief Table test parameters.
+ */
+#define TABLE_ACCOUNTS 20000
+
+/*!
+ * @brief This function tests many accounts, so the stripes' tables grow
+ *          and closing accounts reshuffles their probe runs.
+ */
+void
+test_account_table (void)
+{
+    account_store_t * p_store = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_store);
+    if (NULL == p_store)
+    {
+        return;
+    }
+
+    size_t errors = 0;
+    for (uint32_t id = 1; id <= TABLE_ACCOUNTS; ++id)
+    {
+        if ((0 != account_open(p_store, id)) ||
+            (0 != account_deposit(p_store, id, id, NULL)))
+        {
+            errors++;
+        }
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(TABLE_ACCOUNTS, account_count(p_store));
+
+    for (uint32_t id = 1; id <= TABLE_ACCOUNTS; id += 3)
+    {
+        uint64_t balance = 0;
+        if ((0 != account_close(p_store, id, &balance)) ||
+            (id != balance))
+        {
+            errors++;
+        }
+    }
+    uint64_t expected = 0;
+    for (uint32_t id = 1; id <= TABLE_ACCOUNTS; ++id)
+    {
+        uint64_t balance = 0;
+        int ret = account_balance(p_store, id, &balance);
+        if (1 == (id % 3))
+        {
+            errors += (-1 != ret);
+        }
+        else
+        {
+            errors += ((0 != ret) || (id != balance));
+            expected += id;
+        }
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    uint64_t total = 0;
+    CU_ASSERT_EQUAL(0, account_total(p_store, &total));
+    CU_ASSERT_EQUAL(expected, total);
+
+    account_store_destroy(p_store);
+}
+
+/*!
+ * @brief Stress test parameters.
+ */
+#define STRESS_WORKERS 4
+#define STRESS_ACCOUNTS 1000
+#define STRESS_BALANCE 1000
+#define STRESS_JOBS 64
+#define STRESS_TRANSFERS 20000
+
+static account_store_t * gp_stress_store = NULL;
+static _Atomic size_t g_stress_done = 0;
+static _Atomic size_t g_stress_errors = 0;
+static _Atomic size_t g_stress_moved = 0;
+static _Atomic size_t g_stress_audits = 0;
+
+/*!
+ * @brief This function makes random transfers between random accounts,
+ *          some of them in the same stripe and some of them too large.
+ */
+static void
+stress_transfers (_Atomic bool * pb_shutdown, void * p_arg)
+{
+    (void) pb_shutdown;
+    uint64_t state = 88172645463325252u + (uintptr_t) p_arg;
+    size_t moved = 0;
+    for (size_t i = 0; i < STRESS_TRANSFERS; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t from = (uint32_t) (state % STRESS_ACCOUNTS) + 1;
+        uint32_t to = (uint32_t) ((state >> 20) % STRESS_ACCOUNTS) + 1;
+        uint64_t amount = (state >> 40) % (STRESS_BALANCE / 2);
+        int ret = account_transfer(gp_stress_store, from, to, amount, NULL);
+        if (0 == ret)
+        {
+            moved++;
+        }
+        else if (!(((from == to) && (EINVAL == errno)) ||
+                   ((from != to) && (ERANGE == errno))))
+        {
+            atomic_fetch_add(&g_stress_errors, 1);
+        }
+    }
+    atomic_fetch_add(&g_stress_moved, moved);
+    atomic_fetch_add(&g_stress_done, 1);
+}
+
+/*!
+ * @brief This function tests transfers from every pool thread at once
+ *          never deadlock and keep the money in the system constant.
+ */
+void
+test_account_stress (void)
+{
+    gp_stress_store = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(gp_stress_store);
+    if (NULL == gp_stress_store)
+    {
+        return;
+    }
+    for (uint32_t id = 1; id <= STRESS_ACCOUNTS; ++id)
+    {
+        CU_ASSERT_EQUAL(0, account_open(gp_stress_store, id));
+        CU_ASSERT_EQUAL(0, account_deposit(gp_stress_store, id, STRESS_BALANCE, NULL));
+    }
+
+    threadpool_t * p_tp = threadpool_create(STRESS_WORKERS);
+    CU_ASSERT_PTR_NOT_NULL(p_tp);
+    if (NULL == p_tp)
+    {
+        account_store_destroy(gp_stress_store);
+        gp_stress_store = NULL;
+        return;
+    }
+    atomic_store(&g_stress_done, 0);
+    atomic_store(&g_stress_errors, 0);
+    atomic_store(&g_stress_moved, 0);
+    atomic_store(&g_stress_audits, 0);
+    for (size_t job = 0; job < STRESS_JOBS; ++job)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(p_tp, stress_transfers, (void *) job));
+    }
+
+    // Sum every balance over and over while the transfers run, checking
+    // no money is made or lost.
+    while (STRESS_JOBS != atomic_load(&g_stress_done))
+    {
+        uint64_t total = 0;
+        if ((0 != account_total(gp_stress_store, &total)) ||
+            (((uint64_t) STRESS_ACCOUNTS * STRESS_BALANCE) != total))
+        {
+            atomic_fetch_add(&g_stress_errors, 1);
+        }
+        atomic_fetch_add(&g_stress_audits, 1);
+    }
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_tp));
+    threadpool_destroy(p_tp);
+    printf("%zu transfers made, %zu audits\n", atomic_load(&g_stress_moved),
+           atomic_load(&g_stress_audits));
+
+    CU_ASSERT_EQUAL(0, atomic_load(&g_stress_errors));
+    CU_ASSERT(atomic_load(&g_stress_moved) > 0);
+    CU_ASSERT(atomic_load(&g_stress_audits) > 0);
+    uint64_t total = 0;
+    CU_ASSERT_EQUAL(0, account_total(gp_stress_store, &total));
+    CU_ASSERT_EQUAL((uint64_t) STRESS_ACCOUNTS * STRESS_BALANCE, total);
+    CU_ASSERT_EQUAL(STRESS_ACCOUNTS, account_count(gp_stress_store));
+
+    account_store_destroy(gp_stress_store);
+    gp_stress_store = NULL;
+}
+
+/*!
+ * @brief Read benchmark parameters.
+ */
+#define BENCH_READERS 2
+#define BENCH_WRITERS 2
+#define BENCH_ACCOUNTS 1024
+#define BENCH_BALANCE 1000
+#define BENCH_MS 250
+
+static account_store_t * gp_bench_store = NULL;
+static _Atomic bool gb_bench_stop = false;
+static _Atomic size_t g_bench_reads = 0;
+static _Atomic size_t g_bench_writes = 0;
+static _Atomic size_t g_bench_errors = 0;
+
+/*!
+ * @brief This function reads random balances until told to stop.
+ */
+static void *
+bench_reader (void * p_arg)
+{
+    uint64_t state = 88172645463325252u + (uintptr_t) p_arg;
+    size_t reads = 0;
+    while (false == atomic_load_explicit(&gb_bench_stop, memory_order_relaxed))
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint64_t balance = 0;
+        uint32_t id = (uint32_t) (state % BENCH_ACCOUNTS) + 1;
+        if ((0 != account_balance(gp_bench_store, id, &balance)) ||
+            (balance > ((uint64_t) BENCH_ACCOUNTS * BENCH_BALANCE)))
+        {
+            atomic_fetch_add(&g_bench_errors, 1);
+        }
+        reads++;
+    }
+    atomic_fetch_add(&g_bench_reads, reads);
+    return NULL;
+}
+
+/*!
+ * @brief This function makes random transfers until told to stop.
+ */
+static void *
+bench_writer (void * p_arg)
+{
+    uint64_t state = 88172645463325252u ^ (uintptr_t) p_arg;
+    size_t writes = 0;
+    while (false == atomic_load_explicit(&gb_bench_stop, memory_order_relaxed))
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t from = (uint32_t) (state % BENCH_ACCOUNTS) + 1;
+        uint32_t to = (uint32_t) ((state >> 20) % BENCH_ACCOUNTS) + 1;
+        uint64_t amount = (state >> 40) % BENCH_BALANCE;
+        (void) account_transfer(gp_bench_store, from, to, amount, NULL);
+        writes++;
+    }
+    atomic_fetch_add(&g_bench_writes, writes);
+    return NULL;
+}
+
+/*!
+ * @brief This function runs readers, and optionally writers, for a fixed
+ *          time and reports the throughput of each.
+ */
+static void
+run_bench (const size_t num_writers)
+{
+    pthread_t readers[BENCH_READERS];
+    pthread_t writers[BENCH_WRITERS];
+    atomic_store(&gb_bench_stop, false);
+    atomic_store(&g_bench_reads, 0);
+    atomic_store(&g_bench_writes, 0);
+    atomic_store(&g_bench_errors, 0);
+    for (size_t i = 0; i < num_writers; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(writers + i, NULL, bench_writer, (void *) i));
+    }
+    for (size_t i = 0; i < BENCH_READERS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(readers + i, NULL, bench_reader, (void *) i));
+    }
+    struct timespec delay = {0, BENCH_MS * 1000000L};
+    nanosleep(&delay, NULL);
+    atomic_store(&gb_bench_stop, true);
+    for (size_t i = 0; i < BENCH_READERS; ++i)
+    {
+        pthread_join(readers[i], NULL);
+    }
+    for (size_t i = 0; i < num_writers; ++i)
+    {
+        pthread_join(writers[i], NULL);
+    }
+
+    CU_ASSERT_EQUAL(0, atomic_load(&g_bench_errors));
+    CU_ASSERT(atomic_load(&g_bench_reads) > 0);
+    printf("%d readers, %zu writers: %.0f reads/s, %.0f writes/s\n", BENCH_READERS,
+           num_writers, (double) atomic_load(&g_bench_reads) * 1000.0 / BENCH_MS,
+           (double) atomic_load(&g_bench_writes) * 1000.0 / BENCH_MS);
+}
+
+/*!
+ * @brief This function benchmarks balance reads alone and under a
+ *          concurrent load of transfers.
+ */
+void
+test_account_reads (void)
+{
+    gp_bench_store = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(gp_bench_store);
+    if (NULL == gp_bench_store)
+    {
+        return;
+    }
+    for (uint32_t id = 1; id <= BENCH_ACCOUNTS; ++id)
+    {
+        CU_ASSERT_EQUAL(0, account_open(gp_bench_store, id));
+        CU_ASSERT_EQUAL(0, account_deposit(gp_bench_store, id, BENCH_BALANCE, NULL));
+    }
+
+    run_bench(0);
+    run_bench(BENCH_WRITERS);
+
+    uint64_t total = 0;
+    CU_ASSERT_EQUAL(0, account_total(gp_bench_store, &total));
+    CU_ASSERT_EQUAL((uint64_t) BENCH_ACCOUNTS * BENCH_BALANCE, total);
+    account_store_destroy(gp_bench_store);
+    gp_bench_store = NULL;
+}
+
+/*!
+ * @brief This function makes random transfers between the two accounts of
+ *          a pair until told to stop, so every pair keeps its sum.
+ */
+static void *
+pair_writer (void * p_arg)
+{
+    uint64_t state = 88172645463325252u ^ (uintptr_t) p_arg;
+    size_t writes = 0;
+    while (false == atomic_load_explicit(&gb_bench_stop, memory_order_relaxed))
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t first = (uint32_t) ((state % (BENCH_ACCOUNTS / 2)) * 2) + 1;
+        uint64_t amount = (state >> 40) % BENCH_BALANCE;
+        if (0 != (state & (1u << 20)))
+        {
+            (void) account_transfer(gp_bench_store, first, first + 1, amount, NULL);
+        }
+        else
+        {
+            (void) account_transfer(gp_bench_store, first + 1, first, amount, NULL);
+        }
+        writes++;
+    }
+    atomic_fetch_add(&g_bench_writes, writes);
+    return NULL;
+}
+
+/*!
+ * @brief This function reads random pairs together until told to stop,
+ *          checking each pair still holds its starting sum.
+ */
+static void *
+pair_reader (void * p_arg)
+{
+    uint64_t state = 88172645463325252u + (uintptr_t) p_arg;
+    size_t reads = 0;
+    uint32_t ids[ACCOUNT_MAX_READ] = {0};
+    uint64_t balances[ACCOUNT_MAX_READ] = {0};
+    while (false == atomic_load_explicit(&gb_bench_stop, memory_order_relaxed))
+    {
+        for (size_t idx = 0; idx < ACCOUNT_MAX_READ; idx += 2)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            ids[idx] = (uint32_t) ((state % (BENCH_ACCOUNTS / 2)) * 2) + 1;
+            ids[idx + 1] = ids[idx] + 1;
+        }
+        if (0 != account_balances(gp_bench_store, ids, ACCOUNT_MAX_READ, balances))
+        {
+            atomic_fetch_add(&g_bench_errors, 1);
+        }
+        for (size_t idx = 0; idx < ACCOUNT_MAX_READ; idx += 2)
+        {
+            if ((2 * BENCH_BALANCE) != (balances[idx] + balances[idx + 1]))
+            {
+                atomic_fetch_add(&g_bench_errors, 1);
+            }
+        }
+        reads++;
+    }
+    atomic_fetch_add(&g_bench_reads, reads);
+    return NULL;
+}
+
+/*!
+ * @brief This function tests reads of several accounts never see a
+ *          transfer between them half done.
+ */
+void
+test_account_snapshot (void)
+{
+    gp_bench_store = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(gp_bench_store);
+    if (NULL == gp_bench_store)
+    {
+        return;
+    }
+    for (uint32_t id = 1; id <= BENCH_ACCOUNTS; ++id)
+    {
+        CU_ASSERT_EQUAL(0, account_open(gp_bench_store, id));
+        CU_ASSERT_EQUAL(0, account_deposit(gp_bench_store, id, BENCH_BALANCE, NULL));
+    }
+
+    pthread_t readers[BENCH_READERS];
+    pthread_t writers[BENCH_WRITERS];
+    atomic_store(&gb_bench_stop, false);
+    atomic_store(&g_bench_reads, 0);
+    atomic_store(&g_bench_writes, 0);
+    atomic_store(&g_bench_errors, 0);
+    for (size_t i = 0; i < BENCH_WRITERS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(writers + i, NULL, pair_writer, (void *) i));
+    }
+    for (size_t i = 0; i < BENCH_READERS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(readers + i, NULL, pair_reader, (void *) i));
+    }
+
+    // Check the total too while the transfers run.
+    size_t audits = 0;
+    struct timespec start;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+    {
+        uint64_t total = 0;
+        CU_ASSERT_EQUAL(0, account_total(gp_bench_store, &total));
+        CU_ASSERT_EQUAL((uint64_t) BENCH_ACCOUNTS * BENCH_BALANCE, total);
+        audits++;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (((now.tv_sec - start.tv_sec) * 1000 +
+              (now.tv_nsec - start.tv_nsec) / 1000000) < BENCH_MS);
+    atomic_store(&gb_bench_stop, true);
+    for (size_t i = 0; i < BENCH_READERS; ++i)
+    {
+        pthread_join(readers[i], NULL);
+    }
+    for (size_t i = 0; i < BENCH_WRITERS; ++i)
+    {
+        pthread_join(writers[i], NULL);
+    }
+
+    CU_ASSERT_EQUAL(0, atomic_load(&g_bench_errors));
+    CU_ASSERT(atomic_load(&g_bench_reads) > 0);
+    printf("%d readers of %d accounts, %d writers: %.0f reads/s, %.0f writes/s, "
+           "%.0f totals/s\n", BENCH_READERS, ACCOUNT_MAX_READ, BENCH_WRITERS,
+           (double) atomic_load(&g_bench_reads) * 1000.0 / BENCH_MS,
+           (double) atomic_load(&g_bench_writes) * 1000.0 / BENCH_MS,
+           (double) audits * 1000.0 / BENCH_MS);
+    account_store_destroy(gp_bench_store);
+    gp_bench_store = NULL;
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"account basic test", test_account_basic},
+        {"account log test", test_account_log},
+        {"account table test", test_account_table},
+        {"account stress test", test_account_stress},
+        {"account reads test", test_account_reads},
+        {"account snapshot test", test_account_snapshot},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"account test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
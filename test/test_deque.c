@@ -0,0 +1,289 @@
+/*!
+ * @file test_deque.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          work-stealing deque implemented in source/common/deque.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../source/common/deque.h"
+
+/*!
+ * @brief This function tests the deque_create function.
+ */
+void
+test_deque_create (void)
+{
+    // Test create with invalid capacities.
+    deque_t * p_d = deque_create(0);
+    CU_ASSERT_PTR_NULL(p_d);
+    p_d = deque_create(12);
+    CU_ASSERT_PTR_NULL(p_d);
+
+    // Test create with success.
+    p_d = deque_create(16);
+    CU_ASSERT_PTR_NOT_NULL(p_d);
+    CU_ASSERT_EQUAL(0, deque_size(p_d));
+
+    if (NULL != p_d)
+    {
+        deque_destroy(p_d);
+        p_d = NULL;
+    }
+    return;
+}
+
+/*!
+ * @brief This function tests deque_push and deque_pop, which must
+ *          behave as a bounded stack for the owner.
+ */
+void
+test_deque_push_pop (void)
+{
+    deque_t * p_d = deque_create(4);
+    CU_ASSERT_PTR_NOT_NULL(p_d);
+    if (NULL == p_d)
+    {
+        goto EXIT;
+    }
+
+    // Test NULL parameters and an empty deque.
+    int nums[5] = {1,2,3,4,5};
+    CU_ASSERT_EQUAL(-1, deque_push(NULL, nums + 0));
+    CU_ASSERT_EQUAL(-1, deque_push(p_d, NULL));
+    CU_ASSERT_PTR_NULL(deque_pop(NULL));
+    CU_ASSERT_PTR_NULL(deque_pop(p_d));
+
+    // Test push with success up to capacity, then on a full deque.
+    for (size_t i = 0; i < 4; ++i)
+    {
+        CU_ASSERT_EQUAL(0, deque_push(p_d, nums + i));
+        CU_ASSERT_EQUAL(i+1, deque_size(p_d));
+    }
+    CU_ASSERT_EQUAL(-1, deque_push(p_d, nums + 4));
+
+    // Test pop returns entries in LIFO order.
+    for (size_t i = 4; i > 0; --i)
+    {
+        int * p_i = deque_pop(p_d);
+        CU_ASSERT_PTR_EQUAL(p_i, nums + i - 1);
+    }
+    CU_ASSERT_PTR_NULL(deque_pop(p_d));
+    CU_ASSERT_EQUAL(0, deque_size(p_d));
+
+    EXIT:
+        // Destroy deque.
+        if (NULL != p_d)
+        {
+            deque_destroy(p_d);
+            p_d = NULL;
+        }
+        return;
+}
+
+/*!
+ * @brief This function tests deque_steal, which must take entries in
+ *          FIFO order, including after the cursors wrap several times.
+ */
+void
+test_deque_steal (void)
+{
+    deque_t * p_d = deque_create(4);
+    CU_ASSERT_PTR_NOT_NULL(p_d);
+    if (NULL == p_d)
+    {
+        goto EXIT;
+    }
+
+    // Test steal with NULL parameter and on an empty deque.
+    CU_ASSERT_PTR_NULL(deque_steal(NULL));
+    CU_ASSERT_PTR_NULL(deque_steal(p_d));
+
+    int nums[3] = {1,2,3};
+    for (size_t lap = 0; lap < 10; ++lap)
+    {
+        for (size_t i = 0; i < 3; ++i)
+        {
+            CU_ASSERT_EQUAL(0, deque_push(p_d, nums + i));
+        }
+
+        // Steal from the top while the owner pops from the bottom.
+        CU_ASSERT_PTR_EQUAL(deque_steal(p_d), nums + 0);
+        CU_ASSERT_PTR_EQUAL(deque_pop(p_d), nums + 2);
+        CU_ASSERT_PTR_EQUAL(deque_steal(p_d), nums + 1);
+        CU_ASSERT_PTR_NULL(deque_steal(p_d));
+        CU_ASSERT_EQUAL(0, deque_size(p_d));
+    }
+
+    EXIT:
+        // Destroy deque.
+        if (NULL != p_d)
+        {
+            deque_destroy(p_d);
+            p_d = NULL;
+        }
+        return;
+}
+
+/*!
+ * @brief Stress test parameters. One owner pushes and pops while the
+ *          thieves steal.
+ */
+#define STRESS_THIEVES 4
+#define STRESS_TOTAL 200000
+#define STRESS_CAPACITY 64
+
+static deque_t * gp_stress_deque = NULL;
+static uintptr_t g_stress_items[STRESS_TOTAL];
+static _Atomic unsigned char g_stress_seen[STRESS_TOTAL];
+static _Atomic size_t g_stress_taken = 0;
+
+/*!
+ * @brief This records that an item was taken from the deque.
+ */
+static void
+stress_take (uintptr_t * p_item)
+{
+    atomic_fetch_add(g_stress_seen + *p_item, 1);
+    atomic_fetch_add(&g_stress_taken, 1);
+}
+
+/*!
+ * @brief This is a thief thread for the stress test. Thieves run until
+ *          every item has been taken.
+ */
+static void *
+stress_thief (void * p_arg)
+{
+    (void) p_arg;
+    while (atomic_load(&g_stress_taken) < STRESS_TOTAL)
+    {
+        uintptr_t * p_item = deque_steal(gp_stress_deque);
+        if (NULL == p_item)
+        {
+            sched_yield();
+            continue;
+        }
+        stress_take(p_item);
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This function stresses the deque with one owner and several
+ *          thieves, and checks that every item is taken exactly once.
+ */
+void
+test_deque_stress (void)
+{
+    pthread_t thieves[STRESS_THIEVES];
+    gp_stress_deque = deque_create(STRESS_CAPACITY);
+    CU_ASSERT_PTR_NOT_NULL(gp_stress_deque);
+    if (NULL == gp_stress_deque)
+    {
+        return;
+    }
+    atomic_store(&g_stress_taken, 0);
+    for (size_t i = 0; i < STRESS_TOTAL; ++i)
+    {
+        g_stress_items[i] = i;
+        atomic_store(g_stress_seen + i, 0);
+    }
+
+    for (size_t i = 0; i < STRESS_THIEVES; ++i)
+    {
+        pthread_create(thieves + i, NULL, stress_thief, NULL);
+    }
+
+    // The owner pops every third item itself, racing the thieves for
+    // the last entry whenever the deque runs low.
+    for (size_t i = 0; i < STRESS_TOTAL; ++i)
+    {
+        while (0 != deque_push(gp_stress_deque, g_stress_items + i))
+        {
+            sched_yield();
+        }
+        if (0 == (i % 3))
+        {
+            uintptr_t * p_item = deque_pop(gp_stress_deque);
+            if (NULL != p_item)
+            {
+                stress_take(p_item);
+            }
+        }
+    }
+    for (size_t i = 0; i < STRESS_THIEVES; ++i)
+    {
+        pthread_join(thieves[i], NULL);
+    }
+
+    // Every item must be taken exactly once.
+    size_t errors = 0;
+    for (size_t i = 0; i < STRESS_TOTAL; ++i)
+    {
+        if (1 != atomic_load(g_stress_seen + i))
+        {
+            errors++;
+        }
+    }
+    printf("taken: %zu, errors: %zu\n", atomic_load(&g_stress_taken), errors);
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(0, deque_size(gp_stress_deque));
+
+    deque_destroy(gp_stress_deque);
+    gp_stress_deque = NULL;
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"deque_create test", test_deque_create},
+        {"deque push/pop test", test_deque_push_pop},
+        {"deque steal test", test_deque_steal},
+        {"deque owner/thief stress test", test_deque_stress},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"deque test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
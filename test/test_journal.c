@@ -0,0 +1,333 @@
+/*!
+ * @file test_journal.c
+ *
+ * @brief This file contains a self-contained test battery for the log
+ *          records implemented in source/server/journal.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <errno.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../source/server/journal.h"
+
+/*!
+ * @brief The size of a log path.
+ */
+#define PATH_SIZE 64
+
+/*!
+ * @brief This is a helper function that removes a log's segments.
+ */
+static void
+remove_log (const char * p_path)
+{
+    char pattern[PATH_SIZE + 4];
+    snprintf(pattern, sizeof(pattern), "%s.*", p_path);
+    glob_t found;
+    if (0 == glob(pattern, 0, NULL, &found))
+    {
+        for (size_t idx = 0; idx < found.gl_pathc; ++idx)
+        {
+            unlink(found.gl_pathv[idx]);
+        }
+        globfree(&found);
+    }
+}
+
+/*!
+ * @brief This is a helper function that makes a log path unique to this
+ *          process, and removes any segment left at it.
+ */
+static void
+make_path (char * p_path)
+{
+    snprintf(p_path, PATH_SIZE, "/tmp/bank_test_journal_%d.log", (int) getpid());
+    remove_log(p_path);
+}
+
+/*!
+ * @brief This is a helper function that replays a log into a fresh user
+ *          index and account store.
+ */
+static int
+replay (const char * p_path, journal_t * p_journal)
+{
+    p_journal->p_users = user_index_create(16);
+    p_journal->p_accounts = account_store_create();
+    p_journal->applied = 0;
+    return wal_replay(p_path, 0, journal_apply, p_journal, NULL);
+}
+
+/*!
+ * @brief This is a helper function that frees what a log was replayed
+ *          into.
+ */
+static void
+release (journal_t * p_journal)
+{
+    user_index_destroy(p_journal->p_users);
+    account_store_destroy(p_journal->p_accounts);
+    p_journal->p_users = NULL;
+    p_journal->p_accounts = NULL;
+}
+
+/*!
+ * @brief This function tests logging each record type and replaying
+ *          the log, and bad parameters.
+ */
+void
+test_journal_basic (void)
+{
+    char path[PATH_SIZE];
+    make_path(path);
+    wal_attr_t attr;
+    wal_attr_init(&attr);
+    wal_t * p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+    uint64_t lsn = 0;
+    uint32_t ids[3] = {1, 2, 0};
+    uint64_t balances[3] = {0};
+
+    // Test bad parameters, and names longer than config.h allows.
+    char long_name[USER_DB_UNAME_MAX + 2];
+    memset(long_name, 'x', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+    CU_ASSERT_EQUAL(-1, journal_user_put(NULL, 1, "alice", "secret", &lsn));
+    CU_ASSERT_EQUAL(-1, journal_user_put(p_wal, 0, "alice", "secret", &lsn));
+    CU_ASSERT_EQUAL(-1, journal_user_put(p_wal, 1, NULL, "secret", &lsn));
+    CU_ASSERT_EQUAL(-1, journal_user_put(p_wal, 1, "alice", NULL, &lsn));
+    CU_ASSERT_EQUAL(-1, journal_user_put(p_wal, 1, "", "secret", &lsn));
+    CU_ASSERT_EQUAL(-1, journal_user_put(p_wal, 1, long_name, "secret", &lsn));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+    long_name[USER_DB_UNAME_MAX] = '\0';
+    CU_ASSERT_EQUAL(-1, journal_user_delete(NULL, 1, "alice", &lsn));
+    CU_ASSERT_EQUAL(-1, journal_user_delete(p_wal, 1, NULL, &lsn));
+    CU_ASSERT_EQUAL(-1, journal_balances(NULL, ids, balances, 1, &lsn));
+    CU_ASSERT_EQUAL(-1, journal_balances(p_wal, NULL, balances, 1, &lsn));
+    CU_ASSERT_EQUAL(-1, journal_balances(p_wal, ids, NULL, 1, &lsn));
+    CU_ASSERT_EQUAL(-1, journal_balances(p_wal, ids, balances, 0, &lsn));
+    CU_ASSERT_EQUAL(-1, journal_balances(p_wal, ids, balances, 3, &lsn));
+    CU_ASSERT_EQUAL(-1, journal_balances(p_wal, ids + 2, balances, 1, &lsn));
+    CU_ASSERT_EQUAL(0, wal_last_lsn(p_wal));
+
+    // Log two users, a transfer between them, a third user who leaves,
+    // and a password change.
+    CU_ASSERT_EQUAL(0, journal_user_put(p_wal, 1, "alice", "secret", &lsn));
+    CU_ASSERT_EQUAL(0, journal_user_put(p_wal, 2, "bob", "hunter2", &lsn));
+    balances[0] = 500;
+    CU_ASSERT_EQUAL(0, journal_balances(p_wal, ids, balances, 1, &lsn));
+    balances[0] = 300;
+    balances[1] = 200;
+    CU_ASSERT_EQUAL(0, journal_balances(p_wal, ids, balances, 2, &lsn));
+    CU_ASSERT_EQUAL(0, journal_user_put(p_wal, 3, long_name, "secret", &lsn));
+    CU_ASSERT_EQUAL(0, journal_user_delete(p_wal, 3, long_name, &lsn));
+    CU_ASSERT_EQUAL(0, journal_user_put(p_wal, 2, "bob", "hunter3", &lsn));
+    CU_ASSERT_EQUAL(7, lsn);
+    CU_ASSERT_EQUAL(7, wal_last_lsn(p_wal));
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+
+    // Test the replay rebuilds the same state.
+    journal_t journal;
+    CU_ASSERT_EQUAL(0, replay(path, &journal));
+    CU_ASSERT_EQUAL(7, journal.applied);
+    CU_ASSERT_EQUAL(2, user_count(journal.p_users));
+    CU_ASSERT_EQUAL(2, account_count(journal.p_accounts));
+    uint32_t id = 0;
+    uint64_t balance = 0;
+    CU_ASSERT_EQUAL(0, user_login(journal.p_users, "alice", "secret", &id));
+    CU_ASSERT_EQUAL(1, id);
+    CU_ASSERT_EQUAL(0, user_login(journal.p_users, "bob", "hunter3", &id));
+    CU_ASSERT_EQUAL(2, id);
+    CU_ASSERT_EQUAL(-1, user_find(journal.p_users, long_name, NULL));
+    CU_ASSERT_EQUAL(0, account_balance(journal.p_accounts, 1, &balance));
+    CU_ASSERT_EQUAL(300, balance);
+    CU_ASSERT_EQUAL(0, account_balance(journal.p_accounts, 2, &balance));
+    CU_ASSERT_EQUAL(200, balance);
+    CU_ASSERT_EQUAL(-1, account_balance(journal.p_accounts, 3, &balance));
+
+    // Test the deleted user's id is not handed out again.
+    CU_ASSERT_EQUAL(4, user_next_id(journal.p_users));
+
+    // Test replaying the log again over its own result changes nothing.
+    journal.applied = 0;
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, journal_apply, &journal, NULL));
+    CU_ASSERT_EQUAL(7, journal.applied);
+    CU_ASSERT_EQUAL(2, user_count(journal.p_users));
+    CU_ASSERT_EQUAL(2, account_count(journal.p_accounts));
+    CU_ASSERT_EQUAL(0, account_balance(journal.p_accounts, 1, &balance));
+    CU_ASSERT_EQUAL(300, balance);
+    CU_ASSERT_EQUAL(0, user_login(journal.p_users, "bob", "hunter3", NULL));
+
+    // Test replaying only the tail, as after a snapshot.
+    release(&journal);
+    journal.p_users = user_index_create(16);
+    journal.p_accounts = account_store_create();
+    journal.applied = 0;
+    CU_ASSERT_EQUAL(0, wal_replay(path, 4, journal_apply, &journal, &lsn));
+    CU_ASSERT_EQUAL(3, journal.applied);
+    CU_ASSERT_EQUAL(7, lsn);
+    CU_ASSERT_EQUAL(1, user_count(journal.p_users));
+    CU_ASSERT_EQUAL(0, user_login(journal.p_users, "bob", "hunter3", NULL));
+
+    // Test malformed records are refused.
+    unsigned char record[sizeof(journal_user_t) + 1] = {0};
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, 0, &journal));
+    CU_ASSERT_EQUAL(-1, journal_apply(1, NULL, 1, &journal));
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, 1, NULL));
+    record[0] = 0x7F;
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, 1, &journal));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+    record[0] = JOURNAL_USER_PUT;
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, sizeof(journal_user_t) + 1, &journal));
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, sizeof(journal_user_t), &journal));
+    record[4] = 9;
+    memset(record + 5, 'x', JOURNAL_UNAME_SIZE);
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, sizeof(journal_user_t), &journal));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+    record[0] = JOURNAL_BALANCES;
+    record[1] = 0;
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, 2, &journal));
+    record[1] = JOURNAL_MAX_BALANCES + 1;
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, sizeof(journal_balances_t), &journal));
+    record[1] = 1;
+    CU_ASSERT_EQUAL(-1, journal_apply(1, record, 2 + sizeof(journal_balance_t) + 1,
+                                      &journal));
+    CU_ASSERT_EQUAL(3, journal.applied);
+    release(&journal);
+    remove_log(path);
+}
+
+/*!
+ * @brief This function tests the tables log their own changes through
+ *          the journal's log functions, and that a balance logged after
+ *          its user's deletion is skipped on replay.
+ */
+void
+test_journal_hooks (void)
+{
+    char path[PATH_SIZE];
+    make_path(path);
+    wal_attr_t attr;
+    wal_attr_init(&attr);
+    wal_t * p_wal = wal_open(path, &attr);
+    user_index_t * p_users = user_index_create(16);
+    account_store_t * p_accounts = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    CU_ASSERT_PTR_NOT_NULL(p_users);
+    CU_ASSERT_PTR_NOT_NULL(p_accounts);
+    if ((NULL == p_wal) ||
+        (NULL == p_users) ||
+        (NULL == p_accounts))
+    {
+        goto EXIT;
+    }
+    CU_ASSERT_EQUAL(0, user_index_set_log(p_users, journal_log_user, p_wal));
+    CU_ASSERT_EQUAL(0, account_store_set_log(p_accounts, journal_log_balances, p_wal));
+    uint32_t alice = 0;
+    uint32_t bob = 0;
+    uint64_t balance = 0;
+
+    // Test each change appends one record, whose number journal_lsn
+    // hands back.
+    CU_ASSERT_EQUAL(-1, journal_log_user(NULL, false, p_wal));
+    CU_ASSERT_EQUAL(0, user_register(p_users, "alice", "secret", &alice));
+    CU_ASSERT_EQUAL(1, journal_lsn());
+    CU_ASSERT_EQUAL(0, user_register(p_users, "bob", "hunter2", &bob));
+    CU_ASSERT_EQUAL(0, account_open(p_accounts, alice));
+    CU_ASSERT_EQUAL(0, account_open(p_accounts, bob));
+    CU_ASSERT_EQUAL(2, journal_lsn());
+    CU_ASSERT_EQUAL(0, account_deposit(p_accounts, alice, 500, NULL));
+    CU_ASSERT_EQUAL(0, account_transfer(p_accounts, alice, bob, 200, NULL));
+    CU_ASSERT_EQUAL(0, account_withdraw(p_accounts, bob, 50, NULL));
+    CU_ASSERT_EQUAL(5, journal_lsn());
+    CU_ASSERT_EQUAL(0, wal_commit(p_wal, journal_lsn()));
+
+    // A deposit racing bob's deletion lands after the delete is logged
+    // and before the account closes.
+    CU_ASSERT_EQUAL(0, user_delete(p_users, "bob"));
+    CU_ASSERT_EQUAL(0, account_transfer(p_accounts, alice, bob, 100, NULL));
+    CU_ASSERT_EQUAL(0, account_close(p_accounts, bob, NULL));
+    CU_ASSERT_EQUAL(7, wal_last_lsn(p_wal));
+    CU_ASSERT_EQUAL(7, journal_lsn());
+    CU_ASSERT_EQUAL(0, user_index_set_log(p_users, NULL, NULL));
+    CU_ASSERT_EQUAL(0, account_store_set_log(p_accounts, NULL, NULL));
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    p_wal = NULL;
+
+    // Test the replay rebuilds the same state.
+    journal_t journal;
+    CU_ASSERT_EQUAL(0, replay(path, &journal));
+    CU_ASSERT_EQUAL(7, journal.applied);
+    CU_ASSERT_EQUAL(1, user_count(journal.p_users));
+    CU_ASSERT_EQUAL(1, account_count(journal.p_accounts));
+    CU_ASSERT_EQUAL(0, user_login(journal.p_users, "alice", "secret", NULL));
+    CU_ASSERT_EQUAL(0, account_balance(journal.p_accounts, alice, &balance));
+    CU_ASSERT_EQUAL(200, balance);
+    CU_ASSERT_EQUAL(-1, account_balance(journal.p_accounts, bob, &balance));
+    CU_ASSERT_EQUAL(user_next_id(p_users), user_next_id(journal.p_users));
+    release(&journal);
+
+    EXIT:
+        if (NULL != p_wal)
+        {
+            wal_close(p_wal);
+        }
+        user_index_destroy(p_users);
+        account_store_destroy(p_accounts);
+        remove_log(path);
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"journal basic test", test_journal_basic},
+        {"journal hooks test", test_journal_hooks},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"journal test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
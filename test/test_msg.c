@@ -0,0 +1,389 @@
+/*!
+ * @file test_msg.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          message codec implemented in source/common/msg.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../source/common/msg.h"
+
+/*!
+ * @brief This function tests encoding frames puts every field at its
+ *          wire offset, in network byte order, and the accessors read
+ *          them back.
+ */
+void
+test_msg_encode (void)
+{
+    msg_request_t request;
+    CU_ASSERT_EQUAL(-1, msg_request_encode(NULL, MSG_OP_USER_LOGIN, 0, "alice", "pw", 0));
+    CU_ASSERT_EQUAL(0, msg_request_sid(NULL));
+    CU_ASSERT_EQUAL(0, msg_request_amount(NULL));
+    CU_ASSERT_EQUAL(-1, msg_request_validate(NULL));
+
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, MSG_OP_ACCOUNT_TRANSFER, 0x01020304,
+                                          "bob", NULL, 0x1112131415161718));
+    const unsigned char * p_bytes = (const unsigned char *) &request;
+    CU_ASSERT_EQUAL(MSG_OP_ACCOUNT_TRANSFER, p_bytes[0]);
+    CU_ASSERT_EQUAL(0, memcmp(p_bytes + 1, "\x01\x02\x03\x04", 4));
+    CU_ASSERT_EQUAL(0, strcmp((const char *) p_bytes + 5, "bob"));
+    CU_ASSERT_EQUAL(0, p_bytes[37]);
+    CU_ASSERT_EQUAL(0, memcmp(p_bytes + 69, "\x11\x12\x13\x14\x15\x16\x17\x18", 8));
+    for (size_t i = MSG_REQ_FIELDS_SIZE; i < MSG_REQ_SIZE; ++i)
+    {
+        CU_ASSERT_EQUAL(0, p_bytes[i]);
+    }
+    CU_ASSERT_EQUAL(0x01020304, msg_request_sid(&request));
+    CU_ASSERT_EQUAL(0x1112131415161718, msg_request_amount(&request));
+
+    // Test the longest string that fits is taken, and a longer one is not.
+    char name[MSG_STR_SIZE + 1];
+    memset(name, 'a', sizeof(name));
+    name[MSG_STR_SIZE - 1] = '\0';
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, MSG_OP_USER_LOGIN, 0, name, name, 0));
+    CU_ASSERT_EQUAL(0, msg_request_validate(&request));
+    name[MSG_STR_SIZE - 1] = 'a';
+    name[MSG_STR_SIZE] = '\0';
+    CU_ASSERT_EQUAL(-1, msg_request_encode(&request, MSG_OP_USER_LOGIN, 0, name, "pw", 0));
+    CU_ASSERT_EQUAL(-1, msg_request_encode(&request, MSG_OP_USER_LOGIN, 0, "alice", name, 0));
+
+    msg_response_t response;
+    memset(&response, 0xAA, sizeof(response));
+    CU_ASSERT_EQUAL(-1, msg_response_encode(NULL, MSG_CODE_SUCCESS, 0, 0));
+    CU_ASSERT_EQUAL(0, msg_response_sid(NULL));
+    CU_ASSERT_EQUAL(0, msg_response_amount(NULL));
+    CU_ASSERT_EQUAL(0, msg_response_encode(&response, MSG_CODE_INSUFF_FUNDS, 0xA1B2C3D4, 500));
+    p_bytes = (const unsigned char *) &response;
+    CU_ASSERT_EQUAL(0xF1, p_bytes[0]);
+    CU_ASSERT_EQUAL(0, memcmp(p_bytes + 1, "\xA1\xB2\xC3\xD4", 4));
+    CU_ASSERT_EQUAL(0, memcmp(p_bytes + 5, "\x00\x00\x00\x00\x00\x00\x01\xF4", 8));
+    for (size_t i = MSG_RESP_FIELDS_SIZE; i < MSG_RESP_SIZE; ++i)
+    {
+        CU_ASSERT_EQUAL(0, p_bytes[i]);
+    }
+    CU_ASSERT_EQUAL(0xA1B2C3D4, msg_response_sid(&response));
+    CU_ASSERT_EQUAL(500, msg_response_amount(&response));
+}
+
+/*!
+ * @brief This function tests the validation rules of each operation.
+ */
+void
+test_msg_validate (void)
+{
+    msg_request_t request;
+
+    // Test unknown opcodes are rejected whatever the fields hold.
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, 0x00, 1, "alice", "pw", 1));
+    CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, 0x04, 1, "alice", "pw", 1));
+    CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, 0xFF, 1, "alice", "pw", 1));
+    CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+
+    // Test operations that only take a session id ignore the other
+    // fields.
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, MSG_OP_USER_DELETE, 1, NULL, NULL, 0));
+    CU_ASSERT_EQUAL(0, msg_request_validate(&request));
+    memset(request.username, 'x', MSG_STR_SIZE);
+    CU_ASSERT_EQUAL(0, msg_request_validate(&request));
+    request.opcode = MSG_OP_ACCOUNT_BALANCE;
+    CU_ASSERT_EQUAL(0, msg_request_validate(&request));
+
+    // Test register and login need a username and a password.
+    uint8_t creds_ops[] = {MSG_OP_USER_REGISTER, MSG_OP_USER_LOGIN};
+    for (size_t i = 0; i < sizeof(creds_ops); ++i)
+    {
+        CU_ASSERT_EQUAL(0, msg_request_encode(&request, creds_ops[i], 0, "alice", "pw", 0));
+        CU_ASSERT_EQUAL(0, msg_request_validate(&request));
+        CU_ASSERT_EQUAL(0, msg_request_encode(&request, creds_ops[i], 0, "", "pw", 0));
+        CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+        CU_ASSERT_EQUAL(0, msg_request_encode(&request, creds_ops[i], 0, "alice", NULL, 0));
+        CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+        CU_ASSERT_EQUAL(0, msg_request_encode(&request, creds_ops[i], 0, "alice", "pw", 0));
+        memset(request.password, 'x', MSG_STR_SIZE);
+        CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+    }
+
+    // Test money operations need an amount, and transfer a recipient.
+    uint8_t money_ops[] = {MSG_OP_ACCOUNT_DEPOSIT, MSG_OP_ACCOUNT_WITHDRAW};
+    for (size_t i = 0; i < sizeof(money_ops); ++i)
+    {
+        CU_ASSERT_EQUAL(0, msg_request_encode(&request, money_ops[i], 1, NULL, NULL, 10));
+        CU_ASSERT_EQUAL(0, msg_request_validate(&request));
+        CU_ASSERT_EQUAL(0, msg_request_encode(&request, money_ops[i], 1, NULL, NULL, 0));
+        CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+    }
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, MSG_OP_ACCOUNT_TRANSFER, 1, "bob", NULL, 10));
+    CU_ASSERT_EQUAL(0, msg_request_validate(&request));
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, MSG_OP_ACCOUNT_TRANSFER, 1, NULL, NULL, 10));
+    CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+    CU_ASSERT_EQUAL(0, msg_request_encode(&request, MSG_OP_ACCOUNT_TRANSFER, 1, "bob", NULL, 0));
+    CU_ASSERT_EQUAL(-1, msg_request_validate(&request));
+}
+
+/*!
+ * @brief These are dispatch test handlers. Each answers with its own
+ *          opcode in the amount, and counts its calls.
+ */
+static void
+handle_echo_op (const msg_request_t * p_request, msg_response_t * p_response, void * p_ctx)
+{
+    (*(size_t *) p_ctx)++;
+    msg_response_encode(p_response, MSG_CODE_SUCCESS, msg_request_sid(p_request),
+                        p_request->opcode);
+}
+
+/*!
+ * @brief This function tests requests are routed to their operation's
+ *          handler, and failures echo the session id.
+ */
+void
+test_msg_dispatch (void)
+{
+    msg_dispatch_t dispatch;
+    size_t calls = 0;
+    unsigned char request[MSG_REQ_SIZE];
+    unsigned char response[MSG_RESP_SIZE];
+    msg_request_t * p_req = (msg_request_t *) request;
+    msg_response_t * p_resp = (msg_response_t *) response;
+
+    // Test bad parameters.
+    CU_ASSERT_EQUAL(-1, msg_dispatch_init(NULL, NULL));
+    CU_ASSERT_EQUAL(0, msg_dispatch_init(&dispatch, &calls));
+    CU_ASSERT_EQUAL(-1, msg_dispatch_set(NULL, MSG_OP_USER_LOGIN, handle_echo_op));
+    CU_ASSERT_EQUAL(-1, msg_dispatch_set(&dispatch, 0x00, handle_echo_op));
+    CU_ASSERT_EQUAL(-1, msg_dispatch_set(&dispatch, 0x14, handle_echo_op));
+    CU_ASSERT_EQUAL(-1, msg_dispatch(NULL, request, response));
+    CU_ASSERT_EQUAL(-1, msg_dispatch(&dispatch, NULL, response));
+    CU_ASSERT_EQUAL(-1, msg_dispatch(&dispatch, request, NULL));
+
+    // Test a valid request without a handler fails, echoing the sid.
+    CU_ASSERT_EQUAL(0, msg_request_encode(p_req, MSG_OP_ACCOUNT_BALANCE, 77, NULL, NULL, 0));
+    memset(response, 0xAA, sizeof(response));
+    CU_ASSERT_EQUAL(-1, msg_dispatch(&dispatch, request, response));
+    CU_ASSERT_EQUAL(MSG_CODE_FAILURE, p_resp->code);
+    CU_ASSERT_EQUAL(77, msg_response_sid(p_resp));
+    CU_ASSERT_EQUAL(0, msg_response_amount(p_resp));
+    CU_ASSERT_EQUAL(0, p_resp->padding[sizeof(p_resp->padding) - 1]);
+
+    // Test every operation reaches its handler.
+    uint8_t ops[MSG_NUM_OPS] =
+    {
+        MSG_OP_USER_REGISTER, MSG_OP_USER_DELETE, MSG_OP_USER_LOGIN,
+        MSG_OP_ACCOUNT_BALANCE, MSG_OP_ACCOUNT_DEPOSIT, MSG_OP_ACCOUNT_WITHDRAW,
+        MSG_OP_ACCOUNT_TRANSFER,
+    };
+    for (size_t i = 0; i < MSG_NUM_OPS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, msg_dispatch_set(&dispatch, ops[i], handle_echo_op));
+    }
+    for (size_t i = 0; i < MSG_NUM_OPS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, msg_request_encode(p_req, ops[i], (uint32_t) i, "alice", "pw", 5));
+        CU_ASSERT_EQUAL(0, msg_dispatch(&dispatch, request, response));
+        CU_ASSERT_EQUAL(MSG_CODE_SUCCESS, p_resp->code);
+        CU_ASSERT_EQUAL(i, msg_response_sid(p_resp));
+        CU_ASSERT_EQUAL(ops[i], msg_response_amount(p_resp));
+    }
+    CU_ASSERT_EQUAL(MSG_NUM_OPS, calls);
+
+    // Test invalid requests never reach a handler.
+    CU_ASSERT_EQUAL(0, msg_request_encode(p_req, MSG_OP_ACCOUNT_DEPOSIT, 9, NULL, NULL, 0));
+    CU_ASSERT_EQUAL(-1, msg_dispatch(&dispatch, request, response));
+    CU_ASSERT_EQUAL(MSG_CODE_FAILURE, p_resp->code);
+    CU_ASSERT_EQUAL(9, msg_response_sid(p_resp));
+    request[0] = 0x42;
+    CU_ASSERT_EQUAL(-1, msg_dispatch(&dispatch, request, response));
+    CU_ASSERT_EQUAL(MSG_NUM_OPS, calls);
+
+    // Test a removed handler is no longer called.
+    CU_ASSERT_EQUAL(0, msg_dispatch_set(&dispatch, MSG_OP_USER_DELETE, NULL));
+    CU_ASSERT_EQUAL(0, msg_request_encode(p_req, MSG_OP_USER_DELETE, 1, NULL, NULL, 0));
+    CU_ASSERT_EQUAL(-1, msg_dispatch(&dispatch, request, response));
+    CU_ASSERT_EQUAL(MSG_NUM_OPS, calls);
+}
+
+/*!
+ * @brief Fuzz test parameters.
+ */
+#define FUZZ_FRAMES 200000
+#define FUZZ_MUTATIONS 4
+
+/*!
+ * @brief This function is a reference validator for the fuzz test. It
+ *          reads the raw bytes at their documented offsets, so it also
+ *          checks the codec's layout.
+ */
+static bool
+reference_str_valid (const unsigned char * p_field)
+{
+    if (0 == p_field[0])
+    {
+        return false;
+    }
+    for (size_t i = 1; i < MSG_STR_SIZE; ++i)
+    {
+        if (0 == p_field[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+reference_valid (const unsigned char * p_frame)
+{
+    bool b_amount = false;
+    for (size_t i = 69; i < 77; ++i)
+    {
+        b_amount |= (0 != p_frame[i]);
+    }
+    switch (p_frame[0])
+    {
+        case MSG_OP_USER_REGISTER:
+        case MSG_OP_USER_LOGIN:
+            return reference_str_valid(p_frame + 5) && reference_str_valid(p_frame + 37);
+        case MSG_OP_USER_DELETE:
+        case MSG_OP_ACCOUNT_BALANCE:
+            return true;
+        case MSG_OP_ACCOUNT_DEPOSIT:
+        case MSG_OP_ACCOUNT_WITHDRAW:
+            return b_amount;
+        case MSG_OP_ACCOUNT_TRANSFER:
+            return reference_str_valid(p_frame + 5) && b_amount;
+        default:
+            return false;
+    }
+}
+
+/*!
+ * @brief This function feeds the validator random frames and randomly
+ *          mutated valid frames, at every alignment, and checks it
+ *          agrees with the reference validator on each.
+ */
+void
+test_msg_fuzz (void)
+{
+    // The frames are validated at odd offsets, as in a receive buffer.
+    unsigned char buffer[MSG_REQ_SIZE + 8];
+    uint8_t ops[MSG_NUM_OPS] =
+    {
+        MSG_OP_USER_REGISTER, MSG_OP_USER_DELETE, MSG_OP_USER_LOGIN,
+        MSG_OP_ACCOUNT_BALANCE, MSG_OP_ACCOUNT_DEPOSIT, MSG_OP_ACCOUNT_WITHDRAW,
+        MSG_OP_ACCOUNT_TRANSFER,
+    };
+    size_t mismatches = 0;
+    size_t num_valid = 0;
+    uint64_t seed = 88172645463325252u;
+    for (size_t frame = 0; frame < FUZZ_FRAMES; ++frame)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        unsigned char * p_frame = buffer + (frame % 8);
+
+        // Even frames start valid and have a few bytes mutated, biased
+        // to the fields. Odd frames are random throughout, mostly with
+        // a known opcode so the field checks are reached.
+        if (0 == (frame % 2))
+        {
+            msg_request_encode((msg_request_t *) p_frame, ops[seed % MSG_NUM_OPS],
+                               (uint32_t) seed, "alice", "secret", seed | 1);
+            size_t mutations = (seed >> 8) % (FUZZ_MUTATIONS + 1);
+            for (size_t i = 0; i < mutations; ++i)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                size_t pos = (seed >> 16) % MSG_REQ_FIELDS_SIZE;
+                p_frame[pos] = ((seed >> 32) & 1) ? 0 : (unsigned char) (seed >> 40);
+            }
+        }
+        else
+        {
+            uint64_t bytes = seed;
+            for (size_t i = 0; i < MSG_REQ_SIZE; ++i)
+            {
+                if (0 == (i % 8))
+                {
+                    bytes ^= bytes << 13;
+                    bytes ^= bytes >> 7;
+                    bytes ^= bytes << 17;
+                }
+                p_frame[i] = (unsigned char) (bytes >> ((i % 8) * 8));
+            }
+            if (0 != (seed & 3))
+            {
+                p_frame[0] = ops[(seed >> 8) % MSG_NUM_OPS];
+            }
+        }
+
+        bool b_valid = (0 == msg_request_validate((const msg_request_t *) p_frame));
+        if (b_valid != reference_valid(p_frame))
+        {
+            mismatches++;
+        }
+        num_valid += b_valid;
+    }
+    CU_ASSERT_EQUAL(0, mismatches);
+
+    // Test both outcomes were exercised.
+    CU_ASSERT(num_valid > (FUZZ_FRAMES / 10));
+    CU_ASSERT(num_valid < (FUZZ_FRAMES - (FUZZ_FRAMES / 10)));
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"msg encode test", test_msg_encode},
+        {"msg validate test", test_msg_validate},
+        {"msg dispatch test", test_msg_dispatch},
+        {"msg fuzz test", test_msg_fuzz},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"msg test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
@@ -0,0 +1,254 @@
+/*!
+ * @file test_pool.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          object pool implemented in source/common/pool.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../source/common/pool.h"
+#include "../source/common/ring.h"
+
+/*!
+ * @brief This function tests the pool_create function.
+ */
+void
+test_pool_create (void)
+{
+    // Test create with a zero object size.
+    pool_t * p_pool = pool_create(0, 0);
+    CU_ASSERT_PTR_NULL(p_pool);
+
+    // Test create with success.
+    p_pool = pool_create(24, 0);
+    CU_ASSERT_PTR_NOT_NULL(p_pool);
+
+    if (NULL != p_pool)
+    {
+        pool_destroy(p_pool);
+        p_pool = NULL;
+    }
+    return;
+}
+
+/*!
+ * @brief This function tests pool_alloc and pool_free, and checks that
+ *          freed objects are reused instead of growing the pool.
+ */
+#define REUSE_OBJS 16
+#define REUSE_ROUNDS 1000
+void
+test_pool_reuse (void)
+{
+    pool_stats_t stats = {0};
+    void * p_objs[REUSE_OBJS] = {0};
+    pool_t * p_pool = pool_create(100, 32);
+    CU_ASSERT_PTR_NOT_NULL(p_pool);
+    if (NULL == p_pool)
+    {
+        goto EXIT;
+    }
+
+    // Test NULL parameters.
+    CU_ASSERT_PTR_NULL(pool_alloc(NULL));
+    CU_ASSERT_EQUAL(-1, pool_stats(NULL, &stats));
+    CU_ASSERT_EQUAL(-1, pool_stats(p_pool, NULL));
+    pool_free(p_pool, NULL);
+
+    for (size_t round = 0; round < REUSE_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < REUSE_OBJS; ++i)
+        {
+            p_objs[i] = pool_alloc(p_pool);
+            CU_ASSERT_PTR_NOT_NULL(p_objs[i]);
+            if (NULL == p_objs[i])
+            {
+                goto EXIT;
+            }
+
+            // The whole object must be writable.
+            memset(p_objs[i], (int) i, 100);
+        }
+        for (size_t i = 0; i < REUSE_OBJS; ++i)
+        {
+            pool_free(p_pool, p_objs[i]);
+        }
+    }
+
+    // Only the first allocation should have needed a slab.
+    CU_ASSERT_EQUAL(0, pool_stats(p_pool, &stats));
+    printf("hits: %zu, misses: %zu, slabs: %zu\n", stats.hits, stats.misses, stats.slabs);
+    CU_ASSERT_EQUAL(1, stats.misses);
+    CU_ASSERT_EQUAL(1, stats.slabs);
+    CU_ASSERT_EQUAL((REUSE_OBJS * REUSE_ROUNDS) - 1, stats.hits);
+
+    EXIT:
+        if (NULL != p_pool)
+        {
+            pool_destroy(p_pool);
+            p_pool = NULL;
+        }
+        return;
+}
+
+/*!
+ * @brief Cross-thread test parameters. Producers allocate objects and
+ *          pass them through a ring to consumers, which free them.
+ */
+#define XT_THREADS 4
+#define XT_PER_PRODUCER 50000
+#define XT_IN_FLIGHT 256
+
+static pool_t * gp_xt_pool = NULL;
+static ring_t * gp_xt_ring = NULL;
+static _Atomic size_t g_xt_freed = 0;
+
+/*!
+ * @brief This is a producer thread for the cross-thread test.
+ */
+static void *
+xt_producer (void * p_arg)
+{
+    uintptr_t tag = (uintptr_t) p_arg;
+    for (size_t i = 0; i < XT_PER_PRODUCER; ++i)
+    {
+        uintptr_t * p_obj = pool_alloc(gp_xt_pool);
+        CU_ASSERT_PTR_NOT_NULL(p_obj);
+        if (NULL == p_obj)
+        {
+            break;
+        }
+        p_obj[0] = tag;
+        p_obj[1] = i;
+        while (0 != ring_try_enq(gp_xt_ring, p_obj))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This is a consumer thread for the cross-thread test.
+ */
+static void *
+xt_consumer (void * p_arg)
+{
+    (void) p_arg;
+    while (atomic_load(&g_xt_freed) < (XT_THREADS * XT_PER_PRODUCER))
+    {
+        uintptr_t * p_obj = ring_try_deq(gp_xt_ring);
+        if (NULL == p_obj)
+        {
+            sched_yield();
+            continue;
+        }
+        CU_ASSERT(p_obj[0] < XT_THREADS);
+        pool_free(gp_xt_pool, p_obj);
+        atomic_fetch_add(&g_xt_freed, 1);
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This function tests allocation and free from different
+ *          threads, and checks the pool stays bounded by the number
+ *          of objects in flight.
+ */
+void
+test_pool_cross_thread (void)
+{
+    pthread_t producers[XT_THREADS];
+    pthread_t consumers[XT_THREADS];
+    pool_stats_t stats = {0};
+
+    gp_xt_pool = pool_create(2 * sizeof(uintptr_t), 64);
+    gp_xt_ring = ring_create(XT_IN_FLIGHT);
+    CU_ASSERT_PTR_NOT_NULL(gp_xt_pool);
+    CU_ASSERT_PTR_NOT_NULL(gp_xt_ring);
+    if ((NULL == gp_xt_pool) ||
+        (NULL == gp_xt_ring))
+    {
+        goto EXIT;
+    }
+    atomic_store(&g_xt_freed, 0);
+
+    for (size_t i = 0; i < XT_THREADS; ++i)
+    {
+        pthread_create(consumers + i, NULL, xt_consumer, NULL);
+        pthread_create(producers + i, NULL, xt_producer, (void *) (uintptr_t) i);
+    }
+    for (size_t i = 0; i < XT_THREADS; ++i)
+    {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+
+    CU_ASSERT_EQUAL(0, pool_stats(gp_xt_pool, &stats));
+    printf("hits: %zu, misses: %zu, refills: %zu, slabs: %zu\n",
+           stats.hits, stats.misses, stats.refills, stats.slabs);
+    CU_ASSERT_EQUAL(XT_THREADS * XT_PER_PRODUCER, stats.hits + stats.misses);
+
+    // Objects in flight are bounded by the ring plus the thread caches.
+    CU_ASSERT(stats.slabs * 64 <= XT_IN_FLIGHT + (2 * XT_THREADS * (POOL_DEFAULT_CACHE_MAX + 64)));
+
+    EXIT:
+        ring_destroy(gp_xt_ring);
+        gp_xt_ring = NULL;
+        pool_destroy(gp_xt_pool);
+        gp_xt_pool = NULL;
+        return;
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"pool_create test", test_pool_create},
+        {"pool reuse test", test_pool_reuse},
+        {"pool cross-thread test", test_pool_cross_thread},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"pool test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
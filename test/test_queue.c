@@ -121,6 +121,129 @@ test_queue_deq (void)
         return;
 }
 
+/*!
+ * @brief This function tests the queue_enq_batch and queue_deq_batch
+ *          functions.
+ */
+void
+test_queue_batch (void)
+{
+    int nums[5] = {1,2,3,4,5};
+    void * p_in[5] = {nums + 0, nums + 1, nums + 2, nums + 3, nums + 4};
+    void * p_out[5] = {0};
+    queue_t * p_q = queue_create();
+    CU_ASSERT_PTR_NOT_NULL(p_q);
+    if (NULL == p_q)
+    {
+        goto EXIT;
+    }
+
+    // Test batch enqueue with bad parameters.
+    CU_ASSERT_EQUAL(-1, queue_enq_batch(NULL, p_in, 5));
+    CU_ASSERT_EQUAL(-1, queue_enq_batch(p_q, NULL, 5));
+    CU_ASSERT_EQUAL(-1, queue_enq_batch(p_q, p_in, 0));
+
+    // Test a NULL entry rejects the whole batch.
+    p_in[3] = NULL;
+    CU_ASSERT_EQUAL(-1, queue_enq_batch(p_q, p_in, 5));
+    CU_ASSERT_EQUAL(0, p_q->size);
+    p_in[3] = nums + 3;
+
+    // Test batch enqueue behind a single enqueue.
+    CU_ASSERT_EQUAL(0, queue_enq(p_q, nums + 0));
+    CU_ASSERT_EQUAL(0, queue_enq_batch(p_q, p_in + 1, 4));
+    CU_ASSERT_EQUAL(5, p_q->size);
+
+    // Test batch dequeue with bad parameters.
+    CU_ASSERT_EQUAL(0, queue_deq_batch(NULL, p_out, 5));
+    CU_ASSERT_EQUAL(0, queue_deq_batch(p_q, NULL, 5));
+
+    // Test batch dequeue in two parts, with the second asking for more
+    // than remains.
+    CU_ASSERT_EQUAL(2, queue_deq_batch(p_q, p_out, 2));
+    CU_ASSERT_EQUAL(3, p_q->size);
+    CU_ASSERT_EQUAL(3, queue_deq_batch(p_q, p_out + 2, 5));
+    CU_ASSERT_EQUAL(0, p_q->size);
+    CU_ASSERT_PTR_NULL(p_q->p_head);
+    CU_ASSERT_PTR_NULL(p_q->p_tail);
+    for (size_t i = 0; i < 5; ++i)
+    {
+        CU_ASSERT_PTR_EQUAL(p_out[i], nums + i);
+    }
+
+    // The queue must still work after being drained by a batch.
+    CU_ASSERT_EQUAL(0, queue_enq(p_q, nums + 0));
+    CU_ASSERT_PTR_EQUAL(nums + 0, queue_deq(p_q));
+
+    EXIT:
+        // Destroy queue.
+        if (NULL != p_q)
+        {
+            queue_destroy(p_q);
+            p_q = NULL;
+        }
+        return;
+}
+
+/*!
+ * @brief This function tests the queue_splice function.
+ */
+void
+test_queue_splice (void)
+{
+    int nums[5] = {1,2,3,4,5};
+    queue_t * p_a = queue_create();
+    queue_t * p_b = queue_create();
+    CU_ASSERT_PTR_NOT_NULL(p_a);
+    CU_ASSERT_PTR_NOT_NULL(p_b);
+    if ((NULL == p_a) ||
+        (NULL == p_b))
+    {
+        goto EXIT;
+    }
+
+    // Test splice with bad parameters.
+    CU_ASSERT_EQUAL(-1, queue_splice(NULL, p_b));
+    CU_ASSERT_EQUAL(-1, queue_splice(p_a, NULL));
+    CU_ASSERT_EQUAL(-1, queue_splice(p_a, p_a));
+
+    // Test splicing an empty queue is a no-op.
+    CU_ASSERT_EQUAL(0, queue_splice(p_a, p_b));
+    CU_ASSERT_EQUAL(0, p_a->size);
+
+    // Test splicing onto an empty queue, then onto a non-empty one.
+    CU_ASSERT_EQUAL(0, queue_enq(p_b, nums + 0));
+    CU_ASSERT_EQUAL(0, queue_enq(p_b, nums + 1));
+    CU_ASSERT_EQUAL(0, queue_splice(p_a, p_b));
+    CU_ASSERT_EQUAL(2, p_a->size);
+    CU_ASSERT_EQUAL(0, p_b->size);
+    for (size_t i = 2; i < 5; ++i)
+    {
+        CU_ASSERT_EQUAL(0, queue_enq(p_b, nums + i));
+    }
+    CU_ASSERT_EQUAL(0, queue_splice(p_a, p_b));
+    CU_ASSERT_EQUAL(5, p_a->size);
+    CU_ASSERT_PTR_NULL(p_b->p_head);
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        int * p_i = queue_deq(p_a);
+        CU_ASSERT_PTR_NOT_NULL(p_i);
+        if (NULL == p_i)
+        {
+            goto EXIT;
+        }
+        CU_ASSERT_EQUAL(*p_i, nums[i]);
+    }
+
+    EXIT:
+        queue_destroy(p_a);
+        p_a = NULL;
+        queue_destroy(p_b);
+        p_b = NULL;
+        return;
+}
+
 int
 main ()
 {
@@ -139,6 +262,8 @@ main ()
         {"queue_create test", test_queue_create},
         {"queue_enq test", test_queue_enq},
         {"queue_deq test", test_queue_deq},
+        {"queue batch test", test_queue_batch},
+        {"queue_splice test", test_queue_splice},
         CU_TEST_INFO_NULL,
     };
 
@@ -0,0 +1,304 @@
+/*!
+ * @file test_ring.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          lock-free ring queue implemented in source/common/ring.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../source/common/ring.h"
+
+/*!
+ * @brief This function tests the ring_create function.
+ */
+void
+test_ring_create (void)
+{
+    // Test create with invalid capacities.
+    ring_t * p_r = ring_create(0);
+    CU_ASSERT_PTR_NULL(p_r);
+    p_r = ring_create(6);
+    CU_ASSERT_PTR_NULL(p_r);
+
+    // Test create with success.
+    p_r = ring_create(8);
+    CU_ASSERT_PTR_NOT_NULL(p_r);
+    CU_ASSERT_EQUAL(0, ring_size(p_r));
+
+    if (NULL != p_r)
+    {
+        ring_destroy(p_r);
+        p_r = NULL;
+    }
+    return;
+}
+
+/*!
+ * @brief This function tests the ring_try_enq function.
+ */
+void
+test_ring_enq (void)
+{
+    ring_t * p_r = ring_create(4);
+    CU_ASSERT_PTR_NOT_NULL(p_r);
+    if (NULL == p_r)
+    {
+        goto EXIT;
+    }
+
+    // Test enqueue with NULL as the ring context.
+    int nums[5] = {1,2,3,4,5};
+    int result = ring_try_enq(NULL, nums + 0);
+    CU_ASSERT_EQUAL(-1, result);
+
+    // Test enqueue with NULL as the data.
+    result = ring_try_enq(p_r, NULL);
+    CU_ASSERT_EQUAL(-1, result);
+
+    // Test enqueue with success up to capacity.
+    for (size_t i = 0; i < 4; ++i)
+    {
+        result = ring_try_enq(p_r, nums + i);
+        CU_ASSERT_EQUAL(0, result);
+        CU_ASSERT_EQUAL(i+1, ring_size(p_r));
+    }
+
+    // Test enqueue on a full ring.
+    result = ring_try_enq(p_r, nums + 4);
+    CU_ASSERT_EQUAL(-1, result);
+    CU_ASSERT_EQUAL(4, ring_size(p_r));
+
+    EXIT:
+        // Destroy ring.
+        if (NULL != p_r)
+        {
+            ring_destroy(p_r);
+            p_r = NULL;
+        }
+        return;
+}
+
+/*!
+ * @brief This function tests the ring_try_deq function, including
+ *          wrapping around the ring several times.
+ */
+void
+test_ring_deq (void)
+{
+    ring_t * p_r = ring_create(4);
+    CU_ASSERT_PTR_NOT_NULL(p_r);
+    if (NULL == p_r)
+    {
+        goto EXIT;
+    }
+
+    // Test dequeue with NULL parameter and on an empty ring.
+    int * p_i = ring_try_deq(NULL);
+    CU_ASSERT_PTR_NULL(p_i);
+    p_i = ring_try_deq(p_r);
+    CU_ASSERT_PTR_NULL(p_i);
+
+    // Enqueue and dequeue in FIFO order over several laps.
+    int nums[3] = {1,2,3};
+    for (size_t lap = 0; lap < 10; ++lap)
+    {
+        for (size_t i = 0; i < 3; ++i)
+        {
+            CU_ASSERT_EQUAL(0, ring_try_enq(p_r, nums + i));
+        }
+        for (size_t i = 0; i < 3; ++i)
+        {
+            p_i = ring_try_deq(p_r);
+            CU_ASSERT_PTR_NOT_NULL(p_i);
+            if (NULL == p_i)
+            {
+                goto EXIT;
+            }
+            CU_ASSERT_EQUAL(*p_i, nums[i]);
+        }
+        CU_ASSERT_EQUAL(0, ring_size(p_r));
+    }
+
+    EXIT:
+        // Destroy ring.
+        if (NULL != p_r)
+        {
+            ring_destroy(p_r);
+            p_r = NULL;
+        }
+        return;
+}
+
+/*!
+ * @brief Stress test parameters.
+ */
+#define STRESS_PRODUCERS 8
+#define STRESS_CONSUMERS 8
+#define STRESS_PER_PRODUCER 50000
+#define STRESS_TOTAL (STRESS_PRODUCERS * STRESS_PER_PRODUCER)
+#define STRESS_CAPACITY 64
+
+static ring_t * gp_stress_ring = NULL;
+static uintptr_t g_stress_items[STRESS_TOTAL];
+static _Atomic unsigned char g_stress_seen[STRESS_TOTAL];
+static _Atomic size_t g_stress_consumed = 0;
+
+/*!
+ * @brief This is a producer thread for the stress test. Each producer
+ *          enqueues its own disjoint range of items.
+ */
+static void *
+stress_producer (void * p_arg)
+{
+    size_t base = (size_t) (uintptr_t) p_arg * STRESS_PER_PRODUCER;
+    for (size_t i = 0; i < STRESS_PER_PRODUCER; ++i)
+    {
+        while (0 != ring_try_enq(gp_stress_ring, g_stress_items + base + i))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This is a consumer thread for the stress test. Consumers run
+ *          until every item has been dequeued.
+ */
+static void *
+stress_consumer (void * p_arg)
+{
+    (void) p_arg;
+    while (atomic_load(&g_stress_consumed) < STRESS_TOTAL)
+    {
+        uintptr_t * p_item = ring_try_deq(gp_stress_ring);
+        if (NULL == p_item)
+        {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add(g_stress_seen + *p_item, 1);
+        atomic_fetch_add(&g_stress_consumed, 1);
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This function stresses the ring with many producer and
+ *          consumer threads and checks that every item is dequeued
+ *          exactly once.
+ */
+void
+test_ring_stress (void)
+{
+    pthread_t producers[STRESS_PRODUCERS];
+    pthread_t consumers[STRESS_CONSUMERS];
+
+    gp_stress_ring = ring_create(STRESS_CAPACITY);
+    CU_ASSERT_PTR_NOT_NULL(gp_stress_ring);
+    if (NULL == gp_stress_ring)
+    {
+        goto EXIT;
+    }
+
+    for (size_t i = 0; i < STRESS_TOTAL; ++i)
+    {
+        g_stress_items[i] = i;
+        atomic_init(g_stress_seen + i, 0);
+    }
+    atomic_store(&g_stress_consumed, 0);
+
+    for (size_t i = 0; i < STRESS_CONSUMERS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(consumers + i, NULL, stress_consumer, NULL));
+    }
+    for (size_t i = 0; i < STRESS_PRODUCERS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(producers + i, NULL, stress_producer,
+                                          (void *) (uintptr_t) i));
+    }
+
+    for (size_t i = 0; i < STRESS_PRODUCERS; ++i)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (size_t i = 0; i < STRESS_CONSUMERS; ++i)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+
+    // Every item must have been seen exactly once.
+    size_t errors = 0;
+    for (size_t i = 0; i < STRESS_TOTAL; ++i)
+    {
+        if (1 != atomic_load(g_stress_seen + i))
+        {
+            errors++;
+        }
+    }
+    printf("consumed: %zu, errors: %zu\n", atomic_load(&g_stress_consumed), errors);
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(0, ring_size(gp_stress_ring));
+
+    EXIT:
+        if (NULL != gp_stress_ring)
+        {
+            ring_destroy(gp_stress_ring);
+            gp_stress_ring = NULL;
+        }
+        return;
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"ring_create test", test_ring_create},
+        {"ring_try_enq test", test_ring_enq},
+        {"ring_try_deq test", test_ring_deq},
+        {"ring stress test", test_ring_stress},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"ring test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
@@ -0,0 +1,688 @@
+/*!
+ * @file test_server.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          server front end implemented in source/server/server.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../source/server/server.h"
+
+/*!
+ * @brief This is a request handler that answers with the request's first
+ *          bytes, and counts the requests it handled. With a context, it
+ *          takes longer on some requests than others, so requests of one
+ *          connection finish out of order.
+ */
+static _Atomic size_t g_handled = 0;
+static void
+echo_handler (const unsigned char * p_request, unsigned char * p_response, void * p_ctx)
+{
+    if (NULL != p_ctx)
+    {
+        usleep((p_request[0] % 4) * 200);
+    }
+    memcpy(p_response, p_request, SERVER_RESP_SIZE);
+    atomic_fetch_add(&g_handled, 1);
+}
+
+/*!
+ * @brief This function runs the reactor of a server.
+ */
+static void *
+run_reactor (void * vp_server)
+{
+    CU_ASSERT_EQUAL(0, server_run(vp_server));
+    return NULL;
+}
+
+/*!
+ * @brief This function opens a blocking client connection to a server
+ *          on the loopback interface.
+ */
+static int
+connect_to (const uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (-1 == connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*!
+ * @brief This function reads exactly the given number of bytes, and
+ *          returns the number read before the peer closed.
+ */
+static size_t
+read_all (const int fd, unsigned char * p_buf, const size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t ret = recv(fd, p_buf + got, len - got, 0);
+        if (ret <= 0)
+        {
+            break;
+        }
+        got += (size_t) ret;
+    }
+    return got;
+}
+
+/*!
+ * @brief This function fills a request frame with a pattern derived from
+ *          a sequence number.
+ */
+static void
+fill_request (unsigned char * p_request, const size_t seq)
+{
+    for (size_t i = 0; i < SERVER_REQ_SIZE; ++i)
+    {
+        p_request[i] = (unsigned char) (seq + i);
+    }
+}
+
+/*!
+ * @brief This function tests server_attr_init and server_create.
+ */
+void
+test_server_create (void)
+{
+    server_attr_t attr;
+    CU_ASSERT_EQUAL(-1, server_attr_init(NULL));
+    CU_ASSERT_EQUAL(0, server_attr_init(&attr));
+    CU_ASSERT_EQUAL(SERVER_DEFAULT_PORT, attr.port);
+    CU_ASSERT_EQUAL(SERVER_DEFAULT_WORKERS, attr.num_workers);
+    CU_ASSERT_EQUAL(SERVER_BACKEND_EPOLL, attr.backend);
+    CU_ASSERT_EQUAL(SERVER_DEFAULT_MAX_INFLIGHT, attr.max_inflight);
+    CU_ASSERT_EQUAL(SERVER_DEFAULT_REACTORS, attr.num_reactors);
+    CU_ASSERT_FALSE(attr.b_pinned);
+
+    // Test bad parameters.
+    attr.port = 0;
+    CU_ASSERT_PTR_NULL(server_create(NULL, echo_handler, NULL));
+    CU_ASSERT_PTR_NULL(server_create(&attr, NULL, NULL));
+    attr.num_workers = 0;
+    CU_ASSERT_PTR_NULL(server_create(&attr, echo_handler, NULL));
+    attr.num_workers = 1;
+    attr.max_conns = 0;
+    CU_ASSERT_PTR_NULL(server_create(&attr, echo_handler, NULL));
+    attr.max_conns = 4;
+    attr.max_inflight = 0;
+    CU_ASSERT_PTR_NULL(server_create(&attr, echo_handler, NULL));
+    attr.max_inflight = SERVER_MAX_INFLIGHT + 1;
+    CU_ASSERT_PTR_NULL(server_create(&attr, echo_handler, NULL));
+    attr.max_inflight = SERVER_MAX_INFLIGHT;
+    attr.num_reactors = 0;
+    CU_ASSERT_PTR_NULL(server_create(&attr, echo_handler, NULL));
+    attr.num_reactors = 1;
+    server_stats_t stats;
+    CU_ASSERT_EQUAL(-1, server_run(NULL));
+    CU_ASSERT_EQUAL(0, server_num_reactors(NULL));
+    CU_ASSERT_EQUAL(-1, server_reactor_stats(NULL, 0, &stats));
+    CU_ASSERT_EQUAL(0, server_port(NULL));
+    CU_ASSERT_EQUAL(SERVER_BACKEND_EPOLL, server_backend(NULL));
+    server_stop(NULL);
+    server_destroy(NULL);
+
+    // Test an ephemeral port is reported, and a server that never ran
+    // can be destroyed.
+    server_t * p_server = server_create(&attr, echo_handler, NULL);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    CU_ASSERT_NOT_EQUAL(0, server_port(p_server));
+    CU_ASSERT_EQUAL(SERVER_BACKEND_EPOLL, server_backend(p_server));
+    CU_ASSERT_EQUAL(1, server_num_reactors(p_server));
+    CU_ASSERT_EQUAL(-1, server_reactor_stats(p_server, 0, NULL));
+    CU_ASSERT_EQUAL(-1, server_reactor_stats(p_server, 1, &stats));
+    CU_ASSERT_EQUAL(0, server_reactor_stats(p_server, 0, &stats));
+    CU_ASSERT_EQUAL(0, stats.num_conns);
+    CU_ASSERT_EQUAL(0, stats.accepted);
+    server_destroy(p_server);
+
+    // Test an io_uring server is created, on epoll if the kernel cannot
+    // run io_uring.
+    attr.backend = SERVER_BACKEND_URING;
+    p_server = server_create(&attr, echo_handler, NULL);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    printf("backend: %s\n",
+           (SERVER_BACKEND_URING == server_backend(p_server)) ? "io_uring" : "epoll");
+    server_destroy(p_server);
+}
+
+/*!
+ * @brief Exchange test parameters.
+ */
+#define EXCHANGE_CLIENTS 8
+#define EXCHANGE_FRAMES 200
+
+/*!
+ * @brief This function sends frames on one connection, a few at a time
+ *          and split at odd offsets, and checks every response.
+ */
+static void *
+run_client (void * vp_port)
+{
+    size_t errors = 0;
+    int fd = connect_to(*(uint16_t *) vp_port);
+    if (-1 == fd)
+    {
+        return (void *) 1;
+    }
+
+    unsigned char request[SERVER_REQ_SIZE * 3];
+    unsigned char response[SERVER_RESP_SIZE];
+    for (size_t seq = 0; seq < EXCHANGE_FRAMES; seq += 3)
+    {
+        for (size_t i = 0; i < 3; ++i)
+        {
+            fill_request(request + (i * SERVER_REQ_SIZE), seq + i);
+        }
+
+        // Send three frames in uneven pieces that cut across frames.
+        size_t cuts[] = {0, 100, 300, 301, sizeof(request)};
+        for (size_t i = 0; (i + 1) < (sizeof(cuts) / sizeof(cuts[0])); ++i)
+        {
+            if ((ssize_t) (cuts[i + 1] - cuts[i]) !=
+                send(fd, request + cuts[i], cuts[i + 1] - cuts[i], 0))
+            {
+                errors++;
+            }
+        }
+        for (size_t i = 0; i < 3; ++i)
+        {
+            if ((sizeof(response) != read_all(fd, response, sizeof(response))) ||
+                (0 != memcmp(response, request + (i * SERVER_REQ_SIZE), sizeof(response))))
+            {
+                errors++;
+            }
+        }
+    }
+
+    close(fd);
+    return (void *) errors;
+}
+
+/*!
+ * @brief This function runs the exchange test against a server with the
+ *          given backend.
+ */
+static void
+run_exchange (const server_backend_t backend)
+{
+    server_attr_t attr;
+    CU_ASSERT_EQUAL(0, server_attr_init(&attr));
+    attr.port = 0;
+    attr.num_workers = 4;
+    attr.max_conns = EXCHANGE_CLIENTS;
+    attr.backend = backend;
+    server_t * p_server = server_create(&attr, echo_handler, NULL);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+    uint16_t port = server_port(p_server);
+    pthread_t reactor;
+    CU_ASSERT_EQUAL(0, pthread_create(&reactor, NULL, run_reactor, p_server));
+
+    atomic_store(&g_handled, 0);
+    pthread_t clients[EXCHANGE_CLIENTS];
+    for (size_t i = 0; i < EXCHANGE_CLIENTS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(clients + i, NULL, run_client, &port));
+    }
+    size_t errors = 0;
+    for (size_t i = 0; i < EXCHANGE_CLIENTS; ++i)
+    {
+        void * p_errors = NULL;
+        pthread_join(clients[i], &p_errors);
+        errors += (size_t) p_errors;
+    }
+    printf("errors: %zu, handled: %zu\n", errors, atomic_load(&g_handled));
+    CU_ASSERT_EQUAL(0, errors);
+
+    // Let the server reap the closed connections, then fill it up. Each
+    // connection makes a round trip so it is known to be accepted.
+    usleep(100000);
+    int fds[EXCHANGE_CLIENTS + 1];
+    unsigned char request[SERVER_REQ_SIZE];
+    unsigned char response[SERVER_RESP_SIZE];
+    fill_request(request, 0);
+    for (size_t i = 0; i < EXCHANGE_CLIENTS; ++i)
+    {
+        fds[i] = connect_to(port);
+        CU_ASSERT_NOT_EQUAL(-1, fds[i]);
+        CU_ASSERT_EQUAL(SERVER_REQ_SIZE, send(fds[i], request, SERVER_REQ_SIZE, 0));
+        CU_ASSERT_EQUAL(SERVER_RESP_SIZE, read_all(fds[i], response, SERVER_RESP_SIZE));
+    }
+
+    // Test a connection beyond the limit is closed at once, and a
+    // partial frame is never handled.
+    fds[EXCHANGE_CLIENTS] = connect_to(port);
+    CU_ASSERT_NOT_EQUAL(-1, fds[EXCHANGE_CLIENTS]);
+    CU_ASSERT_EQUAL(0, read_all(fds[EXCHANGE_CLIENTS], response, 1));
+    CU_ASSERT_EQUAL(SERVER_REQ_SIZE - 1, send(fds[0], request, SERVER_REQ_SIZE - 1, 0));
+
+    // Test a complete frame sent right before the client shuts down its
+    // side is still answered.
+    CU_ASSERT_EQUAL(SERVER_REQ_SIZE, send(fds[1], request, SERVER_REQ_SIZE, 0));
+    shutdown(fds[1], SHUT_WR);
+    CU_ASSERT_EQUAL(SERVER_RESP_SIZE, read_all(fds[1], response, SERVER_RESP_SIZE));
+    CU_ASSERT_EQUAL(0, read_all(fds[1], response, 1));
+    CU_ASSERT_EQUAL((((EXCHANGE_FRAMES + 2) / 3) * 3 * EXCHANGE_CLIENTS) + EXCHANGE_CLIENTS + 1,
+                    atomic_load(&g_handled));
+
+    // Test the server stops and is destroyed with connections open.
+    server_stop(p_server);
+    pthread_join(reactor, NULL);
+    server_destroy(p_server);
+    for (size_t i = 0; i <= EXCHANGE_CLIENTS; ++i)
+    {
+        close(fds[i]);
+    }
+}
+
+/*!
+ * @brief This function tests request framing and responses over several
+ *          concurrent connections, with the epoll backend.
+ */
+void
+test_server_exchange (void)
+{
+    run_exchange(SERVER_BACKEND_EPOLL);
+}
+
+/*!
+ * @brief This function tests request framing and responses over several
+ *          concurrent connections, with the io_uring backend.
+ */
+void
+test_server_exchange_uring (void)
+{
+    run_exchange(SERVER_BACKEND_URING);
+}
+
+/*!
+ * @brief Pipelining test parameters.
+ */
+#define PIPELINE_CLIENTS 4
+#define PIPELINE_ROUNDS 4
+#define PIPELINE_FRAMES 64
+#define PIPELINE_INFLIGHT 8
+
+/*!
+ * @brief This function sends many frames at once on one connection, more
+ *          than may be in flight, and checks the responses come back in
+ *          request order.
+ */
+static void *
+run_pipeline_client (void * vp_port)
+{
+    size_t errors = 0;
+    int fd = connect_to(*(uint16_t *) vp_port);
+    if (-1 == fd)
+    {
+        return (void *) 1;
+    }
+
+    unsigned char request[SERVER_REQ_SIZE * PIPELINE_FRAMES];
+    unsigned char response[SERVER_RESP_SIZE];
+    for (size_t round = 0; round < PIPELINE_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < PIPELINE_FRAMES; ++i)
+        {
+            fill_request(request + (i * SERVER_REQ_SIZE), (round * PIPELINE_FRAMES) + i);
+        }
+        size_t len = SERVER_REQ_SIZE * PIPELINE_FRAMES;
+        if ((ssize_t) len != send(fd, request, len, 0))
+        {
+            errors++;
+        }
+        for (size_t i = 0; i < PIPELINE_FRAMES; ++i)
+        {
+            if ((sizeof(response) != read_all(fd, response, sizeof(response))) ||
+                (0 != memcmp(response, request + (i * SERVER_REQ_SIZE), sizeof(response))))
+            {
+                errors++;
+            }
+        }
+    }
+
+    close(fd);
+    return (void *) errors;
+}
+
+/*!
+ * @brief This function runs the pipelining test against a server with
+ *          the given backend and reactors, and checks the reactors'
+ *          statistics add up to the traffic.
+ */
+static void
+run_pipeline (const server_backend_t backend, const size_t num_reactors, const bool b_pinned)
+{
+    server_attr_t attr;
+    CU_ASSERT_EQUAL(0, server_attr_init(&attr));
+    attr.port = 0;
+    attr.num_workers = 4;
+    // SO_REUSEPORT spreads connections by hash, so any reactor may get
+    // every client.
+    attr.max_conns = PIPELINE_CLIENTS * num_reactors;
+    attr.max_inflight = PIPELINE_INFLIGHT;
+    attr.backend = backend;
+    attr.num_reactors = num_reactors;
+    attr.b_pinned = b_pinned;
+    int slow = 1;
+    server_t * p_server = server_create(&attr, echo_handler, &slow);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+    uint16_t port = server_port(p_server);
+    pthread_t reactor;
+    CU_ASSERT_EQUAL(0, pthread_create(&reactor, NULL, run_reactor, p_server));
+
+    // Test pinned reactors split the workers rather than each taking all.
+    if (true == b_pinned)
+    {
+        size_t num_threads = 0;
+        for (size_t i = 0; i < num_reactors; ++i)
+        {
+            threadpool_stats_t tp_stats;
+            CU_ASSERT_EQUAL(0, threadpool_stats_snapshot(p_server->p_reactors[i].p_tp,
+                                                         &tp_stats));
+            CU_ASSERT(tp_stats.num_threads >= 1);
+            num_threads += tp_stats.num_threads;
+        }
+        CU_ASSERT_EQUAL((num_reactors > attr.num_workers) ? num_reactors : attr.num_workers,
+                        num_threads);
+    }
+
+    atomic_store(&g_handled, 0);
+    pthread_t clients[PIPELINE_CLIENTS];
+    for (size_t i = 0; i < PIPELINE_CLIENTS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(clients + i, NULL, run_pipeline_client, &port));
+    }
+    size_t errors = 0;
+    for (size_t i = 0; i < PIPELINE_CLIENTS; ++i)
+    {
+        void * p_errors = NULL;
+        pthread_join(clients[i], &p_errors);
+        errors += (size_t) p_errors;
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(PIPELINE_CLIENTS * PIPELINE_ROUNDS * PIPELINE_FRAMES,
+                    atomic_load(&g_handled));
+
+    server_stop(p_server);
+    pthread_join(reactor, NULL);
+
+    // Test every connection, request and byte was counted by exactly one
+    // reactor.
+    CU_ASSERT_EQUAL(num_reactors, server_num_reactors(p_server));
+    server_stats_t total;
+    memset(&total, 0, sizeof(total));
+    for (size_t i = 0; i < num_reactors; ++i)
+    {
+        server_stats_t stats;
+        CU_ASSERT_EQUAL(0, server_reactor_stats(p_server, i, &stats));
+        printf("reactor %zu: %llu connections, %llu requests\n", i,
+               (unsigned long long) stats.accepted, (unsigned long long) stats.requests);
+        total.accepted += stats.accepted;
+        total.rejected += stats.rejected;
+        total.requests += stats.requests;
+        total.bytes_in += stats.bytes_in;
+        total.bytes_out += stats.bytes_out;
+    }
+    size_t frames = PIPELINE_CLIENTS * PIPELINE_ROUNDS * PIPELINE_FRAMES;
+    CU_ASSERT_EQUAL(PIPELINE_CLIENTS, total.accepted);
+    CU_ASSERT_EQUAL(0, total.rejected);
+    CU_ASSERT_EQUAL(frames, total.requests);
+    CU_ASSERT_EQUAL(frames * SERVER_REQ_SIZE, total.bytes_in);
+    CU_ASSERT_EQUAL(frames * SERVER_RESP_SIZE, total.bytes_out);
+    server_destroy(p_server);
+}
+
+/*!
+ * @brief This function tests pipelined requests are answered in order,
+ *          with the epoll backend.
+ */
+void
+test_server_pipeline (void)
+{
+    run_pipeline(SERVER_BACKEND_EPOLL, 1, false);
+}
+
+/*!
+ * @brief This function tests pipelined requests are answered in order,
+ *          with the io_uring backend.
+ */
+void
+test_server_pipeline_uring (void)
+{
+    run_pipeline(SERVER_BACKEND_URING, 1, false);
+}
+
+/*!
+ * @brief Multi-reactor test parameters.
+ */
+#define REACTORS_COUNT 4
+
+/*!
+ * @brief This function tests reactors sharing a port with SO_REUSEPORT
+ *          and a shared threadpool serve every connection.
+ */
+void
+test_server_reactors (void)
+{
+    run_pipeline(SERVER_BACKEND_EPOLL, REACTORS_COUNT, false);
+}
+
+/*!
+ * @brief This function tests pinned io_uring reactors, each with its own
+ *          threadpool shard, serve every connection.
+ */
+void
+test_server_reactors_pinned (void)
+{
+    run_pipeline(SERVER_BACKEND_URING, REACTORS_COUNT, true);
+}
+
+/*!
+ * @brief Shared-memory test parameters.
+ */
+#define SHM_CLIENTS 3
+#define SHM_DEPTH 8
+#define SHM_FRAMES 2000
+
+static char g_shm_name[32];
+
+/*!
+ * @brief This function sends frames over the shared-memory segment with
+ *          a full window in flight, and checks every response echoes its
+ *          own request.
+ */
+static void *
+run_shm_client (void * p_arg)
+{
+    (void) p_arg;
+    size_t errors = 0;
+    unsigned char request[SERVER_REQ_SIZE];
+    unsigned char response[SERVER_RESP_SIZE];
+    unsigned char expected[SERVER_REQ_SIZE];
+    shm_t * p_shm = shm_attach(g_shm_name);
+    if (NULL == p_shm)
+    {
+        return (void *) 1;
+    }
+
+    size_t num_sent = 0;
+    size_t num_recv = 0;
+    while (num_recv < SHM_FRAMES)
+    {
+        while ((num_sent < SHM_FRAMES) &&
+               ((num_sent - num_recv) < SHM_DEPTH))
+        {
+            fill_request(request, num_sent);
+            if (0 != shm_send(p_shm, request))
+            {
+                errors++;
+            }
+            num_sent++;
+        }
+        fill_request(expected, num_recv);
+        if ((0 != shm_recv(p_shm, response, true)) ||
+            (0 != memcmp(expected, response, SERVER_RESP_SIZE)))
+        {
+            errors++;
+            break;
+        }
+        num_recv++;
+    }
+
+    shm_detach(p_shm);
+    return (void *) errors;
+}
+
+/*!
+ * @brief This function tests local clients over the shared-memory
+ *          segment are served alongside a TCP client, with responses
+ *          finishing out of order.
+ */
+void
+test_server_shm (void)
+{
+    snprintf(g_shm_name, sizeof(g_shm_name), "/bank_test_server_%d", (int) getpid());
+    server_attr_t attr;
+    CU_ASSERT_EQUAL(0, server_attr_init(&attr));
+    CU_ASSERT_PTR_NULL(attr.p_shm_name);
+    attr.port = 0;
+    attr.num_workers = 4;
+    attr.max_inflight = PIPELINE_INFLIGHT;
+    attr.p_shm_name = g_shm_name;
+    attr.shm_channels = SHM_CLIENTS;
+    attr.shm_depth = SHM_DEPTH;
+    int slow = 1;
+    server_t * p_server = server_create(&attr, echo_handler, &slow);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+    uint16_t port = server_port(p_server);
+    pthread_t reactor;
+    CU_ASSERT_EQUAL(0, pthread_create(&reactor, NULL, run_reactor, p_server));
+
+    atomic_store(&g_handled, 0);
+    pthread_t tcp_client;
+    pthread_t clients[SHM_CLIENTS];
+    CU_ASSERT_EQUAL(0, pthread_create(&tcp_client, NULL, run_pipeline_client, &port));
+    for (size_t i = 0; i < SHM_CLIENTS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(clients + i, NULL, run_shm_client, NULL));
+    }
+    size_t errors = 0;
+    for (size_t i = 0; i < SHM_CLIENTS; ++i)
+    {
+        void * p_errors = NULL;
+        pthread_join(clients[i], &p_errors);
+        errors += (size_t) p_errors;
+    }
+    void * p_errors = NULL;
+    pthread_join(tcp_client, &p_errors);
+    errors += (size_t) p_errors;
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL((SHM_CLIENTS * SHM_FRAMES) + (PIPELINE_ROUNDS * PIPELINE_FRAMES),
+                    atomic_load(&g_handled));
+
+    // Test every channel was given back, and the segment goes with the
+    // server.
+    shm_t * p_shms[SHM_CLIENTS];
+    for (size_t i = 0; i < SHM_CLIENTS; ++i)
+    {
+        p_shms[i] = shm_attach(g_shm_name);
+        CU_ASSERT_PTR_NOT_NULL(p_shms[i]);
+    }
+    for (size_t i = 0; i < SHM_CLIENTS; ++i)
+    {
+        shm_detach(p_shms[i]);
+    }
+    server_stop(p_server);
+    pthread_join(reactor, NULL);
+    server_destroy(p_server);
+    CU_ASSERT_PTR_NULL(shm_attach(g_shm_name));
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"server create test", test_server_create},
+        {"server exchange test", test_server_exchange},
+        {"server io_uring exchange test", test_server_exchange_uring},
+        {"server pipeline test", test_server_pipeline},
+        {"server io_uring pipeline test", test_server_pipeline_uring},
+        {"server reactors test", test_server_reactors},
+        {"server pinned reactors test", test_server_reactors_pinned},
+        {"server shared memory test", test_server_shm},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"server test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
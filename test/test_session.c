@@ -0,0 +1,297 @@
+/*!
+ * @file test_session.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          session table implemented in source/server/session.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../source/server/session.h"
+
+/*!
+ * @brief This function tests opening, looking up and closing sessions.
+ */
+void
+test_session_basic (void)
+{
+    uint32_t sid = 0;
+    uint32_t user = 0;
+
+    // Test bad parameters.
+    CU_ASSERT_PTR_NULL(session_create(0));
+    CU_ASSERT_PTR_NULL(session_create(SESSION_MAX_CAPACITY + 1));
+    CU_ASSERT_EQUAL(-1, session_open(NULL, 1, &sid));
+    CU_ASSERT_EQUAL(-1, session_lookup(NULL, 1, &user));
+    CU_ASSERT_EQUAL(-1, session_close(NULL, 1));
+    CU_ASSERT_EQUAL(0, session_expire(NULL, 0));
+    CU_ASSERT_EQUAL(0, session_count(NULL));
+    session_tick(NULL, 1);
+    session_destroy(NULL);
+
+    session_table_t * p_table = session_create(4);
+    CU_ASSERT_PTR_NOT_NULL(p_table);
+    if (NULL == p_table)
+    {
+        return;
+    }
+    CU_ASSERT_EQUAL(-1, session_open(p_table, 1, NULL));
+
+    // Test every slot can be used, and no more.
+    uint32_t sids[4];
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        CU_ASSERT_EQUAL(0, session_open(p_table, 100 + i, sids + i));
+        CU_ASSERT_NOT_EQUAL(0, sids[i]);
+    }
+    CU_ASSERT_EQUAL(-1, session_open(p_table, 200, &sid));
+    CU_ASSERT_EQUAL(4, session_count(p_table));
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        CU_ASSERT_EQUAL(0, session_lookup(p_table, sids[i], &user));
+        CU_ASSERT_EQUAL(100 + i, user);
+    }
+    CU_ASSERT_EQUAL(0, session_lookup(p_table, sids[0], NULL));
+
+    // Test ids that were never handed out are rejected.
+    CU_ASSERT_EQUAL(-1, session_lookup(p_table, 0, &user));
+    CU_ASSERT_EQUAL(-1, session_lookup(p_table, sids[0] + (1u << SESSION_INDEX_BITS), &user));
+    CU_ASSERT_EQUAL(-1, session_lookup(p_table, (sids[0] & ~0xFFFFu) | 4, &user));
+    CU_ASSERT_EQUAL(-1, session_close(p_table, 0));
+
+    // Test a closed session's id is rejected, even once its slot is
+    // reused.
+    CU_ASSERT_EQUAL(0, session_close(p_table, sids[1]));
+    CU_ASSERT_EQUAL(-1, session_close(p_table, sids[1]));
+    CU_ASSERT_EQUAL(-1, session_lookup(p_table, sids[1], &user));
+    CU_ASSERT_EQUAL(3, session_count(p_table));
+    CU_ASSERT_EQUAL(0, session_open(p_table, 300, &sid));
+    CU_ASSERT_NOT_EQUAL(sids[1], sid);
+    CU_ASSERT_EQUAL(-1, session_lookup(p_table, sids[1], &user));
+    CU_ASSERT_EQUAL(-1, session_close(p_table, sids[1]));
+    CU_ASSERT_EQUAL(0, session_lookup(p_table, sid, &user));
+    CU_ASSERT_EQUAL(300, user);
+
+    session_destroy(p_table);
+}
+
+/*!
+ * @brief This function tests a slot reused more times than there are
+ *          generations never hands out 0, nor the id it just closed.
+ */
+void
+test_session_generations (void)
+{
+    session_table_t * p_table = session_create(1);
+    CU_ASSERT_PTR_NOT_NULL(p_table);
+    if (NULL == p_table)
+    {
+        return;
+    }
+
+    size_t errors = 0;
+    uint32_t prev = 0;
+    for (size_t i = 0; i < (2 * (UINT32_MAX >> SESSION_INDEX_BITS)) + 10; ++i)
+    {
+        uint32_t sid = 0;
+        if ((0 != session_open(p_table, 1, &sid)) ||
+            (0 == sid) ||
+            (prev == sid) ||
+            (0 != session_close(p_table, sid)) ||
+            (-1 != session_lookup(p_table, sid, NULL)))
+        {
+            errors++;
+        }
+        prev = sid;
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(0, session_count(p_table));
+
+    session_destroy(p_table);
+}
+
+/*!
+ * @brief This function tests idle sessions expire, and lookups keep a
+ *          session alive.
+ */
+void
+test_session_expire (void)
+{
+    session_table_t * p_table = session_create(8);
+    CU_ASSERT_PTR_NOT_NULL(p_table);
+    if (NULL == p_table)
+    {
+        return;
+    }
+
+    uint32_t idle = 0;
+    uint32_t busy = 0;
+    uint32_t late = 0;
+    session_tick(p_table, 10);
+    CU_ASSERT_EQUAL(0, session_open(p_table, 1, &idle));
+    CU_ASSERT_EQUAL(0, session_open(p_table, 2, &busy));
+    session_tick(p_table, 20);
+    CU_ASSERT_EQUAL(0, session_open(p_table, 3, &late));
+
+    // Test nothing expires within the idle limit.
+    session_tick(p_table, 40);
+    CU_ASSERT_EQUAL(0, session_lookup(p_table, busy, NULL));
+    CU_ASSERT_EQUAL(0, session_expire(p_table, 30));
+    CU_ASSERT_EQUAL(3, session_count(p_table));
+
+    // Test only the session idle past the limit expires.
+    session_tick(p_table, 45);
+    CU_ASSERT_EQUAL(1, session_expire(p_table, 30));
+    CU_ASSERT_EQUAL(-1, session_lookup(p_table, idle, NULL));
+    CU_ASSERT_EQUAL(0, session_lookup(p_table, late, NULL));
+    CU_ASSERT_EQUAL(2, session_count(p_table));
+
+    // Test the lookup above kept the late session alive.
+    session_tick(p_table, 75);
+    CU_ASSERT_EQUAL(1, session_expire(p_table, 30));
+    CU_ASSERT_EQUAL(-1, session_lookup(p_table, busy, NULL));
+    CU_ASSERT_EQUAL(0, session_lookup(p_table, late, NULL));
+    CU_ASSERT_EQUAL(1, session_count(p_table));
+
+    // Test a session used at the current tick is never idle.
+    CU_ASSERT_EQUAL(0, session_expire(p_table, 0));
+    session_tick(p_table, 76);
+    CU_ASSERT_EQUAL(1, session_expire(p_table, 0));
+    CU_ASSERT_EQUAL(0, session_count(p_table));
+
+    session_destroy(p_table);
+}
+
+/*!
+ * @brief Concurrency test parameters.
+ */
+#define CONC_THREADS 4
+#define CONC_CAPACITY 2
+#define CONC_ROUNDS 50000
+
+static session_table_t * gp_conc_table = NULL;
+
+/*!
+ * @brief This function opens, checks and closes sessions in a loop,
+ *          checking its own sessions always map to it and its closed
+ *          ones are always rejected.
+ */
+static void *
+conc_worker (void * p_arg)
+{
+    uint32_t me = (uint32_t) (uintptr_t) p_arg;
+    size_t errors = 0;
+    for (size_t round = 0; round < CONC_ROUNDS; ++round)
+    {
+        uint32_t sid = 0;
+        uint32_t user = 0;
+        if (0 != session_open(gp_conc_table, me, &sid))
+        {
+            continue;
+        }
+        if ((0 != session_lookup(gp_conc_table, sid, &user)) ||
+            (me != user))
+        {
+            errors++;
+        }
+        if ((0 != session_close(gp_conc_table, sid)) ||
+            (-1 != session_lookup(gp_conc_table, sid, &user)) ||
+            (-1 != session_close(gp_conc_table, sid)))
+        {
+            errors++;
+        }
+    }
+    return (void *) errors;
+}
+
+/*!
+ * @brief This function tests threads sharing a table that is smaller
+ *          than their demand, so slots are reused constantly.
+ */
+void
+test_session_concurrent (void)
+{
+    gp_conc_table = session_create(CONC_CAPACITY);
+    CU_ASSERT_PTR_NOT_NULL(gp_conc_table);
+    if (NULL == gp_conc_table)
+    {
+        return;
+    }
+
+    pthread_t threads[CONC_THREADS];
+    for (size_t i = 0; i < CONC_THREADS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(threads + i, NULL, conc_worker, (void *) (i + 1)));
+    }
+    size_t errors = 0;
+    for (size_t i = 0; i < CONC_THREADS; ++i)
+    {
+        void * p_errors = NULL;
+        pthread_join(threads[i], &p_errors);
+        errors += (size_t) p_errors;
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(0, session_count(gp_conc_table));
+
+    // Test no slot was lost from the free stack.
+    uint32_t sid = 0;
+    for (size_t i = 0; i < CONC_CAPACITY; ++i)
+    {
+        CU_ASSERT_EQUAL(0, session_open(gp_conc_table, 0, &sid));
+    }
+    CU_ASSERT_EQUAL(-1, session_open(gp_conc_table, 0, &sid));
+
+    session_destroy(gp_conc_table);
+    gp_conc_table = NULL;
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"session basic test", test_session_basic},
+        {"session generations test", test_session_generations},
+        {"session expire test", test_session_expire},
+        {"session concurrent test", test_session_concurrent},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"session test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
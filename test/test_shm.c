@@ -0,0 +1,541 @@
+/*!
+ * @file test_shm.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          shared-memory transport implemented in source/common/shm.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../source/common/shm.h"
+
+/*!
+ * @brief The size of a segment name used by the tests.
+ */
+#define NAME_SIZE 32
+
+/*!
+ * @brief This function names a segment after the test process, so runs
+ *          in parallel do not collide.
+ */
+static void
+make_name (char * p_name)
+{
+    snprintf(p_name, NAME_SIZE, "/bank_test_shm_%d", (int) getpid());
+}
+
+/*!
+ * @brief This function encodes a request carrying a session id.
+ */
+static void
+make_request (unsigned char * p_request, const uint32_t sid)
+{
+    (void) msg_request_encode((msg_request_t *) p_request, MSG_OP_ACCOUNT_BALANCE, sid,
+                              NULL, NULL, 0);
+}
+
+/*!
+ * @brief This function answers a request with its session id, doubled,
+ *          as the amount.
+ */
+static void
+answer (const shm_req_t * p_req)
+{
+    uint32_t sid = msg_request_sid((const msg_request_t *) p_req->p_request);
+    (void) msg_response_encode((msg_response_t *) p_req->p_response, MSG_CODE_SUCCESS, sid,
+                               2 * (uint64_t) sid);
+}
+
+/*!
+ * @brief This function tests a single request's round trip and bad
+ *          parameters.
+ */
+void
+test_shm_basic (void)
+{
+    char name[NAME_SIZE];
+    make_name(name);
+    unsigned char request[MSG_REQ_SIZE];
+    unsigned char response[MSG_RESP_SIZE];
+    shm_req_t reqs[4];
+
+    // Test bad parameters.
+    CU_ASSERT_PTR_NULL(shm_create(NULL, 1, 1));
+    CU_ASSERT_PTR_NULL(shm_create("no_slash", 1, 1));
+    CU_ASSERT_PTR_NULL(shm_create(name, 0, 1));
+    CU_ASSERT_PTR_NULL(shm_create(name, SHM_MAX_CHANNELS + 1, 1));
+    CU_ASSERT_PTR_NULL(shm_create(name, 1, 0));
+    CU_ASSERT_PTR_NULL(shm_create(name, 1, 3));
+    CU_ASSERT_PTR_NULL(shm_create(name, 1, SHM_MAX_DEPTH * 2));
+    CU_ASSERT_PTR_NULL(shm_attach(name));
+    CU_ASSERT_EQUAL(0, shm_poll(NULL, reqs, 4));
+    CU_ASSERT_EQUAL(-1, shm_respond(NULL, reqs));
+    CU_ASSERT_EQUAL(-1, shm_wait(NULL));
+    CU_ASSERT_EQUAL(-1, shm_send(NULL, request));
+    CU_ASSERT_EQUAL(-1, shm_recv(NULL, response, false));
+    CU_ASSERT_EQUAL(0, shm_depth(NULL));
+    shm_wake(NULL);
+    shm_detach(NULL);
+    shm_destroy(NULL);
+
+    shm_t * p_server = shm_create(name, 2, 4);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+    CU_ASSERT_EQUAL(4, shm_depth(p_server));
+    shm_t * p_client = shm_attach(name);
+    CU_ASSERT_PTR_NOT_NULL(p_client);
+    if (NULL == p_client)
+    {
+        shm_destroy(p_server);
+        return;
+    }
+
+    // Test each side refuses the other side's calls.
+    make_request(request, 7);
+    CU_ASSERT_EQUAL(-1, shm_send(p_server, request));
+    CU_ASSERT_EQUAL(0, shm_poll(p_client, reqs, 4));
+
+    // Test nothing is waiting until a request is sent.
+    CU_ASSERT_EQUAL(0, shm_poll(p_server, reqs, 4));
+    CU_ASSERT_EQUAL(-1, shm_recv(p_client, response, true));
+    CU_ASSERT_EQUAL(0, shm_send(p_client, request));
+    CU_ASSERT_EQUAL(0, shm_wait(p_server));
+    CU_ASSERT_EQUAL(1, shm_poll(p_server, reqs, 4));
+    CU_ASSERT_EQUAL(0, shm_poll(p_server, reqs + 1, 3));
+    CU_ASSERT_EQUAL(0, memcmp(request, reqs[0].p_request, MSG_REQ_SIZE));
+
+    // Test the response is only read once published.
+    CU_ASSERT_EQUAL(-1, shm_recv(p_client, response, false));
+    answer(reqs);
+    CU_ASSERT_EQUAL(0, shm_respond(p_server, reqs));
+    CU_ASSERT_EQUAL(0, shm_recv(p_client, response, false));
+    CU_ASSERT_EQUAL(MSG_CODE_SUCCESS, response[0]);
+    CU_ASSERT_EQUAL(7, msg_response_sid((msg_response_t *) response));
+    CU_ASSERT_EQUAL(14, msg_response_amount((msg_response_t *) response));
+    CU_ASSERT_EQUAL(-1, shm_recv(p_client, response, false));
+
+    shm_detach(p_client);
+    shm_destroy(p_server);
+    CU_ASSERT_PTR_NULL(shm_attach(name));
+}
+
+/*!
+ * @brief This function tests a full channel refuses requests, and
+ *          responses finished out of order are read in order.
+ */
+void
+test_shm_window (void)
+{
+    char name[NAME_SIZE];
+    make_name(name);
+    unsigned char request[MSG_REQ_SIZE];
+    unsigned char response[MSG_RESP_SIZE];
+    shm_req_t reqs[8];
+
+    shm_t * p_server = shm_create(name, 1, 4);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+    shm_t * p_client = shm_attach(name);
+    CU_ASSERT_PTR_NOT_NULL(p_client);
+    if (NULL == p_client)
+    {
+        shm_destroy(p_server);
+        return;
+    }
+
+    for (uint32_t round = 0; round < 3; ++round)
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            make_request(request, (round * 4) + i + 1);
+            CU_ASSERT_EQUAL(0, shm_send(p_client, request));
+        }
+        CU_ASSERT_EQUAL(-1, shm_send(p_client, request));
+        CU_ASSERT_EQUAL(4, shm_poll(p_server, reqs, 8));
+
+        // Test a response finished early waits behind the oldest.
+        for (size_t i = 4; i > 1; --i)
+        {
+            answer(reqs + i - 1);
+            CU_ASSERT_EQUAL(0, shm_respond(p_server, reqs + i - 1));
+        }
+        CU_ASSERT_EQUAL(-1, shm_recv(p_client, response, false));
+        answer(reqs);
+        CU_ASSERT_EQUAL(0, shm_respond(p_server, reqs));
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            CU_ASSERT_EQUAL(0, shm_recv(p_client, response, false));
+            CU_ASSERT_EQUAL((round * 4) + i + 1, msg_response_sid((msg_response_t *) response));
+        }
+    }
+
+    shm_detach(p_client);
+    shm_destroy(p_server);
+}
+
+/*!
+ * @brief This function tests every channel can be claimed, and no more,
+ *          and a detached client's channel is free again.
+ */
+void
+test_shm_channels (void)
+{
+    char name[NAME_SIZE];
+    make_name(name);
+    unsigned char request[MSG_REQ_SIZE];
+    unsigned char response[MSG_RESP_SIZE];
+    shm_req_t reqs[4];
+
+    shm_t * p_server = shm_create(name, 3, 2);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+
+    shm_t * p_clients[3];
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        p_clients[i] = shm_attach(name);
+        CU_ASSERT_PTR_NOT_NULL(p_clients[i]);
+        make_request(request, i + 1);
+        CU_ASSERT_EQUAL(0, shm_send(p_clients[i], request));
+    }
+    CU_ASSERT_PTR_NULL(shm_attach(name));
+
+    // Test every channel is polled, and responses reach their own client.
+    CU_ASSERT_EQUAL(3, shm_poll(p_server, reqs, 4));
+    for (size_t i = 0; i < 3; ++i)
+    {
+        answer(reqs + i);
+        CU_ASSERT_EQUAL(0, shm_respond(p_server, reqs + i));
+    }
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        CU_ASSERT_EQUAL(0, shm_recv(p_clients[i], response, false));
+        CU_ASSERT_EQUAL(i + 1, msg_response_sid((msg_response_t *) response));
+    }
+
+    shm_detach(p_clients[1]);
+    p_clients[1] = shm_attach(name);
+    CU_ASSERT_PTR_NOT_NULL(p_clients[1]);
+    CU_ASSERT_PTR_NULL(shm_attach(name));
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        shm_detach(p_clients[i]);
+    }
+    shm_destroy(p_server);
+}
+
+/*!
+ * @brief This function tests a client running more than depth requests
+ *          ahead, or reusing a slot still in flight, gets its channel
+ *          marked broken without disturbing the others.
+ */
+void
+test_shm_broken (void)
+{
+    char name[NAME_SIZE];
+    make_name(name);
+    unsigned char request[MSG_REQ_SIZE];
+    unsigned char response[MSG_RESP_SIZE];
+    shm_req_t reqs[16];
+
+    shm_t * p_server = shm_create(name, 3, 4);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+    shm_t * p_ahead = shm_attach(name);
+    shm_t * p_reuse = shm_attach(name);
+    shm_t * p_good = shm_attach(name);
+    CU_ASSERT_PTR_NOT_NULL(p_ahead);
+    CU_ASSERT_PTR_NOT_NULL(p_reuse);
+    CU_ASSERT_PTR_NOT_NULL(p_good);
+    if ((NULL == p_ahead) ||
+        (NULL == p_reuse) ||
+        (NULL == p_good))
+    {
+        shm_destroy(p_server);
+        return;
+    }
+    shm_channel_t * p_ahead_channel = p_ahead->p_channels + p_ahead->channel;
+    shm_channel_t * p_reuse_channel = p_reuse->p_channels + p_reuse->channel;
+
+    // Test a tail more than depth past the head takes nothing.
+    atomic_store(&(p_ahead_channel->req_tail), 5);
+    make_request(request, 7);
+    CU_ASSERT_EQUAL(0, shm_send(p_good, request));
+    CU_ASSERT_EQUAL(1, shm_poll(p_server, reqs, 16));
+    CU_ASSERT_EQUAL(p_good->channel, reqs[0].channel);
+    CU_ASSERT_EQUAL(1, atomic_load(&(p_ahead_channel->b_broken)));
+    CU_ASSERT_EQUAL(-1, shm_send(p_ahead, request));
+    CU_ASSERT_EQUAL(EPIPE, errno);
+    CU_ASSERT_EQUAL(-1, shm_recv(p_ahead, response, true));
+    CU_ASSERT_EQUAL(EPIPE, errno);
+    answer(reqs);
+    CU_ASSERT_EQUAL(0, shm_respond(p_server, reqs));
+    CU_ASSERT_EQUAL(0, shm_recv(p_good, response, false));
+
+    // Test a slot reused before its response was sent is not taken again.
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        make_request(request, i + 1);
+        CU_ASSERT_EQUAL(0, shm_send(p_reuse, request));
+    }
+    CU_ASSERT_EQUAL(4, shm_poll(p_server, reqs, 16));
+    atomic_fetch_add(&(p_reuse_channel->resp_head), 1);
+    CU_ASSERT_EQUAL(0, shm_send(p_reuse, request));
+    CU_ASSERT_EQUAL(0, shm_poll(p_server, reqs + 4, 12));
+    CU_ASSERT_EQUAL(1, atomic_load(&(p_reuse_channel->b_broken)));
+    for (size_t i = 0; i < 4; ++i)
+    {
+        CU_ASSERT_EQUAL(0, shm_respond(p_server, reqs + i));
+    }
+
+    // Test broken channels are not handed out again, and the good one is.
+    shm_detach(p_ahead);
+    shm_detach(p_reuse);
+    shm_detach(p_good);
+    p_good = shm_attach(name);
+    CU_ASSERT_PTR_NOT_NULL(p_good);
+    CU_ASSERT_PTR_NULL(shm_attach(name));
+    shm_detach(p_good);
+    shm_destroy(p_server);
+}
+
+/*!
+ * @brief Concurrency test parameters.
+ */
+#define CONC_CLIENTS 3
+#define CONC_DEPTH 8
+#define CONC_REQUESTS 20000
+
+static shm_t * gp_conc_server = NULL;
+static _Atomic bool gb_conc_stop = false;
+static char g_conc_name[NAME_SIZE];
+
+/*!
+ * @brief This function serves requests until told to stop, sleeping
+ *          whenever there are none.
+ */
+static void *
+conc_server (void * p_arg)
+{
+    (void) p_arg;
+    shm_req_t reqs[CONC_DEPTH];
+    while (false == atomic_load(&gb_conc_stop))
+    {
+        size_t num_reqs = shm_poll(gp_conc_server, reqs, CONC_DEPTH);
+        if (0 == num_reqs)
+        {
+            (void) shm_wait(gp_conc_server);
+            continue;
+        }
+        for (size_t i = 0; i < num_reqs; ++i)
+        {
+            answer(reqs + i);
+            (void) shm_respond(gp_conc_server, reqs + i);
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief This function sends requests with a full window in flight,
+ *          checking every response answers its own request.
+ */
+static void *
+conc_client (void * p_arg)
+{
+    (void) p_arg;
+    size_t errors = 0;
+    unsigned char request[MSG_REQ_SIZE];
+    unsigned char response[MSG_RESP_SIZE];
+    shm_t * p_client = shm_attach(g_conc_name);
+    if (NULL == p_client)
+    {
+        return (void *) 1;
+    }
+
+    uint32_t num_sent = 0;
+    uint32_t num_recv = 0;
+    while (num_recv < CONC_REQUESTS)
+    {
+        while ((num_sent < CONC_REQUESTS) &&
+               ((num_sent - num_recv) < CONC_DEPTH))
+        {
+            make_request(request, num_sent + 1);
+            if (0 != shm_send(p_client, request))
+            {
+                errors++;
+            }
+            num_sent++;
+        }
+        if ((0 != shm_recv(p_client, response, true)) ||
+            ((num_recv + 1) != msg_response_sid((msg_response_t *) response)) ||
+            ((2 * (uint64_t) (num_recv + 1)) != msg_response_amount((msg_response_t *) response)))
+        {
+            errors++;
+            break;
+        }
+        num_recv++;
+    }
+
+    shm_detach(p_client);
+    return (void *) errors;
+}
+
+/*!
+ * @brief This function tests clients and a server on their own threads,
+ *          each side sleeping on its doorbell while the other is busy.
+ */
+void
+test_shm_concurrent (void)
+{
+    make_name(g_conc_name);
+    atomic_store(&gb_conc_stop, false);
+    gp_conc_server = shm_create(g_conc_name, CONC_CLIENTS, CONC_DEPTH);
+    CU_ASSERT_PTR_NOT_NULL(gp_conc_server);
+    if (NULL == gp_conc_server)
+    {
+        return;
+    }
+
+    pthread_t server;
+    pthread_t clients[CONC_CLIENTS];
+    CU_ASSERT_EQUAL(0, pthread_create(&server, NULL, conc_server, NULL));
+    for (size_t i = 0; i < CONC_CLIENTS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(clients + i, NULL, conc_client, NULL));
+    }
+    size_t errors = 0;
+    for (size_t i = 0; i < CONC_CLIENTS; ++i)
+    {
+        void * p_errors = NULL;
+        pthread_join(clients[i], &p_errors);
+        errors += (size_t) p_errors;
+    }
+    CU_ASSERT_EQUAL(0, errors);
+
+    // Test the wake-up reaches the server however it is timed.
+    atomic_store(&gb_conc_stop, true);
+    shm_wake(gp_conc_server);
+    pthread_join(server, NULL);
+
+    shm_destroy(gp_conc_server);
+    gp_conc_server = NULL;
+}
+
+/*!
+ * @brief This function waits for a response that never comes.
+ */
+static void *
+orphan_client (void * p_arg)
+{
+    unsigned char response[MSG_RESP_SIZE];
+    return (void *) (intptr_t) shm_recv(p_arg, response, true);
+}
+
+/*!
+ * @brief This function tests a client waiting on a response is woken,
+ *          and fails, when the server goes away.
+ */
+void
+test_shm_destroy (void)
+{
+    char name[NAME_SIZE];
+    make_name(name);
+    unsigned char request[MSG_REQ_SIZE];
+    shm_req_t req;
+
+    shm_t * p_server = shm_create(name, 1, 2);
+    CU_ASSERT_PTR_NOT_NULL(p_server);
+    if (NULL == p_server)
+    {
+        return;
+    }
+    shm_t * p_client = shm_attach(name);
+    CU_ASSERT_PTR_NOT_NULL(p_client);
+    if (NULL == p_client)
+    {
+        shm_destroy(p_server);
+        return;
+    }
+    make_request(request, 1);
+    CU_ASSERT_EQUAL(0, shm_send(p_client, request));
+    CU_ASSERT_EQUAL(1, shm_poll(p_server, &req, 1));
+
+    pthread_t client;
+    CU_ASSERT_EQUAL(0, pthread_create(&client, NULL, orphan_client, p_client));
+    usleep(20000);
+    shm_destroy(p_server);
+    void * p_status = NULL;
+    pthread_join(client, &p_status);
+    CU_ASSERT_EQUAL(-1, (int) (intptr_t) p_status);
+
+    shm_detach(p_client);
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"shm basic test", test_shm_basic},
+        {"shm window test", test_shm_window},
+        {"shm channels test", test_shm_channels},
+        {"shm broken test", test_shm_broken},
+        {"shm concurrent test", test_shm_concurrent},
+        {"shm destroy test", test_shm_destroy},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"shm test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
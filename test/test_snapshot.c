@@ -0,0 +1,802 @@
+/*!
+ * @file test_snapshot.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          snapshots implemented in source/server/snapshot.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "../source/server/snapshot.h"
+#include "../source/server/journal.h"
+
+/*!
+ * @brief The size of a directory or file path.
+ */
+#define PATH_SIZE 128
+
+/*!
+ * @brief The number of threads changing the tables while snapshots are
+ *          taken, and the number of changes each makes.
+ */
+#define RECOVERY_THREADS 4
+#define RECOVERY_OPS 4000
+
+/*!
+ * @brief The number of users the recovery threads share.
+ */
+#define RECOVERY_USERS 64
+
+/*!
+ * @brief The number of users the restart benchmark restores.
+ */
+#define RESTART_USERS 100000
+
+/*!
+ * @brief The number of users the restart benchmark registers after its
+ *          snapshot, and the size of its log segments.
+ */
+#define RESTART_LATE_USERS 10
+#define RESTART_SEGMENT_SIZE (1024 * 1024)
+
+/*!
+ * @brief This is a helper function that removes a directory and the
+ *          files in it.
+ */
+static void
+remove_dir (const char * p_dir)
+{
+    DIR * p_handle = opendir(p_dir);
+    if (NULL == p_handle)
+    {
+        return;
+    }
+    struct dirent * p_entry = NULL;
+    while (NULL != (p_entry = readdir(p_handle)))
+    {
+        if ('.' != p_entry->d_name[0])
+        {
+            unlinkat(dirfd(p_handle), p_entry->d_name, 0);
+        }
+    }
+    closedir(p_handle);
+    rmdir(p_dir);
+}
+
+/*!
+ * @brief This is a helper function that makes an empty directory unique to
+ *          this process.
+ */
+static void
+make_dir (char * p_dir)
+{
+    snprintf(p_dir, PATH_SIZE, "/tmp/bank_test_snapshot_%d", (int) getpid());
+    remove_dir(p_dir);
+    mkdir(p_dir, 0755);
+}
+
+/*!
+ * @brief This is a helper function that counts the files in a directory
+ *          whose names start with a prefix.
+ */
+static size_t
+count_files (const char * p_dir, const char * p_prefix)
+{
+    size_t count = 0;
+    DIR * p_handle = opendir(p_dir);
+    if (NULL == p_handle)
+    {
+        return 0;
+    }
+    struct dirent * p_entry = NULL;
+    while (NULL != (p_entry = readdir(p_handle)))
+    {
+        if (0 == strncmp(p_entry->d_name, p_prefix, strlen(p_prefix)))
+        {
+            count++;
+        }
+    }
+    closedir(p_handle);
+    return count;
+}
+
+/*!
+ * @brief This is a helper function that returns the monotonic time.
+ */
+static uint64_t
+now_ns (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000u) + (uint64_t) now.tv_nsec;
+}
+
+/*!
+ * @brief This datatype defines the tables a live state is checked
+ *          against.
+ *
+ * @param p_users The user index to check.
+ * @param p_accounts The account store to check.
+ * @param errors The number of users and accounts that differ.
+ */
+typedef struct _state_check
+{
+    user_index_t *    p_users;
+    account_store_t * p_accounts;
+    size_t            errors;
+} state_check_t;
+
+/*!
+ * @brief This is a visit function that checks a user is in the checked
+ *          index with the same password and id.
+ */
+static int
+check_user (const user_entry_t * p_entry, void * p_ctx)
+{
+    state_check_t * p_check = p_ctx;
+    uint32_t id = 0;
+    if ((0 != user_login(p_check->p_users, p_entry->username, p_entry->password, &id)) ||
+        (id != p_entry->id))
+    {
+        p_check->errors++;
+    }
+    return 0;
+}
+
+/*!
+ * @brief This is a visit function that checks an account is in the
+ *          checked store with the same balance.
+ */
+static int
+check_account (const uint32_t id, const uint64_t balance, void * p_ctx)
+{
+    state_check_t * p_check = p_ctx;
+    uint64_t checked = 0;
+    if ((0 != account_balance(p_check->p_accounts, id, &checked)) ||
+        (checked != balance))
+    {
+        p_check->errors++;
+    }
+    return 0;
+}
+
+/*!
+ * @brief This is a helper function that counts the differences between
+ *          two states.
+ */
+static size_t
+compare_state (user_index_t * p_users, account_store_t * p_accounts,
+               user_index_t * p_restored_users, account_store_t * p_restored_accounts)
+{
+    state_check_t check = {p_restored_users, p_restored_accounts, 0};
+    user_foreach(p_users, check_user, &check);
+    account_foreach(p_accounts, check_account, &check);
+    if ((user_count(p_users) != user_count(p_restored_users)) ||
+        (account_count(p_accounts) != account_count(p_restored_accounts)) ||
+        (user_next_id(p_users) != user_next_id(p_restored_users)))
+    {
+        check.errors++;
+    }
+    return check.errors;
+}
+
+/*!
+ * @brief This is a helper function that registers a user, opens their
+ *          account with a balance, and logs both if there is a log. Tables
+ *          that log their own changes are passed none.
+ */
+static uint32_t
+add_user (user_index_t * p_users, account_store_t * p_accounts, wal_t * p_wal,
+          const char * p_username, const uint64_t balance)
+{
+    uint32_t id = 0;
+    uint64_t lsn = 0;
+    if ((0 != user_register(p_users, p_username, "password", &id)) ||
+        (0 != account_open(p_accounts, id)) ||
+        ((0 != balance) && (0 != account_deposit(p_accounts, id, balance, NULL))))
+    {
+        return 0;
+    }
+    if ((NULL != p_wal) &&
+        ((0 != journal_user_put(p_wal, id, p_username, "password", &lsn)) ||
+         ((0 != balance) && (0 != journal_balances(p_wal, &id, &balance, 1, &lsn)))))
+    {
+        return 0;
+    }
+    return id;
+}
+
+/*!
+ * @brief This function tests writing, mapping and loading a snapshot, and
+ *          bad parameters.
+ */
+void
+test_snapshot_basic (void)
+{
+    char dir[PATH_SIZE];
+    make_dir(dir);
+    snapshot_t snapshot;
+    snapshot_stats_t stats;
+    uint64_t lsn = 99;
+    user_index_t * p_users = user_index_create(16);
+    account_store_t * p_accounts = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_users);
+    CU_ASSERT_PTR_NOT_NULL(p_accounts);
+
+    // Test bad parameters.
+    CU_ASSERT_EQUAL(-1, snapshot_open(NULL, &snapshot));
+    CU_ASSERT_EQUAL(-1, snapshot_open(dir, NULL));
+    CU_ASSERT_EQUAL(-1, snapshot_write(NULL, p_users, p_accounts, NULL, &lsn));
+    CU_ASSERT_EQUAL(-1, snapshot_write(dir, NULL, p_accounts, NULL, &lsn));
+    CU_ASSERT_EQUAL(-1, snapshot_write(dir, p_users, NULL, NULL, &lsn));
+    CU_ASSERT_EQUAL(-1, snapshot_write("/nonexistent/bank", p_users, p_accounts, NULL, &lsn));
+    CU_ASSERT_EQUAL(-1, snapshot_load(NULL, p_users, p_accounts));
+    CU_ASSERT_PTR_NULL(snapshot_writer_start(NULL, 1000, p_users, p_accounts, NULL));
+    CU_ASSERT_PTR_NULL(snapshot_writer_start(dir, 0, p_users, p_accounts, NULL));
+    CU_ASSERT_PTR_NULL(snapshot_writer_start(dir, 1000, NULL, p_accounts, NULL));
+    CU_ASSERT_PTR_NULL(snapshot_writer_start(dir, 1000, p_users, NULL, NULL));
+    CU_ASSERT_EQUAL(-1, snapshot_writer_stop(NULL));
+    CU_ASSERT_EQUAL(-1, snapshot_writer_stats(NULL, &stats));
+    snapshot_close(NULL);
+
+    // Test an empty directory has no snapshot.
+    CU_ASSERT_EQUAL(-1, snapshot_open(dir, &snapshot));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+    CU_ASSERT_EQUAL(-1, snapshot_load(&snapshot, p_users, p_accounts));
+
+    // Fill the tables, and delete the newest user so the snapshot must
+    // remember their id is taken.
+    char username[USER_STR_SIZE];
+    for (size_t idx = 1; idx <= 100; ++idx)
+    {
+        snprintf(username, sizeof(username), "user%03zu", idx);
+        CU_ASSERT_EQUAL(idx, add_user(p_users, p_accounts, NULL, username, idx * 10));
+    }
+    CU_ASSERT_EQUAL(0, user_delete(p_users, "user100"));
+    CU_ASSERT_EQUAL(0, account_close(p_accounts, 100, NULL));
+
+    // Test a snapshot without a log maps back with everything in it.
+    CU_ASSERT_EQUAL(0, snapshot_write(dir, p_users, p_accounts, NULL, &lsn));
+    CU_ASSERT_EQUAL(0, lsn);
+    CU_ASSERT_EQUAL(1, count_files(dir, "snapshot."));
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    CU_ASSERT_PTR_NOT_NULL(snapshot.p_map);
+    CU_ASSERT_EQUAL(0, snapshot.lsn);
+    CU_ASSERT_EQUAL(99, snapshot.num_users);
+    CU_ASSERT_EQUAL(99, snapshot.num_accounts);
+    CU_ASSERT_EQUAL(101, snapshot.next_id);
+    CU_ASSERT_EQUAL(sizeof(snapshot_header_t) + (99 * sizeof(snapshot_user_t)) +
+                    (99 * sizeof(snapshot_account_t)), snapshot.size);
+
+    user_index_t * p_restored_users = user_index_create(snapshot.num_users);
+    account_store_t * p_restored_accounts = account_store_create();
+    CU_ASSERT_EQUAL(-1, snapshot_load(&snapshot, NULL, p_restored_accounts));
+    CU_ASSERT_EQUAL(-1, snapshot_load(&snapshot, p_restored_users, NULL));
+    CU_ASSERT_EQUAL(0, snapshot_load(&snapshot, p_restored_users, p_restored_accounts));
+    snapshot_close(&snapshot);
+    CU_ASSERT_PTR_NULL(snapshot.p_map);
+    CU_ASSERT_EQUAL(0, compare_state(p_users, p_accounts, p_restored_users,
+                                     p_restored_accounts));
+
+    // Test the deleted user's id is not handed out again.
+    uint32_t id = 0;
+    CU_ASSERT_EQUAL(0, user_register(p_restored_users, "newcomer", "password", &id));
+    CU_ASSERT_EQUAL(101, id);
+
+    // Test the longest name and password the index accepts fit a
+    // snapshot.
+    char long_name[USER_DB_UNAME_MAX + 1];
+    memset(long_name, 'x', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+    char long_password[USER_DB_PWORD_MAX + 1];
+    memset(long_password, 'p', sizeof(long_password) - 1);
+    long_password[sizeof(long_password) - 1] = '\0';
+    CU_ASSERT_EQUAL(0, user_register(p_users, long_name, long_password, NULL));
+    CU_ASSERT_EQUAL(0, snapshot_write(dir, p_users, p_accounts, NULL, &lsn));
+    user_index_destroy(p_restored_users);
+    p_restored_users = user_index_create(16);
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    CU_ASSERT_EQUAL(0, snapshot_load(&snapshot, p_restored_users, p_restored_accounts));
+    snapshot_close(&snapshot);
+    CU_ASSERT_EQUAL(0, user_login(p_restored_users, long_name, long_password, NULL));
+
+    user_index_destroy(p_restored_users);
+    account_store_destroy(p_restored_accounts);
+    user_index_destroy(p_users);
+    account_store_destroy(p_accounts);
+    remove_dir(dir);
+}
+
+/*!
+ * @brief This function tests that only the newest snapshots are kept,
+ *          and that mapping falls back past ones that do not check out.
+ */
+void
+test_snapshot_newest (void)
+{
+    char dir[PATH_SIZE];
+    char path[PATH_SIZE + 32];
+    make_dir(dir);
+    snprintf(path, sizeof(path), "%s/bank.wal", dir);
+    wal_attr_t attr;
+    wal_attr_init(&attr);
+    wal_t * p_wal = wal_open(path, &attr);
+    user_index_t * p_users = user_index_create(16);
+    account_store_t * p_accounts = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+
+    // Take three snapshots, each after more records.
+    uint64_t lsns[3] = {0};
+    char username[USER_STR_SIZE];
+    for (size_t round = 0; round < 3; ++round)
+    {
+        for (size_t idx = 0; idx < 10; ++idx)
+        {
+            snprintf(username, sizeof(username), "user%zu_%zu", round, idx);
+            CU_ASSERT_NOT_EQUAL(0, add_user(p_users, p_accounts, p_wal, username, 5));
+        }
+        CU_ASSERT_EQUAL(0, snapshot_write(dir, p_users, p_accounts, p_wal, lsns + round));
+        CU_ASSERT_EQUAL(wal_last_lsn(p_wal), lsns[round]);
+    }
+    CU_ASSERT_EQUAL(60, lsns[2]);
+
+    // Test the log is durable up to the snapshot.
+    wal_stats_t wal_stats;
+    CU_ASSERT_EQUAL(0, wal_stats_snapshot(p_wal, &wal_stats));
+    CU_ASSERT_EQUAL(lsns[2], wal_stats.durable);
+
+    // Test only the newest are kept, and the newest is mapped.
+    CU_ASSERT_EQUAL(SNAPSHOT_KEEP, count_files(dir, "snapshot."));
+    snapshot_t snapshot;
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    CU_ASSERT_EQUAL(lsns[2], snapshot.lsn);
+    CU_ASSERT_EQUAL(30, snapshot.num_users);
+    snapshot_close(&snapshot);
+
+    // Test a leftover temporary file and stray names are ignored, and the
+    // temporary file is cleaned up by the next snapshot.
+    snprintf(path, sizeof(path), "%s/snapshot.00000000000000ff.tmp", dir);
+    close(open(path, O_WRONLY | O_CREAT, 0644));
+    snprintf(path, sizeof(path), "%s/snapshot.zz", dir);
+    close(open(path, O_WRONLY | O_CREAT, 0644));
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    CU_ASSERT_EQUAL(lsns[2], snapshot.lsn);
+    snapshot_close(&snapshot);
+    CU_ASSERT_EQUAL(0, snapshot_write(dir, p_users, p_accounts, p_wal, lsns + 2));
+    CU_ASSERT_EQUAL(0, count_files(dir, "snapshot.00000000000000ff"));
+    CU_ASSERT_EQUAL(1, count_files(dir, "snapshot.zz"));
+
+    // Test a corrupt newest snapshot falls back to the one before.
+    snprintf(path, sizeof(path), "%s/snapshot.%016llx", dir, (unsigned long long) lsns[2]);
+    int fd = open(path, O_RDWR);
+    unsigned char byte = 0;
+    CU_ASSERT_EQUAL(1, pread(fd, &byte, 1, sizeof(snapshot_header_t) + 5));
+    byte ^= 0x01;
+    CU_ASSERT_EQUAL(1, pwrite(fd, &byte, 1, sizeof(snapshot_header_t) + 5));
+    close(fd);
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    CU_ASSERT_EQUAL(lsns[1], snapshot.lsn);
+    CU_ASSERT_EQUAL(20, snapshot.num_users);
+    snapshot_close(&snapshot);
+
+    // Test a truncated snapshot is skipped too, leaving none.
+    snprintf(path, sizeof(path), "%s/snapshot.%016llx", dir, (unsigned long long) lsns[1]);
+    CU_ASSERT_EQUAL(0, truncate(path, sizeof(snapshot_header_t) + 10));
+    CU_ASSERT_EQUAL(-1, snapshot_open(dir, &snapshot));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    user_index_destroy(p_users);
+    account_store_destroy(p_accounts);
+    remove_dir(dir);
+}
+
+/*!
+ * @brief The tables and log the recovery threads change.
+ */
+static user_index_t *    gp_users = NULL;
+static account_store_t * gp_accounts = NULL;
+static wal_t *           gp_wal = NULL;
+static _Atomic size_t    g_running = 0;
+static _Atomic size_t    g_errors = 0;
+
+/*!
+ * @brief The users the recovery threads share, by slot. Only the thread
+ *          a slot belongs to replaces its user, and only it reads the
+ *          slot's name.
+ */
+static _Atomic uint32_t  g_shared_ids[RECOVERY_USERS];
+static char              g_shared_names[RECOVERY_USERS][USER_STR_SIZE];
+
+/*!
+ * @brief This is a thread function that pays into, withdraws from and
+ *          transfers between users every thread shares, and replaces the
+ *          users of its own slots. The tables log each change themselves,
+ *          so changes to one account by different threads, or racing its
+ *          user's deletion, must reach the log in the order they were
+ *          made.
+ */
+static void *
+recovery_worker (void * vp_idx)
+{
+    size_t thread = (size_t) (uintptr_t) vp_idx;
+    uint64_t state = 88172645463325252u ^ (thread * 0x9E3779B97F4A7C15u);
+    size_t next_name = 0;
+    size_t errors = 0;
+    for (size_t op = 0; op < RECOVERY_OPS; ++op)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t pick = (size_t) (state % 100);
+        size_t slot = (size_t) ((state >> 8) % RECOVERY_USERS);
+        uint32_t id = atomic_load(g_shared_ids + slot);
+        int result = 0;
+        if ((pick < 20) &&
+            (thread == (slot % RECOVERY_THREADS)))
+        {
+            errors += (0 != user_delete(gp_users, g_shared_names[slot]));
+            errors += (0 != account_close(gp_accounts, id, NULL));
+            snprintf(g_shared_names[slot], USER_STR_SIZE, "t%zu_u%zu", thread, next_name++);
+            id = add_user(gp_users, gp_accounts, NULL, g_shared_names[slot], state % 1000);
+            errors += (0 == id);
+            atomic_store(g_shared_ids + slot, id);
+        }
+        else if (pick < 45)
+        {
+            result = account_deposit(gp_accounts, id, 1 + (state % 50), NULL);
+        }
+        else if (pick < 60)
+        {
+            result = account_withdraw(gp_accounts, id, state % 50, NULL);
+        }
+        else
+        {
+            size_t to = (slot + 1 + (size_t) ((state >> 20) % (RECOVERY_USERS - 1))) %
+                        RECOVERY_USERS;
+            result = account_transfer(gp_accounts, id, atomic_load(g_shared_ids + to),
+                                      state % 20, NULL);
+        }
+        
+        // An account may be closed under another thread, or too low.
+        errors += ((0 != result) && (ENOENT != errno) && (ERANGE != errno));
+    }
+    atomic_fetch_add(&g_errors, errors);
+    atomic_fetch_sub(&g_running, 1);
+    return NULL;
+}
+
+/*!
+ * @brief This function tests that snapshots taken while the tables change,
+ *          plus the log after them, rebuild exactly the final tables.
+ */
+void
+test_snapshot_recovery (void)
+{
+    char dir[PATH_SIZE];
+    char path[PATH_SIZE + 32];
+    make_dir(dir);
+    snprintf(path, sizeof(path), "%s/bank.wal", dir);
+    wal_attr_t attr;
+    wal_attr_init(&attr);
+    gp_wal = wal_open(path, &attr);
+    gp_users = user_index_create(16);
+    gp_accounts = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(gp_wal);
+    if (NULL == gp_wal)
+    {
+        return;
+    }
+    CU_ASSERT_EQUAL(0, user_index_set_log(gp_users, journal_log_user, gp_wal));
+    CU_ASSERT_EQUAL(0, account_store_set_log(gp_accounts, journal_log_balances, gp_wal));
+    for (size_t slot = 0; slot < RECOVERY_USERS; ++slot)
+    {
+        snprintf(g_shared_names[slot], USER_STR_SIZE, "shared%zu", slot);
+        atomic_store(g_shared_ids + slot, add_user(gp_users, gp_accounts, NULL,
+                                                   g_shared_names[slot], 100));
+        CU_ASSERT_NOT_EQUAL(0, atomic_load(g_shared_ids + slot));
+    }
+
+    pthread_t threads[RECOVERY_THREADS];
+    atomic_store(&g_running, RECOVERY_THREADS);
+    atomic_store(&g_errors, 0);
+    for (size_t idx = 0; idx < RECOVERY_THREADS; ++idx)
+    {
+        pthread_create(threads + idx, NULL, recovery_worker, (void *) (uintptr_t) idx);
+    }
+
+    // Snapshot over and over while the threads run.
+    size_t taken = 0;
+    size_t failed = 0;
+    do
+    {
+        uint64_t lsn = 0;
+        if (0 == snapshot_write(dir, gp_users, gp_accounts, gp_wal, &lsn))
+        {
+            taken++;
+        }
+        else
+        {
+            failed++;
+        }
+    } while (0 != atomic_load(&g_running));
+    for (size_t idx = 0; idx < RECOVERY_THREADS; ++idx)
+    {
+        pthread_join(threads[idx], NULL);
+    }
+    CU_ASSERT_EQUAL(0, atomic_load(&g_errors));
+    CU_ASSERT_EQUAL(0, failed);
+    CU_ASSERT(taken >= 1);
+    CU_ASSERT_EQUAL(0, user_index_set_log(gp_users, NULL, NULL));
+    CU_ASSERT_EQUAL(0, account_store_set_log(gp_accounts, NULL, NULL));
+    uint64_t last_lsn = wal_last_lsn(gp_wal);
+    CU_ASSERT_EQUAL(0, wal_close(gp_wal));
+    gp_wal = NULL;
+
+    // Rebuild from the newest snapshot and the log after it.
+    snapshot_t snapshot;
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    journal_t journal;
+    journal.p_users = user_index_create(snapshot.num_users);
+    journal.p_accounts = account_store_create();
+    journal.applied = 0;
+    CU_ASSERT_EQUAL(0, snapshot_load(&snapshot, journal.p_users, journal.p_accounts));
+    uint64_t snapshot_lsn = snapshot.lsn;
+    snapshot_close(&snapshot);
+    uint64_t replayed_lsn = 0;
+    CU_ASSERT_EQUAL(0, wal_replay(path, snapshot_lsn, journal_apply, &journal, &replayed_lsn));
+    CU_ASSERT_EQUAL(last_lsn, replayed_lsn);
+    CU_ASSERT_EQUAL(last_lsn - snapshot_lsn, journal.applied);
+    CU_ASSERT_EQUAL(0, compare_state(gp_users, gp_accounts, journal.p_users,
+                                     journal.p_accounts));
+    printf("\n    %zu snapshots during %lu records, last at %lu, %lu replayed after it\n",
+           taken, (unsigned long) last_lsn, (unsigned long) snapshot_lsn,
+           (unsigned long) journal.applied);
+
+    user_index_destroy(journal.p_users);
+    account_store_destroy(journal.p_accounts);
+    user_index_destroy(gp_users);
+    account_store_destroy(gp_accounts);
+    gp_users = NULL;
+    gp_accounts = NULL;
+    remove_dir(dir);
+}
+
+/*!
+ * @brief This function compares restarting from the whole log with
+ *          restarting from a snapshot, and tests the latter reads only
+ *          the log after the snapshot.
+ */
+void
+test_snapshot_restart (void)
+{
+    char dir[PATH_SIZE];
+    char path[PATH_SIZE + 32];
+    make_dir(dir);
+    snprintf(path, sizeof(path), "%s/bank.wal", dir);
+    wal_attr_t attr;
+    wal_attr_init(&attr);
+    attr.segment_size = RESTART_SEGMENT_SIZE;
+    wal_t * p_wal = wal_open(path, &attr);
+    user_index_t * p_users = user_index_create(RESTART_USERS);
+    account_store_t * p_accounts = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+
+    char username[USER_STR_SIZE];
+    size_t errors = 0;
+    for (size_t idx = 0; idx < RESTART_USERS; ++idx)
+    {
+        snprintf(username, sizeof(username), "user%zu", idx);
+        errors += (0 == add_user(p_users, p_accounts, p_wal, username, 1 + idx));
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    size_t segments = count_files(dir, "bank.wal.");
+    CU_ASSERT(segments > 1);
+
+    // Restart from the whole log.
+    journal_t journal;
+    uint64_t start_ns = now_ns();
+    journal.p_users = user_index_create(RESTART_USERS);
+    journal.p_accounts = account_store_create();
+    journal.applied = 0;
+    uint64_t lsn = 0;
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, journal_apply, &journal, &lsn));
+    uint64_t log_ns = now_ns() - start_ns;
+    CU_ASSERT_EQUAL(2 * RESTART_USERS, journal.applied);
+    CU_ASSERT_EQUAL(2 * RESTART_USERS, lsn);
+    CU_ASSERT_EQUAL(0, compare_state(p_users, p_accounts, journal.p_users,
+                                     journal.p_accounts));
+    user_index_destroy(journal.p_users);
+    account_store_destroy(journal.p_accounts);
+
+    // Snapshot, which removes the segments it holds, then log a few more
+    // changes after it.
+    attr.last_lsn = lsn;
+    p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+    start_ns = now_ns();
+    CU_ASSERT_EQUAL(0, snapshot_write(dir, p_users, p_accounts, p_wal, &lsn));
+    uint64_t write_ns = now_ns() - start_ns;
+    CU_ASSERT_EQUAL(2 * RESTART_USERS, lsn);
+    for (size_t idx = 0; idx < RESTART_LATE_USERS; ++idx)
+    {
+        snprintf(username, sizeof(username), "late%zu", idx);
+        errors += (0 == add_user(p_users, p_accounts, p_wal, username, 1 + idx));
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    CU_ASSERT_EQUAL(1, count_files(dir, "bank.wal."));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, wal_replay(path, 0, NULL, NULL, NULL));
+    CU_ASSERT_EQUAL(ENODATA, errno);
+
+    // Restart from the snapshot, then the log after it.
+    snapshot_t snapshot;
+    start_ns = now_ns();
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    journal.p_users = user_index_create(snapshot.num_users);
+    journal.p_accounts = account_store_create();
+    journal.applied = 0;
+    CU_ASSERT_EQUAL(0, snapshot_load(&snapshot, journal.p_users, journal.p_accounts));
+    snapshot_close(&snapshot);
+    uint64_t load_ns = now_ns() - start_ns;
+    CU_ASSERT_EQUAL(0, wal_replay(path, lsn, journal_apply, &journal, NULL));
+    uint64_t snapshot_ns = now_ns() - start_ns;
+    CU_ASSERT_EQUAL(2 * RESTART_LATE_USERS, journal.applied);
+    CU_ASSERT_EQUAL(0, compare_state(p_users, p_accounts, journal.p_users,
+                                     journal.p_accounts));
+    printf("\n    %d users: snapshot written in %.1f ms; restart from the log %.1f ms, "
+           "from the snapshot %.1f ms (%.1f ms loading it); %zu log segments down to 1\n",
+           RESTART_USERS, (double) write_ns / 1e6, (double) log_ns / 1e6,
+           (double) snapshot_ns / 1e6, (double) load_ns / 1e6, segments);
+
+    user_index_destroy(journal.p_users);
+    account_store_destroy(journal.p_accounts);
+    user_index_destroy(p_users);
+    account_store_destroy(p_accounts);
+    remove_dir(dir);
+}
+
+/*!
+ * @brief This function tests a writer snapshots periodically, skips
+ *          periods with nothing new, and snapshots once more when
+ *          stopped.
+ */
+void
+test_snapshot_writer (void)
+{
+    char dir[PATH_SIZE];
+    char path[PATH_SIZE + 32];
+    make_dir(dir);
+    snprintf(path, sizeof(path), "%s/bank.wal", dir);
+    wal_attr_t attr;
+    wal_attr_init(&attr);
+    wal_t * p_wal = wal_open(path, &attr);
+    user_index_t * p_users = user_index_create(16);
+    account_store_t * p_accounts = account_store_create();
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+
+    char username[USER_STR_SIZE];
+    for (size_t idx = 0; idx < 5; ++idx)
+    {
+        snprintf(username, sizeof(username), "user%zu", idx);
+        CU_ASSERT_NOT_EQUAL(0, add_user(p_users, p_accounts, p_wal, username, 100));
+    }
+    snapshot_writer_t * p_writer = snapshot_writer_start(dir, 20, p_users, p_accounts, p_wal);
+    CU_ASSERT_PTR_NOT_NULL(p_writer);
+    if (NULL == p_writer)
+    {
+        return;
+    }
+
+    // Test a snapshot is written within a few periods.
+    snapshot_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    for (size_t tries = 0; (tries < 100) && (0 == stats.written); ++tries)
+    {
+        usleep(10000);
+        CU_ASSERT_EQUAL(0, snapshot_writer_stats(p_writer, &stats));
+    }
+    CU_ASSERT(stats.written >= 1);
+    CU_ASSERT_EQUAL(0, stats.failed);
+    CU_ASSERT_EQUAL(10, stats.lsn);
+    CU_ASSERT(stats.copy_ns <= stats.write_ns);
+
+    // Test periods with nothing logged write nothing.
+    uint64_t written = stats.written;
+    usleep(100000);
+    CU_ASSERT_EQUAL(0, snapshot_writer_stats(p_writer, &stats));
+    CU_ASSERT_EQUAL(written, stats.written);
+
+    // Test stopping snapshots what was logged since.
+    CU_ASSERT_NOT_EQUAL(0, add_user(p_users, p_accounts, p_wal, "latecomer", 7));
+    CU_ASSERT_EQUAL(0, snapshot_writer_stop(p_writer));
+    snapshot_t snapshot;
+    CU_ASSERT_EQUAL(0, snapshot_open(dir, &snapshot));
+    CU_ASSERT_EQUAL(12, snapshot.lsn);
+    CU_ASSERT_EQUAL(6, snapshot.num_users);
+    snapshot_close(&snapshot);
+
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    user_index_destroy(p_users);
+    account_store_destroy(p_accounts);
+    remove_dir(dir);
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"snapshot basic test", test_snapshot_basic},
+        {"snapshot newest test", test_snapshot_newest},
+        {"snapshot recovery test", test_snapshot_recovery},
+        {"snapshot restart test", test_snapshot_restart},
+        {"snapshot writer test", test_snapshot_writer},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"snapshot test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
@@ -5,13 +5,21 @@
  *          generic threadpool implemented in source/common/threadpool.h
  */
 
+#define _GNU_SOURCE
+
 #include <CUnit/Basic.h>
 #include <CUnit/CUnitCI.h>
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "../source/common/threadpool.h"
 
@@ -75,6 +83,1198 @@ test_threadpool_inc (void)
     CU_ASSERT_EQUAL(INCR_ROUNDS, incr);
 }
 
+/*!
+ * @brief This function tests a threadpool by adding jobs in batches,
+ *          including one larger than a single enqueue chunk.
+ */
+#define BATCH_ROUNDS (THREADPOOL_ENQ_BATCH * 3 + 7)
+static void
+test_threadpool_batch (void)
+{
+    CU_ASSERT_PTR_NOT_NULL(p_tp);
+    _Atomic int incr = 0;
+    job_t jobs[BATCH_ROUNDS];
+    for (size_t i = 0; i < BATCH_ROUNDS; ++i)
+    {
+        jobs[i].job_func = (job_f) inc;
+        jobs[i].p_arg = &incr;
+    }
+
+    // Test batch enqueue with bad parameters.
+    CU_ASSERT_EQUAL(-1, threadpool_enq_batch(NULL, jobs, BATCH_ROUNDS));
+    CU_ASSERT_EQUAL(-1, threadpool_enq_batch(p_tp, NULL, BATCH_ROUNDS));
+    CU_ASSERT_EQUAL(-1, threadpool_enq_batch(p_tp, jobs, 0));
+
+    // Test a NULL job function rejects the whole array.
+    jobs[BATCH_ROUNDS - 1].job_func = NULL;
+    CU_ASSERT_EQUAL(-1, threadpool_enq_batch(p_tp, jobs, BATCH_ROUNDS));
+    jobs[BATCH_ROUNDS - 1].job_func = (job_f) inc;
+
+    CU_ASSERT_EQUAL(0, threadpool_enq_batch(p_tp, jobs, 1));
+    CU_ASSERT_EQUAL(0, threadpool_enq_batch(p_tp, jobs, BATCH_ROUNDS));
+
+    // Allow jobs to complete before printing.
+    sleep(1);
+
+    printf("incr: %d\n", incr);
+    CU_ASSERT_EQUAL(BATCH_ROUNDS + 1, incr);
+}
+
+/*!
+ * @brief This is a job that returns its argument doubled.
+ */
+static void *
+twice (_Atomic bool * pb_shutdown, void * p_arg)
+{
+    CU_ASSERT_PTR_NOT_NULL(pb_shutdown);
+    return (void *) ((uintptr_t) p_arg * 2);
+}
+
+/*!
+ * @brief This function tests completion handles and waiting for the
+ *          threadpool to go idle, repeated over several cycles on the
+ *          same threadpool.
+ */
+#define HANDLE_JOBS 32
+#define IDLE_CYCLES 3
+static void
+test_threadpool_handles (void)
+{
+    CU_ASSERT_PTR_NOT_NULL(p_tp);
+    threadpool_handle_t * p_handles[HANDLE_JOBS] = {0};
+    void * p_result = NULL;
+
+    // Test bad parameters.
+    CU_ASSERT_PTR_NULL(threadpool_submit(NULL, twice, NULL));
+    CU_ASSERT_PTR_NULL(threadpool_submit(p_tp, NULL, NULL));
+    CU_ASSERT_EQUAL(false, threadpool_handle_poll(NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_handle_wait(NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_handle_result(NULL, &p_result));
+    CU_ASSERT_EQUAL(-1, threadpool_wait_idle(NULL));
+    threadpool_handle_release(NULL);
+
+    for (size_t i = 0; i < HANDLE_JOBS; ++i)
+    {
+        p_handles[i] = threadpool_submit(p_tp, twice, (void *) i);
+        CU_ASSERT_PTR_NOT_NULL(p_handles[i]);
+    }
+    for (size_t i = 0; i < HANDLE_JOBS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_handle_wait(p_handles[i]));
+        CU_ASSERT_EQUAL(true, threadpool_handle_poll(p_handles[i]));
+        CU_ASSERT_EQUAL(0, threadpool_handle_result(p_handles[i], &p_result));
+        CU_ASSERT_EQUAL(i * 2, (uintptr_t) p_result);
+        CU_ASSERT_EQUAL(-1, threadpool_handle_result(p_handles[i], NULL));
+        threadpool_handle_release(p_handles[i]);
+    }
+
+    // Test a handle released before its job runs.
+    threadpool_handle_release(threadpool_submit(p_tp, twice, NULL));
+
+    // Test the threadpool can be drained and reused, without sleeping.
+    for (size_t cycle = 0; cycle < IDLE_CYCLES; ++cycle)
+    {
+        _Atomic int incr = 0;
+        for (size_t i = 0; i < INCR_ROUNDS; ++i)
+        {
+            CU_ASSERT_EQUAL(0, threadpool_enq(p_tp, (job_f) inc, &incr));
+        }
+        CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_tp));
+        CU_ASSERT_EQUAL(INCR_ROUNDS, incr);
+    }
+
+    // Test waiting on an idle threadpool returns at once.
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_tp));
+}
+
+/*!
+ * @brief This is a job that blocks until its gate is opened.
+ */
+static void
+wait_gate (_Atomic bool * pb_shutdown, _Atomic bool * pb_gate)
+{
+    (void) pb_shutdown;
+    while (false == atomic_load(pb_gate))
+    {
+        usleep(1000);
+    }
+}
+
+/*!
+ * @brief This is a high-water-mark callback that records the latest
+ *          saturation state and the number of transitions.
+ */
+static _Atomic int g_hwm_calls = 0;
+static _Atomic bool gb_hwm_saturated = false;
+static void
+record_hwm (threadpool_t * p_pool, bool b_saturated, void * p_ctx)
+{
+    CU_ASSERT_PTR_NOT_NULL(p_pool);
+    CU_ASSERT_PTR_EQUAL(p_ctx, &g_hwm_calls);
+    gb_hwm_saturated = b_saturated;
+    g_hwm_calls++;
+}
+
+/*!
+ * @brief This function tests a bounded threadpool: try and timed
+ *          enqueues on a full queue, and the high-water-mark callback.
+ */
+#define BOUNDED_CAPACITY 4
+static void
+test_threadpool_bounded (void)
+{
+    _Atomic bool b_gate = false;
+    _Atomic int incr = 0;
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(-1, threadpool_attr_init(NULL));
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.num_threads = 1;
+    attr.capacity = BOUNDED_CAPACITY;
+    attr.high_water = BOUNDED_CAPACITY;
+    attr.low_water = 1;
+    attr.hwm_func = record_hwm;
+    attr.p_hwm_ctx = &g_hwm_calls;
+
+    // Test that the low-water mark must sit below the high-water mark.
+    attr.low_water = BOUNDED_CAPACITY;
+    CU_ASSERT_PTR_NULL(threadpool_create_attr(&attr));
+    attr.low_water = 1;
+    CU_ASSERT_PTR_NULL(threadpool_create_attr(NULL));
+
+    threadpool_t * p_bounded = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_bounded);
+    if (NULL == p_bounded)
+    {
+        return;
+    }
+
+    // Occupy the only thread, then wait for it to pick up the job.
+    CU_ASSERT_EQUAL(0, threadpool_enq(p_bounded, (job_f) wait_gate, &b_gate));
+    sleep(1);
+
+    // Fill the queue to capacity.
+    for (size_t i = 0; i < BOUNDED_CAPACITY; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_try_enq(p_bounded, (job_f) inc, &incr));
+    }
+    CU_ASSERT_EQUAL(1, g_hwm_calls);
+    CU_ASSERT_EQUAL(true, gb_hwm_saturated);
+
+    // Test try enqueue on a full queue.
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, threadpool_try_enq(p_bounded, (job_f) inc, &incr));
+    CU_ASSERT_EQUAL(EAGAIN, errno);
+
+    // Test timed enqueue on a full queue.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 50000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    CU_ASSERT_EQUAL(-1, threadpool_enq_timed(p_bounded, (job_f) inc, &incr, NULL));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, threadpool_enq_timed(p_bounded, (job_f) inc, &incr, &deadline));
+    CU_ASSERT_EQUAL(ETIMEDOUT, errno);
+
+    // Open the gate. A blocking enqueue now succeeds once room is made.
+    b_gate = true;
+    CU_ASSERT_EQUAL(0, threadpool_enq(p_bounded, (job_f) inc, &incr));
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+    CU_ASSERT_EQUAL(0, threadpool_enq_timed(p_bounded, (job_f) inc, &incr, &deadline));
+
+    // Allow jobs to complete before checking.
+    sleep(1);
+
+    printf("incr: %d, hwm calls: %d\n", incr, g_hwm_calls);
+    CU_ASSERT_EQUAL(BOUNDED_CAPACITY + 2, incr);
+    CU_ASSERT_EQUAL(false, gb_hwm_saturated);
+    CU_ASSERT_EQUAL(0, g_hwm_calls % 2);
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_bounded));
+}
+
+/*!
+ * @brief This is a job that records the priority lane it was queued on,
+ *          in the order jobs are performed.
+ */
+#define PRIO_PER_LANE 20
+static _Atomic size_t g_prio_next = 0;
+static int g_prio_order[THREADPOOL_NUM_PRIO * PRIO_PER_LANE];
+static void
+record_prio (_Atomic bool * pb_shutdown, void * p_lane)
+{
+    (void) pb_shutdown;
+    size_t idx = atomic_fetch_add(&g_prio_next, 1);
+    if (idx < (THREADPOOL_NUM_PRIO * PRIO_PER_LANE))
+    {
+        g_prio_order[idx] = (int) (uintptr_t) p_lane;
+    }
+}
+
+/*!
+ * @brief This function tests priority lanes: higher lanes are served
+ *          first, the low lane still makes progress while higher lanes
+ *          are busy, and the lane counters add up.
+ */
+static void
+test_threadpool_prio (void)
+{
+    _Atomic bool b_gate = false;
+    threadpool_lane_stats_t stats = {0};
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+
+    // Test a zero lane weight is rejected.
+    attr.lane_weights[THREADPOOL_PRIO_LOW] = 0;
+    CU_ASSERT_PTR_NULL(threadpool_create_attr(&attr));
+    attr.lane_weights[THREADPOOL_PRIO_LOW] = THREADPOOL_DEFAULT_WEIGHT_LOW;
+
+    threadpool_t * p_prio = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_prio);
+    if (NULL == p_prio)
+    {
+        return;
+    }
+
+    // Test bad parameters.
+    CU_ASSERT_EQUAL(-1, threadpool_enq_prio(NULL, THREADPOOL_PRIO_HIGH, (job_f) inc, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_enq_prio(p_prio, THREADPOOL_NUM_PRIO, (job_f) inc, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_enq_prio(p_prio, THREADPOOL_PRIO_HIGH, NULL, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_lane_stats(NULL, THREADPOOL_PRIO_HIGH, &stats));
+    CU_ASSERT_EQUAL(-1, threadpool_lane_stats(p_prio, THREADPOOL_NUM_PRIO, &stats));
+    CU_ASSERT_EQUAL(-1, threadpool_lane_stats(p_prio, THREADPOOL_PRIO_HIGH, NULL));
+
+    // Occupy the only thread, then fill the lanes from the lowest up.
+    CU_ASSERT_EQUAL(0, threadpool_enq(p_prio, (job_f) wait_gate, &b_gate));
+    sleep(1);
+    atomic_store(&g_prio_next, 0);
+    for (int lane = THREADPOOL_NUM_PRIO - 1; lane >= 0; --lane)
+    {
+        for (size_t i = 0; i < PRIO_PER_LANE; ++i)
+        {
+            CU_ASSERT_EQUAL(0, threadpool_enq_prio(p_prio, (threadpool_prio_t) lane,
+                                                   (job_f) record_prio,
+                                                   (void *) (uintptr_t) lane));
+        }
+    }
+    CU_ASSERT_EQUAL(0, threadpool_lane_stats(p_prio, THREADPOOL_PRIO_LOW, &stats));
+    CU_ASSERT_EQUAL(PRIO_PER_LANE, stats.depth);
+
+    b_gate = true;
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_prio));
+    CU_ASSERT_EQUAL(THREADPOOL_NUM_PRIO * PRIO_PER_LANE, atomic_load(&g_prio_next));
+
+    // The high lane goes first, and every lane is served within a round.
+    size_t round = THREADPOOL_DEFAULT_WEIGHT_HIGH + THREADPOOL_DEFAULT_WEIGHT_NORMAL +
+                   THREADPOOL_DEFAULT_WEIGHT_LOW;
+    bool b_seen[THREADPOOL_NUM_PRIO] = {false};
+    for (size_t idx = 0; idx < round; ++idx)
+    {
+        if (idx < THREADPOOL_DEFAULT_WEIGHT_HIGH)
+        {
+            CU_ASSERT_EQUAL(THREADPOOL_PRIO_HIGH, g_prio_order[idx]);
+        }
+        b_seen[g_prio_order[idx]] = true;
+    }
+    CU_ASSERT_EQUAL(true, b_seen[THREADPOOL_PRIO_NORMAL]);
+    CU_ASSERT_EQUAL(true, b_seen[THREADPOOL_PRIO_LOW]);
+
+    for (size_t lane = 0; lane < THREADPOOL_NUM_PRIO; ++lane)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_lane_stats(p_prio, (threadpool_prio_t) lane, &stats));
+        printf("lane %zu: peak %zu, enqueued %zu, dequeued %zu\n",
+               lane, stats.peak, stats.enqueued, stats.dequeued);
+        CU_ASSERT_EQUAL(0, stats.depth);
+        CU_ASSERT_EQUAL(PRIO_PER_LANE, stats.peak);
+        CU_ASSERT_EQUAL(stats.enqueued, stats.dequeued);
+    }
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_prio));
+}
+
+/*!
+ * @brief This is a threadpool job that takes a little time.
+ */
+static void
+nap (_Atomic bool * pb_shutdown, _Atomic int * p_int)
+{
+    (void) pb_shutdown;
+    usleep(100);
+    atomic_fetch_add(p_int, 1);
+}
+
+/*!
+ * @brief This function checks a statistics snapshot after a threadpool
+ *          has performed jobs in the given mode.
+ */
+#define STATS_JOBS 200
+static void
+run_stats (const threadpool_mode_t mode)
+{
+    _Atomic int count = 0;
+    threadpool_stats_t stats = {0};
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.num_threads = 2;
+    attr.mode = mode;
+    threadpool_t * p_stats = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_stats);
+    if (NULL == p_stats)
+    {
+        return;
+    }
+
+    // Test bad parameters.
+    CU_ASSERT_EQUAL(-1, threadpool_stats_snapshot(NULL, &stats));
+    CU_ASSERT_EQUAL(-1, threadpool_stats_snapshot(p_stats, NULL));
+
+    // Test a fresh threadpool is empty.
+    CU_ASSERT_EQUAL(0, threadpool_stats_snapshot(p_stats, &stats));
+    CU_ASSERT_EQUAL(2, stats.num_threads);
+    CU_ASSERT_EQUAL(0, stats.enqueued);
+    CU_ASSERT_EQUAL(0, stats.completed);
+
+    for (size_t i = 0; i < STATS_JOBS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(p_stats, (job_f) nap, &count));
+    }
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_stats));
+    CU_ASSERT_EQUAL(STATS_JOBS, atomic_load(&count));
+
+    // Every job was counted once, and once in each histogram.
+    CU_ASSERT_EQUAL(0, threadpool_stats_snapshot(p_stats, &stats));
+    uint64_t wait_total = 0;
+    uint64_t run_total = 0;
+    for (size_t bucket = 0; bucket < THREADPOOL_HIST_BUCKETS; ++bucket)
+    {
+        wait_total += stats.wait_hist[bucket];
+        run_total += stats.run_hist[bucket];
+    }
+    printf("enqueued %lu, completed %lu, peak %zu, busy %lu ns, idle %lu ns\n",
+           stats.enqueued, stats.completed, stats.peak_queued, stats.busy_ns, stats.idle_ns);
+    CU_ASSERT_EQUAL(STATS_JOBS, stats.enqueued);
+    CU_ASSERT_EQUAL(STATS_JOBS, stats.completed);
+    CU_ASSERT_EQUAL(0, stats.queued);
+    CU_ASSERT(0 != stats.peak_queued);
+    CU_ASSERT_EQUAL(STATS_JOBS, wait_total);
+    CU_ASSERT_EQUAL(STATS_JOBS, run_total);
+
+    // Each job sleeps at least 100 us, so none ran in under 64 us.
+    for (size_t bucket = 0; bucket < 16; ++bucket)
+    {
+        CU_ASSERT_EQUAL(0, stats.run_hist[bucket]);
+    }
+    CU_ASSERT(stats.busy_ns >= (uint64_t) STATS_JOBS * 100000);
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_stats));
+}
+
+/*!
+ * @brief This function tests threadpool_stats_snapshot in both modes.
+ */
+static void
+test_threadpool_stats (void)
+{
+    run_stats(THREADPOOL_MODE_SHARED);
+    run_stats(THREADPOOL_MODE_STEAL);
+}
+
+/*!
+ * @brief This is a threadpool job that raises a flag.
+ */
+static void
+raise_flag (_Atomic bool * pb_shutdown, _Atomic bool * pb_flag)
+{
+    (void) pb_shutdown;
+    atomic_store(pb_flag, true);
+}
+
+/*!
+ * @brief This function hands jobs one at a time to an idle threadpool,
+ *          with the given spin budget and mode, and reports the average
+ *          handoff latency.
+ */
+#define SPIN_HANDOFFS 2000
+static void
+run_spin (const threadpool_mode_t mode, const size_t spin_max)
+{
+    _Atomic bool b_flag = false;
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    CU_ASSERT_EQUAL(THREADPOOL_DEFAULT_SPIN, attr.spin_max);
+    attr.num_threads = 2;
+    attr.mode = mode;
+    attr.spin_max = spin_max;
+    threadpool_t * p_spin = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_spin);
+    if (NULL == p_spin)
+    {
+        return;
+    }
+
+    struct timespec start;
+    struct timespec end;
+    size_t handoffs = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < SPIN_HANDOFFS; ++i)
+    {
+        atomic_store(&b_flag, false);
+        if (0 != threadpool_enq(p_spin, (job_f) raise_flag, &b_flag))
+        {
+            break;
+        }
+        while (false == atomic_load(&b_flag))
+        {
+            sched_yield();
+        }
+        handoffs++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    CU_ASSERT_EQUAL(SPIN_HANDOFFS, handoffs);
+
+    double elapsed_us = ((double) (end.tv_sec - start.tv_sec) * 1e6) +
+                        ((double) (end.tv_nsec - start.tv_nsec) / 1e3);
+    printf("mode %d, spin %zu: %.2f us per handoff\n",
+           (int) mode, spin_max, elapsed_us / SPIN_HANDOFFS);
+
+    // Test destroy releases threads that are spinning or parked.
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_spin));
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_spin));
+}
+
+/*!
+ * @brief This function tests idle threads pick up jobs handed to them
+ *          one at a time, with and without spinning, in both modes.
+ */
+static void
+test_threadpool_spin (void)
+{
+    run_spin(THREADPOOL_MODE_SHARED, 0);
+    run_spin(THREADPOOL_MODE_SHARED, THREADPOOL_DEFAULT_SPIN);
+    run_spin(THREADPOOL_MODE_STEAL, 0);
+    run_spin(THREADPOOL_MODE_STEAL, THREADPOOL_DEFAULT_SPIN);
+}
+
+/*!
+ * @brief Keyed test parameters, and the state of each key. A job checks
+ *          that no other job of its key is running and that it runs in
+ *          submission order.
+ */
+#define KEYED_KEYS 16
+#define KEYED_PER_KEY 200
+typedef struct _keyed_arg
+{
+    size_t key;
+    size_t seq;
+} keyed_arg_t;
+static keyed_arg_t g_keyed_args[KEYED_KEYS][KEYED_PER_KEY];
+static _Atomic bool gb_keyed_busy[KEYED_KEYS];
+static _Atomic size_t g_keyed_next[KEYED_KEYS];
+static _Atomic size_t g_keyed_errors = 0;
+static _Atomic size_t g_keyed_running = 0;
+static _Atomic size_t g_keyed_overlap = 0;
+
+/*!
+ * @brief This is a keyed threadpool job.
+ */
+static void
+keyed_job (_Atomic bool * pb_shutdown, keyed_arg_t * p_arg)
+{
+    (void) pb_shutdown;
+    if (true == atomic_exchange(gb_keyed_busy + p_arg->key, true))
+    {
+        atomic_fetch_add(&g_keyed_errors, 1);
+    }
+    size_t running = atomic_fetch_add(&g_keyed_running, 1) + 1;
+    if (running > atomic_load(&g_keyed_overlap))
+    {
+        atomic_store(&g_keyed_overlap, running);
+    }
+    if (0 == (p_arg->seq % 50))
+    {
+        usleep(1000);
+    }
+    if (p_arg->seq != atomic_fetch_add(g_keyed_next + p_arg->key, 1))
+    {
+        atomic_fetch_add(&g_keyed_errors, 1);
+    }
+    atomic_fetch_sub(&g_keyed_running, 1);
+    atomic_store(gb_keyed_busy + p_arg->key, false);
+}
+
+/*!
+ * @brief This function enqueues interleaved jobs for several keys in the
+ *          given mode, and checks each key's jobs ran one at a time and
+ *          in order.
+ */
+static void
+run_keyed (const threadpool_mode_t mode)
+{
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.num_threads = 4;
+    attr.mode = mode;
+    threadpool_t * p_keyed = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_keyed);
+    if (NULL == p_keyed)
+    {
+        return;
+    }
+
+    // Test bad parameters.
+    CU_ASSERT_EQUAL(-1, threadpool_enq_keyed(NULL, 0, (job_f) keyed_job, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_enq_keyed(p_keyed, 0, NULL, NULL));
+
+    atomic_store(&g_keyed_errors, 0);
+    atomic_store(&g_keyed_overlap, 0);
+    for (size_t key = 0; key < KEYED_KEYS; ++key)
+    {
+        atomic_store(gb_keyed_busy + key, false);
+        atomic_store(g_keyed_next + key, 0);
+    }
+    for (size_t seq = 0; seq < KEYED_PER_KEY; ++seq)
+    {
+        for (size_t key = 0; key < KEYED_KEYS; ++key)
+        {
+            keyed_arg_t * p_arg = &(g_keyed_args[key][seq]);
+            p_arg->key = key;
+            p_arg->seq = seq;
+            CU_ASSERT_EQUAL(0, threadpool_enq_keyed(p_keyed, key, (job_f) keyed_job, p_arg));
+        }
+    }
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_keyed));
+
+    // Every job ran, one at a time and in order per key, while distinct
+    // keys ran side by side.
+    printf("errors: %zu, overlap: %zu\n",
+           atomic_load(&g_keyed_errors), atomic_load(&g_keyed_overlap));
+    CU_ASSERT_EQUAL(0, atomic_load(&g_keyed_errors));
+    CU_ASSERT(1 < atomic_load(&g_keyed_overlap));
+    for (size_t key = 0; key < KEYED_KEYS; ++key)
+    {
+        CU_ASSERT_EQUAL(KEYED_PER_KEY, atomic_load(g_keyed_next + key));
+    }
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_keyed));
+}
+
+/*!
+ * @brief This function tests threadpool_enq_keyed in both modes.
+ */
+static void
+test_threadpool_keyed (void)
+{
+    run_keyed(THREADPOOL_MODE_SHARED);
+    run_keyed(THREADPOOL_MODE_STEAL);
+}
+
+/*!
+ * @brief This function reads the monotonic clock in milliseconds.
+ */
+static uint64_t
+now_ms (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000u) + ((uint64_t) now.tv_nsec / 1000000u);
+}
+
+/*!
+ * @brief This function waits up to a deadline for a counter to reach a
+ *          value, and returns its final value.
+ */
+static int
+await_count (_Atomic int * p_count, const int count, const uint64_t timeout_ms)
+{
+    uint64_t deadline = now_ms() + timeout_ms;
+    while ((atomic_load(p_count) < count) &&
+           (now_ms() < deadline))
+    {
+        usleep(1000);
+    }
+    return atomic_load(p_count);
+}
+
+/*!
+ * @brief This is a threadpool job that records when it ran.
+ */
+static _Atomic uint64_t g_fired_ms = 0;
+static void
+stamp (_Atomic bool * pb_shutdown, _Atomic int * p_count)
+{
+    (void) pb_shutdown;
+    atomic_store(&g_fired_ms, now_ms());
+    atomic_fetch_add(p_count, 1);
+}
+
+/*!
+ * @brief This function tests delayed and periodic jobs, and cancelling
+ *          them.
+ */
+#define TIMER_MANY 10000
+static void
+test_threadpool_timers (void)
+{
+    _Atomic int once = 0;
+    _Atomic int cancelled = 0;
+    _Atomic int every = 0;
+    _Atomic int many = 0;
+    threadpool_timer_t * p_timer = NULL;
+    threadpool_timer_t * p_periodic = NULL;
+    threadpool_t * p_timers = threadpool_create(2);
+    CU_ASSERT_PTR_NOT_NULL(p_timers);
+    if (NULL == p_timers)
+    {
+        return;
+    }
+
+    // Test bad parameters.
+    CU_ASSERT_EQUAL(-1, threadpool_enq_after(NULL, 1, (job_f) stamp, &once, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_enq_after(p_timers, 1, NULL, &once, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_enq_every(p_timers, 0, (job_f) stamp, &every, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_timer_cancel(NULL));
+
+    // Test a delayed job runs once, and not before its delay.
+    uint64_t start = now_ms();
+    CU_ASSERT_EQUAL(0, threadpool_enq_after(p_timers, 50, (job_f) stamp, &once, &p_timer));
+    CU_ASSERT_EQUAL(1, await_count(&once, 1, 5000));
+    CU_ASSERT(atomic_load(&g_fired_ms) >= (start + 50));
+    CU_ASSERT_EQUAL(-1, threadpool_timer_cancel(p_timer));
+
+    // Test a cancelled job never runs.
+    CU_ASSERT_EQUAL(0, threadpool_enq_after(p_timers, 30, (job_f) stamp, &cancelled, &p_timer));
+    CU_ASSERT_EQUAL(0, threadpool_timer_cancel(p_timer));
+
+    // Test a periodic job repeats until cancelled.
+    CU_ASSERT_EQUAL(0, threadpool_enq_every(p_timers, 10, (job_f) stamp, &every, &p_periodic));
+    CU_ASSERT(5 <= await_count(&every, 5, 5000));
+    CU_ASSERT_EQUAL(0, threadpool_timer_cancel(p_periodic));
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_timers));
+    int stopped = atomic_load(&every);
+    usleep(100000);
+    CU_ASSERT_EQUAL(stopped, atomic_load(&every));
+    CU_ASSERT_EQUAL(0, atomic_load(&cancelled));
+
+    // Test many timers, without handles, spread over several ticks.
+    for (size_t i = 0; i < TIMER_MANY; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq_after(p_timers, i % 100, (job_f) stamp, &many, NULL));
+    }
+    CU_ASSERT_EQUAL(TIMER_MANY, await_count(&many, TIMER_MANY, 10000));
+    CU_ASSERT_EQUAL(1, atomic_load(&once));
+    threadpool_stats_t stats;
+    CU_ASSERT_EQUAL(0, threadpool_stats_snapshot(p_timers, &stats));
+    CU_ASSERT_EQUAL(0, stats.timer_dropped);
+
+    // Test destroy discards pending timers.
+    CU_ASSERT_EQUAL(0, threadpool_enq_after(p_timers, 60000, (job_f) stamp, &cancelled, NULL));
+    CU_ASSERT_EQUAL(0, threadpool_enq_every(p_timers, 60000, (job_f) stamp, &cancelled, NULL));
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_timers));
+    CU_ASSERT_EQUAL(0, atomic_load(&cancelled));
+}
+
+/*!
+ * @brief This function waits up to a deadline for a pool's timer thread to
+ *          have dropped a number of jobs, and returns the final count.
+ */
+static uint64_t
+await_dropped (threadpool_t * p_tp, const uint64_t count, const uint64_t timeout_ms)
+{
+    threadpool_stats_t stats;
+    uint64_t deadline = now_ms() + timeout_ms;
+    do
+    {
+        memset(&stats, 0, sizeof(stats));
+        (void) threadpool_stats_snapshot(p_tp, &stats);
+        if (stats.timer_dropped >= count)
+        {
+            break;
+        }
+        usleep(1000);
+    } while (now_ms() < deadline);
+    return stats.timer_dropped;
+}
+
+/*!
+ * @brief This function tests timers keep firing on time while a bounded
+ *          queue is full, their jobs counted as dropped rather than
+ *          holding up the timer thread.
+ */
+static void
+test_threadpool_timer_full (void)
+{
+    _Atomic bool b_gate = false;
+    _Atomic int once = 0;
+    _Atomic int every = 0;
+    _Atomic int filler = 0;
+    threadpool_timer_t * p_periodic = NULL;
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.num_threads = 1;
+    attr.capacity = 1;
+    threadpool_t * p_full = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_full);
+    if (NULL == p_full)
+    {
+        return;
+    }
+
+    // Occupy the only thread, then fill the queue.
+    CU_ASSERT_EQUAL(0, threadpool_enq(p_full, (job_f) wait_gate, &b_gate));
+    usleep(200000);
+    CU_ASSERT_EQUAL(0, threadpool_try_enq(p_full, (job_f) inc, &filler));
+
+    // Test a one-shot timer finds the queue full, and a periodic timer
+    // behind it still fires every period.
+    uint64_t start = now_ms();
+    CU_ASSERT_EQUAL(0, threadpool_enq_after(p_full, 20, (job_f) stamp, &once, NULL));
+    CU_ASSERT_EQUAL(0, threadpool_enq_every(p_full, 30, (job_f) stamp, &every, &p_periodic));
+    CU_ASSERT(4 <= await_dropped(p_full, 4, 2000));
+    CU_ASSERT((now_ms() - start) < 1000);
+    CU_ASSERT_EQUAL(0, atomic_load(&once));
+    CU_ASSERT_EQUAL(0, atomic_load(&every));
+
+    // Test the periodic timer's jobs run again once there is room.
+    atomic_store(&b_gate, true);
+    CU_ASSERT(2 <= await_count(&every, 2, 5000));
+    CU_ASSERT_EQUAL(0, threadpool_timer_cancel(p_periodic));
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_full));
+    CU_ASSERT_EQUAL(1, atomic_load(&filler));
+    CU_ASSERT_EQUAL(0, atomic_load(&once));
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_full));
+}
+
+/*!
+ * @brief Parallel test parameters, and the number of times each index
+ *          was visited.
+ */
+#define PARALLEL_COUNT 1000003
+static unsigned char g_parallel_hits[PARALLEL_COUNT];
+static _Atomic int g_parallel_status = -1;
+
+/*!
+ * @brief This is a parallel loop body that visits every index of its
+ *          chunk.
+ */
+static void
+parallel_mark (size_t begin, size_t end, void * p_ctx)
+{
+    (void) p_ctx;
+    for (size_t i = begin; i < end; ++i)
+    {
+        g_parallel_hits[i]++;
+    }
+}
+
+/*!
+ * @brief This is a parallel reduction body that sums the indices of its
+ *          chunk.
+ */
+static void
+parallel_sum (size_t begin, size_t end, void * p_ctx, uint64_t * p_partial)
+{
+    (void) p_ctx;
+    for (size_t i = begin; i < end; ++i)
+    {
+        *p_partial += i;
+    }
+}
+
+/*!
+ * @brief This function combines two partial sums.
+ */
+static void
+parallel_add (uint64_t * p_result, const uint64_t * p_partial, void * p_ctx)
+{
+    (void) p_ctx;
+    *p_result += *p_partial;
+}
+
+/*!
+ * @brief This is a threadpool job that runs a parallel loop from one of
+ *          the threadpool's own threads.
+ */
+static void
+parallel_nested (_Atomic bool * pb_shutdown, threadpool_t * p_pool)
+{
+    (void) pb_shutdown;
+    atomic_store(&g_parallel_status,
+                 threadpool_parallel_for(p_pool, 0, PARALLEL_COUNT, 0, parallel_mark, NULL));
+}
+
+/*!
+ * @brief This function checks every index was visited exactly once, and
+ *          clears the visits.
+ */
+static size_t
+parallel_misses (void)
+{
+    size_t misses = 0;
+    for (size_t i = 0; i < PARALLEL_COUNT; ++i)
+    {
+        if (1 != g_parallel_hits[i])
+        {
+            misses++;
+        }
+    }
+    memset(g_parallel_hits, 0, sizeof(g_parallel_hits));
+    return misses;
+}
+
+/*!
+ * @brief This function runs parallel loops and reductions in the given
+ *          mode, from outside and inside the threadpool.
+ */
+static void
+run_parallel (const threadpool_mode_t mode)
+{
+    const size_t grains[] = {0, 1, 7, 1000, PARALLEL_COUNT, 2 * PARALLEL_COUNT};
+    const size_t num_grains = sizeof(grains) / sizeof(grains[0]);
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.num_threads = 4;
+    attr.mode = mode;
+    threadpool_t * p_pool = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_pool);
+    if (NULL == p_pool)
+    {
+        return;
+    }
+
+    // Test bad parameters.
+    uint64_t sum = 0;
+    CU_ASSERT_EQUAL(-1, threadpool_parallel_for(NULL, 0, 1, 0, parallel_mark, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_parallel_for(p_pool, 0, 1, 0, NULL, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_parallel_for(p_pool, 2, 1, 0, parallel_mark, NULL));
+    CU_ASSERT_EQUAL(-1, threadpool_parallel_reduce(p_pool, 0, 1, 0, NULL,
+                                                   (threadpool_combine_f) parallel_add,
+                                                   NULL, &sum, sizeof(sum)));
+    CU_ASSERT_EQUAL(-1, threadpool_parallel_reduce(p_pool, 0, 1, 0,
+                                                   (threadpool_reduce_f) parallel_sum, NULL,
+                                                   NULL, &sum, sizeof(sum)));
+    CU_ASSERT_EQUAL(-1, threadpool_parallel_reduce(p_pool, 0, 1, 0,
+                                                   (threadpool_reduce_f) parallel_sum,
+                                                   (threadpool_combine_f) parallel_add,
+                                                   NULL, NULL, sizeof(sum)));
+
+    // Test an empty range does nothing.
+    memset(g_parallel_hits, 0, sizeof(g_parallel_hits));
+    CU_ASSERT_EQUAL(0, threadpool_parallel_for(p_pool, 5, 5, 0, parallel_mark, NULL));
+    CU_ASSERT_EQUAL(0, g_parallel_hits[5]);
+
+    // Test every index is visited exactly once, whatever the grain, and
+    // the reduction matches the closed form.
+    const uint64_t expected = ((uint64_t) PARALLEL_COUNT * (PARALLEL_COUNT - 1)) / 2;
+    for (size_t i = 0; i < num_grains; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_parallel_for(p_pool, 0, PARALLEL_COUNT, grains[i],
+                                                   parallel_mark, NULL));
+        CU_ASSERT_EQUAL(0, parallel_misses());
+
+        sum = 0;
+        CU_ASSERT_EQUAL(0, threadpool_parallel_reduce(p_pool, 0, PARALLEL_COUNT, grains[i],
+                                                      (threadpool_reduce_f) parallel_sum,
+                                                      (threadpool_combine_f) parallel_add,
+                                                      NULL, &sum, sizeof(sum)));
+        CU_ASSERT_EQUAL(expected, sum);
+    }
+
+    // Test a range that does not start at 0.
+    sum = 0;
+    CU_ASSERT_EQUAL(0, threadpool_parallel_reduce(p_pool, 10, 20, 3,
+                                                  (threadpool_reduce_f) parallel_sum,
+                                                  (threadpool_combine_f) parallel_add,
+                                                  NULL, &sum, sizeof(sum)));
+    CU_ASSERT_EQUAL(145, sum);
+
+    // Test a parallel loop run from inside a job.
+    atomic_store(&g_parallel_status, -1);
+    CU_ASSERT_EQUAL(0, threadpool_enq(p_pool, (job_f) parallel_nested, p_pool));
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_pool));
+    CU_ASSERT_EQUAL(0, atomic_load(&g_parallel_status));
+    CU_ASSERT_EQUAL(0, parallel_misses());
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_pool));
+}
+
+/*!
+ * @brief This function tests threadpool_parallel_for and
+ *          threadpool_parallel_reduce in both modes.
+ */
+static void
+test_threadpool_parallel (void)
+{
+    run_parallel(THREADPOOL_MODE_SHARED);
+    run_parallel(THREADPOOL_MODE_STEAL);
+}
+
+/*!
+ * @brief This is a job that counts whether the thread running it may
+ *          only run on the given processor.
+ */
+static _Atomic size_t g_pinned = 0;
+static void
+pinned_job (_Atomic bool * pb_shutdown, int * p_cpu)
+{
+    (void) pb_shutdown;
+    cpu_set_t cpus;
+    if ((0 == pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus)) &&
+        (1 == CPU_COUNT(&cpus)) &&
+        (CPU_ISSET(*p_cpu, &cpus)))
+    {
+        atomic_fetch_add(&g_pinned, 1);
+    }
+}
+
+/*!
+ * @brief This function tests threads are pinned to the processor set in
+ *          the attributes.
+ */
+#define PINNED_JOBS 32
+static void
+test_threadpool_pinned (void)
+{
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    CU_ASSERT_EQUAL(THREADPOOL_CPU_ANY, attr.cpu);
+    attr.cpu = THREADPOOL_CPU_ANY - 1;
+    CU_ASSERT_PTR_NULL(threadpool_create_attr(&attr));
+    attr.cpu = CPU_SETSIZE;
+    CU_ASSERT_PTR_NULL(threadpool_create_attr(&attr));
+
+    // Pin to the first processor this process may run on.
+    cpu_set_t cpus;
+    CU_ASSERT_EQUAL(0, sched_getaffinity(0, sizeof(cpus), &cpus));
+    int cpu = 0;
+    while ((cpu < CPU_SETSIZE) && (!CPU_ISSET(cpu, &cpus)))
+    {
+        cpu++;
+    }
+    attr.cpu = cpu;
+    attr.num_threads = 3;
+    threadpool_t * p_pinned = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_pinned);
+    if (NULL == p_pinned)
+    {
+        return;
+    }
+
+    atomic_store(&g_pinned, 0);
+    for (size_t i = 0; i < PINNED_JOBS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(p_pinned, (job_f) pinned_job, &cpu));
+    }
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_pinned));
+    CU_ASSERT_EQUAL(PINNED_JOBS, atomic_load(&g_pinned));
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_pinned));
+}
+
+/*!
+ * @brief This function reads the number of running threads.
+ */
+static size_t
+running_threads (threadpool_t * p_pool)
+{
+    pthread_mutex_lock(&(p_pool->mutex));
+    size_t num_threads = p_pool->num_threads;
+    pthread_mutex_unlock(&(p_pool->mutex));
+    return num_threads;
+}
+
+/*!
+ * @brief This function polls until a threadpool runs a number of threads,
+ *          giving up after a few seconds.
+ */
+static bool
+await_threads (threadpool_t * p_pool, const size_t num_threads)
+{
+    for (size_t tries = 0; tries < 300; ++tries)
+    {
+        if (num_threads == running_threads(p_pool))
+        {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+/*!
+ * @brief This function tests an elastic threadpool in the given mode:
+ *          it grows while every thread is blocked and jobs pile up,
+ *          shrinks back to the minimum once idle, and follows resizes.
+ */
+#define ELASTIC_MAX 4
+static void
+run_elastic (const threadpool_mode_t mode)
+{
+    _Atomic bool b_gate = false;
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.mode = mode;
+    attr.num_threads = 1;
+    attr.max_threads = ELASTIC_MAX;
+    attr.idle_timeout_ms = 50;
+    attr.spawn_depth = 1;
+
+    threadpool_t * p_elastic = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(p_elastic);
+    if (NULL == p_elastic)
+    {
+        return;
+    }
+    CU_ASSERT_EQUAL(1, running_threads(p_elastic));
+
+    // Block every thread and let jobs pile up until the maximum is hit.
+    for (size_t tries = 0; tries < 300; ++tries)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(p_elastic, (job_f) wait_gate, &b_gate));
+        if (ELASTIC_MAX == running_threads(p_elastic))
+        {
+            break;
+        }
+        usleep(1000);
+    }
+    CU_ASSERT_EQUAL(ELASTIC_MAX, running_threads(p_elastic));
+
+    // Release the jobs. Idle threads above the minimum retire.
+    b_gate = true;
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_elastic));
+    CU_ASSERT_EQUAL(true, await_threads(p_elastic, 1));
+
+    // Test resize with bad parameters.
+    CU_ASSERT_EQUAL(-1, threadpool_resize(NULL, 1, 2));
+    CU_ASSERT_EQUAL(-1, threadpool_resize(p_elastic, 0, 2));
+    CU_ASSERT_EQUAL(-1, threadpool_resize(p_elastic, 3, 2));
+    CU_ASSERT_EQUAL(-1, threadpool_resize(p_elastic, 1, ELASTIC_MAX + 1));
+
+    // Growing the minimum spawns threads right away, and lowering the
+    // maximum retires them.
+    CU_ASSERT_EQUAL(0, threadpool_resize(p_elastic, 3, ELASTIC_MAX));
+    CU_ASSERT_EQUAL(3, running_threads(p_elastic));
+    CU_ASSERT_EQUAL(0, threadpool_resize(p_elastic, 2, 2));
+    CU_ASSERT_EQUAL(true, await_threads(p_elastic, 2));
+
+    // The threadpool still works after shrinking.
+    _Atomic int incr = 0;
+    for (size_t i = 0; i < INCR_ROUNDS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(p_elastic, (job_f) inc, &incr));
+    }
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_elastic));
+    CU_ASSERT_EQUAL(INCR_ROUNDS, incr);
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(p_elastic));
+}
+
+/*!
+ * @brief This function tests elastic sizing in both scheduling modes.
+ */
+static void
+test_threadpool_elastic (void)
+{
+    // Test a maximum below the minimum is rejected.
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.num_threads = 2;
+    attr.max_threads = 1;
+    CU_ASSERT_PTR_NULL(threadpool_create_attr(&attr));
+
+    run_elastic(THREADPOOL_MODE_SHARED);
+    run_elastic(THREADPOOL_MODE_STEAL);
+}
+
+/*!
+ * @brief This is a job that fans out into two child jobs until its depth
+ *          runs out, then counts a leaf. Children are submitted from a
+ *          pool thread, so in the work-stealing mode they land on that
+ *          thread's deque and are spread out by stealing.
+ */
+#define FANOUT_DEPTH 12
+static threadpool_t * gp_steal_tp = NULL;
+static _Atomic int g_leaves = 0;
+static void
+fan_out (_Atomic bool * pb_shutdown, void * p_depth)
+{
+    (void) pb_shutdown;
+    uintptr_t depth = (uintptr_t) p_depth;
+    if (0 == depth)
+    {
+        // Waiting for idle from inside the threadpool must be refused.
+        errno = 0;
+        CU_ASSERT_EQUAL(-1, threadpool_wait_idle(gp_steal_tp));
+        CU_ASSERT_EQUAL(EDEADLK, errno);
+        g_leaves++;
+        return;
+    }
+    job_t children[2] =
+    {
+        {.job_func = (job_f) fan_out, .p_arg = (void *) (depth - 1)},
+        {.job_func = (job_f) fan_out, .p_arg = (void *) (depth - 1)},
+    };
+
+    // Alternate between batch submission, and a single submission with
+    // the other child performed inline.
+    if (1 == (depth % 2))
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq_batch(gp_steal_tp, children, 2));
+    }
+    else
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(gp_steal_tp, (job_f) fan_out, (void *) (depth - 1)));
+        fan_out(pb_shutdown, (void *) (depth - 1));
+    }
+}
+
+/*!
+ * @brief This function tests the work-stealing mode with recursively
+ *          submitted jobs, from both outside and inside the pool.
+ */
+static void
+test_threadpool_steal (void)
+{
+    threadpool_attr_t attr;
+    CU_ASSERT_EQUAL(0, threadpool_attr_init(&attr));
+    attr.num_threads = NUM_THREADS;
+    attr.mode = THREADPOOL_MODE_STEAL;
+
+    // Test an unknown mode is rejected.
+    attr.mode = (threadpool_mode_t) 7;
+    CU_ASSERT_PTR_NULL(threadpool_create_attr(&attr));
+    attr.mode = THREADPOOL_MODE_STEAL;
+
+    gp_steal_tp = threadpool_create_attr(&attr);
+    CU_ASSERT_PTR_NOT_NULL(gp_steal_tp);
+    if (NULL == gp_steal_tp)
+    {
+        return;
+    }
+
+    // Every job either splits into two, or is a leaf.
+    _Atomic int incr = 0;
+    g_leaves = 0;
+    CU_ASSERT_EQUAL(0, threadpool_enq(gp_steal_tp, (job_f) fan_out, (void *) FANOUT_DEPTH));
+    for (size_t i = 0; i < INCR_ROUNDS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(gp_steal_tp, (job_f) inc, &incr));
+    }
+
+    // Wait for every job, including the ones submitted by jobs.
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(gp_steal_tp));
+
+    printf("leaves: %d, incr: %d\n", g_leaves, incr);
+    CU_ASSERT_EQUAL(1 << FANOUT_DEPTH, g_leaves);
+    CU_ASSERT_EQUAL(INCR_ROUNDS, incr);
+
+    CU_ASSERT_EQUAL(0, threadpool_destroy(gp_steal_tp));
+    gp_steal_tp = NULL;
+}
+
 int
 main ()
 {
@@ -91,6 +1291,25 @@ main ()
     CU_TestInfo tests[] =
     {
         {"threadpool increment test", test_threadpool_inc},
+        {"threadpool batch test", test_threadpool_batch},
+        {"threadpool handle test", test_threadpool_handles},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create standalone test battery array.
+    CU_TestInfo standalone_tests[] =
+    {
+        {"threadpool bounded queue test", test_threadpool_bounded},
+        {"threadpool work-stealing test", test_threadpool_steal},
+        {"threadpool elastic sizing test", test_threadpool_elastic},
+        {"threadpool priority lane test", test_threadpool_prio},
+        {"threadpool statistics test", test_threadpool_stats},
+        {"threadpool spin-then-park test", test_threadpool_spin},
+        {"threadpool keyed serial test", test_threadpool_keyed},
+        {"threadpool timer test", test_threadpool_timers},
+        {"threadpool full queue timer test", test_threadpool_timer_full},
+        {"threadpool parallel loop test", test_threadpool_parallel},
+        {"threadpool pinned threads test", test_threadpool_pinned},
         CU_TEST_INFO_NULL,
     };
 
@@ -98,6 +1317,7 @@ main ()
     CU_SuiteInfo suites[] =
     {
         {"threadpool test suite", test_threadpool_init, test_threadpool_clean, NULL, NULL, tests},
+        {"threadpool standalone suite", NULL, NULL, NULL, NULL, standalone_tests},
         CU_SUITE_INFO_NULL,
     };
 
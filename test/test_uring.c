@@ -0,0 +1,219 @@
+/*!
+ * @file test_uring.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          io_uring wrapper implemented in source/common/uring.h
+ *
+ *          Kernels without io_uring, or sandboxes that forbid it, skip
+ *              the tests that need a ring.
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../source/common/uring.h"
+
+/*!
+ * @brief This function creates a ring, or reports that io_uring is not
+ *          available and returns NULL.
+ */
+static uring_t *
+create_or_skip (const unsigned entries)
+{
+    uring_t * p_ring = uring_create(entries);
+    if (NULL == p_ring)
+    {
+        printf("io_uring unavailable (%s), skipping\n", strerror(errno));
+    }
+    return p_ring;
+}
+
+/*!
+ * @brief This function tests submitting operations and reaping their
+ *          completions.
+ */
+void
+test_uring_submit (void)
+{
+    // Test bad parameters.
+    CU_ASSERT_PTR_NULL(uring_create(0));
+    CU_ASSERT_PTR_NULL(uring_get_sqe(NULL));
+    CU_ASSERT_EQUAL(-1, uring_submit(NULL, 0));
+    CU_ASSERT_PTR_NULL(uring_peek_cqe(NULL));
+    uring_cqe_seen(NULL);
+    uring_destroy(NULL);
+
+    uring_t * p_ring = create_or_skip(8);
+    if (NULL == p_ring)
+    {
+        return;
+    }
+    CU_ASSERT_PTR_NULL(uring_peek_cqe(p_ring));
+    CU_ASSERT_EQUAL(0, uring_submit(p_ring, 0));
+
+    // Test the submission queue fills up, and one submit takes every
+    // queued entry.
+    size_t queued = 0;
+    struct io_uring_sqe * p_sqe = NULL;
+    while (NULL != (p_sqe = uring_get_sqe(p_ring)))
+    {
+        p_sqe->opcode = IORING_OP_NOP;
+        p_sqe->user_data = 100 + queued;
+        queued++;
+    }
+    CU_ASSERT_EQUAL(8, queued);
+    CU_ASSERT_EQUAL(8, uring_submit(p_ring, 8));
+
+    // Test completions come back in order with their user data.
+    for (size_t i = 0; i < queued; ++i)
+    {
+        struct io_uring_cqe * p_cqe = uring_peek_cqe(p_ring);
+        CU_ASSERT_PTR_NOT_NULL(p_cqe);
+        if (NULL == p_cqe)
+        {
+            break;
+        }
+        CU_ASSERT_EQUAL(100 + i, p_cqe->user_data);
+        CU_ASSERT_EQUAL(0, p_cqe->res);
+        uring_cqe_seen(p_ring);
+    }
+    CU_ASSERT_PTR_NULL(uring_peek_cqe(p_ring));
+
+    // Test there is room again after the submit.
+    CU_ASSERT_PTR_NOT_NULL(uring_get_sqe(p_ring));
+
+    uring_destroy(p_ring);
+}
+
+/*!
+ * @brief This function tests receives that select from a provided
+ *          buffer ring, over more receives than there are buffers.
+ */
+#define BUFS_COUNT 4
+#define BUFS_SIZE 16
+#define BUFS_ROUNDS 20
+void
+test_uring_bufs (void)
+{
+    CU_ASSERT_PTR_NULL(uring_bufs_create(NULL, 0, BUFS_COUNT, BUFS_SIZE));
+    CU_ASSERT_PTR_NULL(uring_bufs_get(NULL, 0));
+    CU_ASSERT_EQUAL(-1, uring_bufs_recycle(NULL, 0));
+    uring_bufs_destroy(NULL);
+
+    uring_t * p_ring = create_or_skip(8);
+    if (NULL == p_ring)
+    {
+        return;
+    }
+    CU_ASSERT_PTR_NULL(uring_bufs_create(p_ring, 0, 3, BUFS_SIZE));
+    CU_ASSERT_PTR_NULL(uring_bufs_create(p_ring, 0, BUFS_COUNT, 0));
+    uring_bufs_t * p_bufs = uring_bufs_create(p_ring, 7, BUFS_COUNT, BUFS_SIZE);
+    CU_ASSERT_PTR_NOT_NULL(p_bufs);
+    int fds[2];
+    CU_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    if (NULL == p_bufs)
+    {
+        uring_destroy(p_ring);
+        return;
+    }
+    CU_ASSERT_PTR_NULL(uring_bufs_get(p_bufs, BUFS_COUNT));
+    CU_ASSERT_EQUAL(-1, uring_bufs_recycle(p_bufs, BUFS_COUNT));
+
+    for (size_t round = 0; round < BUFS_ROUNDS; ++round)
+    {
+        char message[BUFS_SIZE];
+        snprintf(message, sizeof(message), "round %zu", round);
+        size_t len = strlen(message);
+        CU_ASSERT_EQUAL((ssize_t) len, write(fds[1], message, len));
+
+        struct io_uring_sqe * p_sqe = uring_get_sqe(p_ring);
+        CU_ASSERT_PTR_NOT_NULL(p_sqe);
+        if (NULL == p_sqe)
+        {
+            break;
+        }
+        p_sqe->opcode = IORING_OP_RECV;
+        p_sqe->fd = fds[0];
+        p_sqe->len = BUFS_SIZE;
+        p_sqe->flags = IOSQE_BUFFER_SELECT;
+        p_sqe->buf_group = 7;
+        CU_ASSERT_EQUAL(1, uring_submit(p_ring, 1));
+
+        struct io_uring_cqe * p_cqe = uring_peek_cqe(p_ring);
+        CU_ASSERT_PTR_NOT_NULL(p_cqe);
+        if (NULL == p_cqe)
+        {
+            break;
+        }
+        CU_ASSERT_EQUAL((int) len, p_cqe->res);
+        CU_ASSERT(0 != (p_cqe->flags & IORING_CQE_F_BUFFER));
+        uint16_t bid = (uint16_t) (p_cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        uring_cqe_seen(p_ring);
+
+        // Test the data landed in the selected buffer, which is then
+        // given back so the ring never runs dry.
+        unsigned char * p_buf = uring_bufs_get(p_bufs, bid);
+        CU_ASSERT_PTR_NOT_NULL(p_buf);
+        if (NULL != p_buf)
+        {
+            CU_ASSERT_EQUAL(0, memcmp(p_buf, message, len));
+        }
+        CU_ASSERT_EQUAL(0, uring_bufs_recycle(p_bufs, bid));
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    uring_bufs_destroy(p_bufs);
+    uring_destroy(p_ring);
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"uring submit test", test_uring_submit},
+        {"uring provided buffers test", test_uring_bufs},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"uring test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
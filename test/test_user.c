@@ -0,0 +1,604 @@
+/*!
+ * @file test_user.c
+ *
+ * @brief This file contains a self-contained test battery for the user
+ *          index implemented in source/server/user.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../source/server/user.h"
+
+/*!
+ * @brief This function names the user with a given number.
+ */
+static void
+make_name (char * p_name, const size_t num)
+{
+    snprintf(p_name, USER_STR_SIZE, "user%zu", num);
+}
+
+/*!
+ * @brief This function tests registering, logging in, finding and
+ *          deleting users, and bad parameters.
+ */
+void
+test_user_basic (void)
+{
+    uint32_t id = 0;
+    uint32_t other = 0;
+
+    // Test bad parameters.
+    CU_ASSERT_PTR_NULL(user_index_create(SIZE_MAX));
+    CU_ASSERT_EQUAL(-1, user_register(NULL, "alice", "pw", &id));
+    CU_ASSERT_EQUAL(-1, user_delete(NULL, "alice"));
+    CU_ASSERT_EQUAL(-1, user_login(NULL, "alice", "pw", &id));
+    CU_ASSERT_EQUAL(-1, user_find(NULL, "alice", &id));
+    CU_ASSERT_EQUAL(0, user_count(NULL));
+    user_index_destroy(NULL);
+
+    user_index_t * p_index = user_index_create(0);
+    CU_ASSERT_PTR_NOT_NULL(p_index);
+    if (NULL == p_index)
+    {
+        return;
+    }
+
+    // Test strings must be non-empty and within config.h's limits.
+    char longest[USER_STR_SIZE + 1];
+    memset(longest, 'a', USER_STR_SIZE);
+    longest[USER_DB_UNAME_MAX] = '\0';
+    char longest_pw[USER_STR_SIZE + 1];
+    memset(longest_pw, 'p', USER_STR_SIZE);
+    longest_pw[USER_DB_PWORD_MAX] = '\0';
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, user_register(p_index, "", "pw", &id));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+    CU_ASSERT_EQUAL(-1, user_register(p_index, "alice", "", &id));
+    CU_ASSERT_EQUAL(-1, user_register(p_index, "alice", NULL, &id));
+    CU_ASSERT_EQUAL(0, user_register(p_index, longest, longest_pw, &id));
+    CU_ASSERT_EQUAL(0, user_login(p_index, longest, longest_pw, NULL));
+    longest[USER_DB_UNAME_MAX] = 'a';
+    longest_pw[USER_DB_PWORD_MAX] = 'p';
+    CU_ASSERT_EQUAL(-1, user_register(p_index, longest, "pw", &id));
+    CU_ASSERT_EQUAL(-1, user_register(p_index, "bob", longest_pw, &id));
+    CU_ASSERT_EQUAL(-1, user_restore(p_index, longest, "pw", 9));
+    CU_ASSERT_EQUAL(-1, user_login(p_index, longest, "pw", &id));
+    longest[USER_STR_SIZE - 1] = 'a';
+    longest[USER_STR_SIZE] = '\0';
+    CU_ASSERT_EQUAL(-1, user_register(p_index, longest, "pw", &id));
+    CU_ASSERT_EQUAL(1, user_count(p_index));
+
+    // Test a username is only registered once, and ids are not reused.
+    CU_ASSERT_EQUAL(0, user_register(p_index, "alice", "secret", &id));
+    CU_ASSERT_EQUAL(2, id);
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, user_register(p_index, "alice", "other", &other));
+    CU_ASSERT_EQUAL(EEXIST, errno);
+    CU_ASSERT_EQUAL(0, user_register(p_index, "bob", "hunter2", NULL));
+    CU_ASSERT_EQUAL(3, user_count(p_index));
+
+    // Test logins check the password, and tell the two failures apart.
+    CU_ASSERT_EQUAL(0, user_login(p_index, "alice", "secret", &other));
+    CU_ASSERT_EQUAL(id, other);
+    CU_ASSERT_EQUAL(0, user_login(p_index, "bob", "hunter2", NULL));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, user_login(p_index, "alice", "secre", &other));
+    CU_ASSERT_EQUAL(EACCES, errno);
+    CU_ASSERT_EQUAL(-1, user_login(p_index, "alice", "secrets", &other));
+    CU_ASSERT_EQUAL(-1, user_login(p_index, "alice", "hunter2", &other));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, user_login(p_index, "carol", "secret", &other));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+    CU_ASSERT_EQUAL(0, user_find(p_index, "alice", &other));
+    CU_ASSERT_EQUAL(id, other);
+    CU_ASSERT_EQUAL(-1, user_find(p_index, "alic", &other));
+
+    // Test a deleted user is gone, and the name can be registered again.
+    CU_ASSERT_EQUAL(0, user_delete(p_index, "alice"));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, user_delete(p_index, "alice"));
+    CU_ASSERT_EQUAL(ENOENT, errno);
+    CU_ASSERT_EQUAL(-1, user_login(p_index, "alice", "secret", &other));
+    CU_ASSERT_EQUAL(2, user_count(p_index));
+    CU_ASSERT_EQUAL(0, user_register(p_index, "alice", "new", &other));
+    CU_ASSERT_NOT_EQUAL(id, other);
+    CU_ASSERT_EQUAL(0, user_login(p_index, "alice", "new", NULL));
+
+    user_index_destroy(p_index);
+}
+
+/*!
+ * @brief This datatype records what an index hands its log function.
+ *
+ * @param p_index The index, read back from inside the call.
+ * @param calls The number of calls.
+ * @param entry The last call's entry.
+ * @param b_deleted The last call's deletion flag.
+ * @param live The number of users in the index as the call saw it.
+ * @param b_fail Whether to fail the calls.
+ */
+typedef struct _log_record
+{
+    user_index_t * p_index;
+    size_t         calls;
+    user_entry_t   entry;
+    bool           b_deleted;
+    size_t         live;
+    bool           b_fail;
+} log_record_t;
+
+/*!
+ * @brief This function records a change handed to the log. It is a
+ *          user_log_f. The index's lock is held, so the number of users
+ *          is read from the tables directly.
+ */
+static int
+record_log (const user_entry_t * p_entry, const bool b_deleted, void * p_ctx)
+{
+    log_record_t * p_record = p_ctx;
+    p_record->calls++;
+    p_record->entry = *p_entry;
+    p_record->b_deleted = b_deleted;
+    p_record->live = p_record->p_index->table.num_live + p_record->p_index->old.num_live;
+    if (true == p_record->b_fail)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief Log test parameters.
+ */
+#define LOG_USERS 1000
+
+/*!
+ * @brief This function tests the log function sees every registration
+ *          and deletion before it is made, while entries are being moved
+ *          too, and that one it fails is not made.
+ */
+void
+test_user_log (void)
+{
+    char name[USER_STR_SIZE];
+    uint32_t id = 0;
+    log_record_t record;
+    memset(&record, 0, sizeof(record));
+
+    CU_ASSERT_EQUAL(-1, user_index_set_log(NULL, record_log, &record));
+    user_index_t * p_index = user_index_create(0);
+    CU_ASSERT_PTR_NOT_NULL(p_index);
+    if (NULL == p_index)
+    {
+        return;
+    }
+    record.p_index = p_index;
+    CU_ASSERT_EQUAL(0, user_index_set_log(p_index, record_log, &record));
+
+    // Test a registration is logged with the id it is about to get.
+    CU_ASSERT_EQUAL(0, user_register(p_index, "alice", "secret", &id));
+    CU_ASSERT_EQUAL(1, record.calls);
+    CU_ASSERT_EQUAL(false, record.b_deleted);
+    CU_ASSERT_EQUAL(id, record.entry.id);
+    CU_ASSERT_EQUAL(0, strcmp(record.entry.username, "alice"));
+    CU_ASSERT_EQUAL(0, strcmp(record.entry.password, "secret"));
+    CU_ASSERT_EQUAL(0, record.live);
+    CU_ASSERT_EQUAL(-1, user_register(p_index, "alice", "other", NULL));
+    CU_ASSERT_EQUAL(-1, user_delete(p_index, "bob"));
+    CU_ASSERT_EQUAL(1, record.calls);
+
+    // Test a change the log fails is not made, keeps its errno, and uses
+    // up no id.
+    record.b_fail = true;
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, user_register(p_index, "bob", "pw", NULL));
+    CU_ASSERT_EQUAL(EIO, errno);
+    CU_ASSERT_EQUAL(-1, user_delete(p_index, "alice"));
+    CU_ASSERT_EQUAL(3, record.calls);
+    CU_ASSERT_EQUAL(0, user_login(p_index, "alice", "secret", NULL));
+    CU_ASSERT_EQUAL(-1, user_find(p_index, "bob", NULL));
+    CU_ASSERT_EQUAL(id + 1, user_next_id(p_index));
+    record.b_fail = false;
+
+    // Test deletions are logged with the user's entry before it goes,
+    // wherever the entry is while the index grows.
+    CU_ASSERT_EQUAL(0, user_delete(p_index, "alice"));
+    CU_ASSERT_EQUAL(true, record.b_deleted);
+    CU_ASSERT_EQUAL(id, record.entry.id);
+    CU_ASSERT_EQUAL(1, record.live);
+    for (size_t idx = 0; idx < LOG_USERS; ++idx)
+    {
+        make_name(name, idx);
+        CU_ASSERT_EQUAL(0, user_register(p_index, name, "pw", NULL));
+    }
+    record.calls = 0;
+    for (size_t idx = 0; idx < LOG_USERS; ++idx)
+    {
+        make_name(name, idx);
+        CU_ASSERT_EQUAL(0, user_find(p_index, name, &id));
+        CU_ASSERT_EQUAL(0, user_delete(p_index, name));
+        CU_ASSERT_EQUAL(true, record.b_deleted);
+        CU_ASSERT_EQUAL(id, record.entry.id);
+        CU_ASSERT_EQUAL(0, strcmp(record.entry.username, name));
+        CU_ASSERT_EQUAL(LOG_USERS - idx, record.live);
+    }
+    CU_ASSERT_EQUAL(LOG_USERS, record.calls);
+
+    // Test restoring is not logged, nor anything once the log function
+    // is cleared.
+    record.calls = 0;
+    CU_ASSERT_EQUAL(0, user_restore(p_index, "carol", "pw", 5000));
+    CU_ASSERT_EQUAL(0, user_index_set_log(p_index, NULL, NULL));
+    CU_ASSERT_EQUAL(0, user_register(p_index, "dave", "pw", NULL));
+    CU_ASSERT_EQUAL(0, user_delete(p_index, "carol"));
+    CU_ASSERT_EQUAL(0, record.calls);
+
+    user_index_destroy(p_index);
+}
+
+/*!
+ * @brief Growth test parameters.
+ */
+#define GROW_USERS 200000
+
+/*!
+ * @brief This function tests the index grows a few slots at a time, and
+ *          every user stays reachable while entries are moved.
+ */
+void
+test_user_grow (void)
+{
+    user_index_t * p_index = user_index_create(0);
+    CU_ASSERT_PTR_NOT_NULL(p_index);
+    if (NULL == p_index)
+    {
+        return;
+    }
+
+    char name[USER_STR_SIZE];
+    size_t errors = 0;
+    size_t moves = 0;
+    size_t max_step = 0;
+    for (size_t num = 0; num < GROW_USERS; ++num)
+    {
+        size_t old_pos = p_index->migrate_pos;
+        bool b_moving = (0 != p_index->old.capacity);
+        make_name(name, num);
+        uint32_t id = 0;
+        if ((0 != user_register(p_index, name, name, &id)) ||
+            ((num + 1) != id))
+        {
+            errors++;
+        }
+
+        // Test no write moves more than its share of the old table.
+        if ((true == b_moving) &&
+            (0 != p_index->migrate_pos) &&
+            ((p_index->migrate_pos - old_pos) > max_step))
+        {
+            max_step = p_index->migrate_pos - old_pos;
+        }
+        if ((false == b_moving) &&
+            (0 != p_index->old.capacity))
+        {
+            moves++;
+
+            // Test users are found in both tables while a move is under
+            // way.
+            for (size_t check = 0; check <= num; check += (num / 64) + 1)
+            {
+                make_name(name, check);
+                if (0 != user_login(p_index, name, name, &id))
+                {
+                    errors++;
+                }
+            }
+        }
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT(moves >= 10);
+    CU_ASSERT(max_step <= USER_MIGRATE_SLOTS);
+    CU_ASSERT_EQUAL(GROW_USERS, user_count(p_index));
+
+    // Test every user is found with its own id.
+    for (size_t num = 0; num < GROW_USERS; ++num)
+    {
+        uint32_t id = 0;
+        make_name(name, num);
+        if ((0 != user_find(p_index, name, &id)) ||
+            ((num + 1) != id))
+        {
+            errors++;
+        }
+    }
+    CU_ASSERT_EQUAL(0, errors);
+
+    // Test deleting half the users leaves the other half.
+    for (size_t num = 0; num < GROW_USERS; num += 2)
+    {
+        make_name(name, num);
+        if (0 != user_delete(p_index, name))
+        {
+            errors++;
+        }
+    }
+    for (size_t num = 0; num < GROW_USERS; ++num)
+    {
+        make_name(name, num);
+        if ((0 == (num % 2)) != (-1 == user_find(p_index, name, NULL)))
+        {
+            errors++;
+        }
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(GROW_USERS / 2, user_count(p_index));
+
+    user_index_destroy(p_index);
+}
+
+/*!
+ * @brief Churn test parameters.
+ */
+#define CHURN_NAMES 512
+#define CHURN_ROUNDS 400000
+
+/*!
+ * @brief This function tests random registers and deletes against a
+ *          model, so deleted slots pile up and are cleared by rehashing
+ *          without the table growing past what its users need.
+ */
+void
+test_user_churn (void)
+{
+    user_index_t * p_index = user_index_create(CHURN_NAMES);
+    CU_ASSERT_PTR_NOT_NULL(p_index);
+    if (NULL == p_index)
+    {
+        return;
+    }
+
+    bool b_present[CHURN_NAMES];
+    memset(b_present, 0, sizeof(b_present));
+    size_t num_present = 0;
+    size_t errors = 0;
+    size_t max_capacity = 0;
+    uint64_t state = 88172645463325252u;
+    char name[USER_STR_SIZE];
+    for (size_t round = 0; round < CHURN_ROUNDS; ++round)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t num = state % CHURN_NAMES;
+        make_name(name, num);
+        if (0 == (state & 0x100))
+        {
+            int ret = user_register(p_index, name, "pw", NULL);
+            if ((0 == ret) == b_present[num])
+            {
+                errors++;
+            }
+            if (0 == ret)
+            {
+                b_present[num] = true;
+                num_present++;
+            }
+        }
+        else
+        {
+            int ret = user_delete(p_index, name);
+            if ((0 == ret) != b_present[num])
+            {
+                errors++;
+            }
+            if (0 == ret)
+            {
+                b_present[num] = false;
+                num_present--;
+            }
+        }
+        if (p_index->table.capacity > max_capacity)
+        {
+            max_capacity = p_index->table.capacity;
+        }
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(num_present, user_count(p_index));
+    CU_ASSERT(max_capacity <= (4 * CHURN_NAMES));
+    for (size_t num = 0; num < CHURN_NAMES; ++num)
+    {
+        make_name(name, num);
+        if ((0 == user_login(p_index, name, "pw", NULL)) != b_present[num])
+        {
+            errors++;
+        }
+    }
+    CU_ASSERT_EQUAL(0, errors);
+
+    user_index_destroy(p_index);
+}
+
+/*!
+ * @brief Concurrency test parameters.
+ */
+#define CONC_READERS 3
+#define CONC_FIXED 1000
+#define CONC_WRITES 50000
+
+static user_index_t * gp_conc_index = NULL;
+static _Atomic bool gb_conc_done = false;
+static _Atomic size_t g_conc_walks = 0;
+
+/*!
+ * @brief This function logs the fixed users in until the writer is done,
+ *          counting any login that fails.
+ */
+static void *
+conc_reader (void * p_arg)
+{
+    (void) p_arg;
+    size_t errors = 0;
+    char name[USER_STR_SIZE];
+    size_t num = 0;
+    while (false == atomic_load(&gb_conc_done))
+    {
+        uint32_t id = 0;
+        make_name(name, num);
+        if ((0 != user_login(gp_conc_index, name, name, &id)) ||
+            ((num + 1) != id))
+        {
+            errors++;
+        }
+        num = (num + 1) % CONC_FIXED;
+    }
+    return (void *) errors;
+}
+
+/*!
+ * @brief This function marks a fixed user as seen by a walk. It is a
+ *          user_visit_f.
+ */
+static int
+conc_mark (const user_entry_t * p_entry, void * p_ctx)
+{
+    bool * p_seen = p_ctx;
+    if ((p_entry->id >= 1) &&
+        (p_entry->id <= CONC_FIXED))
+    {
+        p_seen[p_entry->id - 1] = true;
+    }
+    return 0;
+}
+
+/*!
+ * @brief This function walks the index until the writer is done,
+ *          counting every fixed user a walk misses.
+ */
+static void *
+conc_walker (void * p_arg)
+{
+    (void) p_arg;
+    size_t errors = 0;
+    bool seen[CONC_FIXED];
+    while (false == atomic_load(&gb_conc_done))
+    {
+        memset(seen, 0, sizeof(seen));
+        errors += (0 != user_foreach(gp_conc_index, conc_mark, seen));
+        for (size_t num = 0; num < CONC_FIXED; ++num)
+        {
+            errors += (false == seen[num]);
+        }
+        atomic_fetch_add(&g_conc_walks, 1);
+    }
+    return (void *) errors;
+}
+
+/*!
+ * @brief This function tests logins and walks by several threads while
+ *          another registers users, growing the index under them.
+ */
+void
+test_user_concurrent (void)
+{
+    gp_conc_index = user_index_create(0);
+    CU_ASSERT_PTR_NOT_NULL(gp_conc_index);
+    if (NULL == gp_conc_index)
+    {
+        return;
+    }
+    char name[USER_STR_SIZE];
+    for (size_t num = 0; num < CONC_FIXED; ++num)
+    {
+        make_name(name, num);
+        CU_ASSERT_EQUAL(0, user_register(gp_conc_index, name, name, NULL));
+    }
+
+    atomic_store(&gb_conc_done, false);
+    atomic_store(&g_conc_walks, 0);
+    pthread_t readers[CONC_READERS];
+    for (size_t i = 0; i < CONC_READERS; ++i)
+    {
+        CU_ASSERT_EQUAL(0, pthread_create(readers + i, NULL,
+                                          (0 == i) ? conc_walker : conc_reader, NULL));
+    }
+    size_t errors = 0;
+    for (size_t num = CONC_FIXED; num < (CONC_FIXED + CONC_WRITES); ++num)
+    {
+        make_name(name, num);
+        if (0 != user_register(gp_conc_index, name, name, NULL))
+        {
+            errors++;
+        }
+    }
+    atomic_store(&gb_conc_done, true);
+    for (size_t i = 0; i < CONC_READERS; ++i)
+    {
+        void * p_errors = NULL;
+        pthread_join(readers[i], &p_errors);
+        errors += (size_t) p_errors;
+    }
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT(atomic_load(&g_conc_walks) > 0);
+    CU_ASSERT_EQUAL(CONC_FIXED + CONC_WRITES, user_count(gp_conc_index));
+
+    user_index_destroy(gp_conc_index);
+    gp_conc_index = NULL;
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"user basic test", test_user_basic},
+        {"user log test", test_user_log},
+        {"user grow test", test_user_grow},
+        {"user churn test", test_user_churn},
+        {"user concurrent test", test_user_concurrent},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"user test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
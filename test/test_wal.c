@@ -0,0 +1,686 @@
+/*!
+ * @file test_wal.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          write-ahead log implemented in source/server/wal.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <errno.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../source/server/wal.h"
+#include "../source/common/threadpool.h"
+
+/*!
+ * @brief The size of a log path.
+ */
+#define PATH_SIZE 64
+
+/*!
+ * @brief This is a helper function that counts a log's segments, and
+ *          removes them if told to.
+ */
+static size_t
+remove_log (const char * p_path, const bool b_remove)
+{
+    char pattern[PATH_SIZE + 4];
+    snprintf(pattern, sizeof(pattern), "%s.*", p_path);
+    size_t count = 0;
+    glob_t found;
+    if (0 == glob(pattern, 0, NULL, &found))
+    {
+        count = found.gl_pathc;
+        for (size_t idx = 0; (true == b_remove) && (idx < count); ++idx)
+        {
+            unlink(found.gl_pathv[idx]);
+        }
+        globfree(&found);
+    }
+    return count;
+}
+
+/*!
+ * @brief This is a helper function that makes a log path unique to this
+ *          process, and removes any segment left at it.
+ */
+static void
+make_path (char * p_path)
+{
+    snprintf(p_path, PATH_SIZE, "/tmp/bank_test_wal_%d.log", (int) getpid());
+    remove_log(p_path, true);
+}
+
+/*!
+ * @brief This is a helper function that builds the path of the segment
+ *          starting at a sequence number.
+ */
+static void
+segment_path (char * p_buf, const char * p_path, const uint64_t first_lsn)
+{
+    snprintf(p_buf, PATH_SIZE, "%s.%016llx", p_path, (unsigned long long) first_lsn);
+}
+
+/*!
+ * @brief This is a helper function that returns the monotonic time.
+ */
+static uint64_t
+now_ns (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000u) + (uint64_t) now.tv_nsec;
+}
+
+/*!
+ * @brief This datatype defines what a replay has seen.
+ *
+ * @param count The number of records handed over.
+ * @param first The first record's sequence number.
+ * @param last The last record's sequence number.
+ * @param errors Records whose payload did not match their number.
+ */
+typedef struct _replay_seen
+{
+    size_t   count;
+    uint64_t first;
+    uint64_t last;
+    size_t   errors;
+} replay_seen_t;
+
+/*!
+ * @brief This is a helper function that writes a payload derived from a
+ *          tag, of a length derived from it too.
+ */
+static size_t
+make_payload (unsigned char * p_buf, const uint64_t tag)
+{
+    size_t len = (size_t) (1 + (tag % 200));
+    for (size_t idx = 0; idx < len; ++idx)
+    {
+        p_buf[idx] = (unsigned char) (tag + idx);
+    }
+    return len;
+}
+
+/*!
+ * @brief This is a replay function that checks each payload was made
+ *          from its own sequence number.
+ */
+static int
+replay_check (const uint64_t lsn, const void * p_data, const size_t len, void * p_ctx)
+{
+    replay_seen_t * p_seen = p_ctx;
+    unsigned char expected[WAL_MAX_RECORD];
+    size_t expected_len = make_payload(expected, lsn);
+    if ((expected_len != len) ||
+        (0 != memcmp(expected, p_data, len)))
+    {
+        p_seen->errors++;
+    }
+    if (0 == p_seen->count)
+    {
+        p_seen->first = lsn;
+    }
+    p_seen->last = lsn;
+    p_seen->count++;
+    return 0;
+}
+
+/*!
+ * @brief This is a replay function that fails at the third record.
+ */
+static int
+replay_fail (const uint64_t lsn, const void * p_data, const size_t len, void * p_ctx)
+{
+    (void) p_data;
+    (void) len;
+    (void) p_ctx;
+    return (3 == lsn) ? -1 : 0;
+}
+
+/*!
+ * @brief This function tests appending, committing, replaying and
+ *          reopening a log, and bad parameters.
+ */
+void
+test_wal_basic (void)
+{
+    char path[PATH_SIZE];
+    make_path(path);
+    unsigned char payload[WAL_MAX_RECORD + 1] = {0};
+    uint64_t lsn = 0;
+
+    // Test the checksum against the standard check value.
+    CU_ASSERT_EQUAL(0xE3069283u, wal_checksum(0, "123456789", 9));
+    CU_ASSERT_EQUAL(0xE3069283u, wal_checksum(wal_checksum(0, "1234", 4), "56789", 5));
+
+    // Test bad parameters.
+    wal_attr_t attr;
+    CU_ASSERT_EQUAL(-1, wal_attr_init(NULL));
+    CU_ASSERT_EQUAL(0, wal_attr_init(&attr));
+    CU_ASSERT_EQUAL(WAL_DEFAULT_BUF_SIZE, attr.buf_size);
+    CU_ASSERT_PTR_NULL(wal_open(NULL, &attr));
+    CU_ASSERT_PTR_NULL(wal_open(path, NULL));
+    attr.buf_size = WAL_MAX_RECORD;
+    CU_ASSERT_PTR_NULL(wal_open(path, &attr));
+    attr.buf_size = WAL_DEFAULT_BUF_SIZE;
+    attr.max_batch = 0;
+    CU_ASSERT_PTR_NULL(wal_open(path, &attr));
+    attr.max_batch = WAL_DEFAULT_BUF_SIZE + 1;
+    errno = 0;
+    CU_ASSERT_PTR_NULL(wal_open(path, &attr));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+    attr.max_batch = WAL_DEFAULT_MAX_BATCH;
+    attr.segment_size = 0;
+    CU_ASSERT_PTR_NULL(wal_open(path, &attr));
+    attr.segment_size = WAL_DEFAULT_SEGMENT_SIZE;
+    CU_ASSERT_EQUAL(-1, wal_close(NULL));
+    CU_ASSERT_EQUAL(-1, wal_append(NULL, payload, 1, &lsn));
+    CU_ASSERT_EQUAL(-1, wal_commit(NULL, 1));
+    CU_ASSERT_EQUAL(-1, wal_replay(NULL, 0, NULL, NULL, NULL));
+    CU_ASSERT_EQUAL(-1, wal_truncate(NULL, 1));
+
+    // Test a missing log replays as empty.
+    replay_seen_t seen = {0};
+    lsn = 99;
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(0, seen.count);
+    CU_ASSERT_EQUAL(0, lsn);
+
+    wal_t * p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+    CU_ASSERT_EQUAL(-1, wal_append(p_wal, payload, 0, &lsn));
+    CU_ASSERT_EQUAL(-1, wal_append(p_wal, payload, WAL_MAX_RECORD + 1, &lsn));
+    CU_ASSERT_EQUAL(-1, wal_append(p_wal, NULL, 1, &lsn));
+    CU_ASSERT_EQUAL(-1, wal_append(p_wal, payload, 1, NULL));
+    CU_ASSERT_EQUAL(-1, wal_commit(p_wal, 0));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, wal_commit(p_wal, 1));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+
+    // Test records are numbered from 1 and durable once committed.
+    for (uint64_t expected = 1; expected <= 20; ++expected)
+    {
+        size_t len = make_payload(payload, expected);
+        CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+        CU_ASSERT_EQUAL(expected, lsn);
+    }
+    CU_ASSERT_EQUAL(0, wal_commit(p_wal, 20));
+    CU_ASSERT_EQUAL(0, wal_commit(p_wal, 5));
+    wal_stats_t stats;
+    CU_ASSERT_EQUAL(-1, wal_stats_snapshot(p_wal, NULL));
+    CU_ASSERT_EQUAL(0, wal_stats_snapshot(p_wal, &stats));
+    CU_ASSERT_EQUAL(20, stats.records);
+    CU_ASSERT_EQUAL(20, stats.durable);
+    CU_ASSERT(stats.batches >= 1);
+    CU_ASSERT(stats.batches <= 20);
+    uint64_t commits = 0;
+    for (size_t idx = 0; idx < WAL_HIST_BUCKETS; ++idx)
+    {
+        commits += stats.commit_hist[idx];
+    }
+    CU_ASSERT_EQUAL(2, commits);
+
+    // Test close makes records that were never committed durable too.
+    size_t len = make_payload(payload, 21);
+    CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(21, seen.count);
+    CU_ASSERT_EQUAL(1, seen.first);
+    CU_ASSERT_EQUAL(21, seen.last);
+    CU_ASSERT_EQUAL(0, seen.errors);
+    CU_ASSERT_EQUAL(21, lsn);
+
+    // Test replay skips what it is told to, and stops when told to.
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 15, replay_check, &seen, NULL));
+    CU_ASSERT_EQUAL(6, seen.count);
+    CU_ASSERT_EQUAL(16, seen.first);
+    CU_ASSERT_EQUAL(-1, wal_replay(path, 0, replay_fail, NULL, NULL));
+
+    // Test a reopened log goes on numbering where it stopped.
+    p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL != p_wal)
+    {
+        len = make_payload(payload, 22);
+        CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+        CU_ASSERT_EQUAL(22, lsn);
+        CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    }
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(22, seen.count);
+    CU_ASSERT_EQUAL(0, seen.errors);
+
+    remove_log(path, true);
+}
+
+/*!
+ * @brief This function tests a record torn or corrupted by a crash ends
+ *          the log, and is cut off when the log is reopened.
+ */
+void
+test_wal_torn (void)
+{
+    char path[PATH_SIZE];
+    make_path(path);
+    unsigned char payload[WAL_MAX_RECORD] = {0};
+    uint64_t lsn = 0;
+    wal_attr_t attr;
+    CU_ASSERT_EQUAL(0, wal_attr_init(&attr));
+
+    wal_t * p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+    off_t sizes[11] = {0};
+    for (uint64_t tag = 1; tag <= 10; ++tag)
+    {
+        size_t len = make_payload(payload, tag);
+        CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+        sizes[tag] = sizes[tag - 1] + (off_t) (WAL_HEADER_SIZE + len);
+    }
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+
+    // Tear the last record.
+    char segment[PATH_SIZE];
+    segment_path(segment, path, 1);
+    CU_ASSERT_EQUAL(0, truncate(segment, sizes[10] - 3));
+    replay_seen_t seen = {0};
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(9, seen.count);
+    CU_ASSERT_EQUAL(9, lsn);
+
+    // Corrupt a byte of the eighth record's payload.
+    FILE * p_file = fopen(segment, "r+b");
+    CU_ASSERT_PTR_NOT_NULL(p_file);
+    if (NULL != p_file)
+    {
+        fseek(p_file, sizes[7] + WAL_HEADER_SIZE, SEEK_SET);
+        fputc(0xAA, p_file);
+        fclose(p_file);
+    }
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(7, seen.count);
+    CU_ASSERT_EQUAL(7, lsn);
+
+    // Test reopening goes on after the whole records, in a new segment.
+    p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL != p_wal)
+    {
+        size_t len = make_payload(payload, 8);
+        CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+        CU_ASSERT_EQUAL(8, lsn);
+        CU_ASSERT_EQUAL(0, wal_commit(p_wal, lsn));
+        CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    }
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(8, seen.count);
+    CU_ASSERT_EQUAL(0, seen.errors);
+    CU_ASSERT_EQUAL(8, lsn);
+    CU_ASSERT_EQUAL(2, remove_log(path, false));
+
+    remove_log(path, true);
+}
+
+/*!
+ * @brief This function tests the log is split into segments, that replay
+ *          reads only the segments from the record it starts at, and
+ *          that truncating removes only segments wholly before a record.
+ */
+void
+test_wal_segments (void)
+{
+    char path[PATH_SIZE];
+    make_path(path);
+    unsigned char payload[WAL_MAX_RECORD] = {0};
+    uint64_t lsn = 0;
+    wal_attr_t attr;
+    CU_ASSERT_EQUAL(0, wal_attr_init(&attr));
+    attr.segment_size = 1024;
+
+    // Committing each record makes each its own batch, so a segment
+    // holds about a kilobyte.
+    wal_t * p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+    for (uint64_t tag = 1; tag <= 100; ++tag)
+    {
+        size_t len = make_payload(payload, tag);
+        CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+        CU_ASSERT_EQUAL(0, wal_commit(p_wal, lsn));
+    }
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+    size_t segments = remove_log(path, false);
+    CU_ASSERT(segments >= 5);
+    replay_seen_t seen = {0};
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(100, seen.count);
+    CU_ASSERT_EQUAL(0, seen.errors);
+    CU_ASSERT_EQUAL(100, lsn);
+
+    // Wreck the first record. A replay from the start now finds records
+    // missing, but one from near the end never reads that far back.
+    char segment[PATH_SIZE];
+    segment_path(segment, path, 1);
+    FILE * p_file = fopen(segment, "r+b");
+    CU_ASSERT_PTR_NOT_NULL(p_file);
+    if (NULL != p_file)
+    {
+        fputc(0xAA, p_file);
+        fclose(p_file);
+    }
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, wal_replay(path, 0, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(ENODATA, errno);
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 90, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(10, seen.count);
+    CU_ASSERT_EQUAL(91, seen.first);
+    CU_ASSERT_EQUAL(0, seen.errors);
+    CU_ASSERT_EQUAL(100, lsn);
+
+    // Test a log opened with where replay found it ends goes on from
+    // there, and is refused a number its segments are past.
+    attr.last_lsn = 50;
+    errno = 0;
+    CU_ASSERT_PTR_NULL(wal_open(path, &attr));
+    CU_ASSERT_EQUAL(EINVAL, errno);
+    attr.last_lsn = lsn;
+    p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+    size_t len = make_payload(payload, 101);
+    CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+    CU_ASSERT_EQUAL(101, lsn);
+    CU_ASSERT_EQUAL(0, wal_commit(p_wal, lsn));
+
+    // Test truncating keeps the segment holding the record after the
+    // number, and always the one being appended to.
+    CU_ASSERT_EQUAL(0, wal_truncate(p_wal, 90));
+    CU_ASSERT(remove_log(path, false) < segments);
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 90, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(11, seen.count);
+    CU_ASSERT_EQUAL(101, lsn);
+    CU_ASSERT_EQUAL(0, wal_truncate(p_wal, 200));
+    CU_ASSERT_EQUAL(1, remove_log(path, false));
+    errno = 0;
+    CU_ASSERT_EQUAL(-1, wal_replay(path, 90, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(ENODATA, errno);
+    memset(&seen, 0, sizeof(seen));
+    CU_ASSERT_EQUAL(0, wal_replay(path, 100, replay_check, &seen, &lsn));
+    CU_ASSERT_EQUAL(1, seen.count);
+    CU_ASSERT_EQUAL(0, seen.errors);
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+
+    remove_log(path, true);
+}
+
+/*!
+ * @brief This function tests the flusher holds a batch open for its
+ *          delay, but starts it early once it is large enough.
+ */
+void
+test_wal_batch (void)
+{
+    char path[PATH_SIZE];
+    make_path(path);
+    unsigned char payload[WAL_MAX_RECORD] = {0};
+    uint64_t lsn = 0;
+    wal_attr_t attr;
+    CU_ASSERT_EQUAL(0, wal_attr_init(&attr));
+    attr.max_delay_us = 200000;
+    attr.max_batch = 100 * WAL_HEADER_SIZE;
+
+    wal_t * p_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(p_wal);
+    if (NULL == p_wal)
+    {
+        return;
+    }
+
+    // Records appended well within the delay go out in a single batch.
+    for (uint64_t tag = 1; tag <= 10; ++tag)
+    {
+        size_t len = make_payload(payload, 1);
+        CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+    }
+    uint64_t start_ns = now_ns();
+    CU_ASSERT_EQUAL(0, wal_commit(p_wal, lsn));
+    uint64_t waited_ns = now_ns() - start_ns;
+    wal_stats_t stats;
+    CU_ASSERT_EQUAL(0, wal_stats_snapshot(p_wal, &stats));
+    CU_ASSERT_EQUAL(1, stats.batches);
+    CU_ASSERT_EQUAL(1, stats.batch_hist[3]);
+    CU_ASSERT(waited_ns > 100000000u);
+
+    // A batch past the size bound does not wait out the delay.
+    start_ns = now_ns();
+    for (uint64_t tag = 1; tag <= 100; ++tag)
+    {
+        size_t len = make_payload(payload, 1);
+        CU_ASSERT_EQUAL(0, wal_append(p_wal, payload, len, &lsn));
+    }
+    CU_ASSERT_EQUAL(0, wal_commit(p_wal, lsn));
+    waited_ns = now_ns() - start_ns;
+    CU_ASSERT(waited_ns < 100000000u);
+    CU_ASSERT_EQUAL(0, wal_close(p_wal));
+
+    replay_seen_t seen = {0};
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, NULL, &seen, &lsn));
+    CU_ASSERT_EQUAL(110, lsn);
+    remove_log(path, true);
+}
+
+/*!
+ * @brief Group commit test parameters.
+ */
+#define GROUP_WORKERS 16
+#define GROUP_JOBS 64
+#define GROUP_COMMITS 50
+#define GROUP_SERIAL_MS 500
+
+static wal_t * gp_group_wal = NULL;
+static _Atomic size_t g_group_errors = 0;
+
+/*!
+ * @brief This function appends records and waits for each to be
+ *          durable before appending the next, as a request handler would.
+ */
+static void
+group_commit (_Atomic bool * pb_shutdown, void * p_arg)
+{
+    (void) pb_shutdown;
+    unsigned char payload[WAL_MAX_RECORD];
+    size_t len = make_payload(payload, (uintptr_t) p_arg);
+    for (size_t i = 0; i < GROUP_COMMITS; ++i)
+    {
+        uint64_t lsn = 0;
+        if ((0 != wal_append(gp_group_wal, payload, len, &lsn)) ||
+            (0 != wal_commit(gp_group_wal, lsn)))
+        {
+            atomic_fetch_add(&g_group_errors, 1);
+        }
+    }
+}
+
+/*!
+ * @brief This is a replay function that counts records and checks they
+ *          are whole.
+ */
+static int
+replay_count (const uint64_t lsn, const void * p_data, const size_t len, void * p_ctx)
+{
+    (void) lsn;
+    replay_seen_t * p_seen = p_ctx;
+    const unsigned char * p_byte = p_data;
+    unsigned char expected[WAL_MAX_RECORD];
+    if ((len != make_payload(expected, p_byte[0])) ||
+        (0 != memcmp(expected, p_data, len)))
+    {
+        p_seen->errors++;
+    }
+    p_seen->count++;
+    return 0;
+}
+
+/*!
+ * @brief This function tests many pool threads committing at once share
+ *          syncs, and compares their throughput with committing one
+ *          record per sync.
+ */
+void
+test_wal_group (void)
+{
+    char path[PATH_SIZE];
+    make_path(path);
+    wal_attr_t attr;
+    CU_ASSERT_EQUAL(0, wal_attr_init(&attr));
+    gp_group_wal = wal_open(path, &attr);
+    CU_ASSERT_PTR_NOT_NULL(gp_group_wal);
+    if (NULL == gp_group_wal)
+    {
+        return;
+    }
+
+    // One committer at a time pays a sync per record.
+    unsigned char payload[WAL_MAX_RECORD];
+    size_t len = make_payload(payload, 0);
+    size_t serial = 0;
+    uint64_t start_ns = now_ns();
+    while ((now_ns() - start_ns) < (GROUP_SERIAL_MS * 1000000u))
+    {
+        uint64_t lsn = 0;
+        CU_ASSERT_EQUAL(0, wal_append(gp_group_wal, payload, len, &lsn));
+        CU_ASSERT_EQUAL(0, wal_commit(gp_group_wal, lsn));
+        serial++;
+    }
+    double serial_rate = (double) serial * 1e9 / (double) (now_ns() - start_ns);
+    wal_stats_t before;
+    CU_ASSERT_EQUAL(0, wal_stats_snapshot(gp_group_wal, &before));
+
+    // Many committers at once share them.
+    threadpool_t * p_tp = threadpool_create(GROUP_WORKERS);
+    CU_ASSERT_PTR_NOT_NULL(p_tp);
+    if (NULL == p_tp)
+    {
+        wal_close(gp_group_wal);
+        return;
+    }
+    atomic_store(&g_group_errors, 0);
+    start_ns = now_ns();
+    for (size_t job = 0; job < GROUP_JOBS; ++job)
+    {
+        CU_ASSERT_EQUAL(0, threadpool_enq(p_tp, group_commit, (void *) (job + 1)));
+    }
+    CU_ASSERT_EQUAL(0, threadpool_wait_idle(p_tp));
+    double group_rate = (double) (GROUP_JOBS * GROUP_COMMITS) * 1e9 /
+                        (double) (now_ns() - start_ns);
+    threadpool_destroy(p_tp);
+    CU_ASSERT_EQUAL(0, atomic_load(&g_group_errors));
+
+    wal_stats_t after;
+    CU_ASSERT_EQUAL(0, wal_stats_snapshot(gp_group_wal, &after));
+    uint64_t batches = after.batches - before.batches;
+    CU_ASSERT_EQUAL(serial + (GROUP_JOBS * GROUP_COMMITS), after.records);
+    CU_ASSERT_EQUAL(after.records, after.durable);
+    CU_ASSERT(batches < (GROUP_JOBS * GROUP_COMMITS));
+    printf("one committer: %.0f commits/s, %d committers: %.0f commits/s, "
+           "%.1f records per sync\n", serial_rate, GROUP_WORKERS, group_rate,
+           (double) (GROUP_JOBS * GROUP_COMMITS) / (double) batches);
+    printf("commit latency log2(ns) histogram:");
+    for (size_t idx = 0; idx < WAL_HIST_BUCKETS; ++idx)
+    {
+        if (0 != after.commit_hist[idx])
+        {
+            printf(" %zu:%lu", idx, (unsigned long) after.commit_hist[idx]);
+        }
+    }
+    printf("\n");
+    CU_ASSERT_EQUAL(0, wal_close(gp_group_wal));
+    gp_group_wal = NULL;
+
+    // Test every record made it to the file whole.
+    replay_seen_t seen = {0};
+    CU_ASSERT_EQUAL(0, wal_replay(path, 0, replay_count, &seen, NULL));
+    CU_ASSERT_EQUAL(serial + (GROUP_JOBS * GROUP_COMMITS), seen.count);
+    CU_ASSERT_EQUAL(0, seen.errors);
+    remove_log(path, true);
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"wal basic test", test_wal_basic},
+        {"wal torn test", test_wal_torn},
+        {"wal segments test", test_wal_segments},
+        {"wal batch test", test_wal_batch},
+        {"wal group test", test_wal_group},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"wal test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/
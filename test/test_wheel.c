@@ -0,0 +1,259 @@
+/*!
+ * @file test_wheel.c
+ *
+ * @brief This file contains a self-contained test battery for the
+ *          timing wheel implemented in source/common/wheel.h
+ */
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnitCI.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../source/common/wheel.h"
+
+/*!
+ * @brief This function counts the timers in a list returned by
+ *          wheel_advance, and checks each expired on the given tick.
+ */
+static size_t
+count_expired (wheel_timer_t * p_timer, const uint64_t tick)
+{
+    size_t count = 0;
+    while (NULL != p_timer)
+    {
+        CU_ASSERT_EQUAL(tick, p_timer->expiry);
+        CU_ASSERT_PTR_NULL(p_timer->p_prev);
+        count++;
+        p_timer = p_timer->p_next;
+    }
+    return count;
+}
+
+/*!
+ * @brief This function tests wheel_add, wheel_remove and wheel_size.
+ */
+void
+test_wheel_add_remove (void)
+{
+    wheel_timer_t timers[3];
+    memset(timers, 0, sizeof(timers));
+    wheel_t * p_wheel = wheel_create(0);
+    CU_ASSERT_PTR_NOT_NULL(p_wheel);
+    if (NULL == p_wheel)
+    {
+        return;
+    }
+
+    // Test NULL parameters.
+    CU_ASSERT_EQUAL(-1, wheel_add(NULL, timers + 0, 1));
+    CU_ASSERT_EQUAL(-1, wheel_add(p_wheel, NULL, 1));
+    CU_ASSERT_EQUAL(-1, wheel_remove(NULL, timers + 0));
+    CU_ASSERT_EQUAL(-1, wheel_remove(p_wheel, NULL));
+    CU_ASSERT_PTR_NULL(wheel_advance(NULL, 1));
+    CU_ASSERT_EQUAL(UINT64_MAX, wheel_next(NULL));
+    CU_ASSERT_EQUAL(0, wheel_size(NULL));
+
+    // Test an empty wheel.
+    CU_ASSERT_EQUAL(UINT64_MAX, wheel_next(p_wheel));
+    CU_ASSERT_EQUAL(-1, wheel_remove(p_wheel, timers + 0));
+
+    // Test a timer cannot be armed twice.
+    CU_ASSERT_EQUAL(0, wheel_add(p_wheel, timers + 0, 10));
+    CU_ASSERT_EQUAL(-1, wheel_add(p_wheel, timers + 0, 20));
+    CU_ASSERT_EQUAL(0, wheel_add(p_wheel, timers + 1, 10));
+    CU_ASSERT_EQUAL(0, wheel_add(p_wheel, timers + 2, 100000));
+    CU_ASSERT_EQUAL(3, wheel_size(p_wheel));
+    CU_ASSERT_EQUAL(10, wheel_next(p_wheel));
+
+    // Test a removed timer does not expire.
+    CU_ASSERT_EQUAL(0, wheel_remove(p_wheel, timers + 0));
+    CU_ASSERT_EQUAL(-1, wheel_remove(p_wheel, timers + 0));
+    CU_ASSERT_EQUAL(2, wheel_size(p_wheel));
+    wheel_timer_t * p_expired = wheel_advance(p_wheel, 50);
+    CU_ASSERT_PTR_EQUAL(timers + 1, p_expired);
+    CU_ASSERT_EQUAL(1, count_expired(p_expired, 10));
+    CU_ASSERT_EQUAL(1, wheel_size(p_wheel));
+
+    // Test an expired timer can be armed again.
+    CU_ASSERT_EQUAL(-1, wheel_remove(p_wheel, timers + 1));
+    CU_ASSERT_EQUAL(0, wheel_add(p_wheel, timers + 1, 60));
+    CU_ASSERT_EQUAL(60, wheel_next(p_wheel));
+
+    // Test a timer due in the past expires on the next tick.
+    CU_ASSERT_EQUAL(0, wheel_add(p_wheel, timers + 0, 5));
+    CU_ASSERT_EQUAL(51, timers[0].expiry);
+    CU_ASSERT_EQUAL(1, count_expired(wheel_advance(p_wheel, 51), 51));
+    CU_ASSERT_EQUAL(1, count_expired(wheel_advance(p_wheel, 60), 60));
+
+    // Test advancing backwards does nothing.
+    CU_ASSERT_PTR_NULL(wheel_advance(p_wheel, 1));
+    CU_ASSERT_EQUAL(0, wheel_remove(p_wheel, timers + 2));
+    CU_ASSERT_EQUAL(0, wheel_size(p_wheel));
+
+    wheel_destroy(p_wheel);
+}
+
+/*!
+ * @brief This function tests timers on every level, and beyond the
+ *          wheel's span, expire exactly on their tick.
+ */
+void
+test_wheel_levels (void)
+{
+    const uint64_t start = 1000;
+    const uint64_t delays[] =
+    {
+        1, 255, 256, 257, 65535, 65536, 70000,
+        (UINT64_C(1) << 24) + 3, (UINT64_C(1) << 32) + 5,
+    };
+    const size_t num_delays = sizeof(delays) / sizeof(delays[0]);
+    wheel_timer_t timers[sizeof(delays) / sizeof(delays[0])];
+    memset(timers, 0, sizeof(timers));
+
+    wheel_t * p_wheel = wheel_create(start);
+    CU_ASSERT_PTR_NOT_NULL(p_wheel);
+    if (NULL == p_wheel)
+    {
+        return;
+    }
+    for (size_t i = 0; i < num_delays; ++i)
+    {
+        CU_ASSERT_EQUAL(0, wheel_add(p_wheel, timers + i, start + delays[i]));
+    }
+
+    // Advance to one tick before each expiry, then onto it.
+    for (size_t i = 0; i < num_delays; ++i)
+    {
+        uint64_t expiry = start + delays[i];
+        CU_ASSERT_PTR_NULL(wheel_advance(p_wheel, expiry - 1));
+        CU_ASSERT_TRUE(wheel_next(p_wheel) <= expiry);
+        wheel_timer_t * p_expired = wheel_advance(p_wheel, expiry);
+        CU_ASSERT_PTR_EQUAL(timers + i, p_expired);
+        CU_ASSERT_EQUAL(1, count_expired(p_expired, expiry));
+    }
+    CU_ASSERT_EQUAL(0, wheel_size(p_wheel));
+
+    wheel_destroy(p_wheel);
+}
+
+/*!
+ * @brief Stress test parameters.
+ */
+#define STRESS_TIMERS 20000
+#define STRESS_SPAN 200000
+#define STRESS_STEP 97
+
+static wheel_timer_t g_stress_timers[STRESS_TIMERS];
+static unsigned char g_stress_fired[STRESS_TIMERS];
+
+/*!
+ * @brief This function arms many timers with pseudo-random expiries,
+ *          removes some, advances in uneven steps, and checks every
+ *          remaining timer fires exactly once and never early.
+ */
+void
+test_wheel_stress (void)
+{
+    memset(g_stress_timers, 0, sizeof(g_stress_timers));
+    memset(g_stress_fired, 0, sizeof(g_stress_fired));
+    wheel_t * p_wheel = wheel_create(0);
+    CU_ASSERT_PTR_NOT_NULL(p_wheel);
+    if (NULL == p_wheel)
+    {
+        return;
+    }
+
+    uint64_t seed = 88172645463325252u;
+    for (size_t i = 0; i < STRESS_TIMERS; ++i)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        CU_ASSERT_EQUAL(0, wheel_add(p_wheel, g_stress_timers + i, 1 + (seed % STRESS_SPAN)));
+    }
+    for (size_t i = 0; i < STRESS_TIMERS; i += 3)
+    {
+        CU_ASSERT_EQUAL(0, wheel_remove(p_wheel, g_stress_timers + i));
+        g_stress_fired[i] = 1;
+    }
+
+    size_t errors = 0;
+    uint64_t now = 0;
+    while (now < STRESS_SPAN)
+    {
+        now += STRESS_STEP;
+        for (wheel_timer_t * p_timer = wheel_advance(p_wheel, now);
+             NULL != p_timer;
+             p_timer = p_timer->p_next)
+        {
+            size_t idx = (size_t) (p_timer - g_stress_timers);
+            if ((p_timer->expiry > now) ||
+                (p_timer->expiry + STRESS_STEP <= now) ||
+                (0 != g_stress_fired[idx]))
+            {
+                errors++;
+            }
+            g_stress_fired[idx] = 1;
+        }
+    }
+    for (size_t i = 0; i < STRESS_TIMERS; ++i)
+    {
+        if (1 != g_stress_fired[i])
+        {
+            errors++;
+        }
+    }
+    printf("errors: %zu\n", errors);
+    CU_ASSERT_EQUAL(0, errors);
+    CU_ASSERT_EQUAL(0, wheel_size(p_wheel));
+
+    wheel_destroy(p_wheel);
+}
+
+int
+main ()
+{
+    // Initialize the CUnit test registry.
+    if (CUE_SUCCESS != CU_initialize_registry())
+    {
+        goto EXIT;
+    }
+
+    // Set verbose mode.
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    // Create test battery array.
+    CU_TestInfo tests[] =
+    {
+        {"wheel add/remove test", test_wheel_add_remove},
+        {"wheel levels test", test_wheel_levels},
+        {"wheel stress test", test_wheel_stress},
+        CU_TEST_INFO_NULL,
+    };
+
+    // Create test suites.
+    CU_SuiteInfo suites[] =
+    {
+        {"wheel test suite", NULL, NULL, NULL, NULL, tests},
+        CU_SUITE_INFO_NULL,
+    };
+
+    // Register suites.
+    if (CUE_SUCCESS != CU_register_suites(suites))
+    {
+        fprintf(stderr, "Register suites failed - %s\n", CU_get_error_msg());
+        goto EXIT;
+    }
+
+    // Run basic tests.
+    CU_basic_run_tests();
+
+    EXIT:
+        CU_cleanup_registry();
+        return CU_get_error();
+}
+
+/***   end of file   ***/